@@ -0,0 +1,74 @@
+#!/usr/bin/python3
+# Renders a file written by plymouthd's trace points (booted with
+# plymouth.trace-points) as text, one line per entry:
+#
+#   plymouth-decode-trace-points.py /var/log/plymouth-trace-points.bin
+#
+# The file is in the byte order of the machine that recorded it, so
+# --big-endian is there for looking at one from somewhere else.
+import argparse
+import struct
+import sys
+
+MAGIC = b'PLYTRACE'
+VERSION = 1
+MAX_ARGUMENTS = 4
+
+def decode(data, byte_order):
+    header = struct.Struct(byte_order + '8sIIQ')
+    point = struct.Struct(byte_order + 'III')
+    entry = struct.Struct(byte_order + 'QII%dq' % MAX_ARGUMENTS)
+
+    magic, version, number_of_points, number_of_entries = header.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('not a plymouth trace points file')
+    if version != VERSION:
+        raise ValueError('unsupported trace points file version %d' % version)
+
+    offset = header.size
+    points = {}
+    for i in range(number_of_points):
+        point_id, name_length, format_length = point.unpack_from(data, offset)
+        offset += point.size
+        name = data[offset:offset + name_length].decode('utf-8', 'replace')
+        offset += name_length
+        format = data[offset:offset + format_length].decode('utf-8', 'replace')
+        offset += format_length
+        points[point_id] = (name, format)
+
+    first_timestamp = None
+    for i in range(number_of_entries):
+        timestamp, point_id, _, *arguments = entry.unpack_from(data, offset)
+        offset += entry.size
+
+        if first_timestamp is None:
+            first_timestamp = timestamp
+
+        name, format = points.get(point_id, ('unknown-%d' % point_id, ''))
+        # Formats take as many arguments as they have conversions
+        number_of_conversions = format.replace('%%', '').count('%')
+        try:
+            text = format % tuple(arguments[:number_of_conversions])
+        except (TypeError, ValueError):
+            text = '%s %s' % (format, ' '.join(str(a) for a in arguments))
+
+        yield '%12.6f %-40s %s' % ((timestamp - first_timestamp) / 1e9, name, text)
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode plymouth trace points')
+    parser.add_argument('file', help='file written by plymouthd')
+    parser.add_argument('--big-endian', action='store_true',
+                        help='the file was recorded on a big endian machine')
+    args = parser.parse_args()
+
+    with open(args.file, 'rb') as f:
+        data = f.read()
+
+    try:
+        for line in decode(data, '>' if args.big_endian else '<'):
+            print(line)
+    except (ValueError, struct.error) as error:
+        sys.exit('%s: %s' % (args.file, error))
+
+if __name__ == '__main__':
+    main()
@@ -23,14 +23,20 @@
 #include "ply-boot-client.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "ply-array.h"
+#include "ply-buffer.h"
 #include "ply-event-loop.h"
 #include "ply-list.h"
 #include "ply-logger.h"
@@ -48,7 +54,20 @@ struct _ply_boot_client
         ply_boot_client_disconnect_handler_t disconnect_handler;
         void                                *disconnect_handler_user_data;
 
+        uint32_t                             next_request_id;
+
+        /* shared with the daemon, see ply_boot_client_update_progress_channel */
+        ply_boot_protocol_progress_record_t *progress_record;
+        int                                  progress_channel_fd;
+
         uint32_t                             is_connected : 1;
+        uint32_t                             progress_channel_is_unsupported : 1;
+
+        /* whether the daemon has said it takes batched requests, and
+         * whether we're still waiting to hear */
+        uint32_t                             can_batch_requests : 1;
+        uint32_t                             has_asked_about_batching : 1;
+        uint32_t                             is_asking_about_batching : 1;
 };
 
 typedef struct
@@ -59,10 +78,18 @@ typedef struct
         ply_boot_client_response_handler_t handler;
         ply_boot_client_response_handler_t failed_handler;
         void                              *user_data;
+
+        /* passed along with the request, but not owned by it */
+        int                                fd;
+
+        /* set when sent in a batch, to match up the batched reply */
+        uint32_t                           id;
+        uint32_t                           is_batched : 1;
 } ply_boot_client_request_t;
 
 static void ply_boot_client_cancel_request (ply_boot_client_t         *client,
                                             ply_boot_client_request_t *request);
+static void ply_boot_client_process_pending_requests (ply_boot_client_t *client);
 
 ply_boot_client_t *
 ply_boot_client_new (void)
@@ -78,6 +105,7 @@ ply_boot_client_new (void)
         client->is_connected = false;
         client->disconnect_handler = NULL;
         client->disconnect_handler_user_data = NULL;
+        client->progress_channel_fd = -1;
 
         return client;
 }
@@ -162,6 +190,11 @@ ply_boot_client_free (ply_boot_client_t *client)
         ply_list_free (client->requests_to_send);
         ply_list_free (client->requests_waiting_for_replies);
 
+        if (client->progress_record != NULL)
+                munmap (client->progress_record, sizeof(ply_boot_protocol_progress_record_t));
+        if (client->progress_channel_fd >= 0)
+                close (client->progress_channel_fd);
+
         free (client);
 }
 
@@ -220,6 +253,7 @@ ply_boot_client_request_new (ply_boot_client_t                 *client,
         request->handler = handler;
         request->failed_handler = failed_handler;
         request->user_data = user_data;
+        request->fd = -1;
 
         return request;
 }
@@ -245,6 +279,82 @@ ply_boot_client_cancel_request (ply_boot_client_t         *client,
         ply_boot_client_request_free (request);
 }
 
+static void
+ply_boot_client_stop_watching_for_replies_if_done (ply_boot_client_t *client)
+{
+        if (ply_list_get_length (client->requests_waiting_for_replies) == 0) {
+                if (client->daemon_has_reply_watch != NULL) {
+                        assert (client->loop != NULL);
+                        ply_event_loop_stop_watching_fd (client->loop,
+                                                         client->daemon_has_reply_watch);
+                        client->daemon_has_reply_watch = NULL;
+                }
+        }
+}
+
+static ply_list_node_t *
+ply_boot_client_find_batched_request_node (ply_boot_client_t *client,
+                                           uint32_t           id)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (client->requests_waiting_for_replies);
+        while (node != NULL) {
+                ply_boot_client_request_t *request;
+
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (node);
+
+                if (request->is_batched && request->id == id)
+                        break;
+
+                node = ply_list_get_next_node (client->requests_waiting_for_replies, node);
+        }
+
+        return node;
+}
+
+static void
+ply_boot_client_process_batched_replies (ply_boot_client_t *client)
+{
+        uint32_t number_of_replies, i;
+
+        if (!ply_read_uint32 (client->socket_fd, &number_of_replies))
+                return;
+
+        for (i = 0; i < number_of_replies; i++) {
+                ply_list_node_t *request_node;
+                ply_boot_client_request_t *request;
+                uint8_t reply[5];
+                uint32_t id;
+
+                if (!ply_read (client->socket_fd, reply, sizeof(reply)))
+                        break;
+
+                id = reply[0] | (reply[1] << 8) | (reply[2] << 16) | ((uint32_t) reply[3] << 24);
+
+                request_node = ply_boot_client_find_batched_request_node (client, id);
+
+                if (request_node == NULL) {
+                        ply_error ("received reply for unknown batched request %u", id);
+                        continue;
+                }
+
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
+                ply_list_remove_node (client->requests_waiting_for_replies, request_node);
+
+                if (memcmp (reply + 4, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK, sizeof(uint8_t)) == 0) {
+                        if (request->handler != NULL)
+                                request->handler (request->user_data, client);
+                } else if (request->failed_handler != NULL) {
+                        request->failed_handler (request->user_data, client);
+                }
+
+                ply_boot_client_request_free (request);
+        }
+
+        ply_boot_client_stop_watching_for_replies_if_done (client);
+}
+
 static void
 ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
 {
@@ -262,13 +372,35 @@ ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
                 return;
         }
 
+        if (!ply_read (client->socket_fd, byte, sizeof(uint8_t)))
+                byte[0] = '\0';
+
+        if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_BATCH, sizeof(uint8_t)) == 0) {
+                ply_boot_client_process_batched_replies (client);
+                return;
+        }
+
+        /* Batched requests get their replies in a batch, so this is for
+         * the oldest request that went out on its own
+         */
         request_node = ply_list_get_first_node (client->requests_waiting_for_replies);
-        assert (request_node != NULL);
+        while (request_node != NULL) {
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
+
+                if (!request->is_batched)
+                        break;
+
+                request_node = ply_list_get_next_node (client->requests_waiting_for_replies, request_node);
+        }
+
+        if (request_node == NULL) {
+                ply_error ("received unexpected response from boot status daemon");
+                return;
+        }
 
-        request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
         assert (request != NULL);
 
-        if (!ply_read (client->socket_fd, byte, sizeof(uint8_t)))
+        if (byte[0] == '\0')
                 goto out;
 
         if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK, sizeof(uint8_t)) == 0) {
@@ -350,14 +482,7 @@ out:
 
         ply_list_remove_node (client->requests_waiting_for_replies, request_node);
 
-        if (ply_list_get_length (client->requests_waiting_for_replies) == 0) {
-                if (client->daemon_has_reply_watch != NULL) {
-                        assert (client->loop != NULL);
-                        ply_event_loop_stop_watching_fd (client->loop,
-                                                         client->daemon_has_reply_watch);
-                        client->daemon_has_reply_watch = NULL;
-                }
-        }
+        ply_boot_client_stop_watching_for_replies_if_done (client);
 }
 
 static char *
@@ -389,6 +514,66 @@ ply_boot_client_get_request_string (ply_boot_client_t         *client,
         return request_string;
 }
 
+static void
+ply_boot_client_watch_for_replies (ply_boot_client_t *client)
+{
+        if (client->daemon_has_reply_watch != NULL)
+                return;
+
+        assert (ply_list_get_length (client->requests_waiting_for_replies) == 0);
+        client->daemon_has_reply_watch =
+                ply_event_loop_watch_fd (client->loop, client->socket_fd,
+                                         PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                         (ply_event_handler_t)
+                                         ply_boot_client_process_incoming_replies,
+                                         NULL, client);
+}
+
+/* The fd goes out alongside the first byte, the rest is written as usual */
+static bool
+ply_boot_client_write_with_fd (ply_boot_client_t *client,
+                               const char        *bytes,
+                               size_t             size,
+                               int                fd)
+{
+        union
+        {
+                struct cmsghdr header;
+                char           buffer[CMSG_SPACE (sizeof(int))];
+        } control;
+        struct cmsghdr *control_message;
+        struct msghdr message = { 0 };
+        struct iovec vector;
+        ssize_t bytes_written;
+
+        memset (&control, 0, sizeof(control));
+
+        vector.iov_base = (void *) bytes;
+        vector.iov_len = size;
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+
+        control_message = CMSG_FIRSTHDR (&message);
+        control_message->cmsg_level = SOL_SOCKET;
+        control_message->cmsg_type = SCM_RIGHTS;
+        control_message->cmsg_len = CMSG_LEN (sizeof(int));
+        memcpy (CMSG_DATA (control_message), &fd, sizeof(int));
+
+        do {
+                bytes_written = sendmsg (client->socket_fd, &message, MSG_NOSIGNAL);
+        } while (bytes_written < 0 && errno == EINTR);
+
+        if (bytes_written <= 0)
+                return false;
+
+        if ((size_t) bytes_written < size)
+                return ply_write (client->socket_fd, bytes + bytes_written, size - bytes_written);
+
+        return true;
+}
+
 static bool
 ply_boot_client_send_request (ply_boot_client_t         *client,
                               ply_boot_client_request_t *request)
@@ -401,25 +586,174 @@ ply_boot_client_send_request (ply_boot_client_t         *client,
 
         request_string = ply_boot_client_get_request_string (client, request,
                                                              &request_size);
-        if (!ply_write (client->socket_fd, request_string, request_size)) {
+
+        if (request->fd >= 0) {
+                if (!ply_boot_client_write_with_fd (client, request_string,
+                                                    request_size, request->fd)) {
+                        free (request_string);
+                        ply_boot_client_cancel_request (client, request);
+                        return false;
+                }
+        } else if (!ply_write (client->socket_fd, request_string, request_size)) {
                 free (request_string);
                 ply_boot_client_cancel_request (client, request);
                 return false;
         }
         free (request_string);
 
-        if (client->daemon_has_reply_watch == NULL) {
-                assert (ply_list_get_length (client->requests_waiting_for_replies) == 0);
-                client->daemon_has_reply_watch =
-                        ply_event_loop_watch_fd (client->loop, client->socket_fd,
-                                                 PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
-                                                 (ply_event_handler_t)
-                                                 ply_boot_client_process_incoming_replies,
-                                                 NULL, client);
-        }
+        ply_boot_client_watch_for_replies (client);
         return true;
 }
 
+/* Only requests that get an ACK or NAK right away can go in a batch */
+static bool
+ply_boot_client_request_can_be_batched (ply_boot_client_request_t *request)
+{
+        return strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PASSWORD) != 0 &&
+               strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_CACHED_PASSWORD) != 0 &&
+               strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUESTION) != 0 &&
+               strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_KEYSTROKE) != 0 &&
+               strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_DEACTIVATE) != 0 &&
+               strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUIT) != 0 &&
+               strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_STATISTICS) != 0 &&
+               request->fd < 0;
+}
+
+static void
+ply_boot_client_watch_for_room_to_send (ply_boot_client_t *client)
+{
+        if (client->daemon_can_take_request_watch != NULL ||
+            client->loop == NULL ||
+            client->socket_fd < 0 ||
+            ply_list_get_length (client->requests_to_send) == 0)
+                return;
+
+        client->daemon_can_take_request_watch =
+                ply_event_loop_watch_fd (client->loop, client->socket_fd,
+                                         PLY_EVENT_LOOP_FD_STATUS_CAN_TAKE_DATA,
+                                         (ply_event_handler_t)
+                                         ply_boot_client_process_pending_requests,
+                                         NULL, client);
+}
+
+static void
+ply_boot_client_on_batching_supported (ply_boot_client_t *client)
+{
+        ply_trace ("daemon takes batched requests");
+        client->can_batch_requests = true;
+        client->is_asking_about_batching = false;
+        ply_boot_client_watch_for_room_to_send (client);
+}
+
+static void
+ply_boot_client_on_batching_unsupported (ply_boot_client_t *client)
+{
+        ply_trace ("daemon doesn't take batched requests");
+        client->can_batch_requests = false;
+        client->is_asking_about_batching = false;
+        ply_boot_client_watch_for_room_to_send (client);
+}
+
+/* Holds off sending anything else until the daemon says whether it
+ * takes batches
+ */
+static void
+ply_boot_client_ask_about_batching (ply_boot_client_t *client)
+{
+        ply_boot_client_request_t *request;
+
+        client->has_asked_about_batching = true;
+        client->is_asking_about_batching = true;
+
+        request = ply_boot_client_request_new (client,
+                                               PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH,
+                                               NULL,
+                                               (ply_boot_client_response_handler_t)
+                                               ply_boot_client_on_batching_supported,
+                                               (ply_boot_client_response_handler_t)
+                                               ply_boot_client_on_batching_unsupported,
+                                               client);
+
+        if (ply_boot_client_send_request (client, request))
+                ply_list_append_data (client->requests_waiting_for_replies, request);
+
+        if (client->is_asking_about_batching) {
+                ply_event_loop_stop_watching_fd (client->loop,
+                                                 client->daemon_can_take_request_watch);
+                client->daemon_can_take_request_watch = NULL;
+        }
+}
+
+static void
+ply_boot_client_send_batch (ply_boot_client_t *client)
+{
+        ply_list_t *batch;
+        ply_list_node_t *node;
+        ply_buffer_t *buffer;
+        uint8_t header[6];
+
+        batch = ply_list_new ();
+        buffer = ply_buffer_new ();
+
+        while ((node = ply_list_get_first_node (client->requests_to_send)) != NULL) {
+                ply_boot_client_request_t *request;
+                size_t argument_size;
+
+                request = (ply_boot_client_request_t *) ply_list_node_get_data (node);
+
+                if (!ply_boot_client_request_can_be_batched (request))
+                        break;
+
+                argument_size = request->argument != NULL ? strlen (request->argument) + 1 : 0;
+
+                if (ply_buffer_get_size (buffer) + sizeof(header) + argument_size > PLY_BOOT_PROTOCOL_MAX_BATCH_SIZE)
+                        break;
+
+                request->id = client->next_request_id++;
+                request->is_batched = true;
+
+                header[0] = (request->id >> 0) & 0xFF;
+                header[1] = (request->id >> 8) & 0xFF;
+                header[2] = (request->id >> 16) & 0xFF;
+                header[3] = (request->id >> 24) & 0xFF;
+                header[4] = request->command[0];
+                header[5] = argument_size;
+                ply_buffer_append_bytes (buffer, header, sizeof(header));
+
+                if (argument_size > 0)
+                        ply_buffer_append_bytes (buffer, request->argument, argument_size);
+
+                ply_list_remove_node (client->requests_to_send, node);
+                ply_list_append_data (batch, request);
+        }
+
+        ply_trace ("sending %d requests in one batch", ply_list_get_length (batch));
+
+        if (ply_write (client->socket_fd,
+                       PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH "\003",
+                       strlen (PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH) + 1) &&
+            ply_write_uint32 (client->socket_fd, ply_buffer_get_size (buffer)) &&
+            ply_write (client->socket_fd,
+                       ply_buffer_get_bytes (buffer),
+                       ply_buffer_get_size (buffer))) {
+                ply_boot_client_watch_for_replies (client);
+
+                while ((node = ply_list_get_first_node (batch)) != NULL) {
+                        ply_list_append_data (client->requests_waiting_for_replies,
+                                              ply_list_node_get_data (node));
+                        ply_list_remove_node (batch, node);
+                }
+        } else {
+                while ((node = ply_list_get_first_node (batch)) != NULL) {
+                        ply_boot_client_cancel_request (client, ply_list_node_get_data (node));
+                        ply_list_remove_node (batch, node);
+                }
+        }
+
+        ply_buffer_free (buffer);
+        ply_list_free (batch);
+}
+
 static void
 ply_boot_client_process_pending_requests (ply_boot_client_t *client)
 {
@@ -435,10 +769,28 @@ ply_boot_client_process_pending_requests (ply_boot_client_t *client)
         request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
         assert (request != NULL);
 
-        ply_list_remove_node (client->requests_to_send, request_node);
+        /* A burst of requests goes out in one batch, if the daemon can
+         * take them that way
+         */
+        if (ply_list_get_length (client->requests_to_send) > 1 &&
+            ply_boot_client_request_can_be_batched (request)) {
+                if (!client->has_asked_about_batching) {
+                        ply_boot_client_ask_about_batching (client);
+                        return;
+                }
 
-        if (ply_boot_client_send_request (client, request))
-                ply_list_append_data (client->requests_waiting_for_replies, request);
+                if (client->can_batch_requests) {
+                        ply_boot_client_send_batch (client);
+                        request_node = NULL;
+                }
+        }
+
+        if (request_node != NULL) {
+                ply_list_remove_node (client->requests_to_send, request_node);
+
+                if (ply_boot_client_send_request (client, request))
+                        ply_list_append_data (client->requests_waiting_for_replies, request);
+        }
 
         if (ply_list_get_length (client->requests_to_send) == 0) {
                 if (client->daemon_has_reply_watch != NULL) {
@@ -451,7 +803,7 @@ ply_boot_client_process_pending_requests (ply_boot_client_t *client)
         }
 }
 
-static void
+static ply_boot_client_request_t *
 ply_boot_client_queue_request (ply_boot_client_t                 *client,
                                const char                        *request_command,
                                const char                        *request_argument,
@@ -465,7 +817,8 @@ ply_boot_client_queue_request (ply_boot_client_t                 *client,
         assert (request_argument == NULL || strlen (request_argument) <= UCHAR_MAX);
 
         if (client->daemon_can_take_request_watch == NULL &&
-            client->socket_fd >= 0) {
+            client->socket_fd >= 0 &&
+            !client->is_asking_about_batching) {
                 assert (ply_list_get_length (client->requests_to_send) == 0);
                 client->daemon_can_take_request_watch =
                         ply_event_loop_watch_fd (client->loop, client->socket_fd,
@@ -485,7 +838,10 @@ ply_boot_client_queue_request (ply_boot_client_t                 *client,
                                                        request_argument,
                                                        handler, failed_handler, user_data);
                 ply_list_append_data (client->requests_to_send, request);
+                return request;
         }
+
+        return NULL;
 }
 
 void
@@ -758,6 +1114,19 @@ ply_boot_client_ask_daemon_has_active_vt (ply_boot_client_t                 *cli
                                        NULL, handler, failed_handler, user_data);
 }
 
+void
+ply_boot_client_ask_daemon_for_statistics (ply_boot_client_t                 *client,
+                                            ply_boot_client_answer_handler_t   handler,
+                                            ply_boot_client_response_handler_t failed_handler,
+                                            void                              *user_data)
+{
+        assert (client != NULL);
+
+        ply_boot_client_queue_request (client, PLY_BOOT_PROTOCOL_REQUEST_TYPE_STATISTICS,
+                                       NULL, (ply_boot_client_response_handler_t) handler,
+                                       failed_handler, user_data);
+}
+
 void
 ply_boot_client_tell_daemon_about_error (ply_boot_client_t                 *client,
                                          ply_boot_client_response_handler_t handler,
@@ -768,6 +1137,246 @@ ply_boot_client_tell_daemon_about_error (ply_boot_client_t                 *clie
                                        NULL, handler, failed_handler, user_data);
 }
 
+typedef struct
+{
+        const char *name;
+        const char *request_command;
+        bool        takes_argument;
+} ply_boot_client_command_t;
+
+static const ply_boot_client_command_t ply_boot_client_commands[] =
+{
+        { "ping",             PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING,               false },
+        { "update",           PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE,             true  },
+        { "change-mode",      PLY_BOOT_PROTOCOL_REQUEST_TYPE_CHANGE_MODE,        true  },
+        { "system-update",    PLY_BOOT_PROTOCOL_REQUEST_TYPE_SYSTEM_UPDATE,      true  },
+        { "display-message",  PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_MESSAGE,       true  },
+        { "message",          PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_MESSAGE,       true  },
+        { "hide-message",     PLY_BOOT_PROTOCOL_REQUEST_TYPE_HIDE_MESSAGE,       true  },
+        { "sysinit",          PLY_BOOT_PROTOCOL_REQUEST_TYPE_SYSTEM_INITIALIZED, false },
+        { "newroot",          PLY_BOOT_PROTOCOL_REQUEST_TYPE_NEWROOT,            true  },
+        { "show-splash",      PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_SPLASH,        false },
+        { "hide-splash",      PLY_BOOT_PROTOCOL_REQUEST_TYPE_HIDE_SPLASH,        false },
+        { "pause-progress",   PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_PAUSE,     false },
+        { "unpause-progress", PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_UNPAUSE,   false },
+        { "report-error",     PLY_BOOT_PROTOCOL_REQUEST_TYPE_ERROR,              false },
+        { "has-active-vt",    PLY_BOOT_PROTOCOL_REQUEST_TYPE_HAS_ACTIVE_VT,      false },
+        { "deactivate",       PLY_BOOT_PROTOCOL_REQUEST_TYPE_DEACTIVATE,         false },
+        { "reactivate",       PLY_BOOT_PROTOCOL_REQUEST_TYPE_REACTIVATE,         false },
+        { "quit",             PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUIT,               false },
+        { NULL }
+};
+
+bool
+ply_boot_client_queue_command_line (ply_boot_client_t                 *client,
+                                    const char                        *command_line,
+                                    ply_boot_client_response_handler_t handler,
+                                    ply_boot_client_response_handler_t failed_handler,
+                                    void                              *user_data)
+{
+        const ply_boot_client_command_t *command;
+        const char *argument_start;
+        char *name, *argument;
+        size_t name_length, argument_length;
+
+        assert (client != NULL);
+        assert (command_line != NULL);
+
+        while (isspace ((unsigned char) *command_line))
+                command_line++;
+
+        name_length = 0;
+        while (command_line[name_length] != '\0' &&
+               !isspace ((unsigned char) command_line[name_length]))
+                name_length++;
+
+        argument_start = command_line + name_length;
+        while (isspace ((unsigned char) *argument_start))
+                argument_start++;
+
+        argument_length = strlen (argument_start);
+        while (argument_length > 0 &&
+               isspace ((unsigned char) argument_start[argument_length - 1]))
+                argument_length--;
+
+        if (name_length == 0 || argument_length > UCHAR_MAX)
+                return false;
+
+        name = strndup (command_line, name_length);
+        argument = strndup (argument_start, argument_length);
+
+        for (command = ply_boot_client_commands; command->name != NULL; command++) {
+                if (strcmp (command->name, name) == 0)
+                        break;
+        }
+
+        free (name);
+
+        if (command->name == NULL ||
+            (command->takes_argument && argument_length == 0)) {
+                free (argument);
+                return false;
+        }
+
+        if (strcmp (command->request_command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUIT) == 0) {
+                bool retain_splash;
+
+                retain_splash = strcmp (argument, "retain-splash") == 0;
+                free (argument);
+
+                if (!retain_splash && argument_length > 0)
+                        return false;
+
+                ply_boot_client_tell_daemon_to_quit (client, retain_splash,
+                                                     handler, failed_handler,
+                                                     user_data);
+                return true;
+        }
+
+        ply_boot_client_queue_request (client, command->request_command,
+                                       command->takes_argument ? argument : NULL,
+                                       handler, failed_handler, user_data);
+        free (argument);
+
+        return true;
+}
+
+void
+ply_boot_client_replay_request (ply_boot_client_t                 *client,
+                                const char                        *command,
+                                const char                        *argument,
+                                ply_boot_client_response_handler_t handler,
+                                ply_boot_client_response_handler_t failed_handler,
+                                void                              *user_data)
+{
+        assert (client != NULL);
+        assert (command != NULL);
+
+        ply_boot_client_queue_request (client, command, argument,
+                                       handler, failed_handler, user_data);
+}
+
+static void
+ply_boot_client_on_progress_channel_refused (void              *user_data,
+                                             ply_boot_client_t *client)
+{
+        ply_trace ("daemon doesn't take progress channels");
+        client->progress_channel_is_unsupported = true;
+}
+
+static bool
+ply_boot_client_open_progress_channel (ply_boot_client_t *client)
+{
+        ply_boot_client_request_t *request;
+        void *record;
+        int fd;
+
+        fd = memfd_create ("plymouth-progress", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) {
+                ply_trace ("could not create progress channel: %m");
+                return false;
+        }
+
+        if (ftruncate (fd, sizeof(ply_boot_protocol_progress_record_t)) < 0 ||
+            fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+                ply_trace ("could not set up progress channel: %m");
+                close (fd);
+                return false;
+        }
+
+        record = mmap (NULL, sizeof(ply_boot_protocol_progress_record_t),
+                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (record == MAP_FAILED) {
+                ply_trace ("could not map progress channel: %m");
+                close (fd);
+                return false;
+        }
+
+        request = ply_boot_client_queue_request (client,
+                                                 PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_CHANNEL,
+                                                 NULL, NULL,
+                                                 ply_boot_client_on_progress_channel_refused,
+                                                 NULL);
+        if (request == NULL) {
+                munmap (record, sizeof(ply_boot_protocol_progress_record_t));
+                close (fd);
+                return false;
+        }
+
+        request->fd = fd;
+        client->progress_channel_fd = fd;
+        client->progress_record = record;
+
+        return true;
+}
+
+bool
+ply_boot_client_update_progress_channel (ply_boot_client_t *client,
+                                         unsigned int       percent,
+                                         const char        *text)
+{
+        ply_boot_protocol_progress_record_t *record;
+        uint32_t sequence;
+
+        assert (client != NULL);
+
+        if (client->progress_channel_is_unsupported)
+                return false;
+
+        if (client->progress_record == NULL &&
+            !ply_boot_client_open_progress_channel (client)) {
+                client->progress_channel_is_unsupported = true;
+                return false;
+        }
+
+        record = client->progress_record;
+
+        sequence = record->sequence;
+        __atomic_store_n (&record->sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence (__ATOMIC_RELEASE);
+
+        __atomic_store_n (&record->percent, MIN (percent, 100), __ATOMIC_RELAXED);
+        memset (record->text, 0, sizeof(record->text));
+        if (text != NULL)
+                strncpy (record->text, text, sizeof(record->text) - 1);
+
+        __atomic_store_n (&record->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+        return true;
+}
+
+bool
+ply_boot_client_send_request_without_reply (ply_boot_client_t *client,
+                                            const char        *request_command,
+                                            const char        *request_argument)
+{
+        ply_boot_client_request_t request = { 0 };
+        char *request_string;
+        size_t request_size;
+        bool was_sent;
+
+        assert (client != NULL);
+        assert (client->loop == NULL);
+
+        if (!client->is_connected)
+                return false;
+
+        if (request_argument != NULL && strlen (request_argument) > UCHAR_MAX)
+                return false;
+
+        request.client = client;
+        request.command = (char *) request_command;
+        request.argument = (char *) request_argument;
+        request.fd = -1;
+
+        request_string = ply_boot_client_get_request_string (client, &request,
+                                                             &request_size);
+        was_sent = ply_write (client->socket_fd, request_string, request_size);
+        free (request_string);
+
+        return was_sent;
+}
+
 void
 ply_boot_client_flush (ply_boot_client_t *client)
 {
@@ -144,6 +144,55 @@ void ply_boot_client_ask_daemon_has_active_vt (ply_boot_client_t
                                                ply_boot_client_response_handler_t handler,
                                                ply_boot_client_response_handler_t failed_handler,
                                                void                              *user_data);
+
+/* For progress that changes many times a second.  The first call hands
+ * the daemon a bit of shared memory, and later calls just write to it,
+ * without making a request; the daemon looks at it once a frame.  text
+ * is shown as the status, like ply_boot_client_update_daemon, and percent
+ * as system update progress.  Returns false if the daemon can't take
+ * progress this way, in which case the caller should fall back to
+ * ordinary requests.  A daemon that turns the channel down is only found
+ * out about once the reply comes back, so a few updates may get lost.
+ */
+bool ply_boot_client_update_progress_channel (ply_boot_client_t *client,
+                                              unsigned int       percent,
+                                              const char        *text);
+
+/* Sends one command written like a plymouth subcommand, say
+ * "update fsck:sda1:40" or "display-message Hello", so something that
+ * keeps a connection open can pass on lines without parsing them
+ * itself.  Returns false, without sending anything, if the line isn't a
+ * command that can go through this way.  Only commands that get a plain
+ * ACK or NAK back are understood; asking for passwords isn't.
+ */
+bool ply_boot_client_queue_command_line (ply_boot_client_t                 *client,
+                                         const char                        *command_line,
+                                         ply_boot_client_response_handler_t handler,
+                                         ply_boot_client_response_handler_t failed_handler,
+                                         void                              *user_data);
+/* Sends a request just as it was recorded by the daemon, the one byte
+ * command and its argument, for playing a recorded boot back.  handler
+ * gets called with whatever kind of answer the request gets.
+ */
+void ply_boot_client_replay_request (ply_boot_client_t                 *client,
+                                     const char                        *command,
+                                     const char                        *argument,
+                                     ply_boot_client_response_handler_t handler,
+                                     ply_boot_client_response_handler_t failed_handler,
+                                     void                              *user_data);
+/* Writes a request straight to the daemon, before the client is attached
+ * to an event loop, and doesn't wait for the answer.  For one shot
+ * commands that have nothing to do with the answer anyway.  Returns false
+ * if the request couldn't be written, not if the daemon turns it down.
+ */
+bool ply_boot_client_send_request_without_reply (ply_boot_client_t *client,
+                                                 const char        *request_command,
+                                                 const char        *request_argument);
+/* Answers with the daemon's performance counters, one per line */
+void ply_boot_client_ask_daemon_for_statistics (ply_boot_client_t                 *client,
+                                                ply_boot_client_answer_handler_t   handler,
+                                                ply_boot_client_response_handler_t failed_handler,
+                                                void                              *user_data);
 void ply_boot_client_flush (ply_boot_client_t *client);
 void ply_boot_client_disconnect (ply_boot_client_t *client);
 void ply_boot_client_attach_to_event_loop (ply_boot_client_t *client,
@@ -0,0 +1,877 @@
+/* plymouth-load-test.c - floods an offscreen plymouthd with boot requests
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ply-boot-client.h"
+#include "ply-command-parser.h"
+#include "ply-event-loop.h"
+#include "ply-logger.h"
+#include "ply-utils.h"
+
+/* Starts a plymouthd of its own rendering offscreen, opens a number of
+ * connections to it, the way hundreds of units starting at once would,
+ * and sends it a mix of pings, status updates, messages and keystroke
+ * watches for a while.  With --rate the requests go out at that many a
+ * second across all connections, whether or not earlier ones have been
+ * answered; without it each connection sends its next request as soon
+ * as the last one is answered.  Afterwards how long requests took to be
+ * answered, how much CPU the daemon used while under load and the
+ * daemon's own counters get printed one "name value" per line.
+ *
+ * Like plymouth-replay, the daemon this starts needs the boot protocol
+ * socket to itself, so this has to run as root, with no other plymouthd
+ * running.
+ */
+
+#define DEFAULT_HEADS "1920x1080"
+#define DEFAULT_NUMBER_OF_CONNECTIONS 100
+#define DEFAULT_DURATION 10
+#define DEFAULT_MIX "ping=4,update=4,message=1,keystroke=1"
+#define CONNECT_RETRY_INTERVAL 0.05
+#define CONNECT_TIMEOUT 10.0
+
+/* how long to wait for requests still in flight once sending stops */
+#define DRAIN_TIMEOUT 10.0
+
+/* finest spacing requests get sent at with --rate; more than one goes
+ * out at a time when the rate is higher than this allows */
+#define SEND_INTERVAL 0.001
+
+/* the daemon keeps every status it hasn't seen before for the boot time
+ * cache, so each connection goes round a few, like a unit would */
+#define STATUSES_PER_CONNECTION 10
+
+typedef enum
+{
+        REQUEST_KIND_PING = 0,
+        REQUEST_KIND_UPDATE,
+        REQUEST_KIND_MESSAGE,
+        REQUEST_KIND_KEYSTROKE,
+        NUMBER_OF_REQUEST_KINDS
+} request_kind_t;
+
+static const char *request_kind_names[NUMBER_OF_REQUEST_KINDS] = {
+        "ping", "update", "message", "keystroke"
+};
+
+typedef struct
+{
+        double *latencies;
+        size_t  number_of_latencies;
+        size_t  latencies_size;
+
+        unsigned long number_sent;
+        unsigned long number_failed;
+
+        int weight;
+        int current_weight;
+} request_kind_statistics_t;
+
+typedef struct _state state_t;
+
+typedef struct
+{
+        state_t           *state;
+        ply_boot_client_t *client;
+        int                index;
+        unsigned long      number_of_requests;
+        char              *keys;
+
+        uint32_t           is_showing_message : 1;
+} connection_t;
+
+typedef struct
+{
+        connection_t  *connection;
+        request_kind_t kind;
+        double         send_time;
+} request_t;
+
+struct _state
+{
+        ply_event_loop_t          *loop;
+        ply_command_parser_t      *command_parser;
+
+        connection_t              *connections;
+        int                        number_of_connections;
+        int                        next_connection;
+
+        request_kind_statistics_t  kinds[NUMBER_OF_REQUEST_KINDS];
+        int                        total_weight;
+
+        double                     rate;
+        double                     duration;
+
+        pid_t                      daemon_pid;
+        double                     connect_start_time;
+        double                     load_start_time;
+        double                     load_end_time;
+        double                     load_cpu_time[2];
+        unsigned long              number_sent;
+        unsigned long              number_in_flight;
+
+        char                      *daemon_statistics;
+
+        uint32_t                   is_sending : 1;
+        uint32_t                   has_finished_load : 1;
+        uint32_t                   has_sent_quit : 1;
+};
+
+static void send_request (connection_t *connection);
+
+static bool
+parse_mix (state_t    *state,
+           const char *mix)
+{
+        char *copy, *item, *save_pointer = NULL;
+        bool ret = true;
+
+        copy = strdup (mix);
+
+        for (item = strtok_r (copy, ",", &save_pointer);
+             item != NULL;
+             item = strtok_r (NULL, ",", &save_pointer)) {
+                char *value;
+                int kind;
+
+                value = strchr (item, '=');
+                if (value != NULL)
+                        *value++ = '\0';
+
+                for (kind = 0; kind < NUMBER_OF_REQUEST_KINDS; kind++) {
+                        if (strcmp (item, request_kind_names[kind]) == 0)
+                                break;
+                }
+
+                if (kind == NUMBER_OF_REQUEST_KINDS || (value != NULL && atoi (value) < 0)) {
+                        ply_error ("plymouth-load-test: don't know how to send \"%s\"", item);
+                        ret = false;
+                        continue;
+                }
+
+                state->kinds[kind].weight = value != NULL ? atoi (value) : 1;
+                state->total_weight += state->kinds[kind].weight;
+        }
+
+        free (copy);
+
+        if (ret && state->total_weight == 0) {
+                ply_error ("plymouth-load-test: mix \"%s\" has nothing to send", mix);
+                ret = false;
+        }
+
+        return ret;
+}
+
+/* Spreads the kinds out evenly in proportion to their weights, rather
+ * than at random, so runs can be compared with each other */
+static request_kind_t
+pick_request_kind (state_t *state)
+{
+        int kind, best = 0;
+
+        for (kind = 0; kind < NUMBER_OF_REQUEST_KINDS; kind++) {
+                state->kinds[kind].current_weight += state->kinds[kind].weight;
+
+                if (state->kinds[kind].current_weight > state->kinds[best].current_weight)
+                        best = kind;
+        }
+
+        state->kinds[best].current_weight -= state->total_weight;
+
+        return best;
+}
+
+static bool
+get_daemon_cpu_time (pid_t   pid,
+                     double *cpu_time)
+{
+        char *filename = NULL, *end;
+        char contents[1024];
+        unsigned long user_ticks, system_ticks;
+        long ticks_per_second;
+        FILE *fp;
+        bool ret = false;
+
+        asprintf (&filename, "/proc/%ld/stat", (long) pid);
+        fp = fopen (filename, "re");
+        free (filename);
+
+        if (fp == NULL)
+                return false;
+
+        if (fgets (contents, sizeof(contents), fp) == NULL) {
+                fclose (fp);
+                return false;
+        }
+        fclose (fp);
+
+        /* the command name can have spaces and brackets in it, so count
+         * fields from the last ')' */
+        end = strrchr (contents, ')');
+        ticks_per_second = sysconf (_SC_CLK_TCK);
+
+        if (end != NULL && ticks_per_second > 0 &&
+            sscanf (end + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                    &user_ticks, &system_ticks) == 2) {
+                cpu_time[0] = (double) user_ticks / ticks_per_second;
+                cpu_time[1] = (double) system_ticks / ticks_per_second;
+                ret = true;
+        }
+
+        return ret;
+}
+
+static bool
+start_daemon (state_t    *state,
+              const char *daemon_path,
+              const char *theme,
+              const char *heads,
+              const char *kernel_command_line)
+{
+        char *command_line = NULL;
+
+        asprintf (&command_line, "--kernel-command-line=splash%s%s%s%s",
+                  theme != NULL ? " plymouth.splash=" : "",
+                  theme != NULL ? theme : "",
+                  kernel_command_line != NULL ? " " : "",
+                  kernel_command_line != NULL ? kernel_command_line : "");
+
+        state->daemon_pid = fork ();
+
+        if (state->daemon_pid < 0) {
+                ply_error ("plymouth-load-test: could not start %s: %m", daemon_path);
+                free (command_line);
+                return false;
+        }
+
+        if (state->daemon_pid == 0) {
+                setenv ("PLY_OFFSCREEN_HEADS", heads, true);
+
+                execl (daemon_path, daemon_path, "--no-daemon", "--no-boot-log",
+                       command_line, (char *) NULL);
+
+                ply_error ("plymouth-load-test: could not run %s: %m", daemon_path);
+                _exit (127);
+        }
+
+        free (command_line);
+        return true;
+}
+
+static void
+on_quit_reply (state_t *state)
+{
+        ply_event_loop_exit (state->loop, 0);
+}
+
+static void
+send_quit (state_t *state)
+{
+        state->has_sent_quit = true;
+        ply_boot_client_tell_daemon_to_quit (state->connections[0].client, false,
+                                             (ply_boot_client_response_handler_t)
+                                             on_quit_reply,
+                                             (ply_boot_client_response_handler_t)
+                                             on_quit_reply, state);
+}
+
+static void
+on_daemon_statistics (state_t           *state,
+                      const char        *statistics,
+                      ply_boot_client_t *client)
+{
+        if (statistics != NULL)
+                state->daemon_statistics = strdup (statistics);
+
+        send_quit (state);
+}
+
+static void
+on_daemon_statistics_failed (state_t           *state,
+                             ply_boot_client_t *client)
+{
+        send_quit (state);
+}
+
+static void
+finish_load (state_t *state)
+{
+        double cpu_time[2];
+
+        if (state->has_finished_load)
+                return;
+
+        state->has_finished_load = true;
+
+        ply_event_loop_stop_watching_for_timeout (state->loop,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  finish_load, state);
+
+        state->load_end_time = ply_get_timestamp ();
+
+        if (get_daemon_cpu_time (state->daemon_pid, cpu_time)) {
+                state->load_cpu_time[0] = cpu_time[0] - state->load_cpu_time[0];
+                state->load_cpu_time[1] = cpu_time[1] - state->load_cpu_time[1];
+        }
+
+        if (state->number_in_flight > 0)
+                ply_trace ("%lu requests still unanswered", state->number_in_flight);
+
+        ply_boot_client_ask_daemon_for_statistics (state->connections[0].client,
+                                                   (ply_boot_client_answer_handler_t)
+                                                   on_daemon_statistics,
+                                                   (ply_boot_client_response_handler_t)
+                                                   on_daemon_statistics_failed,
+                                                   state);
+}
+
+static void
+stop_sending (state_t *state)
+{
+        state->is_sending = false;
+
+        if (state->number_in_flight == 0) {
+                finish_load (state);
+                return;
+        }
+
+        ply_event_loop_watch_for_timeout (state->loop, DRAIN_TIMEOUT,
+                                          (ply_event_loop_timeout_handler_t)
+                                          finish_load, state);
+}
+
+static void
+record_latency (request_kind_statistics_t *kind,
+                double                     latency)
+{
+        if (kind->number_of_latencies == kind->latencies_size) {
+                kind->latencies_size = MAX (kind->latencies_size * 2, 1024);
+                kind->latencies = realloc (kind->latencies,
+                                           kind->latencies_size * sizeof(double));
+        }
+
+        kind->latencies[kind->number_of_latencies++] = latency;
+}
+
+static void
+finish_request (request_t *request,
+                bool       was_answered)
+{
+        connection_t *connection = request->connection;
+        state_t *state = connection->state;
+        request_kind_statistics_t *kind = &state->kinds[request->kind];
+
+        if (was_answered)
+                record_latency (kind, ply_get_timestamp () - request->send_time);
+        else
+                kind->number_failed++;
+
+        free (request);
+        state->number_in_flight--;
+
+        if (state->is_sending) {
+                /* with no rate given, each connection keeps one request
+                 * going at a time */
+                if (state->rate <= 0.0)
+                        send_request (connection);
+        } else if (state->number_in_flight == 0) {
+                finish_load (state);
+        }
+}
+
+static void
+on_reply (request_t *request)
+{
+        finish_request (request, true);
+}
+
+static void
+on_failed_reply (request_t *request)
+{
+        finish_request (request, false);
+}
+
+static void
+on_keystroke_answer (request_t         *request,
+                     const char        *keys,
+                     ply_boot_client_t *client)
+{
+        finish_request (request, true);
+}
+
+static void
+send_request (connection_t *connection)
+{
+        state_t *state = connection->state;
+        request_t *request;
+        char *text = NULL;
+
+        request = calloc (1, sizeof(request_t));
+        request->connection = connection;
+        request->kind = pick_request_kind (state);
+        request->send_time = ply_get_timestamp ();
+
+        state->kinds[request->kind].number_sent++;
+        state->number_sent++;
+        state->number_in_flight++;
+        connection->number_of_requests++;
+
+        switch (request->kind) {
+        case REQUEST_KIND_PING:
+                ply_boot_client_ping_daemon (connection->client,
+                                             (ply_boot_client_response_handler_t)
+                                             on_reply,
+                                             (ply_boot_client_response_handler_t)
+                                             on_failed_reply, request);
+                break;
+
+        case REQUEST_KIND_UPDATE:
+                asprintf (&text, "load-test-%d:%lu", connection->index,
+                          connection->number_of_requests % STATUSES_PER_CONNECTION);
+                ply_boot_client_update_daemon (connection->client, text,
+                                               (ply_boot_client_response_handler_t)
+                                               on_reply,
+                                               (ply_boot_client_response_handler_t)
+                                               on_failed_reply, request);
+                break;
+
+        case REQUEST_KIND_MESSAGE:
+                /* messages pile up in the daemon until they get hidden, so
+                 * each connection takes its message back on the next go */
+                asprintf (&text, "Load test connection %d", connection->index);
+                if (connection->is_showing_message)
+                        ply_boot_client_tell_daemon_to_hide_message (connection->client, text,
+                                                                     (ply_boot_client_response_handler_t)
+                                                                     on_reply,
+                                                                     (ply_boot_client_response_handler_t)
+                                                                     on_failed_reply, request);
+                else
+                        ply_boot_client_tell_daemon_to_display_message (connection->client, text,
+                                                                        (ply_boot_client_response_handler_t)
+                                                                        on_reply,
+                                                                        (ply_boot_client_response_handler_t)
+                                                                        on_failed_reply, request);
+                connection->is_showing_message = !connection->is_showing_message;
+                break;
+
+        case REQUEST_KIND_KEYSTROKE:
+                /* nobody types during the test, so the watch is taken back
+                 * straight away, which is what gets it answered */
+                ply_boot_client_ask_daemon_to_watch_for_keystroke (connection->client,
+                                                                   connection->keys,
+                                                                   (ply_boot_client_answer_handler_t)
+                                                                   on_keystroke_answer,
+                                                                   (ply_boot_client_response_handler_t)
+                                                                   on_failed_reply, request);
+                ply_boot_client_ask_daemon_to_ignore_keystroke (connection->client,
+                                                                connection->keys,
+                                                                NULL, NULL, NULL);
+                break;
+
+        case NUMBER_OF_REQUEST_KINDS:
+                break;
+        }
+
+        free (text);
+}
+
+static void
+on_send_timeout (state_t *state)
+{
+        double now;
+        unsigned long number_due;
+
+        if (!state->is_sending)
+                return;
+
+        now = ply_get_timestamp ();
+
+        if (now - state->load_start_time >= state->duration) {
+                stop_sending (state);
+                return;
+        }
+
+        number_due = (unsigned long) ((now - state->load_start_time) * state->rate) + 1;
+
+        while (state->number_sent < number_due) {
+                send_request (&state->connections[state->next_connection]);
+                state->next_connection = (state->next_connection + 1) % state->number_of_connections;
+        }
+
+        ply_event_loop_watch_for_timeout (state->loop, MAX (1.0 / state->rate, SEND_INTERVAL),
+                                          (ply_event_loop_timeout_handler_t)
+                                          on_send_timeout, state);
+}
+
+static void
+on_duration_timeout (state_t *state)
+{
+        if (state->is_sending)
+                stop_sending (state);
+}
+
+static void
+on_disconnect (connection_t *connection)
+{
+        state_t *state = connection->state;
+
+        if (state->has_finished_load)
+                return;
+
+        ply_error ("plymouth-load-test: daemon hung up on connection %d", connection->index);
+        ply_event_loop_exit (state->loop, 1);
+}
+
+static void
+start_load (state_t *state)
+{
+        int i;
+
+        state->is_sending = true;
+        state->load_start_time = ply_get_timestamp ();
+        get_daemon_cpu_time (state->daemon_pid, state->load_cpu_time);
+
+        ply_trace ("sending requests over %d connections", state->number_of_connections);
+
+        if (state->rate > 0.0) {
+                on_send_timeout (state);
+                return;
+        }
+
+        ply_event_loop_watch_for_timeout (state->loop, state->duration,
+                                          (ply_event_loop_timeout_handler_t)
+                                          on_duration_timeout, state);
+
+        for (i = 0; i < state->number_of_connections; i++) {
+                send_request (&state->connections[i]);
+        }
+}
+
+static bool
+connect_client (state_t *state,
+                int      index)
+{
+        connection_t *connection = &state->connections[index];
+
+        connection->state = state;
+        connection->index = index;
+        connection->client = ply_boot_client_new ();
+
+        if (!ply_boot_client_connect (connection->client,
+                                      (ply_boot_client_disconnect_handler_t)
+                                      on_disconnect, connection)) {
+                ply_boot_client_free (connection->client);
+                connection->client = NULL;
+                return false;
+        }
+
+        asprintf (&connection->keys, "\x01load-test-%d", index);
+        ply_boot_client_attach_to_event_loop (connection->client, state->loop);
+
+        return true;
+}
+
+static void
+on_connect_timeout (state_t *state)
+{
+        int i;
+
+        if (!connect_client (state, 0)) {
+                if (ply_get_timestamp () - state->connect_start_time > CONNECT_TIMEOUT ||
+                    waitpid (state->daemon_pid, NULL, WNOHANG) == state->daemon_pid) {
+                        ply_error ("plymouth-load-test: could not connect to daemon");
+                        state->daemon_pid = 0;
+                        ply_event_loop_exit (state->loop, 1);
+                        return;
+                }
+
+                ply_event_loop_watch_for_timeout (state->loop, CONNECT_RETRY_INTERVAL,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_connect_timeout, state);
+                return;
+        }
+
+        for (i = 1; i < state->number_of_connections; i++) {
+                if (!connect_client (state, i)) {
+                        ply_error ("plymouth-load-test: could only open %d connections: %m", i);
+                        state->number_of_connections = i;
+                        break;
+                }
+        }
+
+        start_load (state);
+}
+
+static int
+compare_latencies (const void *a,
+                   const void *b)
+{
+        double first = *(const double *) a, second = *(const double *) b;
+
+        return (first > second) - (first < second);
+}
+
+static double
+get_percentile (const double *latencies,
+                size_t        number_of_latencies,
+                double        percentile)
+{
+        size_t index;
+
+        if (number_of_latencies == 0)
+                return 0.0;
+
+        index = (size_t) (percentile / 100.0 * (number_of_latencies - 1) + 0.5);
+
+        return latencies[index];
+}
+
+static void
+print_latencies (const char *name,
+                 double     *latencies,
+                 size_t      number_of_latencies)
+{
+        qsort (latencies, number_of_latencies, sizeof(double), compare_latencies);
+
+        printf ("%s-answered %zu\n", name, number_of_latencies);
+        printf ("%s-p50 %.6f\n", name, get_percentile (latencies, number_of_latencies, 50.0));
+        printf ("%s-p90 %.6f\n", name, get_percentile (latencies, number_of_latencies, 90.0));
+        printf ("%s-p99 %.6f\n", name, get_percentile (latencies, number_of_latencies, 99.0));
+        printf ("%s-max %.6f\n", name,
+                number_of_latencies > 0 ? latencies[number_of_latencies - 1] : 0.0);
+}
+
+static void
+print_daemon_statistics (state_t *state)
+{
+        char *line, *save_pointer = NULL;
+
+        if (state->daemon_statistics == NULL)
+                return;
+
+        for (line = strtok_r (state->daemon_statistics, "\n", &save_pointer);
+             line != NULL;
+             line = strtok_r (NULL, "\n", &save_pointer)) {
+                if (strncmp (line, "timeline", strlen ("timeline")) == 0)
+                        continue;
+
+                printf ("daemon-%s\n", line);
+        }
+}
+
+static void
+print_statistics (state_t             *state,
+                  const struct rusage *usage)
+{
+        double load_time = state->load_end_time - state->load_start_time;
+        double *all_latencies = NULL;
+        size_t number_of_latencies = 0;
+        unsigned long number_failed = 0;
+        int kind;
+
+        printf ("connections %d\n", state->number_of_connections);
+        printf ("requests %lu\n", state->number_sent);
+        printf ("load-time %.6f\n", load_time);
+        printf ("requests-per-second %.1f\n",
+                load_time > 0.0 ? (state->number_sent - state->number_in_flight) / load_time : 0.0);
+        printf ("unanswered-requests %lu\n", state->number_in_flight);
+
+        for (kind = 0; kind < NUMBER_OF_REQUEST_KINDS; kind++) {
+                request_kind_statistics_t *statistics = &state->kinds[kind];
+
+                number_failed += statistics->number_failed;
+
+                if (statistics->number_sent == 0)
+                        continue;
+
+                all_latencies = realloc (all_latencies,
+                                         (number_of_latencies + statistics->number_of_latencies) * sizeof(double));
+                memcpy (all_latencies + number_of_latencies, statistics->latencies,
+                        statistics->number_of_latencies * sizeof(double));
+                number_of_latencies += statistics->number_of_latencies;
+
+                printf ("%s-sent %lu\n", request_kind_names[kind], statistics->number_sent);
+                printf ("%s-failed %lu\n", request_kind_names[kind], statistics->number_failed);
+                print_latencies (request_kind_names[kind],
+                                 statistics->latencies,
+                                 statistics->number_of_latencies);
+        }
+
+        printf ("failed-requests %lu\n", number_failed);
+        print_latencies ("latency", all_latencies, number_of_latencies);
+        free (all_latencies);
+
+        printf ("load-cpu-user %.6f\n", state->load_cpu_time[0]);
+        printf ("load-cpu-system %.6f\n", state->load_cpu_time[1]);
+        printf ("load-cpu-percent %.1f\n",
+                load_time > 0.0 ? 100.0 * (state->load_cpu_time[0] + state->load_cpu_time[1]) / load_time : 0.0);
+        printf ("cpu-user %.6f\n", usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1000000.0);
+        printf ("cpu-system %.6f\n", usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1000000.0);
+        printf ("max-rss-kb %ld\n", usage->ru_maxrss);
+
+        print_daemon_statistics (state);
+}
+
+static void
+raise_file_limit (void)
+{
+        struct rlimit limit;
+
+        /* the daemon inherits this, and needs a descriptor for every
+         * connection too */
+        if (getrlimit (RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == limit.rlim_max)
+                return;
+
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &limit);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        state_t state = { 0 };
+        bool should_help = false, should_be_verbose = false;
+        char *mix = NULL, *theme = NULL, *heads = NULL, *daemon_path = NULL;
+        char *kernel_command_line = NULL;
+        int number_of_connections = 0, rate = 0, duration = 0;
+        int exit_code, status = 0, i;
+        struct rusage usage = { { 0 } };
+
+        state.loop = ply_event_loop_get_default ();
+        state.command_parser = ply_command_parser_new ("plymouth-load-test", "Send an offscreen daemon lots of requests at once");
+
+        ply_command_parser_add_options (state.command_parser,
+                                        "help", "This help message", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "debug", "Enable verbose debug logging", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "connections", "Number of connections to open", PLY_COMMAND_OPTION_TYPE_INTEGER,
+                                        "rate", "Requests a second across all connections", PLY_COMMAND_OPTION_TYPE_INTEGER,
+                                        "duration", "Seconds to keep sending for", PLY_COMMAND_OPTION_TYPE_INTEGER,
+                                        "mix", "Requests to send and how often, like " DEFAULT_MIX, PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "theme", "Theme to show instead of the configured one", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "heads", "Offscreen heads, like 1920x1080 or 3840x2160@2", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "daemon", "plymouthd to run", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "kernel-command-line", "More kernel command line for the daemon", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        NULL);
+
+        if (!ply_command_parser_parse_arguments (state.command_parser, state.loop, argv, argc)) {
+                char *help_string;
+
+                help_string = ply_command_parser_get_help_string (state.command_parser);
+                ply_error ("%s", help_string);
+                free (help_string);
+                return 1;
+        }
+
+        ply_command_parser_get_options (state.command_parser,
+                                        "help", &should_help,
+                                        "debug", &should_be_verbose,
+                                        "connections", &number_of_connections,
+                                        "rate", &rate,
+                                        "duration", &duration,
+                                        "mix", &mix,
+                                        "theme", &theme,
+                                        "heads", &heads,
+                                        "daemon", &daemon_path,
+                                        "kernel-command-line", &kernel_command_line,
+                                        NULL);
+
+        if (should_help) {
+                char *help_string;
+
+                help_string = ply_command_parser_get_help_string (state.command_parser);
+                printf ("%s", help_string);
+                free (help_string);
+                return 0;
+        }
+
+        if (should_be_verbose && !ply_is_tracing ())
+                ply_toggle_tracing ();
+
+        if (!parse_mix (&state, mix != NULL ? mix : DEFAULT_MIX))
+                return 1;
+
+        state.number_of_connections = number_of_connections > 0 ? number_of_connections : DEFAULT_NUMBER_OF_CONNECTIONS;
+        state.connections = calloc (state.number_of_connections, sizeof(connection_t));
+        state.rate = MAX (rate, 0);
+        state.duration = duration > 0 ? duration : DEFAULT_DURATION;
+
+        signal (SIGPIPE, SIG_IGN);
+        raise_file_limit ();
+
+        if (!start_daemon (&state,
+                           daemon_path != NULL ? daemon_path : PLYMOUTH_DAEMON_DIR "/plymouthd",
+                           theme,
+                           heads != NULL ? heads : DEFAULT_HEADS,
+                           kernel_command_line)) {
+                free (state.connections);
+                return 1;
+        }
+
+        state.connect_start_time = ply_get_timestamp ();
+        on_connect_timeout (&state);
+
+        exit_code = ply_event_loop_run (state.loop);
+
+        if (state.daemon_pid > 0) {
+                if (exit_code != 0)
+                        kill (state.daemon_pid, SIGTERM);
+
+                while (wait4 (state.daemon_pid, &status, 0, &usage) < 0 && errno == EINTR);
+        }
+
+        if (exit_code == 0)
+                print_statistics (&state, &usage);
+
+        for (i = 0; i < state.number_of_connections; i++) {
+                if (state.connections[i].client != NULL)
+                        ply_boot_client_free (state.connections[i].client);
+                free (state.connections[i].keys);
+        }
+        free (state.connections);
+
+        for (i = 0; i < NUMBER_OF_REQUEST_KINDS; i++) {
+                free (state.kinds[i].latencies);
+        }
+
+        free (state.daemon_statistics);
+        ply_command_parser_free (state.command_parser);
+
+        free (mix);
+        free (theme);
+        free (heads);
+        free (daemon_path);
+        free (kernel_command_line);
+
+        return exit_code;
+}
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,680 @@
+/* plymouth-replay.c - plays a recorded boot back to an offscreen plymouthd
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ply-boot-client.h"
+#include "ply-boot-server.h"
+#include "ply-command-parser.h"
+#include "ply-event-loop.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-utils.h"
+
+/* Takes a recording made with plymouthd --record-file (or plymouth.record=
+ * on the kernel command line), starts a plymouthd of its own rendering
+ * offscreen, and sends it the same requests and keyboard input at the
+ * same times, or one after the other as fast as it takes them with
+ * --fast.  Device events get counted but can't be played back, since the
+ * offscreen renderer has a fixed set of heads.  When the daemon has
+ * quit, its frame times and how much CPU it used get printed one
+ * "name value" per line.
+ *
+ * The daemon this starts needs the boot protocol socket to itself, so
+ * this has to run as root, with no other plymouthd running.
+ */
+
+#define DEFAULT_HEADS "1920x1080"
+#define DEFAULT_FRAME_RATE 30
+#define CONNECT_RETRY_INTERVAL 0.05
+#define CONNECT_TIMEOUT 10.0
+
+/* gaps between flushes longer than this are the splash having nothing
+ * to redraw, not frames getting dropped */
+#define IDLE_INTERVAL 0.5
+
+typedef struct
+{
+        double time;
+        char   kind;
+        char  *name;
+        char  *data;
+        size_t data_size;
+} replay_event_t;
+
+typedef struct
+{
+        ply_event_loop_t     *loop;
+        ply_boot_client_t    *client;
+        ply_command_parser_t *command_parser;
+
+        ply_list_t           *events;
+        ply_list_node_t      *next_event_node;
+
+        char                 *work_directory;
+        char                 *stats_file_name;
+        char                 *input_file_name;
+        int                   input_fd;
+
+        pid_t                 daemon_pid;
+        double                start_time;
+        double                connect_start_time;
+        double                end_time;
+
+        unsigned long         number_of_requests;
+        unsigned long         number_of_keyboard_events;
+        unsigned long         number_of_device_events;
+        unsigned long         number_of_skipped_events;
+        unsigned long         number_of_failed_requests;
+
+        uint32_t              should_go_fast : 1;
+        uint32_t              is_waiting_for_reply : 1;
+        uint32_t              has_sent_quit : 1;
+} state_t;
+
+static void dispatch_next_event (state_t *state);
+
+static char *
+unescape (const char *text,
+          size_t     *size)
+{
+        char *result;
+        size_t i, length;
+
+        length = strlen (text);
+        result = calloc (length + 1, sizeof(char));
+
+        for (i = 0, *size = 0; i < length; i++) {
+                unsigned int byte;
+
+                if (text[i] == '\\' && text[i + 1] == 'x' &&
+                    sscanf (text + i + 2, "%2x", &byte) == 1) {
+                        result[(*size)++] = (char) byte;
+                        i += 3;
+                } else {
+                        result[(*size)++] = text[i];
+                }
+        }
+
+        return result;
+}
+
+static void
+free_events (ply_list_t *events)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (events);
+             node != NULL;
+             node = ply_list_get_next_node (events, node)) {
+                replay_event_t *event = ply_list_node_get_data (node);
+
+                free (event->name);
+                free (event->data);
+                free (event);
+        }
+
+        ply_list_free (events);
+}
+
+static ply_list_t *
+load_events (const char *filename)
+{
+        ply_list_t *events;
+        FILE *fp;
+        char *line = NULL;
+        size_t line_size = 0;
+        ssize_t length;
+        unsigned long line_number = 0;
+
+        fp = fopen (filename, "re");
+        if (fp == NULL)
+                return NULL;
+
+        events = ply_list_new ();
+
+        while ((length = getline (&line, &line_size, fp)) >= 0) {
+                replay_event_t *event;
+                char *name, *data;
+                size_t size;
+                double time;
+                char kind;
+                int name_start = 0;
+
+                line_number++;
+
+                if (length > 0 && line[length - 1] == '\n')
+                        line[--length] = '\0';
+
+                if (sscanf (line, "%lf %c %n", &time, &kind, &name_start) != 2 ||
+                    name_start == 0 || line[name_start] == '\0') {
+                        ply_error ("plymouth-replay: %s:%lu: could not parse event",
+                                   filename, line_number);
+                        continue;
+                }
+
+                name = line + name_start;
+                data = strstr (name, " :");
+                if (data != NULL) {
+                        *data = '\0';
+                        data += strlen (" :");
+                }
+
+                event = calloc (1, sizeof(replay_event_t));
+                event->time = time;
+                event->kind = kind;
+                event->name = unescape (name, &size);
+                if (data != NULL)
+                        event->data = unescape (data, &event->data_size);
+
+                ply_list_append_data (events, event);
+        }
+
+        free (line);
+        fclose (fp);
+
+        return events;
+}
+
+static bool
+start_daemon (state_t    *state,
+              const char *daemon_path,
+              const char *theme,
+              const char *heads,
+              const char *kernel_command_line)
+{
+        char *command_line = NULL;
+
+        state->work_directory = strdup ("/tmp/plymouth-replay-XXXXXX");
+        if (mkdtemp (state->work_directory) == NULL) {
+                ply_error ("plymouth-replay: could not make work directory: %m");
+                return false;
+        }
+
+        asprintf (&state->stats_file_name, "%s/frames", state->work_directory);
+        asprintf (&state->input_file_name, "%s/input", state->work_directory);
+
+        if (mkfifo (state->input_file_name, 0600) < 0) {
+                ply_error ("plymouth-replay: could not make %s: %m", state->input_file_name);
+                return false;
+        }
+
+        /* the daemon opens the fifo for reading and writing, so this
+         * doesn't block waiting for it */
+        state->input_fd = open (state->input_file_name, O_RDWR | O_CLOEXEC);
+        if (state->input_fd < 0) {
+                ply_error ("plymouth-replay: could not open %s: %m", state->input_file_name);
+                return false;
+        }
+
+        asprintf (&command_line, "--kernel-command-line=splash%s%s%s%s",
+                  theme != NULL ? " plymouth.splash=" : "",
+                  theme != NULL ? theme : "",
+                  kernel_command_line != NULL ? " " : "",
+                  kernel_command_line != NULL ? kernel_command_line : "");
+
+        state->start_time = ply_get_timestamp ();
+        state->daemon_pid = fork ();
+
+        if (state->daemon_pid < 0) {
+                ply_error ("plymouth-replay: could not start %s: %m", daemon_path);
+                free (command_line);
+                return false;
+        }
+
+        if (state->daemon_pid == 0) {
+                setenv ("PLY_OFFSCREEN_HEADS", heads, true);
+                setenv ("PLY_OFFSCREEN_STATS_FILE", state->stats_file_name, true);
+                setenv ("PLY_OFFSCREEN_INPUT", state->input_file_name, true);
+
+                execl (daemon_path, daemon_path, "--no-daemon", "--no-boot-log",
+                       command_line, (char *) NULL);
+
+                ply_error ("plymouth-replay: could not run %s: %m", daemon_path);
+                _exit (127);
+        }
+
+        free (command_line);
+        return true;
+}
+
+static void
+on_reply (state_t *state)
+{
+        if (!state->is_waiting_for_reply)
+                return;
+
+        state->is_waiting_for_reply = false;
+        dispatch_next_event (state);
+}
+
+static void
+on_failed_reply (state_t *state)
+{
+        state->number_of_failed_requests++;
+        on_reply (state);
+}
+
+static void
+on_quit_reply (state_t *state)
+{
+        ply_event_loop_exit (state->loop, 0);
+}
+
+static void
+on_disconnect (state_t *state)
+{
+        ply_trace ("daemon hung up");
+        ply_event_loop_exit (state->loop, state->has_sent_quit ? 0 : 1);
+}
+
+static bool
+request_answers_later (const char *command)
+{
+        /* these only get answered once someone types something, which may
+         * be the next event in the trace */
+        return strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PASSWORD) == 0 ||
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUESTION) == 0 ||
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_KEYSTROKE) == 0;
+}
+
+static void
+send_quit (state_t *state,
+           bool     retain_splash)
+{
+        state->has_sent_quit = true;
+        ply_boot_client_tell_daemon_to_quit (state->client, retain_splash,
+                                             (ply_boot_client_response_handler_t)
+                                             on_quit_reply,
+                                             (ply_boot_client_response_handler_t)
+                                             on_quit_reply, state);
+}
+
+static void
+replay_request (state_t        *state,
+                replay_event_t *event)
+{
+        state->number_of_requests++;
+
+        /* progress channels pass a memfd that isn't in the trace, and the
+         * client library works out batching on its own */
+        if (strcmp (event->name, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_CHANNEL) == 0 ||
+            strcmp (event->name, PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH) == 0) {
+                state->number_of_skipped_events++;
+                return;
+        }
+
+        if (strcmp (event->name, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUIT) == 0) {
+                send_quit (state, event->data != NULL && event->data[0] != '\0');
+                return;
+        }
+
+        if (event->data != NULL && event->data_size > UCHAR_MAX) {
+                state->number_of_skipped_events++;
+                return;
+        }
+
+        if (state->should_go_fast && !request_answers_later (event->name))
+                state->is_waiting_for_reply = true;
+
+        ply_boot_client_replay_request (state->client, event->name, event->data,
+                                        (ply_boot_client_response_handler_t)
+                                        on_reply,
+                                        (ply_boot_client_response_handler_t)
+                                        on_failed_reply, state);
+}
+
+static void
+replay_keyboard_input (state_t        *state,
+                       replay_event_t *event)
+{
+        state->number_of_keyboard_events++;
+
+        if (event->data == NULL || event->data_size == 0)
+                return;
+
+        if (!ply_write (state->input_fd, event->data, event->data_size))
+                ply_trace ("could not send keyboard input: %m");
+}
+
+static void
+replay_event (state_t        *state,
+              replay_event_t *event)
+{
+        switch (event->kind) {
+        case PLY_BOOT_SERVER_EVENT_REQUEST:
+                replay_request (state, event);
+                break;
+
+        case PLY_BOOT_SERVER_EVENT_KEYBOARD:
+                replay_keyboard_input (state, event);
+                break;
+
+        case PLY_BOOT_SERVER_EVENT_DEVICE:
+                state->number_of_device_events++;
+                break;
+
+        default:
+                state->number_of_skipped_events++;
+                break;
+        }
+}
+
+static void
+on_event_due (state_t *state)
+{
+        replay_event_t *event;
+
+        event = ply_list_node_get_data (state->next_event_node);
+        state->next_event_node = ply_list_get_next_node (state->events,
+                                                         state->next_event_node);
+
+        replay_event (state, event);
+
+        if (!state->is_waiting_for_reply)
+                dispatch_next_event (state);
+}
+
+static void
+dispatch_next_event (state_t *state)
+{
+        replay_event_t *event;
+        double delay = 0.0;
+
+        if (state->has_sent_quit)
+                return;
+
+        if (state->next_event_node == NULL) {
+                ply_trace ("end of trace, telling daemon to quit");
+                send_quit (state, false);
+                return;
+        }
+
+        event = ply_list_node_get_data (state->next_event_node);
+
+        ply_event_loop_stop_watching_for_timeout (state->loop,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_event_due, state);
+
+        if (!state->should_go_fast)
+                delay = state->start_time + event->time - ply_get_timestamp ();
+
+        if (delay > 0.0)
+                ply_event_loop_watch_for_timeout (state->loop, delay,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_event_due, state);
+        else
+                ply_event_loop_watch_for_idle (state->loop,
+                                               (ply_event_loop_idle_handler_t)
+                                               on_event_due, state);
+}
+
+static void
+on_connect_timeout (state_t *state)
+{
+        if (!ply_boot_client_connect (state->client,
+                                      (ply_boot_client_disconnect_handler_t)
+                                      on_disconnect, state)) {
+                if (ply_get_timestamp () - state->connect_start_time > CONNECT_TIMEOUT ||
+                    waitpid (state->daemon_pid, NULL, WNOHANG) == state->daemon_pid) {
+                        ply_error ("plymouth-replay: could not connect to daemon");
+                        state->daemon_pid = 0;
+                        ply_event_loop_exit (state->loop, 1);
+                        return;
+                }
+
+                ply_event_loop_watch_for_timeout (state->loop, CONNECT_RETRY_INTERVAL,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_connect_timeout, state);
+                return;
+        }
+
+        ply_trace ("connected to daemon, starting replay");
+        ply_boot_client_attach_to_event_loop (state->client, state->loop);
+
+        /* times in the trace count from when the daemon started */
+        state->next_event_node = ply_list_get_first_node (state->events);
+        dispatch_next_event (state);
+}
+
+static void
+print_frame_statistics (state_t *state,
+                        int      frame_rate)
+{
+        FILE *fp;
+        char *line = NULL;
+        size_t line_size = 0;
+        double frame_interval = 1.0 / frame_rate;
+        unsigned long frames[16] = { 0 };
+        unsigned long dropped_frames[16] = { 0 };
+        double total_interval[16] = { 0.0 };
+        unsigned long number_of_intervals[16] = { 0 };
+        double max_interval[16] = { 0.0 };
+        int number_of_heads = 0, head;
+
+        fp = fopen (state->stats_file_name, "re");
+        if (fp == NULL) {
+                ply_error ("plymouth-replay: daemon wrote no frame statistics");
+                return;
+        }
+
+        while (getline (&line, &line_size, fp) >= 0) {
+                double time, interval;
+                unsigned long frame;
+
+                if (line[0] == '#')
+                        continue;
+
+                if (sscanf (line, "%lf %d %lu %lf", &time, &head, &frame, &interval) != 4 ||
+                    head < 0 || head >= 16)
+                        continue;
+
+                number_of_heads = MAX (number_of_heads, head + 1);
+                frames[head]++;
+
+                if (frame == 0 || interval > IDLE_INTERVAL)
+                        continue;
+
+                total_interval[head] += interval;
+                number_of_intervals[head]++;
+                max_interval[head] = MAX (max_interval[head], interval);
+
+                if (interval > 1.5 * frame_interval)
+                        dropped_frames[head] += (unsigned long) (interval / frame_interval + 0.5) - 1;
+        }
+
+        free (line);
+        fclose (fp);
+
+        for (head = 0; head < number_of_heads; head++) {
+                printf ("head-%d-frames %lu\n", head, frames[head]);
+                printf ("head-%d-mean-frame-time %.6f\n", head,
+                        number_of_intervals[head] > 0 ? total_interval[head] / number_of_intervals[head] : 0.0);
+                printf ("head-%d-max-frame-time %.6f\n", head, max_interval[head]);
+                printf ("head-%d-dropped-frames %lu\n", head, dropped_frames[head]);
+        }
+}
+
+static void
+print_statistics (state_t             *state,
+                  const struct rusage *usage,
+                  int                  frame_rate)
+{
+        printf ("requests %lu\n", state->number_of_requests);
+        printf ("keyboard-events %lu\n", state->number_of_keyboard_events);
+        printf ("device-events %lu\n", state->number_of_device_events);
+        printf ("skipped-events %lu\n", state->number_of_skipped_events);
+        printf ("failed-requests %lu\n", state->number_of_failed_requests);
+        printf ("wall-time %.6f\n", state->end_time - state->start_time);
+        printf ("cpu-user %.6f\n", usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1000000.0);
+        printf ("cpu-system %.6f\n", usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1000000.0);
+        printf ("max-rss-kb %ld\n", usage->ru_maxrss);
+
+        print_frame_statistics (state, frame_rate);
+}
+
+static void
+clean_up (state_t *state)
+{
+        if (state->input_fd >= 0)
+                close (state->input_fd);
+
+        if (state->stats_file_name != NULL)
+                unlink (state->stats_file_name);
+        if (state->input_file_name != NULL)
+                unlink (state->input_file_name);
+        if (state->work_directory != NULL)
+                rmdir (state->work_directory);
+
+        free (state->stats_file_name);
+        free (state->input_file_name);
+        free (state->work_directory);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        state_t state = { 0 };
+        bool should_help = false, should_be_verbose = false, should_go_fast = false;
+        char *trace = NULL, *theme = NULL, *heads = NULL, *daemon_path = NULL;
+        char *kernel_command_line = NULL;
+        int frame_rate = 0;
+        int exit_code, status = 0;
+        struct rusage usage = { { 0 } };
+
+        state.input_fd = -1;
+        state.loop = ply_event_loop_get_default ();
+        state.command_parser = ply_command_parser_new ("plymouth-replay", "Play a recorded boot back");
+
+        ply_command_parser_add_options (state.command_parser,
+                                        "help", "This help message", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "debug", "Enable verbose debug logging", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "trace", "Recording to play back", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "theme", "Theme to show instead of the configured one", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "heads", "Offscreen heads, like 1920x1080 or 3840x2160@2", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "fast", "Send events as fast as the daemon takes them", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "frame-rate", "Frame rate the theme animates at", PLY_COMMAND_OPTION_TYPE_INTEGER,
+                                        "daemon", "plymouthd to run", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        "kernel-command-line", "More kernel command line for the daemon", PLY_COMMAND_OPTION_TYPE_STRING,
+                                        NULL);
+
+        if (!ply_command_parser_parse_arguments (state.command_parser, state.loop, argv, argc)) {
+                char *help_string;
+
+                help_string = ply_command_parser_get_help_string (state.command_parser);
+                ply_error ("%s", help_string);
+                free (help_string);
+                return 1;
+        }
+
+        ply_command_parser_get_options (state.command_parser,
+                                        "help", &should_help,
+                                        "debug", &should_be_verbose,
+                                        "trace", &trace,
+                                        "theme", &theme,
+                                        "heads", &heads,
+                                        "fast", &should_go_fast,
+                                        "frame-rate", &frame_rate,
+                                        "daemon", &daemon_path,
+                                        "kernel-command-line", &kernel_command_line,
+                                        NULL);
+
+        if (should_help || trace == NULL) {
+                char *help_string;
+
+                help_string = ply_command_parser_get_help_string (state.command_parser);
+                if (trace == NULL && !should_help)
+                        ply_error ("%s", help_string);
+                else
+                        printf ("%s", help_string);
+                free (help_string);
+                return should_help ? 0 : 1;
+        }
+
+        if (should_be_verbose && !ply_is_tracing ())
+                ply_toggle_tracing ();
+
+        state.should_go_fast = should_go_fast;
+        if (frame_rate <= 0)
+                frame_rate = DEFAULT_FRAME_RATE;
+
+        state.events = load_events (trace);
+        if (state.events == NULL) {
+                ply_error ("plymouth-replay: could not read %s: %m", trace);
+                return 1;
+        }
+
+        signal (SIGPIPE, SIG_IGN);
+
+        if (!start_daemon (&state,
+                           daemon_path != NULL ? daemon_path : PLYMOUTH_DAEMON_DIR "/plymouthd",
+                           theme,
+                           heads != NULL ? heads : DEFAULT_HEADS,
+                           kernel_command_line)) {
+                clean_up (&state);
+                return 1;
+        }
+
+        state.client = ply_boot_client_new ();
+        state.connect_start_time = ply_get_timestamp ();
+        on_connect_timeout (&state);
+
+        exit_code = ply_event_loop_run (state.loop);
+
+        if (state.daemon_pid > 0) {
+                if (exit_code != 0)
+                        kill (state.daemon_pid, SIGTERM);
+
+                while (wait4 (state.daemon_pid, &status, 0, &usage) < 0 && errno == EINTR);
+        }
+        state.end_time = ply_get_timestamp ();
+
+        if (exit_code == 0)
+                print_statistics (&state, &usage, frame_rate);
+
+        ply_boot_client_free (state.client);
+        free_events (state.events);
+        clean_up (&state);
+        ply_command_parser_free (state.command_parser);
+
+        free (trace);
+        free (theme);
+        free (heads);
+        free (daemon_path);
+        free (kernel_command_line);
+
+        return exit_code;
+}
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -28,11 +28,13 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 #include "ply-boot-client.h"
+#include "ply-buffer.h"
 #include "ply-command-parser.h"
 #include "ply-event-loop.h"
 #include "ply-logger.h"
@@ -81,6 +83,30 @@ typedef struct
         char    *keys;
 } key_answer_state_t;
 
+typedef struct
+{
+        state_t        *state;
+        ply_buffer_t   *input;
+        ply_fd_watch_t *input_watch;
+        int             number_of_pending_commands;
+        uint32_t        reached_end_of_input : 1;
+        uint32_t        had_failure : 1;
+} batch_state_t;
+
+typedef struct
+{
+        batch_state_t *batch_state;
+        char          *command_line;
+} batch_command_t;
+
+static void
+on_statistics_answer (state_t    *state,
+                      const char *statistics)
+{
+        printf ("%s", statistics);
+        ply_event_loop_exit (state->loop, 0);
+}
+
 static void
 on_ping_timeout (state_t *state)
 {
@@ -868,12 +894,510 @@ on_system_update_request (state_t    *state,
         }
 }
 
+static void
+maybe_finish_batch (batch_state_t *batch_state)
+{
+        if (!batch_state->reached_end_of_input ||
+            batch_state->number_of_pending_commands > 0)
+                return;
+
+        ply_event_loop_exit (batch_state->state->loop,
+                             batch_state->had_failure ? 1 : 0);
+}
+
+static void
+on_batch_command_done (batch_command_t *batch_command,
+                       bool             succeeded)
+{
+        batch_state_t *batch_state = batch_command->batch_state;
+
+        if (!succeeded) {
+                ply_trace ("batch: '%s' failed", batch_command->command_line);
+                batch_state->had_failure = true;
+        }
+
+        free (batch_command->command_line);
+        free (batch_command);
+
+        batch_state->number_of_pending_commands--;
+        maybe_finish_batch (batch_state);
+}
+
+static void
+on_batch_command_success (batch_command_t *batch_command)
+{
+        on_batch_command_done (batch_command, true);
+}
+
+static void
+on_batch_command_failure (batch_command_t *batch_command)
+{
+        on_batch_command_done (batch_command, false);
+}
+
+static void
+run_batch_command_line (batch_state_t *batch_state,
+                        char          *command_line)
+{
+        batch_command_t *batch_command;
+        const char *start;
+
+        start = command_line + strspn (command_line, " \t\r");
+
+        /* blank lines and comments are skipped */
+        if (*start == '\0' || *start == '#') {
+                free (command_line);
+                return;
+        }
+
+        batch_command = calloc (1, sizeof(batch_command_t));
+        batch_command->batch_state = batch_state;
+        batch_command->command_line = command_line;
+
+        batch_state->number_of_pending_commands++;
+        if (!ply_boot_client_queue_command_line (batch_state->state->client,
+                                                 command_line,
+                                                 (ply_boot_client_response_handler_t)
+                                                 on_batch_command_success,
+                                                 (ply_boot_client_response_handler_t)
+                                                 on_batch_command_failure,
+                                                 batch_command)) {
+                ply_error ("plymouth: can't run '%s' in batch mode", command_line);
+                on_batch_command_failure (batch_command);
+        }
+}
+
+static void
+run_complete_batch_command_lines (batch_state_t *batch_state)
+{
+        const char *bytes;
+        const char *end_of_line;
+        size_t size;
+
+        bytes = ply_buffer_get_bytes (batch_state->input);
+        size = ply_buffer_get_size (batch_state->input);
+
+        while ((end_of_line = memchr (bytes, '\n', size)) != NULL) {
+                size_t line_length = end_of_line - bytes;
+
+                run_batch_command_line (batch_state, strndup (bytes, line_length));
+
+                ply_buffer_remove_bytes (batch_state->input, line_length + 1);
+                bytes = ply_buffer_get_bytes (batch_state->input);
+                size = ply_buffer_get_size (batch_state->input);
+        }
+}
+
+static void
+finish_batch_input (batch_state_t *batch_state)
+{
+        size_t size;
+
+        if (batch_state->reached_end_of_input)
+                return;
+
+        /* the last line might not have a newline */
+        size = ply_buffer_get_size (batch_state->input);
+        if (size > 0) {
+                run_batch_command_line (batch_state,
+                                        strndup (ply_buffer_get_bytes (batch_state->input), size));
+                ply_buffer_clear (batch_state->input);
+        }
+
+        batch_state->reached_end_of_input = true;
+        maybe_finish_batch (batch_state);
+}
+
+/* Returns false once there's nothing more to read */
+static bool
+read_batch_input (batch_state_t *batch_state,
+                  int            fd)
+{
+        void *region;
+        size_t region_size;
+        ssize_t bytes_read;
+
+        region = ply_buffer_get_writable_region (batch_state->input, 4096, &region_size);
+
+        do {
+                bytes_read = read (fd, region, region_size);
+        } while (bytes_read < 0 && errno == EINTR);
+
+        if (bytes_read <= 0)
+                return bytes_read < 0 && errno == EAGAIN;
+
+        ply_buffer_commit (batch_state->input, bytes_read);
+        run_complete_batch_command_lines (batch_state);
+
+        return true;
+}
+
+static void
+on_batch_input (batch_state_t *batch_state,
+                int            fd)
+{
+        if (read_batch_input (batch_state, fd))
+                return;
+
+        ply_event_loop_stop_watching_fd (batch_state->state->loop,
+                                         batch_state->input_watch);
+        batch_state->input_watch = NULL;
+        finish_batch_input (batch_state);
+}
+
+static void
+on_batch_input_hangup (batch_state_t *batch_state,
+                       int            fd)
+{
+        batch_state->input_watch = NULL;
+
+        while (read_batch_input (batch_state, fd)) {
+        }
+
+        finish_batch_input (batch_state);
+}
+
+/* Reads commands like "update fsck:sda1:40" or "display-message Hello"
+ * from standard input, one per line, and sends them all over the one
+ * connection, so callers that have a lot to say don't have to start a
+ * plymouth for each.  The exit status is nonzero if any of them failed.
+ */
+static void
+start_batch (state_t       *state,
+             batch_state_t *batch_state)
+{
+        struct stat file_info;
+
+        batch_state->state = state;
+        batch_state->input = ply_buffer_new ();
+
+        /* regular files can't be polled, but reading them won't block
+         * either
+         */
+        if (fstat (STDIN_FILENO, &file_info) == 0 && S_ISREG (file_info.st_mode)) {
+                while (read_batch_input (batch_state, STDIN_FILENO)) {
+                }
+                finish_batch_input (batch_state);
+                return;
+        }
+
+        batch_state->input_watch =
+                ply_event_loop_watch_fd (state->loop, STDIN_FILENO,
+                                         PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                         (ply_event_handler_t) on_batch_input,
+                                         (ply_event_handler_t) on_batch_input_hangup,
+                                         batch_state);
+}
+
+/* Commands that only tell the daemon something, and don't do anything
+ * with the answer, skip the event loop and the command parser: the
+ * request goes out in one write, and the client exits without waiting
+ * for the ACK.  Anything else on the command line, --wait included,
+ * takes the usual way.
+ */
+typedef struct
+{
+        const char *name;
+        const char *option; /* the only one it takes, if any */
+        const char *request_command;
+} one_shot_command_t;
+
+static const one_shot_command_t one_shot_commands[] =
+{
+        { "update",           "status", PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE           },
+        { "display-message",  "text",   PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_MESSAGE     },
+        { "message",          "text",   PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_MESSAGE     },
+        { "hide-message",     "text",   PLY_BOOT_PROTOCOL_REQUEST_TYPE_HIDE_MESSAGE     },
+        { "pause-progress",   NULL,     PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_PAUSE   },
+        { "unpause-progress", NULL,     PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_UNPAUSE },
+        { "report-error",     NULL,     PLY_BOOT_PROTOCOL_REQUEST_TYPE_ERROR            },
+        { NULL }
+};
+
+/* Matches --option=value or --option value, and nothing else */
+static const char *
+get_only_option_value (int         argc,
+                       char      **argv,
+                       const char *option)
+{
+        size_t option_length;
+
+        if (argc < 1 || strncmp (argv[0], "--", strlen ("--")) != 0)
+                return NULL;
+
+        option_length = strlen (option);
+        if (strncmp (argv[0] + strlen ("--"), option, option_length) != 0)
+                return NULL;
+
+        if (argc == 1 && argv[0][strlen ("--") + option_length] == '=')
+                return argv[0] + strlen ("--") + option_length + 1;
+
+        if (argc == 2 && argv[0][strlen ("--") + option_length] == '\0')
+                return argv[1];
+
+        return NULL;
+}
+
+static bool
+send_one_shot_request (int    argc,
+                       char **argv,
+                       int   *exit_code)
+{
+        const one_shot_command_t *command = NULL;
+        const char *argument = NULL;
+        ply_boot_client_t *client;
+
+        if (argc < 2)
+                return false;
+
+        /* the old way of sending status updates */
+        argument = get_only_option_value (argc - 1, argv + 1, "update");
+        if (argument != NULL) {
+                command = &one_shot_commands[0];
+        } else {
+                for (command = one_shot_commands; command->name != NULL; command++) {
+                        if (strcmp (command->name, argv[1]) == 0)
+                                break;
+                }
+
+                if (command->name == NULL)
+                        return false;
+
+                if (command->option != NULL)
+                        argument = get_only_option_value (argc - 2, argv + 2, command->option);
+
+                if ((command->option == NULL && argc != 2) ||
+                    (command->option != NULL && argument == NULL))
+                        return false;
+        }
+
+        /* debugging goes through the usual way, so it gets traced */
+        if (ply_kernel_command_line_has_argument ("plymouth.debug"))
+                return false;
+
+        client = ply_boot_client_new ();
+
+        *exit_code = 1;
+        if (ply_boot_client_connect (client, NULL, NULL)) {
+                if (ply_boot_client_send_request_without_reply (client, command->request_command,
+                                                                argument))
+                        *exit_code = 0;
+                ply_boot_client_disconnect (client);
+        }
+
+        ply_boot_client_free (client);
+
+        return true;
+}
+
+/* Only the command given on the command line gets set up, if there is
+ * one, since each costs a few allocations and most runs use just one
+ */
+static bool
+should_add_command (const char *only_command,
+                    const char *name,
+                    bool       *has_added_commands)
+{
+        if (only_command != NULL && strcmp (only_command, "message") == 0)
+                only_command = "display-message";
+
+        if (only_command != NULL && strcmp (only_command, name) != 0)
+                return false;
+
+        *has_added_commands = true;
+        return true;
+}
+
+/* Returns false if only_command isn't a command at all */
+static bool
+add_commands (state_t    *state,
+              const char *only_command)
+{
+        bool has_added_commands = false;
+
+        if (should_add_command (only_command, "change-mode", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "change-mode", "Change the operation mode",
+                                                (ply_command_handler_t)
+                                                on_change_mode_request, state,
+                                                "boot-up", "Starting the system up",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                "shutdown", "Shutting the system down",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                "reboot", "Rebooting the system",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                "updates", "Applying updates",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                "system-upgrade", "Upgrading the OS to a new version",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                "firmware-upgrade", "Upgrading firmware to a new version",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                NULL);
+
+        if (should_add_command (only_command, "system-update", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "system-update", "Tell the daemon about updates progress",
+                                                (ply_command_handler_t)
+                                                on_system_update_request, state,
+                                                "progress", "The percentage progress of the updates",
+                                                PLY_COMMAND_OPTION_TYPE_INTEGER,
+                                                NULL);
+
+        if (should_add_command (only_command, "update", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "update", "Tell daemon about boot status changes",
+                                                (ply_command_handler_t)
+                                                on_update_request, state,
+                                                "status", "Tell daemon the current boot status",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                NULL);
+
+        if (should_add_command (only_command, "update-root-fs", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "update-root-fs", "Tell daemon about root filesystem changes",
+                                                (ply_command_handler_t)
+                                                on_update_root_fs_request, state,
+                                                "new-root-dir", "Root filesystem is about to change",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                "read-write", "Root filesystem is no longer read-only",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                NULL);
+
+        if (should_add_command (only_command, "show-splash", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "show-splash", "Tell daemon to show splash screen",
+                                                (ply_command_handler_t)
+                                                on_show_splash_request, state,
+                                                NULL);
+
+        if (should_add_command (only_command, "hide-splash", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "hide-splash", "Tell daemon to hide splash screen",
+                                                (ply_command_handler_t)
+                                                on_hide_splash_request, state,
+                                                NULL);
+
+        if (should_add_command (only_command, "ask-for-password", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "ask-for-password", "Ask user for password",
+                                                (ply_command_handler_t)
+                                                on_password_request, state,
+                                                "command", "Command to send password to via standard input",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                "prompt", "Message to display when asking for password",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                "number-of-tries", "Number of times to ask before giving up (requires --command)",
+                                                PLY_COMMAND_OPTION_TYPE_INTEGER,
+                                                "dont-pause-progress", "Don't pause boot progress bar while asking",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                NULL);
+
+        if (should_add_command (only_command, "ask-question", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "ask-question", "Ask user a question",
+                                                (ply_command_handler_t)
+                                                on_question_request, state,
+                                                "command", "Command to send the answer to via standard input",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                "prompt", "Message to display when asking the question",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                "dont-pause-progress", "Don't pause boot progress bar while asking",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG,
+                                                NULL);
+
+        if (should_add_command (only_command, "display-message", &has_added_commands)) {
+                ply_command_parser_add_command (state->command_parser,
+                                                "display-message", "Display a message",
+                                                (ply_command_handler_t)
+                                                on_display_message_request, state,
+                                                "text", "The message text",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                NULL);
+                ply_command_parser_add_command_alias (state->command_parser,
+                                                      "display-message",
+                                                      "message");
+        }
+
+        if (should_add_command (only_command, "hide-message", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "hide-message", "Hide a message",
+                                                (ply_command_handler_t)
+                                                on_hide_message_request, state,
+                                                "text", "The message text",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                NULL);
+
+        if (should_add_command (only_command, "watch-keystroke", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "watch-keystroke", "Become sensitive to a keystroke",
+                                                (ply_command_handler_t)
+                                                on_keystroke_request, state,
+                                                "command", "Command to send keystroke to via standard input",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                "keys", "Keys to become sensitive to",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                NULL);
+
+        if (should_add_command (only_command, "ignore-keystroke", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "ignore-keystroke", "Remove sensitivity to a keystroke",
+                                                (ply_command_handler_t)
+                                                on_keystroke_ignore, state,
+                                                "keys", "Keys to remove sensitivity to",
+                                                PLY_COMMAND_OPTION_TYPE_STRING,
+                                                NULL);
+
+        if (should_add_command (only_command, "pause-progress", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "pause-progress", "Pause boot progress bar",
+                                                (ply_command_handler_t)
+                                                on_progress_pause_request, state,
+                                                NULL);
+
+        if (should_add_command (only_command, "unpause-progress", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "unpause-progress", "Unpause boot progress bar",
+                                                (ply_command_handler_t)
+                                                on_progress_unpause_request, state,
+                                                NULL);
+
+        if (should_add_command (only_command, "report-error", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "report-error", "Tell boot daemon there were errors during boot",
+                                                (ply_command_handler_t)
+                                                on_report_error_request, state,
+                                                NULL);
+
+        if (should_add_command (only_command, "deactivate", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "deactivate", "Tell boot daemon to deactivate",
+                                                (ply_command_handler_t)
+                                                on_deactivate_request, state, NULL);
+
+        if (should_add_command (only_command, "reactivate", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "reactivate", "Tell boot daemon to reactivate",
+                                                (ply_command_handler_t)
+                                                on_reactivate_request, state, NULL);
+
+        if (should_add_command (only_command, "quit", &has_added_commands))
+                ply_command_parser_add_command (state->command_parser,
+                                                "quit", "Tell boot daemon to quit",
+                                                (ply_command_handler_t)
+                                                on_quit_request, state,
+                                                "retain-splash", "Don't explicitly hide boot splash on exit",
+                                                PLY_COMMAND_OPTION_TYPE_FLAG, NULL);
+
+        return has_added_commands;
+}
+
 int
 main (int    argc,
       char **argv)
 {
         state_t state = { 0 };
-        bool should_help, should_quit, should_ping, should_check_for_active_vt, should_sysinit, should_ask_for_password, should_show_splash, should_hide_splash, should_wait, should_be_verbose, report_error, should_get_plugin_path;
+        batch_state_t batch_state = { 0 };
+        bool should_batch, should_get_statistics, should_help, should_quit, should_ping, should_check_for_active_vt, should_sysinit, should_ask_for_password, should_show_splash, should_hide_splash, should_wait, should_be_verbose, report_error, should_get_plugin_path;
         bool is_connected;
         char *status, *chroot_dir, *ignore_keystroke;
         int exit_code;
@@ -882,6 +1406,9 @@ main (int    argc,
 
         signal (SIGPIPE, SIG_IGN);
 
+        if (send_one_shot_request (argc, argv, &exit_code))
+                return exit_code;
+
         state.loop = ply_event_loop_new ();
         state.client = ply_boot_client_new ();
         state.command_parser = ply_command_parser_new ("plymouth", "Splash control client");
@@ -902,160 +1429,12 @@ main (int    argc,
                                         "update", "Tell boot daemon an update about boot progress", PLY_COMMAND_OPTION_TYPE_STRING,
                                         "details", "Tell boot daemon there were errors during boot", PLY_COMMAND_OPTION_TYPE_FLAG,
                                         "wait", "Wait for boot daemon to quit", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "batch", "Read commands from standard input, one per line, and send them over one connection", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "stats", "Print the boot daemon's performance counters", PLY_COMMAND_OPTION_TYPE_FLAG,
                                         NULL);
 
-        ply_command_parser_add_command (state.command_parser,
-                                        "change-mode", "Change the operation mode",
-                                        (ply_command_handler_t)
-                                        on_change_mode_request, &state,
-                                        "boot-up", "Starting the system up",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        "shutdown", "Shutting the system down",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        "reboot", "Rebooting the system",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        "updates", "Applying updates",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        "system-upgrade", "Upgrading the OS to a new version",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        "firmware-upgrade", "Upgrading firmware to a new version",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "system-update", "Tell the daemon about updates progress",
-                                        (ply_command_handler_t)
-                                        on_system_update_request, &state,
-                                        "progress", "The percentage progress of the updates",
-                                        PLY_COMMAND_OPTION_TYPE_INTEGER,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "update", "Tell daemon about boot status changes",
-                                        (ply_command_handler_t)
-                                        on_update_request, &state,
-                                        "status", "Tell daemon the current boot status",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "update-root-fs", "Tell daemon about root filesystem changes",
-                                        (ply_command_handler_t)
-                                        on_update_root_fs_request, &state,
-                                        "new-root-dir", "Root filesystem is about to change",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        "read-write", "Root filesystem is no longer read-only",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "show-splash", "Tell daemon to show splash screen",
-                                        (ply_command_handler_t)
-                                        on_show_splash_request, &state,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "hide-splash", "Tell daemon to hide splash screen",
-                                        (ply_command_handler_t)
-                                        on_hide_splash_request, &state,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "ask-for-password", "Ask user for password",
-                                        (ply_command_handler_t)
-                                        on_password_request, &state,
-                                        "command", "Command to send password to via standard input",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        "prompt", "Message to display when asking for password",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        "number-of-tries", "Number of times to ask before giving up (requires --command)",
-                                        PLY_COMMAND_OPTION_TYPE_INTEGER,
-                                        "dont-pause-progress", "Don't pause boot progress bar while asking",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "ask-question", "Ask user a question",
-                                        (ply_command_handler_t)
-                                        on_question_request, &state,
-                                        "command", "Command to send the answer to via standard input",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        "prompt", "Message to display when asking the question",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        "dont-pause-progress", "Don't pause boot progress bar while asking",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "display-message", "Display a message",
-                                        (ply_command_handler_t)
-                                        on_display_message_request, &state,
-                                        "text", "The message text",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        NULL);
-        ply_command_parser_add_command_alias (state.command_parser,
-                                              "display-message",
-                                              "message");
-        ply_command_parser_add_command (state.command_parser,
-                                        "hide-message", "Hide a message",
-                                        (ply_command_handler_t)
-                                        on_hide_message_request, &state,
-                                        "text", "The message text",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "watch-keystroke", "Become sensitive to a keystroke",
-                                        (ply_command_handler_t)
-                                        on_keystroke_request, &state,
-                                        "command", "Command to send keystroke to via standard input",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        "keys", "Keys to become sensitive to",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "ignore-keystroke", "Remove sensitivity to a keystroke",
-                                        (ply_command_handler_t)
-                                        on_keystroke_ignore, &state,
-                                        "keys", "Keys to remove sensitivity to",
-                                        PLY_COMMAND_OPTION_TYPE_STRING,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "pause-progress", "Pause boot progress bar",
-                                        (ply_command_handler_t)
-                                        on_progress_pause_request, &state,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "unpause-progress", "Unpause boot progress bar",
-                                        (ply_command_handler_t)
-                                        on_progress_unpause_request, &state,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "report-error", "Tell boot daemon there were errors during boot",
-                                        (ply_command_handler_t)
-                                        on_report_error_request, &state,
-                                        NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "deactivate", "Tell boot daemon to deactivate",
-                                        (ply_command_handler_t)
-                                        on_deactivate_request, &state, NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "reactivate", "Tell boot daemon to reactivate",
-                                        (ply_command_handler_t)
-                                        on_reactivate_request, &state, NULL);
-
-        ply_command_parser_add_command (state.command_parser,
-                                        "quit", "Tell boot daemon to quit",
-                                        (ply_command_handler_t)
-                                        on_quit_request, &state,
-                                        "retain-splash", "Don't explicitly hide boot splash on exit",
-                                        PLY_COMMAND_OPTION_TYPE_FLAG, NULL);
+        if (argc < 2 || argv[1][0] == '-' || !add_commands (&state, argv[1]))
+                add_commands (&state, NULL);
 
         if (!ply_command_parser_parse_arguments (state.command_parser, state.loop, argv, argc)) {
                 char *help_string;
@@ -1084,6 +1463,8 @@ main (int    argc,
                                         "update", &status,
                                         "wait", &should_wait,
                                         "details", &report_error,
+                                        "batch", &should_batch,
+                                        "stats", &should_get_statistics,
                                         NULL);
 
         if (should_help || argc < 2) {
@@ -1133,7 +1514,15 @@ main (int    argc,
 
         ply_boot_client_attach_to_event_loop (state.client, state.loop);
 
-        if (should_show_splash) {
+        if (should_batch) {
+                start_batch (&state, &batch_state);
+        } else if (should_get_statistics) {
+                ply_boot_client_ask_daemon_for_statistics (state.client,
+                                                           (ply_boot_client_answer_handler_t)
+                                                           on_statistics_answer,
+                                                           (ply_boot_client_response_handler_t)
+                                                           on_failure, &state);
+        } else if (should_show_splash) {
                 ply_boot_client_tell_daemon_to_show_splash (state.client,
                                                             (ply_boot_client_response_handler_t)
                                                             on_success,
@@ -1215,6 +1604,9 @@ main (int    argc,
 
         exit_code = ply_event_loop_run (state.loop);
 
+        if (batch_state.input != NULL)
+                ply_buffer_free (batch_state.input);
+
         ply_boot_client_free (state.client);
 
         ply_event_loop_free (state.loop);
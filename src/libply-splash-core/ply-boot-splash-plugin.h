@@ -69,6 +69,11 @@ typedef struct
                                    ply_event_loop_t         *loop,
                                    ply_buffer_t             *boot_buffer,
                                    ply_boot_splash_mode_t    mode);
+        /* optional, switches a splash that's shown to another mode
+         * without hiding and loading it again; returns false when the
+         * plugin can't, and then it gets hidden and shown again instead */
+        bool (*change_mode)(ply_boot_splash_plugin_t *plugin,
+                            ply_boot_splash_mode_t    mode);
         void (*system_update)(ply_boot_splash_plugin_t *plugin,
                               int                       progress);
         void (*update_status)(ply_boot_splash_plugin_t *plugin,
@@ -95,6 +100,9 @@ typedef struct
                                  const char               *entry_text);
         void (*become_idle)(ply_boot_splash_plugin_t *plugin,
                             ply_trigger_t            *idle_trigger);
+        /* optional, frees what can be loaded again later while the
+         * splash sits inactive, keeping what the last frame needs */
+        void (*trim_memory)(ply_boot_splash_plugin_t *plugin);
 } ply_boot_splash_plugin_interface_t;
 
 #endif /* PLY_BOOT_SPLASH_PLUGIN_H */
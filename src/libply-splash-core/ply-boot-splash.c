@@ -24,11 +24,17 @@
 #include "ply-boot-splash.h"
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <wchar.h>
@@ -36,8 +42,11 @@
 #include "ply-boot-splash-plugin.h"
 #include "ply-terminal.h"
 #include "ply-event-loop.h"
+#include "ply-frame-clock.h"
 #include "ply-list.h"
 #include "ply-logger.h"
+#include "ply-pixel-buffer.h"
+#include "ply-statistics.h"
 #include "ply-trigger.h"
 #include "ply-utils.h"
 #include "ply-progress.h"
@@ -70,6 +79,11 @@ struct _ply_boot_splash
         ply_boot_splash_on_idle_handler_t         idle_handler;
         void                                     *idle_handler_user_data;
 
+        /* Kept out of the bit fields below, which the load thread writes */
+        pthread_t                                 load_thread;
+        int                                       load_errno;
+        bool                                      is_loading_in_background;
+
         uint32_t                                  is_loaded : 1;
         uint32_t                                  should_force_text_mode : 1;
 };
@@ -78,6 +92,7 @@ typedef const ply_boot_splash_plugin_interface_t *
 (*get_plugin_interface_function_t) (void);
 
 static void ply_boot_splash_update_progress (ply_boot_splash_t *splash);
+static void ply_boot_splash_stop_progress_updates (ply_boot_splash_t *splash);
 static void ply_boot_splash_detach_from_event_loop (ply_boot_splash_t *splash);
 
 ply_boot_splash_t *
@@ -195,15 +210,146 @@ ply_boot_splash_remove_text_display (ply_boot_splash_t  *splash,
         ply_list_remove_data (splash->text_displays, display);
 }
 
-bool
-ply_boot_splash_load (ply_boot_splash_t *splash)
+/* Themes keep their images in the theme directory, or in a folder or
+ * two under it */
+#define PREFETCH_MAX_DEPTH 2
+
+/* Asks the kernel to start reading in every file in a theme directory,
+ * so the images are already in the page cache when the plugin gets to
+ * them.  This doesn't wait for the reads to finish.
+ */
+static void
+prefetch_directory_at (int         parent_fd,
+                       const char *path,
+                       int         depth)
+{
+        struct dirent *entry;
+        DIR *dir;
+        int dir_fd, fd;
+
+        dir_fd = openat (parent_fd, path, O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+
+        if (dir_fd < 0)
+                return;
+
+        dir = fdopendir (dir_fd);
+
+        if (dir == NULL) {
+                close (dir_fd);
+                return;
+        }
+
+        while ((entry = readdir (dir)) != NULL) {
+                unsigned char type = entry->d_type;
+
+                if (entry->d_name[0] == '.')
+                        continue;
+
+                if (type == DT_UNKNOWN) {
+                        struct stat file_info;
+
+                        if (fstatat (dirfd (dir), entry->d_name, &file_info, AT_SYMLINK_NOFOLLOW) < 0)
+                                continue;
+
+                        if (S_ISDIR (file_info.st_mode))
+                                type = DT_DIR;
+                        else if (S_ISREG (file_info.st_mode))
+                                type = DT_REG;
+                }
+
+                if (type == DT_DIR) {
+                        if (depth < PREFETCH_MAX_DEPTH)
+                                prefetch_directory_at (dirfd (dir), entry->d_name, depth + 1);
+                        continue;
+                }
+
+                if (type != DT_REG)
+                        continue;
+
+                fd = openat (dirfd (dir), entry->d_name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+
+                if (fd < 0)
+                        continue;
+
+                posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+                close (fd);
+        }
+
+        closedir (dir);
+}
+
+static void
+prefetch_directory (const char *path)
+{
+        prefetch_directory_at (AT_FDCWD, path, 0);
+}
+
+static void
+prefetch_theme (ply_boot_splash_t *splash,
+                ply_key_file_t    *key_file,
+                const char        *module_name)
+{
+        char *theme_dir, *image_dir;
+
+        theme_dir = strdup (splash->theme_path);
+        prefetch_directory (dirname (theme_dir));
+
+        image_dir = ply_key_file_get_value (key_file, module_name, "ImageDir");
+        if (image_dir != NULL && strcmp (image_dir, theme_dir) != 0)
+                prefetch_directory (image_dir);
+
+        free (image_dir);
+        free (theme_dir);
+}
+
+/* plymouthd can be built with one of the splash plugins in it, which
+ * then gets used instead of the plugin's module on disk, saving the
+ * load of the module and the libraries it pulls in.
+ */
+static get_plugin_interface_function_t
+look_up_built_in_plugin (ply_boot_splash_t *splash,
+                         const char        *module_name)
+{
+        get_plugin_interface_function_t get_boot_splash_plugin_interface;
+        char *function_name, *p;
+
+        if (module_name == NULL)
+                return NULL;
+
+        splash->module_handle = ply_open_built_in_module ();
+
+        if (splash->module_handle == NULL)
+                return NULL;
+
+        asprintf (&function_name, "ply_boot_splash_%s_get_interface", module_name);
+        for (p = function_name; *p != '\0'; p++) {
+                if (*p == '-')
+                        *p = '_';
+        }
+
+        get_boot_splash_plugin_interface = (get_plugin_interface_function_t)
+                                           ply_module_look_up_function (splash->module_handle,
+                                                                        function_name);
+        free (function_name);
+
+        if (get_boot_splash_plugin_interface == NULL) {
+                ply_close_module (splash->module_handle);
+                splash->module_handle = NULL;
+                return NULL;
+        }
+
+        ply_trace ("using built-in splash plugin %s", module_name);
+
+        return get_boot_splash_plugin_interface;
+}
+
+static bool
+ply_boot_splash_load_plugin (ply_boot_splash_t *splash)
 {
         ply_key_file_t *key_file;
         char *module_name;
         char *module_path;
 
-        assert (splash != NULL);
-
         get_plugin_interface_function_t get_boot_splash_plugin_interface;
 
         key_file = ply_key_file_new (splash->theme_path);
@@ -215,22 +361,32 @@ ply_boot_splash_load (ply_boot_splash_t *splash)
 
         module_name = ply_key_file_get_value (key_file, "Plymouth Theme", "ModuleName");
 
-        asprintf (&module_path, "%s%s.so",
-                  splash->plugin_dir, module_name);
-        free (module_name);
+        /* the plugin reads its images one at a time as it loads them, so
+         * get them all coming now */
+        if (module_name != NULL)
+                prefetch_theme (splash, key_file, module_name);
 
-        splash->module_handle = ply_open_module (module_path);
+        get_boot_splash_plugin_interface = look_up_built_in_plugin (splash, module_name);
 
-        free (module_path);
+        if (get_boot_splash_plugin_interface == NULL) {
+                asprintf (&module_path, "%s%s.so",
+                          splash->plugin_dir, module_name);
 
-        if (splash->module_handle == NULL) {
-                ply_key_file_free (key_file);
-                return false;
-        }
+                splash->module_handle = ply_open_module (module_path);
 
-        get_boot_splash_plugin_interface = (get_plugin_interface_function_t)
-                                           ply_module_look_up_function (splash->module_handle,
-                                                                        "ply_boot_splash_plugin_get_interface");
+                free (module_path);
+
+                if (splash->module_handle == NULL) {
+                        free (module_name);
+                        ply_key_file_free (key_file);
+                        return false;
+                }
+
+                get_boot_splash_plugin_interface = (get_plugin_interface_function_t)
+                                                   ply_module_look_up_function (splash->module_handle,
+                                                                                "ply_boot_splash_plugin_get_interface");
+        }
+        free (module_name);
 
         if (get_boot_splash_plugin_interface == NULL) {
                 ply_save_errno ();
@@ -263,6 +419,73 @@ ply_boot_splash_load (ply_boot_splash_t *splash)
         return true;
 }
 
+static void *
+ply_boot_splash_load_in_thread (ply_boot_splash_t *splash)
+{
+        bool is_loaded;
+
+        is_loaded = ply_boot_splash_load_plugin (splash);
+
+        if (!is_loaded)
+                splash->load_errno = errno;
+
+        return (void *) (intptr_t) is_loaded;
+}
+
+/* Nothing may touch the splash besides ply_boot_splash_load and
+ * ply_boot_splash_free until the load is joined, and the plugin's
+ * create_plugin has to be safe to run off the event loop's thread.
+ */
+void
+ply_boot_splash_load_in_background (ply_boot_splash_t *splash)
+{
+        assert (splash != NULL);
+        assert (!splash->is_loaded);
+
+        if (splash->is_loading_in_background)
+                return;
+
+        if (pthread_create (&splash->load_thread, NULL,
+                            (void *(*)(void *))ply_boot_splash_load_in_thread, splash) != 0) {
+                ply_trace ("could not start loading splash in the background: %m");
+                return;
+        }
+
+        splash->is_loading_in_background = true;
+}
+
+static bool
+ply_boot_splash_join_load_thread (ply_boot_splash_t *splash)
+{
+        void *result;
+
+        pthread_join (splash->load_thread, &result);
+        splash->is_loading_in_background = false;
+
+        if (result == NULL) {
+                errno = splash->load_errno;
+                return false;
+        }
+
+        return true;
+}
+
+bool
+ply_boot_splash_load (ply_boot_splash_t *splash)
+{
+        assert (splash != NULL);
+
+        if (splash->is_loading_in_background) {
+                ply_trace ("waiting for splash to finish loading in the background");
+                return ply_boot_splash_join_load_thread (splash);
+        }
+
+        if (splash->is_loaded)
+                return true;
+
+        return ply_boot_splash_load_plugin (splash);
+}
+
 bool
 ply_boot_splash_load_built_in (ply_boot_splash_t *splash)
 {
@@ -391,12 +614,12 @@ ply_boot_splash_free (ply_boot_splash_t *splash)
         if (splash == NULL)
                 return;
 
+        if (splash->is_loading_in_background)
+                ply_boot_splash_join_load_thread (splash);
+
         if (splash->loop != NULL) {
-                if (splash->plugin_interface->on_boot_progress != NULL) {
-                        ply_event_loop_stop_watching_for_timeout (splash->loop,
-                                                                  (ply_event_loop_timeout_handler_t)
-                                                                  ply_boot_splash_update_progress, splash);
-                }
+                if (splash->plugin_interface->on_boot_progress != NULL)
+                        ply_boot_splash_stop_progress_updates (splash);
 
                 ply_event_loop_stop_watching_for_exit (splash->loop, (ply_event_loop_exit_handler_t)
                                                        ply_boot_splash_detach_from_event_loop,
@@ -440,13 +663,28 @@ ply_boot_splash_update_progress (ply_boot_splash_t *splash)
                 splash->plugin_interface->on_boot_progress (splash->plugin,
                                                             time,
                                                             percentage);
+}
 
-        ply_event_loop_watch_for_timeout (splash->loop,
-                                          1.0 / UPDATES_PER_SECOND,
-                                          (ply_event_loop_timeout_handler_t)
+/* Progress gets sampled along with the animations' frames, and widgets
+ * only redraw when what they show actually moves */
+static void
+ply_boot_splash_start_progress_updates (ply_boot_splash_t *splash)
+{
+        ply_boot_splash_update_progress (splash);
+        ply_frame_clock_watch_for_frames (ply_frame_clock_get_default (),
+                                          UPDATES_PER_SECOND,
+                                          (ply_frame_clock_handler_t)
                                           ply_boot_splash_update_progress, splash);
 }
 
+static void
+ply_boot_splash_stop_progress_updates (ply_boot_splash_t *splash)
+{
+        ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                  (ply_frame_clock_handler_t)
+                                                  ply_boot_splash_update_progress, splash);
+}
+
 void
 ply_boot_splash_attach_progress (ply_boot_splash_t *splash,
                                  ply_progress_t    *progress)
@@ -462,6 +700,9 @@ bool
 ply_boot_splash_show (ply_boot_splash_t     *splash,
                       ply_boot_splash_mode_t mode)
 {
+        double start_time;
+        bool is_shown;
+
         assert (splash != NULL);
         assert (mode != PLY_BOOT_SPLASH_MODE_INVALID);
         assert (splash->module_handle != NULL);
@@ -474,20 +715,29 @@ ply_boot_splash_show (ply_boot_splash_t     *splash,
                 ply_trace ("already set same splash screen mode");
                 return true;
         } else if (splash->mode != PLY_BOOT_SPLASH_MODE_INVALID) {
+                if (splash->plugin_interface->change_mode != NULL &&
+                    splash->plugin_interface->change_mode (splash->plugin, mode)) {
+                        ply_trace ("changed splash screen mode");
+                        splash->mode = mode;
+                        return true;
+                }
+
                 splash->plugin_interface->hide_splash_screen (splash->plugin,
                                                               splash->loop);
-                if (splash->plugin_interface->on_boot_progress != NULL) {
-                        ply_event_loop_stop_watching_for_timeout (splash->loop,
-                                                                  (ply_event_loop_timeout_handler_t)
-                                                                  ply_boot_splash_update_progress, splash);
-                }
+                if (splash->plugin_interface->on_boot_progress != NULL)
+                        ply_boot_splash_stop_progress_updates (splash);
         }
 
         ply_trace ("showing splash screen");
-        if (!splash->plugin_interface->show_splash_screen (splash->plugin,
-                                                           splash->loop,
-                                                           splash->boot_buffer,
-                                                           mode)) {
+        start_time = ply_get_timestamp ();
+        is_shown = splash->plugin_interface->show_splash_screen (splash->plugin,
+                                                                 splash->loop,
+                                                                 splash->boot_buffer,
+                                                                 mode);
+        ply_statistics_add_timeline_span ("show-splash-screen", splash->theme_path,
+                                          start_time, ply_get_timestamp ());
+
+        if (!is_shown) {
                 ply_save_errno ();
                 ply_trace ("can't show splash: %m");
                 ply_restore_errno ();
@@ -495,7 +745,7 @@ ply_boot_splash_show (ply_boot_splash_t     *splash,
         }
 
         if (splash->plugin_interface->on_boot_progress != NULL)
-                ply_boot_splash_update_progress (splash);
+                ply_boot_splash_start_progress_updates (splash);
 
         splash->mode = mode;
         return true;
@@ -576,11 +826,8 @@ ply_boot_splash_hide (ply_boot_splash_t *splash)
         splash->mode = PLY_BOOT_SPLASH_MODE_INVALID;
 
         if (splash->loop != NULL) {
-                if (splash->plugin_interface->on_boot_progress != NULL) {
-                        ply_event_loop_stop_watching_for_timeout (splash->loop,
-                                                                  (ply_event_loop_timeout_handler_t)
-                                                                  ply_boot_splash_update_progress, splash);
-                }
+                if (splash->plugin_interface->on_boot_progress != NULL)
+                        ply_boot_splash_stop_progress_updates (splash);
 
                 ply_event_loop_stop_watching_for_exit (splash->loop, (ply_event_loop_exit_handler_t)
                                                        ply_boot_splash_detach_from_event_loop,
@@ -711,4 +958,22 @@ ply_boot_splash_uses_pixel_displays (ply_boot_splash_t *splash)
         return splash->plugin_interface->add_pixel_display != NULL;
 }
 
+/* For a splash that is staying up without changing for a while, like
+ * after being deactivated
+ */
+void
+ply_boot_splash_trim_memory (ply_boot_splash_t *splash)
+{
+        assert (splash != NULL);
+
+        ply_trace ("trimming splash memory");
+
+        if (splash->plugin_interface != NULL &&
+            splash->plugin_interface->trim_memory != NULL)
+                splash->plugin_interface->trim_memory (splash->plugin);
+
+        ply_pixel_buffer_flush_cache ();
+        ply_trim_memory ();
+}
+
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
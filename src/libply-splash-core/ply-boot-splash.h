@@ -46,6 +46,12 @@ ply_boot_splash_t *ply_boot_splash_new (const char   *theme_path,
                                         ply_buffer_t *boot_buffer);
 
 bool ply_boot_splash_load (ply_boot_splash_t *splash);
+
+/* Starts loading the theme and its plugin on another thread, and has
+ * the kernel read the theme's files in.  ply_boot_splash_load waits for
+ * it to finish.
+ */
+void ply_boot_splash_load_in_background (ply_boot_splash_t *splash);
 bool ply_boot_splash_load_built_in (ply_boot_splash_t *splash);
 void ply_boot_splash_unload (ply_boot_splash_t *splash);
 void ply_boot_splash_set_keyboard (ply_boot_splash_t *splash,
@@ -90,6 +96,7 @@ void ply_boot_splash_become_idle (ply_boot_splash_t                *splash,
                                   ply_boot_splash_on_idle_handler_t idle_handler,
                                   void                             *user_data);
 bool ply_boot_splash_uses_pixel_displays (ply_boot_splash_t *splash);
+void ply_boot_splash_trim_memory (ply_boot_splash_t *splash);
 
 
 #endif
@@ -43,6 +43,12 @@
 #define SUBSYSTEM_DRM "drm"
 #define SUBSYSTEM_FRAME_BUFFER "graphics"
 
+/* udev events are held until none have come in for this long, or until
+ * the first of them has waited the longest time, and then handled in
+ * one go */
+#define UDEV_EVENT_SETTLE_TIME 0.1
+#define UDEV_EVENT_MAX_DELAY   0.5
+
 #ifdef HAVE_UDEV
 static void create_devices_from_udev (ply_device_manager_t *manager);
 #endif
@@ -53,6 +59,8 @@ static bool create_devices_for_terminal_and_renderer_type (ply_device_manager_t
                                                            ply_renderer_type_t   renderer_type);
 static void create_pixel_displays_for_renderer (ply_device_manager_t *manager,
                                                 ply_renderer_t       *renderer);
+static void update_pixel_displays_for_renderer (ply_device_manager_t *manager,
+                                                ply_renderer_t       *renderer);
 
 struct _ply_device_manager
 {
@@ -67,6 +75,8 @@ struct _ply_device_manager
         struct udev               *udev_context;
         struct udev_monitor       *udev_monitor;
         ply_fd_watch_t            *fd_watch;
+        ply_list_t                *pending_udev_events;
+        double                     pending_udev_events_start_time;
 
         ply_keyboard_added_handler_t         keyboard_added_handler;
         ply_keyboard_removed_handler_t       keyboard_removed_handler;
@@ -86,8 +96,19 @@ struct _ply_device_manager
         uint32_t                    device_timeout_elapsed : 1;
         uint32_t                    found_drm_device : 1;
         uint32_t                    found_fb_device : 1;
+        uint32_t                    is_waiting_for_udev_events_to_settle : 1;
 };
 
+typedef struct
+{
+        char               *device_path;
+
+        /* the last add or change event, if it came after any remove */
+        struct udev_device *device;
+
+        uint32_t            was_removed : 1;
+} ply_pending_udev_event_t;
+
 static void
 detach_from_event_loop (ply_device_manager_t *manager)
 {
@@ -399,10 +420,8 @@ on_drm_udev_add_or_change (ply_device_manager_t *manager,
                 return;
 
         changed = ply_renderer_handle_change_event (renderer);
-        if (changed) {
-                free_displays_for_renderer (manager, renderer);
-                create_pixel_displays_for_renderer (manager, renderer);
-        }
+        if (changed)
+                update_pixel_displays_for_renderer (manager, renderer);
 }
 
 static bool
@@ -431,40 +450,128 @@ verify_add_or_change (ply_device_manager_t *manager,
         return true;
 }
 
-static bool
-duplicate_device_path (ply_list_t *events, const char *device_path)
+static ply_pending_udev_event_t *
+get_pending_udev_event (ply_device_manager_t *manager,
+                        const char           *device_path)
 {
-        struct udev_device *device;
+        ply_pending_udev_event_t *event;
         ply_list_node_t *node;
 
-        for (node = ply_list_get_first_node (events);
-             node; node = ply_list_get_next_node (events, node)) {
-                device = ply_list_node_get_data (node);
+        for (node = ply_list_get_first_node (manager->pending_udev_events);
+             node; node = ply_list_get_next_node (manager->pending_udev_events, node)) {
+                event = ply_list_node_get_data (node);
 
-                if (strcmp (udev_device_get_devnode (device), device_path) == 0)
-                        return true;
+                if (strcmp (event->device_path, device_path) == 0)
+                        return event;
         }
 
-        return false;
+        event = calloc (1, sizeof(ply_pending_udev_event_t));
+        event->device_path = strdup (device_path);
+        ply_list_append_data (manager->pending_udev_events, event);
+
+        return event;
 }
 
 static void
-process_udev_add_or_change_events (ply_device_manager_t *manager, ply_list_t *events)
+free_pending_udev_event (ply_pending_udev_event_t *event)
 {
-        const char *action, *device_path;
-        struct udev_device *device;
+        if (event->device != NULL)
+                udev_device_unref (event->device);
+
+        free (event->device_path);
+        free (event);
+}
+
+static void
+stop_waiting_for_udev_events_to_settle (ply_device_manager_t *manager);
+
+/*
+ * During the initial monitor/connector enumeration on boot the kernel
+ * fires a large number of change events, and handing over from one
+ * driver to another (simpledrm to a native one) removes and adds cards
+ * in quick succession. If we process these 1 by 1, we spend a lot of
+ * time probing the drm-connectors and tear down and set up displays over
+ * and over.  So instead they are collected until they settle, with only
+ * the last state of each device kept, and every device is handled once.
+ */
+static void
+process_pending_udev_events (ply_device_manager_t *manager)
+{
+        ply_pending_udev_event_t *event;
         ply_list_node_t *node;
 
-        while ((node = ply_list_get_first_node (events))) {
-                device = ply_list_node_get_data (node);
-                action = udev_device_get_action (device);
-                device_path = udev_device_get_devnode (device);
+        stop_waiting_for_udev_events_to_settle (manager);
 
-                on_drm_udev_add_or_change (manager, action, device_path, device);
+        /* Removes go first, so a card that went away doesn't hold on to
+         * the console while the one replacing it gets set up */
+        for (node = ply_list_get_first_node (manager->pending_udev_events);
+             node; node = ply_list_get_next_node (manager->pending_udev_events, node)) {
+                event = ply_list_node_get_data (node);
 
-                ply_list_remove_node (events, node);
-                udev_device_unref (device);
+                if (event->was_removed)
+                        free_devices_from_device_path (manager, event->device_path, true);
         }
+
+        while ((node = ply_list_get_first_node (manager->pending_udev_events))) {
+                const char *action;
+
+                event = ply_list_node_get_data (node);
+                ply_list_remove_node (manager->pending_udev_events, node);
+
+                if (event->device != NULL) {
+                        action = udev_device_get_action (event->device);
+
+                        if (verify_add_or_change (manager, action, event->device_path, event->device))
+                                on_drm_udev_add_or_change (manager, action, event->device_path, event->device);
+                }
+
+                free_pending_udev_event (event);
+        }
+}
+
+static void
+on_udev_events_settled (ply_device_manager_t *manager)
+{
+        manager->is_waiting_for_udev_events_to_settle = false;
+        process_pending_udev_events (manager);
+}
+
+static void
+stop_waiting_for_udev_events_to_settle (ply_device_manager_t *manager)
+{
+        if (!manager->is_waiting_for_udev_events_to_settle)
+                return;
+
+        ply_event_loop_stop_watching_for_timeout (manager->loop,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_udev_events_settled,
+                                                  manager);
+        manager->is_waiting_for_udev_events_to_settle = false;
+}
+
+static void
+wait_for_udev_events_to_settle (ply_device_manager_t *manager)
+{
+        double time_left;
+
+        stop_waiting_for_udev_events_to_settle (manager);
+
+        time_left = UDEV_EVENT_MAX_DELAY - (ply_get_timestamp () - manager->pending_udev_events_start_time);
+
+        if (time_left > UDEV_EVENT_SETTLE_TIME)
+                time_left = UDEV_EVENT_SETTLE_TIME;
+
+        if (time_left <= 0.0) {
+                process_pending_udev_events (manager);
+                return;
+        }
+
+        ply_event_loop_watch_for_timeout (manager->loop,
+                                          time_left,
+                                          (ply_event_loop_timeout_handler_t)
+                                          on_udev_events_settled,
+                                          manager);
+        manager->is_waiting_for_udev_events_to_settle = true;
 }
 
 static void
@@ -472,18 +579,10 @@ on_udev_event (ply_device_manager_t *manager)
 {
         const char *action, *device_path;
         struct udev_device *device;
-        ply_list_t *pending_events;
 
-        pending_events = ply_list_new ();
-
-        /*
-         * During the initial monitor/connector enumeration on boot the kernel
-         * fires a large number of change events. If we process these 1 by 1,
-         * we spend a lot of time probing the drm-connectors. So instead we
-         * collect them all and then coalescence them so that if there are multiple
-         * change events pending for a single card, we only re-probe the card once.
-         */
         while ((device = udev_monitor_receive_device (manager->udev_monitor))) {
+                ply_pending_udev_event_t *event;
+
                 action = udev_device_get_action (device);
                 device_path = udev_device_get_devnode (device);
 
@@ -492,33 +591,36 @@ on_udev_event (ply_device_manager_t *manager)
 
                 ply_trace ("got %s event for device %s", action, device_path);
 
-                /*
-                 * Add/change events before and after a remove may not be
-                 * coalesced together. So flush the queue and then process
-                 * the remove event immediately.
-                 */
-                if (strcmp (action, "remove") == 0) {
-                        process_udev_add_or_change_events (manager, pending_events);
-                        free_devices_from_device_path (manager, device_path, true);
+                if (strcmp (action, "remove") && strcmp (action, "add") && strcmp (action, "change"))
                         goto unref;
-                }
 
-                if (!verify_add_or_change (manager, action, device_path, device))
-                        goto unref;
+                if (ply_list_get_length (manager->pending_udev_events) == 0)
+                        manager->pending_udev_events_start_time = ply_get_timestamp ();
 
-                if (duplicate_device_path (pending_events, device_path)) {
-                        ply_trace ("ignoring duplicate %s event for device %s", action, device_path);
-                        goto unref;
+                event = get_pending_udev_event (manager, device_path);
+
+                if (event->device != NULL) {
+                        ply_trace ("dropping earlier %s event for device %s",
+                                   udev_device_get_action (event->device), device_path);
+                        udev_device_unref (event->device);
+                        event->device = NULL;
                 }
 
-                ply_list_append_data (pending_events, udev_device_ref(device));
+                /*
+                 * Add/change events before and after a remove may not be
+                 * coalesced together, so the remove gets handled before
+                 * whatever came after it.
+                 */
+                if (strcmp (action, "remove") == 0)
+                        event->was_removed = true;
+                else
+                        event->device = udev_device_ref (device);
 unref:
                 udev_device_unref (device);
         }
 
-        process_udev_add_or_change_events (manager, pending_events);
-
-        ply_list_free (pending_events);
+        if (ply_list_get_length (manager->pending_udev_events) > 0)
+                wait_for_udev_events_to_settle (manager);
 }
 
 static void
@@ -560,6 +662,8 @@ stop_watching_for_udev_events (ply_device_manager_t *manager)
 
         ply_event_loop_stop_watching_fd (manager->loop, manager->fd_watch);
         manager->fd_watch = NULL;
+
+        stop_waiting_for_udev_events_to_settle (manager);
 }
 #endif
 
@@ -654,6 +758,8 @@ ply_device_manager_new (const char                *default_tty,
         manager->flags = flags;
 
 #ifdef HAVE_UDEV
+        manager->pending_udev_events = ply_list_new ();
+
         if (!(flags & PLY_DEVICE_MANAGER_FLAGS_IGNORE_UDEV))
                 manager->udev_context = udev_new ();
 #else
@@ -668,6 +774,10 @@ ply_device_manager_new (const char                *default_tty,
 void
 ply_device_manager_free (ply_device_manager_t *manager)
 {
+#ifdef HAVE_UDEV
+        ply_list_node_t *node;
+#endif
+
         ply_trace ("freeing device manager");
 
         if (manager == NULL)
@@ -688,6 +798,13 @@ ply_device_manager_free (ply_device_manager_t *manager)
         ply_event_loop_stop_watching_for_timeout (manager->loop,
                                          (ply_event_loop_timeout_handler_t)
                                          create_devices_from_udev, manager);
+        stop_waiting_for_udev_events_to_settle (manager);
+
+        while ((node = ply_list_get_first_node (manager->pending_udev_events))) {
+                free_pending_udev_event (ply_list_node_get_data (node));
+                ply_list_remove_node (manager->pending_udev_events, node);
+        }
+        ply_list_free (manager->pending_udev_events);
 
         if (manager->udev_monitor != NULL)
                 udev_monitor_unref (manager->udev_monitor);
@@ -802,6 +919,96 @@ create_pixel_displays_for_renderer (ply_device_manager_t *manager,
         }
 }
 
+static bool
+display_is_for_head_in_list (ply_pixel_display_t *display,
+                             ply_list_t          *heads)
+{
+        ply_renderer_head_t *head;
+        ply_list_node_t *node;
+
+        head = ply_pixel_display_get_renderer_head (display);
+
+        for (node = ply_list_get_first_node (heads);
+             node; node = ply_list_get_next_node (heads, node)) {
+                if (ply_list_node_get_data (node) == head)
+                        return ply_renderer_get_head_epoch (ply_pixel_display_get_renderer (display), head) ==
+                               ply_pixel_display_get_renderer_head_epoch (display);
+        }
+
+        return false;
+}
+
+static bool
+head_has_display (ply_device_manager_t *manager,
+                  ply_renderer_t       *renderer,
+                  ply_renderer_head_t  *head)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (manager->pixel_displays);
+             node; node = ply_list_get_next_node (manager->pixel_displays, node)) {
+                ply_pixel_display_t *display = ply_list_node_get_data (node);
+
+                if (ply_pixel_display_get_renderer (display) == renderer &&
+                    ply_pixel_display_get_renderer_head (display) == head)
+                        return true;
+        }
+
+        return false;
+}
+
+/* Brings the displays in line with the renderer's heads after a hotplug.
+ * Displays for heads that are still there, in the same epoch, are kept
+ * with everything drawn to them, so only screens that changed get redrawn.
+ */
+static void
+update_pixel_displays_for_renderer (ply_device_manager_t *manager,
+                                    ply_renderer_t       *renderer)
+{
+        ply_list_t *heads;
+        ply_list_node_t *node;
+
+        heads = ply_renderer_get_heads (renderer);
+
+        node = ply_list_get_first_node (manager->pixel_displays);
+        while (node != NULL) {
+                ply_list_node_t *next_node;
+                ply_pixel_display_t *display;
+
+                display = ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (manager->pixel_displays, node);
+
+                if (ply_pixel_display_get_renderer (display) == renderer &&
+                    !display_is_for_head_in_list (display, heads)) {
+                        if (manager->pixel_display_removed_handler != NULL)
+                                manager->pixel_display_removed_handler (manager->event_handler_data, display);
+                        ply_pixel_display_free (display);
+                        ply_list_remove_node (manager->pixel_displays, node);
+                }
+
+                node = next_node;
+        }
+
+        node = ply_list_get_first_node (heads);
+        while (node != NULL) {
+                ply_renderer_head_t *head;
+                ply_pixel_display_t *display;
+
+                head = ply_list_node_get_data (node);
+                node = ply_list_get_next_node (heads, node);
+
+                if (head_has_display (manager, renderer, head))
+                        continue;
+
+                ply_trace ("Adding display for new head");
+                display = ply_pixel_display_new (renderer, head);
+                ply_list_append_data (manager->pixel_displays, display);
+
+                if (manager->pixel_display_added_handler != NULL)
+                        manager->pixel_display_added_handler (manager->event_handler_data, display);
+        }
+}
+
 static void
 create_text_displays_for_terminal (ply_device_manager_t *manager,
                                    ply_terminal_t       *terminal)
@@ -826,6 +1033,15 @@ create_text_displays_for_terminal (ply_device_manager_t *manager,
           manager->text_display_added_handler (manager->event_handler_data, display);
 }
 
+static void
+on_renderer_heads_changed (ply_device_manager_t *manager,
+                           ply_renderer_t       *renderer)
+{
+        ply_trace ("heads changed for %s", ply_renderer_get_device_name (renderer));
+
+        update_pixel_displays_for_renderer (manager, renderer);
+}
+
 static bool
 create_devices_for_terminal_and_renderer_type (ply_device_manager_t *manager,
                                                const char           *device_path,
@@ -883,6 +1099,10 @@ create_devices_for_terminal_and_renderer_type (ply_device_manager_t *manager,
 
                 ply_hashtable_insert (manager->renderers, strdup (ply_renderer_get_device_name (renderer)), renderer);
                 create_pixel_displays_for_renderer (manager, renderer);
+                ply_renderer_set_handler_for_heads_changed (renderer,
+                                                            (ply_renderer_heads_changed_handler_t)
+                                                            on_renderer_heads_changed,
+                                                            manager);
 
                 if (manager->renderers_activated) {
                         ply_trace ("activating renderer");
@@ -1017,6 +1237,16 @@ ply_device_manager_watch_devices (ply_device_manager_t                *manager,
         manager->text_display_removed_handler = text_display_removed_handler;
         manager->event_handler_data = data;
 
+        if ((manager->flags & PLY_DEVICE_MANAGER_FLAGS_USE_OFFSCREEN_RENDERER) &&
+            !(manager->flags & PLY_DEVICE_MANAGER_FLAGS_SKIP_RENDERERS)) {
+                ply_trace ("rendering offscreen, not looking for any other devices");
+                create_devices_for_terminal_and_renderer_type (manager,
+                                                               NULL,
+                                                               NULL,
+                                                               PLY_RENDERER_TYPE_OFFSCREEN);
+                return;
+        }
+
         /* Try to create devices for each serial device right away, if possible
          */
         done_with_initial_devices_setup = create_devices_from_terminals (manager);
@@ -1122,6 +1352,25 @@ ply_device_manager_deactivate_renderers (ply_device_manager_t *manager)
         manager->renderers_activated = false;
 }
 
+static void
+hand_over_renderer (char                 *device_path,
+                    ply_renderer_t       *renderer,
+                    ply_device_manager_t *manager)
+{
+        ply_renderer_hand_over (renderer);
+}
+
+void
+ply_device_manager_hand_over_renderers (ply_device_manager_t *manager)
+{
+        ply_hashtable_foreach (manager->renderers,
+                               (ply_hashtable_foreach_func_t *)
+                               hand_over_renderer,
+                               manager);
+
+        manager->renderers_activated = false;
+}
+
 void
 ply_device_manager_activate_keyboards (ply_device_manager_t *manager)
 {
@@ -1187,5 +1436,9 @@ ply_device_manager_unpause (ply_device_manager_t *manager)
                 create_devices_from_udev (manager);
         }
         watch_for_udev_events (manager);
+
+        /* events that came in before the pause still need handling */
+        if (ply_list_get_length (manager->pending_udev_events) > 0)
+                wait_for_udev_events_to_settle (manager);
 #endif
 }
@@ -32,7 +32,8 @@ typedef enum
         PLY_DEVICE_MANAGER_FLAGS_NONE = 0,
         PLY_DEVICE_MANAGER_FLAGS_IGNORE_SERIAL_CONSOLES = 1 << 0,
         PLY_DEVICE_MANAGER_FLAGS_IGNORE_UDEV = 1 << 1,
-        PLY_DEVICE_MANAGER_FLAGS_SKIP_RENDERERS = 1 << 2
+        PLY_DEVICE_MANAGER_FLAGS_SKIP_RENDERERS = 1 << 2,
+        PLY_DEVICE_MANAGER_FLAGS_USE_OFFSCREEN_RENDERER = 1 << 3
 } ply_device_manager_flags_t;
 
 typedef struct _ply_device_manager ply_device_manager_t;
@@ -67,6 +68,7 @@ void ply_device_manager_activate_keyboards (ply_device_manager_t *manager);
 void ply_device_manager_deactivate_keyboards (ply_device_manager_t *manager);
 void ply_device_manager_activate_renderers (ply_device_manager_t *manager);
 void ply_device_manager_deactivate_renderers (ply_device_manager_t *manager);
+void ply_device_manager_hand_over_renderers (ply_device_manager_t *manager);
 ply_terminal_t *ply_device_manager_get_default_terminal (ply_device_manager_t *manager);
 
 #endif
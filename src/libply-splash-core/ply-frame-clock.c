@@ -0,0 +1,460 @@
+/* ply-frame-clock.c - one shared tick for everything that animates
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-frame-clock.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ply-event-loop.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-renderer.h"
+#include "ply-utils.h"
+
+/* Never sleep for less than this between frames */
+#define MIN_TIMEOUT 0.005
+
+/* How long to wait past the due time for a vblank that may never come,
+ * for instance because the display got turned off
+ */
+#define VBLANK_TIMEOUT 0.1
+
+/* Refresh rates outside of this range are taken to be bogus measurements */
+#define MIN_REFRESH_INTERVAL (1.0 / 480.0)
+#define MAX_REFRESH_INTERVAL (1.0 / 10.0)
+
+typedef struct
+{
+        ply_frame_clock_handler_t handler;
+        void                     *user_data;
+        double                    interval;
+        double                    due_time;
+        uint32_t                  is_removed : 1;
+} ply_frame_clock_watch_t;
+
+struct _ply_frame_clock
+{
+        ply_event_loop_t *loop;
+        ply_list_t       *watches;
+        ply_list_t       *end_of_frame_callbacks;
+        ply_list_t       *renderers;
+
+        int               vblanks_in_flight;
+        unsigned int      last_vblank_sequence;
+        double            last_vblank_time;
+        double            refresh_interval;
+
+        /* no watch gets called more often than this, when it's set */
+        double            minimum_interval;
+
+        uint32_t          is_in_frame : 1;
+        uint32_t          is_waiting_for_vblank : 1;
+        uint32_t          is_waiting_for_timeout : 1;
+};
+
+static void ply_frame_clock_schedule (ply_frame_clock_t *clock);
+
+ply_frame_clock_t *
+ply_frame_clock_get_default (void)
+{
+        static ply_frame_clock_t *clock = NULL;
+
+        if (clock != NULL)
+                return clock;
+
+        clock = calloc (1, sizeof(ply_frame_clock_t));
+        clock->loop = ply_event_loop_get_default ();
+        clock->watches = ply_list_new ();
+        clock->end_of_frame_callbacks = ply_list_new ();
+        clock->renderers = ply_list_new ();
+
+        return clock;
+}
+
+static ply_list_node_t *
+find_watch_node (ply_list_t               *watches,
+                 ply_frame_clock_handler_t handler,
+                 void                     *user_data)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (watches);
+        while (node != NULL) {
+                ply_frame_clock_watch_t *watch = ply_list_node_get_data (node);
+
+                if (watch->handler == handler && watch->user_data == user_data)
+                        return node;
+
+                node = ply_list_get_next_node (watches, node);
+        }
+
+        return NULL;
+}
+
+static void
+on_timeout (ply_frame_clock_t *clock);
+
+static double
+get_watch_interval (ply_frame_clock_t       *clock,
+                    ply_frame_clock_watch_t *watch)
+{
+        return MAX (watch->interval, clock->minimum_interval);
+}
+
+static void
+ply_frame_clock_stop_waiting (ply_frame_clock_t *clock)
+{
+        if (clock->is_waiting_for_timeout)
+                ply_event_loop_stop_watching_for_timeout (clock->loop,
+                                                          (ply_event_loop_timeout_handler_t)
+                                                          on_timeout, clock);
+
+        /* A vblank that is still in flight gets ignored when it arrives */
+        clock->is_waiting_for_timeout = false;
+        clock->is_waiting_for_vblank = false;
+}
+
+static void
+ply_frame_clock_tick (ply_frame_clock_t *clock,
+                      double             slack)
+{
+        ply_list_node_t *node;
+        double now;
+
+        /* every handler called from here sees this same frame time */
+        now = ply_event_loop_get_frame_time (clock->loop);
+
+        clock->is_in_frame = true;
+        node = ply_list_get_first_node (clock->watches);
+        while (node != NULL) {
+                ply_frame_clock_watch_t *watch = ply_list_node_get_data (node);
+
+                node = ply_list_get_next_node (clock->watches, node);
+
+                if (watch->is_removed || watch->due_time > now + slack)
+                        continue;
+
+                /* Keep to the schedule, unless we fell behind it */
+                watch->due_time += get_watch_interval (clock, watch);
+                if (watch->due_time < now)
+                        watch->due_time = now + get_watch_interval (clock, watch);
+
+                watch->handler (watch->user_data);
+        }
+        clock->is_in_frame = false;
+
+        node = ply_list_get_first_node (clock->watches);
+        while (node != NULL) {
+                ply_frame_clock_watch_t *watch = ply_list_node_get_data (node);
+                ply_list_node_t *next_node = ply_list_get_next_node (clock->watches, node);
+
+                if (watch->is_removed) {
+                        ply_list_remove_node (clock->watches, node);
+                        free (watch);
+                }
+
+                node = next_node;
+        }
+
+        while ((node = ply_list_get_first_node (clock->end_of_frame_callbacks)) != NULL) {
+                ply_frame_clock_watch_t *callback = ply_list_node_get_data (node);
+
+                ply_list_remove_node (clock->end_of_frame_callbacks, node);
+                callback->handler (callback->user_data);
+                free (callback);
+        }
+
+        ply_frame_clock_schedule (clock);
+}
+
+static void
+on_timeout (ply_frame_clock_t *clock)
+{
+        clock->is_waiting_for_timeout = false;
+        clock->is_waiting_for_vblank = false;
+
+        ply_frame_clock_tick (clock, 0.0);
+}
+
+static void
+on_vblank (ply_frame_clock_t *clock,
+           unsigned int       sequence,
+           double             time)
+{
+        if (clock->vblanks_in_flight > 0)
+                clock->vblanks_in_flight--;
+
+        if (clock->last_vblank_time > 0.0 && sequence > clock->last_vblank_sequence) {
+                double interval;
+
+                interval = (time - clock->last_vblank_time) / (sequence - clock->last_vblank_sequence);
+                if (interval >= MIN_REFRESH_INTERVAL && interval <= MAX_REFRESH_INTERVAL)
+                        clock->refresh_interval = interval;
+        }
+        clock->last_vblank_sequence = sequence;
+        clock->last_vblank_time = time;
+
+        if (!clock->is_waiting_for_vblank)
+                return;
+
+        ply_frame_clock_stop_waiting (clock);
+
+        /* Anything due before the vblank after this one goes out now */
+        ply_frame_clock_tick (clock, clock->refresh_interval / 2.0);
+}
+
+static bool
+ply_frame_clock_request_vblank (ply_frame_clock_t *clock,
+                                double             delay)
+{
+        ply_list_node_t *node;
+        unsigned int vblanks_from_now = 1;
+
+        if (clock->vblanks_in_flight > 0)
+                return false;
+
+        if (clock->refresh_interval > 0.0 && delay > 0.0)
+                vblanks_from_now = MAX (1, (unsigned int) (delay / clock->refresh_interval + 0.5));
+
+        node = ply_list_get_first_node (clock->renderers);
+        while (node != NULL) {
+                ply_renderer_t *renderer = ply_list_node_get_data (node);
+
+                if (ply_renderer_watch_for_vblank (renderer, vblanks_from_now,
+                                                   (ply_renderer_vblank_handler_t) on_vblank,
+                                                   clock)) {
+                        clock->vblanks_in_flight++;
+                        return true;
+                }
+
+                node = ply_list_get_next_node (clock->renderers, node);
+        }
+
+        return false;
+}
+
+static void
+ply_frame_clock_schedule (ply_frame_clock_t *clock)
+{
+        ply_list_node_t *node;
+        double due_time = 0.0, delay;
+        bool has_watches = false;
+
+        if (clock->is_waiting_for_timeout || clock->is_waiting_for_vblank)
+                return;
+
+        node = ply_list_get_first_node (clock->watches);
+        while (node != NULL) {
+                ply_frame_clock_watch_t *watch = ply_list_node_get_data (node);
+
+                if (!has_watches || watch->due_time < due_time)
+                        due_time = watch->due_time;
+                has_watches = true;
+
+                node = ply_list_get_next_node (clock->watches, node);
+        }
+
+        if (!has_watches)
+                return;
+
+        delay = due_time - ply_get_timestamp ();
+
+        if (ply_frame_clock_request_vblank (clock, delay)) {
+                clock->is_waiting_for_vblank = true;
+                delay = MAX (delay, 0.0) + VBLANK_TIMEOUT;
+        }
+
+        clock->is_waiting_for_timeout = true;
+        ply_event_loop_watch_for_timeout (clock->loop,
+                                          MAX (delay, MIN_TIMEOUT),
+                                          (ply_event_loop_timeout_handler_t)
+                                          on_timeout, clock);
+}
+
+void
+ply_frame_clock_watch_for_frames (ply_frame_clock_t        *clock,
+                                  double                    frames_per_second,
+                                  ply_frame_clock_handler_t handler,
+                                  void                     *user_data)
+{
+        ply_frame_clock_watch_t *watch;
+        ply_list_node_t *node;
+
+        assert (clock != NULL);
+        assert (frames_per_second > 0.0);
+        assert (handler != NULL);
+
+        node = find_watch_node (clock->watches, handler, user_data);
+        if (node != NULL) {
+                watch = ply_list_node_get_data (node);
+        } else {
+                watch = calloc (1, sizeof(ply_frame_clock_watch_t));
+                watch->handler = handler;
+                watch->user_data = user_data;
+                ply_list_append_data (clock->watches, watch);
+        }
+
+        watch->interval = 1.0 / frames_per_second;
+        watch->due_time = ply_get_timestamp () + get_watch_interval (clock, watch);
+        watch->is_removed = false;
+
+        /* The next wakeup may be too late for this one now */
+        if (!clock->is_in_frame) {
+                ply_frame_clock_stop_waiting (clock);
+                ply_frame_clock_schedule (clock);
+        }
+}
+
+void
+ply_frame_clock_stop_watching_for_frames (ply_frame_clock_t        *clock,
+                                          ply_frame_clock_handler_t handler,
+                                          void                     *user_data)
+{
+        ply_frame_clock_watch_t *watch;
+        ply_list_node_t *node;
+
+        assert (clock != NULL);
+
+        node = find_watch_node (clock->watches, handler, user_data);
+        if (node == NULL)
+                return;
+
+        watch = ply_list_node_get_data (node);
+
+        /* The tick is walking the list, so leave it for the tick to free */
+        if (clock->is_in_frame) {
+                watch->is_removed = true;
+                return;
+        }
+
+        ply_list_remove_node (clock->watches, node);
+        free (watch);
+
+        if (ply_list_get_length (clock->watches) == 0)
+                ply_frame_clock_stop_waiting (clock);
+}
+
+void
+ply_frame_clock_set_maximum_frame_rate (ply_frame_clock_t *clock,
+                                        double             frames_per_second)
+{
+        ply_list_node_t *node;
+        double now;
+
+        assert (clock != NULL);
+
+        clock->minimum_interval = frames_per_second > 0.0 ? 1.0 / frames_per_second : 0.0;
+
+        /* Frames put off for the old rate shouldn't hold up a faster one */
+        now = ply_get_timestamp ();
+        node = ply_list_get_first_node (clock->watches);
+        while (node != NULL) {
+                ply_frame_clock_watch_t *watch = ply_list_node_get_data (node);
+
+                watch->due_time = MIN (watch->due_time, now + get_watch_interval (clock, watch));
+
+                node = ply_list_get_next_node (clock->watches, node);
+        }
+
+        if (!clock->is_in_frame) {
+                ply_frame_clock_stop_waiting (clock);
+                ply_frame_clock_schedule (clock);
+        }
+}
+
+bool
+ply_frame_clock_is_in_frame (ply_frame_clock_t *clock)
+{
+        return clock->is_in_frame;
+}
+
+void
+ply_frame_clock_run_at_end_of_frame (ply_frame_clock_t        *clock,
+                                     ply_frame_clock_handler_t handler,
+                                     void                     *user_data)
+{
+        ply_frame_clock_watch_t *callback;
+
+        assert (clock != NULL);
+        assert (handler != NULL);
+
+        if (!clock->is_in_frame) {
+                handler (user_data);
+                return;
+        }
+
+        if (find_watch_node (clock->end_of_frame_callbacks, handler, user_data) != NULL)
+                return;
+
+        callback = calloc (1, sizeof(ply_frame_clock_watch_t));
+        callback->handler = handler;
+        callback->user_data = user_data;
+        ply_list_append_data (clock->end_of_frame_callbacks, callback);
+}
+
+void
+ply_frame_clock_cancel_end_of_frame (ply_frame_clock_t        *clock,
+                                     ply_frame_clock_handler_t handler,
+                                     void                     *user_data)
+{
+        ply_list_node_t *node;
+
+        assert (clock != NULL);
+
+        node = find_watch_node (clock->end_of_frame_callbacks, handler, user_data);
+        if (node == NULL)
+                return;
+
+        free (ply_list_node_get_data (node));
+        ply_list_remove_node (clock->end_of_frame_callbacks, node);
+}
+
+void
+ply_frame_clock_add_renderer (ply_frame_clock_t *clock,
+                              ply_renderer_t    *renderer)
+{
+        assert (clock != NULL);
+        assert (renderer != NULL);
+
+        if (ply_list_find_node (clock->renderers, renderer) != NULL)
+                return;
+
+        ply_list_append_data (clock->renderers, renderer);
+}
+
+void
+ply_frame_clock_remove_renderer (ply_frame_clock_t *clock,
+                                 ply_renderer_t    *renderer)
+{
+        assert (clock != NULL);
+
+        if (ply_list_find_node (clock->renderers, renderer) == NULL)
+                return;
+
+        ply_list_remove_data (clock->renderers, renderer);
+
+        /* A closed renderer won't deliver its vblank, the timeout taken
+         * out alongside the request still wakes the clock up */
+        clock->vblanks_in_flight = 0;
+}
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,71 @@
+/* ply-frame-clock.h - one shared tick for everything that animates
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_FRAME_CLOCK_H
+#define PLY_FRAME_CLOCK_H
+
+#include <stdbool.h>
+
+#include "ply-renderer.h"
+
+typedef struct _ply_frame_clock ply_frame_clock_t;
+
+typedef void (*ply_frame_clock_handler_t) (void *user_data);
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+ply_frame_clock_t *ply_frame_clock_get_default (void);
+
+/* Calls handler about frames_per_second times a second until told to
+ * stop.  All handlers due at the same time get called from one wakeup,
+ * lined up with the display's vblank when a renderer can report it.
+ */
+void ply_frame_clock_watch_for_frames (ply_frame_clock_t        *clock,
+                                       double                    frames_per_second,
+                                       ply_frame_clock_handler_t handler,
+                                       void                     *user_data);
+void ply_frame_clock_stop_watching_for_frames (ply_frame_clock_t        *clock,
+                                               ply_frame_clock_handler_t handler,
+                                               void                     *user_data);
+
+/* Slows every watch down to at most frames_per_second, for saving power
+ * while nothing much is going on.  0 lets them all run at their own
+ * rate again.
+ */
+void ply_frame_clock_set_maximum_frame_rate (ply_frame_clock_t *clock,
+                                             double             frames_per_second);
+
+/* While the frame handlers run, work like flushing a display can be put
+ * off until they have all had their turn, so it happens once per frame.
+ */
+bool ply_frame_clock_is_in_frame (ply_frame_clock_t *clock);
+void ply_frame_clock_run_at_end_of_frame (ply_frame_clock_t        *clock,
+                                          ply_frame_clock_handler_t handler,
+                                          void                     *user_data);
+void ply_frame_clock_cancel_end_of_frame (ply_frame_clock_t        *clock,
+                                          ply_frame_clock_handler_t handler,
+                                          void                     *user_data);
+
+void ply_frame_clock_add_renderer (ply_frame_clock_t *clock,
+                                   ply_renderer_t    *renderer);
+void ply_frame_clock_remove_renderer (ply_frame_clock_t *clock,
+                                      ply_renderer_t    *renderer);
+#endif
+
+#endif /* PLY_FRAME_CLOCK_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
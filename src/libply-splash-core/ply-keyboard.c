@@ -256,17 +256,58 @@ process_keyboard_input (ply_keyboard_t *keyboard,
         }
 }
 
+/* Hands a run of ordinary characters to the input handlers in one go, so
+ * pasted text gets drawn once instead of once per character */
+static void
+process_keyboard_text (ply_keyboard_t *keyboard,
+                       const char     *text,
+                       size_t          size)
+{
+        ply_list_node_t *node;
+        char *keyboard_text;
+
+        keyboard_text = strndup (text, size);
+        ply_buffer_append_bytes (keyboard->line_buffer, keyboard_text, size);
+
+        for (node = ply_list_get_first_node (keyboard->keyboard_input_handler_list);
+             node; node = ply_list_get_next_node (keyboard->keyboard_input_handler_list, node)) {
+                ply_keyboard_closure_t *closure = ply_list_node_get_data (node);
+                ply_keyboard_input_handler_t keyboard_input_handler =
+                        (ply_keyboard_input_handler_t) closure->function;
+
+                keyboard_input_handler (closure->user_data,
+                                        keyboard_text, size);
+        }
+
+        free (keyboard_text);
+}
+
+/* Control characters are what the keys with special meanings send, so
+ * they get processed one at a time */
+static bool
+is_text_character (const char *bytes,
+                   size_t      character_size)
+{
+        wchar_t key;
+
+        if ((ssize_t) mbrtowc (&key, bytes, character_size, NULL) <= 0)
+                return false;
+
+        return key >= 0x20 && key != KEY_BACKSPACE;
+}
+
 static void
 on_key_event (ply_keyboard_t *keyboard,
               ply_buffer_t   *buffer)
 {
         const char *bytes;
-        size_t size, i;
+        size_t size, i, text_start;
 
         bytes = ply_buffer_get_bytes (buffer);
         size = ply_buffer_get_size (buffer);
 
         i = 0;
+        text_start = 0;
         while (i < size) {
                 ssize_t character_size;
                 char *keyboard_input;
@@ -276,10 +317,19 @@ on_key_event (ply_keyboard_t *keyboard,
                 if (character_size < 0)
                         break;
 
+                if (character_size > 0 && is_text_character (bytes + i, character_size)) {
+                        i += character_size;
+                        continue;
+                }
+
+                if (i > text_start)
+                        process_keyboard_text (keyboard, bytes + text_start, i - text_start);
+
                 /* If we're at a NUL character walk through it
                  */
                 if (character_size == 0) {
                         i++;
+                        text_start = i;
                         continue;
                 }
 
@@ -288,10 +338,14 @@ on_key_event (ply_keyboard_t *keyboard,
                 process_keyboard_input (keyboard, keyboard_input, character_size);
 
                 i += character_size;
+                text_start = i;
 
                 free (keyboard_input);
         }
 
+        if (i > text_start)
+                process_keyboard_text (keyboard, bytes + text_start, i - text_start);
+
         if (i > 0)
                 ply_buffer_remove_bytes (buffer, i);
 }
@@ -32,6 +32,8 @@
 
 typedef struct _ply_keyboard ply_keyboard_t;
 
+/* keyboard_input is either one control character, or as much ordinary
+ * text as came in at once, and is nul terminated either way */
 typedef void (*ply_keyboard_input_handler_t) (void       *user_data,
                                               const char *keyboard_input,
                                               size_t      character_size);
@@ -26,133 +26,409 @@
 #include "ply-list.h"
 #include "ply-pixel-buffer.h"
 #include "ply-logger.h"
+#include "ply-statistics.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define PLY_PIXEL_BUFFER_HAVE_X86_KERNELS
+#elif defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define PLY_PIXEL_BUFFER_HAVE_NEON_KERNELS
+#endif
+
 #define ALPHA_MASK 0xff000000
 
+/* Blends a row of premultiplied argb32 source pixels at the given opacity
+ * onto a row of upright destination pixels.
+ */
+typedef void (*ply_pixel_buffer_blend_row_function_t) (uint32_t       *destination,
+                                                        const uint32_t *source,
+                                                        unsigned long   width,
+                                                        uint8_t         opacity);
+
+/* How deeply clip areas can nest, counting the buffer's own area at the
+ * bottom.  Displays push one for each band and one for the area being
+ * drawn, so this leaves plenty of room for plugins.
+ */
+#define PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH 16
+
 struct _ply_pixel_buffer
 {
         uint32_t       *bytes;
 
         ply_rectangle_t area; /* in device pixels */
         ply_rectangle_t logical_area; /* in logical pixels */
-        ply_list_t     *clip_areas; /* in device pixels */
+        /* in device pixels, each one already intersected with the ones below it */
+        ply_rectangle_t clip_areas[PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH];
+        int             clip_depth;
 
-        ply_region_t   *updated_areas; /* in device pixels */
+        ply_tiled_region_t *updated_areas; /* in device pixels */
         uint32_t        is_opaque : 1;
         int             device_scale;
 
         ply_pixel_buffer_rotation_t device_rotation;
+        ply_pixel_buffer_alpha_mode_t alpha_mode;
+
+        int             refcount;
+        ply_pixel_buffer_t *parent; /* owns bytes, for views */
+        uint32_t        has_foreign_bytes : 1;
+        void           *mapping; /* unmapped on free, holds foreign bytes */
+        size_t          mapping_size;
+        const char     *owner; /* what the memory is counted against */
+        unsigned long   serial; /* never reused, identifies the buffer */
+        unsigned long   generation; /* bumped whenever the pixels may change */
+
+        /* Runs of pixels with the same kind of alpha, row after row */
+        uint32_t       *runs;
+        uint32_t       *row_runs; /* index of each row's first run, and one past the last */
+        unsigned long   runs_generation;
+        uint32_t        should_encode_runs : 1;
 };
 
-static inline void ply_pixel_buffer_blend_value_at_pixel (ply_pixel_buffer_t *buffer,
-                                                          int                 x,
-                                                          int                 y,
-                                                          uint32_t            pixel_value);
-
 static void ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t *buffer,
                                                          ply_rectangle_t    *fill_area,
                                                          uint32_t            pixel_value);
 
-__attribute__((__pure__))
+/* Pixel values are stored with premultiplied alpha, so compositing a
+ * pixel over another is one multiply-add per channel:
+ *
+ *   result = source + destination * (255 - source alpha) / 255
+ *
+ * The red and blue channels, and the alpha and green channels, are
+ * processed in pairs, 16 bits apart, which leaves room for each product
+ * and its rounding without carrying into the neighboring channel.
+ */
+#define RED_BLUE_MASK 0x00ff00ff
+#define ROUNDING_BIAS 0x00800080
+
+__attribute__((__const__))
+static inline uint32_t
+multiply_pixel_value (uint32_t pixel_value,
+                      uint8_t  factor)
+{
+        uint32_t red_blue, alpha_green;
+
+        red_blue = (pixel_value & RED_BLUE_MASK) * factor + ROUNDING_BIAS;
+        red_blue = ((red_blue + ((red_blue >> 8) & RED_BLUE_MASK)) >> 8) & RED_BLUE_MASK;
+
+        alpha_green = ((pixel_value >> 8) & RED_BLUE_MASK) * factor + ROUNDING_BIAS;
+        alpha_green = (alpha_green + ((alpha_green >> 8) & RED_BLUE_MASK)) & ~RED_BLUE_MASK;
+
+        return alpha_green | red_blue;
+}
+
+__attribute__((__const__))
 static inline uint32_t
 blend_two_pixel_values (uint32_t pixel_value_1,
                         uint32_t pixel_value_2)
 {
-        if ((pixel_value_2 & 0xff000000) == 0xff000000) {
-                uint8_t alpha_1, red_1, green_1, blue_1;
-                uint8_t red_2, green_2, blue_2;
-                uint_least32_t red, green, blue;
+        uint8_t alpha_1;
 
-                alpha_1 = (uint8_t) (pixel_value_1 >> 24);
-                red_1 = (uint8_t) (pixel_value_1 >> 16);
-                green_1 = (uint8_t) (pixel_value_1 >> 8);
-                blue_1 = (uint8_t) pixel_value_1;
+        alpha_1 = (uint8_t) (pixel_value_1 >> 24);
 
-                red_2 = (uint8_t) (pixel_value_2 >> 16);
-                green_2 = (uint8_t) (pixel_value_2 >> 8);
-                blue_2 = (uint8_t) pixel_value_2;
+        return pixel_value_1 + multiply_pixel_value (pixel_value_2, 255 - alpha_1);
+}
 
-                red = red_1 * 255 + red_2 * (255 - alpha_1);
-                green = green_1 * 255 + green_2 * (255 - alpha_1);
-                blue = blue_1 * 255 + blue_2 * (255 - alpha_1);
+__attribute__((__const__))
+static inline uint32_t
+make_pixel_value_translucent (uint32_t pixel_value,
+                              uint8_t  opacity)
+{
+        if (opacity == 255)
+                return pixel_value;
 
-                red = (uint8_t) ((red + (red >> 8) + 0x80) >> 8);
-                green = (uint8_t) ((green + (green >> 8) + 0x80) >> 8);
-                blue = (uint8_t) ((blue + (blue >> 8) + 0x80) >> 8);
+        return multiply_pixel_value (pixel_value, opacity);
+}
 
-                return 0xff000000 | (red << 16) | (green << 8) | blue;
-        } else {
-                uint8_t alpha_1, red_1, green_1, blue_1;
-                uint8_t alpha_2, red_2, green_2, blue_2;
-                uint_least32_t alpha, red, green, blue;
+/* Each kernel is written once, as an always inlined _at_opacity
+ * function, and this stamps out the function that gets called.  It
+ * calls the kernel with a constant opacity when it's 0xff, so that
+ * copy of the loop is compiled without the multiply by opacity, and
+ * picks between the two once per row instead of once per pixel.
+ */
+#define PLY_PIXEL_BUFFER_DEFINE_BLEND_ROW_FUNCTION(name, ...)                   \
+        __VA_ARGS__                                                            \
+        static void                                                            \
+        name (uint32_t       *destination,                                     \
+              const uint32_t *source,                                          \
+              unsigned long   width,                                           \
+              uint8_t         opacity)                                         \
+        {                                                                      \
+                if (opacity == 0xff)                                           \
+                        name ## _at_opacity (destination, source, width, 0xff); \
+                else                                                           \
+                        name ## _at_opacity (destination, source, width, opacity); \
+        }
 
-                alpha_1 = (uint8_t) (pixel_value_1 >> 24);
-                red_1 = (uint8_t) (pixel_value_1 >> 16);
-                green_1 = (uint8_t) (pixel_value_1 >> 8);
-                blue_1 = (uint8_t) pixel_value_1;
+#define PLY_PIXEL_BUFFER_ALWAYS_INLINE __attribute__((__always_inline__)) inline
 
-                alpha_2 = (uint8_t) (pixel_value_2 >> 24);
-                red_2 = (uint8_t) (pixel_value_2 >> 16);
-                green_2 = (uint8_t) (pixel_value_2 >> 8);
-                blue_2 = (uint8_t) pixel_value_2;
+static PLY_PIXEL_BUFFER_ALWAYS_INLINE void
+blend_row_scalar_at_opacity (uint32_t       *destination,
+                             const uint32_t *source,
+                             unsigned long   width,
+                             uint8_t         opacity)
+{
+        unsigned long i;
 
-                red = red_1 * alpha_1 + red_2 * alpha_2 * (255 - alpha_1);
-                green = green_1 * alpha_1 + green_2 * alpha_2 * (255 - alpha_1);
-                blue = blue_1 * alpha_1 + blue_2 * alpha_2 * (255 - alpha_1);
-                alpha = alpha_1 * 255 + alpha_2 * (255 - alpha_1);
+        for (i = 0; i < width; i++) {
+                uint32_t pixel_value;
 
-                red = (red + (red >> 8) + 0x80) >> 8;
-                red = MIN (red, 0xff);
+                pixel_value = source[i];
 
-                green = (green + (green >> 8) + 0x80) >> 8;
-                green = MIN (green, 0xff);
+                if ((pixel_value >> 24) == 0x00)
+                        continue;
 
-                blue = (blue + (blue >> 8) + 0x80) >> 8;
-                blue = MIN (blue, 0xff);
+                pixel_value = make_pixel_value_translucent (pixel_value, opacity);
 
-                alpha = (alpha + (alpha >> 8) + 0x80) >> 8;
-                alpha = MIN (alpha, 0xff);
+                if ((pixel_value >> 24) != 0xff)
+                        pixel_value = blend_two_pixel_values (pixel_value, destination[i]);
 
-                return (alpha << 24) | (red << 16) | (green << 8) | blue;
+                destination[i] = pixel_value;
         }
 }
 
-__attribute__((__pure__))
-static inline uint32_t
-make_pixel_value_translucent (uint32_t pixel_value,
-                              uint8_t  opacity)
+PLY_PIXEL_BUFFER_DEFINE_BLEND_ROW_FUNCTION (blend_row_scalar)
+
+/* Stands in for blending when the source is opaque and drawn at full
+ * opacity, which comes out the same */
+static void
+copy_row (uint32_t       *destination,
+          const uint32_t *source,
+          unsigned long   width,
+          uint8_t         opacity)
 {
-        uint_least16_t alpha, red, green, blue;
+        memcpy (destination, source, width * sizeof(uint32_t));
+}
 
-        if (opacity == 255)
-                return pixel_value;
+/* The vector kernels below widen each channel to 16 bits and do the same
+ * arithmetic as blend_two_pixel_values (), so their output is bit for bit
+ * identical to blend_row_scalar ().
+ */
+#ifdef PLY_PIXEL_BUFFER_HAVE_X86_KERNELS
+__attribute__((__target__ ("sse2")))
+static inline __m128i
+divide_by_255_sse2 (__m128i value)
+{
+        value = _mm_add_epi16 (value, _mm_set1_epi16 (0x80));
+        value = _mm_add_epi16 (value, _mm_srli_epi16 (value, 8));
+        return _mm_srli_epi16 (value, 8);
+}
+
+__attribute__((__target__ ("sse2")))
+static inline __m128i
+blend_half_sse2 (__m128i source,
+                 __m128i destination,
+                 uint8_t opacity)
+{
+        __m128i alpha, inverse_alpha;
 
-        alpha = (uint8_t) (pixel_value >> 24);
-        red = (uint8_t) (pixel_value >> 16);
-        green = (uint8_t) (pixel_value >> 8);
-        blue = (uint8_t) pixel_value;
+        if (opacity != 0xff)
+                source = divide_by_255_sse2 (_mm_mullo_epi16 (source, _mm_set1_epi16 (opacity)));
 
-        red *= opacity;
-        green *= opacity;
-        blue *= opacity;
-        alpha *= opacity;
+        alpha = _mm_shufflelo_epi16 (source, _MM_SHUFFLE (3, 3, 3, 3));
+        alpha = _mm_shufflehi_epi16 (alpha, _MM_SHUFFLE (3, 3, 3, 3));
+        inverse_alpha = _mm_sub_epi16 (_mm_set1_epi16 (0xff), alpha);
 
-        red = (uint8_t) ((red + (red >> 8) + 0x80) >> 8);
-        green = (uint8_t) ((green + (green >> 8) + 0x80) >> 8);
-        blue = (uint8_t) ((blue + (blue >> 8) + 0x80) >> 8);
-        alpha = (uint8_t) ((alpha + (alpha >> 8) + 0x80) >> 8);
+        return _mm_add_epi16 (source, divide_by_255_sse2 (_mm_mullo_epi16 (destination, inverse_alpha)));
+}
 
-        return (alpha << 24) | (red << 16) | (green << 8) | blue;
+__attribute__((__target__ ("sse2")))
+static PLY_PIXEL_BUFFER_ALWAYS_INLINE void
+blend_row_sse2_at_opacity (uint32_t       *destination,
+                           const uint32_t *source,
+                           unsigned long   width,
+                           uint8_t         opacity)
+{
+        const __m128i zero = _mm_setzero_si128 ();
+        const __m128i alpha_mask = _mm_set1_epi32 (ALPHA_MASK);
+        unsigned long i;
+
+        for (i = 0; i + 4 <= width; i += 4) {
+                __m128i source_pixels, destination_pixels, transparent, result;
+
+                source_pixels = _mm_loadu_si128 ((const __m128i *) (source + i));
+                destination_pixels = _mm_loadu_si128 ((const __m128i *) (destination + i));
+
+                transparent = _mm_cmpeq_epi32 (_mm_and_si128 (source_pixels, alpha_mask), zero);
+                if (_mm_movemask_epi8 (transparent) == 0xffff)
+                        continue;
+
+                result = _mm_packus_epi16 (blend_half_sse2 (_mm_unpacklo_epi8 (source_pixels, zero),
+                                                            _mm_unpacklo_epi8 (destination_pixels, zero),
+                                                            opacity),
+                                           blend_half_sse2 (_mm_unpackhi_epi8 (source_pixels, zero),
+                                                            _mm_unpackhi_epi8 (destination_pixels, zero),
+                                                            opacity));
+                result = _mm_or_si128 (_mm_and_si128 (transparent, destination_pixels),
+                                       _mm_andnot_si128 (transparent, result));
+
+                _mm_storeu_si128 ((__m128i *) (destination + i), result);
+        }
+
+        blend_row_scalar (destination + i, source + i, width - i, opacity);
+}
+
+PLY_PIXEL_BUFFER_DEFINE_BLEND_ROW_FUNCTION (blend_row_sse2, __attribute__((__target__ ("sse2"))))
+
+__attribute__((__target__ ("avx2")))
+static inline __m256i
+divide_by_255_avx2 (__m256i value)
+{
+        value = _mm256_add_epi16 (value, _mm256_set1_epi16 (0x80));
+        value = _mm256_add_epi16 (value, _mm256_srli_epi16 (value, 8));
+        return _mm256_srli_epi16 (value, 8);
+}
+
+__attribute__((__target__ ("avx2")))
+static inline __m256i
+blend_half_avx2 (__m256i source,
+                 __m256i destination,
+                 uint8_t opacity)
+{
+        __m256i alpha, inverse_alpha;
+
+        if (opacity != 0xff)
+                source = divide_by_255_avx2 (_mm256_mullo_epi16 (source, _mm256_set1_epi16 (opacity)));
+
+        alpha = _mm256_shufflelo_epi16 (source, _MM_SHUFFLE (3, 3, 3, 3));
+        alpha = _mm256_shufflehi_epi16 (alpha, _MM_SHUFFLE (3, 3, 3, 3));
+        inverse_alpha = _mm256_sub_epi16 (_mm256_set1_epi16 (0xff), alpha);
+
+        return _mm256_add_epi16 (source, divide_by_255_avx2 (_mm256_mullo_epi16 (destination, inverse_alpha)));
+}
+
+__attribute__((__target__ ("avx2")))
+static PLY_PIXEL_BUFFER_ALWAYS_INLINE void
+blend_row_avx2_at_opacity (uint32_t       *destination,
+                           const uint32_t *source,
+                           unsigned long   width,
+                           uint8_t         opacity)
+{
+        const __m256i zero = _mm256_setzero_si256 ();
+        const __m256i alpha_mask = _mm256_set1_epi32 (ALPHA_MASK);
+        unsigned long i;
+
+        for (i = 0; i + 8 <= width; i += 8) {
+                __m256i source_pixels, destination_pixels, transparent, result;
+
+                source_pixels = _mm256_loadu_si256 ((const __m256i *) (source + i));
+                destination_pixels = _mm256_loadu_si256 ((const __m256i *) (destination + i));
+
+                transparent = _mm256_cmpeq_epi32 (_mm256_and_si256 (source_pixels, alpha_mask), zero);
+                if (_mm256_movemask_epi8 (transparent) == -1)
+                        continue;
+
+                /* unpack and pack both work within 128-bit lanes, so the pixel order survives the round trip */
+                result = _mm256_packus_epi16 (blend_half_avx2 (_mm256_unpacklo_epi8 (source_pixels, zero),
+                                                               _mm256_unpacklo_epi8 (destination_pixels, zero),
+                                                               opacity),
+                                              blend_half_avx2 (_mm256_unpackhi_epi8 (source_pixels, zero),
+                                                               _mm256_unpackhi_epi8 (destination_pixels, zero),
+                                                               opacity));
+                result = _mm256_blendv_epi8 (result, destination_pixels, transparent);
+
+                _mm256_storeu_si256 ((__m256i *) (destination + i), result);
+        }
+
+        blend_row_sse2 (destination + i, source + i, width - i, opacity);
+}
+
+PLY_PIXEL_BUFFER_DEFINE_BLEND_ROW_FUNCTION (blend_row_avx2, __attribute__((__target__ ("avx2"))))
+#endif
+
+#ifdef PLY_PIXEL_BUFFER_HAVE_NEON_KERNELS
+static inline uint8x8_t
+divide_by_255_neon (uint16x8_t value)
+{
+        value = vaddq_u16 (value, vdupq_n_u16 (0x80));
+        value = vaddq_u16 (value, vshrq_n_u16 (value, 8));
+        return vshrn_n_u16 (value, 8);
+}
+
+static PLY_PIXEL_BUFFER_ALWAYS_INLINE void
+blend_row_neon_at_opacity (uint32_t       *destination,
+                           const uint32_t *source,
+                           unsigned long   width,
+                           uint8_t         opacity)
+{
+        const uint8x8_t opacity_vector = vdup_n_u8 (opacity);
+        unsigned long i;
+
+        for (i = 0; i + 8 <= width; i += 8) {
+                uint8x8x4_t source_pixels, destination_pixels;
+                uint8x8_t transparent, inverse_alpha;
+                int channel;
+
+                /* deinterleaves into blue, green, red and alpha planes */
+                source_pixels = vld4_u8 ((const uint8_t *) (source + i));
+                destination_pixels = vld4_u8 ((const uint8_t *) (destination + i));
+
+                transparent = vceq_u8 (source_pixels.val[3], vdup_n_u8 (0));
+                if (vget_lane_u64 (vreinterpret_u64_u8 (vmvn_u8 (transparent)), 0) == 0)
+                        continue;
+
+                if (opacity != 0xff) {
+                        for (channel = 0; channel < 4; channel++) {
+                                source_pixels.val[channel] = divide_by_255_neon (vmull_u8 (source_pixels.val[channel],
+                                                                                           opacity));
+                        }
+                }
+
+                inverse_alpha = vmvn_u8 (source_pixels.val[3]);
+
+                for (channel = 0; channel < 4; channel++) {
+                        uint8x8_t result;
+
+                        result = divide_by_255_neon (vmull_u8 (destination_pixels.val[channel], inverse_alpha));
+                        result = vqadd_u8 (source_pixels.val[channel], result);
+
+                        destination_pixels.val[channel] = vbsl_u8 (transparent,
+                                                                   destination_pixels.val[channel],
+                                                                   result);
+                }
+
+                vst4_u8 ((uint8_t *) (destination + i), destination_pixels);
+        }
+
+        blend_row_scalar (destination + i, source + i, width - i, opacity);
+}
+
+PLY_PIXEL_BUFFER_DEFINE_BLEND_ROW_FUNCTION (blend_row_neon)
+#endif
+
+static ply_pixel_buffer_blend_row_function_t
+get_blend_row_function (void)
+{
+        static ply_pixel_buffer_blend_row_function_t blend_row = NULL;
+
+        if (blend_row != NULL)
+                return blend_row;
+
+        blend_row = blend_row_scalar;
+
+#if defined(PLY_PIXEL_BUFFER_HAVE_X86_KERNELS)
+        __builtin_cpu_init ();
+        if (__builtin_cpu_supports ("avx2"))
+                blend_row = blend_row_avx2;
+        else if (__builtin_cpu_supports ("sse2"))
+                blend_row = blend_row_sse2;
+#elif defined(PLY_PIXEL_BUFFER_HAVE_NEON_KERNELS)
+        blend_row = blend_row_neon;
+#endif
+
+        return blend_row;
 }
 
 static inline void ply_pixel_buffer_set_pixel (ply_pixel_buffer_t *buffer,
@@ -201,21 +477,166 @@ static inline uint32_t ply_pixel_buffer_get_pixel (ply_pixel_buffer_t *buffer,
         return 0;
 }
 
-static inline void
-ply_pixel_buffer_blend_value_at_pixel (ply_pixel_buffer_t *buffer,
-                                       int                 x,
-                                       int                 y,
-                                       uint32_t            pixel_value)
+/* Describes how the pixels of an area, given in upright device coordinates,
+ * are laid out in memory for the buffer's rotation.  The area is walked as
+ * a series of spans that are contiguous in memory (rows for upright and
+ * upside down buffers, columns for buffers rotated by 90 degrees), so the
+ * inner loops never have to look at the rotation.
+ */
+typedef struct
+{
+        uint32_t     *first_pixel;
+        ptrdiff_t     column_step;
+        ptrdiff_t     row_step;
+
+        ptrdiff_t     span_step; /* always 1 or -1 */
+        ptrdiff_t     next_span_step;
+        unsigned long span_length;
+        unsigned long number_of_spans;
+        uint32_t      spans_are_columns : 1;
+} ply_pixel_buffer_spans_t;
+
+static void
+ply_pixel_buffer_get_spans (ply_pixel_buffer_t       *buffer,
+                            ply_rectangle_t          *area,
+                            ply_pixel_buffer_spans_t *spans)
+{
+        ptrdiff_t width, height, origin = 0;
+
+        width = buffer->area.width;
+        height = buffer->area.height;
+
+        switch (buffer->device_rotation) {
+        case PLY_PIXEL_BUFFER_ROTATE_UPRIGHT:
+                spans->column_step = 1;
+                spans->row_step = width;
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN:
+                origin = (height - 1) * width + (width - 1);
+                spans->column_step = -1;
+                spans->row_step = -width;
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE:
+                origin = height - 1;
+                spans->column_step = height;
+                spans->row_step = -1;
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE:
+                origin = (width - 1) * height;
+                spans->column_step = -height;
+                spans->row_step = 1;
+                break;
+        }
+
+        spans->first_pixel = buffer->bytes + (origin +
+                                              area->y * spans->row_step +
+                                              area->x * spans->column_step);
+
+        if (spans->column_step == 1 || spans->column_step == -1) {
+                spans->spans_are_columns = false;
+                spans->span_step = spans->column_step;
+                spans->next_span_step = spans->row_step;
+                spans->span_length = area->width;
+                spans->number_of_spans = area->height;
+        } else {
+                spans->spans_are_columns = true;
+                spans->span_step = spans->row_step;
+                spans->next_span_step = spans->column_step;
+                spans->span_length = area->height;
+                spans->number_of_spans = area->width;
+        }
+}
+
+/* Returns the lowest address touched by a span starting at span_start */
+static inline uint32_t *
+ply_pixel_buffer_spans_get_span_base (ply_pixel_buffer_spans_t *spans,
+                                      uint32_t                 *span_start)
+{
+        if (spans->span_step > 0)
+                return span_start;
+
+        return span_start - (spans->span_length - 1);
+}
+
+/* When the area covers whole rows (or columns) of the buffer, its spans
+ * sit next to each other in memory and the area can be treated as one
+ * block of pixels.
+ */
+static bool
+ply_pixel_buffer_spans_get_block (ply_pixel_buffer_spans_t *spans,
+                                  uint32_t                **block,
+                                  unsigned long            *number_of_pixels)
+{
+        uint32_t *first_span, *last_span;
+
+        if (spans->number_of_spans == 0)
+                return false;
+
+        if (spans->number_of_spans > 1 &&
+            (unsigned long) labs (spans->next_span_step) != spans->span_length)
+                return false;
+
+        first_span = ply_pixel_buffer_spans_get_span_base (spans, spans->first_pixel);
+        last_span = first_span + (spans->number_of_spans - 1) * spans->next_span_step;
+
+        *block = MIN (first_span, last_span);
+        *number_of_pixels = spans->span_length * spans->number_of_spans;
+
+        return true;
+}
+
+#define FILL_CHUNK_SIZE 1024
+
+/* Fills a chunk with a simple loop the compiler can turn into wide
+ * stores, then replicates that chunk, which is still in cache, with
+ * memcpy
+ */
+static void
+fill_pixels (uint32_t     *pixels,
+             unsigned long number_of_pixels,
+             uint32_t      pixel_value)
+{
+        unsigned long chunk_size, i;
+
+        chunk_size = MIN (number_of_pixels, FILL_CHUNK_SIZE);
+
+        for (i = 0; i < chunk_size; i++) {
+                pixels[i] = pixel_value;
+        }
+
+        for (i = chunk_size; i < number_of_pixels; i += chunk_size) {
+                memcpy (pixels + i, pixels, MIN (chunk_size, number_of_pixels - i) * sizeof(uint32_t));
+        }
+}
+
+/* Repeats the first pattern_length pixels over the rest, doubling what
+ * gets copied each time until it's at least a chunk long, so each copy
+ * is one wide memcpy
+ */
+static void
+replicate_pixels (uint32_t     *pixels,
+                  unsigned long number_of_pixels,
+                  unsigned long pattern_length)
 {
-        uint32_t old_pixel_value;
+        unsigned long copied, chunk_size, length;
 
-        if ((pixel_value >> 24) != 0xff) {
-                old_pixel_value = ply_pixel_buffer_get_pixel (buffer, x, y);
+        copied = MIN (pattern_length, number_of_pixels);
+        if (copied == 0)
+                return;
 
-                pixel_value = blend_two_pixel_values (pixel_value, old_pixel_value);
+        while (copied < number_of_pixels && copied < FILL_CHUNK_SIZE) {
+                length = MIN (copied, number_of_pixels - copied);
+                memcpy (pixels + copied, pixels, length * sizeof(uint32_t));
+                copied += length;
         }
 
-        ply_pixel_buffer_set_pixel (buffer, x, y, pixel_value);
+        /* a whole number of patterns, so every copy starts on one */
+        chunk_size = copied;
+        while (copied < number_of_pixels) {
+                length = MIN (chunk_size, number_of_pixels - copied);
+                memcpy (pixels + copied, pixels, length * sizeof(uint32_t));
+                copied += length;
+        }
 }
 
 static void
@@ -251,23 +672,13 @@ ply_pixel_buffer_crop_area_to_clip_area (ply_pixel_buffer_t *buffer,
                                          ply_rectangle_t    *area,
                                          ply_rectangle_t    *cropped_area)
 {
-        ply_list_node_t *node;
-
         *cropped_area = *area;
         ply_pixel_buffer_adjust_area_for_device_scale (buffer, cropped_area);
 
-        node = ply_list_get_first_node (buffer->clip_areas);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
-                ply_rectangle_t *clip_rectangle;
-
-                clip_rectangle = ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (buffer->clip_areas, node);
-
-                ply_rectangle_intersect (cropped_area, clip_rectangle, cropped_area);
-
-                node = next_node;
-        }
+        if (buffer->clip_depth > 0)
+                ply_rectangle_intersect (cropped_area,
+                                         &buffer->clip_areas[buffer->clip_depth - 1],
+                                         cropped_area);
 }
 
 static void ply_pixel_buffer_add_updated_area (ply_pixel_buffer_t *buffer,
@@ -296,7 +707,8 @@ static void ply_pixel_buffer_add_updated_area (ply_pixel_buffer_t *buffer,
                 break;
         }
 
-        ply_region_add_rectangle (buffer->updated_areas, &updated_area);
+        ply_tiled_region_add_rectangle (buffer->updated_areas, &updated_area);
+        buffer->generation++;
 }
 
 static void
@@ -304,7 +716,9 @@ ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t *buffer,
                                              ply_rectangle_t    *fill_area,
                                              uint32_t            pixel_value)
 {
-        unsigned long row, column;
+        ply_pixel_buffer_spans_t spans;
+        uint32_t *span_start, *block;
+        unsigned long span, i, number_of_pixels;
         ply_rectangle_t cropped_area;
 
         if (fill_area == NULL)
@@ -320,12 +734,30 @@ ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t *buffer,
                 buffer->is_opaque = true;
         }
 
-        for (row = cropped_area.y; row < cropped_area.y + cropped_area.height; row++) {
-                for (column = cropped_area.x; column < cropped_area.x + cropped_area.width; column++) {
-                        ply_pixel_buffer_blend_value_at_pixel (buffer,
-                                                               column, row,
-                                                               pixel_value);
+        ply_pixel_buffer_get_spans (buffer, &cropped_area, &spans);
+
+        if ((pixel_value >> 24) == 0xff &&
+            ply_pixel_buffer_spans_get_block (&spans, &block, &number_of_pixels)) {
+                fill_pixels (block, number_of_pixels, pixel_value);
+                ply_pixel_buffer_add_updated_area (buffer, &cropped_area);
+                return;
+        }
+
+        span_start = spans.first_pixel;
+        for (span = 0; span < spans.number_of_spans; span++) {
+                uint32_t *pixel;
+
+                pixel = ply_pixel_buffer_spans_get_span_base (&spans, span_start);
+
+                if ((pixel_value >> 24) == 0xff) {
+                        fill_pixels (pixel, spans.span_length, pixel_value);
+                } else {
+                        for (i = 0; i < spans.span_length; i++) {
+                                pixel[i] = blend_two_pixel_values (pixel_value, pixel[i]);
+                        }
                 }
+
+                span_start += spans.next_span_step;
         }
 
         ply_pixel_buffer_add_updated_area (buffer, &cropped_area);
@@ -337,139 +769,671 @@ ply_pixel_buffer_push_clip_area (ply_pixel_buffer_t *buffer,
 {
         ply_rectangle_t *new_clip_area;
 
-        new_clip_area = malloc (sizeof(*new_clip_area));
+        assert (buffer->clip_depth < PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH);
+
+        new_clip_area = &buffer->clip_areas[buffer->clip_depth];
 
         *new_clip_area = *clip_area;
         ply_pixel_buffer_adjust_area_for_device_scale (buffer, new_clip_area);
 
-        ply_list_append_data (buffer->clip_areas, new_clip_area);
+        if (buffer->clip_depth > 0)
+                ply_rectangle_intersect (new_clip_area,
+                                         &buffer->clip_areas[buffer->clip_depth - 1],
+                                         new_clip_area);
+
+        buffer->clip_depth++;
 }
 
 void
 ply_pixel_buffer_pop_clip_area (ply_pixel_buffer_t *buffer)
 {
-        ply_list_node_t *last_node;
+        assert (buffer->clip_depth > 0);
 
-        last_node = ply_list_get_last_node (buffer->clip_areas);
-        free (ply_list_node_get_data (last_node));
-        ply_list_remove_node (buffer->clip_areas, last_node);
+        buffer->clip_depth--;
 }
 
-ply_pixel_buffer_t *
-ply_pixel_buffer_new (unsigned long width,
-                      unsigned long height)
+/* Pixel storage for animation frames, scaled images and labels comes and
+ * goes all the time, and every fresh calloc of a few megabytes comes back
+ * from the kernel as new pages that fault in one by one.  Keep recently
+ * freed storage around instead, binned in size classes a quarter of a
+ * power of two apart, so sizes that differ a little can still share.
+ * Storage smaller than MIN_POOLED_SIZE is left to malloc.
+ */
+#define MIN_POOLED_SIZE (64 * 1024)
+#define MAX_POOLED_BLOCKS 16
+
+typedef struct
 {
-        return ply_pixel_buffer_new_with_device_rotation (
-                        width, height, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT);
-}
+        void  *bytes;
+        size_t size;
+} ply_pixel_buffer_pool_block_t;
 
-ply_pixel_buffer_t *
-ply_pixel_buffer_new_with_device_rotation (unsigned long               width,
-                                           unsigned long               height,
-                                           ply_pixel_buffer_rotation_t device_rotation)
+static ply_pixel_buffer_pool_block_t pool_blocks[MAX_POOLED_BLOCKS];
+static int number_of_pool_blocks;
+static size_t pool_size;
+static size_t pool_memory_limit = PLY_PIXEL_BUFFER_POOL_DEFAULT_MEMORY_LIMIT;
+
+static size_t
+get_pool_size_class (size_t size)
 {
-        ply_pixel_buffer_t *buffer;
+        size_t power_of_two, step, size_class;
 
-        if (device_rotation == PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE ||
-            device_rotation == PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE) {
-                unsigned long tmp = width;
-                width = height;
-                height = tmp;
+        if (size < MIN_POOLED_SIZE)
+                return size;
+
+        power_of_two = MIN_POOLED_SIZE;
+        while (power_of_two * 2 <= size) {
+                power_of_two *= 2;
         }
 
-        buffer = calloc (1, sizeof(ply_pixel_buffer_t));
+        step = power_of_two / 4;
+        size_class = power_of_two;
+        while (size_class < size) {
+                size_class += step;
+        }
 
-        buffer->updated_areas = ply_region_new ();
-        buffer->bytes = (uint32_t *) calloc (height, width * sizeof(uint32_t));
-        buffer->area.width = width;
-        buffer->area.height = height;
-        buffer->logical_area = buffer->area;
-        buffer->device_scale = 1;
-        buffer->device_rotation = device_rotation;
+        return size_class;
+}
 
-        buffer->clip_areas = ply_list_new ();
-        ply_pixel_buffer_push_clip_area (buffer, &buffer->area);
-        buffer->is_opaque = false;
+/* Counts everything held, whether in use or kept in the pool */
+#define BYTES_HELD_STATISTIC "pixel-buffer.bytes-held"
 
-        return buffer;
+static void
+ply_pixel_buffer_pool_remove_block (int index)
+{
+        pool_size -= pool_blocks[index].size;
+        number_of_pool_blocks--;
+        memmove (&pool_blocks[index], &pool_blocks[index + 1],
+                 (number_of_pool_blocks - index) * sizeof(ply_pixel_buffer_pool_block_t));
 }
 
-static void
-free_clip_areas (ply_pixel_buffer_t *buffer)
+static uint32_t *
+ply_pixel_buffer_allocate_bytes (size_t number_of_pixels,
+                                 bool   should_clear)
 {
-        while (ply_list_get_length (buffer->clip_areas) > 0) {
-                ply_pixel_buffer_pop_clip_area (buffer);
+        size_t size;
+        int i;
+
+        size = get_pool_size_class (number_of_pixels * sizeof(uint32_t));
+
+        if (size < MIN_POOLED_SIZE) {
+                ply_statistics_adjust_level (BYTES_HELD_STATISTIC, size);
+                if (should_clear)
+                        return calloc (1, size);
+                return malloc (size);
+        }
+
+        /* Most recently freed first, it's most likely still in cache */
+        for (i = number_of_pool_blocks - 1; i >= 0; i--) {
+                void *bytes;
+
+                if (pool_blocks[i].size != size)
+                        continue;
+
+                bytes = pool_blocks[i].bytes;
+                ply_pixel_buffer_pool_remove_block (i);
+
+                if (should_clear)
+                        memset (bytes, 0, size);
+
+                return bytes;
         }
 
-        ply_list_free (buffer->clip_areas);
-        buffer->clip_areas = NULL;
+        ply_statistics_adjust_level (BYTES_HELD_STATISTIC, size);
+        if (should_clear)
+                return calloc (1, size);
+        return malloc (size);
 }
 
-void
-ply_pixel_buffer_free (ply_pixel_buffer_t *buffer)
+static void
+ply_pixel_buffer_free_bytes (uint32_t *bytes,
+                             size_t    number_of_pixels)
 {
-        if (buffer == NULL)
+        size_t size;
+
+        if (bytes == NULL)
                 return;
 
-        free_clip_areas (buffer);
-        free (buffer->bytes);
-        ply_region_free (buffer->updated_areas);
-        free (buffer);
+        size = get_pool_size_class (number_of_pixels * sizeof(uint32_t));
+
+        if (size < MIN_POOLED_SIZE || size > pool_memory_limit) {
+                ply_statistics_adjust_level (BYTES_HELD_STATISTIC, -(int64_t) size);
+                free (bytes);
+                return;
+        }
+
+        while (number_of_pool_blocks > 0 &&
+               (number_of_pool_blocks == MAX_POOLED_BLOCKS ||
+                pool_size + size > pool_memory_limit)) {
+                ply_statistics_adjust_level (BYTES_HELD_STATISTIC, -(int64_t) pool_blocks[0].size);
+                free (pool_blocks[0].bytes);
+                ply_pixel_buffer_pool_remove_block (0);
+        }
+
+        pool_blocks[number_of_pool_blocks].bytes = bytes;
+        pool_blocks[number_of_pool_blocks].size = size;
+        number_of_pool_blocks++;
+        pool_size += size;
 }
 
 void
-ply_pixel_buffer_get_size (ply_pixel_buffer_t *buffer,
-                           ply_rectangle_t    *size)
+ply_pixel_buffer_set_pool_memory_limit (size_t memory_limit)
 {
-        assert (buffer != NULL);
-        assert (size != NULL);
+        pool_memory_limit = memory_limit;
 
-        *size = buffer->logical_area;
+        while (number_of_pool_blocks > 0 && pool_size > pool_memory_limit) {
+                ply_statistics_adjust_level (BYTES_HELD_STATISTIC, -(int64_t) pool_blocks[0].size);
+                free (pool_blocks[0].bytes);
+                ply_pixel_buffer_pool_remove_block (0);
+        }
 }
 
-unsigned long
-ply_pixel_buffer_get_width (ply_pixel_buffer_t *buffer)
-{
-        assert (buffer != NULL);
-        return buffer->logical_area.width;
-}
+/* Memory held by buffers that own their pixels, in total and per owner,
+ * and the budget it should stay under
+ */
+#define DEFAULT_OWNER "other"
+static size_t bytes_in_use;
+static size_t memory_budget;
 
-unsigned long
-ply_pixel_buffer_get_height (ply_pixel_buffer_t *buffer)
+static bool
+ply_pixel_buffer_owns_bytes (ply_pixel_buffer_t *buffer)
 {
-        assert (buffer != NULL);
-        return buffer->logical_area.height;
+        return buffer->parent == NULL && !buffer->has_foreign_bytes;
 }
 
-bool
-ply_pixel_buffer_is_opaque (ply_pixel_buffer_t *buffer)
+static void
+ply_pixel_buffer_count_bytes (ply_pixel_buffer_t *buffer,
+                              int                 sign)
 {
-        assert (buffer != NULL);
-        return buffer->is_opaque;
+        char statistic_name[64];
+        size_t size;
+
+        if (!ply_pixel_buffer_owns_bytes (buffer))
+                return;
+
+        size = buffer->area.width * buffer->area.height * sizeof(uint32_t);
+
+        if (sign > 0)
+                bytes_in_use += size;
+        else
+                bytes_in_use -= size;
+
+        snprintf (statistic_name, sizeof(statistic_name), "pixel-buffer.bytes.%s",
+                  buffer->owner != NULL ? buffer->owner : DEFAULT_OWNER);
+        ply_statistics_adjust_level (statistic_name, sign * (int64_t) size);
 }
 
 void
-ply_pixel_buffer_set_opaque (ply_pixel_buffer_t *buffer,
-                             bool                is_opaque)
+ply_pixel_buffer_set_owner (ply_pixel_buffer_t *buffer,
+                            const char         *owner)
 {
-        assert (buffer != NULL);
-        buffer->is_opaque = is_opaque;
+        ply_pixel_buffer_count_bytes (buffer, -1);
+        buffer->owner = owner;
+        ply_pixel_buffer_count_bytes (buffer, 1);
 }
 
-ply_region_t *
-ply_pixel_buffer_get_updated_areas (ply_pixel_buffer_t *buffer)
+size_t
+ply_pixel_buffer_get_bytes_in_use (void)
 {
-        return buffer->updated_areas;
+        return bytes_in_use;
 }
 
 void
-ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
-                                     ply_rectangle_t    *fill_area,
-                                     uint32_t            start,
-                                     uint32_t            end)
+ply_pixel_buffer_set_memory_budget (size_t budget)
 {
-/* The gradient produced is a linear interpolation of the two passed
- * in color stops: start and end.
+        memory_budget = budget;
+
+        if (memory_budget == 0)
+                return;
+
+        /* Memory kept around just in case shouldn't crowd out what a
+         * theme needs
+         */
+        ply_pixel_buffer_set_pool_memory_limit (MIN (pool_memory_limit, memory_budget / 4));
+        ply_pixel_buffer_set_cache_memory_limit (MIN (PLY_PIXEL_BUFFER_CACHE_DEFAULT_MEMORY_LIMIT,
+                                                      memory_budget / 4));
+}
+
+size_t
+ply_pixel_buffer_get_memory_budget (void)
+{
+        return memory_budget;
+}
+
+bool
+ply_pixel_buffer_is_over_memory_budget (void)
+{
+        return memory_budget != 0 && bytes_in_use > memory_budget;
+}
+
+static ply_pixel_buffer_t *
+ply_pixel_buffer_new_with_storage (unsigned long               width,
+                                   unsigned long               height,
+                                   ply_pixel_buffer_rotation_t device_rotation,
+                                   uint32_t                   *bytes,
+                                   bool                        should_clear)
+{
+        static unsigned long next_serial = 1;
+        ply_pixel_buffer_t *buffer;
+
+        buffer = calloc (1, sizeof(ply_pixel_buffer_t));
+
+        buffer->refcount = 1;
+        buffer->serial = next_serial++;
+        buffer->updated_areas = ply_tiled_region_new (width, height);
+
+        if (device_rotation == PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE ||
+            device_rotation == PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE) {
+                unsigned long tmp = width;
+                width = height;
+                height = tmp;
+        }
+
+        if (bytes != NULL) {
+                buffer->bytes = bytes;
+                buffer->has_foreign_bytes = true;
+        } else {
+                buffer->bytes = ply_pixel_buffer_allocate_bytes (width * height, should_clear);
+        }
+        buffer->area.width = width;
+        buffer->area.height = height;
+        buffer->logical_area = buffer->area;
+        buffer->device_scale = 1;
+        buffer->device_rotation = device_rotation;
+        buffer->alpha_mode = PLY_PIXEL_BUFFER_ALPHA_MODE_PREMULTIPLIED;
+
+        ply_pixel_buffer_push_clip_area (buffer, &buffer->area);
+        buffer->is_opaque = false;
+
+        ply_pixel_buffer_count_bytes (buffer, 1);
+
+        return buffer;
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_new (unsigned long width,
+                      unsigned long height)
+{
+        return ply_pixel_buffer_new_with_device_rotation (
+                        width, height, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT);
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_new_with_device_rotation (unsigned long               width,
+                                           unsigned long               height,
+                                           ply_pixel_buffer_rotation_t device_rotation)
+{
+        return ply_pixel_buffer_new_with_storage (width, height, device_rotation, NULL, true);
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_new_uninitialized (unsigned long width,
+                                    unsigned long height)
+{
+        return ply_pixel_buffer_new_with_storage (width, height,
+                                                  PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,
+                                                  NULL, false);
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_new_for_data (unsigned long width,
+                               unsigned long height,
+                               uint32_t     *bytes)
+{
+        assert (bytes != NULL);
+
+        return ply_pixel_buffer_new_with_storage (width, height,
+                                                  PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,
+                                                  bytes, false);
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_new_for_mapped_data (unsigned long width,
+                                      unsigned long height,
+                                      uint32_t     *bytes,
+                                      void         *mapping,
+                                      size_t        mapping_size)
+{
+        ply_pixel_buffer_t *buffer;
+
+        assert (mapping != NULL);
+
+        buffer = ply_pixel_buffer_new_for_data (width, height, bytes);
+        buffer->mapping = mapping;
+        buffer->mapping_size = mapping_size;
+
+        return buffer;
+}
+
+void
+ply_pixel_buffer_set_data (ply_pixel_buffer_t *buffer,
+                           uint32_t           *bytes)
+{
+        assert (buffer->parent == NULL);
+        assert (buffer->mapping == NULL);
+
+        if (bytes != NULL && bytes == buffer->bytes)
+                return;
+
+        ply_pixel_buffer_count_bytes (buffer, -1);
+        if (!buffer->has_foreign_bytes)
+                ply_pixel_buffer_free_bytes (buffer->bytes,
+                                             buffer->area.width * buffer->area.height);
+
+        if (bytes != NULL) {
+                buffer->bytes = bytes;
+                buffer->has_foreign_bytes = true;
+        } else {
+                buffer->bytes = ply_pixel_buffer_allocate_bytes (buffer->area.width * buffer->area.height,
+                                                                 false);
+                buffer->has_foreign_bytes = false;
+        }
+        ply_pixel_buffer_count_bytes (buffer, 1);
+
+        buffer->generation++;
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_ref (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+
+        buffer->refcount++;
+        return buffer;
+}
+
+void
+ply_pixel_buffer_free (ply_pixel_buffer_t *buffer)
+{
+        if (buffer == NULL)
+                return;
+
+        assert (buffer->refcount > 0);
+        buffer->refcount--;
+        if (buffer->refcount > 0)
+                return;
+
+        ply_pixel_buffer_count_bytes (buffer, -1);
+        if (buffer->parent != NULL)
+                ply_pixel_buffer_free (buffer->parent);
+        else if (!buffer->has_foreign_bytes)
+                ply_pixel_buffer_free_bytes (buffer->bytes,
+                                             buffer->area.width * buffer->area.height);
+        else if (buffer->mapping != NULL)
+                munmap (buffer->mapping, buffer->mapping_size);
+        ply_tiled_region_free (buffer->updated_areas);
+        free (buffer->runs);
+        free (buffer->row_runs);
+        free (buffer);
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_new_view (ply_pixel_buffer_t *buffer)
+{
+        ply_pixel_buffer_t *view;
+        unsigned long device_width, device_height;
+
+        assert (buffer != NULL);
+
+        /* Pick the row kernel now, rather than racing for it from several
+         * threads later */
+        get_blend_row_function ();
+
+        if (buffer->device_rotation == PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE ||
+            buffer->device_rotation == PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE) {
+                device_width = buffer->area.height;
+                device_height = buffer->area.width;
+        } else {
+                device_width = buffer->area.width;
+                device_height = buffer->area.height;
+        }
+
+        view = calloc (1, sizeof(ply_pixel_buffer_t));
+
+        view->refcount = 1;
+        view->parent = ply_pixel_buffer_ref (buffer);
+        view->bytes = buffer->bytes;
+        view->area = buffer->area;
+        view->logical_area = buffer->logical_area;
+        view->device_scale = buffer->device_scale;
+        view->device_rotation = buffer->device_rotation;
+        view->alpha_mode = buffer->alpha_mode;
+        view->is_opaque = buffer->is_opaque;
+        view->updated_areas = ply_tiled_region_new (device_width, device_height);
+
+        memcpy (view->clip_areas, buffer->clip_areas,
+                buffer->clip_depth * sizeof(ply_rectangle_t));
+        view->clip_depth = buffer->clip_depth;
+
+        return view;
+}
+
+void
+ply_pixel_buffer_merge_view_updates (ply_pixel_buffer_t *view)
+{
+        ply_rectangle_t *areas;
+        size_t number_of_areas, i;
+
+        assert (view != NULL);
+        assert (view->parent != NULL);
+
+        areas = ply_tiled_region_get_rectangles (view->updated_areas, &number_of_areas);
+        for (i = 0; i < number_of_areas; i++) {
+                ply_tiled_region_add_rectangle (view->parent->updated_areas, &areas[i]);
+        }
+        ply_tiled_region_clear (view->updated_areas);
+
+        if (number_of_areas > 0)
+                view->parent->generation++;
+}
+
+void
+ply_pixel_buffer_get_size (ply_pixel_buffer_t *buffer,
+                           ply_rectangle_t    *size)
+{
+        assert (buffer != NULL);
+        assert (size != NULL);
+
+        *size = buffer->logical_area;
+}
+
+unsigned long
+ply_pixel_buffer_get_width (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+        return buffer->logical_area.width;
+}
+
+unsigned long
+ply_pixel_buffer_get_height (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+        return buffer->logical_area.height;
+}
+
+bool
+ply_pixel_buffer_is_opaque (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+        return buffer->is_opaque;
+}
+
+void
+ply_pixel_buffer_set_opaque (ply_pixel_buffer_t *buffer,
+                             bool                is_opaque)
+{
+        assert (buffer != NULL);
+        buffer->is_opaque = is_opaque;
+}
+
+ply_pixel_buffer_alpha_mode_t
+ply_pixel_buffer_get_alpha_mode (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+        return buffer->alpha_mode;
+}
+
+void
+ply_pixel_buffer_set_alpha_mode (ply_pixel_buffer_t           *buffer,
+                                 ply_pixel_buffer_alpha_mode_t alpha_mode)
+{
+        assert (buffer != NULL);
+        buffer->alpha_mode = alpha_mode;
+}
+
+static inline uint32_t
+premultiply_pixel_value (uint32_t pixel_value)
+{
+        uint32_t alpha, red, green, blue;
+
+        alpha = pixel_value >> 24;
+
+        if (alpha == 0xff)
+                return pixel_value;
+
+        red = PLY_PIXEL_BUFFER_MULTIPLY_CHANNEL ((pixel_value >> 16) & 0xff, alpha);
+        green = PLY_PIXEL_BUFFER_MULTIPLY_CHANNEL ((pixel_value >> 8) & 0xff, alpha);
+        blue = PLY_PIXEL_BUFFER_MULTIPLY_CHANNEL (pixel_value & 0xff, alpha);
+
+        return (alpha << 24) | (red << 16) | (green << 8) | blue;
+}
+
+void
+ply_pixel_buffer_premultiply_alpha (ply_pixel_buffer_t *buffer)
+{
+        unsigned long i, number_of_pixels;
+
+        assert (buffer != NULL);
+
+        if (buffer->alpha_mode == PLY_PIXEL_BUFFER_ALPHA_MODE_PREMULTIPLIED)
+                return;
+
+        number_of_pixels = buffer->area.width * buffer->area.height;
+        for (i = 0; i < number_of_pixels; i++) {
+                buffer->bytes[i] = premultiply_pixel_value (buffer->bytes[i]);
+        }
+        buffer->generation++;
+
+        buffer->alpha_mode = PLY_PIXEL_BUFFER_ALPHA_MODE_PREMULTIPLIED;
+}
+
+/* Each run is a pixel count with the kind of alpha in the top two bits */
+#define RUN_KIND_SHIFT 30
+#define RUN_LENGTH_MASK ((1U << RUN_KIND_SHIFT) - 1)
+
+typedef enum
+{
+        PLY_PIXEL_BUFFER_RUN_TRANSPARENT = 0,
+        PLY_PIXEL_BUFFER_RUN_OPAQUE,
+        PLY_PIXEL_BUFFER_RUN_TRANSLUCENT,
+} ply_pixel_buffer_run_kind_t;
+
+/* A run costs as much memory as a pixel, so images that change alpha
+ * more often than this are drawn the usual way
+ */
+#define MIN_PIXELS_PER_RUN 8
+
+static inline ply_pixel_buffer_run_kind_t
+get_run_kind (uint32_t pixel_value)
+{
+        switch (pixel_value >> 24) {
+        case 0x00:
+                return PLY_PIXEL_BUFFER_RUN_TRANSPARENT;
+        case 0xff:
+                return PLY_PIXEL_BUFFER_RUN_OPAQUE;
+        default:
+                return PLY_PIXEL_BUFFER_RUN_TRANSLUCENT;
+        }
+}
+
+static void
+ply_pixel_buffer_drop_runs (ply_pixel_buffer_t *buffer)
+{
+        free (buffer->runs);
+        free (buffer->row_runs);
+        buffer->runs = NULL;
+        buffer->row_runs = NULL;
+}
+
+static void
+ply_pixel_buffer_update_runs (ply_pixel_buffer_t *buffer)
+{
+        unsigned long width, height, row, column;
+        unsigned long number_of_runs = 0, maximum_runs;
+
+        ply_pixel_buffer_drop_runs (buffer);
+        buffer->runs_generation = buffer->generation;
+
+        width = buffer->area.width;
+        height = buffer->area.height;
+        maximum_runs = MAX (width * height / MIN_PIXELS_PER_RUN, height);
+
+        if (buffer->device_rotation != PLY_PIXEL_BUFFER_ROTATE_UPRIGHT ||
+            width == 0 || width > RUN_LENGTH_MASK)
+                return;
+
+        buffer->runs = malloc (maximum_runs * sizeof(uint32_t));
+        buffer->row_runs = malloc ((height + 1) * sizeof(uint32_t));
+
+        for (row = 0; row < height; row++) {
+                const uint32_t *pixels = buffer->bytes + row * width;
+                ply_pixel_buffer_run_kind_t kind;
+                unsigned long run_start = 0;
+
+                buffer->row_runs[row] = number_of_runs;
+                kind = get_run_kind (pixels[0]);
+
+                for (column = 1; column <= width; column++) {
+                        if (column < width && get_run_kind (pixels[column]) == kind)
+                                continue;
+
+                        if (number_of_runs == maximum_runs) {
+                                ply_pixel_buffer_drop_runs (buffer);
+                                return;
+                        }
+
+                        buffer->runs[number_of_runs++] = (kind << RUN_KIND_SHIFT) |
+                                                         (column - run_start);
+
+                        if (column < width) {
+                                kind = get_run_kind (pixels[column]);
+                                run_start = column;
+                        }
+                }
+        }
+        buffer->row_runs[height] = number_of_runs;
+
+        buffer->runs = realloc (buffer->runs, MAX (number_of_runs, 1) * sizeof(uint32_t));
+}
+
+void
+ply_pixel_buffer_encode_runs (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+
+        /* The runs are drawn from straight off the pixels, so those need
+         * to be in their final form first
+         */
+        ply_pixel_buffer_premultiply_alpha (buffer);
+
+        buffer->should_encode_runs = true;
+        ply_pixel_buffer_update_runs (buffer);
+}
+
+ply_tiled_region_t *
+ply_pixel_buffer_get_updated_areas (ply_pixel_buffer_t *buffer)
+{
+        return buffer->updated_areas;
+}
+
+void
+ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
+                                     ply_rectangle_t    *fill_area,
+                                     uint32_t            start,
+                                     uint32_t            end)
+{
+/* The gradient produced is a linear interpolation of the two passed
+ * in color stops: start and end.
  *
  * In order to prevent banding when the color stops are too close
  * together, or are stretched over too large an area, we slightly
@@ -518,11 +1482,13 @@ ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
          */
         uint32_t noise = 0x100001;
         ply_rectangle_t cropped_area;
+        ply_pixel_buffer_spans_t spans;
 
         if (fill_area == NULL)
                 fill_area = &buffer->logical_area;
 
         ply_pixel_buffer_crop_area_to_clip_area (buffer, fill_area, &cropped_area);
+        ply_pixel_buffer_get_spans (buffer, &cropped_area, &spans);
 
         red = (start << RED_SHIFT) & COLOR_MASK;
         green = (start << GREEN_SHIFT) & COLOR_MASK;
@@ -542,6 +1508,7 @@ ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
         for (y = buffer->area.y; y < buffer->area.y + buffer->area.height; y++) {
                 if (cropped_area.y <= y && y < cropped_area.y + cropped_area.height) {
                         if (cropped_area.width < UNROLLED_PIXEL_COUNT || buffer->device_rotation) {
+                                uint32_t *ptr = spans.first_pixel + (y - cropped_area.y) * spans.row_step;
                                 for (x = cropped_area.x; x < cropped_area.x + cropped_area.width; x++) {
                                         pixel = 0xff000000;
                                         RANDOMIZE (noise);
@@ -551,7 +1518,8 @@ ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
                                         RANDOMIZE (noise);
                                         pixel |= (((blue + noise) & COLOR_MASK) >> BLUE_SHIFT);
 
-                                        ply_pixel_buffer_set_pixel (buffer, x, y, pixel);
+                                        *ptr = pixel;
+                                        ptr += spans.column_step;
                                 }
                         } else {
                                 uint32_t shaded_set[UNROLLED_PIXEL_COUNT];
@@ -647,63 +1615,147 @@ ply_pixel_buffer_fill_with_hex_color (ply_pixel_buffer_t *buffer,
                                                                 hex_color, 1.0);
 }
 
+/* Bilinear interpolation is done in 16.16 fixed point.  Each source
+ * coordinate is reduced to the indices of the two neighboring samples
+ * along that axis and the weight of the second one.  Blits and resizes
+ * compute these once per column and once per row, rather than once per
+ * pixel.
+ */
+#define PLY_PIXEL_BUFFER_FIXED_POINT_ONE (1 << 16)
+
+typedef struct
+{
+        int      index[2]; /* -1 when the sample is outside the source */
+        uint32_t fraction;
+} ply_pixel_buffer_sample_t;
+
+static inline void
+ply_pixel_buffer_compute_sample (double                     coordinate,
+                                 int                        size,
+                                 ply_pixel_buffer_sample_t *sample)
+{
+        double fraction;
+        int i;
+
+        for (i = 0; i < 2; i++) {
+                int index = coordinate + i;
+
+                if (index >= size)
+                        index = size - 1;
+
+                if (index < 0)
+                        index = -1;
+
+                sample->index[i] = index;
+        }
+
+        fraction = coordinate - (int) coordinate;
+
+        if (fraction < 0)
+                fraction = 0;
+
+        sample->fraction = fraction * PLY_PIXEL_BUFFER_FIXED_POINT_ONE;
+}
+
+/* Fills samples with the coordinates step * (first + i) - offset */
+static void
+ply_pixel_buffer_compute_samples (double                     step,
+                                  unsigned long              first,
+                                  double                     offset,
+                                  int                        size,
+                                  ply_pixel_buffer_sample_t *samples,
+                                  unsigned long              number_of_samples)
+{
+        unsigned long i;
+
+        for (i = 0; i < number_of_samples; i++) {
+                ply_pixel_buffer_compute_sample (step * (first + i) - offset, size, &samples[i]);
+        }
+}
+
 static inline uint32_t
-ply_pixels_interpolate (uint32_t *bytes,
-                        int       width,
-                        int       height,
-                        double    x,
-                        double    y)
+ply_pixels_interpolate_samples (uint32_t                  *bytes,
+                                int                        width,
+                                ply_pixel_buffer_sample_t *x_sample,
+                                ply_pixel_buffer_sample_t *y_sample)
 {
-        int ix;
-        int iy;
+        uint32_t pixels[4];
+        uint32_t weights[4];
+        uint32_t inverse_x, inverse_y;
+        uint64_t blue = 0;
+        uint64_t green = 0, red = 0, alpha = 0;
+        int offset_x, offset_y;
         int i;
-        int offset_x;
-        int offset_y;
-        uint32_t pixels[2][2];
-        uint32_t reply = 0;
 
         for (offset_y = 0; offset_y < 2; offset_y++) {
                 for (offset_x = 0; offset_x < 2; offset_x++) {
-                        ix = x + offset_x;
-                        iy = y + offset_y;
-
-                        if (ix >= width)
-                                ix = width - 1;
-
-                        if (iy >= height)
-                                iy = height - 1;
+                        int ix = x_sample->index[offset_x];
+                        int iy = y_sample->index[offset_y];
 
                         if (ix < 0 || iy < 0)
-                                pixels[offset_y][offset_x] = 0x00000000;
+                                pixels[offset_y * 2 + offset_x] = 0x00000000;
                         else
-                                pixels[offset_y][offset_x] = bytes[ix + iy * width];
+                                pixels[offset_y * 2 + offset_x] = bytes[ix + iy * width];
                 }
         }
-        if (!pixels[0][0] && !pixels[0][1] && !pixels[1][0] && !pixels[1][1]) return 0;
+        if (!pixels[0] && !pixels[1] && !pixels[2] && !pixels[3]) return 0;
+
+        if (x_sample->fraction == 0 && y_sample->fraction == 0)
+                return pixels[0];
+
+        /* the weights add up to 1 << 32, which can't overflow here since at
+         * least one of the fractions is non-zero
+         */
+        inverse_x = PLY_PIXEL_BUFFER_FIXED_POINT_ONE - x_sample->fraction;
+        inverse_y = PLY_PIXEL_BUFFER_FIXED_POINT_ONE - y_sample->fraction;
+        weights[0] = inverse_x * inverse_y;
+        weights[1] = x_sample->fraction * inverse_y;
+        weights[2] = inverse_x * y_sample->fraction;
+        weights[3] = x_sample->fraction * y_sample->fraction;
 
-        ix = x;
-        iy = y;
-        x -= ix;
-        y -= iy;
         for (i = 0; i < 4; i++) {
-                uint32_t value = 0;
-                uint32_t mask = 0xFF << (i * 8);
-                value += ((pixels[0][0]) & mask) * (1 - x) * (1 - y);
-                value += ((pixels[0][1]) & mask) * x * (1 - y);
-                value += ((pixels[1][0]) & mask) * (1 - x) * y;
-                value += ((pixels[1][1]) & mask) * x * y;
-                reply |= value & mask;
+                /* The floating point version this replaces truncated each
+                 * blue contribution separately, so keep doing that to stay
+                 * within a bit of its output.
+                 */
+                blue += ((uint64_t) (pixels[i] & 0xff) * weights[i]) >> 32;
+                green += (uint64_t) ((pixels[i] >> 8) & 0xff) * weights[i];
+                red += (uint64_t) ((pixels[i] >> 16) & 0xff) * weights[i];
+                alpha += (uint64_t) (pixels[i] >> 24) * weights[i];
         }
-        return reply;
+
+        return ((uint32_t) (alpha >> 32) << 24) |
+               ((uint32_t) (red >> 32) << 16) |
+               ((uint32_t) (green >> 32) << 8) |
+               (uint32_t) blue;
 }
 
-void
-ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (ply_pixel_buffer_t *buffer,
-                                                                       ply_rectangle_t    *fill_area,
-                                                                       ply_rectangle_t    *clip_area,
-                                                                       uint32_t           *data,
-                                                                       double              opacity,
-                                                                       int                 scale)
+static inline uint32_t
+ply_pixels_interpolate (uint32_t *bytes,
+                        int       width,
+                        int       height,
+                        double    x,
+                        double    y)
+{
+        ply_pixel_buffer_sample_t x_sample, y_sample;
+
+        ply_pixel_buffer_compute_sample (x, width, &x_sample);
+        ply_pixel_buffer_compute_sample (y, height, &y_sample);
+
+        return ply_pixels_interpolate_samples (bytes, width, &x_sample, &y_sample);
+}
+
+/* source_is_opaque says every pixel of data has full alpha, which lets
+ * unscaled spans be copied rather than blended at full opacity
+ */
+static void
+ply_pixel_buffer_fill_with_argb32_data_internal (ply_pixel_buffer_t *buffer,
+                                                 ply_rectangle_t    *fill_area,
+                                                 ply_rectangle_t    *clip_area,
+                                                 uint32_t           *data,
+                                                 double              opacity,
+                                                 int                 scale,
+                                                 bool                source_is_opaque)
 {
         unsigned long row, column;
         uint8_t opacity_as_byte;
@@ -712,6 +1764,14 @@ ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (ply_pixel
         unsigned long x;
         unsigned long y;
         double scale_factor;
+        ply_pixel_buffer_blend_row_function_t blend_row;
+        ply_pixel_buffer_spans_t spans;
+        uint32_t *span_start;
+        ptrdiff_t source_offset;
+        uint32_t *staged_span = NULL;
+        ply_pixel_buffer_sample_t *x_samples = NULL, *y_samples = NULL;
+        ptrdiff_t source_span_step, source_next_span_step;
+        unsigned long span, i;
 
         assert (buffer != NULL);
 
@@ -748,32 +1808,96 @@ ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (ply_pixel
            scale_factor * (column - fill_area->x), scale_factor * (row - fill_area->y)
            is the point we want to source from, in the data coordinate
            space */
-        for (row = y; row < y + cropped_area.height; row++) {
-                for (column = x; column < x + cropped_area.width; column++) {
-                        uint32_t pixel_value;
+        if (source_is_opaque && opacity_as_byte == 0xff && buffer->device_scale == scale)
+                blend_row = copy_row;
+        else
+                blend_row = get_blend_row_function ();
+        ply_pixel_buffer_get_spans (buffer, &cropped_area, &spans);
+
+        if (spans.spans_are_columns) {
+                source_span_step = fill_area->width;
+                source_next_span_step = 1;
+        } else {
+                source_span_step = 1;
+                source_next_span_step = fill_area->width;
+        }
 
-                        if (buffer->device_scale == scale)
-                                pixel_value = data[fill_area->width * (row - fill_area->y) +
-                                                   column - fill_area->x];
-                        else
-                                pixel_value = ply_pixels_interpolate (data,
-                                                                      fill_area->width,
-                                                                      fill_area->height,
-                                                                      scale_factor * column - fill_area->x,
-                                                                      scale_factor * row - fill_area->y);
-                        if ((pixel_value >> 24) == 0x00)
-                                continue;
+        /* Spans that run backward through memory, down columns, or need
+         * scaling are staged in memory order before being blended
+         */
+        if (buffer->device_scale != scale || source_span_step != 1 || spans.span_step != 1)
+                staged_span = malloc (spans.span_length * sizeof(uint32_t));
 
-                        pixel_value = make_pixel_value_translucent (pixel_value, opacity_as_byte);
-                        ply_pixel_buffer_blend_value_at_pixel (buffer,
-                                                               column, row,
-                                                               pixel_value);
+        if (buffer->device_scale != scale) {
+                x_samples = malloc (cropped_area.width * sizeof(ply_pixel_buffer_sample_t));
+                y_samples = malloc (cropped_area.height * sizeof(ply_pixel_buffer_sample_t));
+
+                ply_pixel_buffer_compute_samples (scale_factor, x, fill_area->x,
+                                                  fill_area->width, x_samples, cropped_area.width);
+                ply_pixel_buffer_compute_samples (scale_factor, y, fill_area->y,
+                                                  fill_area->height, y_samples, cropped_area.height);
+        }
+
+        span_start = spans.first_pixel;
+        source_offset = fill_area->width * (y - fill_area->y) + x - fill_area->x;
+        for (span = 0; span < spans.number_of_spans; span++) {
+                const uint32_t *source_pixels = staged_span;
+
+                if (staged_span == NULL) {
+                        source_pixels = data + source_offset;
+                } else if (x_samples == NULL) {
+                        for (i = 0; i < spans.span_length; i++) {
+                                unsigned long staged_index;
+
+                                staged_index = spans.span_step > 0 ? i : spans.span_length - 1 - i;
+                                staged_span[staged_index] = data[source_offset + i * source_span_step];
+                        }
+                } else {
+                        for (i = 0; i < spans.span_length; i++) {
+                                unsigned long staged_index;
+
+                                if (spans.spans_are_columns) {
+                                        column = span;
+                                        row = i;
+                                } else {
+                                        column = i;
+                                        row = span;
+                                }
+
+                                staged_index = spans.span_step > 0 ? i : spans.span_length - 1 - i;
+                                staged_span[staged_index] = ply_pixels_interpolate_samples (data,
+                                                                                            fill_area->width,
+                                                                                            &x_samples[column],
+                                                                                            &y_samples[row]);
+                        }
                 }
+
+                blend_row (ply_pixel_buffer_spans_get_span_base (&spans, span_start),
+                           source_pixels, spans.span_length, opacity_as_byte);
+
+                span_start += spans.next_span_step;
+                source_offset += source_next_span_step;
         }
 
+        free (staged_span);
+        free (x_samples);
+        free (y_samples);
+
         ply_pixel_buffer_add_updated_area (buffer, &cropped_area);
 }
 
+void
+ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (ply_pixel_buffer_t *buffer,
+                                                                       ply_rectangle_t    *fill_area,
+                                                                       ply_rectangle_t    *clip_area,
+                                                                       uint32_t           *data,
+                                                                       double              opacity,
+                                                                       int                 scale)
+{
+        ply_pixel_buffer_fill_with_argb32_data_internal (buffer, fill_area, clip_area,
+                                                         data, opacity, scale, false);
+}
+
 void
 ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip (ply_pixel_buffer_t *buffer,
                                                              ply_rectangle_t    *fill_area,
@@ -824,18 +1948,96 @@ ply_pixel_buffer_fill_with_argb32_data_with_clip (ply_pixel_buffer_t *buffer,
                                                                                data, 1.0, 1);
 }
 
+/* Copies the area at x, y in source to cropped_area in canvas.  Both
+ * buffers must have the same device rotation.
+ */
 static void
 ply_pixel_buffer_copy_area (ply_pixel_buffer_t *canvas,
                             ply_pixel_buffer_t *source,
                             int x, int y,
                             ply_rectangle_t *cropped_area)
 {
-        unsigned long row;
+        ply_pixel_buffer_spans_t canvas_spans, source_spans;
+        ply_rectangle_t source_area;
+        uint32_t *canvas_block, *source_block;
+        uint32_t *canvas_span, *source_span;
+        unsigned long canvas_length, source_length;
+        unsigned long span;
+
+        source_area.x = x;
+        source_area.y = y;
+        source_area.width = cropped_area->width;
+        source_area.height = cropped_area->height;
+
+        ply_pixel_buffer_get_spans (canvas, cropped_area, &canvas_spans);
+        ply_pixel_buffer_get_spans (source, &source_area, &source_spans);
+
+        if (ply_pixel_buffer_spans_get_block (&canvas_spans, &canvas_block, &canvas_length) &&
+            ply_pixel_buffer_spans_get_block (&source_spans, &source_block, &source_length)) {
+                memcpy (canvas_block, source_block, canvas_length * sizeof(uint32_t));
+                return;
+        }
+
+        canvas_span = canvas_spans.first_pixel;
+        source_span = source_spans.first_pixel;
+        for (span = 0; span < canvas_spans.number_of_spans; span++) {
+                memcpy (ply_pixel_buffer_spans_get_span_base (&canvas_spans, canvas_span),
+                        ply_pixel_buffer_spans_get_span_base (&source_spans, source_span),
+                        canvas_spans.span_length * sizeof(uint32_t));
+
+                canvas_span += canvas_spans.next_span_step;
+                source_span += source_spans.next_span_step;
+        }
+}
+
+/* Blends the area at x, y in source to cropped_area in canvas, a run at
+ * a time.  Both buffers must be upright.
+ */
+static void
+ply_pixel_buffer_blend_runs (ply_pixel_buffer_t *canvas,
+                             ply_pixel_buffer_t *source,
+                             int x, int y,
+                             ply_rectangle_t *cropped_area,
+                             uint8_t opacity)
+{
+        ply_pixel_buffer_blend_row_function_t blend_row;
+        unsigned long row, run, first_column, last_column;
+
+        blend_row = get_blend_row_function ();
+        first_column = x;
+        last_column = x + cropped_area->width;
+
+        for (row = 0; row < cropped_area->height; row++) {
+                const uint32_t *source_row;
+                uint32_t *canvas_row;
+                unsigned long run_start = 0, run_end;
 
-        for (row = y; row < y + cropped_area->height; row++) {
-                memcpy (canvas->bytes + (cropped_area->y + row - y) * canvas->area.width + cropped_area->x,
-                        source->bytes + (row * source->area.width) + x,
-                        cropped_area->width * 4);
+                source_row = source->bytes + (y + row) * source->area.width;
+                canvas_row = canvas->bytes + (cropped_area->y + row) * canvas->area.width +
+                             cropped_area->x;
+
+                for (run = source->row_runs[y + row];
+                     run < source->row_runs[y + row + 1] && run_start < last_column;
+                     run_start = run_end, run++) {
+                        ply_pixel_buffer_run_kind_t kind;
+                        unsigned long start, end;
+
+                        run_end = run_start + (source->runs[run] & RUN_LENGTH_MASK);
+                        kind = source->runs[run] >> RUN_KIND_SHIFT;
+
+                        if (kind == PLY_PIXEL_BUFFER_RUN_TRANSPARENT || run_end <= first_column)
+                                continue;
+
+                        start = MAX (run_start, first_column);
+                        end = MIN (run_end, last_column);
+
+                        if (kind == PLY_PIXEL_BUFFER_RUN_OPAQUE && opacity == 0xff)
+                                memcpy (canvas_row + (start - first_column), source_row + start,
+                                        (end - start) * sizeof(uint32_t));
+                        else
+                                blend_row (canvas_row + (start - first_column), source_row + start,
+                                           end - start, opacity);
+                }
         }
 }
 
@@ -854,10 +2056,21 @@ ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (ply_pixel_buffer_t *canv
         assert (canvas != NULL);
         assert (source != NULL);
 
-        /* Fast path to memcpy if we need no blending or scaling */
-        if (opacity == 1.0 && ply_pixel_buffer_is_opaque (source) &&
-            canvas->device_scale == source->device_scale &&
-            canvas->device_rotation == PLY_PIXEL_BUFFER_ROTATE_UPRIGHT) {
+        /* Compositing only works on premultiplied pixels, so do the
+         * conversion once here and keep the result
+         */
+        ply_pixel_buffer_premultiply_alpha (source);
+
+        if (source->should_encode_runs && source->runs_generation != source->generation)
+                ply_pixel_buffer_update_runs (source);
+
+        /* Fast path to memcpy if we need no blending, scaling or rotating,
+         * or to walk the runs of the source if it only needs blending
+         */
+        if (canvas->device_scale == source->device_scale &&
+            canvas->device_rotation == source->device_rotation &&
+            ((opacity == 1.0 && ply_pixel_buffer_is_opaque (source)) ||
+             (source->runs != NULL && canvas->device_rotation == PLY_PIXEL_BUFFER_ROTATE_UPRIGHT))) {
                 ply_rectangle_t cropped_area;
 
                 cropped_area.x = x_offset;
@@ -877,21 +2090,26 @@ ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (ply_pixel_buffer_t *canv
                 x = cropped_area.x - x_offset * canvas->device_scale;
                 y = cropped_area.y - y_offset * canvas->device_scale;
 
-                ply_pixel_buffer_copy_area (canvas, source, x, y, &cropped_area);
+                if (opacity == 1.0 && ply_pixel_buffer_is_opaque (source))
+                        ply_pixel_buffer_copy_area (canvas, source, x, y, &cropped_area);
+                else
+                        ply_pixel_buffer_blend_runs (canvas, source, x, y, &cropped_area,
+                                                     (uint8_t) (opacity * 255.0));
 
-                ply_region_add_rectangle (canvas->updated_areas, &cropped_area);
+                ply_pixel_buffer_add_updated_area (canvas, &cropped_area);
         } else {
                 fill_area.x = x_offset * source->device_scale;
                 fill_area.y = y_offset * source->device_scale;
                 fill_area.width = source->area.width;
                 fill_area.height = source->area.height;
 
-                ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (canvas,
-                                                                                       &fill_area,
-                                                                                       clip_area,
-                                                                                       source->bytes,
-                                                                                       opacity,
-                                                                                       source->device_scale);
+                ply_pixel_buffer_fill_with_argb32_data_internal (canvas,
+                                                                 &fill_area,
+                                                                 clip_area,
+                                                                 source->bytes,
+                                                                 opacity,
+                                                                 source->device_scale,
+                                                                 ply_pixel_buffer_is_opaque (source));
         }
 }
 
@@ -942,6 +2160,9 @@ ply_pixel_buffer_fill_with_buffer (ply_pixel_buffer_t *canvas,
 uint32_t *
 ply_pixel_buffer_get_argb32_data (ply_pixel_buffer_t *buffer)
 {
+        /* The caller may write through the returned pointer */
+        buffer->generation++;
+
         return buffer->bytes;
 }
 
@@ -956,11 +2177,150 @@ ply_pixel_buffer_interpolate (ply_pixel_buffer_t *buffer,
 
         width = buffer->area.width;
         height = buffer->area.height;
-        bytes = ply_pixel_buffer_get_argb32_data (buffer);
+        bytes = buffer->bytes;
 
         return ply_pixels_interpolate (bytes, width, height, x, y);
 }
 
+/* For box filtering: the run of source pixels one destination pixel
+ * covers, and how much of it each one makes up
+ */
+typedef struct
+{
+        int first_index;
+        int number_of_weights;
+        int first_weight;
+} ply_pixel_buffer_box_span_t;
+
+/* Splits old_size pixels into size runs.  The weights of each run are in
+ * fixed point and add up to exactly PLY_PIXEL_BUFFER_FIXED_POINT_ONE.
+ */
+static uint32_t *
+ply_pixel_buffer_compute_box_spans (int                          old_size,
+                                    int                          size,
+                                    ply_pixel_buffer_box_span_t *spans)
+{
+        uint32_t *weights;
+        int i, number_of_weights = 0;
+
+        weights = malloc ((old_size + size) * sizeof(uint32_t));
+
+        for (i = 0; i < size; i++) {
+                uint64_t start = (uint64_t) i * old_size * PLY_PIXEL_BUFFER_FIXED_POINT_ONE / size;
+                uint64_t end = (uint64_t) (i + 1) * old_size * PLY_PIXEL_BUFFER_FIXED_POINT_ONE / size;
+                uint64_t length = end - start;
+                uint32_t total = 0;
+                int index;
+
+                spans[i].first_index = start / PLY_PIXEL_BUFFER_FIXED_POINT_ONE;
+                spans[i].first_weight = number_of_weights;
+                spans[i].number_of_weights = 0;
+
+                for (index = spans[i].first_index; (uint64_t) index * PLY_PIXEL_BUFFER_FIXED_POINT_ONE < end; index++) {
+                        uint64_t pixel_start = MAX ((uint64_t) index * PLY_PIXEL_BUFFER_FIXED_POINT_ONE, start);
+                        uint64_t pixel_end = MIN ((uint64_t) (index + 1) * PLY_PIXEL_BUFFER_FIXED_POINT_ONE, end);
+                        uint32_t weight = (pixel_end - pixel_start) * PLY_PIXEL_BUFFER_FIXED_POINT_ONE / length;
+
+                        weights[number_of_weights++] = weight;
+                        spans[i].number_of_weights++;
+                        total += weight;
+                }
+
+                /* rounding leaves the last pixel short a little */
+                weights[number_of_weights - 1] += PLY_PIXEL_BUFFER_FIXED_POINT_ONE - total;
+        }
+
+        return weights;
+}
+
+/* Averages every source pixel under each destination pixel, instead of
+ * sampling four, so shrinking a lot doesn't alias.  Rows are filtered into
+ * 8.8 fixed point channels first, then runs of those rows get added up a
+ * whole row at a time, which the compiler can vectorize.
+ */
+static ply_pixel_buffer_t *
+ply_pixel_buffer_box_downscale (ply_pixel_buffer_t *old_buffer,
+                                long                width,
+                                long                height)
+{
+        ply_pixel_buffer_t *buffer;
+        ply_pixel_buffer_box_span_t *x_spans, *y_spans;
+        uint32_t *x_weights, *y_weights, *bytes, *sums;
+        uint16_t *rows;
+        int old_width, old_height;
+        long x, y;
+        int i, channel;
+
+        old_width = old_buffer->area.width;
+        old_height = old_buffer->area.height;
+
+        buffer = ply_pixel_buffer_new_uninitialized (width, height);
+        bytes = ply_pixel_buffer_get_argb32_data (buffer);
+
+        x_spans = malloc (width * sizeof(ply_pixel_buffer_box_span_t));
+        y_spans = malloc (height * sizeof(ply_pixel_buffer_box_span_t));
+        x_weights = ply_pixel_buffer_compute_box_spans (old_width, width, x_spans);
+        y_weights = ply_pixel_buffer_compute_box_spans (old_height, height, y_spans);
+
+        rows = malloc ((size_t) old_height * width * 4 * sizeof(uint16_t));
+        sums = malloc (width * 4 * sizeof(uint32_t));
+
+        for (y = 0; y < old_height; y++) {
+                uint32_t *old_row = old_buffer->bytes + y * old_width;
+                uint16_t *row = rows + y * width * 4;
+
+                for (x = 0; x < width; x++) {
+                        uint32_t *weights = x_weights + x_spans[x].first_weight;
+                        uint32_t *pixels = old_row + x_spans[x].first_index;
+                        uint32_t sum[4] = { 0, 0, 0, 0 };
+
+                        for (i = 0; i < x_spans[x].number_of_weights; i++) {
+                                for (channel = 0; channel < 4; channel++) {
+                                        sum[channel] += ((pixels[i] >> (channel * 8)) & 0xff) * weights[i];
+                                }
+                        }
+
+                        for (channel = 0; channel < 4; channel++) {
+                                row[x * 4 + channel] = (sum[channel] + (1 << 7)) >> 8;
+                        }
+                }
+        }
+
+        for (y = 0; y < height; y++) {
+                uint32_t *weights = y_weights + y_spans[y].first_weight;
+                uint16_t *row = rows + y_spans[y].first_index * width * 4;
+
+                memset (sums, 0, width * 4 * sizeof(uint32_t));
+
+                /* at most 0xff00 times weights adding up to 1 << 16, plus
+                 * rounding, which still fits in 32 bits */
+                for (i = 0; i < y_spans[y].number_of_weights; i++) {
+                        for (x = 0; x < width * 4; x++) {
+                                sums[x] += row[x] * weights[i];
+                        }
+                        row += width * 4;
+                }
+
+                for (x = 0; x < width; x++) {
+                        uint32_t pixel = 0;
+
+                        for (channel = 0; channel < 4; channel++) {
+                                pixel |= ((sums[x * 4 + channel] + (1 << 23)) >> 24) << (channel * 8);
+                        }
+                        bytes[x + y * width] = pixel;
+                }
+        }
+
+        free (sums);
+        free (rows);
+        free (x_weights);
+        free (y_weights);
+        free (x_spans);
+        free (y_spans);
+
+        return buffer;
+}
+
 ply_pixel_buffer_t *
 ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
                          long                width,
@@ -968,12 +2328,21 @@ ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
 {
         ply_pixel_buffer_t *buffer;
         int x, y;
-        double old_x, old_y;
         int old_width, old_height;
         double scale_x, scale_y;
         uint32_t *bytes;
+        ply_pixel_buffer_sample_t *x_samples;
+
+        /* Shrinking goes through a box filter, growing through bilinear
+         * interpolation */
+        if (width > 0 && height > 0 &&
+            width <= (long) old_buffer->area.width &&
+            height <= (long) old_buffer->area.height &&
+            (width < (long) old_buffer->area.width ||
+             height < (long) old_buffer->area.height))
+                return ply_pixel_buffer_box_downscale (old_buffer, width, height);
 
-        buffer = ply_pixel_buffer_new (width, height);
+        buffer = ply_pixel_buffer_new_uninitialized (width, height);
 
         bytes = ply_pixel_buffer_get_argb32_data (buffer);
 
@@ -983,17 +2352,188 @@ ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
         scale_x = ((double) old_width - 1) / MAX (width - 1, 1);
         scale_y = ((double) old_height - 1) / MAX (height - 1, 1);
 
+        x_samples = malloc (width * sizeof(ply_pixel_buffer_sample_t));
+        ply_pixel_buffer_compute_samples (scale_x, 0, 0.0, old_width, x_samples, width);
+
         for (y = 0; y < height; y++) {
-                old_y = y * scale_y;
+                ply_pixel_buffer_sample_t y_sample;
+
+                ply_pixel_buffer_compute_sample (y * scale_y, old_height, &y_sample);
                 for (x = 0; x < width; x++) {
-                        old_x = x * scale_x;
                         bytes[x + y * width] =
-                                ply_pixel_buffer_interpolate (old_buffer, old_x, old_y);
+                                ply_pixels_interpolate_samples (old_buffer->bytes, old_width,
+                                                                &x_samples[x], &y_sample);
                 }
         }
+
+        free (x_samples);
         return buffer;
 }
 
+/* Quarter turns and upright copies move each pixel somewhere else whole,
+ * with the source pixel for x, y at column_offsets[x] + row_offsets[y].
+ * Going a tile at a time keeps the source rows a transpose reads from in
+ * cache until the tile is done with them.
+ */
+#define ROTATION_TILE_SIZE 32
+
+static void
+copy_pixels_by_offsets (uint32_t        *destination,
+                        unsigned long    destination_width,
+                        ply_rectangle_t *area,
+                        const uint32_t  *source,
+                        const ptrdiff_t *column_offsets,
+                        const ptrdiff_t *row_offsets)
+{
+        unsigned long tile_x, tile_y, x, y, tile_width, tile_height;
+
+        for (tile_y = 0; tile_y < area->height; tile_y += ROTATION_TILE_SIZE) {
+                tile_height = MIN (area->height - tile_y, ROTATION_TILE_SIZE);
+
+                for (tile_x = 0; tile_x < area->width; tile_x += ROTATION_TILE_SIZE) {
+                        tile_width = MIN (area->width - tile_x, ROTATION_TILE_SIZE);
+
+                        for (y = area->y + tile_y; y < area->y + tile_y + tile_height; y++) {
+                                uint32_t *row = destination + y * destination_width;
+                                const uint32_t *source_row = source + row_offsets[y];
+
+                                for (x = area->x + tile_x; x < area->x + tile_x + tile_width; x++) {
+                                        row[x] = source_row[column_offsets[x]];
+                                }
+                        }
+                }
+        }
+}
+
+/* Fills offsets with where first + direction * i falls in a source row or
+ * column size pixels long.  Like interpolating, size itself still counts
+ * as the last pixel.  Returns the range of i that falls inside.
+ */
+static void
+compute_quarter_turn_offsets (long           first,
+                              long           direction,
+                              long           size,
+                              ptrdiff_t      stride,
+                              ptrdiff_t     *offsets,
+                              unsigned long  number_of_offsets,
+                              unsigned long *start,
+                              unsigned long *length)
+{
+        unsigned long i;
+
+        *start = number_of_offsets;
+        *length = 0;
+
+        for (i = 0; i < number_of_offsets; i++) {
+                long coordinate = first + direction * (long) i;
+
+                if (coordinate < 0 || coordinate > size) {
+                        offsets[i] = 0;
+                        continue;
+                }
+
+                offsets[i] = MIN (coordinate, size - 1) * stride;
+
+                if (*start == number_of_offsets)
+                        *start = i;
+                *length = i - *start + 1;
+        }
+}
+
+/* Rotating about a whole pixel by a multiple of 90 degrees lands every
+ * pixel exactly on another, so there's nothing to interpolate
+ */
+static void
+ply_pixel_buffer_rotate_by_quarter_turns (ply_pixel_buffer_t *old_buffer,
+                                          ply_pixel_buffer_t *buffer,
+                                          long                center_x,
+                                          long                center_y,
+                                          int                 quarter_turns)
+{
+        ptrdiff_t *column_offsets, *row_offsets;
+        ply_rectangle_t area;
+        unsigned long start, length;
+        long width, height;
+        uint32_t *bytes;
+
+        width = old_buffer->area.width;
+        height = old_buffer->area.height;
+        bytes = ply_pixel_buffer_get_argb32_data (buffer);
+
+        column_offsets = malloc (width * sizeof(ptrdiff_t));
+        row_offsets = malloc (height * sizeof(ptrdiff_t));
+
+        /* The source pixel for x, y is the center plus the offset from it
+         * turned back the other way
+         */
+        switch (quarter_turns) {
+        case 0:
+                compute_quarter_turn_offsets (0, 1, width, 1,
+                                              column_offsets, width, &start, &length);
+                area.x = start;
+                area.width = length;
+                compute_quarter_turn_offsets (0, 1, height, width,
+                                              row_offsets, height, &start, &length);
+                break;
+        case 1:
+                compute_quarter_turn_offsets (center_y + center_x, -1, height, width,
+                                              column_offsets, width, &start, &length);
+                area.x = start;
+                area.width = length;
+                compute_quarter_turn_offsets (center_x - center_y, 1, width, 1,
+                                              row_offsets, height, &start, &length);
+                break;
+        case 2:
+                compute_quarter_turn_offsets (2 * center_x, -1, width, 1,
+                                              column_offsets, width, &start, &length);
+                area.x = start;
+                area.width = length;
+                compute_quarter_turn_offsets (2 * center_y, -1, height, width,
+                                              row_offsets, height, &start, &length);
+                break;
+        default:
+                compute_quarter_turn_offsets (center_y - center_x, 1, height, width,
+                                              column_offsets, width, &start, &length);
+                area.x = start;
+                area.width = length;
+                compute_quarter_turn_offsets (center_x + center_y, -1, width, 1,
+                                              row_offsets, height, &start, &length);
+                break;
+        }
+        area.y = start;
+        area.height = length;
+
+        if (area.width < (unsigned long) width || area.height < (unsigned long) height)
+                memset (bytes, 0, width * height * sizeof(uint32_t));
+
+        copy_pixels_by_offsets (bytes, width, &area, old_buffer->bytes,
+                                column_offsets, row_offsets);
+
+        free (column_offsets);
+        free (row_offsets);
+}
+
+/* Source coordinates are stepped along in 32.32 fixed point, which stays
+ * well within a pixel of the exact position across any row
+ */
+#define ROTATION_FIXED_POINT_SHIFT 32
+#define ROTATION_FIXED_POINT_ONE ((int64_t) 1 << ROTATION_FIXED_POINT_SHIFT)
+
+static inline void
+compute_fixed_point_sample (int64_t                    coordinate,
+                            int                        size,
+                            ply_pixel_buffer_sample_t *sample)
+{
+        int index;
+
+        index = coordinate >> ROTATION_FIXED_POINT_SHIFT;
+
+        sample->index[0] = MIN (index, size - 1);
+        sample->index[1] = MIN (index + 1, size - 1);
+        sample->fraction = (coordinate >> (ROTATION_FIXED_POINT_SHIFT - 16)) &
+                           (PLY_PIXEL_BUFFER_FIXED_POINT_ONE - 1);
+}
+
 ply_pixel_buffer_t *
 ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
                          long                center_x,
@@ -1002,15 +2542,26 @@ ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
 {
         ply_pixel_buffer_t *buffer;
         int x, y;
-        double old_x, old_y;
         int width;
         int height;
         uint32_t *bytes;
+        double quarter_turns;
+        int64_t old_x, old_y, step_x, step_y, right_edge, bottom_edge;
 
         width = old_buffer->area.width;
         height = old_buffer->area.height;
 
-        buffer = ply_pixel_buffer_new (width, height);
+        buffer = ply_pixel_buffer_new_uninitialized (width, height);
+
+        quarter_turns = nearbyint (theta_offset / (M_PI / 2));
+        if (fabs (theta_offset / (M_PI / 2) - quarter_turns) < 1e-9) {
+                int turns = fmod (quarter_turns, 4.0);
+
+                ply_pixel_buffer_rotate_by_quarter_turns (old_buffer, buffer,
+                                                          center_x, center_y,
+                                                          (turns + 4) % 4);
+                return buffer;
+        }
 
         bytes = ply_pixel_buffer_get_argb32_data (buffer);
 
@@ -1019,20 +2570,29 @@ ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
         double theta = atan2 (-center_y, -center_x) - theta_offset;
         double start_x = center_x + d * cos (theta);
         double start_y = center_y + d * sin (theta);
-        double step_x = cos (-theta_offset);
-        double step_y = sin (-theta_offset);
+        double cos_theta = cos (-theta_offset);
+        double sin_theta = sin (-theta_offset);
+
+        step_x = llround (cos_theta * ROTATION_FIXED_POINT_ONE);
+        step_y = llround (sin_theta * ROTATION_FIXED_POINT_ONE);
+        right_edge = (int64_t) width * ROTATION_FIXED_POINT_ONE;
+        bottom_edge = (int64_t) height * ROTATION_FIXED_POINT_ONE;
 
         for (y = 0; y < height; y++) {
-                old_y = start_y;
-                old_x = start_x;
-                start_y += step_x;
-                start_x -= step_y;
+                old_x = llround ((start_x - y * sin_theta) * ROTATION_FIXED_POINT_ONE);
+                old_y = llround ((start_y + y * cos_theta) * ROTATION_FIXED_POINT_ONE);
                 for (x = 0; x < width; x++) {
-                        if (old_x < 0 || old_x > width || old_y < 0 || old_y > height)
+                        ply_pixel_buffer_sample_t x_sample, y_sample;
+
+                        if (old_x < 0 || old_x > right_edge || old_y < 0 || old_y > bottom_edge) {
                                 bytes[x + y * width] = 0;
-                        else
+                        } else {
+                                compute_fixed_point_sample (old_x, width, &x_sample);
+                                compute_fixed_point_sample (old_y, height, &y_sample);
                                 bytes[x + y * width] =
-                                        ply_pixel_buffer_interpolate (old_buffer, old_x, old_y);
+                                        ply_pixels_interpolate_samples (old_buffer->bytes, width,
+                                                                        &x_sample, &y_sample);
+                        }
                         old_x += step_x;
                         old_y += step_y;
                 }
@@ -1045,30 +2605,336 @@ ply_pixel_buffer_tile (ply_pixel_buffer_t *old_buffer,
                        long                width,
                        long                height)
 {
-        long x, y;
-        long old_x, old_y;
+        long y, copied, length;
         long old_width, old_height;
         uint32_t *bytes, *old_bytes;
         ply_pixel_buffer_t *buffer;
 
-        buffer = ply_pixel_buffer_new (width, height);
+        buffer = ply_pixel_buffer_new_uninitialized (width, height);
 
-        old_bytes = ply_pixel_buffer_get_argb32_data (old_buffer);
+        old_bytes = old_buffer->bytes;
         bytes = ply_pixel_buffer_get_argb32_data (buffer);
 
         old_width = old_buffer->area.width;
         old_height = old_buffer->area.height;
 
-        for (y = 0; y < height; y++) {
-                old_y = y % old_height;
-                for (x = 0; x < width; x++) {
-                        old_x = x % old_width;
-                        bytes[x + y * width] = old_bytes[old_x + old_y * old_width];
+        if (width <= 0 || height <= 0)
+                return buffer;
+
+        if (old_width <= 0 || old_height <= 0) {
+                memset (bytes, 0, width * height * sizeof(uint32_t));
+                return buffer;
+        }
+
+        /* One row of tiles, then that row over and over */
+        for (y = 0; y < MIN (old_height, height); y++) {
+                memcpy (bytes + y * width, old_bytes + y * old_width,
+                        MIN (old_width, width) * sizeof(uint32_t));
+                replicate_pixels (bytes + y * width, width, old_width);
+        }
+
+        for (copied = old_height; copied < height; copied += length) {
+                length = MIN (copied, height - copied);
+                memcpy (bytes + copied * width, bytes, length * width * sizeof(uint32_t));
+        }
+
+        return buffer;
+}
+
+/* Script themes tend to scale, rotate or tile the same image the same way
+ * on every frame, so keep the most recently used results around.  Entries
+ * are keyed by the serial and generation of the source buffer, which
+ * changes whenever its pixels may have changed, so a stale result is never
+ * handed out.
+ */
+typedef enum
+{
+        PLY_PIXEL_BUFFER_TRANSFORM_RESIZE,
+        PLY_PIXEL_BUFFER_TRANSFORM_ROTATE,
+        PLY_PIXEL_BUFFER_TRANSFORM_TILE,
+} ply_pixel_buffer_transform_t;
+
+typedef struct
+{
+        ply_pixel_buffer_transform_t transform;
+        unsigned long                source_serial;
+        unsigned long                source_generation;
+        long                         x;
+        long                         y;
+        double                       theta;
+
+        ply_pixel_buffer_t          *result;
+        unsigned long                result_generation;
+        size_t                       size;
+} ply_pixel_buffer_cache_entry_t;
+
+static ply_list_t *cache_entries;
+static size_t cache_size;
+static size_t cache_memory_limit = PLY_PIXEL_BUFFER_CACHE_DEFAULT_MEMORY_LIMIT;
+
+static void
+ply_pixel_buffer_cache_remove_node (ply_list_node_t *node)
+{
+        ply_pixel_buffer_cache_entry_t *entry;
+
+        entry = ply_list_node_get_data (node);
+        ply_list_remove_node (cache_entries, node);
+
+        cache_size -= entry->size;
+        ply_pixel_buffer_free (entry->result);
+        free (entry);
+}
+
+static void
+ply_pixel_buffer_cache_trim (size_t memory_limit)
+{
+        ply_list_node_t *node;
+
+        if (cache_entries == NULL)
+                return;
+
+        while (cache_size > memory_limit) {
+                node = ply_list_get_last_node (cache_entries);
+                if (node == NULL)
+                        break;
+
+                ply_pixel_buffer_cache_remove_node (node);
+        }
+}
+
+void
+ply_pixel_buffer_set_cache_memory_limit (size_t memory_limit)
+{
+        cache_memory_limit = memory_limit;
+        ply_pixel_buffer_cache_trim (cache_memory_limit);
+}
+
+void
+ply_pixel_buffer_flush_cache (void)
+{
+        ply_pixel_buffer_cache_trim (0);
+}
+
+static ply_pixel_buffer_t *
+ply_pixel_buffer_cache_lookup (ply_pixel_buffer_transform_t transform,
+                               ply_pixel_buffer_t          *source,
+                               long                         x,
+                               long                         y,
+                               double                       theta)
+{
+        ply_list_node_t *node;
+
+        if (cache_entries == NULL)
+                return NULL;
+
+        node = ply_list_get_first_node (cache_entries);
+        while (node != NULL) {
+                ply_pixel_buffer_cache_entry_t *entry;
+                ply_list_node_t *next_node;
+
+                entry = ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (cache_entries, node);
+
+                if (entry->transform == transform &&
+                    entry->source_serial == source->serial &&
+                    entry->x == x && entry->y == y && entry->theta == theta) {
+                        /* The source or the result has been written to
+                         * since, so the entry can never match again */
+                        if (entry->source_generation != source->generation ||
+                            entry->result_generation != entry->result->generation) {
+                                ply_pixel_buffer_cache_remove_node (node);
+                                return NULL;
+                        }
+
+                        if (node != ply_list_get_first_node (cache_entries)) {
+                                ply_list_remove_node (cache_entries, node);
+                                ply_list_prepend_data (cache_entries, entry);
+                        }
+
+                        return ply_pixel_buffer_ref (entry->result);
                 }
+
+                node = next_node;
         }
+
+        return NULL;
+}
+
+static void
+ply_pixel_buffer_cache_insert (ply_pixel_buffer_transform_t transform,
+                               ply_pixel_buffer_t          *source,
+                               long                         x,
+                               long                         y,
+                               double                       theta,
+                               ply_pixel_buffer_t          *result)
+{
+        ply_pixel_buffer_cache_entry_t *entry;
+        size_t size;
+
+        size = result->area.width * result->area.height * sizeof(uint32_t);
+        if (size > cache_memory_limit)
+                return;
+
+        if (cache_entries == NULL)
+                cache_entries = ply_list_new ();
+
+        ply_pixel_buffer_cache_trim (cache_memory_limit - size);
+
+        entry = calloc (1, sizeof(ply_pixel_buffer_cache_entry_t));
+        entry->transform = transform;
+        entry->source_serial = source->serial;
+        entry->source_generation = source->generation;
+        entry->x = x;
+        entry->y = y;
+        entry->theta = theta;
+        entry->result = ply_pixel_buffer_ref (result);
+        entry->result_generation = result->generation;
+        entry->size = size;
+
+        ply_list_prepend_data (cache_entries, entry);
+        cache_size += size;
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_resize_cached (ply_pixel_buffer_t *old_buffer,
+                                long                width,
+                                long                height)
+{
+        ply_pixel_buffer_t *buffer;
+
+        buffer = ply_pixel_buffer_cache_lookup (PLY_PIXEL_BUFFER_TRANSFORM_RESIZE,
+                                                old_buffer, width, height, 0.0);
+        if (buffer != NULL)
+                return buffer;
+
+        buffer = ply_pixel_buffer_resize (old_buffer, width, height);
+        ply_pixel_buffer_cache_insert (PLY_PIXEL_BUFFER_TRANSFORM_RESIZE,
+                                       old_buffer, width, height, 0.0, buffer);
+        return buffer;
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_rotate_cached (ply_pixel_buffer_t *old_buffer,
+                                long                center_x,
+                                long                center_y,
+                                double              theta_offset)
+{
+        ply_pixel_buffer_t *buffer;
+
+        buffer = ply_pixel_buffer_cache_lookup (PLY_PIXEL_BUFFER_TRANSFORM_ROTATE,
+                                                old_buffer, center_x, center_y,
+                                                theta_offset);
+        if (buffer != NULL)
+                return buffer;
+
+        buffer = ply_pixel_buffer_rotate (old_buffer, center_x, center_y, theta_offset);
+        ply_pixel_buffer_cache_insert (PLY_PIXEL_BUFFER_TRANSFORM_ROTATE,
+                                       old_buffer, center_x, center_y,
+                                       theta_offset, buffer);
+        return buffer;
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_tile_cached (ply_pixel_buffer_t *old_buffer,
+                              long                width,
+                              long                height)
+{
+        ply_pixel_buffer_t *buffer;
+
+        buffer = ply_pixel_buffer_cache_lookup (PLY_PIXEL_BUFFER_TRANSFORM_TILE,
+                                                old_buffer, width, height, 0.0);
+        if (buffer != NULL)
+                return buffer;
+
+        buffer = ply_pixel_buffer_tile (old_buffer, width, height);
+        ply_pixel_buffer_cache_insert (PLY_PIXEL_BUFFER_TRANSFORM_TILE,
+                                       old_buffer, width, height, 0.0, buffer);
         return buffer;
 }
 
+ply_pixel_buffer_t *
+ply_pixel_buffer_duplicate (ply_pixel_buffer_t *buffer)
+{
+        ply_pixel_buffer_t *new_buffer;
+
+        new_buffer = ply_pixel_buffer_new_uninitialized (buffer->area.width, buffer->area.height);
+        memcpy (new_buffer->bytes, buffer->bytes,
+                buffer->area.width * buffer->area.height * sizeof(uint32_t));
+        new_buffer->is_opaque = buffer->is_opaque;
+        new_buffer->alpha_mode = buffer->alpha_mode;
+
+        return new_buffer;
+}
+
+/* Updated areas are kept in the order pixels are laid out in memory, so
+ * this size is the one they are measured against, whatever the rotation */
+static void
+ply_pixel_buffer_get_memory_size (ply_pixel_buffer_t *buffer,
+                                  unsigned long      *width,
+                                  unsigned long      *height)
+{
+        if (buffer->device_rotation == PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE ||
+            buffer->device_rotation == PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE) {
+                *width = buffer->area.height;
+                *height = buffer->area.width;
+        } else {
+                *width = buffer->area.width;
+                *height = buffer->area.height;
+        }
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_new_shadow (ply_pixel_buffer_t *buffer)
+{
+        ply_pixel_buffer_t *shadow;
+        unsigned long width, height;
+
+        ply_pixel_buffer_get_memory_size (buffer, &width, &height);
+
+        shadow = ply_pixel_buffer_new_with_storage (width, height,
+                                                    buffer->device_rotation,
+                                                    NULL, false);
+        memcpy (shadow->bytes, buffer->bytes, width * height * sizeof(uint32_t));
+        ply_pixel_buffer_set_device_scale (shadow, buffer->device_scale);
+        shadow->is_opaque = buffer->is_opaque;
+        shadow->alpha_mode = buffer->alpha_mode;
+
+        return shadow;
+}
+
+void
+ply_pixel_buffer_copy_updated_areas (ply_pixel_buffer_t *destination,
+                                     ply_pixel_buffer_t *source)
+{
+        ply_rectangle_t *areas;
+        size_t number_of_areas, i;
+        unsigned long width, height, destination_width, destination_height;
+        long y;
+
+        ply_pixel_buffer_get_memory_size (source, &width, &height);
+        ply_pixel_buffer_get_memory_size (destination, &destination_width, &destination_height);
+
+        assert (width == destination_width && height == destination_height);
+        assert (source->device_rotation == destination->device_rotation);
+
+        areas = ply_tiled_region_get_rectangles (source->updated_areas, &number_of_areas);
+
+        for (i = 0; i < number_of_areas; i++) {
+                for (y = areas[i].y; y < areas[i].y + (long) areas[i].height; y++) {
+                        memcpy (destination->bytes + y * width + areas[i].x,
+                                source->bytes + y * width + areas[i].x,
+                                areas[i].width * sizeof(uint32_t));
+                }
+
+                ply_tiled_region_add_rectangle (destination->updated_areas, &areas[i]);
+        }
+
+        if (number_of_areas > 0)
+                destination->generation++;
+
+        ply_tiled_region_clear (source->updated_areas);
+}
+
 int
 ply_pixel_buffer_get_device_scale (ply_pixel_buffer_t *buffer)
 {
@@ -1109,9 +2975,7 @@ ply_pixel_buffer_set_device_rotation (ply_pixel_buffer_t *buffer,
                 ply_pixel_buffer_set_device_scale (buffer, buffer->device_scale);
         }
 
-        while (ply_list_get_length (buffer->clip_areas) > 0) {
-                ply_pixel_buffer_pop_clip_area (buffer);
-        }
+        buffer->clip_depth = 0;
         ply_pixel_buffer_push_clip_area (buffer, &buffer->area);
 }
 
@@ -1119,21 +2983,57 @@ ply_pixel_buffer_t *
 ply_pixel_buffer_rotate_upright (ply_pixel_buffer_t *old_buffer)
 {
         ply_pixel_buffer_t *buffer;
-        int x,y, width, height;
-        uint32_t pixel;
+        ptrdiff_t *column_offsets, *row_offsets;
+        ply_rectangle_t area;
+        unsigned long start, length;
+        long width, height;
 
         width = old_buffer->area.width;
         height = old_buffer->area.height;
 
-        buffer = ply_pixel_buffer_new (width, height);
+        buffer = ply_pixel_buffer_new_uninitialized (width, height);
 
-        for (y = 0; y < height; y++) {
-                for (x = 0; x < width; x++) {
-                        pixel = ply_pixel_buffer_get_pixel (old_buffer, x, y);
-                        ply_pixel_buffer_set_pixel (buffer, x, y, pixel);
-                }
+        column_offsets = malloc (width * sizeof(ptrdiff_t));
+        row_offsets = malloc (height * sizeof(ptrdiff_t));
+
+        /* Where each pixel sits in memory, as in ply_pixel_buffer_get_pixel */
+        switch (old_buffer->device_rotation) {
+        case PLY_PIXEL_BUFFER_ROTATE_UPRIGHT:
+                compute_quarter_turn_offsets (0, 1, width, 1,
+                                              column_offsets, width, &start, &length);
+                compute_quarter_turn_offsets (0, 1, height, width,
+                                              row_offsets, height, &start, &length);
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN:
+                compute_quarter_turn_offsets (width - 1, -1, width, 1,
+                                              column_offsets, width, &start, &length);
+                compute_quarter_turn_offsets (height - 1, -1, height, width,
+                                              row_offsets, height, &start, &length);
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE:
+                compute_quarter_turn_offsets (0, 1, width, height,
+                                              column_offsets, width, &start, &length);
+                compute_quarter_turn_offsets (height - 1, -1, height, 1,
+                                              row_offsets, height, &start, &length);
+                break;
+        case PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE:
+                compute_quarter_turn_offsets (width - 1, -1, width, height,
+                                              column_offsets, width, &start, &length);
+                compute_quarter_turn_offsets (0, 1, height, 1,
+                                              row_offsets, height, &start, &length);
+                break;
         }
 
+        area.x = 0;
+        area.y = 0;
+        area.width = width;
+        area.height = height;
+        copy_pixels_by_offsets (ply_pixel_buffer_get_argb32_data (buffer), width, &area,
+                                old_buffer->bytes, column_offsets, row_offsets);
+
+        free (column_offsets);
+        free (row_offsets);
+
         ply_pixel_buffer_set_device_scale (buffer, old_buffer->device_scale);
         ply_pixel_buffer_set_opaque (buffer, old_buffer->is_opaque);
 
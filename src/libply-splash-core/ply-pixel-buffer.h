@@ -23,10 +23,11 @@
 #define PLY_PIXEL_BUFFER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "ply-rectangle.h"
-#include "ply-region.h"
+#include "ply-tiled-region.h"
 #include "ply-utils.h"
 
 typedef struct _ply_pixel_buffer ply_pixel_buffer_t;
@@ -37,6 +38,10 @@ typedef struct _ply_pixel_buffer ply_pixel_buffer_t;
          | ((uint8_t) (CLAMP (g * 255.0, 0.0, 255.0)) << 8)                      \
          | ((uint8_t) (CLAMP (b * 255.0, 0.0, 255.0))))
 
+/* Scales a color channel by an alpha value, rounding to nearest */
+#define PLY_PIXEL_BUFFER_MULTIPLY_CHANNEL(c, a)                                   \
+        ((((c) * (a) + 0x80) + (((c) * (a) + 0x80) >> 8)) >> 8)
+
 typedef enum
 {
         PLY_PIXEL_BUFFER_ROTATE_UPRIGHT = 0,
@@ -45,6 +50,20 @@ typedef enum
         PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE
 } ply_pixel_buffer_rotation_t;
 
+/* All compositing is done on premultiplied pixels.  Buffers filled with
+ * straight alpha data should be marked as such, and get converted once,
+ * the first time they are used as a source.
+ */
+typedef enum
+{
+        PLY_PIXEL_BUFFER_ALPHA_MODE_PREMULTIPLIED = 0,
+        PLY_PIXEL_BUFFER_ALPHA_MODE_STRAIGHT
+} ply_pixel_buffer_alpha_mode_t;
+
+/* in bytes of pixel data */
+#define PLY_PIXEL_BUFFER_CACHE_DEFAULT_MEMORY_LIMIT (32 * 1024 * 1024)
+#define PLY_PIXEL_BUFFER_POOL_DEFAULT_MEMORY_LIMIT (64 * 1024 * 1024)
+
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_pixel_buffer_t *ply_pixel_buffer_new (unsigned long width,
                                           unsigned long height);
@@ -52,7 +71,44 @@ ply_pixel_buffer_t *
 ply_pixel_buffer_new_with_device_rotation (unsigned long width,
                                            unsigned long height,
                                            ply_pixel_buffer_rotation_t device_rotation);
+/* Like ply_pixel_buffer_new, but the pixels start out with whatever the
+ * recycled storage held, for callers that overwrite all of them anyway
+ */
+ply_pixel_buffer_t *ply_pixel_buffer_new_uninitialized (unsigned long width,
+                                                        unsigned long height);
+/* Draws into pixels the caller owns, like memory shared with a display
+ * server.  They have to outlive the buffer, which never frees them.
+ */
+ply_pixel_buffer_t *ply_pixel_buffer_new_for_data (unsigned long width,
+                                                   unsigned long height,
+                                                   uint32_t     *bytes);
+/* Like ply_pixel_buffer_new_for_data, for pixels inside a file mapping
+ * that the buffer takes over and unmaps when it gets freed
+ */
+ply_pixel_buffer_t *ply_pixel_buffer_new_for_mapped_data (unsigned long width,
+                                                          unsigned long height,
+                                                          uint32_t     *bytes,
+                                                          void         *mapping,
+                                                          size_t        mapping_size);
+/* Moves the buffer over to other pixels of the same size that the caller
+ * owns, like the next of a display's scan-out buffers, or back to pixels
+ * of its own when bytes is NULL.  Nothing gets copied, and pixels the
+ * buffer owned before get freed.  Views of the buffer keep drawing to the
+ * old pixels, so there mustn't be any.
+ */
+void ply_pixel_buffer_set_data (ply_pixel_buffer_t *buffer,
+                                uint32_t           *bytes);
+/* Buffers start out with one reference, ply_pixel_buffer_free drops one */
+ply_pixel_buffer_t *ply_pixel_buffer_ref (ply_pixel_buffer_t *buffer);
 void ply_pixel_buffer_free (ply_pixel_buffer_t *buffer);
+
+/* A view draws straight into the pixels of buffer, but has its own clip
+ * stack and updated areas, so that several threads can each draw into
+ * disjoint parts of the same buffer through their own view.  Its updated
+ * areas get moved over to buffer with ply_pixel_buffer_merge_view_updates.
+ */
+ply_pixel_buffer_t *ply_pixel_buffer_new_view (ply_pixel_buffer_t *buffer);
+void ply_pixel_buffer_merge_view_updates (ply_pixel_buffer_t *view);
 void ply_pixel_buffer_get_size (ply_pixel_buffer_t *buffer,
                                 ply_rectangle_t    *size);
 int  ply_pixel_buffer_get_device_scale (ply_pixel_buffer_t *buffer);
@@ -72,7 +128,21 @@ bool ply_pixel_buffer_is_opaque (ply_pixel_buffer_t *buffer);
 void ply_pixel_buffer_set_opaque (ply_pixel_buffer_t *buffer,
                                   bool                is_opaque);
 
-ply_region_t *ply_pixel_buffer_get_updated_areas (ply_pixel_buffer_t *buffer);
+ply_pixel_buffer_alpha_mode_t
+ply_pixel_buffer_get_alpha_mode (ply_pixel_buffer_t *buffer);
+/* Only records the mode, the pixel data is left alone */
+void ply_pixel_buffer_set_alpha_mode (ply_pixel_buffer_t           *buffer,
+                                      ply_pixel_buffer_alpha_mode_t alpha_mode);
+/* Converts straight alpha pixel data to premultiplied, in place */
+void ply_pixel_buffer_premultiply_alpha (ply_pixel_buffer_t *buffer);
+/* Records the runs of transparent, opaque and translucent pixels in each
+ * row, so drawing the buffer onto another skips the transparent ones and
+ * copies the opaque ones.  Worth it for small, sparse images like
+ * throbber frames.  The runs are recorded again if the pixels change.
+ */
+void ply_pixel_buffer_encode_runs (ply_pixel_buffer_t *buffer);
+
+ply_tiled_region_t *ply_pixel_buffer_get_updated_areas (ply_pixel_buffer_t *buffer);
 
 void ply_pixel_buffer_fill_with_color (ply_pixel_buffer_t *buffer,
                                        ply_rectangle_t    *fill_area,
@@ -146,6 +216,7 @@ void ply_pixel_buffer_pop_clip_area (ply_pixel_buffer_t *buffer);
 
 uint32_t *ply_pixel_buffer_get_argb32_data (ply_pixel_buffer_t *buffer);
 
+/* Box filters when shrinking and interpolates bilinearly when growing */
 ply_pixel_buffer_t *ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
                                              long                width,
                                              long                height);
@@ -159,6 +230,53 @@ ply_pixel_buffer_t *ply_pixel_buffer_tile (ply_pixel_buffer_t *old_buffer,
                                            long                width,
                                            long                height);
 
+/* Like the above, but results are kept in a process wide LRU cache, so
+ * repeating a transform on an unchanged buffer is free.  The returned
+ * buffer may be shared with other callers and must not be modified;
+ * release it with ply_pixel_buffer_free.
+ */
+ply_pixel_buffer_t *ply_pixel_buffer_resize_cached (ply_pixel_buffer_t *old_buffer,
+                                                    long                width,
+                                                    long                height);
+ply_pixel_buffer_t *ply_pixel_buffer_rotate_cached (ply_pixel_buffer_t *old_buffer,
+                                                    long                center_x,
+                                                    long                center_y,
+                                                    double              theta_offset);
+ply_pixel_buffer_t *ply_pixel_buffer_tile_cached (ply_pixel_buffer_t *old_buffer,
+                                                  long                width,
+                                                  long                height);
+void ply_pixel_buffer_set_cache_memory_limit (size_t memory_limit);
+/* Caps the freed pixel storage kept around for reuse */
+void ply_pixel_buffer_set_pool_memory_limit (size_t memory_limit);
+void ply_pixel_buffer_flush_cache (void);
+
+/* Pixels a buffer allocated are counted against its owner, like "image"
+ * or "animation", in a pixel-buffer.bytes.<owner> statistic.  owner is
+ * kept, not copied, so it should be a string literal.
+ */
+void ply_pixel_buffer_set_owner (ply_pixel_buffer_t *buffer,
+                                 const char         *owner);
+size_t ply_pixel_buffer_get_bytes_in_use (void);
+/* A budget of 0, the default, means there is none.  Nothing is refused
+ * over budget; splash plugins check and cut back on what they load.
+ */
+void ply_pixel_buffer_set_memory_budget (size_t budget);
+size_t ply_pixel_buffer_get_memory_budget (void);
+bool ply_pixel_buffer_is_over_memory_budget (void);
+
+ply_pixel_buffer_t *ply_pixel_buffer_duplicate (ply_pixel_buffer_t *buffer);
+/* A buffer with the same pixels, size, scale and rotation as buffer, to
+ * draw into while buffer gets read from on another thread.  Nothing is
+ * updated in it to start with.
+ */
+ply_pixel_buffer_t *ply_pixel_buffer_new_shadow (ply_pixel_buffer_t *buffer);
+/* Copies what got updated in source over to destination, a buffer of
+ * the same size and rotation, like the one source is a shadow of.  The
+ * updated areas move over to destination with the pixels.
+ */
+void ply_pixel_buffer_copy_updated_areas (ply_pixel_buffer_t *destination,
+                                          ply_pixel_buffer_t *source);
+
 /* Return the upright version of a buffer which is non upright.
  * This is the *only* ply_pixel_buffer function which works correctly with a
  * non upright buffer as source.
@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -36,11 +37,83 @@
 #include <unistd.h>
 
 #include "ply-event-loop.h"
+#include "ply-frame-clock.h"
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-pixel-buffer.h"
+#include "ply-probes.h"
+#include "ply-region.h"
 #include "ply-renderer.h"
+#include "ply-statistics.h"
+#include "ply-trace-points.h"
 #include "ply-utils.h"
+#include "ply-worker-pool.h"
+
+/* Bands thinner than this aren't worth handing to another thread */
+#define MIN_BAND_HEIGHT 64
+
+#define SNAPSHOT_MAGIC "PLYSNAP1"
+
+/* The debug HUD is drawn with a 3x5 font, each glyph pixel this many
+ * pixels across, and its numbers are worked out this often */
+#define HUD_PIXEL_SIZE 2
+#define HUD_MARGIN 8
+#define HUD_PADDING 4
+#define HUD_NUMBER_OF_LINES 5
+#define HUD_LINE_LENGTH 14
+#define HUD_SAMPLE_INTERVAL 1.0
+
+typedef struct
+{
+        char    character;
+        uint8_t rows[5];
+} ply_pixel_display_hud_glyph_t;
+
+static const ply_pixel_display_hud_glyph_t hud_glyphs[] =
+{
+        { '0', { 07, 05, 05, 05, 07 } },
+        { '1', { 02, 06, 02, 02, 07 } },
+        { '2', { 07, 01, 07, 04, 07 } },
+        { '3', { 07, 01, 07, 01, 07 } },
+        { '4', { 05, 05, 07, 01, 01 } },
+        { '5', { 07, 04, 07, 01, 07 } },
+        { '6', { 07, 04, 07, 05, 07 } },
+        { '7', { 07, 01, 01, 01, 01 } },
+        { '8', { 07, 05, 07, 05, 07 } },
+        { '9', { 07, 05, 07, 01, 07 } },
+        { '.', { 00, 00, 00, 00, 02 } },
+        { '%', { 05, 01, 02, 04, 05 } },
+        { 'A', { 02, 05, 07, 05, 05 } },
+        { 'D', { 06, 05, 05, 05, 06 } },
+        { 'E', { 07, 04, 06, 04, 07 } },
+        { 'F', { 07, 04, 06, 04, 04 } },
+        { 'H', { 05, 05, 07, 05, 05 } },
+        { 'L', { 04, 04, 04, 04, 07 } },
+        { 'M', { 05, 07, 07, 05, 05 } },
+        { 'O', { 07, 05, 05, 05, 07 } },
+        { 'P', { 06, 05, 06, 04, 04 } },
+        { 'R', { 06, 05, 06, 05, 05 } },
+        { 'S', { 03, 04, 02, 01, 06 } },
+        { 'U', { 05, 05, 05, 05, 07 } },
+        { 'W', { 05, 05, 07, 07, 05 } },
+};
+
+/* A snapshot file is this header, then tag_length bytes of tag padded
+ * out to a multiple of 4, then the pixels as the head's buffer stores
+ * them */
+typedef struct
+{
+        char     magic[8];
+        uint32_t width;
+        uint32_t height;
+        uint32_t device_scale;
+        uint32_t device_rotation;
+        uint32_t tag_length;
+        uint32_t reserved;
+} ply_pixel_display_snapshot_header_t;
+
+PLY_DEFINE_TRACE_POINT (pixel_display_flush_trace_point,
+                        "pixel display %#x: flush took %d us");
 
 struct _ply_pixel_display
 {
@@ -48,21 +121,46 @@ struct _ply_pixel_display
 
         ply_renderer_t                  *renderer;
         ply_renderer_head_t             *head;
+        uint32_t                         head_epoch;
 
         unsigned long                    width;
         unsigned long                    height;
         int                              device_scale;
 
         ply_pixel_display_draw_handler_t draw_handler;
+        ply_pixel_display_region_draw_handler_t region_draw_handler;
         void                            *draw_handler_user_data;
+        uint32_t                         draw_handler_is_thread_safe : 1;
+        uint32_t                         has_flushed : 1;
+        uint32_t                         should_keep_first_frame : 1;
+
+        /* a copy of the first frame the draw handler drew */
+        ply_pixel_buffer_t              *first_frame;
 
         int                              pause_count;
+
+        /* areas asked to be drawn since the loop last went idle */
+        ply_region_t                    *pending_draw_area;
+
+        /* what this display's statistics are called */
+        char                            *statistics_prefix;
+
+        /* what the debug HUD shows, and what goes into the next numbers */
+        uint32_t                         should_show_hud : 1;
+        char                             hud_lines[HUD_NUMBER_OF_LINES][HUD_LINE_LENGTH + 1];
+        double                           hud_sample_start_time;
+        double                           hud_sample_start_time_spent_waiting;
+        unsigned long                    hud_number_of_frames;
+        double                           hud_composite_time;
+        double                           hud_flush_time;
+        double                           hud_damaged_pixels;
 };
 
 ply_pixel_display_t *
 ply_pixel_display_new (ply_renderer_t      *renderer,
                        ply_renderer_head_t *head)
 {
+        static int number_of_displays = 0;
         ply_pixel_display_t *display;
         ply_pixel_buffer_t *pixel_buffer;
         ply_rectangle_t size;
@@ -72,6 +170,7 @@ ply_pixel_display_new (ply_renderer_t      *renderer,
         display->loop = ply_event_loop_get_default ();
         display->renderer = renderer;
         display->head = head;
+        display->head_epoch = ply_renderer_get_head_epoch (renderer, head);
 
         pixel_buffer = ply_renderer_get_buffer_for_head (renderer, head);
         ply_pixel_buffer_get_size (pixel_buffer, &size);
@@ -80,6 +179,11 @@ ply_pixel_display_new (ply_renderer_t      *renderer,
         display->height = size.height;
         display->device_scale = ply_pixel_buffer_get_device_scale (pixel_buffer);
 
+        display->pending_draw_area = ply_region_new ();
+
+        asprintf (&display->statistics_prefix, "pixel-display.%d.%lux%lu",
+                  number_of_displays++, display->width, display->height);
+
         return display;
 }
 
@@ -95,6 +199,12 @@ ply_pixel_display_get_renderer_head (ply_pixel_display_t *display)
         return display->head;
 }
 
+uint32_t
+ply_pixel_display_get_renderer_head_epoch (ply_pixel_display_t *display)
+{
+        return display->head_epoch;
+}
+
 unsigned long
 ply_pixel_display_get_width (ply_pixel_display_t *display)
 {
@@ -114,12 +224,80 @@ ply_pixel_display_get_device_scale (ply_pixel_display_t *display)
 }
 
 static void
-ply_pixel_display_flush (ply_pixel_display_t *display)
+ply_pixel_display_add_statistic_duration (ply_pixel_display_t *display,
+                                          const char          *name,
+                                          double               seconds)
+{
+        char *statistic_name;
+
+        asprintf (&statistic_name, "%s.%s", display->statistics_prefix, name);
+        ply_statistics_add_duration (statistic_name, seconds);
+        free (statistic_name);
+}
+
+static bool
+ply_pixel_display_has_draw_handler (ply_pixel_display_t *display)
 {
+        return display->draw_handler != NULL || display->region_draw_handler != NULL;
+}
+
+static void
+ply_pixel_display_flush_now (ply_pixel_display_t *display)
+{
+        double start_time;
+
         if (display->pause_count > 0)
                 return;
 
+        if (display->should_keep_first_frame && display->first_frame == NULL &&
+            ply_pixel_display_has_draw_handler (display)) {
+                display->first_frame = ply_pixel_buffer_duplicate (ply_renderer_get_buffer_for_head (display->renderer,
+                                                                                                     display->head));
+                ply_pixel_buffer_set_owner (display->first_frame, "snapshot");
+        }
+
+        start_time = ply_get_timestamp ();
         ply_renderer_flush_head (display->renderer, display->head);
+
+        ply_trace_point (pixel_display_flush_trace_point, (intptr_t) display,
+                         (ply_get_timestamp () - start_time) * 1000000);
+
+        /* counts frames too */
+        ply_pixel_display_add_statistic_duration (display, "flush",
+                                                  ply_get_timestamp () - start_time);
+        display->hud_flush_time += ply_get_timestamp () - start_time;
+
+        /* timestamps count from boot, so this is how long boot took to
+         * get something on screen */
+        ply_statistics_set_value_once ("time-to-first-frame", start_time);
+
+        if (!display->has_flushed) {
+                ply_statistics_add_timeline_span ("first-flush", display->statistics_prefix,
+                                                  start_time, ply_get_timestamp ());
+                display->has_flushed = true;
+        }
+}
+
+static void
+ply_pixel_display_flush (ply_pixel_display_t *display)
+{
+        ply_frame_clock_t *clock;
+
+        if (display->pause_count > 0)
+                return;
+
+        /* Everything animating draws during the same frame, so only send
+         * the result to the head once they are all done */
+        clock = ply_frame_clock_get_default ();
+        if (ply_frame_clock_is_in_frame (clock)) {
+                ply_frame_clock_run_at_end_of_frame (clock,
+                                                     (ply_frame_clock_handler_t)
+                                                     ply_pixel_display_flush_now,
+                                                     display);
+                return;
+        }
+
+        ply_pixel_display_flush_now (display);
 }
 
 void
@@ -140,6 +318,283 @@ ply_pixel_display_unpause_updates (ply_pixel_display_t *display)
         ply_pixel_display_flush (display);
 }
 
+typedef struct
+{
+        ply_pixel_display_t *display;
+        ply_pixel_buffer_t **views;
+        ply_rectangle_t      area;
+        int                  number_of_bands;
+} ply_pixel_display_band_job_t;
+
+static void
+on_draw_band (ply_pixel_display_band_job_t *job,
+              int                           band)
+{
+        ply_pixel_display_t *display = job->display;
+        ply_rectangle_t band_area;
+        long top, bottom;
+
+        top = job->area.y + (long) job->area.height * band / job->number_of_bands;
+        bottom = job->area.y + (long) job->area.height * (band + 1) / job->number_of_bands;
+
+        band_area.x = job->area.x;
+        band_area.y = top;
+        band_area.width = job->area.width;
+        band_area.height = bottom - top;
+
+        ply_pixel_buffer_push_clip_area (job->views[band], &band_area);
+        display->draw_handler (display->draw_handler_user_data,
+                               job->views[band],
+                               band_area.x, band_area.y,
+                               band_area.width, band_area.height,
+                               display);
+        ply_pixel_buffer_pop_clip_area (job->views[band]);
+}
+
+/* Splits the area into horizontal bands and draws each through its own
+ * view of the pixel buffer on the worker pool.  Returns false if the area
+ * isn't worth splitting.
+ */
+static bool
+ply_pixel_display_draw_area_in_bands (ply_pixel_display_t *display,
+                                      ply_pixel_buffer_t  *pixel_buffer,
+                                      ply_rectangle_t     *area)
+{
+        ply_pixel_display_band_job_t job;
+        ply_worker_pool_t *worker_pool;
+        int i;
+
+        if (!display->draw_handler_is_thread_safe)
+                return false;
+
+        worker_pool = ply_worker_pool_get_default ();
+        if (worker_pool == NULL)
+                return false;
+
+        job.number_of_bands = MIN ((long) area->height / MIN_BAND_HEIGHT,
+                                   ply_worker_pool_get_number_of_threads (worker_pool));
+        if (job.number_of_bands < 2)
+                return false;
+
+        job.display = display;
+        job.area = *area;
+        job.views = calloc (job.number_of_bands, sizeof(ply_pixel_buffer_t *));
+        for (i = 0; i < job.number_of_bands; i++) {
+                job.views[i] = ply_pixel_buffer_new_view (pixel_buffer);
+        }
+
+        ply_worker_pool_run (worker_pool,
+                             (ply_worker_pool_job_handler_t) on_draw_band,
+                             &job, job.number_of_bands);
+
+        for (i = 0; i < job.number_of_bands; i++) {
+                ply_pixel_buffer_merge_view_updates (job.views[i]);
+                ply_pixel_buffer_free (job.views[i]);
+        }
+        free (job.views);
+
+        return true;
+}
+
+static void
+ply_pixel_display_draw_area_now (ply_pixel_display_t *display,
+                                 ply_pixel_buffer_t  *pixel_buffer,
+                                 ply_rectangle_t     *area)
+{
+        ply_pixel_buffer_push_clip_area (pixel_buffer, area);
+        if (!ply_pixel_display_draw_area_in_bands (display, pixel_buffer, area))
+                display->draw_handler (display->draw_handler_user_data,
+                                       pixel_buffer,
+                                       area->x, area->y,
+                                       area->width, area->height,
+                                       display);
+        ply_pixel_buffer_pop_clip_area (pixel_buffer);
+}
+
+static void
+ply_pixel_display_get_hud_area (ply_pixel_display_t *display,
+                                ply_rectangle_t     *area)
+{
+        area->x = HUD_MARGIN;
+        area->y = HUD_MARGIN;
+        area->width = 2 * HUD_PADDING + HUD_LINE_LENGTH * 4 * HUD_PIXEL_SIZE;
+        area->height = 2 * HUD_PADDING + HUD_NUMBER_OF_LINES * 7 * HUD_PIXEL_SIZE;
+}
+
+static const ply_pixel_display_hud_glyph_t *
+get_hud_glyph (char character)
+{
+        size_t i;
+
+        for (i = 0; i < sizeof(hud_glyphs) / sizeof(hud_glyphs[0]); i++) {
+                if (hud_glyphs[i].character == character)
+                        return &hud_glyphs[i];
+        }
+
+        return NULL;
+}
+
+static void
+ply_pixel_display_draw_hud_text (ply_pixel_display_t *display,
+                                 ply_pixel_buffer_t  *pixel_buffer,
+                                 const char          *text,
+                                 long                 x,
+                                 long                 y)
+{
+        const ply_pixel_display_hud_glyph_t *glyph;
+        ply_rectangle_t pixel;
+        int row, column;
+
+        pixel.width = HUD_PIXEL_SIZE;
+        pixel.height = HUD_PIXEL_SIZE;
+
+        for (; *text != '\0'; text++, x += 4 * HUD_PIXEL_SIZE) {
+                glyph = get_hud_glyph (*text);
+
+                if (glyph == NULL)
+                        continue;
+
+                for (row = 0; row < 5; row++) {
+                        for (column = 0; column < 3; column++) {
+                                if (!(glyph->rows[row] & (04 >> column)))
+                                        continue;
+
+                                pixel.x = x + column * HUD_PIXEL_SIZE;
+                                pixel.y = y + row * HUD_PIXEL_SIZE;
+                                ply_pixel_buffer_fill_with_hex_color (pixel_buffer, &pixel,
+                                                                      0xffffff);
+                        }
+                }
+        }
+}
+
+/* Drawn over whatever the draw handler drew, so it works with any splash */
+static void
+ply_pixel_display_draw_hud (ply_pixel_display_t *display,
+                            ply_pixel_buffer_t  *pixel_buffer,
+                            ply_rectangle_t     *area)
+{
+        ply_rectangle_t hud_area;
+        int i;
+
+        ply_pixel_display_get_hud_area (display, &hud_area);
+
+        if (ply_rectangle_find_overlap (&hud_area, area) == PLY_RECTANGLE_OVERLAP_NONE)
+                return;
+
+        ply_pixel_buffer_push_clip_area (pixel_buffer, area);
+        ply_pixel_buffer_fill_with_hex_color_at_opacity (pixel_buffer, &hud_area,
+                                                         0x000000, 0.75);
+
+        for (i = 0; i < HUD_NUMBER_OF_LINES; i++) {
+                ply_pixel_display_draw_hud_text (display, pixel_buffer,
+                                                 display->hud_lines[i],
+                                                 hud_area.x + HUD_PADDING,
+                                                 hud_area.y + HUD_PADDING + i * 7 * HUD_PIXEL_SIZE);
+        }
+        ply_pixel_buffer_pop_clip_area (pixel_buffer);
+}
+
+/* Works out new numbers for the HUD once a sample interval has gone by,
+ * and redraws it with them
+ */
+static void
+ply_pixel_display_update_hud (ply_pixel_display_t *display)
+{
+        ply_rectangle_t hud_area;
+        double now, elapsed_time, time_spent_waiting;
+        double frames;
+
+        now = ply_get_timestamp ();
+        elapsed_time = now - display->hud_sample_start_time;
+
+        if (elapsed_time < HUD_SAMPLE_INTERVAL)
+                return;
+
+        time_spent_waiting = ply_event_loop_get_time_spent_waiting (display->loop);
+        frames = MAX (display->hud_number_of_frames, 1);
+
+        snprintf (display->hud_lines[0], HUD_LINE_LENGTH + 1, "FPS %.1f",
+                  display->hud_number_of_frames / elapsed_time);
+        snprintf (display->hud_lines[1], HUD_LINE_LENGTH + 1, "DRAW %.2f MS",
+                  display->hud_composite_time * 1000.0 / frames);
+        snprintf (display->hud_lines[2], HUD_LINE_LENGTH + 1, "FLUSH %.2f MS",
+                  display->hud_flush_time * 1000.0 / frames);
+        snprintf (display->hud_lines[3], HUD_LINE_LENGTH + 1, "AREA %.1f%%",
+                  100.0 * display->hud_damaged_pixels /
+                  (frames * display->width * display->height));
+        snprintf (display->hud_lines[4], HUD_LINE_LENGTH + 1, "LOOP %.1f%%",
+                  100.0 * MAX (0.0, 1.0 - (time_spent_waiting -
+                                           display->hud_sample_start_time_spent_waiting) / elapsed_time));
+
+        display->hud_sample_start_time = now;
+        display->hud_sample_start_time_spent_waiting = time_spent_waiting;
+        display->hud_number_of_frames = 0;
+        display->hud_composite_time = 0.0;
+        display->hud_flush_time = 0.0;
+        display->hud_damaged_pixels = 0.0;
+
+        ply_pixel_display_get_hud_area (display, &hud_area);
+        ply_pixel_display_draw_area (display, hud_area.x, hud_area.y,
+                                     hud_area.width, hud_area.height);
+}
+
+static void
+on_idle (ply_pixel_display_t *display)
+{
+        ply_pixel_buffer_t *pixel_buffer;
+        ply_list_t *areas;
+        ply_list_node_t *node;
+
+        pixel_buffer = ply_renderer_get_buffer_for_head (display->renderer,
+                                                         display->head);
+
+        if (ply_pixel_display_has_draw_handler (display)) {
+                double start_time;
+
+                start_time = ply_get_timestamp ();
+                areas = ply_region_get_sorted_rectangle_list (display->pending_draw_area);
+                ply_probe (pixel_display_frame_start, display, ply_list_get_length (areas));
+
+                if (display->region_draw_handler != NULL)
+                        display->region_draw_handler (display->draw_handler_user_data,
+                                                      pixel_buffer,
+                                                      display->pending_draw_area,
+                                                      display);
+
+                for (node = ply_list_get_first_node (areas);
+                     node != NULL;
+                     node = ply_list_get_next_node (areas, node)) {
+                        ply_rectangle_t *area = ply_list_node_get_data (node);
+
+                        if (display->draw_handler != NULL)
+                                ply_pixel_display_draw_area_now (display, pixel_buffer, area);
+
+                        if (display->should_show_hud) {
+                                ply_pixel_display_draw_hud (display, pixel_buffer, area);
+                                display->hud_damaged_pixels += (double) area->width * area->height;
+                        }
+                }
+
+                ply_probe (pixel_display_frame_end, display);
+                ply_pixel_display_add_statistic_duration (display, "composite",
+                                                          ply_get_timestamp () - start_time);
+                display->hud_composite_time += ply_get_timestamp () - start_time;
+                display->hud_number_of_frames++;
+        }
+
+        ply_region_clear (display->pending_draw_area);
+
+        /* drops the pause taken when the first area was queued */
+        ply_pixel_display_unpause_updates (display);
+
+        if (display->should_show_hud)
+                ply_pixel_display_update_hud (display);
+}
+
+/* Drawing is put off until the event loop has nothing else to do, so a
+ * burst of updates in one iteration gets drawn, and flushed, only once.
+ */
 void
 ply_pixel_display_draw_area (ply_pixel_display_t *display,
                              int                  x,
@@ -147,26 +602,48 @@ ply_pixel_display_draw_area (ply_pixel_display_t *display,
                              int                  width,
                              int                  height)
 {
-        ply_pixel_buffer_t *pixel_buffer;
+        ply_rectangle_t area;
 
-        pixel_buffer = ply_renderer_get_buffer_for_head (display->renderer,
-                                                         display->head);
+        area.x = x;
+        area.y = y;
+        area.width = width;
+        area.height = height;
+
+        if (ply_rectangle_is_empty (&area))
+                return;
 
-        if (display->draw_handler != NULL) {
-                ply_rectangle_t clip_area;
+        ply_probe (pixel_display_draw_area, display, x, y, width, height);
 
-                clip_area.x = x;
-                clip_area.y = y;
-                clip_area.width = width;
-                clip_area.height = height;
-                ply_pixel_buffer_push_clip_area (pixel_buffer, &clip_area);
-                display->draw_handler (display->draw_handler_user_data,
-                                       pixel_buffer,
-                                       x, y, width, height, display);
-                ply_pixel_buffer_pop_clip_area (pixel_buffer);
+        if (ply_region_is_empty (display->pending_draw_area)) {
+                ply_pixel_display_pause_updates (display);
+                ply_event_loop_watch_for_idle (display->loop,
+                                               (ply_event_loop_idle_handler_t)
+                                               on_idle,
+                                               display);
         }
 
-        ply_pixel_display_flush (display);
+        ply_region_add_rectangle (display->pending_draw_area, &area);
+}
+
+void
+ply_pixel_display_draw_region (ply_pixel_display_t *display,
+                               ply_region_t        *region)
+{
+        ply_list_t *areas;
+        ply_list_node_t *node;
+
+        assert (display != NULL);
+        assert (region != NULL);
+
+        areas = ply_region_get_rectangle_list (region);
+        for (node = ply_list_get_first_node (areas);
+             node != NULL;
+             node = ply_list_get_next_node (areas, node)) {
+                ply_rectangle_t *area = ply_list_node_get_data (node);
+
+                ply_pixel_display_draw_area (display, area->x, area->y,
+                                             area->width, area->height);
+        }
 }
 
 void
@@ -175,6 +652,17 @@ ply_pixel_display_free (ply_pixel_display_t *display)
         if (display == NULL)
                 return;
 
+        ply_event_loop_stop_watching_for_idle (display->loop,
+                                               (ply_event_loop_idle_handler_t)
+                                               on_idle,
+                                               display);
+        ply_frame_clock_cancel_end_of_frame (ply_frame_clock_get_default (),
+                                             (ply_frame_clock_handler_t)
+                                             ply_pixel_display_flush_now,
+                                             display);
+        ply_region_free (display->pending_draw_area);
+        ply_pixel_buffer_free (display->first_frame);
+        free (display->statistics_prefix);
         free (display);
 }
 
@@ -186,7 +674,268 @@ ply_pixel_display_set_draw_handler (ply_pixel_display_t             *display,
         assert (display != NULL);
 
         display->draw_handler = draw_handler;
+        display->region_draw_handler = NULL;
+        display->draw_handler_user_data = user_data;
+        display->draw_handler_is_thread_safe = false;
+}
+
+void
+ply_pixel_display_set_region_draw_handler (ply_pixel_display_t                    *display,
+                                           ply_pixel_display_region_draw_handler_t draw_handler,
+                                           void                                   *user_data)
+{
+        assert (display != NULL);
+
+        display->draw_handler = NULL;
+        display->region_draw_handler = draw_handler;
         display->draw_handler_user_data = user_data;
+        display->draw_handler_is_thread_safe = false;
+}
+
+void
+ply_pixel_display_set_draw_handler_is_thread_safe (ply_pixel_display_t *display,
+                                                   bool                 is_thread_safe)
+{
+        assert (display != NULL);
+
+        display->draw_handler_is_thread_safe = is_thread_safe;
+}
+
+ply_renderer_plane_t *
+ply_pixel_display_create_plane (ply_pixel_display_t *display,
+                                unsigned long        width,
+                                unsigned long        height)
+{
+        ply_pixel_buffer_t *pixel_buffer;
+
+        /* Plane images go out as they are, so they only line up with the
+         * rest of the display if it isn't scaled or rotated */
+        pixel_buffer = ply_renderer_get_buffer_for_head (display->renderer, display->head);
+        if (display->device_scale != 1 ||
+            ply_pixel_buffer_get_device_rotation (pixel_buffer) != PLY_PIXEL_BUFFER_ROTATE_UPRIGHT)
+                return NULL;
+
+        return ply_renderer_create_plane (display->renderer, display->head,
+                                          width, height);
+}
+
+void
+ply_pixel_display_free_plane (ply_pixel_display_t  *display,
+                              ply_renderer_plane_t *plane)
+{
+        ply_renderer_free_plane (display->renderer, plane);
+}
+
+bool
+ply_pixel_display_show_image_on_plane (ply_pixel_display_t  *display,
+                                       ply_renderer_plane_t *plane,
+                                       ply_pixel_buffer_t   *image,
+                                       int                   x,
+                                       int                   y)
+{
+        if (ply_pixel_buffer_get_device_scale (image) != 1 ||
+            ply_pixel_buffer_get_device_rotation (image) != PLY_PIXEL_BUFFER_ROTATE_UPRIGHT)
+                return false;
+
+        return ply_renderer_show_image_on_plane (display->renderer, plane, image, x, y);
+}
+
+void
+ply_pixel_display_show_hud (ply_pixel_display_t *display)
+{
+        ply_rectangle_t hud_area;
+
+        if (display->should_show_hud)
+                return;
+
+        display->should_show_hud = true;
+        display->hud_sample_start_time = ply_get_timestamp ();
+        display->hud_sample_start_time_spent_waiting = ply_event_loop_get_time_spent_waiting (display->loop);
+
+        ply_pixel_display_get_hud_area (display, &hud_area);
+        ply_pixel_display_draw_area (display, hud_area.x, hud_area.y,
+                                     hud_area.width, hud_area.height);
+}
+
+void
+ply_pixel_display_keep_first_frame (ply_pixel_display_t *display)
+{
+        assert (display != NULL);
+
+        display->should_keep_first_frame = true;
+}
+
+static void
+get_snapshot_header (ply_pixel_buffer_t                  *pixel_buffer,
+                     const char                          *tag,
+                     ply_pixel_display_snapshot_header_t *header)
+{
+        ply_rectangle_t size;
+
+        ply_pixel_buffer_get_size (pixel_buffer, &size);
+
+        memset (header, 0, sizeof(*header));
+        memcpy (header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+        header->device_scale = ply_pixel_buffer_get_device_scale (pixel_buffer);
+        header->width = size.width * header->device_scale;
+        header->height = size.height * header->device_scale;
+        header->device_rotation = ply_pixel_buffer_get_device_rotation (pixel_buffer);
+        header->tag_length = strlen (tag);
+}
+
+static size_t
+get_snapshot_tag_size (ply_pixel_display_snapshot_header_t *header)
+{
+        return (header->tag_length + 3) & ~(size_t) 3;
+}
+
+bool
+ply_pixel_display_save_first_frame (ply_pixel_display_t *display,
+                                    const char          *filename,
+                                    const char          *tag)
+{
+        ply_pixel_display_snapshot_header_t header;
+        char *temporary_filename, *padded_tag;
+        bool is_saved;
+        int fd;
+
+        assert (display != NULL);
+        assert (filename != NULL);
+        assert (tag != NULL);
+
+        if (display->first_frame == NULL)
+                return false;
+
+        get_snapshot_header (ply_renderer_get_buffer_for_head (display->renderer, display->head),
+                             tag, &header);
+
+        asprintf (&temporary_filename, "%s.XXXXXX", filename);
+        fd = mkostemp (temporary_filename, O_CLOEXEC);
+
+        if (fd < 0) {
+                free (temporary_filename);
+                return false;
+        }
+
+        padded_tag = calloc (1, get_snapshot_tag_size (&header) + 1);
+        memcpy (padded_tag, tag, header.tag_length);
+
+        is_saved = ply_write (fd, &header, sizeof(header)) &&
+                   ply_write (fd, padded_tag, get_snapshot_tag_size (&header)) &&
+                   ply_write (fd, ply_pixel_buffer_get_argb32_data (display->first_frame),
+                              (size_t) header.width * header.height * sizeof(uint32_t));
+        free (padded_tag);
+
+        if (close (fd) < 0)
+                is_saved = false;
+
+        if (is_saved && rename (temporary_filename, filename) < 0)
+                is_saved = false;
+
+        if (!is_saved) {
+                ply_save_errno ();
+                unlink (temporary_filename);
+                ply_restore_errno ();
+        }
+        free (temporary_filename);
+
+        ply_pixel_buffer_free (display->first_frame);
+        display->first_frame = NULL;
+
+        return is_saved;
+}
+
+static bool
+read_bytes (int    fd,
+            void  *bytes,
+            size_t number_of_bytes)
+{
+        size_t bytes_left_to_read = number_of_bytes;
+        char *position = bytes;
+
+        while (bytes_left_to_read > 0) {
+                ssize_t bytes_read;
+
+                bytes_read = read (fd, position, bytes_left_to_read);
+
+                if (bytes_read < 0 && errno == EINTR)
+                        continue;
+
+                if (bytes_read <= 0)
+                        return false;
+
+                position += bytes_read;
+                bytes_left_to_read -= bytes_read;
+        }
+
+        return true;
+}
+
+bool
+ply_pixel_display_show_snapshot (ply_pixel_display_t *display,
+                                 const char          *filename,
+                                 const char          *tag)
+{
+        ply_pixel_display_snapshot_header_t expected_header, header;
+        ply_pixel_buffer_t *pixel_buffer;
+        ply_rectangle_t device_area;
+        struct stat file_info;
+        size_t pixels_size;
+        char *saved_tag;
+        bool is_shown;
+        int fd;
+
+        assert (display != NULL);
+        assert (filename != NULL);
+        assert (tag != NULL);
+
+        pixel_buffer = ply_renderer_get_buffer_for_head (display->renderer, display->head);
+        get_snapshot_header (pixel_buffer, tag, &expected_header);
+        pixels_size = (size_t) expected_header.width * expected_header.height * sizeof(uint32_t);
+
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+                return false;
+
+        is_shown = false;
+        saved_tag = calloc (1, get_snapshot_tag_size (&expected_header) + 1);
+
+        if (fstat (fd, &file_info) < 0 ||
+            (uint64_t) file_info.st_size != sizeof(header) + get_snapshot_tag_size (&expected_header) + pixels_size)
+                goto out;
+
+        if (!read_bytes (fd, &header, sizeof(header)) ||
+            memcmp (&header, &expected_header, sizeof(header)) != 0)
+                goto out;
+
+        if (!read_bytes (fd, saved_tag, get_snapshot_tag_size (&header)) ||
+            memcmp (saved_tag, tag, header.tag_length) != 0)
+                goto out;
+
+        /* Straight into the head's buffer, it all gets drawn over anyway */
+        if (!read_bytes (fd, ply_pixel_buffer_get_argb32_data (pixel_buffer), pixels_size))
+                goto out;
+
+        device_area.x = 0;
+        device_area.y = 0;
+        device_area.width = header.width;
+        device_area.height = header.height;
+        if (header.device_rotation == PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE ||
+            header.device_rotation == PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE) {
+                device_area.width = header.height;
+                device_area.height = header.width;
+        }
+        ply_tiled_region_add_rectangle (ply_pixel_buffer_get_updated_areas (pixel_buffer),
+                                        &device_area);
+
+        ply_statistics_add_timeline_event ("snapshot-shown", display->statistics_prefix);
+        is_shown = true;
+out:
+        free (saved_tag);
+        close (fd);
+
+        return is_shown;
 }
 
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
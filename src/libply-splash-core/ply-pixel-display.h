@@ -28,6 +28,7 @@
 
 #include "ply-event-loop.h"
 #include "ply-pixel-buffer.h"
+#include "ply-region.h"
 #include "ply-renderer.h"
 
 typedef struct _ply_pixel_display ply_pixel_display_t;
@@ -40,6 +41,11 @@ typedef void (*ply_pixel_display_draw_handler_t) (void                *user_data
                                                   int                  height,
                                                   ply_pixel_display_t *pixel_display);
 
+typedef void (*ply_pixel_display_region_draw_handler_t) (void                *user_data,
+                                                         ply_pixel_buffer_t  *pixel_buffer,
+                                                         ply_region_t        *region,
+                                                         ply_pixel_display_t *pixel_display);
+
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_pixel_display_t *ply_pixel_display_new (ply_renderer_t      *renderer,
                                             ply_renderer_head_t *head);
@@ -48,6 +54,7 @@ void ply_pixel_display_free (ply_pixel_display_t *display);
 
 ply_renderer_t      *ply_pixel_display_get_renderer (ply_pixel_display_t *display);
 ply_renderer_head_t *ply_pixel_display_get_renderer_head (ply_pixel_display_t *display);
+uint32_t ply_pixel_display_get_renderer_head_epoch (ply_pixel_display_t *display);
 
 unsigned long ply_pixel_display_get_width (ply_pixel_display_t *display);
 unsigned long ply_pixel_display_get_height (ply_pixel_display_t *display);
@@ -56,16 +63,74 @@ int ply_pixel_display_get_device_scale (ply_pixel_display_t *display);
 void ply_pixel_display_set_draw_handler (ply_pixel_display_t             *display,
                                          ply_pixel_display_draw_handler_t draw_handler,
                                          void                            *user_data);
+/* Lets draw_area split big areas into bands drawn in parallel when
+ * RenderThreads is set in plymouthd.conf.  The draw handler must then be
+ * safe to call from several threads at once, each with its own view of
+ * the pixel buffer.
+ */
+void ply_pixel_display_set_draw_handler_is_thread_safe (ply_pixel_display_t *display,
+                                                        bool                 is_thread_safe);
+/* Instead of a draw handler called once for each rectangle that needs
+ * drawing, with the pixel buffer clipped to it, this one gets called
+ * once a frame with all of them.  The rectangles in region don't
+ * overlap, and the handler has to keep its drawing inside them, usually
+ * by pushing each as a clip area in turn.  Drawing in bands doesn't
+ * apply to it.
+ */
+void ply_pixel_display_set_region_draw_handler (ply_pixel_display_t                    *display,
+                                                ply_pixel_display_region_draw_handler_t draw_handler,
+                                                void                                   *user_data);
 
 void ply_pixel_display_draw_area (ply_pixel_display_t *display,
                                   int                  x,
                                   int                  y,
                                   int                  width,
                                   int                  height);
+/* Queues every rectangle of region, as draw_area would one at a time */
+void ply_pixel_display_draw_region (ply_pixel_display_t *display,
+                                    ply_region_t        *region);
 
 void ply_pixel_display_pause_updates (ply_pixel_display_t *display);
 void ply_pixel_display_unpause_updates (ply_pixel_display_t *display);
 
+/* Small images that change on their own, like throbber frames, can be
+ * shown on a hardware plane above the display instead of being drawn in.
+ * Returns NULL when there is no plane for them, and whatever is shown
+ * on the plane has to be left out of the draw handler's drawing.
+ */
+ply_renderer_plane_t *ply_pixel_display_create_plane (ply_pixel_display_t *display,
+                                                      unsigned long        width,
+                                                      unsigned long        height);
+void ply_pixel_display_free_plane (ply_pixel_display_t  *display,
+                                   ply_renderer_plane_t *plane);
+bool ply_pixel_display_show_image_on_plane (ply_pixel_display_t  *display,
+                                            ply_renderer_plane_t *plane,
+                                            ply_pixel_buffer_t   *image,
+                                            int                   x,
+                                            int                   y);
+
+/* Puts a small overlay in the top left corner with the frame rate, how
+ * long drawing and flushing frames take, how much of the display each
+ * frame redraws and how busy the event loop is.  For eyeballing
+ * performance on real hardware.
+ */
+void ply_pixel_display_show_hud (ply_pixel_display_t *display);
+
+/* The first frame the draw handler draws can be kept and saved, to be
+ * put up on the next boot as soon as the display turns up, before the
+ * splash has loaded.  tag says what the frame showed, like the theme's
+ * path, and a snapshot is only shown with the same tag on a display of
+ * the same size, scale and rotation.  Showing one only fills in the
+ * head's buffer; it goes out with the next flush or when the renderer
+ * gets activated.
+ */
+void ply_pixel_display_keep_first_frame (ply_pixel_display_t *display);
+bool ply_pixel_display_save_first_frame (ply_pixel_display_t *display,
+                                         const char          *filename,
+                                         const char          *tag);
+bool ply_pixel_display_show_snapshot (ply_pixel_display_t *display,
+                                      const char          *filename,
+                                      const char          *tag);
 #endif
 
 #endif /* PLY_PIXEL_DISPLAY_H */
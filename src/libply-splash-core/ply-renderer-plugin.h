@@ -35,6 +35,8 @@
 typedef struct _ply_renderer_plugin ply_renderer_plugin_t;
 typedef struct _ply_renderer_backend ply_renderer_backend_t;
 
+typedef void (*ply_renderer_backend_heads_changed_handler_t) (void *user_data);
+
 typedef struct
 {
         ply_renderer_backend_t * (*create_backend)(const char *device_name,
@@ -76,6 +78,52 @@ typedef struct
                                      int                         *scale);
         bool (*get_capslock_state)(ply_renderer_backend_t *backend);
         const char * (*get_keymap)(ply_renderer_backend_t *backend);
+
+        ply_renderer_plane_t * (*create_plane)(ply_renderer_backend_t * backend,
+                                               ply_renderer_head_t * head,
+                                               unsigned long width,
+                                               unsigned long height);
+        void (*free_plane)(ply_renderer_backend_t *backend,
+                           ply_renderer_plane_t   *plane);
+        bool (*show_image_on_plane)(ply_renderer_backend_t *backend,
+                                    ply_renderer_plane_t   *plane,
+                                    ply_pixel_buffer_t     *image,
+                                    long                    x,
+                                    long                    y);
+        void (*hide_plane)(ply_renderer_backend_t *backend,
+                           ply_renderer_plane_t   *plane);
+
+        bool (*watch_for_vblank)(ply_renderer_backend_t       *backend,
+                                 unsigned int                  vblanks_from_now,
+                                 ply_renderer_vblank_handler_t handler,
+                                 void                         *user_data);
+
+        void (*set_handler_for_heads_changed)(ply_renderer_backend_t                      *backend,
+                                              ply_renderer_backend_heads_changed_handler_t handler,
+                                              void                                        *user_data);
+
+        bool (*capture_console_contents)(ply_renderer_backend_t *backend,
+                                         ply_renderer_head_t    *head);
+
+        uint32_t (*get_head_epoch)(ply_renderer_backend_t *backend,
+                                   ply_renderer_head_t    *head);
+
+        ply_renderer_capabilities_t (*get_head_capabilities)(ply_renderer_backend_t *backend,
+                                                             ply_renderer_head_t    *head);
+
+        void (*hand_over)(ply_renderer_backend_t *backend);
+
+        /* Optional, for flushing on a thread of the renderer's own.
+         * prepare_to_flush_head gets called on the main thread first, for
+         * whatever touches things the rest of the daemon uses too, like
+         * the terminal.  flush_head_on_thread then does the rest of what
+         * flush_head does.  Nothing else gets called on the backend while
+         * it runs.
+         */
+        void (*prepare_to_flush_head)(ply_renderer_backend_t *backend,
+                                      ply_renderer_head_t    *head);
+        void (*flush_head_on_thread)(ply_renderer_backend_t *backend,
+                                     ply_renderer_head_t    *head);
 } ply_renderer_plugin_interface_t;
 
 #endif /* PLY_RENDERER_PLUGIN_H */
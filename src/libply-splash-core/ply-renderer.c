@@ -38,10 +38,40 @@
 #include "ply-buffer.h"
 #include "ply-terminal.h"
 #include "ply-event-loop.h"
+#include "ply-frame-clock.h"
 #include "ply-list.h"
 #include "ply-logger.h"
+#include "ply-statistics.h"
+#include "ply-task-queue.h"
 #include "ply-utils.h"
 
+/* how often caps lock gets checked while no keys come in */
+#ifndef CAPSLOCK_STATE_POLL_INTERVAL
+#define CAPSLOCK_STATE_POLL_INTERVAL 0.1
+#endif
+
+/* What a head's pixel buffer looks like when the renderer flushes on a
+ * thread: everything gets drawn into a shadow of the backend's buffer,
+ * and only what got updated is copied over to the backend's buffer when
+ * the flush thread is idle, for the thread to read from while the next
+ * frame gets drawn.
+ */
+typedef struct
+{
+        ply_renderer_head_t *head;
+        ply_pixel_buffer_t  *device_buffer;
+        ply_pixel_buffer_t  *shadow_buffer;
+        uint32_t             epoch;
+
+        uint32_t             needs_flush : 1;
+} ply_renderer_shadow_t;
+
+typedef struct
+{
+        ply_renderer_capslock_state_changed_handler_t handler;
+        void                                         *user_data;
+} ply_renderer_capslock_closure_t;
+
 struct _ply_renderer
 {
         ply_event_loop_t                      *loop;
@@ -53,15 +83,34 @@ struct _ply_renderer
         char                                  *device_name;
         ply_terminal_t                        *terminal;
 
+        ply_renderer_heads_changed_handler_t   heads_changed_handler;
+        void                                  *heads_changed_handler_user_data;
+
+        ply_renderer_input_source_handler_t    input_source_handler;
+        void                                  *input_source_handler_user_data;
+
+        ply_list_t                            *capslock_closures;
+
+        /* only set up when flushing on a thread of its own */
+        ply_task_queue_t                      *flush_queue;
+        ply_list_t                            *shadows;
+        ply_list_t                            *heads_being_flushed;
+        int                                    flush_has_run;
+        uint32_t                               flush_is_queued : 1;
+
         uint32_t                               input_source_is_open : 1;
         uint32_t                               is_mapped : 1;
         uint32_t                               is_active : 1;
+        uint32_t                               capslock_is_on : 1;
 };
 
 typedef const ply_renderer_plugin_interface_t *
 (*get_backend_interface_function_t) (void);
 
 static void ply_renderer_unload_plugin (ply_renderer_t *renderer);
+static void ply_renderer_finish_flush (ply_renderer_t *renderer);
+static void ply_renderer_free_shadows (ply_renderer_t *renderer);
+static void on_capslock_poll_timeout (ply_renderer_t *renderer);
 
 ply_renderer_t *
 ply_renderer_new (ply_renderer_type_t renderer_type,
@@ -78,6 +127,7 @@ ply_renderer_new (ply_renderer_type_t renderer_type,
                 renderer->device_name = strdup (device_name);
 
         renderer->terminal = terminal;
+        renderer->capslock_closures = ply_list_new ();
 
         return renderer;
 }
@@ -85,9 +135,31 @@ ply_renderer_new (ply_renderer_type_t renderer_type,
 void
 ply_renderer_free (ply_renderer_t *renderer)
 {
+        ply_list_node_t *node;
+
         if (renderer == NULL)
                 return;
 
+        ply_frame_clock_remove_renderer (ply_frame_clock_get_default (), renderer);
+
+        while ((node = ply_list_get_first_node (renderer->capslock_closures)) != NULL) {
+                ply_renderer_capslock_closure_t *closure;
+
+                closure = ply_list_node_get_data (node);
+                ply_renderer_stop_watching_for_capslock_state_change (renderer,
+                                                                      closure->handler,
+                                                                      closure->user_data);
+        }
+        ply_list_free (renderer->capslock_closures);
+
+        if (renderer->flush_queue != NULL) {
+                ply_renderer_finish_flush (renderer);
+                ply_task_queue_free (renderer->flush_queue);
+                ply_renderer_free_shadows (renderer);
+                ply_list_free (renderer->shadows);
+                ply_list_free (renderer->heads_being_flushed);
+        }
+
         if (renderer->plugin_interface != NULL) {
                 ply_trace ("Unloading renderer backend plugin");
                 ply_renderer_unload_plugin (renderer);
@@ -105,20 +177,44 @@ ply_renderer_get_device_name (ply_renderer_t *renderer)
 
 static bool
 ply_renderer_load_plugin (ply_renderer_t *renderer,
-                          const char     *module_path)
+                          const char     *module_path,
+                          const char     *built_in_function_name)
 {
         assert (renderer != NULL);
 
-        get_backend_interface_function_t get_renderer_backend_interface;
+        get_backend_interface_function_t get_renderer_backend_interface = NULL;
+
+        /* plymouthd may have been built with this renderer in it, which
+         * saves loading it and the libraries it needs from disk
+         */
+        if (built_in_function_name != NULL) {
+                renderer->module_handle = ply_open_built_in_module ();
+
+                if (renderer->module_handle != NULL) {
+                        get_renderer_backend_interface = (get_backend_interface_function_t)
+                                                         ply_module_look_up_function (renderer->module_handle,
+                                                                                      built_in_function_name);
+
+                        if (get_renderer_backend_interface != NULL) {
+                                ply_trace ("using built-in renderer plugin for '%s'",
+                                           module_path);
+                        } else {
+                                ply_close_module (renderer->module_handle);
+                                renderer->module_handle = NULL;
+                        }
+                }
+        }
 
-        renderer->module_handle = ply_open_module (module_path);
+        if (renderer->module_handle == NULL) {
+                renderer->module_handle = ply_open_module (module_path);
 
-        if (renderer->module_handle == NULL)
-                return false;
+                if (renderer->module_handle == NULL)
+                        return false;
 
-        get_renderer_backend_interface = (get_backend_interface_function_t)
-                                         ply_module_look_up_function (renderer->module_handle,
-                                                                      "ply_renderer_backend_get_interface");
+                get_renderer_backend_interface = (get_backend_interface_function_t)
+                                                 ply_module_look_up_function (renderer->module_handle,
+                                                                              "ply_renderer_backend_get_interface");
+        }
 
         if (get_renderer_backend_interface == NULL) {
                 ply_save_errno ();
@@ -231,21 +327,35 @@ ply_renderer_unmap_from_device (ply_renderer_t *renderer)
 
 static bool
 ply_renderer_open_plugin (ply_renderer_t *renderer,
-                          const char     *plugin_path)
+                          const char     *plugin_path,
+                          const char     *built_in_function_name)
 {
+        double start_time;
+        bool is_opened;
+
         ply_trace ("trying to open renderer plugin %s", plugin_path);
 
-        if (!ply_renderer_load_plugin (renderer, plugin_path))
+        if (!ply_renderer_load_plugin (renderer, plugin_path, built_in_function_name))
                 return false;
 
-        if (!ply_renderer_open_device (renderer)) {
+        start_time = ply_get_timestamp ();
+        is_opened = ply_renderer_open_device (renderer);
+        ply_statistics_add_timeline_span ("renderer-open", plugin_path,
+                                          start_time, ply_get_timestamp ());
+
+        if (!is_opened) {
                 ply_trace ("could not open rendering device for plugin %s",
                            plugin_path);
                 ply_renderer_unload_plugin (renderer);
                 return false;
         }
 
-        if (!ply_renderer_query_device (renderer)) {
+        start_time = ply_get_timestamp ();
+        is_opened = ply_renderer_query_device (renderer);
+        ply_statistics_add_timeline_span ("renderer-query-device", plugin_path,
+                                          start_time, ply_get_timestamp ());
+
+        if (!is_opened) {
                 ply_trace ("could not query rendering device for plugin %s",
                            plugin_path);
                 ply_renderer_close_device (renderer);
@@ -266,19 +376,25 @@ ply_renderer_open (ply_renderer_t *renderer)
         {
                 ply_renderer_type_t type;
                 const char         *path;
+                const char         *built_in_function_name;
         } known_plugins[] =
         {
-                { PLY_RENDERER_TYPE_X11,          PLYMOUTH_PLUGIN_PATH "renderers/x11.so"          },
-                { PLY_RENDERER_TYPE_DRM,          PLYMOUTH_PLUGIN_PATH "renderers/drm.so"          },
-                { PLY_RENDERER_TYPE_FRAME_BUFFER, PLYMOUTH_PLUGIN_PATH "renderers/frame-buffer.so" },
-                { PLY_RENDERER_TYPE_NONE,         NULL                                             }
+                { PLY_RENDERER_TYPE_X11,          PLYMOUTH_PLUGIN_PATH "renderers/x11.so",          NULL                                      },
+                { PLY_RENDERER_TYPE_DRM,          PLYMOUTH_PLUGIN_PATH "renderers/drm.so",          "ply_renderer_drm_get_interface"          },
+                { PLY_RENDERER_TYPE_FRAME_BUFFER, PLYMOUTH_PLUGIN_PATH "renderers/frame-buffer.so", "ply_renderer_frame_buffer_get_interface" },
+                { PLY_RENDERER_TYPE_OFFSCREEN,    PLYMOUTH_PLUGIN_PATH "renderers/offscreen.so",    NULL                                      },
+                { PLY_RENDERER_TYPE_NONE,         NULL,                                             NULL                                      }
         };
 
         renderer->is_active = false;
         for (i = 0; known_plugins[i].type != PLY_RENDERER_TYPE_NONE; i++) {
+                /* the offscreen renderer always works, so only use it when
+                 * asked to explicitly */
                 if (renderer->type == known_plugins[i].type ||
-                    renderer->type == PLY_RENDERER_TYPE_AUTO)
-                        if (ply_renderer_open_plugin (renderer, known_plugins[i].path)) {
+                    (renderer->type == PLY_RENDERER_TYPE_AUTO &&
+                     known_plugins[i].type != PLY_RENDERER_TYPE_OFFSCREEN))
+                        if (ply_renderer_open_plugin (renderer, known_plugins[i].path,
+                                                      known_plugins[i].built_in_function_name)) {
                                 renderer->is_active = true;
                                 goto out;
                         }
@@ -286,12 +402,27 @@ ply_renderer_open (ply_renderer_t *renderer)
 
         ply_trace ("could not find suitable rendering plugin");
 out:
+        if (renderer->is_active)
+                ply_frame_clock_add_renderer (ply_frame_clock_get_default (), renderer);
+
+        if (renderer->is_active && renderer->flush_queue == NULL &&
+            ply_get_flush_threads () &&
+            renderer->plugin_interface->flush_head_on_thread != NULL) {
+                ply_trace ("flushing %s on a thread of its own", renderer->device_name);
+                renderer->flush_queue = ply_task_queue_new (ply_event_loop_get_default (), 1);
+                renderer->shadows = ply_list_new ();
+                renderer->heads_being_flushed = ply_list_new ();
+        }
+
         return renderer->is_active;
 }
 
 void
 ply_renderer_close (ply_renderer_t *renderer)
 {
+        ply_frame_clock_remove_renderer (ply_frame_clock_get_default (), renderer);
+        ply_renderer_finish_flush (renderer);
+        ply_renderer_free_shadows (renderer);
         ply_renderer_unmap_from_device (renderer);
         ply_renderer_close_device (renderer);
         renderer->is_active = false;
@@ -300,10 +431,49 @@ ply_renderer_close (ply_renderer_t *renderer)
 bool
 ply_renderer_handle_change_event (ply_renderer_t *renderer)
 {
-        if (renderer->plugin_interface->handle_change_event)
-                return renderer->plugin_interface->handle_change_event (renderer->backend);
+        bool heads_changed;
+
+        if (!renderer->plugin_interface->handle_change_event)
+                return false;
+
+        ply_renderer_finish_flush (renderer);
+        heads_changed = renderer->plugin_interface->handle_change_event (renderer->backend);
+
+        /* shadows of heads that changed get made again when next asked for,
+         * but ones for heads that went away never would be */
+        if (heads_changed)
+                ply_renderer_free_shadows (renderer);
+
+        return heads_changed;
+}
+
+static void
+on_backend_heads_changed (ply_renderer_t *renderer)
+{
+        ply_renderer_finish_flush (renderer);
+        ply_renderer_free_shadows (renderer);
+
+        if (renderer->heads_changed_handler != NULL)
+                renderer->heads_changed_handler (renderer->heads_changed_handler_user_data,
+                                                 renderer);
+}
+
+void
+ply_renderer_set_handler_for_heads_changed (ply_renderer_t                      *renderer,
+                                            ply_renderer_heads_changed_handler_t handler,
+                                            void                                *user_data)
+{
+        assert (renderer != NULL);
+        assert (renderer->plugin_interface != NULL);
+
+        renderer->heads_changed_handler = handler;
+        renderer->heads_changed_handler_user_data = user_data;
 
-        return false;
+        if (renderer->plugin_interface->set_handler_for_heads_changed)
+                renderer->plugin_interface->set_handler_for_heads_changed (renderer->backend,
+                                                                           (ply_renderer_backend_heads_changed_handler_t)
+                                                                           on_backend_heads_changed,
+                                                                           renderer);
 }
 
 void
@@ -314,6 +484,7 @@ ply_renderer_activate (ply_renderer_t *renderer)
         if (renderer->is_active)
               return;
 
+        ply_renderer_finish_flush (renderer);
         renderer->plugin_interface->activate (renderer->backend);
         renderer->is_active = true;
 }
@@ -323,10 +494,24 @@ ply_renderer_deactivate (ply_renderer_t *renderer)
 {
         assert (renderer->plugin_interface != NULL);
 
+        ply_renderer_finish_flush (renderer);
         renderer->plugin_interface->deactivate (renderer->backend);
         renderer->is_active = false;
 }
 
+void
+ply_renderer_hand_over (ply_renderer_t *renderer)
+{
+        assert (renderer->plugin_interface != NULL);
+
+        if (!renderer->plugin_interface->hand_over)
+                return;
+
+        ply_renderer_finish_flush (renderer);
+        renderer->plugin_interface->hand_over (renderer->backend);
+        renderer->is_active = false;
+}
+
 bool
 ply_renderer_is_active (ply_renderer_t *renderer)
 {
@@ -341,6 +526,194 @@ ply_renderer_get_heads (ply_renderer_t *renderer)
         return renderer->plugin_interface->get_heads (renderer->backend);
 }
 
+static ply_renderer_shadow_t *
+ply_renderer_find_shadow (ply_renderer_t      *renderer,
+                          ply_renderer_head_t *head)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (renderer->shadows);
+             node != NULL;
+             node = ply_list_get_next_node (renderer->shadows, node)) {
+                ply_renderer_shadow_t *shadow = ply_list_node_get_data (node);
+
+                if (shadow->head == head)
+                        return shadow;
+        }
+
+        return NULL;
+}
+
+static void
+ply_renderer_free_shadow (ply_renderer_t        *renderer,
+                          ply_renderer_shadow_t *shadow)
+{
+        ply_list_remove_data (renderer->shadows, shadow);
+        ply_pixel_buffer_free (shadow->device_buffer);
+        ply_pixel_buffer_free (shadow->shadow_buffer);
+        free (shadow);
+}
+
+static void
+ply_renderer_free_shadows (ply_renderer_t *renderer)
+{
+        ply_list_node_t *node;
+
+        if (renderer->shadows == NULL)
+                return;
+
+        while ((node = ply_list_get_first_node (renderer->shadows)) != NULL) {
+                ply_renderer_free_shadow (renderer, ply_list_node_get_data (node));
+        }
+}
+
+/* Returns the shadow of the head's buffer, made anew if the head got a
+ * different one, or NULL if the head has to be drawn to directly */
+static ply_renderer_shadow_t *
+ply_renderer_get_shadow (ply_renderer_t      *renderer,
+                         ply_renderer_head_t *head)
+{
+        ply_renderer_shadow_t *shadow;
+        ply_pixel_buffer_t *device_buffer;
+        uint32_t epoch;
+
+        device_buffer = renderer->plugin_interface->get_buffer_for_head (renderer->backend,
+                                                                         head);
+        epoch = ply_renderer_get_head_epoch (renderer, head);
+
+        shadow = ply_renderer_find_shadow (renderer, head);
+        if (shadow != NULL && shadow->device_buffer == device_buffer && shadow->epoch == epoch)
+                return shadow;
+
+        /* the device buffer gets read from below */
+        ply_renderer_finish_flush (renderer);
+
+        if (shadow != NULL)
+                ply_renderer_free_shadow (renderer, shadow);
+
+        if (device_buffer == NULL)
+                return NULL;
+
+        /* drawing into a shadow of the scan-out buffer would only mean
+         * copying every frame from the main thread anyway */
+        if (ply_renderer_get_head_capabilities (renderer, head) & PLY_RENDERER_CAPABILITY_DIRECT_SCAN_OUT)
+                return NULL;
+
+        shadow = calloc (1, sizeof(ply_renderer_shadow_t));
+        shadow->head = head;
+        shadow->device_buffer = ply_pixel_buffer_ref (device_buffer);
+        shadow->shadow_buffer = ply_pixel_buffer_new_shadow (device_buffer);
+        shadow->epoch = epoch;
+        ply_pixel_buffer_set_owner (shadow->shadow_buffer, "display");
+        ply_list_append_data (renderer->shadows, shadow);
+
+        return shadow;
+}
+
+/* Moves what got drawn into the shadows since the last flush over to the
+ * backend's buffers.  Only call it with the flush thread idle.
+ */
+static bool
+ply_renderer_take_damage_from_shadows (ply_renderer_t *renderer)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (renderer->shadows);
+             node != NULL;
+             node = ply_list_get_next_node (renderer->shadows, node)) {
+                ply_renderer_shadow_t *shadow = ply_list_node_get_data (node);
+
+                if (!shadow->needs_flush)
+                        continue;
+
+                ply_pixel_buffer_copy_updated_areas (shadow->device_buffer,
+                                                     shadow->shadow_buffer);
+
+                if (renderer->plugin_interface->prepare_to_flush_head != NULL)
+                        renderer->plugin_interface->prepare_to_flush_head (renderer->backend,
+                                                                           shadow->head);
+
+                ply_list_append_data (renderer->heads_being_flushed, shadow->head);
+                shadow->needs_flush = false;
+        }
+
+        return ply_list_get_length (renderer->heads_being_flushed) > 0;
+}
+
+static void
+ply_renderer_flush_heads_on_thread (ply_renderer_t *renderer)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (renderer->heads_being_flushed);
+             node != NULL;
+             node = ply_list_get_next_node (renderer->heads_being_flushed, node)) {
+                renderer->plugin_interface->flush_head_on_thread (renderer->backend,
+                                                                  ply_list_node_get_data (node));
+        }
+
+        renderer->flush_has_run = true;
+}
+
+static void ply_renderer_queue_flush (ply_renderer_t *renderer);
+
+static void
+on_flush_done (ply_renderer_t *renderer)
+{
+        renderer->flush_is_queued = false;
+        ply_list_remove_all_nodes (renderer->heads_being_flushed);
+
+        /* whatever got drawn while the thread was busy goes out now, all
+         * in one go */
+        ply_renderer_queue_flush (renderer);
+}
+
+static void
+ply_renderer_queue_flush (ply_renderer_t *renderer)
+{
+        if (renderer->flush_is_queued)
+                return;
+
+        if (!ply_renderer_take_damage_from_shadows (renderer))
+                return;
+
+        renderer->flush_has_run = false;
+        renderer->flush_is_queued = true;
+        ply_task_queue_run (renderer->flush_queue,
+                            (ply_task_handler_t)
+                            ply_renderer_flush_heads_on_thread,
+                            (ply_task_handler_t)
+                            on_flush_done,
+                            renderer);
+}
+
+/* Waits for the flush thread, and flushes on this thread what is still
+ * waiting for it, so the backend can be called into again */
+static void
+ply_renderer_finish_flush (ply_renderer_t *renderer)
+{
+        if (renderer->flush_queue == NULL)
+                return;
+
+        if (renderer->flush_is_queued) {
+                ply_task_queue_cancel (renderer->flush_queue,
+                                       (ply_task_handler_t)
+                                       ply_renderer_flush_heads_on_thread,
+                                       renderer);
+
+                if (!renderer->flush_has_run)
+                        ply_renderer_flush_heads_on_thread (renderer);
+
+                renderer->flush_is_queued = false;
+                ply_list_remove_all_nodes (renderer->heads_being_flushed);
+        }
+
+        if (ply_renderer_take_damage_from_shadows (renderer)) {
+                ply_renderer_flush_heads_on_thread (renderer);
+                ply_list_remove_all_nodes (renderer->heads_being_flushed);
+        }
+}
+
 ply_pixel_buffer_t *
 ply_renderer_get_buffer_for_head (ply_renderer_t      *renderer,
                                   ply_renderer_head_t *head)
@@ -349,10 +722,31 @@ ply_renderer_get_buffer_for_head (ply_renderer_t      *renderer,
         assert (renderer->plugin_interface != NULL);
         assert (head != NULL);
 
+        if (renderer->flush_queue != NULL) {
+                ply_renderer_shadow_t *shadow;
+
+                shadow = ply_renderer_get_shadow (renderer, head);
+                if (shadow != NULL)
+                        return shadow->shadow_buffer;
+        }
+
         return renderer->plugin_interface->get_buffer_for_head (renderer->backend,
                                                                 head);
 }
 
+ply_renderer_capabilities_t
+ply_renderer_get_head_capabilities (ply_renderer_t      *renderer,
+                                    ply_renderer_head_t *head)
+{
+        assert (renderer != NULL);
+        assert (head != NULL);
+
+        if (!renderer->plugin_interface->get_head_capabilities)
+                return PLY_RENDERER_CAPABILITY_NONE;
+
+        return renderer->plugin_interface->get_head_capabilities (renderer->backend, head);
+}
+
 void
 ply_renderer_flush_head (ply_renderer_t      *renderer,
                          ply_renderer_head_t *head)
@@ -364,6 +758,19 @@ ply_renderer_flush_head (ply_renderer_t      *renderer,
         if (!ply_renderer_map_to_device (renderer))
                 return;
 
+        if (renderer->flush_queue != NULL) {
+                ply_renderer_shadow_t *shadow;
+
+                shadow = ply_renderer_get_shadow (renderer, head);
+                if (shadow != NULL) {
+                        shadow->needs_flush = true;
+                        ply_renderer_queue_flush (renderer);
+                        return;
+                }
+
+                ply_renderer_finish_flush (renderer);
+        }
+
         renderer->plugin_interface->flush_head (renderer->backend, head);
 }
 
@@ -389,6 +796,51 @@ ply_renderer_open_input_source (ply_renderer_t              *renderer,
         return renderer->input_source_is_open;
 }
 
+static void
+ply_renderer_check_capslock_state (ply_renderer_t *renderer)
+{
+        ply_list_node_t *node;
+        bool is_on;
+
+        if (ply_list_get_length (renderer->capslock_closures) == 0 ||
+            renderer->plugin_interface == NULL ||
+            renderer->plugin_interface->get_capslock_state == NULL)
+                return;
+
+        is_on = renderer->plugin_interface->get_capslock_state (renderer->backend);
+
+        if (is_on == renderer->capslock_is_on)
+                return;
+
+        renderer->capslock_is_on = is_on;
+
+        node = ply_list_get_first_node (renderer->capslock_closures);
+        while (node != NULL) {
+                ply_renderer_capslock_closure_t *closure;
+                ply_list_node_t *next_node;
+
+                closure = ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (renderer->capslock_closures, node);
+
+                closure->handler (closure->user_data, is_on, renderer);
+
+                node = next_node;
+        }
+}
+
+static void
+on_input_source_input (ply_renderer_t              *renderer,
+                       ply_buffer_t                *key_buffer,
+                       ply_renderer_input_source_t *input_source)
+{
+        /* before the keys get handled, so a prompt redrawn because of them
+         * already shows the new state */
+        ply_renderer_check_capslock_state (renderer);
+
+        renderer->input_source_handler (renderer->input_source_handler_user_data,
+                                        key_buffer, input_source);
+}
+
 void
 ply_renderer_set_handler_for_input_source (ply_renderer_t                     *renderer,
                                            ply_renderer_input_source_t        *input_source,
@@ -398,10 +850,21 @@ ply_renderer_set_handler_for_input_source (ply_renderer_t                     *r
         assert (renderer != NULL);
         assert (input_source != NULL);
 
+        renderer->input_source_handler = handler;
+        renderer->input_source_handler_user_data = user_data;
+
+        if (handler == NULL) {
+                renderer->plugin_interface->set_handler_for_input_source (renderer->backend,
+                                                                          input_source,
+                                                                          NULL, NULL);
+                return;
+        }
+
         renderer->plugin_interface->set_handler_for_input_source (renderer->backend,
                                                                   input_source,
-                                                                  handler,
-                                                                  user_data);
+                                                                  (ply_renderer_input_source_handler_t)
+                                                                  on_input_source_input,
+                                                                  renderer);
 }
 
 void
@@ -440,6 +903,10 @@ ply_renderer_get_capslock_state (ply_renderer_t *renderer)
         if (!renderer->plugin_interface->get_capslock_state)
                 return false;
 
+        /* kept up to date while anything watches it */
+        if (ply_list_get_length (renderer->capslock_closures) > 0)
+                return renderer->capslock_is_on;
+
         return renderer->plugin_interface->get_capslock_state (renderer->backend);
 }
 
@@ -452,4 +919,186 @@ ply_renderer_get_keymap (ply_renderer_t *renderer)
         return renderer->plugin_interface->get_keymap (renderer->backend);
 }
 
+static void
+on_capslock_poll_timeout (ply_renderer_t *renderer)
+{
+        ply_renderer_check_capslock_state (renderer);
+
+        ply_event_loop_watch_for_timeout (ply_event_loop_get_default (),
+                                          CAPSLOCK_STATE_POLL_INTERVAL,
+                                          (ply_event_loop_timeout_handler_t)
+                                          on_capslock_poll_timeout,
+                                          renderer);
+}
+
+void
+ply_renderer_watch_for_capslock_state_change (ply_renderer_t                              *renderer,
+                                              ply_renderer_capslock_state_changed_handler_t handler,
+                                              void                                        *user_data)
+{
+        ply_renderer_capslock_closure_t *closure;
+
+        assert (renderer != NULL);
+        assert (renderer->plugin_interface != NULL);
+
+        if (ply_list_get_length (renderer->capslock_closures) == 0 &&
+            renderer->plugin_interface->get_capslock_state != NULL) {
+                renderer->capslock_is_on = renderer->plugin_interface->get_capslock_state (renderer->backend);
+                ply_event_loop_watch_for_timeout (ply_event_loop_get_default (),
+                                                  CAPSLOCK_STATE_POLL_INTERVAL,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_capslock_poll_timeout,
+                                                  renderer);
+        }
+
+        closure = calloc (1, sizeof(*closure));
+        closure->handler = handler;
+        closure->user_data = user_data;
+
+        ply_list_append_data (renderer->capslock_closures, closure);
+}
+
+void
+ply_renderer_stop_watching_for_capslock_state_change (ply_renderer_t                              *renderer,
+                                                      ply_renderer_capslock_state_changed_handler_t handler,
+                                                      void                                        *user_data)
+{
+        ply_list_node_t *node;
+
+        assert (renderer != NULL);
+
+        node = ply_list_get_first_node (renderer->capslock_closures);
+        while (node != NULL) {
+                ply_renderer_capslock_closure_t *closure;
+                ply_list_node_t *next_node;
+
+                closure = ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (renderer->capslock_closures, node);
+
+                if (closure->handler == handler &&
+                    closure->user_data == user_data) {
+                        free (closure);
+                        ply_list_remove_node (renderer->capslock_closures, node);
+                }
+
+                node = next_node;
+        }
+
+        if (ply_list_get_length (renderer->capslock_closures) == 0 &&
+            renderer->plugin_interface != NULL &&
+            renderer->plugin_interface->get_capslock_state != NULL)
+                ply_event_loop_stop_watching_for_timeout (ply_event_loop_get_default (),
+                                                          (ply_event_loop_timeout_handler_t)
+                                                          on_capslock_poll_timeout,
+                                                          renderer);
+}
+
+ply_renderer_plane_t *
+ply_renderer_create_plane (ply_renderer_t      *renderer,
+                           ply_renderer_head_t *head,
+                           unsigned long        width,
+                           unsigned long        height)
+{
+        assert (renderer != NULL);
+        assert (head != NULL);
+
+        if (!renderer->plugin_interface->create_plane)
+                return NULL;
+
+        return renderer->plugin_interface->create_plane (renderer->backend, head,
+                                                         width, height);
+}
+
+void
+ply_renderer_free_plane (ply_renderer_t       *renderer,
+                         ply_renderer_plane_t *plane)
+{
+        if (plane == NULL)
+                return;
+
+        renderer->plugin_interface->free_plane (renderer->backend, plane);
+}
+
+bool
+ply_renderer_show_image_on_plane (ply_renderer_t       *renderer,
+                                  ply_renderer_plane_t *plane,
+                                  ply_pixel_buffer_t   *image,
+                                  long                  x,
+                                  long                  y)
+{
+        assert (renderer != NULL);
+        assert (plane != NULL);
+        assert (image != NULL);
+
+        return renderer->plugin_interface->show_image_on_plane (renderer->backend, plane,
+                                                                image, x, y);
+}
+
+void
+ply_renderer_hide_plane (ply_renderer_t       *renderer,
+                         ply_renderer_plane_t *plane)
+{
+        assert (renderer != NULL);
+        assert (plane != NULL);
+
+        renderer->plugin_interface->hide_plane (renderer->backend, plane);
+}
+
+bool
+ply_renderer_capture_console_contents (ply_renderer_t      *renderer,
+                                       ply_renderer_head_t *head)
+{
+        assert (renderer != NULL);
+        assert (head != NULL);
+
+        if (!renderer->plugin_interface->capture_console_contents)
+                return false;
+
+        if (renderer->flush_queue != NULL) {
+                ply_renderer_shadow_t *shadow;
+
+                ply_renderer_finish_flush (renderer);
+
+                /* made again from what got captured when next asked for */
+                shadow = ply_renderer_find_shadow (renderer, head);
+                if (shadow != NULL)
+                        ply_renderer_free_shadow (renderer, shadow);
+        }
+
+        return renderer->plugin_interface->capture_console_contents (renderer->backend, head);
+}
+
+uint32_t
+ply_renderer_get_head_epoch (ply_renderer_t      *renderer,
+                             ply_renderer_head_t *head)
+{
+        assert (renderer != NULL);
+        assert (head != NULL);
+
+        if (!renderer->plugin_interface->get_head_epoch)
+                return 0;
+
+        return renderer->plugin_interface->get_head_epoch (renderer->backend, head);
+}
+
+bool
+ply_renderer_watch_for_vblank (ply_renderer_t               *renderer,
+                               unsigned int                  vblanks_from_now,
+                               ply_renderer_vblank_handler_t handler,
+                               void                         *user_data)
+{
+        assert (renderer != NULL);
+        assert (handler != NULL);
+
+        if (!renderer->is_active || !renderer->is_mapped)
+                return false;
+
+        if (!renderer->plugin_interface->watch_for_vblank)
+                return false;
+
+        return renderer->plugin_interface->watch_for_vblank (renderer->backend,
+                                                             vblanks_from_now,
+                                                             handler, user_data);
+}
+
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -34,6 +34,7 @@
 typedef struct _ply_renderer ply_renderer_t;
 typedef struct _ply_renderer_head ply_renderer_head_t;
 typedef struct _ply_renderer_input_source ply_renderer_input_source_t;
+typedef struct _ply_renderer_plane ply_renderer_plane_t;
 
 typedef enum
 {
@@ -41,13 +42,38 @@ typedef enum
         PLY_RENDERER_TYPE_AUTO,
         PLY_RENDERER_TYPE_DRM,
         PLY_RENDERER_TYPE_FRAME_BUFFER,
-        PLY_RENDERER_TYPE_X11
+        PLY_RENDERER_TYPE_X11,
+        PLY_RENDERER_TYPE_OFFSCREEN
 } ply_renderer_type_t;
 
+typedef enum
+{
+        PLY_RENDERER_CAPABILITY_NONE            = 0,
+        /* The head's pixel buffer is the mapped memory the device shows
+         * next, rather than a shadow that gets copied out on every flush,
+         * except while a flip is in flight.  Reading pixels back from it
+         * can be slow, and they move between the head's buffers and a
+         * shadow as pages get flipped, so the pointer from
+         * ply_pixel_buffer_get_argb32_data doesn't last past a flush.
+         */
+        PLY_RENDERER_CAPABILITY_DIRECT_SCAN_OUT = 1 << 0,
+} ply_renderer_capabilities_t;
+
 typedef void (*ply_renderer_input_source_handler_t) (void                        *user_data,
                                                      ply_buffer_t                *key_buffer,
                                                      ply_renderer_input_source_t *input_source);
 
+typedef void (*ply_renderer_vblank_handler_t) (void        *user_data,
+                                               unsigned int sequence,
+                                               double       time);
+
+typedef void (*ply_renderer_heads_changed_handler_t) (void           *user_data,
+                                                      ply_renderer_t *renderer);
+
+typedef void (*ply_renderer_capslock_state_changed_handler_t) (void           *user_data,
+                                                               bool            is_on,
+                                                               ply_renderer_t *renderer);
+
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_renderer_t *ply_renderer_new (ply_renderer_type_t renderer_type,
                                   const char         *device_name,
@@ -57,13 +83,25 @@ bool ply_renderer_open (ply_renderer_t *renderer);
 void ply_renderer_close (ply_renderer_t *renderer);
 /* Returns true when the heads have changed as a result of the change event */
 bool ply_renderer_handle_change_event (ply_renderer_t *renderer);
+/* Called when the renderer finds out on its own that its heads changed,
+ * for instance once outputs that weren't lit at startup have been probed
+ */
+void ply_renderer_set_handler_for_heads_changed (ply_renderer_t                      *renderer,
+                                                 ply_renderer_heads_changed_handler_t handler,
+                                                 void                                *user_data);
 void ply_renderer_activate (ply_renderer_t *renderer);
 void ply_renderer_deactivate (ply_renderer_t *renderer);
+/* Gives up the device but leaves the current frame on screen after the
+ * renderer is freed, for the display server to take over from
+ */
+void ply_renderer_hand_over (ply_renderer_t *renderer);
 bool ply_renderer_is_active (ply_renderer_t *renderer);
 const char *ply_renderer_get_device_name (ply_renderer_t *renderer);
 ply_list_t *ply_renderer_get_heads (ply_renderer_t *renderer);
 ply_pixel_buffer_t *ply_renderer_get_buffer_for_head (ply_renderer_t      *renderer,
                                                       ply_renderer_head_t *head);
+ply_renderer_capabilities_t ply_renderer_get_head_capabilities (ply_renderer_t      *renderer,
+                                                                ply_renderer_head_t *head);
 
 void ply_renderer_flush_head (ply_renderer_t      *renderer,
                               ply_renderer_head_t *head);
@@ -87,6 +125,63 @@ bool ply_renderer_get_panel_properties (ply_renderer_t              *renderer,
 
 bool ply_renderer_get_capslock_state (ply_renderer_t *renderer);
 const char *ply_renderer_get_keymap (ply_renderer_t *renderer);
+
+/* Calls handler whenever caps lock goes on or off.  The state gets checked
+ * as keys come in from the renderer's input source, and every so often in
+ * between, since the caps lock key on its own sends no input.
+ */
+void ply_renderer_watch_for_capslock_state_change (ply_renderer_t                              *renderer,
+                                                   ply_renderer_capslock_state_changed_handler_t handler,
+                                                   void                                        *user_data);
+void ply_renderer_stop_watching_for_capslock_state_change (ply_renderer_t                              *renderer,
+                                                           ply_renderer_capslock_state_changed_handler_t handler,
+                                                           void                                        *user_data);
+
+/* A plane is a small hardware layer above the head's pixel buffer, like
+ * a cursor plane.  Returns NULL when the renderer has none to spare for
+ * an image of the given size, and the caller should draw in software.
+ * Images shown on a plane are upright, premultiplied ARGB32 in device
+ * pixels, and must not be changed while they may be shown.
+ */
+ply_renderer_plane_t *ply_renderer_create_plane (ply_renderer_t      *renderer,
+                                                 ply_renderer_head_t *head,
+                                                 unsigned long        width,
+                                                 unsigned long        height);
+void ply_renderer_free_plane (ply_renderer_t       *renderer,
+                              ply_renderer_plane_t *plane);
+/* Returns false if the plane stopped working, in which case the image
+ * has to be drawn in software from now on */
+bool ply_renderer_show_image_on_plane (ply_renderer_t       *renderer,
+                                       ply_renderer_plane_t *plane,
+                                       ply_pixel_buffer_t   *image,
+                                       long                  x,
+                                       long                  y);
+void ply_renderer_hide_plane (ply_renderer_t       *renderer,
+                              ply_renderer_plane_t *plane);
+
+/* Fills the head's pixel buffer with what the head is showing right now,
+ * usually the firmware's boot logo, so it can stay up without a flash
+ * when the renderer takes over.  Only makes sense before anything got
+ * drawn to the head.  Returns false if the contents can't be read back.
+ */
+bool ply_renderer_capture_console_contents (ply_renderer_t      *renderer,
+                                            ply_renderer_head_t *head);
+
+/* Changes whenever the head is set up anew or gets a different pixel
+ * buffer, so whatever was drawn for it has to be redone.  A head that
+ * comes through a hotplug with the same epoch can be left alone.
+ */
+uint32_t ply_renderer_get_head_epoch (ply_renderer_t      *renderer,
+                                      ply_renderer_head_t *head);
+
+/* Calls handler once, vblanks_from_now vertical blanks from now, with the
+ * vblank's sequence number and time.  Returns false if the renderer can't
+ * report vblanks right now, in which case handler won't be called.
+ */
+bool ply_renderer_watch_for_vblank (ply_renderer_t               *renderer,
+                                    unsigned int                  vblanks_from_now,
+                                    ply_renderer_vblank_handler_t handler,
+                                    void                         *user_data);
 #endif
 
 #endif /* PLY_RENDERER_H */
@@ -39,6 +39,7 @@
 
 #include <linux/kd.h>
 #include <linux/major.h>
+#include <linux/serial.h>
 #include <linux/vt.h>
 
 #include "ply-buffer.h"
@@ -60,6 +61,16 @@
 #define PLY_TERMINAL_REOPEN_INTERVAL 0.05
 #endif
 
+/* Escape sequences and short messages get formatted on the stack */
+#ifndef PLY_TERMINAL_MAX_STACK_STRING_SIZE
+#define PLY_TERMINAL_MAX_STACK_STRING_SIZE 256
+#endif
+
+/* Output gets written out right away once this much is waiting */
+#ifndef PLY_TERMINAL_MAX_BUFFERED_OUTPUT
+#define PLY_TERMINAL_MAX_BUFFERED_OUTPUT (64 * 1024)
+#endif
+
 typedef struct
 {
         ply_terminal_input_handler_t handler;
@@ -89,6 +100,7 @@ struct _ply_terminal
         ply_list_t          *vt_change_closures;
         ply_list_t          *input_closures;
         ply_fd_watch_t      *fd_watch;
+        ply_buffer_t        *output;
         ply_terminal_color_t foreground_color;
         ply_terminal_color_t background_color;
 
@@ -97,6 +109,13 @@ struct _ply_terminal
 
         int                  number_of_rows;
         int                  number_of_columns;
+        int                  output_bytes_per_second;
+
+        /* The mode last set.  Renderers set it on every flush, so it is
+         * only set again when the tty could have changed under us: it got
+         * reopened or the VT got switched away from and back.
+         */
+        ply_terminal_mode_t  mode;
 
         uint32_t             original_term_attributes_saved : 1;
         uint32_t             original_locked_term_attributes_saved : 1;
@@ -106,6 +125,9 @@ struct _ply_terminal
         uint32_t             is_unbuffered : 1;
         uint32_t             is_watching_for_vt_changes : 1;
         uint32_t             should_ignore_mode_changes : 1;
+        uint32_t             mode_is_current : 1;
+        uint32_t             unbuffered_input_is_current : 1;
+        uint32_t             flush_is_queued : 1;
 };
 
 typedef enum
@@ -158,6 +180,7 @@ ply_terminal_new (const char *device_name)
         terminal->loop = ply_event_loop_get_default ();
         terminal->vt_change_closures = ply_list_new ();
         terminal->input_closures = ply_list_new ();
+        terminal->output = ply_buffer_new ();
 
         if (strncmp (device_name, "/dev/", strlen ("/dev/")) == 0)
                 terminal->name = strdup (device_name);
@@ -267,6 +290,9 @@ ply_terminal_set_unbuffered_input (ply_terminal_t *terminal)
 {
         struct termios term_attributes;
 
+        if (terminal->is_unbuffered && terminal->unbuffered_input_is_current)
+                return true;
+
         ply_terminal_unlock (terminal);
 
         tcgetattr (terminal->fd, &term_attributes);
@@ -290,10 +316,19 @@ ply_terminal_set_unbuffered_input (ply_terminal_t *terminal)
         ply_terminal_lock (terminal);
 
         terminal->is_unbuffered = true;
+        terminal->unbuffered_input_is_current = true;
 
         return true;
 }
 
+/* Makes the next mode and input changes go through to the tty again */
+static void
+ply_terminal_forget_tty_state (ply_terminal_t *terminal)
+{
+        terminal->mode_is_current = false;
+        terminal->unbuffered_input_is_current = false;
+}
+
 bool
 ply_terminal_set_buffered_input (ply_terminal_t *terminal)
 {
@@ -302,6 +337,8 @@ ply_terminal_set_buffered_input (ply_terminal_t *terminal)
         if (!terminal->is_unbuffered)
                 return true;
 
+        terminal->unbuffered_input_is_current = false;
+
         ply_terminal_unlock (terminal);
 
         tcgetattr (terminal->fd, &term_attributes);
@@ -345,19 +382,86 @@ ply_terminal_write (ply_terminal_t *terminal,
                     ...)
 {
         va_list args;
+        char stack_string[PLY_TERMINAL_MAX_STACK_STRING_SIZE];
         char *string;
         int size;
 
         assert (terminal != NULL);
         assert (format != NULL);
 
-        string = NULL;
+        string = stack_string;
         va_start (args, format);
-        size = vasprintf (&string, format, args);
+        size = vsnprintf (stack_string, sizeof(stack_string), format, args);
         va_end (args);
 
-        write (terminal->fd, string, size);
-        free (string);
+        if (size >= (int) sizeof(stack_string)) {
+                va_start (args, format);
+                size = vasprintf (&string, format, args);
+                va_end (args);
+        }
+
+        if (size > 0)
+                ply_terminal_write_bytes (terminal, string, size);
+
+        if (string != stack_string)
+                free (string);
+}
+
+/* Output is held until the event loop goes idle, or until something
+ * that draws a whole screen calls ply_terminal_flush, so it reaches the
+ * tty in as few writes as possible
+ */
+void
+ply_terminal_write_bytes (ply_terminal_t *terminal,
+                          const char     *bytes,
+                          size_t          number_of_bytes)
+{
+        assert (terminal != NULL);
+
+        if (terminal->fd < 0 || number_of_bytes == 0)
+                return;
+
+        ply_buffer_append_bytes (terminal->output, bytes, number_of_bytes);
+
+        if (terminal->loop == NULL ||
+            ply_buffer_get_size (terminal->output) >= PLY_TERMINAL_MAX_BUFFERED_OUTPUT) {
+                ply_terminal_flush (terminal);
+                return;
+        }
+
+        if (!terminal->flush_is_queued) {
+                ply_event_loop_watch_for_idle (terminal->loop,
+                                               (ply_event_loop_idle_handler_t)
+                                               ply_terminal_flush,
+                                               terminal);
+                terminal->flush_is_queued = true;
+        }
+}
+
+void
+ply_terminal_flush (ply_terminal_t *terminal)
+{
+        size_t size;
+
+        assert (terminal != NULL);
+
+        if (terminal->flush_is_queued) {
+                if (terminal->loop != NULL)
+                        ply_event_loop_stop_watching_for_idle (terminal->loop,
+                                                               (ply_event_loop_idle_handler_t)
+                                                               ply_terminal_flush,
+                                                               terminal);
+                terminal->flush_is_queued = false;
+        }
+
+        size = ply_buffer_get_size (terminal->output);
+        if (size == 0)
+                return;
+
+        if (terminal->fd >= 0)
+                ply_write (terminal->fd, ply_buffer_get_bytes (terminal->output), size);
+
+        ply_buffer_clear (terminal->output);
 }
 
 static void
@@ -446,6 +550,63 @@ ply_terminal_refresh_geometry (ply_terminal_t *terminal)
         return true;
 }
 
+/* Only serial lines send output at the speed set on them; virtual
+ * terminals and pseudo terminals just report a nominal one
+ */
+static void
+ply_terminal_look_up_output_speed (ply_terminal_t *terminal)
+{
+        static const struct
+        {
+                speed_t speed;
+                int     bits_per_second;
+        } speeds[] = {
+                { B1200,    1200    },
+                { B2400,    2400    },
+                { B4800,    4800    },
+                { B9600,    9600    },
+                { B19200,   19200   },
+                { B38400,   38400   },
+                { B57600,   57600   },
+                { B115200,  115200  },
+                { B230400,  230400  },
+                { B460800,  460800  },
+                { B921600,  921600  },
+                { B1000000, 1000000 },
+                { B1500000, 1500000 },
+                { B2000000, 2000000 },
+                { B3000000, 3000000 },
+                { B4000000, 4000000 },
+        };
+        struct serial_struct serial_info;
+        struct termios term_attributes;
+        speed_t speed;
+        size_t i;
+
+        terminal->output_bytes_per_second = 0;
+
+        if (ply_terminal_is_vt (terminal))
+                return;
+
+        if (ioctl (terminal->fd, TIOCGSERIAL, &serial_info) < 0)
+                return;
+
+        if (tcgetattr (terminal->fd, &term_attributes) < 0)
+                return;
+
+        speed = cfgetospeed (&term_attributes);
+        for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+                if (speeds[i].speed != speed)
+                        continue;
+
+                /* a start and a stop bit go with every byte */
+                terminal->output_bytes_per_second = speeds[i].bits_per_second / 10;
+                ply_trace ("terminal '%s' sends %d bytes a second",
+                           terminal->name, terminal->output_bytes_per_second);
+                break;
+        }
+}
+
 static void
 ply_terminal_check_for_vt (ply_terminal_t *terminal)
 {
@@ -509,6 +670,7 @@ on_leave_vt (ply_terminal_t *terminal)
 {
         ioctl (terminal->fd, VT_RELDISP, 1);
 
+        ply_terminal_forget_tty_state (terminal);
         terminal->is_active = false;
         do_active_vt_changed (terminal);
 }
@@ -518,6 +680,7 @@ on_enter_vt (ply_terminal_t *terminal)
 {
         ioctl (terminal->fd, VT_RELDISP, VT_ACKACQ);
 
+        ply_terminal_forget_tty_state (terminal);
         terminal->is_active = true;
         do_active_vt_changed (terminal);
 }
@@ -606,6 +769,7 @@ ply_terminal_open_device (ply_terminal_t *terminal)
         }
 
         ply_set_fd_as_blocking (terminal->fd);
+        ply_terminal_forget_tty_state (terminal);
 
         terminal->fd_watch = ply_event_loop_watch_fd (terminal->loop, terminal->fd,
                                                       PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
@@ -643,6 +807,7 @@ ply_terminal_open (ply_terminal_t *terminal)
         }
 
         ply_terminal_refresh_geometry (terminal);
+        ply_terminal_look_up_output_speed (terminal);
 
         ply_terminal_look_up_color_palette (terminal);
         ply_terminal_save_color_palette (terminal);
@@ -699,6 +864,7 @@ ply_terminal_close (ply_terminal_t *terminal)
                 return;
         }
 
+        ply_terminal_flush (terminal);
         terminal->is_open = false;
 
         ply_terminal_stop_watching_for_vt_changes (terminal);
@@ -722,6 +888,7 @@ ply_terminal_close (ply_terminal_t *terminal)
 
         close (terminal->fd);
         terminal->fd = -1;
+        ply_terminal_forget_tty_state (terminal);
 }
 
 int
@@ -736,6 +903,12 @@ ply_terminal_get_number_of_rows (ply_terminal_t *terminal)
         return terminal->number_of_rows;
 }
 
+int
+ply_terminal_get_output_bytes_per_second (ply_terminal_t *terminal)
+{
+        return terminal->output_bytes_per_second;
+}
+
 uint32_t
 ply_terminal_get_color_hex_value (ply_terminal_t      *terminal,
                                   ply_terminal_color_t color)
@@ -786,6 +959,9 @@ ply_terminal_set_mode (ply_terminal_t     *terminal,
         if (terminal->should_ignore_mode_changes)
                 return;
 
+        if (terminal->mode_is_current && terminal->mode == mode)
+                return;
+
         switch (mode) {
         case PLY_TERMINAL_MODE_TEXT:
                 if (ioctl (terminal->fd, KDSETMODE, KD_TEXT) < 0)
@@ -797,6 +973,9 @@ ply_terminal_set_mode (ply_terminal_t     *terminal,
                         return;
                 break;
         }
+
+        terminal->mode = mode;
+        terminal->mode_is_current = true;
 }
 
 void
@@ -813,6 +992,7 @@ static void
 ply_terminal_detach_from_event_loop (ply_terminal_t *terminal)
 {
         assert (terminal != NULL);
+        ply_terminal_flush (terminal);
         terminal->loop = NULL;
         terminal->fd_watch = NULL;
 }
@@ -877,6 +1057,8 @@ ply_terminal_free (ply_terminal_t *terminal)
         if (terminal->is_open)
                 ply_terminal_close (terminal);
 
+        ply_terminal_flush (terminal);
+        ply_buffer_free (terminal->output);
         free_vt_change_closures (terminal);
         free_input_closures (terminal);
         free (terminal->keymap);
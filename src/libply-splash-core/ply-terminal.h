@@ -75,9 +75,16 @@ __attribute__((__format__ (__printf__, 2, 3)))
 void ply_terminal_write (ply_terminal_t *terminal,
                          const char     *format,
                          ...);
+void ply_terminal_write_bytes (ply_terminal_t *terminal,
+                               const char     *bytes,
+                               size_t          number_of_bytes);
+void ply_terminal_flush (ply_terminal_t *terminal);
 int ply_terminal_get_number_of_columns (ply_terminal_t *terminal);
 int ply_terminal_get_number_of_rows (ply_terminal_t *terminal);
 
+/* How fast a serial line can take output, or 0 when nothing limits it */
+int ply_terminal_get_output_bytes_per_second (ply_terminal_t *terminal);
+
 bool ply_terminal_supports_color (ply_terminal_t *terminal);
 uint32_t ply_terminal_get_color_hex_value (ply_terminal_t      *terminal,
                                            ply_terminal_color_t color);
@@ -58,6 +58,26 @@
 #define MOVE_CURSOR_SEQUENCE "\033[%d;%df"
 #endif
 
+#ifndef MOVE_CURSOR_UP_SEQUENCE
+#define MOVE_CURSOR_UP_SEQUENCE "\033[%dA"
+#endif
+
+#ifndef MOVE_CURSOR_DOWN_SEQUENCE
+#define MOVE_CURSOR_DOWN_SEQUENCE "\033[%dB"
+#endif
+
+#ifndef MOVE_CURSOR_FORWARD_SEQUENCE
+#define MOVE_CURSOR_FORWARD_SEQUENCE "\033[%dC"
+#endif
+
+#ifndef MOVE_CURSOR_BACKWARD_SEQUENCE
+#define MOVE_CURSOR_BACKWARD_SEQUENCE "\033[%dD"
+#endif
+
+#ifndef CLEAR_TO_END_OF_LINE_SEQUENCE
+#define CLEAR_TO_END_OF_LINE_SEQUENCE "\033[K"
+#endif
+
 #ifndef HIDE_CURSOR_SEQUENCE
 #define HIDE_CURSOR_SEQUENCE "\033[?25l"
 #endif
@@ -90,6 +110,37 @@
 #define TEXT_PALETTE_SIZE 48
 #endif
 
+#ifndef MAX_STACK_STRING_SIZE
+#define MAX_STACK_STRING_SIZE 256
+#endif
+
+/* Skipping over this many unchanged cells by writing them again is no
+ * longer than the sequence that moves the cursor past them */
+#ifndef MAX_CELLS_TO_REWRITE
+#define MAX_CELLS_TO_REWRITE 3
+#endif
+
+/* How much of a slow serial line the splash may keep busy, leaving the
+ * rest for console messages */
+#ifndef OUTPUT_BUDGET_FRACTION
+#define OUTPUT_BUDGET_FRACTION 0.5
+#endif
+
+#define UNKNOWN_COLOR -1
+#define UNKNOWN_POSITION -1
+
+/* One character on the screen.  A length of 0 means nothing is known
+ * about it: in the shadow of what's on the terminal, it could be anything,
+ * and in what's been drawn, it's to be left as it is.
+ */
+typedef struct
+{
+        char                 text[4];
+        uint8_t              length;
+        ply_terminal_color_t foreground_color;
+        ply_terminal_color_t background_color;
+} ply_text_display_cell_t;
+
 struct _ply_text_display
 {
         ply_event_loop_t               *loop;
@@ -101,8 +152,37 @@ struct _ply_text_display
 
         ply_text_display_draw_handler_t draw_handler;
         void                           *draw_handler_user_data;
+
+        /* What's been drawn, and what the terminal is showing.  The
+         * difference goes out in one write once the loop goes idle, so
+         * slow consoles only get sent the cells that changed.
+         */
+        ply_text_display_cell_t        *cells;
+        ply_text_display_cell_t        *shown_cells;
+        int                             number_of_columns;
+        int                             number_of_rows;
+
+        int                             cursor_column;
+        int                             cursor_row;
+        int                             shown_cursor_column;
+        int                             shown_cursor_row;
+        int                             shown_foreground_color;
+        int                             shown_background_color;
+        ply_terminal_color_t            clear_background_color;
+        ply_buffer_t                   *output;
+        double                          next_flush_time;
+
+        uint32_t                        cursor_is_hidden : 1;
+        uint32_t                        cursor_visibility_is_set : 1;
+        uint32_t                        shown_cursor_is_hidden : 1;
+        uint32_t                        shown_cursor_visibility_is_known : 1;
+        uint32_t                        needs_clear : 1;
+        uint32_t                        flush_is_pending : 1;
+        uint32_t                        flush_is_waiting_for_budget : 1;
 };
 
+static void ply_text_display_flush (ply_text_display_t *display);
+
 ply_text_display_t *
 ply_text_display_new (ply_terminal_t *terminal)
 {
@@ -112,10 +192,445 @@ ply_text_display_new (ply_terminal_t *terminal)
 
         display->loop = NULL;
         display->terminal = terminal;
+        display->output = ply_buffer_new ();
+        display->shown_cursor_column = UNKNOWN_POSITION;
+        display->shown_cursor_row = UNKNOWN_POSITION;
+        display->shown_foreground_color = UNKNOWN_COLOR;
+        display->shown_background_color = UNKNOWN_COLOR;
 
         return display;
 }
 
+/* Forgets what the terminal is showing, and what's been drawn on it, for
+ * when something else has been written to it
+ */
+static void
+ply_text_display_forget_screen (ply_text_display_t *display)
+{
+        size_t size;
+
+        size = (size_t) display->number_of_columns * display->number_of_rows * sizeof(ply_text_display_cell_t);
+        memset (display->cells, 0, size);
+        memset (display->shown_cells, 0, size);
+
+        display->shown_cursor_column = UNKNOWN_POSITION;
+        display->shown_cursor_row = UNKNOWN_POSITION;
+        display->shown_foreground_color = UNKNOWN_COLOR;
+        display->shown_background_color = UNKNOWN_COLOR;
+        display->shown_cursor_visibility_is_known = false;
+        display->needs_clear = false;
+}
+
+/* Keeps the screen model the size of the terminal, and says whether
+ * there is one; before the terminal knows its size there isn't
+ */
+static bool
+ply_text_display_has_screen (ply_text_display_t *display)
+{
+        int number_of_columns, number_of_rows;
+
+        number_of_columns = ply_terminal_get_number_of_columns (display->terminal);
+        number_of_rows = ply_terminal_get_number_of_rows (display->terminal);
+
+        if (number_of_columns != display->number_of_columns ||
+            number_of_rows != display->number_of_rows) {
+                free (display->cells);
+                free (display->shown_cells);
+                display->cells = NULL;
+                display->shown_cells = NULL;
+                display->number_of_columns = 0;
+                display->number_of_rows = 0;
+
+                if (number_of_columns > 0 && number_of_rows > 0) {
+                        display->cells = calloc ((size_t) number_of_columns * number_of_rows,
+                                                 sizeof(ply_text_display_cell_t));
+                        display->shown_cells = calloc ((size_t) number_of_columns * number_of_rows,
+                                                       sizeof(ply_text_display_cell_t));
+                        display->number_of_columns = number_of_columns;
+                        display->number_of_rows = number_of_rows;
+                }
+
+                ply_text_display_forget_screen (display);
+                display->cursor_column = MIN (display->cursor_column, MAX (number_of_columns - 1, 0));
+                display->cursor_row = MIN (display->cursor_row, MAX (number_of_rows - 1, 0));
+        }
+
+        return display->cells != NULL;
+}
+
+static void
+on_output_budget_available (ply_text_display_t *display)
+{
+        ply_text_display_flush (display);
+}
+
+/* On a slow line, every update made before the last one has had time
+ * to go out gets folded into the next flush, so progress bars and
+ * animations update only as often as the line can keep up.
+ */
+static void
+ply_text_display_queue_flush (ply_text_display_t *display)
+{
+        double now;
+
+        if (display->flush_is_pending)
+                return;
+
+        display->flush_is_pending = true;
+
+        now = ply_get_timestamp ();
+        if (now < display->next_flush_time) {
+                display->flush_is_waiting_for_budget = true;
+                ply_event_loop_watch_for_timeout (ply_event_loop_get_default (),
+                                                  display->next_flush_time - now,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_output_budget_available,
+                                                  display);
+                return;
+        }
+
+        ply_event_loop_watch_for_idle (ply_event_loop_get_default (),
+                                       (ply_event_loop_idle_handler_t)
+                                       ply_text_display_flush,
+                                       display);
+}
+
+static ply_text_display_cell_t *
+ply_text_display_get_cell (ply_text_display_t *display,
+                           int                 column,
+                           int                 row)
+{
+        return &display->cells[row * display->number_of_columns + column];
+}
+
+static void
+ply_text_display_set_cell (ply_text_display_t *display,
+                           int                 column,
+                           int                 row,
+                           const char         *text,
+                           size_t              length)
+{
+        ply_text_display_cell_t *cell;
+
+        cell = ply_text_display_get_cell (display, column, row);
+        memcpy (cell->text, text, length);
+        cell->length = length;
+        cell->foreground_color = display->foreground_color;
+        cell->background_color = display->background_color;
+}
+
+/* Blanks from column to the end of the row, the way erasing does on a
+ * real terminal: in the current background color
+ */
+static void
+ply_text_display_erase_row (ply_text_display_t *display,
+                            int                 column,
+                            int                 row)
+{
+        for (; column < display->number_of_columns; column++) {
+                ply_text_display_set_cell (display, column, row, " ", 1);
+        }
+}
+
+/* The screen model doesn't scroll, so moving on from the last row stays
+ * on it; nothing drawn through the display goes that far down.  Running
+ * off the end of a row wraps onto the next, like it does on a terminal.
+ */
+static void
+ply_text_display_move_to_next_row (ply_text_display_t *display)
+{
+        display->cursor_column = 0;
+        display->cursor_row = MIN (display->cursor_row + 1, display->number_of_rows - 1);
+}
+
+static bool
+ply_text_display_cell_is_space (ply_text_display_cell_t *cell)
+{
+        return cell->length == 1 && cell->text[0] == ' ';
+}
+
+/* A space looks the same in any foreground color */
+static bool
+ply_text_display_cells_are_equal (ply_text_display_cell_t *cell,
+                                  ply_text_display_cell_t *other_cell)
+{
+        if (cell->length != other_cell->length)
+                return false;
+
+        if (cell->foreground_color != other_cell->foreground_color &&
+            !ply_text_display_cell_is_space (cell))
+                return false;
+
+        if (cell->background_color != other_cell->background_color)
+                return false;
+
+        return memcmp (cell->text, other_cell->text, cell->length) == 0;
+}
+
+static bool
+ply_text_display_cell_needs_update (ply_text_display_t *display,
+                                    int                 index)
+{
+        if (display->cells[index].length == 0)
+                return false;
+
+        return !ply_text_display_cells_are_equal (&display->cells[index],
+                                                  &display->shown_cells[index]);
+}
+
+static bool
+ply_text_display_cell_is_blank (ply_text_display_cell_t *cell,
+                                ply_terminal_color_t     background_color)
+{
+        return ply_text_display_cell_is_space (cell) &&
+               cell->background_color == background_color;
+}
+
+static ply_terminal_color_t
+ply_text_display_get_foreground_color_to_show (ply_text_display_t      *display,
+                                               ply_text_display_cell_t *cell)
+{
+        if (ply_text_display_cell_is_space (cell) &&
+            display->shown_foreground_color != UNKNOWN_COLOR)
+                return display->shown_foreground_color;
+
+        return cell->foreground_color;
+}
+
+static void
+ply_text_display_output_colors (ply_text_display_t  *display,
+                                ply_terminal_color_t foreground_color,
+                                ply_terminal_color_t background_color)
+{
+        if (display->shown_foreground_color != (int) foreground_color) {
+                ply_buffer_append (display->output,
+                                   COLOR_SEQUENCE_FORMAT,
+                                   FOREGROUND_COLOR_BASE + foreground_color);
+                display->shown_foreground_color = foreground_color;
+        }
+
+        if (display->shown_background_color != (int) background_color) {
+                ply_buffer_append (display->output,
+                                   COLOR_SEQUENCE_FORMAT,
+                                   BACKGROUND_COLOR_BASE + background_color);
+                display->shown_background_color = background_color;
+        }
+}
+
+static void
+ply_text_display_output_cursor_move (ply_text_display_t *display,
+                                     int                 column,
+                                     int                 row)
+{
+        int shown_column = display->shown_cursor_column;
+        int shown_row = display->shown_cursor_row;
+
+        if (shown_column == column && shown_row == row)
+                return;
+
+        if (shown_column == UNKNOWN_POSITION || shown_row == UNKNOWN_POSITION)
+                ply_buffer_append (display->output, MOVE_CURSOR_SEQUENCE, row + 1, column + 1);
+        else if (shown_row == row && column == 0)
+                ply_buffer_append (display->output, "\r");
+        else if (shown_row == row && column > shown_column)
+                ply_buffer_append (display->output, MOVE_CURSOR_FORWARD_SEQUENCE, column - shown_column);
+        else if (shown_row == row)
+                ply_buffer_append (display->output, MOVE_CURSOR_BACKWARD_SEQUENCE, shown_column - column);
+        else if (shown_column == column && row > shown_row)
+                ply_buffer_append (display->output, MOVE_CURSOR_DOWN_SEQUENCE, row - shown_row);
+        else if (shown_column == column)
+                ply_buffer_append (display->output, MOVE_CURSOR_UP_SEQUENCE, shown_row - row);
+        else
+                ply_buffer_append (display->output, MOVE_CURSOR_SEQUENCE, row + 1, column + 1);
+
+        display->shown_cursor_column = column;
+        display->shown_cursor_row = row;
+}
+
+static void
+ply_text_display_output_cell (ply_text_display_t *display,
+                              int                 column,
+                              int                 row)
+{
+        int index = row * display->number_of_columns + column;
+        ply_text_display_cell_t *cell = &display->cells[index];
+
+        ply_text_display_output_colors (display,
+                                        ply_text_display_get_foreground_color_to_show (display, cell),
+                                        cell->background_color);
+        ply_buffer_append_bytes (display->output, cell->text, cell->length);
+        display->shown_cells[index] = *cell;
+        display->shown_cells[index].foreground_color = display->shown_foreground_color;
+
+        /* Terminals differ over where the cursor goes after the last
+         * column, so don't guess */
+        if (column + 1 < display->number_of_columns)
+                display->shown_cursor_column = column + 1;
+        else
+                display->shown_cursor_column = UNKNOWN_POSITION;
+}
+
+/* Cells the cursor would have to skip over to get to column can be
+ * written out again instead, when that's shorter and they look the same
+ * in the colors the terminal is already set to.
+ */
+static bool
+ply_text_display_can_rewrite_up_to (ply_text_display_t *display,
+                                    int                 column,
+                                    int                 row)
+{
+        int index;
+
+        if (display->shown_cursor_row != row ||
+            display->shown_cursor_column == UNKNOWN_POSITION ||
+            display->shown_cursor_column > column ||
+            column - display->shown_cursor_column > MAX_CELLS_TO_REWRITE)
+                return false;
+
+        for (index = display->shown_cursor_column; index < column; index++) {
+                ply_text_display_cell_t *cell;
+
+                cell = &display->cells[row * display->number_of_columns + index];
+
+                if (cell->length == 0 ||
+                    !ply_text_display_cells_are_equal (cell, &display->shown_cells[row * display->number_of_columns + index]) ||
+                    (int) ply_text_display_get_foreground_color_to_show (display, cell) != display->shown_foreground_color ||
+                    (int) cell->background_color != display->shown_background_color)
+                        return false;
+        }
+
+        return true;
+}
+
+static void
+ply_text_display_output_row (ply_text_display_t *display,
+                             int                 row)
+{
+        int row_start = row * display->number_of_columns;
+        int column, tail_start, tail_changes;
+        ply_terminal_color_t tail_color;
+
+        /* A run of blanks to the end of the row goes out as one erase if
+         * enough of it changed */
+        tail_start = display->number_of_columns;
+        tail_changes = 0;
+        tail_color = display->cells[row_start + tail_start - 1].background_color;
+        while (tail_start > 0 &&
+               ply_text_display_cell_is_blank (&display->cells[row_start + tail_start - 1], tail_color)) {
+                tail_start--;
+                if (ply_text_display_cell_needs_update (display, row_start + tail_start))
+                        tail_changes++;
+        }
+
+        if (tail_changes <= (int) strlen (CLEAR_TO_END_OF_LINE_SEQUENCE))
+                tail_start = display->number_of_columns;
+
+        for (column = 0; column < tail_start; column++) {
+                if (!ply_text_display_cell_needs_update (display, row_start + column))
+                        continue;
+
+                if (ply_text_display_can_rewrite_up_to (display, column, row)) {
+                        while (display->shown_cursor_column < column) {
+                                ply_text_display_output_cell (display, display->shown_cursor_column, row);
+                        }
+                }
+
+                ply_text_display_output_cursor_move (display, column, row);
+                ply_text_display_output_cell (display, column, row);
+        }
+
+        if (tail_start == display->number_of_columns)
+                return;
+
+        while (!ply_text_display_cell_needs_update (display, row_start + tail_start)) {
+                tail_start++;
+        }
+
+        ply_text_display_output_cursor_move (display, tail_start, row);
+        ply_text_display_output_colors (display,
+                                        ply_text_display_get_foreground_color_to_show (display,
+                                                                                       &display->cells[row_start + tail_start]),
+                                        tail_color);
+        ply_buffer_append (display->output, CLEAR_TO_END_OF_LINE_SEQUENCE);
+        memcpy (&display->shown_cells[row_start + tail_start],
+                &display->cells[row_start + tail_start],
+                (display->number_of_columns - tail_start) * sizeof(ply_text_display_cell_t));
+}
+
+static void
+ply_text_display_flush (ply_text_display_t *display)
+{
+        int fd, row, bytes_per_second;
+        size_t size;
+
+        if (display->flush_is_waiting_for_budget) {
+                ply_event_loop_stop_watching_for_timeout (ply_event_loop_get_default (),
+                                                          (ply_event_loop_timeout_handler_t)
+                                                          on_output_budget_available,
+                                                          display);
+                display->flush_is_waiting_for_budget = false;
+        } else if (display->flush_is_pending) {
+                ply_event_loop_stop_watching_for_idle (ply_event_loop_get_default (),
+                                                       (ply_event_loop_idle_handler_t)
+                                                       ply_text_display_flush,
+                                                       display);
+        }
+        display->flush_is_pending = false;
+
+        if (!ply_text_display_has_screen (display))
+                return;
+
+        fd = ply_terminal_get_fd (display->terminal);
+        if (fd < 0) {
+                ply_text_display_forget_screen (display);
+                return;
+        }
+
+        /* clearing fills the screen with the current background color */
+        if (display->needs_clear) {
+                if (display->shown_background_color != (int) display->clear_background_color) {
+                        ply_buffer_append (display->output,
+                                           COLOR_SEQUENCE_FORMAT,
+                                           BACKGROUND_COLOR_BASE + display->clear_background_color);
+                        display->shown_background_color = display->clear_background_color;
+                }
+                ply_buffer_append (display->output, CLEAR_SCREEN_SEQUENCE);
+                display->needs_clear = false;
+        }
+
+        for (row = 0; row < display->number_of_rows; row++) {
+                ply_text_display_output_row (display, row);
+        }
+
+        if (!display->cursor_is_hidden)
+                ply_text_display_output_cursor_move (display,
+                                                     MIN (display->cursor_column, display->number_of_columns - 1),
+                                                     display->cursor_row);
+
+        if (display->cursor_visibility_is_set &&
+            (!display->shown_cursor_visibility_is_known ||
+             display->shown_cursor_is_hidden != display->cursor_is_hidden)) {
+                ply_buffer_append (display->output,
+                                   display->cursor_is_hidden ? HIDE_CURSOR_SEQUENCE : SHOW_CURSOR_SEQUENCE);
+                display->shown_cursor_is_hidden = display->cursor_is_hidden;
+                display->shown_cursor_visibility_is_known = true;
+        }
+
+        size = ply_buffer_get_size (display->output);
+        if (size == 0)
+                return;
+
+        /* along with anything written to the terminal before it, in one go */
+        ply_terminal_write_bytes (display->terminal, ply_buffer_get_bytes (display->output), size);
+        ply_terminal_flush (display->terminal);
+        ply_buffer_clear (display->output);
+
+        bytes_per_second = ply_terminal_get_output_bytes_per_second (display->terminal);
+        if (bytes_per_second > 0)
+                display->next_flush_time = ply_get_timestamp () +
+                                           size / (bytes_per_second * OUTPUT_BUDGET_FRACTION);
+}
+
 int
 ply_text_display_get_number_of_columns (ply_text_display_t *display)
 {
@@ -128,6 +643,10 @@ ply_text_display_get_number_of_rows (ply_text_display_t *display)
         return ply_terminal_get_number_of_rows (display->terminal);
 }
 
+/* Columns and rows have always gone straight into the terminal's own
+ * cursor sequence, which counts from 1, so 0 and 1 both mean the first.
+ * The screen model counts from 0.
+ */
 void
 ply_text_display_set_cursor_position (ply_text_display_t *display,
                                       int                 column,
@@ -142,19 +661,42 @@ ply_text_display_set_cursor_position (ply_text_display_t *display,
         column = CLAMP (column, 0, number_of_columns - 1);
         row = CLAMP (row, 0, number_of_rows - 1);
 
-        ply_terminal_write (display->terminal,
-                            MOVE_CURSOR_SEQUENCE,
-                            row, column);
+        if (!ply_text_display_has_screen (display)) {
+                ply_terminal_write (display->terminal,
+                                    MOVE_CURSOR_SEQUENCE,
+                                    row, column);
+                return;
+        }
+
+        display->cursor_column = MAX (column - 1, 0);
+        display->cursor_row = MAX (row - 1, 0);
+        ply_text_display_queue_flush (display);
 }
 
 void
 ply_text_display_clear_screen (ply_text_display_t *display)
 {
+        int row;
+
         if (ply_is_tracing_to_terminal ())
                 return;
 
-        ply_terminal_write (display->terminal,
-                            CLEAR_SCREEN_SEQUENCE);
+        if (!ply_text_display_has_screen (display)) {
+                ply_terminal_write (display->terminal,
+                                    CLEAR_SCREEN_SEQUENCE);
+
+                ply_text_display_set_cursor_position (display, 0, 0);
+                return;
+        }
+
+        /* Whatever was drawn before is gone, so it never needs sending */
+        for (row = 0; row < display->number_of_rows; row++) {
+                ply_text_display_erase_row (display, 0, row);
+        }
+        memcpy (display->shown_cells, display->cells,
+                (size_t) display->number_of_columns * display->number_of_rows * sizeof(ply_text_display_cell_t));
+        display->needs_clear = true;
+        display->clear_background_color = display->background_color;
 
         ply_text_display_set_cursor_position (display, 0, 0);
 }
@@ -162,24 +704,40 @@ ply_text_display_clear_screen (ply_text_display_t *display)
 void
 ply_text_display_clear_line (ply_text_display_t *display)
 {
-        ply_terminal_write (display->terminal,
-                            CLEAR_LINE_SEQUENCE);
+        if (!ply_text_display_has_screen (display)) {
+                ply_terminal_write (display->terminal,
+                                    CLEAR_LINE_SEQUENCE);
+                return;
+        }
+
+        ply_text_display_erase_row (display, 0, display->cursor_row);
+        ply_text_display_move_to_next_row (display);
+        ply_text_display_queue_flush (display);
 }
 
 void
 ply_text_display_remove_character (ply_text_display_t *display)
 {
-        ply_terminal_write (display->terminal,
-                            BACKSPACE);
+        if (!ply_text_display_has_screen (display)) {
+                ply_terminal_write (display->terminal,
+                                    BACKSPACE);
+                return;
+        }
+
+        display->cursor_column = MAX (MIN (display->cursor_column, display->number_of_columns - 1) - 1, 0);
+        ply_text_display_erase_row (display, display->cursor_column, display->cursor_row);
+        ply_text_display_queue_flush (display);
 }
 
+/* Colors only get sent along with the cells drawn in them */
 void
 ply_text_display_set_background_color (ply_text_display_t  *display,
                                        ply_terminal_color_t color)
 {
-        ply_terminal_write (display->terminal,
-                            COLOR_SEQUENCE_FORMAT,
-                            BACKGROUND_COLOR_BASE + color);
+        if (!ply_text_display_has_screen (display))
+                ply_terminal_write (display->terminal,
+                                    COLOR_SEQUENCE_FORMAT,
+                                    BACKGROUND_COLOR_BASE + color);
 
         display->background_color = color;
 }
@@ -188,9 +746,10 @@ void
 ply_text_display_set_foreground_color (ply_text_display_t  *display,
                                        ply_terminal_color_t color)
 {
-        ply_terminal_write (display->terminal,
-                            COLOR_SEQUENCE_FORMAT,
-                            FOREGROUND_COLOR_BASE + color);
+        if (!ply_text_display_has_screen (display))
+                ply_terminal_write (display->terminal,
+                                    COLOR_SEQUENCE_FORMAT,
+                                    FOREGROUND_COLOR_BASE + color);
 
         display->foreground_color = color;
 }
@@ -220,11 +779,100 @@ ply_text_display_draw_area (ply_text_display_t *display,
                                        x, y, width, height);
 }
 
+static void
+ply_text_display_set_cursor_is_hidden (ply_text_display_t *display,
+                                       bool                is_hidden)
+{
+        display->cursor_is_hidden = is_hidden;
+        display->cursor_visibility_is_set = true;
+        ply_text_display_queue_flush (display);
+}
+
 void
 ply_text_display_hide_cursor (ply_text_display_t *display)
 {
-        ply_terminal_write (display->terminal,
-                            HIDE_CURSOR_SEQUENCE);
+        ply_text_display_set_cursor_is_hidden (display, true);
+}
+
+/* Anything but text and the few control characters the screen model
+ * follows can't be tracked, so it gets written straight out
+ */
+static bool
+ply_text_display_can_model_string (const char *string)
+{
+        const unsigned char *character;
+
+        for (character = (const unsigned char *) string; *character != '\0'; character++) {
+                if (*character >= ' ' && *character != 0x7f)
+                        continue;
+
+                if (*character == '\n' || *character == '\r' || *character == '\b')
+                        continue;
+
+                return false;
+        }
+
+        return true;
+}
+
+static size_t
+ply_text_display_get_character_length (const char *string)
+{
+        unsigned char first_byte = string[0];
+        size_t length, i;
+
+        if ((first_byte & 0xe0) == 0xc0)
+                length = 2;
+        else if ((first_byte & 0xf0) == 0xe0)
+                length = 3;
+        else if ((first_byte & 0xf8) == 0xf0)
+                length = 4;
+        else
+                return 1;
+
+        for (i = 1; i < length; i++) {
+                if ((string[i] & 0xc0) != 0x80)
+                        return i;
+        }
+
+        return length;
+}
+
+static void
+ply_text_display_write_string (ply_text_display_t *display,
+                               const char         *string)
+{
+        while (*string != '\0') {
+                size_t length;
+
+                switch (*string) {
+                case '\n':
+                        ply_text_display_move_to_next_row (display);
+                        string++;
+                        continue;
+
+                case '\r':
+                        display->cursor_column = 0;
+                        string++;
+                        continue;
+
+                case '\b':
+                        display->cursor_column = MAX (MIN (display->cursor_column, display->number_of_columns - 1) - 1, 0);
+                        string++;
+                        continue;
+                }
+
+                if (display->cursor_column >= display->number_of_columns)
+                        ply_text_display_move_to_next_row (display);
+
+                length = ply_text_display_get_character_length (string);
+                ply_text_display_set_cell (display,
+                                           display->cursor_column,
+                                           display->cursor_row,
+                                           string, length);
+                display->cursor_column++;
+                string += length;
+        }
 }
 
 void
@@ -232,30 +880,50 @@ ply_text_display_write (ply_text_display_t *display,
                         const char         *format,
                         ...)
 {
-        int fd;
-
         va_list args;
+        char stack_string[MAX_STACK_STRING_SIZE];
         char *string;
+        int size;
 
         assert (display != NULL);
         assert (format != NULL);
 
-        fd = ply_terminal_get_fd (display->terminal);
-
-        string = NULL;
+        /* Plugins write a cell or a word at a time, which fits on the stack */
+        string = stack_string;
         va_start (args, format);
-        vasprintf (&string, format, args);
+        size = vsnprintf (stack_string, sizeof(stack_string), format, args);
         va_end (args);
 
-        write (fd, string, strlen (string));
-        free (string);
+        if (size >= (int) sizeof(stack_string)) {
+                va_start (args, format);
+                size = vasprintf (&string, format, args);
+                va_end (args);
+        }
+
+        if (size < 0)
+                return;
+
+        if (ply_text_display_has_screen (display) &&
+            ply_text_display_can_model_string (string)) {
+                ply_text_display_write_string (display, string);
+                ply_text_display_queue_flush (display);
+        } else {
+                if (ply_text_display_has_screen (display)) {
+                        ply_text_display_flush (display);
+                        ply_text_display_forget_screen (display);
+                }
+
+                ply_terminal_write_bytes (display->terminal, string, size);
+        }
+
+        if (string != stack_string)
+                free (string);
 }
 
 void
 ply_text_display_show_cursor (ply_text_display_t *display)
 {
-        ply_terminal_write (display->terminal,
-                            SHOW_CURSOR_SEQUENCE);
+        ply_text_display_set_cursor_is_hidden (display, false);
 }
 
 bool
@@ -284,6 +952,12 @@ ply_text_display_free (ply_text_display_t *display)
                                                        display);
         }
 
+        if (display->flush_is_pending)
+                ply_text_display_flush (display);
+
+        ply_buffer_free (display->output);
+        free (display->cells);
+        free (display->shown_cells);
         free (display);
 }
 
@@ -301,15 +975,23 @@ ply_text_display_set_draw_handler (ply_text_display_t             *display,
 void
 ply_text_display_pause_updates (ply_text_display_t *display)
 {
+        if (display->flush_is_pending)
+                ply_text_display_flush (display);
+
         ply_terminal_write (display->terminal,
                             PAUSE_SEQUENCE);
+        ply_terminal_flush (display->terminal);
 }
 
 void
 ply_text_display_unpause_updates (ply_text_display_t *display)
 {
+        if (display->flush_is_pending)
+                ply_text_display_flush (display);
+
         ply_terminal_write (display->terminal,
                             UNPAUSE_SEQUENCE);
+        ply_terminal_flush (display->terminal);
 }
 
 void
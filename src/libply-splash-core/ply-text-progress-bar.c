@@ -67,8 +67,20 @@ struct _ply_text_progress_bar
         int                 number_of_rows;
         int                 number_of_columns;
 
+        /* A row of spaces, made when shown, that each run of cells in
+         * one color gets written from in one go */
+        char               *spaces;
+
+        /* How many white, blue and brown cells are on the display, and
+         * the color of the os string, if it's there */
+        int                 drawn_white_cells;
+        int                 drawn_blue_cells;
+        int                 drawn_brown_cells;
+        int                 drawn_os_string_color;
+
         double              fraction_done;
         uint32_t            is_hidden : 1;
+        uint32_t            is_drawn : 1;
 };
 
 ply_text_progress_bar_t *
@@ -92,6 +104,7 @@ ply_text_progress_bar_free (ply_text_progress_bar_t *progress_bar)
         if (progress_bar == NULL)
                 return;
 
+        free (progress_bar->spaces);
         free (progress_bar);
 }
 
@@ -171,10 +184,26 @@ out:
                 os_string = strdup ("");
 }
 
+static void
+ply_text_progress_bar_write_cells (ply_text_progress_bar_t *progress_bar,
+                                   ply_terminal_color_t     color,
+                                   int                      number_of_cells)
+{
+        if (number_of_cells <= 0)
+                return;
+
+        ply_text_display_set_background_color (progress_bar->display, color);
+        ply_text_display_write (progress_bar->display, "%.*s",
+                                number_of_cells, progress_bar->spaces);
+}
+
+/* Only touches the display when a cell changes color, or the os string
+ * shows up or changes color */
 void
 ply_text_progress_bar_draw (ply_text_progress_bar_t *progress_bar)
 {
         int i, width;
+        int white_cells, blue_cells, brown_cells, os_string_color;
         double brown_fraction, blue_fraction, white_fraction;
 
         if (progress_bar->is_hidden)
@@ -182,46 +211,56 @@ ply_text_progress_bar_draw (ply_text_progress_bar_t *progress_bar)
 
         width = progress_bar->number_of_columns - 2 - strlen (os_string);
 
-        ply_text_display_set_cursor_position (progress_bar->display,
-                                              progress_bar->column,
-                                              progress_bar->row);
-
         brown_fraction = -(progress_bar->fraction_done * progress_bar->fraction_done) + 2 * progress_bar->fraction_done;
         blue_fraction = progress_bar->fraction_done;
         white_fraction = progress_bar->fraction_done * progress_bar->fraction_done;
 
+        white_cells = blue_cells = brown_cells = 0;
         for (i = 0; i < width; i++) {
                 double f;
 
                 f = (double) i / (double) width;
                 if (f < white_fraction)
-                        ply_text_display_set_background_color (progress_bar->display,
-                                                               PLY_TERMINAL_COLOR_WHITE);
+                        white_cells++;
                 else if (f < blue_fraction)
-                        ply_text_display_set_background_color (progress_bar->display,
-                                                               PLY_TERMINAL_COLOR_BLUE);
+                        blue_cells++;
                 else if (f < brown_fraction)
-                        ply_text_display_set_background_color (progress_bar->display,
-                                                               PLY_TERMINAL_COLOR_BROWN);
+                        brown_cells++;
                 else
                         break;
-
-                ply_text_display_write (progress_bar->display, "%c", ' ');
         }
 
-        ply_text_display_set_background_color (progress_bar->display,
-                                               PLY_TERMINAL_COLOR_BLACK);
-
+        os_string_color = -1;
         if (brown_fraction > 0.5) {
                 if (white_fraction > 0.875)
-                        ply_text_display_set_foreground_color (progress_bar->display,
-                                                               PLY_TERMINAL_COLOR_WHITE);
+                        os_string_color = PLY_TERMINAL_COLOR_WHITE;
                 else if (blue_fraction > 0.66)
-                        ply_text_display_set_foreground_color (progress_bar->display,
-                                                               PLY_TERMINAL_COLOR_BLUE);
+                        os_string_color = PLY_TERMINAL_COLOR_BLUE;
                 else
-                        ply_text_display_set_foreground_color (progress_bar->display,
-                                                               PLY_TERMINAL_COLOR_BROWN);
+                        os_string_color = PLY_TERMINAL_COLOR_BROWN;
+        }
+
+        if (progress_bar->is_drawn &&
+            white_cells == progress_bar->drawn_white_cells &&
+            blue_cells == progress_bar->drawn_blue_cells &&
+            brown_cells == progress_bar->drawn_brown_cells &&
+            os_string_color == progress_bar->drawn_os_string_color)
+                return;
+
+        ply_text_display_set_cursor_position (progress_bar->display,
+                                              progress_bar->column,
+                                              progress_bar->row);
+
+        ply_text_progress_bar_write_cells (progress_bar, PLY_TERMINAL_COLOR_WHITE, white_cells);
+        ply_text_progress_bar_write_cells (progress_bar, PLY_TERMINAL_COLOR_BLUE, blue_cells);
+        ply_text_progress_bar_write_cells (progress_bar, PLY_TERMINAL_COLOR_BROWN, brown_cells);
+
+        ply_text_display_set_background_color (progress_bar->display,
+                                               PLY_TERMINAL_COLOR_BLACK);
+
+        if (os_string_color >= 0) {
+                ply_text_display_set_foreground_color (progress_bar->display,
+                                                       os_string_color);
 
                 ply_text_display_set_cursor_position (progress_bar->display,
                                                       progress_bar->column + width,
@@ -232,6 +271,23 @@ ply_text_progress_bar_draw (ply_text_progress_bar_t *progress_bar)
                 ply_text_display_set_foreground_color (progress_bar->display,
                                                        PLY_TERMINAL_COLOR_DEFAULT);
         }
+
+        progress_bar->drawn_white_cells = white_cells;
+        progress_bar->drawn_blue_cells = blue_cells;
+        progress_bar->drawn_brown_cells = brown_cells;
+        progress_bar->drawn_os_string_color = os_string_color;
+        progress_bar->is_drawn = true;
+}
+
+void
+ply_text_progress_bar_redraw (ply_text_progress_bar_t *progress_bar)
+{
+        /* displays can ask for a redraw before the bar is shown on them */
+        if (progress_bar->display == NULL)
+                return;
+
+        progress_bar->is_drawn = false;
+        ply_text_progress_bar_draw (progress_bar);
 }
 
 void
@@ -249,9 +305,14 @@ ply_text_progress_bar_show (ply_text_progress_bar_t *progress_bar,
 
         get_os_string ();
 
+        free (progress_bar->spaces);
+        progress_bar->spaces = malloc (progress_bar->number_of_columns + 1);
+        memset (progress_bar->spaces, ' ', progress_bar->number_of_columns);
+        progress_bar->spaces[progress_bar->number_of_columns] = '\0';
+
         progress_bar->is_hidden = false;
 
-        ply_text_progress_bar_draw (progress_bar);
+        ply_text_progress_bar_redraw (progress_bar);
 }
 
 void
@@ -38,6 +38,7 @@ ply_text_progress_bar_t *ply_text_progress_bar_new (void);
 void ply_text_progress_bar_free (ply_text_progress_bar_t *progress_bar);
 
 void ply_text_progress_bar_draw (ply_text_progress_bar_t *progress_bar);
+void ply_text_progress_bar_redraw (ply_text_progress_bar_t *progress_bar);
 void ply_text_progress_bar_show (ply_text_progress_bar_t *progress_bar,
                                  ply_text_display_t      *display);
 void ply_text_progress_bar_hide (ply_text_progress_bar_t *progress_bar);
@@ -27,6 +27,10 @@
 
 #include "ply-text-display.h"
 #include "ply-text-step-bar.h"
+#include "ply-utils.h"
+
+/* U+25A0 BLACK SQUARE, and a space after it */
+#define STEP_CELL "\xe2\x96\xa0 "
 
 struct _ply_text_step_bar
 {
@@ -37,6 +41,11 @@ struct _ply_text_step_bar
         int                 number_of_rows;
         int                 number_of_columns;
 
+        /* All the steps, laid out once when shown, so that each run of
+         * them in one color goes out in one write */
+        char               *cells;
+        int                 drawn_step;
+
         double              fraction_done;
         uint32_t            is_hidden : 1;
 };
@@ -52,6 +61,7 @@ ply_text_step_bar_new (void)
         step_bar->column = 0;
         step_bar->number_of_columns = 0;
         step_bar->number_of_rows = 0;
+        step_bar->drawn_step = -1;
 
         return step_bar;
 }
@@ -62,18 +72,37 @@ ply_text_step_bar_free (ply_text_step_bar_t *step_bar)
         if (step_bar == NULL)
                 return;
 
+        free (step_bar->cells);
         free (step_bar);
 }
 
+static void
+ply_text_step_bar_write_steps (ply_text_step_bar_t *step_bar,
+                               int                  number_of_steps)
+{
+        if (number_of_steps <= 0)
+                return;
+
+        ply_text_display_write (step_bar->display, "%.*s",
+                                (int) (number_of_steps * strlen (STEP_CELL)),
+                                step_bar->cells);
+}
+
+/* Only touches the display when the lit up step moves */
 void
 ply_text_step_bar_draw (ply_text_step_bar_t *step_bar)
 {
-        int i;
         int cur;
 
         if (step_bar->is_hidden)
                 return;
 
+        cur = step_bar->fraction_done * step_bar->number_of_columns;
+        cur = CLAMP (cur, 0, step_bar->number_of_columns);
+
+        if (cur == step_bar->drawn_step)
+                return;
+
         ply_text_display_set_background_color (step_bar->display,
                                                PLY_TERMINAL_COLOR_BLACK);
 
@@ -81,22 +110,35 @@ ply_text_step_bar_draw (ply_text_step_bar_t *step_bar)
                                               step_bar->column,
                                               step_bar->row);
 
-        cur = step_bar->fraction_done * step_bar->number_of_columns;
-        for (i = 0; i < step_bar->number_of_columns; i++) {
-                if (i == cur)
-                        ply_text_display_set_foreground_color (step_bar->display,
-                                                               PLY_TERMINAL_COLOR_WHITE);
-                else
-                        ply_text_display_set_foreground_color (step_bar->display,
-                                                               PLY_TERMINAL_COLOR_BROWN);
-
-                /* U+25A0 BLACK SQUARE */
-                ply_text_display_write (step_bar->display, "%s", "\xe2\x96\xa0");
-                ply_text_display_write (step_bar->display, "%c", ' ');
+        ply_text_display_set_foreground_color (step_bar->display,
+                                               PLY_TERMINAL_COLOR_BROWN);
+        ply_text_step_bar_write_steps (step_bar, cur);
+
+        if (cur < step_bar->number_of_columns) {
+                ply_text_display_set_foreground_color (step_bar->display,
+                                                       PLY_TERMINAL_COLOR_WHITE);
+                ply_text_step_bar_write_steps (step_bar, 1);
+
+                ply_text_display_set_foreground_color (step_bar->display,
+                                                       PLY_TERMINAL_COLOR_BROWN);
+                ply_text_step_bar_write_steps (step_bar, step_bar->number_of_columns - cur - 1);
         }
 
         ply_text_display_set_foreground_color (step_bar->display,
                                                PLY_TERMINAL_COLOR_DEFAULT);
+
+        step_bar->drawn_step = cur;
+}
+
+void
+ply_text_step_bar_redraw (ply_text_step_bar_t *step_bar)
+{
+        /* displays can ask for a redraw before the bar is shown on them */
+        if (step_bar->display == NULL)
+                return;
+
+        step_bar->drawn_step = -1;
+        ply_text_step_bar_draw (step_bar);
 }
 
 void
@@ -119,9 +161,19 @@ ply_text_step_bar_show (ply_text_step_bar_t *step_bar,
         step_bar->number_of_columns = 3;
         step_bar->column = screen_cols / 2.0 - step_bar->number_of_columns / 2.0;
 
+        if (step_bar->cells == NULL) {
+                int i;
+
+                step_bar->cells = malloc (step_bar->number_of_columns * strlen (STEP_CELL) + 1);
+                step_bar->cells[0] = '\0';
+                for (i = 0; i < step_bar->number_of_columns; i++) {
+                        strcat (step_bar->cells, STEP_CELL);
+                }
+        }
+
         step_bar->is_hidden = false;
 
-        ply_text_step_bar_draw (step_bar);
+        ply_text_step_bar_redraw (step_bar);
 }
 
 void
@@ -32,6 +32,7 @@ ply_text_step_bar_t *ply_text_step_bar_new (void);
 void ply_text_step_bar_free (ply_text_step_bar_t *step_bar);
 
 void ply_text_step_bar_draw (ply_text_step_bar_t *step_bar);
+void ply_text_step_bar_redraw (ply_text_step_bar_t *step_bar);
 void ply_text_step_bar_show (ply_text_step_bar_t *step_bar,
                              ply_text_display_t  *display);
 void ply_text_step_bar_hide (ply_text_step_bar_t *step_bar);
@@ -42,9 +42,9 @@
 
 #include "ply-animation.h"
 #include "ply-event-loop.h"
-#include "ply-array.h"
+#include "ply-frame-clock.h"
+#include "ply-frame-cache.h"
 #include "ply-logger.h"
-#include "ply-image.h"
 #include "ply-pixel-buffer.h"
 #include "ply-utils.h"
 
@@ -56,20 +56,23 @@
 
 struct _ply_animation
 {
-        ply_array_t         *frames;
+        ply_frame_cache_t   *frames;
         ply_event_loop_t    *loop;
         char                *image_dir;
         char                *frames_prefix;
 
         ply_pixel_display_t *display;
+        ply_renderer_plane_t *plane;
         ply_trigger_t       *stop_trigger;
 
         int                  frame_number;
+        int                  drawn_frame_number; /* -1 when not on the display */
         long                 x, y;
         long                 width, height;
         double               start_time, previous_time, now;
         uint32_t             is_stopped : 1;
         uint32_t             stop_requested : 1;
+        uint32_t             is_streaming : 1;
 };
 
 static void ply_animation_stop_now (ply_animation_t *animation);
@@ -86,10 +89,11 @@ ply_animation_new (const char *image_dir,
 
         animation = calloc (1, sizeof(ply_animation_t));
 
-        animation->frames = ply_array_new (PLY_ARRAY_ELEMENT_TYPE_POINTER);
+        animation->frames = ply_frame_cache_new ();
         animation->frames_prefix = strdup (frames_prefix);
         animation->image_dir = strdup (image_dir);
         animation->frame_number = 0;
+        animation->drawn_frame_number = -1;
         animation->is_stopped = true;
         animation->stop_requested = false;
         animation->width = 0;
@@ -98,19 +102,6 @@ ply_animation_new (const char *image_dir,
         return animation;
 }
 
-static void
-ply_animation_remove_frames (ply_animation_t *animation)
-{
-        int i;
-        ply_pixel_buffer_t **frames;
-
-        frames = (ply_pixel_buffer_t **) ply_array_steal_pointer_elements (animation->frames);
-        for (i = 0; frames[i] != NULL; i++) {
-                ply_pixel_buffer_free (frames[i]);
-        }
-        free (frames);
-}
-
 void
 ply_animation_free (ply_animation_t *animation)
 {
@@ -120,24 +111,102 @@ ply_animation_free (ply_animation_t *animation)
         if (!animation->is_stopped)
                 ply_animation_stop_now (animation);
 
-        ply_animation_remove_frames (animation);
-        ply_array_free (animation->frames);
+        ply_frame_cache_free (animation->frames);
 
         free (animation->frames_prefix);
         free (animation->image_dir);
         free (animation);
 }
 
+static void
+show_frame (ply_animation_t    *animation,
+            ply_pixel_buffer_t *frame)
+{
+        if (animation->plane != NULL &&
+            !ply_pixel_display_show_image_on_plane (animation->display, animation->plane,
+                                                    frame,
+                                                    animation->x, animation->y)) {
+                ply_trace ("could not show animation frame on plane, drawing it instead");
+                ply_pixel_display_free_plane (animation->display, animation->plane);
+                animation->plane = NULL;
+        }
+
+        if (animation->plane == NULL) {
+                ply_rectangle_t changed_area;
+
+                ply_frame_cache_get_changed_area (animation->frames,
+                                                  animation->drawn_frame_number,
+                                                  animation->frame_number,
+                                                  &changed_area);
+                ply_pixel_display_draw_area (animation->display,
+                                             animation->x + changed_area.x,
+                                             animation->y + changed_area.y,
+                                             changed_area.width,
+                                             changed_area.height);
+                animation->drawn_frame_number = animation->frame_number;
+        }
+}
+
+/* Goes by the time, not by frames shown, so when a frame is decoded too
+ * late the ones that should have come up in the meantime get skipped
+ */
+static bool
+stream_at_time (ply_animation_t *animation,
+                double           time)
+{
+        int number_of_frames, due_frame_number;
+        ply_pixel_buffer_t *frame;
+
+        number_of_frames = ply_frame_cache_get_number_of_frames (animation->frames);
+
+        if (number_of_frames == 0)
+                return false;
+
+        if (animation->frame_number > number_of_frames - 1) {
+                ply_trace ("reached last frame of animation");
+                return false;
+        }
+
+        if (animation->stop_requested) {
+                ply_trace ("stopping animation in the middle of sequence");
+                return false;
+        }
+
+        due_frame_number = MIN ((int) (time * FRAMES_PER_SECOND), number_of_frames - 1);
+        if (animation->frame_number > due_frame_number)
+                return true;
+
+        frame = ply_frame_cache_get_frame_if_ready (animation->frames, animation->frame_number);
+        if (frame == NULL) {
+                if (ply_frame_cache_frame_is_pending (animation->frames, animation->frame_number))
+                        return true;
+
+                animation->frame_number = MAX (animation->frame_number, due_frame_number) + 1;
+                ply_frame_cache_prefetch_frame (animation->frames, animation->frame_number);
+                return true;
+        }
+
+        show_frame (animation, frame);
+
+        if (animation->frame_number < due_frame_number)
+                ply_trace ("decoding fell behind, dropping %d frames",
+                           due_frame_number - animation->frame_number);
+
+        animation->frame_number = due_frame_number + 1;
+        ply_frame_cache_prefetch_frame (animation->frames, animation->frame_number);
+
+        return true;
+}
+
 static bool
 animate_at_time (ply_animation_t *animation,
                  double           time)
 {
         int number_of_frames;
-        ply_pixel_buffer_t *const *frames;
-        ply_rectangle_t frame_area;
+        ply_pixel_buffer_t *frame;
         bool should_continue;
 
-        number_of_frames = ply_array_get_size (animation->frames);
+        number_of_frames = ply_frame_cache_get_number_of_frames (animation->frames);
 
         if (number_of_frames == 0)
                 return false;
@@ -154,13 +223,15 @@ animate_at_time (ply_animation_t *animation,
                 should_continue = false;
         }
 
-        frames = (ply_pixel_buffer_t *const *) ply_array_get_pointer_elements (animation->frames);
-        ply_pixel_buffer_get_size (frames[animation->frame_number], &frame_area);
+        frame = ply_frame_cache_get_frame (animation->frames, animation->frame_number);
+        if (frame == NULL) {
+                animation->frame_number++;
+                return should_continue;
+        }
 
-        ply_pixel_display_draw_area (animation->display,
-                                     animation->x, animation->y,
-                                     frame_area.width,
-                                     frame_area.height);
+        ply_frame_cache_prefetch_frame (animation->frames, animation->frame_number + 1);
+
+        show_frame (animation, frame);
 
         animation->frame_number++;
 
@@ -168,138 +239,109 @@ animate_at_time (ply_animation_t *animation,
 }
 
 static void
-on_timeout (ply_animation_t *animation)
+on_frame (ply_animation_t *animation)
 {
-        double sleep_time;
         bool should_continue;
 
         animation->previous_time = animation->now;
-        animation->now = ply_get_timestamp ();
-
-        should_continue = animate_at_time (animation,
-                                           animation->now - animation->start_time);
+        animation->now = ply_event_loop_get_frame_time (animation->loop);
 
-        sleep_time = 1.0 / FRAMES_PER_SECOND;
-        sleep_time = MAX (sleep_time - (ply_get_timestamp () - animation->now),
-                          0.005);
+        if (animation->is_streaming)
+                should_continue = stream_at_time (animation,
+                                                  animation->now - animation->start_time);
+        else
+                should_continue = animate_at_time (animation,
+                                                   animation->now - animation->start_time);
 
         if (!should_continue) {
+                ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                          (ply_frame_clock_handler_t)
+                                                          on_frame, animation);
                 if (animation->stop_trigger != NULL) {
                         ply_trace ("firing off stop trigger");
                         ply_trigger_pull (animation->stop_trigger, NULL);
                         animation->stop_trigger = NULL;
                 }
-        } else {
-                ply_event_loop_watch_for_timeout (animation->loop,
-                                                  sleep_time,
-                                                  (ply_event_loop_timeout_handler_t)
-                                                  on_timeout, animation);
         }
 }
 
-static bool
-ply_animation_add_frame (ply_animation_t *animation,
-                         const char      *filename)
+void
+ply_animation_set_prescale_frames (ply_animation_t *animation,
+                                   bool             should_prescale)
 {
-        ply_image_t *image;
-        ply_pixel_buffer_t *frame;
-
-        image = ply_image_new (filename);
-
-        if (!ply_image_load (image)) {
-                ply_image_free (image);
-                return false;
-        }
-
-        frame = ply_image_convert_to_pixel_buffer (image);
-
-        ply_array_add_pointer_element (animation->frames, frame);
-
-        animation->width = MAX (animation->width, (long) ply_pixel_buffer_get_width (frame));
-        animation->height = MAX (animation->height, (long) ply_pixel_buffer_get_height (frame));
-
-        return true;
+        ply_frame_cache_set_prescale_frames (animation->frames, should_prescale);
 }
 
-static bool
-ply_animation_add_frames (ply_animation_t *animation)
+void
+ply_animation_set_maximum_resident_frames (ply_animation_t *animation,
+                                           int              maximum_resident_frames)
 {
-        struct dirent **entries;
-        int number_of_entries;
-        int number_of_frames;
-        int i;
-        bool load_finished;
-
-        entries = NULL;
-
-        number_of_entries = scandir (animation->image_dir, &entries, NULL, versionsort);
-
-        if (number_of_entries <= 0)
-                return false;
-
-        load_finished = false;
-        for (i = 0; i < number_of_entries; i++) {
-                if (strncmp (entries[i]->d_name,
-                             animation->frames_prefix,
-                             strlen (animation->frames_prefix)) == 0
-                    && (strlen (entries[i]->d_name) > 4)
-                    && strcmp (entries[i]->d_name + strlen (entries[i]->d_name) - 4, ".png") == 0) {
-                        char *filename;
-
-                        filename = NULL;
-                        asprintf (&filename, "%s/%s", animation->image_dir, entries[i]->d_name);
-
-                        if (!ply_animation_add_frame (animation, filename))
-                                goto out;
-
-                        free (filename);
-                }
-
-                free (entries[i]);
-                entries[i] = NULL;
-        }
+        ply_frame_cache_clear (animation->frames);
+        ply_frame_cache_set_maximum_resident_frames (animation->frames,
+                                                     maximum_resident_frames);
+}
 
-        number_of_frames = ply_array_get_size (animation->frames);
-        if (number_of_frames == 0) {
-                ply_trace ("%s directory had no files starting with %s",
-                           animation->image_dir, animation->frames_prefix);
-                goto out;
-        } else {
-                ply_trace ("animation has %d frames", number_of_frames);
-        }
+void
+ply_animation_set_streaming (ply_animation_t *animation,
+                             bool             is_streaming)
+{
+        ply_frame_cache_clear (animation->frames);
+        ply_frame_cache_set_streaming (animation->frames, is_streaming);
+        animation->is_streaming = is_streaming;
+}
 
-        load_finished = true;
+void
+ply_animation_share_frames (ply_animation_t *animation,
+                            ply_animation_t *source)
+{
+        ply_frame_cache_t *frames;
 
-out:
-        if (!load_finished) {
-                ply_animation_remove_frames (animation);
+        frames = ply_frame_cache_ref (source->frames);
+        ply_frame_cache_free (animation->frames);
+        animation->frames = frames;
 
-                while (i < number_of_entries) {
-                        free (entries[i]);
-                        i++;
-                }
-        }
-        free (entries);
+        /* so reloading, say with fewer resident frames, gets the same ones */
+        free (animation->image_dir);
+        free (animation->frames_prefix);
+        animation->image_dir = strdup (source->image_dir);
+        animation->frames_prefix = strdup (source->frames_prefix);
 
-        return (ply_array_get_size (animation->frames) > 0);
+        animation->width = source->width;
+        animation->height = source->height;
+        animation->is_streaming = source->is_streaming;
 }
 
 bool
 ply_animation_load (ply_animation_t *animation)
 {
-        if (ply_array_get_size (animation->frames) != 0) {
-                ply_animation_remove_frames (animation);
+        if (ply_frame_cache_get_number_of_frames (animation->frames) != 0)
                 ply_trace ("reloading animation with new set of frames");
-        } else {
+        else
                 ply_trace ("loading frames for animation");
-        }
 
-        if (!ply_animation_add_frames (animation))
+        if (!ply_frame_cache_load (animation->frames,
+                                   animation->image_dir,
+                                   animation->frames_prefix))
                 return false;
 
+        ply_trace ("animation has %d frames",
+                   ply_frame_cache_get_number_of_frames (animation->frames));
+
+        animation->width = ply_frame_cache_get_width (animation->frames);
+        animation->height = ply_frame_cache_get_height (animation->frames);
+
         return true;
 }
 
+void
+ply_animation_drop_frames (ply_animation_t *animation)
+{
+        if (!animation->is_stopped)
+                return;
+
+        ply_frame_cache_drop_frames (animation->frames);
+}
+
 bool
 ply_animation_start (ply_animation_t     *animation,
                      ply_pixel_display_t *display,
@@ -323,12 +365,22 @@ ply_animation_start (ply_animation_t     *animation,
         animation->x = x;
         animation->y = y;
 
-        animation->start_time = ply_get_timestamp ();
+        animation->start_time = ply_event_loop_get_frame_time (animation->loop);
+        animation->drawn_frame_number = -1;
 
-        ply_event_loop_watch_for_timeout (animation->loop,
-                                          1.0 / FRAMES_PER_SECOND,
-                                          (ply_event_loop_timeout_handler_t)
-                                          on_timeout, animation);
+        animation->plane = ply_pixel_display_create_plane (display,
+                                                           animation->width,
+                                                           animation->height);
+        if (animation->plane != NULL)
+                ply_trace ("showing animation on a hardware plane");
+
+        if (animation->is_streaming)
+                ply_frame_cache_prefetch_frame (animation->frames, animation->frame_number);
+
+        ply_frame_clock_watch_for_frames (ply_frame_clock_get_default (),
+                                          FRAMES_PER_SECOND,
+                                          (ply_frame_clock_handler_t)
+                                          on_frame, animation);
 
         return true;
 }
@@ -341,12 +393,17 @@ ply_animation_stop_now (ply_animation_t *animation)
         ply_trace ("stopping animation now");
 
         if (animation->loop != NULL) {
-                ply_event_loop_stop_watching_for_timeout (animation->loop,
-                                                          (ply_event_loop_timeout_handler_t)
-                                                          on_timeout, animation);
+                ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                          (ply_frame_clock_handler_t)
+                                                          on_frame, animation);
                 animation->loop = NULL;
         }
 
+        if (animation->plane != NULL) {
+                ply_pixel_display_free_plane (animation->display, animation->plane);
+                animation->plane = NULL;
+        }
+
         animation->display = NULL;
 }
 
@@ -381,19 +438,33 @@ ply_animation_draw_area (ply_animation_t    *animation,
                          unsigned long       width,
                          unsigned long       height)
 {
-        ply_pixel_buffer_t *const *frames;
+        ply_pixel_buffer_t *frame;
         int number_of_frames;
         int frame_index;
 
-        if (animation->is_stopped)
+        if (animation->is_stopped || animation->plane != NULL)
+                return;
+
+        number_of_frames = ply_frame_cache_get_number_of_frames (animation->frames);
+        if (number_of_frames == 0)
                 return;
 
-        number_of_frames = ply_array_get_size (animation->frames);
-        frame_index = MIN (animation->frame_number, number_of_frames - 1);
+        /* The frame the display was told about, which frame_number has
+         * already moved past
+         */
+        if (animation->drawn_frame_number >= 0)
+                frame_index = animation->drawn_frame_number;
+        else if (animation->is_streaming)
+                return; /* nothing decoded to draw yet, and no waiting for it */
+        else
+                frame_index = MIN (animation->frame_number, number_of_frames - 1);
+
+        frame = ply_frame_cache_get_frame_for_device_scale (animation->frames, frame_index,
+                                                            ply_pixel_buffer_get_device_scale (buffer));
+        if (frame == NULL)
+                return;
 
-        frames = (ply_pixel_buffer_t *const *) ply_array_get_pointer_elements (animation->frames);
-        ply_pixel_buffer_fill_with_buffer (buffer,
-                                           frames[frame_index],
+        ply_pixel_buffer_fill_with_buffer (buffer, frame,
                                            animation->x, animation->y);
 }
 
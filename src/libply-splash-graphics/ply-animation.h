@@ -37,7 +37,33 @@ ply_animation_t *ply_animation_new (const char *image_dir,
                                     const char *frames_prefix);
 void ply_animation_free (ply_animation_t *animation);
 
+/* Decode frames as they are needed, keeping at most this many around,
+ * instead of all of them up front.  Takes effect on the next load.
+ */
+/* Scale frames up to the display's device scale once, the first time
+ * each one is drawn, instead of every time
+ */
+void ply_animation_set_prescale_frames (ply_animation_t *animation,
+                                        bool             should_prescale);
+void ply_animation_set_maximum_resident_frames (ply_animation_t *animation,
+                                                int              maximum_resident_frames);
+/* Plays the frames back from disk, with only the one being shown and
+ * the one after it in memory, the next one decoded on another thread.
+ * Frames that don't get decoded in time are skipped.  Takes effect on
+ * the next load.
+ */
+void ply_animation_set_streaming (ply_animation_t *animation,
+                                  bool             is_streaming);
 bool ply_animation_load (ply_animation_t *animation);
+/* Draws the frames another animation loaded instead of loading them
+ * again; use in place of ply_animation_load ()
+ */
+void ply_animation_share_frames (ply_animation_t *animation,
+                                 ply_animation_t *source);
+/* Frees the decoded frames while the animation isn't running; they get
+ * decoded again as they're drawn
+ */
+void ply_animation_drop_frames (ply_animation_t *animation);
 bool ply_animation_start (ply_animation_t     *animation,
                           ply_pixel_display_t *display,
                           ply_trigger_t       *stop_trigger,
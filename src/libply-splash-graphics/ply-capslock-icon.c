@@ -34,12 +34,6 @@
 #include "ply-image.h"
 #include "ply-utils.h"
 
-#include <linux/kd.h>
-
-#ifndef FRAMES_PER_SECOND
-#define FRAMES_PER_SECOND 30
-#endif
-
 struct _ply_capslock_icon
 {
         char                *image_name;
@@ -52,7 +46,7 @@ struct _ply_capslock_icon
         bool                 is_on;
 };
 
-static void ply_capslock_stop_polling (ply_capslock_icon_t *capslock_icon);
+static void ply_capslock_icon_stop_watching (ply_capslock_icon_t *capslock_icon);
 
 ply_capslock_icon_t *
 ply_capslock_icon_new (const char *image_dir)
@@ -76,7 +70,7 @@ ply_capslock_icon_free (ply_capslock_icon_t *capslock_icon)
                 return;
 
         if (!capslock_icon->is_hidden)
-                ply_capslock_stop_polling (capslock_icon);
+                ply_capslock_icon_stop_watching (capslock_icon);
 
         if (capslock_icon->buffer != NULL)
                 ply_pixel_buffer_free (capslock_icon->buffer);
@@ -85,18 +79,6 @@ ply_capslock_icon_free (ply_capslock_icon_t *capslock_icon)
         free (capslock_icon);
 }
 
-static void
-ply_capslock_icon_update_state (ply_capslock_icon_t *capslock_icon)
-{
-        ply_renderer_t *renderer;
-
-        if (!capslock_icon->display)
-                return;
-
-        renderer = ply_pixel_display_get_renderer (capslock_icon->display);
-        capslock_icon->is_on = ply_renderer_get_capslock_state (renderer);
-}
-
 static void
 ply_capslock_icon_draw (ply_capslock_icon_t *capslock_icon)
 {
@@ -106,29 +88,34 @@ ply_capslock_icon_draw (ply_capslock_icon_t *capslock_icon)
                                      capslock_icon->height);
 }
 
+/* The renderer only calls this when caps lock actually went on or off,
+ * so the icon area only gets damaged then, not on every redraw */
 static void
-on_timeout (void             *user_data,
-            ply_event_loop_t *loop)
+on_capslock_state_changed (ply_capslock_icon_t *capslock_icon,
+                           bool                 is_on,
+                           ply_renderer_t      *renderer)
 {
-        ply_capslock_icon_t *capslock_icon = user_data;
-        bool old_is_on = capslock_icon->is_on;
-
-        ply_capslock_icon_update_state (capslock_icon);
-        
-        if (capslock_icon->is_on != old_is_on)
-                ply_capslock_icon_draw (capslock_icon);
+        if (capslock_icon->is_on == is_on)
+                return;
 
-        ply_event_loop_watch_for_timeout (capslock_icon->loop,
-                                          1.0 / FRAMES_PER_SECOND,
-                                          on_timeout, capslock_icon);
+        capslock_icon->is_on = is_on;
+        ply_capslock_icon_draw (capslock_icon);
 }
 
 static void
-ply_capslock_stop_polling (ply_capslock_icon_t *capslock_icon)
+ply_capslock_icon_stop_watching (ply_capslock_icon_t *capslock_icon)
 {
-        ply_event_loop_stop_watching_for_timeout (capslock_icon->loop,
-                                                  (ply_event_loop_timeout_handler_t)
-                                                  on_timeout, capslock_icon);
+        ply_renderer_t *renderer;
+
+        renderer = ply_pixel_display_get_renderer (capslock_icon->display);
+
+        if (renderer == NULL)
+                return;
+
+        ply_renderer_stop_watching_for_capslock_state_change (renderer,
+                                                              (ply_renderer_capslock_state_changed_handler_t)
+                                                              on_capslock_state_changed,
+                                                              capslock_icon);
 }
 
 bool
@@ -160,6 +147,8 @@ ply_capslock_icon_show (ply_capslock_icon_t *capslock_icon,
                         long                 x,
                         long                 y)
 {
+        ply_renderer_t *renderer;
+
         assert (capslock_icon != NULL);
         assert (capslock_icon->loop == NULL);
 
@@ -175,11 +164,19 @@ ply_capslock_icon_show (ply_capslock_icon_t *capslock_icon,
         capslock_icon->x = x;
         capslock_icon->y = y;
 
-        ply_capslock_icon_draw (capslock_icon);
+        renderer = ply_pixel_display_get_renderer (display);
 
-        ply_event_loop_watch_for_timeout (capslock_icon->loop,
-                                          1.0 / FRAMES_PER_SECOND,
-                                          on_timeout, capslock_icon);
+        if (renderer != NULL) {
+                ply_renderer_watch_for_capslock_state_change (renderer,
+                                                              (ply_renderer_capslock_state_changed_handler_t)
+                                                              on_capslock_state_changed,
+                                                              capslock_icon);
+                capslock_icon->is_on = ply_renderer_get_capslock_state (renderer);
+        } else {
+                capslock_icon->is_on = false;
+        }
+
+        ply_capslock_icon_draw (capslock_icon);
 
         return true;
 }
@@ -193,7 +190,7 @@ ply_capslock_icon_hide (ply_capslock_icon_t *capslock_icon)
         capslock_icon->is_hidden = true;
 
         ply_capslock_icon_draw (capslock_icon);
-        ply_capslock_stop_polling (capslock_icon);
+        ply_capslock_icon_stop_watching (capslock_icon);
 
         capslock_icon->loop = NULL;
         capslock_icon->display = NULL;
@@ -210,8 +207,6 @@ ply_capslock_icon_draw_area (ply_capslock_icon_t *capslock_icon,
         if (capslock_icon->is_hidden)
                 return;
 
-        ply_capslock_icon_update_state (capslock_icon);
-        
         if (!capslock_icon->is_on)
                 return;
 
@@ -72,6 +72,7 @@ struct _ply_entry
 
         uint32_t             is_hidden : 1;
         uint32_t             is_password : 1;
+        uint32_t             bullet_row_is_opaque : 1;
 };
 
 ply_entry_t *
@@ -129,6 +130,67 @@ get_max_number_of_visible_bullets (ply_entry_t *entry)
         return (int) (text_field_width / bullet_width) - ((text_field_width % bullet_width) < (bullet_width / 2) ? 1 : 0);
 }
 
+static void
+get_bullet_row (ply_entry_t     *entry,
+                ply_rectangle_t *row)
+{
+        long bullet_height;
+
+        bullet_height = ply_image_get_height (entry->bullet_image);
+
+        row->x = entry->area.x;
+        row->y = entry->area.y + entry->area.height / 2.0 - bullet_height / 2.0;
+        row->width = entry->area.width;
+        row->height = bullet_height;
+}
+
+/* Cell number -1 is the sliver of half bullet shown at the left edge
+ * when there are more bullets than fit
+ */
+static void
+get_bullet_cell (ply_entry_t     *entry,
+                 int              cell,
+                 ply_rectangle_t *area)
+{
+        long bullet_width;
+
+        bullet_width = ply_image_get_width (entry->bullet_image);
+
+        get_bullet_row (entry, area);
+
+        if (cell < 0) {
+                area->width = (long) (entry->area.x + bullet_width / 2.0) - entry->area.x;
+                return;
+        }
+
+        area->x = entry->area.x + cell * bullet_width + bullet_width / 2.0;
+        area->width = bullet_width;
+}
+
+static bool
+text_field_is_opaque_behind_bullets (ply_entry_t *entry)
+{
+        ply_rectangle_t row;
+        uint32_t *data;
+        long x, y, top;
+
+        data = ply_image_get_data (entry->text_field_image);
+        get_bullet_row (entry, &row);
+        top = row.y - entry->area.y;
+
+        if (top < 0 || top + (long) row.height > (long) entry->area.height)
+                return false;
+
+        for (y = top; y < top + (long) row.height; y++) {
+                for (x = 0; x < (long) entry->area.width; x++) {
+                        if ((data[y * entry->area.width + x] >> 24) != 0xff)
+                                return false;
+                }
+        }
+
+        return true;
+}
+
 bool
 ply_entry_load (ply_entry_t *entry)
 {
@@ -142,6 +204,7 @@ ply_entry_load (ply_entry_t *entry)
         entry->area.height = ply_image_get_height (entry->text_field_image);
 
         entry->max_number_of_visible_bullets = get_max_number_of_visible_bullets (entry);
+        entry->bullet_row_is_opaque = text_field_is_opaque_behind_bullets (entry);
 
         return true;
 }
@@ -156,6 +219,59 @@ ply_entry_draw (ply_entry_t *entry)
                                      entry->area.height);
 }
 
+static void
+ply_entry_draw_changed_bullets (ply_entry_t *entry,
+                                int          old_count,
+                                int          new_count)
+{
+        ply_rectangle_t first_cell, last_cell;
+        int old_visible, new_visible;
+        bool old_overflows, new_overflows;
+
+        old_visible = MIN (old_count, entry->max_number_of_visible_bullets);
+        new_visible = MIN (new_count, entry->max_number_of_visible_bullets);
+        old_overflows = old_count > entry->max_number_of_visible_bullets;
+        new_overflows = new_count > entry->max_number_of_visible_bullets;
+
+        if (old_visible == new_visible && old_overflows == new_overflows)
+                return;
+
+        if (old_overflows != new_overflows)
+                get_bullet_cell (entry, -1, &first_cell);
+        else
+                get_bullet_cell (entry, MIN (old_visible, new_visible), &first_cell);
+
+        if (old_visible != new_visible)
+                get_bullet_cell (entry, MAX (old_visible, new_visible) - 1, &last_cell);
+        else
+                last_cell = first_cell;
+
+        ply_pixel_display_draw_area (entry->display,
+                                     first_cell.x,
+                                     first_cell.y,
+                                     last_cell.x + last_cell.width - first_cell.x,
+                                     first_cell.height);
+}
+
+bool
+ply_entry_is_covering_area (ply_entry_t  *entry,
+                            long          x,
+                            long          y,
+                            unsigned long width,
+                            unsigned long height)
+{
+        ply_rectangle_t row;
+
+        if (entry->is_hidden || !entry->is_password || !entry->bullet_row_is_opaque)
+                return false;
+
+        get_bullet_row (entry, &row);
+
+        return x >= row.x && y >= row.y &&
+               x + (long) width <= row.x + (long) row.width &&
+               y + (long) height <= row.y + (long) row.height;
+}
+
 void
 ply_entry_draw_area (ply_entry_t        *entry,
                      ply_pixel_buffer_t *pixel_buffer,
@@ -228,7 +344,17 @@ ply_entry_draw_area (ply_entry_t        *entry,
 void
 ply_entry_set_bullet_count (ply_entry_t *entry, int count)
 {
+        int old_count;
+
         count = MAX (0, count);
+
+        if (entry->is_password && !entry->is_hidden) {
+                old_count = entry->number_of_bullets;
+                entry->number_of_bullets = count;
+                ply_entry_draw_changed_bullets (entry, old_count, count);
+                return;
+        }
+
         if (!entry->is_password || entry->number_of_bullets != count) {
                 entry->is_password = true;
                 entry->number_of_bullets = count;
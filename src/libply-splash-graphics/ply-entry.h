@@ -51,6 +51,15 @@ void ply_entry_draw_area (ply_entry_t        *entry,
                           unsigned long       height);
 bool ply_entry_is_hidden (ply_entry_t *entry);
 
+/* True when drawing the entry alone fully repaints the given area, so
+ * whatever is behind it (the background, a dialog box) can be skipped
+ */
+bool ply_entry_is_covering_area (ply_entry_t  *entry,
+                                 long          x,
+                                 long          y,
+                                 unsigned long width,
+                                 unsigned long height);
+
 long ply_entry_get_width (ply_entry_t *entry);
 long ply_entry_get_height (ply_entry_t *entry);
 
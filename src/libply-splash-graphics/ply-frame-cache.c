@@ -0,0 +1,888 @@
+/* ply-frame-cache.c - animation frames, decoded up front or on demand
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-frame-cache.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-array.h"
+#include "ply-event-loop.h"
+#include "ply-image.h"
+#include "ply-logger.h"
+#include "ply-utils.h"
+
+/* One frame to show and one decoded ahead of it */
+#define MIN_RESIDENT_FRAMES 2
+
+/* Device scales above this get their frames scaled while drawing */
+#define MAX_PRESCALED_DEVICE_SCALE 4
+
+typedef struct
+{
+        char               *filename;
+        ply_pixel_buffer_t *buffer;
+        uint64_t            last_use;
+
+        /* What differs from the frame before it, known once both frames
+         * have been decoded at the same time
+         */
+        ply_rectangle_t     changed_area;
+        uint32_t            has_changed_area : 1;
+
+        /* Scaled up copies for displays with device scales 2 and up */
+        ply_pixel_buffer_t *scaled_buffers[MAX_PRESCALED_DEVICE_SCALE - 1];
+} ply_frame_cache_frame_t;
+
+/* Finishes decoding one frame at a time off the event loop's thread,
+ * for streaming caches.  Everything but image_is_decoded only changes
+ * on the event loop's thread while nothing is being decoded.
+ */
+typedef struct
+{
+        pthread_t       thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t  condition;
+
+        ply_image_t    *image;
+        int             frame_number; /* -1 when idle */
+        uint32_t        image_is_decoded : 1;
+        uint32_t        image_did_decode : 1;
+        uint32_t        should_exit : 1;
+} ply_frame_cache_decoder_t;
+
+struct _ply_frame_cache
+{
+        ply_frame_cache_frame_t *frames;
+        int                      number_of_frames;
+        int                      number_of_resident_frames;
+        int                      maximum_resident_frames; /* 0 for no limit */
+
+        uint64_t                 use_count;
+        long                     width, height;
+        int                      reference_count;
+
+        int                      frame_to_prefetch;
+        uint32_t                 prefetch_is_queued : 1;
+        uint32_t                 should_prescale : 1;
+        uint32_t                 is_streaming : 1;
+
+        ply_frame_cache_decoder_t *decoder;
+};
+
+ply_frame_cache_t *
+ply_frame_cache_new (void)
+{
+        ply_frame_cache_t *cache;
+
+        cache = calloc (1, sizeof(ply_frame_cache_t));
+        cache->frame_to_prefetch = -1;
+        cache->reference_count = 1;
+
+        return cache;
+}
+
+ply_frame_cache_t *
+ply_frame_cache_ref (ply_frame_cache_t *cache)
+{
+        cache->reference_count++;
+
+        return cache;
+}
+
+void
+ply_frame_cache_free (ply_frame_cache_t *cache)
+{
+        if (cache == NULL)
+                return;
+
+        if (--cache->reference_count > 0)
+                return;
+
+        ply_frame_cache_clear (cache);
+        free (cache);
+}
+
+void
+ply_frame_cache_set_maximum_resident_frames (ply_frame_cache_t *cache,
+                                             int                maximum_resident_frames)
+{
+        assert (cache->number_of_frames == 0);
+
+        if (cache->is_streaming)
+                return;
+
+        if (maximum_resident_frames > 0)
+                maximum_resident_frames = MAX (maximum_resident_frames, MIN_RESIDENT_FRAMES);
+        else
+                maximum_resident_frames = 0;
+
+        cache->maximum_resident_frames = maximum_resident_frames;
+}
+
+void
+ply_frame_cache_set_prescale_frames (ply_frame_cache_t *cache,
+                                     bool               should_prescale)
+{
+        cache->should_prescale = should_prescale;
+}
+
+void
+ply_frame_cache_set_streaming (ply_frame_cache_t *cache,
+                               bool               is_streaming)
+{
+        assert (cache->number_of_frames == 0);
+
+        cache->is_streaming = is_streaming;
+        cache->maximum_resident_frames = is_streaming ? MIN_RESIDENT_FRAMES : 0;
+}
+
+static void *
+ply_frame_cache_decoder_run (ply_frame_cache_decoder_t *decoder)
+{
+        pthread_mutex_lock (&decoder->mutex);
+        while (!decoder->should_exit) {
+                bool did_decode;
+
+                if (decoder->frame_number < 0 || decoder->image_is_decoded) {
+                        pthread_cond_wait (&decoder->condition, &decoder->mutex);
+                        continue;
+                }
+
+                pthread_mutex_unlock (&decoder->mutex);
+                did_decode = ply_image_finish_load (decoder->image);
+                pthread_mutex_lock (&decoder->mutex);
+
+                decoder->image_did_decode = did_decode;
+                decoder->image_is_decoded = true;
+        }
+        pthread_mutex_unlock (&decoder->mutex);
+
+        return NULL;
+}
+
+static ply_frame_cache_decoder_t *
+ply_frame_cache_decoder_new (void)
+{
+        ply_frame_cache_decoder_t *decoder;
+
+        decoder = calloc (1, sizeof(ply_frame_cache_decoder_t));
+        decoder->frame_number = -1;
+        pthread_mutex_init (&decoder->mutex, NULL);
+        pthread_cond_init (&decoder->condition, NULL);
+
+        if (pthread_create (&decoder->thread, NULL,
+                            (void *(*)(void *))ply_frame_cache_decoder_run, decoder) != 0) {
+                ply_trace ("could not start thread to decode frames on: %m");
+                pthread_cond_destroy (&decoder->condition);
+                pthread_mutex_destroy (&decoder->mutex);
+                free (decoder);
+                return NULL;
+        }
+
+        return decoder;
+}
+
+static void
+ply_frame_cache_decoder_free (ply_frame_cache_decoder_t *decoder)
+{
+        if (decoder == NULL)
+                return;
+
+        pthread_mutex_lock (&decoder->mutex);
+        decoder->should_exit = true;
+        pthread_cond_signal (&decoder->condition);
+        pthread_mutex_unlock (&decoder->mutex);
+
+        pthread_join (decoder->thread, NULL);
+
+        ply_image_free (decoder->image);
+        pthread_cond_destroy (&decoder->condition);
+        pthread_mutex_destroy (&decoder->mutex);
+        free (decoder);
+}
+
+static bool
+ply_frame_cache_decoder_is_busy (ply_frame_cache_decoder_t *decoder)
+{
+        bool is_busy;
+
+        pthread_mutex_lock (&decoder->mutex);
+        is_busy = decoder->frame_number >= 0 && !decoder->image_is_decoded;
+        pthread_mutex_unlock (&decoder->mutex);
+
+        return is_busy;
+}
+
+/* Takes the decoded image, if it's for frame_number and done */
+static ply_image_t *
+ply_frame_cache_decoder_take_image (ply_frame_cache_decoder_t *decoder,
+                                    int                        frame_number,
+                                    bool                      *did_decode)
+{
+        ply_image_t *image = NULL;
+
+        pthread_mutex_lock (&decoder->mutex);
+        if (decoder->frame_number == frame_number && decoder->image_is_decoded) {
+                image = decoder->image;
+                *did_decode = decoder->image_did_decode;
+
+                decoder->image = NULL;
+                decoder->frame_number = -1;
+                decoder->image_is_decoded = false;
+        }
+        pthread_mutex_unlock (&decoder->mutex);
+
+        return image;
+}
+
+/* Starts decoding a frame, unless another one is still being decoded.
+ * A decoded frame nobody took gets thrown away for it.
+ */
+static void
+ply_frame_cache_decoder_start (ply_frame_cache_decoder_t *decoder,
+                               const char                *filename,
+                               int                        frame_number)
+{
+        ply_image_t *image;
+
+        if (ply_frame_cache_decoder_is_busy (decoder))
+                return;
+
+        pthread_mutex_lock (&decoder->mutex);
+        if (decoder->frame_number == frame_number) {
+                pthread_mutex_unlock (&decoder->mutex);
+                return;
+        }
+
+        ply_image_free (decoder->image);
+        decoder->image = NULL;
+        decoder->frame_number = -1;
+        decoder->image_is_decoded = false;
+        pthread_mutex_unlock (&decoder->mutex);
+
+        image = ply_image_new (filename);
+        if (!ply_image_start_load (image)) {
+                ply_trace ("could not decode frame %s", filename);
+                ply_image_free (image);
+                image = NULL;
+        }
+
+        pthread_mutex_lock (&decoder->mutex);
+        decoder->image = image;
+        decoder->frame_number = frame_number;
+
+        /* a frame that couldn't even be started is done, and failed */
+        decoder->image_is_decoded = image == NULL;
+        decoder->image_did_decode = false;
+        pthread_cond_signal (&decoder->condition);
+        pthread_mutex_unlock (&decoder->mutex);
+}
+
+static void
+ply_frame_cache_frame_drop_buffers (ply_frame_cache_frame_t *frame)
+{
+        int i;
+
+        ply_pixel_buffer_free (frame->buffer);
+        frame->buffer = NULL;
+
+        for (i = 0; i < MAX_PRESCALED_DEVICE_SCALE - 1; i++) {
+                ply_pixel_buffer_free (frame->scaled_buffers[i]);
+                frame->scaled_buffers[i] = NULL;
+        }
+}
+
+static void
+on_prefetch (ply_frame_cache_t *cache)
+{
+        int frame_number;
+
+        cache->prefetch_is_queued = false;
+
+        frame_number = cache->frame_to_prefetch;
+        cache->frame_to_prefetch = -1;
+
+        if (frame_number < 0 || frame_number >= cache->number_of_frames)
+                return;
+
+        ply_frame_cache_get_frame (cache, frame_number);
+}
+
+void
+ply_frame_cache_clear (ply_frame_cache_t *cache)
+{
+        int i;
+
+        if (cache->prefetch_is_queued) {
+                ply_event_loop_stop_watching_for_idle (ply_event_loop_get_default (),
+                                                       (ply_event_loop_idle_handler_t)
+                                                       on_prefetch, cache);
+                cache->prefetch_is_queued = false;
+        }
+        cache->frame_to_prefetch = -1;
+
+        ply_frame_cache_decoder_free (cache->decoder);
+        cache->decoder = NULL;
+
+        for (i = 0; i < cache->number_of_frames; i++) {
+                ply_frame_cache_frame_drop_buffers (&cache->frames[i]);
+                free (cache->frames[i].filename);
+        }
+        free (cache->frames);
+
+        cache->frames = NULL;
+        cache->number_of_frames = 0;
+        cache->number_of_resident_frames = 0;
+        cache->width = 0;
+        cache->height = 0;
+}
+
+void
+ply_frame_cache_drop_frames (ply_frame_cache_t *cache)
+{
+        int i;
+
+        if (cache->number_of_resident_frames == 0)
+                return;
+
+        if (cache->prefetch_is_queued) {
+                ply_event_loop_stop_watching_for_idle (ply_event_loop_get_default (),
+                                                       (ply_event_loop_idle_handler_t)
+                                                       on_prefetch, cache);
+                cache->prefetch_is_queued = false;
+        }
+        cache->frame_to_prefetch = -1;
+
+        for (i = 0; i < cache->number_of_frames; i++)
+                ply_frame_cache_frame_drop_buffers (&cache->frames[i]);
+
+        cache->number_of_resident_frames = 0;
+}
+
+static void
+ply_frame_cache_add_frame (ply_frame_cache_t  *cache,
+                           const char         *filename,
+                           ply_pixel_buffer_t *buffer,
+                           long                width,
+                           long                height)
+{
+        ply_frame_cache_frame_t *frame;
+
+        frame = &cache->frames[cache->number_of_frames++];
+        frame->filename = strdup (filename);
+        frame->buffer = buffer;
+        frame->last_use = 0;
+
+        if (buffer != NULL)
+                cache->number_of_resident_frames++;
+
+        cache->width = MAX (cache->width, width);
+        cache->height = MAX (cache->height, height);
+}
+
+static void
+find_changed_area (ply_pixel_buffer_t *previous_buffer,
+                   ply_pixel_buffer_t *buffer,
+                   ply_rectangle_t    *area)
+{
+        unsigned long width, height, x, y, left, right, top, bottom;
+        uint32_t *previous_bytes, *bytes;
+
+        width = ply_pixel_buffer_get_width (buffer);
+        height = ply_pixel_buffer_get_height (buffer);
+
+        area->x = 0;
+        area->y = 0;
+
+        if (width != ply_pixel_buffer_get_width (previous_buffer) ||
+            height != ply_pixel_buffer_get_height (previous_buffer)) {
+                area->width = MAX (width, ply_pixel_buffer_get_width (previous_buffer));
+                area->height = MAX (height, ply_pixel_buffer_get_height (previous_buffer));
+                return;
+        }
+
+        previous_bytes = ply_pixel_buffer_get_argb32_data (previous_buffer);
+        bytes = ply_pixel_buffer_get_argb32_data (buffer);
+
+        left = width;
+        right = 0;
+        top = height;
+        bottom = 0;
+        for (y = 0; y < height; y++) {
+                uint32_t *previous_row = previous_bytes + y * width;
+                uint32_t *row = bytes + y * width;
+
+                if (memcmp (previous_row, row, width * sizeof(uint32_t)) == 0)
+                        continue;
+
+                for (x = 0; x < left && previous_row[x] == row[x]; x++);
+                left = MIN (left, x);
+
+                for (x = width; x > right && previous_row[x - 1] == row[x - 1]; x--);
+                right = MAX (right, x);
+
+                top = MIN (top, y);
+                bottom = y + 1;
+        }
+
+        if (top >= bottom) {
+                area->width = 0;
+                area->height = 0;
+                return;
+        }
+
+        area->x = left;
+        area->y = top;
+        area->width = right - left;
+        area->height = bottom - top;
+}
+
+/* Compares the frame to the one before it, if both are decoded and
+ * haven't been compared before.  The first frame follows the last one.
+ */
+static void
+ply_frame_cache_update_changed_area (ply_frame_cache_t *cache,
+                                     int                frame_number)
+{
+        ply_frame_cache_frame_t *frame, *previous_frame;
+
+        frame = &cache->frames[frame_number];
+        previous_frame = &cache->frames[(frame_number + cache->number_of_frames - 1) %
+                                        cache->number_of_frames];
+
+        if (frame->has_changed_area ||
+            frame->buffer == NULL || previous_frame->buffer == NULL)
+                return;
+
+        find_changed_area (previous_frame->buffer, frame->buffer, &frame->changed_area);
+        frame->has_changed_area = true;
+}
+
+bool
+ply_frame_cache_load (ply_frame_cache_t *cache,
+                      const char        *image_dir,
+                      const char        *frames_prefix)
+{
+        struct dirent **entries;
+        ply_array_t *filename_array;
+        char **filenames;
+        ply_image_t **images;
+        int number_of_entries;
+        int number_of_images;
+        int i;
+        bool load_finished;
+
+        ply_frame_cache_clear (cache);
+
+        entries = NULL;
+
+        number_of_entries = scandir (image_dir, &entries, NULL, versionsort);
+
+        if (number_of_entries <= 0)
+                return false;
+
+        filename_array = ply_array_new (PLY_ARRAY_ELEMENT_TYPE_POINTER);
+        for (i = 0; i < number_of_entries; i++) {
+                if (strncmp (entries[i]->d_name,
+                             frames_prefix,
+                             strlen (frames_prefix)) == 0
+                    && (strlen (entries[i]->d_name) > 4)
+                    && strcmp (entries[i]->d_name + strlen (entries[i]->d_name) - 4, ".png") == 0) {
+                        char *filename;
+
+                        filename = NULL;
+                        asprintf (&filename, "%s/%s", image_dir, entries[i]->d_name);
+
+                        ply_array_add_pointer_element (filename_array, filename);
+                }
+
+                free (entries[i]);
+        }
+        free (entries);
+
+        number_of_images = ply_array_get_size (filename_array);
+        filenames = (char **) ply_array_steal_pointer_elements (filename_array);
+        ply_array_free (filename_array);
+
+        if (number_of_images == 0) {
+                ply_trace ("%s directory had no files starting with %s",
+                           image_dir, frames_prefix);
+                free (filenames);
+                return false;
+        }
+
+        images = calloc (number_of_images, sizeof(ply_image_t *));
+        for (i = 0; i < number_of_images; i++) {
+                images[i] = ply_image_new (filenames[i]);
+        }
+
+        if (cache->maximum_resident_frames == 0) {
+                /* Decode all the frames at once so they can be spread over
+                 * the worker pool
+                 */
+                load_finished = ply_image_load_images (images, number_of_images);
+        } else {
+                ply_trace ("decoding up to %d of %d frames on demand",
+                           cache->maximum_resident_frames, number_of_images);
+
+                load_finished = true;
+                for (i = 0; i < number_of_images; i++) {
+                        long width, height;
+
+                        if (!ply_image_peek_size (images[i], &width, &height)) {
+                                load_finished = false;
+                                break;
+                        }
+
+                        cache->width = MAX (cache->width, width);
+                        cache->height = MAX (cache->height, height);
+                }
+        }
+
+        if (load_finished)
+                cache->frames = calloc (number_of_images, sizeof(ply_frame_cache_frame_t));
+
+        for (i = 0; i < number_of_images; i++) {
+                if (load_finished && cache->maximum_resident_frames == 0) {
+                        ply_pixel_buffer_t *buffer;
+
+                        buffer = ply_image_convert_to_pixel_buffer (images[i]);
+                        ply_pixel_buffer_set_owner (buffer, "animation");
+                        ply_frame_cache_add_frame (cache, filenames[i], buffer,
+                                                   ply_pixel_buffer_get_width (buffer),
+                                                   ply_pixel_buffer_get_height (buffer));
+                } else {
+                        if (load_finished)
+                                ply_frame_cache_add_frame (cache, filenames[i], NULL, 0, 0);
+
+                        ply_image_free (images[i]);
+                }
+                free (filenames[i]);
+        }
+        free (images);
+        free (filenames);
+
+        if (!load_finished) {
+                cache->width = 0;
+                cache->height = 0;
+        }
+
+        for (i = 0; i < cache->number_of_frames; i++) {
+                ply_frame_cache_update_changed_area (cache, i);
+        }
+
+        if (load_finished && cache->is_streaming) {
+                cache->decoder = ply_frame_cache_decoder_new ();
+                if (cache->decoder != NULL)
+                        ply_trace ("streaming %d frames", cache->number_of_frames);
+        }
+
+        return load_finished;
+}
+
+int
+ply_frame_cache_get_number_of_frames (ply_frame_cache_t *cache)
+{
+        return cache->number_of_frames;
+}
+
+long
+ply_frame_cache_get_width (ply_frame_cache_t *cache)
+{
+        return cache->width;
+}
+
+long
+ply_frame_cache_get_height (ply_frame_cache_t *cache)
+{
+        return cache->height;
+}
+
+static void
+ply_frame_cache_drop_least_recently_used_frame (ply_frame_cache_t *cache,
+                                                int                frame_to_keep)
+{
+        ply_frame_cache_frame_t *least_recently_used = NULL;
+        int i;
+
+        for (i = 0; i < cache->number_of_frames; i++) {
+                ply_frame_cache_frame_t *frame = &cache->frames[i];
+
+                if (frame->buffer == NULL || i == frame_to_keep)
+                        continue;
+
+                if (least_recently_used == NULL ||
+                    frame->last_use < least_recently_used->last_use)
+                        least_recently_used = frame;
+        }
+
+        if (least_recently_used == NULL)
+                return;
+
+        ply_frame_cache_frame_drop_buffers (least_recently_used);
+        cache->number_of_resident_frames--;
+}
+
+ply_pixel_buffer_t *
+ply_frame_cache_get_frame (ply_frame_cache_t *cache,
+                           int                frame_number)
+{
+        ply_frame_cache_frame_t *frame;
+
+        assert (frame_number >= 0 && frame_number < cache->number_of_frames);
+
+        frame = &cache->frames[frame_number];
+        frame->last_use = ++cache->use_count;
+
+        if (frame->buffer == NULL) {
+                ply_image_t *image;
+
+                image = ply_image_new (frame->filename);
+                if (!ply_image_load (image)) {
+                        ply_trace ("could not decode frame %s", frame->filename);
+                        ply_image_free (image);
+                        return NULL;
+                }
+
+                while (cache->maximum_resident_frames > 0 &&
+                       cache->number_of_resident_frames >= cache->maximum_resident_frames) {
+                        int resident_frames = cache->number_of_resident_frames;
+
+                        ply_frame_cache_drop_least_recently_used_frame (cache, frame_number);
+                        if (cache->number_of_resident_frames == resident_frames)
+                                break;
+                }
+
+                frame->buffer = ply_image_convert_to_pixel_buffer (image);
+                ply_pixel_buffer_set_owner (frame->buffer, "animation");
+                ply_pixel_buffer_encode_runs (frame->buffer);
+                cache->number_of_resident_frames++;
+
+                ply_frame_cache_update_changed_area (cache, frame_number);
+                ply_frame_cache_update_changed_area (cache, (frame_number + 1) %
+                                                     cache->number_of_frames);
+        }
+
+        return frame->buffer;
+}
+
+ply_pixel_buffer_t *
+ply_frame_cache_get_frame_if_ready (ply_frame_cache_t *cache,
+                                    int                frame_number)
+{
+        ply_frame_cache_frame_t *frame;
+        ply_image_t *image;
+        bool did_decode = false;
+
+        assert (frame_number >= 0 && frame_number < cache->number_of_frames);
+
+        frame = &cache->frames[frame_number];
+
+        if (cache->decoder == NULL || frame->buffer != NULL)
+                return ply_frame_cache_get_frame (cache, frame_number);
+
+        image = ply_frame_cache_decoder_take_image (cache->decoder, frame_number, &did_decode);
+        if (image == NULL) {
+                ply_frame_cache_decoder_start (cache->decoder, frame->filename, frame_number);
+                return NULL;
+        }
+
+        if (!did_decode) {
+                ply_trace ("could not decode frame %s", frame->filename);
+                ply_image_free (image);
+                return NULL;
+        }
+
+        frame->buffer = ply_image_convert_to_pixel_buffer (image);
+        ply_pixel_buffer_set_owner (frame->buffer, "animation");
+        ply_pixel_buffer_encode_runs (frame->buffer);
+        frame->last_use = ++cache->use_count;
+        cache->number_of_resident_frames++;
+
+        ply_frame_cache_update_changed_area (cache, frame_number);
+
+        /* The frame this replaces on screen isn't needed anymore, which
+         * leaves room for decoding the one after it.  Animations sharing
+         * the cache may each still be showing one, though.
+         */
+        while (cache->number_of_resident_frames > cache->reference_count) {
+                int resident_frames = cache->number_of_resident_frames;
+
+                ply_frame_cache_drop_least_recently_used_frame (cache, frame_number);
+                if (cache->number_of_resident_frames == resident_frames)
+                        break;
+        }
+
+        return frame->buffer;
+}
+
+bool
+ply_frame_cache_frame_is_pending (ply_frame_cache_t *cache,
+                                  int                frame_number)
+{
+        bool is_pending;
+
+        if (cache->decoder == NULL)
+                return false;
+
+        pthread_mutex_lock (&cache->decoder->mutex);
+        is_pending = cache->decoder->frame_number == frame_number ||
+                     (cache->decoder->frame_number >= 0 && !cache->decoder->image_is_decoded);
+        pthread_mutex_unlock (&cache->decoder->mutex);
+
+        return is_pending;
+}
+
+ply_pixel_buffer_t *
+ply_frame_cache_get_frame_for_device_scale (ply_frame_cache_t *cache,
+                                            int                frame_number,
+                                            int                device_scale)
+{
+        ply_frame_cache_frame_t *frame;
+        ply_pixel_buffer_t *buffer, **scaled_buffer;
+
+        buffer = ply_frame_cache_get_frame (cache, frame_number);
+
+        if (buffer == NULL || !cache->should_prescale || cache->is_streaming ||
+            device_scale < 2 || device_scale > MAX_PRESCALED_DEVICE_SCALE ||
+            ply_pixel_buffer_get_device_scale (buffer) != 1)
+                return buffer;
+
+        frame = &cache->frames[frame_number];
+        scaled_buffer = &frame->scaled_buffers[device_scale - 2];
+
+        /* Drawn the same way it would be drawn onto the display, just
+         * once, so later draws are a plain blend
+         */
+        if (*scaled_buffer == NULL) {
+                *scaled_buffer = ply_pixel_buffer_new (ply_pixel_buffer_get_width (buffer) * device_scale,
+                                                       ply_pixel_buffer_get_height (buffer) * device_scale);
+                ply_pixel_buffer_set_owner (*scaled_buffer, "animation");
+                ply_pixel_buffer_set_device_scale (*scaled_buffer, device_scale);
+                ply_pixel_buffer_fill_with_buffer (*scaled_buffer, buffer, 0, 0);
+                ply_pixel_buffer_set_opaque (*scaled_buffer,
+                                             ply_pixel_buffer_is_opaque (buffer));
+                ply_pixel_buffer_encode_runs (*scaled_buffer);
+        }
+
+        return *scaled_buffer;
+}
+
+static void
+add_to_area (ply_rectangle_t *area,
+             ply_rectangle_t *other_area)
+{
+        long right, bottom;
+
+        if (ply_rectangle_is_empty (other_area))
+                return;
+
+        if (ply_rectangle_is_empty (area)) {
+                *area = *other_area;
+                return;
+        }
+
+        right = MAX (area->x + (long) area->width, other_area->x + (long) other_area->width);
+        bottom = MAX (area->y + (long) area->height, other_area->y + (long) other_area->height);
+        area->x = MIN (area->x, other_area->x);
+        area->y = MIN (area->y, other_area->y);
+        area->width = right - area->x;
+        area->height = bottom - area->y;
+}
+
+void
+ply_frame_cache_get_changed_area (ply_frame_cache_t *cache,
+                                  int                from_frame_number,
+                                  int                to_frame_number,
+                                  ply_rectangle_t   *area)
+{
+        int frame_number;
+
+        assert (to_frame_number >= 0 && to_frame_number < cache->number_of_frames);
+
+        area->x = 0;
+        area->y = 0;
+        area->width = 0;
+        area->height = 0;
+
+        if (from_frame_number < 0 || from_frame_number >= cache->number_of_frames) {
+                area->width = cache->width;
+                area->height = cache->height;
+                return;
+        }
+
+        frame_number = from_frame_number;
+        while (frame_number != to_frame_number) {
+                ply_frame_cache_frame_t *frame;
+
+                frame_number = (frame_number + 1) % cache->number_of_frames;
+                frame = &cache->frames[frame_number];
+
+                if (!frame->has_changed_area) {
+                        area->x = 0;
+                        area->y = 0;
+                        area->width = cache->width;
+                        area->height = cache->height;
+                        return;
+                }
+
+                add_to_area (area, &frame->changed_area);
+        }
+}
+
+void
+ply_frame_cache_prefetch_frame (ply_frame_cache_t *cache,
+                                int                frame_number)
+{
+        if (cache->maximum_resident_frames == 0)
+                return;
+
+        if (frame_number < 0 || frame_number >= cache->number_of_frames)
+                return;
+
+        if (cache->frames[frame_number].buffer != NULL)
+                return;
+
+        if (cache->decoder != NULL) {
+                ply_frame_cache_decoder_start (cache->decoder,
+                                               cache->frames[frame_number].filename,
+                                               frame_number);
+                return;
+        }
+
+        cache->frame_to_prefetch = frame_number;
+
+        if (cache->prefetch_is_queued)
+                return;
+
+        cache->prefetch_is_queued = true;
+        ply_event_loop_watch_for_idle (ply_event_loop_get_default (),
+                                       (ply_event_loop_idle_handler_t)
+                                       on_prefetch, cache);
+}
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,124 @@
+/* ply-frame-cache.h - animation frames, decoded up front or on demand
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_FRAME_CACHE_H
+#define PLY_FRAME_CACHE_H
+
+#include <stdbool.h>
+
+#include "ply-pixel-buffer.h"
+
+typedef struct _ply_frame_cache ply_frame_cache_t;
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+ply_frame_cache_t *ply_frame_cache_new (void);
+/* Lets more than one animation draw from the same frames; free drops a
+ * reference, and the frames go with the last one
+ */
+ply_frame_cache_t *ply_frame_cache_ref (ply_frame_cache_t *cache);
+void ply_frame_cache_free (ply_frame_cache_t *cache);
+
+/* By default every frame gets decoded when the cache is loaded and stays
+ * in memory.  With a limit set, loading only reads the frame sizes, and
+ * frames get decoded the first time they are asked for.  The frames
+ * used least recently are dropped to stay under the limit.
+ * Must be called before ply_frame_cache_load ().
+ */
+void ply_frame_cache_set_maximum_resident_frames (ply_frame_cache_t *cache,
+                                                  int                maximum_resident_frames);
+
+/* Keeps no more than the frame being shown and the one after it, which
+ * gets decoded ahead on a thread of its own as the frames are played
+ * back with ply_frame_cache_get_frame_if_ready () and prefetching.  For
+ * machines that can't spare memory for more, so frames don't get
+ * prescaled either.  Must be called before ply_frame_cache_load (), and
+ * replaces any resident frame limit.
+ */
+void ply_frame_cache_set_streaming (ply_frame_cache_t *cache,
+                                    bool               is_streaming);
+
+/* Keeps a copy of each frame scaled up for every device scale it gets
+ * drawn at, trading memory for not interpolating on each draw
+ */
+void ply_frame_cache_set_prescale_frames (ply_frame_cache_t *cache,
+                                          bool               should_prescale);
+
+/* Loads every png in image_dir starting with frames_prefix, in version
+ * sort order, replacing whatever frames were loaded before
+ */
+bool ply_frame_cache_load (ply_frame_cache_t *cache,
+                           const char        *image_dir,
+                           const char        *frames_prefix);
+void ply_frame_cache_clear (ply_frame_cache_t *cache);
+/* Frees every decoded frame but remembers where they came from, so
+ * each gets decoded again whenever it's next asked for
+ */
+void ply_frame_cache_drop_frames (ply_frame_cache_t *cache);
+
+int ply_frame_cache_get_number_of_frames (ply_frame_cache_t *cache);
+long ply_frame_cache_get_width (ply_frame_cache_t *cache);
+long ply_frame_cache_get_height (ply_frame_cache_t *cache);
+
+/* Returns NULL if the frame could not be decoded.  The buffer belongs to
+ * the cache and may get dropped on the next call; take a reference to
+ * keep it longer.
+ */
+ply_pixel_buffer_t *ply_frame_cache_get_frame (ply_frame_cache_t *cache,
+                                               int                frame_number);
+
+/* Like ply_frame_cache_get_frame (), but never waits for a streaming
+ * cache to decode the frame.  Returns NULL if it isn't decoded yet, and
+ * starts decoding it when nothing else is.  Frames other than the one
+ * returned get dropped.
+ */
+ply_pixel_buffer_t *ply_frame_cache_get_frame_if_ready (ply_frame_cache_t *cache,
+                                                        int                frame_number);
+/* Whether a NULL from ply_frame_cache_get_frame_if_ready () means the
+ * frame is still on its way, rather than that it couldn't be decoded
+ */
+bool ply_frame_cache_frame_is_pending (ply_frame_cache_t *cache,
+                                       int                frame_number);
+
+/* Like ply_frame_cache_get_frame (), but scaled up to device_scale if
+ * prescaling is on
+ */
+ply_pixel_buffer_t *ply_frame_cache_get_frame_for_device_scale (ply_frame_cache_t *cache,
+                                                                int                frame_number,
+                                                                int                device_scale);
+
+/* Finds the part of the frames that changes going from one frame to
+ * another, stepping forward and wrapping around after the last.  Frames
+ * are compared as they get decoded; the whole frame size comes back when
+ * from_frame_number is -1 or the frames on the way weren't compared.
+ */
+void ply_frame_cache_get_changed_area (ply_frame_cache_t *cache,
+                                       int                from_frame_number,
+                                       int                to_frame_number,
+                                       ply_rectangle_t   *area);
+
+/* Decodes the frame from an idle handler, or the decoding thread of a
+ * streaming cache, so it is ready by the time it gets asked for.  Does
+ * nothing unless a limit is set.
+ */
+void ply_frame_cache_prefetch_frame (ply_frame_cache_t *cache,
+                                     int                frame_number);
+#endif
+
+#endif /* PLY_FRAME_CACHE_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
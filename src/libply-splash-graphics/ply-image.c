@@ -47,12 +47,31 @@
 
 #include <linux/fb.h>
 
+#include "ply-list.h"
+#include "ply-probes.h"
+#include "ply-statistics.h"
 #include "ply-utils.h"
+#include "ply-worker-pool.h"
+
+/* The contents of an image file, mapped into memory and read from
+ * there instead of through stdio
+ */
+typedef struct
+{
+        uint8_t *data;
+        size_t   size;
+        size_t   offset;
+} ply_image_file_t;
 
 struct _ply_image
 {
         char               *filename;
         ply_pixel_buffer_t *buffer;
+
+        /* Set between reading a PNG's header and decoding its pixels */
+        ply_image_file_t    file;
+        png_struct         *png;
+        png_info           *info;
 };
 
 struct bmp_file_header {
@@ -78,6 +97,104 @@ struct bmp_dib_header {
 
 const uint8_t png_header[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
 
+/* Set will_read_all when the whole file is going to be read right
+ * away, to fault all its pages in with one call
+ */
+static bool
+ply_image_file_open (ply_image_file_t *file,
+                     const char       *filename,
+                     struct stat      *file_info,
+                     bool              will_read_all)
+{
+        void *data;
+        int flags;
+        int fd;
+
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return false;
+
+        if (fstat (fd, file_info) < 0 || file_info->st_size <= 0) {
+                close (fd);
+                return false;
+        }
+
+        flags = MAP_PRIVATE;
+        if (will_read_all)
+                flags |= MAP_POPULATE;
+
+        data = mmap (NULL, file_info->st_size, PROT_READ, flags, fd, 0);
+        close (fd);
+
+        if (data == MAP_FAILED)
+                return false;
+
+        file->data = data;
+        file->size = file_info->st_size;
+        file->offset = 0;
+
+        return true;
+}
+
+static void
+ply_image_file_close (ply_image_file_t *file)
+{
+        if (file->data == NULL)
+                return;
+
+        munmap (file->data, file->size);
+        file->data = NULL;
+        file->size = 0;
+        file->offset = 0;
+}
+
+static void
+read_png_data (png_struct *png,
+               png_byte   *data,
+               png_size_t  length)
+{
+        ply_image_file_t *file;
+
+        file = png_get_io_ptr (png);
+
+        if (length > file->size - file->offset)
+                png_error (png, "unexpected end of file");
+
+        memcpy (data, file->data + file->offset, length);
+        file->offset += length;
+}
+
+/* An image can have its decoded pixels saved next to it, in a file named
+ * after it with PLY_IMAGE_CACHE_SUFFIX appended.  The pixels follow the
+ * header as premultiplied argb32, in the byte order of the machine that
+ * wrote them, so loading is just mapping the file.  The source file's
+ * size and modification time are recorded to tell when it went stale.
+ */
+#define PLY_IMAGE_CACHE_SUFFIX ".cache"
+#define PLY_IMAGE_CACHE_VERSION 1
+#define PLY_IMAGE_CACHE_IS_OPAQUE (1 << 0)
+
+typedef struct
+{
+        char     magic[8];
+        uint32_t version; /* also reads wrong if the byte order differs */
+        uint32_t flags;
+        uint32_t width;
+        uint32_t height;
+
+        /* Bounding box of the pixels that aren't fully transparent */
+        uint32_t content_x;
+        uint32_t content_y;
+        uint32_t content_width;
+        uint32_t content_height;
+
+        uint64_t source_size;
+        int64_t  source_mtime_seconds;
+        int64_t  source_mtime_nanoseconds;
+} ply_image_cache_header_t;
+
+static const char image_cache_magic[8] = { 'P', 'L', 'Y', 'I', 'M', 'A', 'G', 'E' };
+
 ply_image_t *
 ply_image_new (const char *filename)
 {
@@ -101,6 +218,11 @@ ply_image_free (ply_image_t *image)
 
         assert (image->filename != NULL);
 
+        if (image->png != NULL)
+                png_destroy_read_struct (&image->png, &image->info, NULL);
+
+        ply_image_file_close (&image->file);
+
         ply_pixel_buffer_free (image->buffer);
         free (image->filename);
         free (image);
@@ -122,12 +244,13 @@ transform_to_argb32 (png_struct   *png,
                 blue = data[i + 2];
                 alpha = data[i + 3];
 
-                /* pre-multiply the alpha if there's translucency */
+                /* pre-multiply the alpha if there's translucency, once, at
+                 * load time, so compositing doesn't have to
+                 */
                 if (alpha != 0xff) {
-                        red = (uint8_t) CLAMP (((red / 255.0) * (alpha / 255.0)) * 255.0, 0, 255.0);
-                        green = (uint8_t) CLAMP (((green / 255.0) * (alpha / 255.0)) * 255.0,
-                                                 0, 255.0);
-                        blue = (uint8_t) CLAMP (((blue / 255.0) * (alpha / 255.0)) * 255.0, 0, 255.0);
+                        red = PLY_PIXEL_BUFFER_MULTIPLY_CHANNEL (red, alpha);
+                        green = PLY_PIXEL_BUFFER_MULTIPLY_CHANNEL (green, alpha);
+                        blue = PLY_PIXEL_BUFFER_MULTIPLY_CHANNEL (blue, alpha);
                 }
 
                 pixel_value = (alpha << 24) | (red << 16) | (green << 8) | (blue << 0);
@@ -135,18 +258,21 @@ transform_to_argb32 (png_struct   *png,
         }
 }
 
+/* Reads everything up to the pixel data and allocates the pixel buffer,
+ * leaving the decoder open for ply_image_decode_png_pixels ().  Pixel
+ * buffers come out of a pool shared with the main thread, so this part
+ * has to run there.
+ */
 static bool
-ply_image_load_png (ply_image_t *image, FILE *fp)
+ply_image_load_png_header (ply_image_t *image)
 {
         png_struct *png;
         png_info *info;
-        png_uint_32 width, height, row;
+        png_uint_32 width, height;
         int bits_per_pixel, color_type, interlace_method;
-        png_byte **rows;
-        uint32_t *bytes;
 
         assert (image != NULL);
-        assert (fp != NULL);
+        assert (image->file.data != NULL);
 
         png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
         assert (png != NULL);
@@ -154,10 +280,12 @@ ply_image_load_png (ply_image_t *image, FILE *fp)
         info = png_create_info_struct (png);
         assert (info != NULL);
 
-        png_init_io (png, fp);
+        png_set_read_fn (png, &image->file, read_png_data);
 
-        if (setjmp (png_jmpbuf (png)) != 0)
+        if (setjmp (png_jmpbuf (png)) != 0) {
+                png_destroy_read_struct (&png, &info, NULL);
                 return false;
+        }
 
         png_read_info (png, info);
         png_get_IHDR (png, info,
@@ -192,41 +320,71 @@ ply_image_load_png (ply_image_t *image, FILE *fp)
 
         png_read_update_info (png, info);
 
-        rows = malloc (height * sizeof(png_byte *));
         image->buffer = ply_pixel_buffer_new (width, height);
+        ply_pixel_buffer_set_owner (image->buffer, "image");
+        image->png = png;
+        image->info = info;
+
+        return true;
+}
+
+/* Only touches the image's own decoder and pixels, so images can be
+ * decoded on worker threads.
+ */
+static bool
+ply_image_decode_png_pixels (ply_image_t *image)
+{
+        png_uint_32 width, height, row;
+        png_byte **rows;
+        uint32_t *bytes;
 
+        assert (image->png != NULL);
+
+        width = png_get_image_width (image->png, image->info);
+        height = png_get_image_height (image->png, image->info);
+
+        rows = malloc (height * sizeof(png_byte *));
         bytes = ply_pixel_buffer_get_argb32_data (image->buffer);
 
         for (row = 0; row < height; row++) {
                 rows[row] = (png_byte *) &bytes[row * width];
         }
 
-        png_read_image (png, rows);
+        if (setjmp (png_jmpbuf (image->png)) != 0) {
+                free (rows);
+                png_destroy_read_struct (&image->png, &image->info, NULL);
+                return false;
+        }
+
+        png_read_image (image->png, rows);
 
         free (rows);
-        png_read_end (png, info);
-        png_destroy_read_struct (&png, &info, NULL);
+        png_read_end (image->png, image->info);
+        png_destroy_read_struct (&image->png, &image->info, NULL);
 
         return true;
 }
 
+/* Converts the pixels straight out of the mapped file */
 static bool
-ply_image_load_bmp (ply_image_t *image, FILE *fp)
+ply_image_load_bmp (ply_image_t      *image,
+                    ply_image_file_t *file)
 {
         uint32_t x, y, src_y, width, height, bmp_pitch, *dst;
         struct bmp_file_header file_header;
         struct bmp_dib_header dib_header;
-        uint8_t r, g, b, *buf, *src;
-        bool ret = false;
+        uint8_t r, g, b;
+        const uint8_t *src;
 
         assert (image != NULL);
-        assert (fp != NULL);
+        assert (file->data != NULL);
 
-        if (fread (&file_header, 1, sizeof(struct bmp_file_header), fp) != sizeof(struct bmp_file_header))
+        if (file->size < sizeof(struct bmp_file_header) + sizeof(struct bmp_dib_header))
                 return false;
 
-        if (fread (&dib_header, 1, sizeof(struct bmp_dib_header), fp) != sizeof(struct bmp_dib_header))
-                return false;
+        memcpy (&file_header, file->data, sizeof(struct bmp_file_header));
+        memcpy (&dib_header, file->data + sizeof(struct bmp_file_header),
+                sizeof(struct bmp_dib_header));
 
         if (dib_header.dib_header_size != 40 || dib_header.width < 0 ||
             dib_header.planes != 1 || dib_header.bpp != 24 ||
@@ -237,16 +395,12 @@ ply_image_load_bmp (ply_image_t *image, FILE *fp)
         height = abs (dib_header.height);
         bmp_pitch = (3 * width + 3) & ~3;
 
-        buf = malloc (bmp_pitch * height);
-        assert (buf);
-
-        if (fseek (fp, file_header.bitmap_offset, SEEK_SET) != 0)
-                goto out;
-        
-        if (fread (buf, 1, bmp_pitch * height, fp) != bmp_pitch * height)
-                goto out;
+        if (file_header.bitmap_offset > file->size ||
+            (uint64_t) bmp_pitch * height > file->size - file_header.bitmap_offset)
+                return false;
 
         image->buffer = ply_pixel_buffer_new (width, height);
+        ply_pixel_buffer_set_owner (image->buffer, "image");
         dst = ply_pixel_buffer_get_argb32_data (image->buffer);
 
         for (y = 0; y < height; y++) {
@@ -256,7 +410,7 @@ ply_image_load_bmp (ply_image_t *image, FILE *fp)
                 else
                         src_y = y;
 
-                src = buf + src_y * bmp_pitch;
+                src = file->data + file_header.bitmap_offset + src_y * bmp_pitch;
 
                 for (x = 0; x < width; x++) {
                         b = *src++;
@@ -267,41 +421,421 @@ ply_image_load_bmp (ply_image_t *image, FILE *fp)
         }
 
         ply_pixel_buffer_set_opaque (image->buffer, true);
-        ret = true;
+
+        return true;
+}
+
+static char *
+get_cache_filename (ply_image_t *image)
+{
+        char *filename;
+
+        asprintf (&filename, "%s" PLY_IMAGE_CACHE_SUFFIX, image->filename);
+
+        return filename;
+}
+
+static bool
+ply_image_cache_matches_source (ply_image_cache_header_t *header,
+                                struct stat              *source)
+{
+        if (memcmp (header->magic, image_cache_magic, sizeof(image_cache_magic)) != 0)
+                return false;
+
+        if (header->version != PLY_IMAGE_CACHE_VERSION)
+                return false;
+
+        if (header->source_size != (uint64_t) source->st_size)
+                return false;
+
+        if (header->source_mtime_seconds != (int64_t) source->st_mtim.tv_sec ||
+            header->source_mtime_nanoseconds != (int64_t) source->st_mtim.tv_nsec)
+                return false;
+
+        return true;
+}
+
+/* Maps the decoded pixels from the image's cache file, when there is one
+ * and it was made from the source file as it is now
+ */
+static bool
+ply_image_load_cache (ply_image_t *image,
+                      struct stat *source)
+{
+        ply_image_cache_header_t *header;
+        struct stat cache;
+        char *cache_filename;
+        void *mapping;
+        int fd;
+
+        cache_filename = get_cache_filename (image);
+        fd = open (cache_filename, O_RDONLY | O_CLOEXEC);
+        free (cache_filename);
+
+        if (fd < 0)
+                return false;
+
+        if (fstat (fd, &cache) < 0 ||
+            cache.st_size < (off_t) sizeof(ply_image_cache_header_t)) {
+                close (fd);
+                return false;
+        }
+
+        /* Private and writable, so that drawing into the image copies the
+         * pages it touches instead of failing or changing the file
+         */
+        mapping = mmap (NULL, cache.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close (fd);
+
+        if (mapping == MAP_FAILED)
+                return false;
+
+        header = mapping;
+
+        if (!ply_image_cache_matches_source (header, source) ||
+            header->width == 0 || header->height == 0 ||
+            (uint64_t) cache.st_size != sizeof(ply_image_cache_header_t) +
+            (uint64_t) header->width * header->height * sizeof(uint32_t)) {
+                munmap (mapping, cache.st_size);
+                return false;
+        }
+
+        image->buffer = ply_pixel_buffer_new_for_mapped_data (header->width,
+                                                              header->height,
+                                                              (uint32_t *) (header + 1),
+                                                              mapping,
+                                                              cache.st_size);
+
+        if (header->flags & PLY_IMAGE_CACHE_IS_OPAQUE)
+                ply_pixel_buffer_set_opaque (image->buffer, true);
+
+        return true;
+}
+
+static void
+get_content_area (uint32_t        *bytes,
+                  unsigned long    width,
+                  unsigned long    height,
+                  ply_rectangle_t *area,
+                  bool            *is_opaque)
+{
+        unsigned long x, y, left, right, top, bottom;
+
+        left = width;
+        right = 0;
+        top = height;
+        bottom = 0;
+        *is_opaque = true;
+
+        for (y = 0; y < height; y++) {
+                for (x = 0; x < width; x++) {
+                        uint32_t alpha = bytes[y * width + x] >> 24;
+
+                        if (alpha != 0xff)
+                                *is_opaque = false;
+
+                        if (alpha == 0)
+                                continue;
+
+                        if (x < left)
+                                left = x;
+                        if (x >= right)
+                                right = x + 1;
+                        if (y < top)
+                                top = y;
+                        bottom = y + 1;
+                }
+        }
+
+        if (left >= right) {
+                area->x = area->y = 0;
+                area->width = area->height = 0;
+                return;
+        }
+
+        area->x = left;
+        area->y = top;
+        area->width = right - left;
+        area->height = bottom - top;
+}
+
+bool
+ply_image_save_cache (ply_image_t *image)
+{
+        ply_image_cache_header_t header = { { 0 } };
+        ply_rectangle_t size, content_area;
+        char *cache_filename, *temporary_filename;
+        struct stat source;
+        uint32_t *bytes;
+        bool is_opaque;
+        bool ret = false;
+        int fd;
+
+        assert (image != NULL);
+        assert (image->buffer != NULL);
+
+        if (stat (image->filename, &source) < 0)
+                return false;
+
+        ply_pixel_buffer_get_size (image->buffer, &size);
+        bytes = ply_pixel_buffer_get_argb32_data (image->buffer);
+        get_content_area (bytes, size.width, size.height, &content_area, &is_opaque);
+
+        memcpy (header.magic, image_cache_magic, sizeof(image_cache_magic));
+        header.version = PLY_IMAGE_CACHE_VERSION;
+        header.flags = is_opaque ? PLY_IMAGE_CACHE_IS_OPAQUE : 0;
+        header.width = size.width;
+        header.height = size.height;
+        header.content_x = content_area.x;
+        header.content_y = content_area.y;
+        header.content_width = content_area.width;
+        header.content_height = content_area.height;
+        header.source_size = source.st_size;
+        header.source_mtime_seconds = source.st_mtim.tv_sec;
+        header.source_mtime_nanoseconds = source.st_mtim.tv_nsec;
+
+        /* Written to the side and renamed into place, so a reader never
+         * maps a half written file
+         */
+        cache_filename = get_cache_filename (image);
+        asprintf (&temporary_filename, "%s.XXXXXX", cache_filename);
+
+        fd = mkostemp (temporary_filename, O_CLOEXEC);
+        if (fd < 0)
+                goto out;
+
+        if (ply_write (fd, &header, sizeof(header)) &&
+            ply_write (fd, bytes, size.width * size.height * sizeof(uint32_t)) &&
+            fchmod (fd, 0644) == 0)
+                ret = true;
+
+        if (close (fd) < 0)
+                ret = false;
+
+        if (ret && rename (temporary_filename, cache_filename) < 0)
+                ret = false;
+
+        if (!ret)
+                unlink (temporary_filename);
 out:
-        free (buf);
+        free (temporary_filename);
+        free (cache_filename);
+        return ret;
+}
+
+/* Opens the image and reads as much of it as has to happen on the main
+ * thread.  A BMP, or an image with an up to date cache, gets loaded
+ * completely; a PNG is left with its decoder open and its file mapped,
+ * ready for ply_image_finish_load ().
+ */
+static bool
+is_bmp_file (ply_image_file_t *file)
+{
+        struct bmp_file_header file_header;
+
+        if (file->size < sizeof(struct bmp_file_header))
+                return false;
+
+        memcpy (&file_header, file->data, sizeof(struct bmp_file_header));
+
+        return file_header.id == 0x4d42 && file_header.reserved == 0;
+}
+
+static bool
+is_png_file (ply_image_file_t *file)
+{
+        return file->size >= sizeof(png_header) &&
+               memcmp (file->data, png_header, sizeof(png_header)) == 0;
+}
+
+bool
+ply_image_start_load (ply_image_t *image)
+{
+        struct stat source;
+        bool ret = false;
+
+        assert (image != NULL);
+        assert (image->file.data == NULL);
+
+        ply_probe (image_load_begin, image->filename);
+
+        /* Checked before mapping the source, which isn't needed at all
+         * when the cache is good
+         */
+        if (stat (image->filename, &source) == 0 &&
+            ply_image_load_cache (image, &source)) {
+                ply_probe (image_load_end, image->filename, true);
+                return true;
+        }
+
+        if (!ply_image_file_open (&image->file, image->filename, &source, true)) {
+                ply_probe (image_load_end, image->filename, false);
+                return false;
+        }
+
+        if (is_png_file (&image->file)) {
+                ret = ply_image_load_png_header (image);
+                if (ret)
+                        return true;
+        } else if (is_bmp_file (&image->file)) {
+                ret = ply_image_load_bmp (image, &image->file);
+        }
+
+        ply_image_file_close (&image->file);
+        ply_probe (image_load_end, image->filename, ret);
+        return ret;
+}
+
+bool
+ply_image_finish_load (ply_image_t *image)
+{
+        bool ret;
+
+        if (image->file.data == NULL)
+                return true;
+
+        ret = ply_image_decode_png_pixels (image);
+
+        ply_image_file_close (&image->file);
+        ply_probe (image_load_end, image->filename, ret);
         return ret;
 }
 
 bool
 ply_image_load (ply_image_t *image)
 {
-        uint8_t header[16];
+        double start_time;
+        bool is_loaded;
+
+        start_time = ply_get_timestamp ();
+
+        is_loaded = ply_image_start_load (image) && ply_image_finish_load (image);
+
+        ply_statistics_add_timeline_span ("image-load", image->filename,
+                                          start_time, ply_get_timestamp ());
+
+        return is_loaded;
+}
+
+static bool
+ply_image_peek_png_size (ply_image_file_t *file,
+                         long             *width,
+                         long             *height)
+{
+        png_struct *png;
+        png_info *info;
+
+        png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        assert (png != NULL);
+
+        info = png_create_info_struct (png);
+        assert (info != NULL);
+
+        png_set_read_fn (png, file, read_png_data);
+
+        if (setjmp (png_jmpbuf (png)) != 0) {
+                png_destroy_read_struct (&png, &info, NULL);
+                return false;
+        }
+
+        png_read_info (png, info);
+        *width = png_get_image_width (png, info);
+        *height = png_get_image_height (png, info);
+
+        png_destroy_read_struct (&png, &info, NULL);
+
+        return true;
+}
+
+bool
+ply_image_peek_size (ply_image_t *image,
+                     long        *width,
+                     long        *height)
+{
+        ply_image_file_t file = { NULL };
+        struct stat file_info;
         bool ret = false;
-        FILE *fp;
 
         assert (image != NULL);
 
-        fp = fopen (image->filename, "re");
-        if (fp == NULL)
+        if (!ply_image_file_open (&file, image->filename, &file_info, false))
                 return false;
 
-        if (fread (header, 1, 16, fp) != 16)
-                goto out;
+        if (is_png_file (&file)) {
+                ret = ply_image_peek_png_size (&file, width, height);
+        } else if (is_bmp_file (&file) &&
+                   file.size >= sizeof(struct bmp_file_header) + sizeof(struct bmp_dib_header)) {
+                struct bmp_dib_header dib_header;
+
+                memcpy (&dib_header, file.data + sizeof(struct bmp_file_header),
+                        sizeof(struct bmp_dib_header));
+                *width = dib_header.width;
+                *height = abs (dib_header.height);
+                ret = true;
+        }
 
-        /* Rewind */
-        if (fseek (fp, 0, SEEK_SET) != 0)
-                goto out;
+        ply_image_file_close (&file);
+        return ret;
+}
+
+typedef struct
+{
+        ply_image_t **images;
+        bool         *results;
+} ply_image_load_job_t;
 
-        if (memcmp (header, png_header, sizeof(png_header)) == 0)
-                ret = ply_image_load_png (image, fp);
+static void
+on_finish_load (ply_image_load_job_t *job,
+                int                   index)
+{
+        job->results[index] = ply_image_finish_load (job->images[index]);
+}
 
-        else if (((struct bmp_file_header *)header)->id == 0x4d42 &&
-                 ((struct bmp_file_header *)header)->reserved == 0)
-                ret = ply_image_load_bmp (image, fp);
+bool
+ply_image_load_images (ply_image_t **images,
+                       int           number_of_images)
+{
+        ply_image_load_job_t job;
+        ply_worker_pool_t *worker_pool;
+        bool ret = true;
+        int i;
+
+        if (number_of_images <= 0)
+                return true;
+
+        job.images = images;
+        job.results = calloc (number_of_images, sizeof(bool));
+
+        for (i = 0; i < number_of_images; i++) {
+                if (!ply_image_start_load (images[i])) {
+                        ret = false;
+                        break;
+                }
+        }
+
+        /* Decode whatever got started even after a failure, so that every
+         * decoder gets closed again
+         */
+        number_of_images = i;
+
+        worker_pool = ply_worker_pool_get_default ();
+        if (worker_pool != NULL) {
+                ply_worker_pool_run (worker_pool,
+                                     (ply_worker_pool_job_handler_t) on_finish_load,
+                                     &job, number_of_images);
+        } else {
+                for (i = 0; i < number_of_images; i++) {
+                        on_finish_load (&job, i);
+                }
+        }
+
+        for (i = 0; i < number_of_images; i++) {
+                if (!job.results[i])
+                        ret = false;
+        }
+
+        free (job.results);
 
-out:
-        fclose (fp);
         return ret;
 }
 
@@ -341,12 +875,15 @@ ply_image_resize (ply_image_t *image,
                   long         height)
 {
         ply_image_t *new_image;
+        ply_pixel_buffer_t *buffer;
 
         new_image = ply_image_new (image->filename);
 
-        new_image->buffer = ply_pixel_buffer_resize (image->buffer,
-                                                     width,
-                                                     height);
+        buffer = ply_pixel_buffer_resize_cached (image->buffer, width, height);
+        new_image->buffer = ply_pixel_buffer_duplicate (buffer);
+        ply_pixel_buffer_set_owner (new_image->buffer, "image");
+        ply_pixel_buffer_free (buffer);
+
         return new_image;
 }
 
@@ -357,13 +894,18 @@ ply_image_rotate (ply_image_t *image,
                   double       theta_offset)
 {
         ply_image_t *new_image;
+        ply_pixel_buffer_t *buffer;
 
         new_image = ply_image_new (image->filename);
 
-        new_image->buffer = ply_pixel_buffer_rotate (image->buffer,
-                                                     center_x,
-                                                     center_y,
-                                                     theta_offset);
+        buffer = ply_pixel_buffer_rotate_cached (image->buffer,
+                                                 center_x,
+                                                 center_y,
+                                                 theta_offset);
+        new_image->buffer = ply_pixel_buffer_duplicate (buffer);
+        ply_pixel_buffer_set_owner (new_image->buffer, "image");
+        ply_pixel_buffer_free (buffer);
+
         return new_image;
 }
 
@@ -373,12 +915,15 @@ ply_image_tile (ply_image_t *image,
                 long         height)
 {
         ply_image_t *new_image;
+        ply_pixel_buffer_t *buffer;
 
         new_image = ply_image_new (image->filename);
 
-        new_image->buffer = ply_pixel_buffer_tile (image->buffer,
-                                                   width,
-                                                   height);
+        buffer = ply_pixel_buffer_tile_cached (image->buffer, width, height);
+        new_image->buffer = ply_pixel_buffer_duplicate (buffer);
+        ply_pixel_buffer_set_owner (new_image->buffer, "image");
+        ply_pixel_buffer_free (buffer);
+
         return new_image;
 }
 
@@ -404,4 +949,127 @@ ply_image_convert_to_pixel_buffer (ply_image_t *image)
         return buffer;
 }
 
+/* Decoded images shared between everyone loading the same file, most
+ * recently used first, and told apart from newer versions of the file
+ * by what stat () says about it
+ */
+typedef struct
+{
+        char               *path;
+        dev_t               device;
+        ino_t               inode;
+        off_t               size;
+        struct timespec     modification_time;
+
+        ply_pixel_buffer_t *buffer;
+        size_t              memory_size;
+} ply_image_cache_entry_t;
+
+static ply_list_t *cache_entries;
+static size_t cache_size;
+
+static void
+ply_image_cache_remove_node (ply_list_node_t *node)
+{
+        ply_image_cache_entry_t *entry;
+
+        entry = ply_list_node_get_data (node);
+        ply_list_remove_node (cache_entries, node);
+
+        cache_size -= entry->memory_size;
+        ply_pixel_buffer_free (entry->buffer);
+        free (entry->path);
+        free (entry);
+}
+
+static bool
+ply_image_cache_entry_matches (ply_image_cache_entry_t *entry,
+                               struct stat             *file_info)
+{
+        return entry->device == file_info->st_dev &&
+               entry->inode == file_info->st_ino &&
+               entry->size == file_info->st_size &&
+               entry->modification_time.tv_sec == file_info->st_mtim.tv_sec &&
+               entry->modification_time.tv_nsec == file_info->st_mtim.tv_nsec;
+}
+
+ply_pixel_buffer_t *
+ply_image_load_buffer_cached (const char *filename)
+{
+        ply_image_cache_entry_t *entry;
+        ply_pixel_buffer_t *buffer;
+        ply_list_node_t *node;
+        ply_image_t *image;
+        ply_rectangle_t area;
+        struct stat file_info;
+        char *path;
+
+        path = realpath (filename, NULL);
+        if (path == NULL)
+                return NULL;
+
+        if (stat (path, &file_info) < 0) {
+                free (path);
+                return NULL;
+        }
+
+        if (cache_entries == NULL)
+                cache_entries = ply_list_new ();
+
+        node = ply_list_get_first_node (cache_entries);
+        while (node != NULL) {
+                ply_list_node_t *next_node;
+
+                entry = ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (cache_entries, node);
+
+                if (strcmp (entry->path, path) == 0) {
+                        if (!ply_image_cache_entry_matches (entry, &file_info)) {
+                                ply_image_cache_remove_node (node);
+                                break;
+                        }
+
+                        if (node != ply_list_get_first_node (cache_entries)) {
+                                ply_list_remove_node (cache_entries, node);
+                                ply_list_prepend_data (cache_entries, entry);
+                        }
+
+                        free (path);
+                        return ply_pixel_buffer_ref (entry->buffer);
+                }
+
+                node = next_node;
+        }
+
+        image = ply_image_new (path);
+        if (!ply_image_load (image)) {
+                ply_image_free (image);
+                free (path);
+                return NULL;
+        }
+        buffer = ply_image_convert_to_pixel_buffer (image);
+
+        ply_pixel_buffer_get_size (buffer, &area);
+
+        entry = calloc (1, sizeof(ply_image_cache_entry_t));
+        entry->path = path;
+        entry->device = file_info.st_dev;
+        entry->inode = file_info.st_ino;
+        entry->size = file_info.st_size;
+        entry->modification_time = file_info.st_mtim;
+        entry->buffer = ply_pixel_buffer_ref (buffer);
+        entry->memory_size = area.width * area.height * sizeof(uint32_t);
+
+        ply_list_prepend_data (cache_entries, entry);
+        cache_size += entry->memory_size;
+
+        /* Never drops what was just loaded, however big it is */
+        while (cache_size > PLY_IMAGE_CACHE_MEMORY_LIMIT &&
+               ply_list_get_length (cache_entries) > 1) {
+                ply_image_cache_remove_node (ply_list_get_last_node (cache_entries));
+        }
+
+        return buffer;
+}
+
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -30,10 +30,39 @@
 
 typedef struct _ply_image ply_image_t;
 
+/* How much decoded image memory ply_image_load_buffer_cached () holds
+ * on to */
+#define PLY_IMAGE_CACHE_MEMORY_LIMIT (32 * 1024 * 1024)
+
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_image_t *ply_image_new (const char *filename);
 void ply_image_free (ply_image_t *image);
 bool ply_image_load (ply_image_t *image);
+
+/* ply_image_load () in two halves.  Starting reads the header, or all of
+ * a cached image, and has to happen on the event loop's thread.
+ * Finishing decodes the pixels and can happen on any thread.
+ */
+bool ply_image_start_load (ply_image_t *image);
+bool ply_image_finish_load (ply_image_t *image);
+
+/* Loads all the images, decoding them in parallel on the shared worker
+ * pool when there is one.  Returns false if any of them failed to load.
+ */
+bool ply_image_load_images (ply_image_t **images,
+                            int           number_of_images);
+
+/* Reads just enough of the file to tell how big the image is, without
+ * loading it
+ */
+bool ply_image_peek_size (ply_image_t *image,
+                          long        *width,
+                          long        *height);
+
+/* Saves the loaded pixels where ply_image_load () looks for them first,
+ * so they don't have to be decoded again until the file changes
+ */
+bool ply_image_save_cache (ply_image_t *image);
 uint32_t *ply_image_get_data (ply_image_t *image);
 long ply_image_get_width (ply_image_t *image);
 long ply_image_get_height (ply_image_t *image);
@@ -50,6 +79,12 @@ ply_image_t *ply_image_tile (ply_image_t *image,
 ply_pixel_buffer_t *ply_image_get_buffer (ply_image_t *image);
 ply_pixel_buffer_t *ply_image_convert_to_pixel_buffer (ply_image_t *image);
 
+/* Loads filename straight into a pixel buffer, sharing it with everyone
+ * else who has loaded the same unchanged file this way.  The buffer must
+ * not be modified; release it with ply_pixel_buffer_free.
+ */
+ply_pixel_buffer_t *ply_image_load_buffer_cached (const char *filename);
+
 #endif
 
 #endif /* PLY_IMAGE_H */
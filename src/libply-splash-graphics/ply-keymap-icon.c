@@ -39,8 +39,8 @@ struct _ply_keymap_icon
 {
         ply_pixel_display_t *display;
         char                *image_dir;
-        ply_pixel_buffer_t  *icon_buffer;
-        ply_pixel_buffer_t  *keymap_buffer;
+        /* the keyboard icon and the keymap's text, laid out side by side */
+        ply_pixel_buffer_t  *buffer;
         int                  keymap_offset;
         int                  keymap_width;
         long                 x, y;
@@ -130,16 +130,52 @@ ply_keymap_icon_free (ply_keymap_icon_t *keymap_icon)
         if (keymap_icon == NULL)
                 return;
 
-        ply_pixel_buffer_free (keymap_icon->icon_buffer);
-        ply_pixel_buffer_free (keymap_icon->keymap_buffer);
+        ply_pixel_buffer_free (keymap_icon->buffer);
 
         free (keymap_icon->image_dir);
         free (keymap_icon);
 }
 
+static void
+ply_keymap_icon_render (ply_keymap_icon_t  *keymap_icon,
+                        ply_pixel_buffer_t *icon_buffer,
+                        ply_pixel_buffer_t *keymap_buffer)
+{
+        ply_rectangle_t icon_area, keymap_area;
+
+        keymap_icon->buffer = ply_pixel_buffer_new (keymap_icon->width,
+                                                    keymap_icon->height);
+
+        /* Draw keyboard icon */
+        ply_pixel_buffer_get_size (icon_buffer, &icon_area);
+        icon_area.x = 0;
+        icon_area.y = (keymap_icon->height - icon_area.height) / 2;
+
+        ply_pixel_buffer_fill_with_buffer (keymap_icon->buffer, icon_buffer,
+                                           icon_area.x, icon_area.y);
+
+        /* Draw pre-rendered keyboard layout text */
+        keymap_area.width = keymap_icon->keymap_width;
+        keymap_area.height = ply_pixel_buffer_get_height (keymap_buffer);
+        keymap_area.x = icon_area.width + SPACING;
+        keymap_area.y = (keymap_icon->height - keymap_area.height) / 2;
+
+        /* Draw keyboard layout text, shift the pre-rendered image to the left
+         * so that the text we want lines out at the place we want it and set
+         * the area we want to draw to as clip-area to only draw what we want.
+         */
+        ply_pixel_buffer_fill_with_buffer_with_clip (
+                keymap_icon->buffer,
+                keymap_buffer,
+                keymap_area.x - keymap_icon->keymap_offset,
+                keymap_area.y,
+                &keymap_area);
+}
+
 bool
 ply_keymap_icon_load (ply_keymap_icon_t *keymap_icon)
 {
+        ply_pixel_buffer_t *icon_buffer, *keymap_buffer;
         ply_image_t *keymap_image = NULL;
         ply_image_t *icon_image;
         char *filename;
@@ -149,7 +185,7 @@ ply_keymap_icon_load (ply_keymap_icon_t *keymap_icon)
         if (keymap_icon->keymap_offset == -1)
                 return false;
 
-        if (keymap_icon->icon_buffer)
+        if (keymap_icon->buffer)
                 return true;
 
         asprintf (&filename, "%s/keyboard.png", keymap_icon->image_dir);
@@ -172,15 +208,24 @@ ply_keymap_icon_load (ply_keymap_icon_t *keymap_icon)
                 return false;
         }
 
-        keymap_icon->icon_buffer = ply_image_convert_to_pixel_buffer (icon_image);
-        keymap_icon->keymap_buffer = ply_image_convert_to_pixel_buffer (keymap_image);
+        icon_buffer = ply_image_convert_to_pixel_buffer (icon_image);
+        keymap_buffer = ply_image_convert_to_pixel_buffer (keymap_image);
 
         keymap_icon->width =
-                ply_pixel_buffer_get_width (keymap_icon->icon_buffer) +
+                ply_pixel_buffer_get_width (icon_buffer) +
                 SPACING + keymap_icon->keymap_width;
         keymap_icon->height = MAX(
-                ply_pixel_buffer_get_height (keymap_icon->icon_buffer),
-                ply_pixel_buffer_get_height (keymap_icon->keymap_buffer));
+                ply_pixel_buffer_get_height (icon_buffer),
+                ply_pixel_buffer_get_height (keymap_buffer));
+
+        /* The keymap comes from the terminal and doesn't change once it's
+         * open, so the icon only needs putting together once.  The image
+         * with the text of every keymap is big, and isn't kept around.
+         */
+        ply_keymap_icon_render (keymap_icon, icon_buffer, keymap_buffer);
+
+        ply_pixel_buffer_free (icon_buffer);
+        ply_pixel_buffer_free (keymap_buffer);
 
         return true;
 }
@@ -190,7 +235,7 @@ ply_keymap_icon_show (ply_keymap_icon_t *keymap_icon,
                       long               x,
                       long               y)
 {
-        if (!keymap_icon->icon_buffer) {
+        if (!keymap_icon->buffer) {
                 ply_trace ("keymap_icon not loaded, can not start");
                 return false;
         }
@@ -228,38 +273,11 @@ ply_keymap_icon_draw_area (ply_keymap_icon_t  *keymap_icon,
                            unsigned long       width,
                            unsigned long       height)
 {
-        ply_rectangle_t icon_area, keymap_area;
-
         if (keymap_icon->is_hidden)
                 return;
 
-        /* Draw keyboard icon */
-        ply_pixel_buffer_get_size (keymap_icon->icon_buffer, &icon_area);
-        icon_area.x = keymap_icon->x;
-        icon_area.y = keymap_icon->y +
-                      (keymap_icon->height - icon_area.height) / 2;
-
-        ply_pixel_buffer_fill_with_buffer (buffer, keymap_icon->icon_buffer,
-                                           icon_area.x, icon_area.y);
-
-        /* Draw pre-rendered keyboard layout text */
-        keymap_area.width = keymap_icon->keymap_width;
-        keymap_area.height =
-                ply_pixel_buffer_get_height (keymap_icon->keymap_buffer);
-        keymap_area.x = keymap_icon->x + icon_area.width + SPACING;
-        keymap_area.y = keymap_icon->y +
-                        (keymap_icon->height - keymap_area.height) / 2;
-
-        /* Draw keyboard layout text, shift the pre-rendered image to the left
-         * so that the text we want lines out at the place we want it and set
-         * the area we want to draw to as clip-area to only draw what we want.
-         */
-        ply_pixel_buffer_fill_with_buffer_with_clip (
-                buffer,
-                keymap_icon->keymap_buffer,
-                keymap_area.x - keymap_icon->keymap_offset,
-                keymap_area.y,
-                &keymap_area);
+        ply_pixel_buffer_fill_with_buffer (buffer, keymap_icon->buffer,
+                                           keymap_icon->x, keymap_icon->y);
 }
 
 unsigned long
@@ -68,6 +68,10 @@ typedef struct
                                           ply_label_alignment_t       alignment);
         void (*set_width_for_control)(ply_label_plugin_control_t *label,
                                       long                        width);
+
+        /* Called on a helper thread, before any control is made, to get
+         * slow one-time setup like loading fonts out of the way */
+        void (*preload)(void);
 } ply_label_plugin_interface_t;
 
 #endif /* PLY_LABEL_PLUGIN_H */
@@ -24,6 +24,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +39,132 @@
 #include "ply-logger.h"
 #include "ply-utils.h"
 
+#ifndef PLUGIN_PRELOAD_POLL_INTERVAL
+#define PLUGIN_PRELOAD_POLL_INTERVAL 0.05
+#endif
+
+/* The built-in font: 5x7 glyphs for printable ASCII, a column per byte
+ * with the top row in the lowest bit, drawn magnified */
+#define FALLBACK_GLYPH_WIDTH 5
+#define FALLBACK_GLYPH_HEIGHT 7
+#define FALLBACK_CELL_WIDTH 6
+#define FALLBACK_CELL_HEIGHT 9
+#define FALLBACK_FONT_SCALE 2
+
+static const uint8_t fallback_glyphs[][FALLBACK_GLYPH_WIDTH] = {
+        { 0x00, 0x00, 0x00, 0x00, 0x00 }, /*   */
+        { 0x00, 0x00, 0x5f, 0x00, 0x00 }, /* ! */
+        { 0x00, 0x07, 0x00, 0x07, 0x00 }, /* " */
+        { 0x14, 0x7f, 0x14, 0x7f, 0x14 }, /* # */
+        { 0x24, 0x2a, 0x7f, 0x2a, 0x12 }, /* $ */
+        { 0x23, 0x13, 0x08, 0x64, 0x62 }, /* % */
+        { 0x36, 0x49, 0x55, 0x22, 0x50 }, /* & */
+        { 0x00, 0x05, 0x03, 0x00, 0x00 }, /* ' */
+        { 0x00, 0x1c, 0x22, 0x41, 0x00 }, /* ( */
+        { 0x00, 0x41, 0x22, 0x1c, 0x00 }, /* ) */
+        { 0x08, 0x2a, 0x1c, 0x2a, 0x08 }, /* * */
+        { 0x08, 0x08, 0x3e, 0x08, 0x08 }, /* + */
+        { 0x00, 0x50, 0x30, 0x00, 0x00 }, /* , */
+        { 0x08, 0x08, 0x08, 0x08, 0x08 }, /* - */
+        { 0x00, 0x60, 0x60, 0x00, 0x00 }, /* . */
+        { 0x20, 0x10, 0x08, 0x04, 0x02 }, /* / */
+        { 0x3e, 0x51, 0x49, 0x45, 0x3e }, /* 0 */
+        { 0x00, 0x42, 0x7f, 0x40, 0x00 }, /* 1 */
+        { 0x42, 0x61, 0x51, 0x49, 0x46 }, /* 2 */
+        { 0x21, 0x41, 0x45, 0x4b, 0x31 }, /* 3 */
+        { 0x18, 0x14, 0x12, 0x7f, 0x10 }, /* 4 */
+        { 0x27, 0x45, 0x45, 0x45, 0x39 }, /* 5 */
+        { 0x3c, 0x4a, 0x49, 0x49, 0x30 }, /* 6 */
+        { 0x01, 0x71, 0x09, 0x05, 0x03 }, /* 7 */
+        { 0x36, 0x49, 0x49, 0x49, 0x36 }, /* 8 */
+        { 0x06, 0x49, 0x49, 0x29, 0x1e }, /* 9 */
+        { 0x00, 0x36, 0x36, 0x00, 0x00 }, /* : */
+        { 0x00, 0x56, 0x36, 0x00, 0x00 }, /* ; */
+        { 0x08, 0x14, 0x22, 0x41, 0x00 }, /* < */
+        { 0x14, 0x14, 0x14, 0x14, 0x14 }, /* = */
+        { 0x00, 0x41, 0x22, 0x14, 0x08 }, /* > */
+        { 0x02, 0x01, 0x51, 0x09, 0x06 }, /* ? */
+        { 0x32, 0x49, 0x79, 0x41, 0x3e }, /* @ */
+        { 0x7e, 0x11, 0x11, 0x11, 0x7e }, /* A */
+        { 0x7f, 0x49, 0x49, 0x49, 0x36 }, /* B */
+        { 0x3e, 0x41, 0x41, 0x41, 0x22 }, /* C */
+        { 0x7f, 0x41, 0x41, 0x22, 0x1c }, /* D */
+        { 0x7f, 0x49, 0x49, 0x49, 0x41 }, /* E */
+        { 0x7f, 0x09, 0x09, 0x09, 0x01 }, /* F */
+        { 0x3e, 0x41, 0x49, 0x49, 0x7a }, /* G */
+        { 0x7f, 0x08, 0x08, 0x08, 0x7f }, /* H */
+        { 0x00, 0x41, 0x7f, 0x41, 0x00 }, /* I */
+        { 0x20, 0x40, 0x41, 0x3f, 0x01 }, /* J */
+        { 0x7f, 0x08, 0x14, 0x22, 0x41 }, /* K */
+        { 0x7f, 0x40, 0x40, 0x40, 0x40 }, /* L */
+        { 0x7f, 0x02, 0x0c, 0x02, 0x7f }, /* M */
+        { 0x7f, 0x04, 0x08, 0x10, 0x7f }, /* N */
+        { 0x3e, 0x41, 0x41, 0x41, 0x3e }, /* O */
+        { 0x7f, 0x09, 0x09, 0x09, 0x06 }, /* P */
+        { 0x3e, 0x41, 0x51, 0x21, 0x5e }, /* Q */
+        { 0x7f, 0x09, 0x19, 0x29, 0x46 }, /* R */
+        { 0x46, 0x49, 0x49, 0x49, 0x31 }, /* S */
+        { 0x01, 0x01, 0x7f, 0x01, 0x01 }, /* T */
+        { 0x3f, 0x40, 0x40, 0x40, 0x3f }, /* U */
+        { 0x1f, 0x20, 0x40, 0x20, 0x1f }, /* V */
+        { 0x3f, 0x40, 0x38, 0x40, 0x3f }, /* W */
+        { 0x63, 0x14, 0x08, 0x14, 0x63 }, /* X */
+        { 0x07, 0x08, 0x70, 0x08, 0x07 }, /* Y */
+        { 0x61, 0x51, 0x49, 0x45, 0x43 }, /* Z */
+        { 0x00, 0x7f, 0x41, 0x41, 0x00 }, /* [ */
+        { 0x02, 0x04, 0x08, 0x10, 0x20 }, /* \ */
+        { 0x00, 0x41, 0x41, 0x7f, 0x00 }, /* ] */
+        { 0x04, 0x02, 0x01, 0x02, 0x04 }, /* ^ */
+        { 0x40, 0x40, 0x40, 0x40, 0x40 }, /* _ */
+        { 0x00, 0x01, 0x02, 0x04, 0x00 }, /* ` */
+        { 0x20, 0x54, 0x54, 0x54, 0x78 }, /* a */
+        { 0x7f, 0x48, 0x44, 0x44, 0x38 }, /* b */
+        { 0x38, 0x44, 0x44, 0x44, 0x20 }, /* c */
+        { 0x38, 0x44, 0x44, 0x48, 0x7f }, /* d */
+        { 0x38, 0x54, 0x54, 0x54, 0x18 }, /* e */
+        { 0x08, 0x7e, 0x09, 0x01, 0x02 }, /* f */
+        { 0x0c, 0x52, 0x52, 0x52, 0x3e }, /* g */
+        { 0x7f, 0x08, 0x04, 0x04, 0x78 }, /* h */
+        { 0x00, 0x44, 0x7d, 0x40, 0x00 }, /* i */
+        { 0x20, 0x40, 0x44, 0x3d, 0x00 }, /* j */
+        { 0x7f, 0x10, 0x28, 0x44, 0x00 }, /* k */
+        { 0x00, 0x41, 0x7f, 0x40, 0x00 }, /* l */
+        { 0x7c, 0x04, 0x18, 0x04, 0x78 }, /* m */
+        { 0x7c, 0x08, 0x04, 0x04, 0x78 }, /* n */
+        { 0x38, 0x44, 0x44, 0x44, 0x38 }, /* o */
+        { 0x7c, 0x14, 0x14, 0x14, 0x08 }, /* p */
+        { 0x08, 0x14, 0x14, 0x18, 0x7c }, /* q */
+        { 0x7c, 0x08, 0x04, 0x04, 0x08 }, /* r */
+        { 0x48, 0x54, 0x54, 0x54, 0x20 }, /* s */
+        { 0x04, 0x3f, 0x44, 0x40, 0x20 }, /* t */
+        { 0x3c, 0x40, 0x40, 0x20, 0x7c }, /* u */
+        { 0x1c, 0x20, 0x40, 0x20, 0x1c }, /* v */
+        { 0x3c, 0x40, 0x30, 0x40, 0x3c }, /* w */
+        { 0x44, 0x28, 0x10, 0x28, 0x44 }, /* x */
+        { 0x0c, 0x50, 0x50, 0x50, 0x3c }, /* y */
+        { 0x44, 0x64, 0x54, 0x4c, 0x44 }, /* z */
+        { 0x00, 0x08, 0x36, 0x41, 0x00 }, /* { */
+        { 0x00, 0x00, 0x7f, 0x00, 0x00 }, /* | */
+        { 0x00, 0x41, 0x36, 0x08, 0x00 }, /* } */
+        { 0x08, 0x04, 0x08, 0x10, 0x08 }, /* ~ */
+};
+
+typedef enum
+{
+        PLUGIN_PRELOAD_NOT_STARTED,
+        PLUGIN_PRELOAD_RUNNING,
+        PLUGIN_PRELOAD_DONE
+} plugin_preload_state_t;
+
+/* Loading the plugin pulls in pango, cairo and fontconfig, which can take
+ * a while on a cold boot, so the first label starts it on a thread of its
+ * own.  Anything shown before that's done gets the built-in font until it
+ * is.
+ */
+static pthread_t plugin_preload_thread;
+static int plugin_preload_state = PLUGIN_PRELOAD_NOT_STARTED;
+static bool plugin_preload_thread_is_joined;
+
 struct _ply_label
 {
         ply_event_loop_t                   *loop;
@@ -53,18 +180,305 @@ struct _ply_label
         float                               green;
         float                               blue;
         float                               alpha;
+
+        /* where the built-in font stands in for the plugin */
+        ply_pixel_display_t                *display;
+        ply_rectangle_t                     fallback_area;
+        uint32_t                            is_using_fallback : 1;
+        uint32_t                            is_waiting_for_plugin : 1;
 };
 
 typedef const ply_label_plugin_interface_t *
 (*get_plugin_interface_function_t) (void);
 
 static void ply_label_unload_plugin (ply_label_t *label);
+static bool ply_label_load_plugin (ply_label_t *label);
+static void ply_label_draw_fallback_area (ply_label_t        *label,
+                                          ply_pixel_buffer_t *buffer,
+                                          long                x,
+                                          long                y,
+                                          unsigned long       width,
+                                          unsigned long       height);
+
+static void *
+preload_plugin (void *user_data)
+{
+        ply_module_handle_t *module_handle;
+        get_plugin_interface_function_t get_label_plugin_interface;
+        const ply_label_plugin_interface_t *plugin_interface;
+
+        /* The module is never unloaded, so loading it again later on the
+         * main thread is quick */
+        module_handle = ply_open_module (PLYMOUTH_PLUGIN_PATH "label.so");
+        if (module_handle != NULL) {
+                get_label_plugin_interface = (get_plugin_interface_function_t)
+                                             ply_module_look_up_function (module_handle,
+                                                                          "ply_label_plugin_get_interface");
+                plugin_interface = get_label_plugin_interface != NULL ? get_label_plugin_interface () : NULL;
+
+                if (plugin_interface != NULL && plugin_interface->preload != NULL)
+                        plugin_interface->preload ();
+
+                ply_close_module (module_handle);
+        }
+
+        __atomic_store_n (&plugin_preload_state, PLUGIN_PRELOAD_DONE, __ATOMIC_RELEASE);
+
+        return NULL;
+}
+
+static void
+start_preloading_plugin (void)
+{
+        if (plugin_preload_state != PLUGIN_PRELOAD_NOT_STARTED)
+                return;
+
+        plugin_preload_state = PLUGIN_PRELOAD_RUNNING;
+        if (pthread_create (&plugin_preload_thread, NULL, preload_plugin, NULL) != 0) {
+                ply_trace ("could not start loading the label plugin in the background: %m");
+                plugin_preload_state = PLUGIN_PRELOAD_DONE;
+                plugin_preload_thread_is_joined = true;
+        }
+}
+
+static bool
+plugin_is_preloading (void)
+{
+        if (__atomic_load_n (&plugin_preload_state, __ATOMIC_ACQUIRE) == PLUGIN_PRELOAD_RUNNING)
+                return true;
+
+        if (plugin_preload_state == PLUGIN_PRELOAD_DONE && !plugin_preload_thread_is_joined) {
+                pthread_join (plugin_preload_thread, NULL);
+                plugin_preload_thread_is_joined = true;
+        }
+
+        return false;
+}
+
+static void
+ply_label_get_fallback_size (ply_label_t   *label,
+                             unsigned long *width,
+                             unsigned long *height)
+{
+        const char *character;
+        unsigned long line_width = 0;
+
+        *width = 0;
+        *height = FALLBACK_CELL_HEIGHT * FALLBACK_FONT_SCALE;
+
+        for (character = label->text; character != NULL && *character != '\0'; character++) {
+                if (*character == '\n') {
+                        *height += FALLBACK_CELL_HEIGHT * FALLBACK_FONT_SCALE;
+                        line_width = 0;
+                        continue;
+                }
+
+                /* one cell for each UTF-8 character */
+                if ((*character & 0xc0) == 0x80)
+                        continue;
+
+                line_width += FALLBACK_CELL_WIDTH * FALLBACK_FONT_SCALE;
+                *width = MAX (*width, line_width);
+        }
+
+        if (label->width >= 0)
+                *width = label->width;
+}
+
+static void
+ply_label_queue_fallback_redraw (ply_label_t *label)
+{
+        if (label->display == NULL)
+                return;
+
+        ply_pixel_display_draw_area (label->display,
+                                     label->fallback_area.x, label->fallback_area.y,
+                                     label->fallback_area.width, label->fallback_area.height);
+}
+
+static void
+on_plugin_preload_poll_timeout (ply_label_t *label)
+{
+        ply_rectangle_t fallback_area;
+
+        if (plugin_is_preloading ()) {
+                ply_event_loop_watch_for_timeout (ply_event_loop_get_default (),
+                                                  PLUGIN_PRELOAD_POLL_INTERVAL,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_plugin_preload_poll_timeout,
+                                                  label);
+                return;
+        }
+
+        label->is_waiting_for_plugin = false;
+
+        if (!label->is_using_fallback)
+                return;
+
+        fallback_area = label->fallback_area;
+        ply_label_queue_fallback_redraw (label);
+        label->is_using_fallback = false;
+
+        ply_trace ("label plugin is ready, switching over from the built-in font");
+        if (ply_label_load_plugin (label))
+                label->plugin_interface->show_control (label->control,
+                                                       label->display,
+                                                       fallback_area.x,
+                                                       fallback_area.y);
+}
+
+static bool
+ply_label_show_fallback (ply_label_t         *label,
+                         ply_pixel_display_t *display,
+                         long                 x,
+                         long                 y)
+{
+        if (label->is_using_fallback)
+                ply_label_queue_fallback_redraw (label);
+
+        label->is_using_fallback = true;
+        label->display = display;
+        label->fallback_area.x = x;
+        label->fallback_area.y = y;
+        ply_label_get_fallback_size (label, &label->fallback_area.width, &label->fallback_area.height);
+        ply_label_queue_fallback_redraw (label);
+
+        if (!label->is_waiting_for_plugin) {
+                label->is_waiting_for_plugin = true;
+                ply_event_loop_watch_for_timeout (ply_event_loop_get_default (),
+                                                  PLUGIN_PRELOAD_POLL_INTERVAL,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_plugin_preload_poll_timeout,
+                                                  label);
+        }
+
+        return true;
+}
+
+/* for when something changing moves or resizes the text */
+static void
+ply_label_update_fallback (ply_label_t *label)
+{
+        if (!label->is_using_fallback)
+                return;
+
+        ply_label_queue_fallback_redraw (label);
+        ply_label_get_fallback_size (label, &label->fallback_area.width, &label->fallback_area.height);
+        ply_label_queue_fallback_redraw (label);
+}
+
+static void
+ply_label_hide_fallback (ply_label_t *label)
+{
+        ply_label_queue_fallback_redraw (label);
+        label->is_using_fallback = false;
+        label->display = NULL;
+}
+
+static void
+ply_label_draw_fallback_glyph (ply_label_t        *label,
+                               ply_pixel_buffer_t *buffer,
+                               long                x,
+                               long                y,
+                               unsigned char       character)
+{
+        const uint8_t *glyph;
+        ply_rectangle_t dot;
+        int column, row;
+
+        if (character < ' ' || character > '~')
+                character = '?';
+
+        glyph = fallback_glyphs[character - ' '];
+
+        dot.width = FALLBACK_FONT_SCALE;
+        dot.height = FALLBACK_FONT_SCALE;
+        for (column = 0; column < FALLBACK_GLYPH_WIDTH; column++) {
+                for (row = 0; row < FALLBACK_GLYPH_HEIGHT; row++) {
+                        if (!(glyph[column] & (1 << row)))
+                                continue;
+
+                        dot.x = x + column * FALLBACK_FONT_SCALE;
+                        dot.y = y + row * FALLBACK_FONT_SCALE;
+                        ply_pixel_buffer_fill_with_color (buffer, &dot,
+                                                          label->red, label->green,
+                                                          label->blue, label->alpha);
+                }
+        }
+}
+
+static long
+ply_label_get_fallback_line_width (const char *line)
+{
+        long width = 0;
+
+        for (; *line != '\0' && *line != '\n'; line++) {
+                if ((*line & 0xc0) != 0x80)
+                        width += FALLBACK_CELL_WIDTH * FALLBACK_FONT_SCALE;
+        }
+
+        return width;
+}
+
+static void
+ply_label_draw_fallback_area (ply_label_t        *label,
+                              ply_pixel_buffer_t *buffer,
+                              long                x,
+                              long                y,
+                              unsigned long       width,
+                              unsigned long       height)
+{
+        ply_rectangle_t clip_area;
+        const char *character;
+        long line_x, line_y;
+        bool is_start_of_line = true;
+
+        if (label->text == NULL)
+                return;
+
+        clip_area.x = x;
+        clip_area.y = y;
+        clip_area.width = width;
+        clip_area.height = height;
+        ply_pixel_buffer_push_clip_area (buffer, &clip_area);
+
+        line_x = label->fallback_area.x;
+        line_y = label->fallback_area.y;
+        for (character = label->text; *character != '\0'; character++) {
+                if (is_start_of_line) {
+                        long line_width = ply_label_get_fallback_line_width (character);
+
+                        line_x = label->fallback_area.x;
+                        if (label->alignment == PLY_LABEL_ALIGN_CENTER)
+                                line_x += ((long) label->fallback_area.width - line_width) / 2;
+                        else if (label->alignment == PLY_LABEL_ALIGN_RIGHT)
+                                line_x += (long) label->fallback_area.width - line_width;
+                        is_start_of_line = false;
+                }
+
+                if (*character == '\n') {
+                        line_y += FALLBACK_CELL_HEIGHT * FALLBACK_FONT_SCALE;
+                        is_start_of_line = true;
+                        continue;
+                }
+
+                if ((*character & 0xc0) == 0x80)
+                        continue;
+
+                ply_label_draw_fallback_glyph (label, buffer, line_x, line_y, *character);
+                line_x += FALLBACK_CELL_WIDTH * FALLBACK_FONT_SCALE;
+        }
+
+        ply_pixel_buffer_pop_clip_area (buffer);
+}
 
 ply_label_t *
 ply_label_new (void)
 {
         ply_label_t *label;
 
+        start_preloading_plugin ();
+
         label = calloc (1, sizeof(struct _ply_label));
         label->red = 1;
         label->green = 1;
@@ -81,6 +495,12 @@ ply_label_free (ply_label_t *label)
         if (label == NULL)
                 return;
 
+        if (label->is_waiting_for_plugin)
+                ply_event_loop_stop_watching_for_timeout (ply_event_loop_get_default (),
+                                                          (ply_event_loop_timeout_handler_t)
+                                                          on_plugin_preload_poll_timeout,
+                                                          label);
+
         if (label->plugin_interface != NULL) {
                 ply_trace ("Unloading label control plugin");
                 ply_label_unload_plugin (label);
@@ -162,9 +582,13 @@ ply_label_show (ply_label_t         *label,
                 long                 x,
                 long                 y)
 {
-        if (label->plugin_interface == NULL)
+        if (label->plugin_interface == NULL) {
+                if (plugin_is_preloading ())
+                        return ply_label_show_fallback (label, display, x, y);
+
                 if (!ply_label_load_plugin (label))
                         return false;
+        }
 
         return label->plugin_interface->show_control (label->control,
                                                       display, x, y);
@@ -185,6 +609,11 @@ ply_label_draw_area (ply_label_t        *label,
                      unsigned long       width,
                      unsigned long       height)
 {
+        if (label->is_using_fallback) {
+                ply_label_draw_fallback_area (label, buffer, x, y, width, height);
+                return;
+        }
+
         if (label->plugin_interface == NULL)
                 return;
 
@@ -196,6 +625,11 @@ ply_label_draw_area (ply_label_t        *label,
 void
 ply_label_hide (ply_label_t *label)
 {
+        if (label->is_using_fallback) {
+                ply_label_hide_fallback (label);
+                return;
+        }
+
         if (label->plugin_interface == NULL)
                 return;
 
@@ -205,6 +639,9 @@ ply_label_hide (ply_label_t *label)
 bool
 ply_label_is_hidden (ply_label_t *label)
 {
+        if (label->is_using_fallback)
+                return false;
+
         if (label->plugin_interface == NULL)
                 return true;
 
@@ -218,6 +655,8 @@ ply_label_set_text (ply_label_t *label,
         free (label->text);
         label->text = strdup (text);
 
+        ply_label_update_fallback (label);
+
         if (label->plugin_interface == NULL)
                 return;
 
@@ -231,6 +670,8 @@ ply_label_set_alignment (ply_label_t          *label,
 {
         label->alignment = alignment;
 
+        ply_label_update_fallback (label);
+
         if (label->plugin_interface == NULL)
                 return;
 
@@ -244,6 +685,8 @@ ply_label_set_width (ply_label_t *label,
 {
         label->width = width;
 
+        ply_label_update_fallback (label);
+
         if (label->plugin_interface == NULL)
                 return;
 
@@ -266,6 +709,8 @@ ply_label_set_font (ply_label_t *label,
         else
                 label->fontdesc = NULL;
 
+        ply_label_update_fallback (label);
+
         if (label->plugin_interface == NULL)
                 return;
 
@@ -285,6 +730,8 @@ ply_label_set_color (ply_label_t *label,
         label->blue = blue;
         label->alpha = alpha;
 
+        ply_label_update_fallback (label);
+
         if (label->plugin_interface == NULL)
                 return;
 
@@ -298,9 +745,17 @@ ply_label_set_color (ply_label_t *label,
 long
 ply_label_get_width (ply_label_t *label)
 {
-        if (label->plugin_interface == NULL)
+        unsigned long width, height;
+
+        if (label->plugin_interface == NULL) {
+                if (plugin_is_preloading ()) {
+                        ply_label_get_fallback_size (label, &width, &height);
+                        return width;
+                }
+
                 if (!ply_label_load_plugin (label))
                         return 0;
+        }
 
         return label->plugin_interface->get_width_of_control (label->control);
 }
@@ -308,9 +763,17 @@ ply_label_get_width (ply_label_t *label)
 long
 ply_label_get_height (ply_label_t *label)
 {
-        if (label->plugin_interface == NULL)
+        unsigned long width, height;
+
+        if (label->plugin_interface == NULL) {
+                if (plugin_is_preloading ()) {
+                        ply_label_get_fallback_size (label, &width, &height);
+                        return height;
+                }
+
                 if (!ply_label_load_plugin (label))
                         return 0;
+        }
 
         return label->plugin_interface->get_height_of_control (label->control);
 }
@@ -43,6 +43,7 @@
 
 #include "ply-progress-animation.h"
 #include "ply-array.h"
+#include "ply-event-loop.h"
 #include "ply-logger.h"
 #include "ply-image.h"
 #include "ply-utils.h"
@@ -222,7 +223,7 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
             progress_animation->transition != PLY_PROGRESS_ANIMATION_TRANSITION_NONE &&
             progress_animation->transition_duration > 0.0) {
                 progress_animation->is_transitioning = true;
-                progress_animation->transition_start_time = ply_get_timestamp ();
+                progress_animation->transition_start_time = ply_event_loop_get_frame_time (ply_event_loop_get_default ());
         }
 
         frames = (ply_image_t *const *) ply_array_get_pointer_elements (progress_animation->frames);
@@ -237,7 +238,7 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
                 double fade_out_opacity;
                 int width, height;
                 uint32_t *faded_data;
-                now = ply_get_timestamp ();
+                now = ply_event_loop_get_frame_time (ply_event_loop_get_default ());
 
                 fade_percentage = (now - progress_animation->transition_start_time) / progress_animation->transition_duration;
 
@@ -253,6 +254,7 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
 
                         ply_pixel_buffer_free (progress_animation->last_rendered_frame);
                         progress_animation->last_rendered_frame = ply_pixel_buffer_new (width, height);
+                        ply_pixel_buffer_set_owner (progress_animation->last_rendered_frame, "animation");
                         faded_data = ply_pixel_buffer_get_argb32_data (progress_animation->last_rendered_frame);
 
                         image_fade_merge (frames[frame_number - 1], frames[frame_number], fade_percentage, width, height, faded_data);
@@ -262,6 +264,7 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
                                 ply_pixel_buffer_free (progress_animation->last_rendered_frame);
                                 progress_animation->last_rendered_frame = ply_pixel_buffer_new (ply_image_get_width (frames[frame_number - 1]),
                                                                                                 ply_image_get_height (frames[frame_number - 1]));
+                                ply_pixel_buffer_set_owner (progress_animation->last_rendered_frame, "animation");
                                 ply_pixel_buffer_fill_with_buffer (progress_animation->last_rendered_frame,
                                                                    previous_frame_buffer,
                                                                    0,
@@ -292,6 +295,7 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
                 progress_animation->frame_area.height = ply_image_get_height (frames[frame_number]);
                 progress_animation->last_rendered_frame = ply_pixel_buffer_new (progress_animation->frame_area.width,
                                                                                 progress_animation->frame_area.height);
+                ply_pixel_buffer_set_owner (progress_animation->last_rendered_frame, "animation");
 
                 ply_pixel_buffer_fill_with_buffer (progress_animation->last_rendered_frame,
                                                    current_frame_buffer,
@@ -308,33 +312,24 @@ ply_progress_animation_draw (ply_progress_animation_t *progress_animation)
                                      progress_animation->frame_area.height);
 }
 
-static bool
+static void
 ply_progress_animation_add_frame (ply_progress_animation_t *progress_animation,
-                                  const char               *filename)
+                                  ply_image_t              *image)
 {
-        ply_image_t *image;
-
-        image = ply_image_new (filename);
-
-        if (!ply_image_load (image)) {
-                ply_image_free (image);
-                return false;
-        }
-
         ply_array_add_pointer_element (progress_animation->frames, image);
 
         progress_animation->area.width = MAX (progress_animation->area.width, (size_t) ply_image_get_width (image));
         progress_animation->area.height = MAX (progress_animation->area.height, (size_t) ply_image_get_height (image));
-
-        return true;
 }
 
 static bool
 ply_progress_animation_add_frames (ply_progress_animation_t *progress_animation)
 {
         struct dirent **entries;
+        ply_array_t *image_array;
+        ply_image_t **images;
         int number_of_entries;
-        int number_of_frames;
+        int number_of_images;
         int i;
         bool load_finished;
 
@@ -345,7 +340,7 @@ ply_progress_animation_add_frames (ply_progress_animation_t *progress_animation)
         if (number_of_entries < 0)
                 return false;
 
-        load_finished = false;
+        image_array = ply_array_new (PLY_ARRAY_ELEMENT_TYPE_POINTER);
         for (i = 0; i < number_of_entries; i++) {
                 if (strncmp (entries[i]->d_name,
                              progress_animation->frames_prefix,
@@ -353,40 +348,46 @@ ply_progress_animation_add_frames (ply_progress_animation_t *progress_animation)
                     && (strlen (entries[i]->d_name) > 4)
                     && strcmp (entries[i]->d_name + strlen (entries[i]->d_name) - 4, ".png") == 0) {
                         char *filename;
-                        bool r;
 
                         filename = NULL;
                         asprintf (&filename, "%s/%s", progress_animation->image_dir, entries[i]->d_name);
 
-                        r = ply_progress_animation_add_frame (progress_animation, filename);
+                        ply_array_add_pointer_element (image_array, ply_image_new (filename));
+
                         free (filename);
-                        if (!r)
-                                goto out;
                 }
 
                 free (entries[i]);
-                entries[i] = NULL;
         }
+        free (entries);
 
-        number_of_frames = ply_array_get_size (progress_animation->frames);
-        if (number_of_frames == 0) {
+        number_of_images = ply_array_get_size (image_array);
+        images = (ply_image_t **) ply_array_steal_pointer_elements (image_array);
+        ply_array_free (image_array);
+
+        if (number_of_images == 0) {
                 ply_trace ("could not find any progress animation frames");
-                load_finished = false;
-        } else {
-                ply_trace ("found %d progress animation frames", number_of_frames);
-                load_finished = true;
+                free (images);
+                return false;
         }
 
-out:
-        if (!load_finished) {
-                ply_progress_animation_remove_frames (progress_animation);
+        /* Decode all the frames at once so they can be spread over the
+         * worker pool
+         */
+        load_finished = ply_image_load_images (images, number_of_images);
 
-                while (i < number_of_entries) {
-                        free (entries[i]);
-                        i++;
-                }
+        if (load_finished) {
+                ply_trace ("found %d progress animation frames", number_of_images);
+                ply_array_reserve (progress_animation->frames, number_of_images);
         }
-        free (entries);
+
+        for (i = 0; i < number_of_images; i++) {
+                if (load_finished)
+                        ply_progress_animation_add_frame (progress_animation, images[i]);
+                else
+                        ply_image_free (images[i]);
+        }
+        free (images);
 
         return load_finished;
 }
@@ -459,7 +460,18 @@ void
 ply_progress_animation_set_fraction_done (ply_progress_animation_t *progress_animation,
                                           double                    fraction_done)
 {
+        int number_of_frames;
+
         progress_animation->fraction_done = fraction_done;
+
+        /* Nothing to redraw until it's time for another frame, or the
+         * fade to the last one hasn't finished */
+        number_of_frames = ply_array_get_size (progress_animation->frames);
+        if (progress_animation->last_rendered_frame != NULL &&
+            !progress_animation->is_transitioning &&
+            progress_animation->previous_frame_number == (int) (fraction_done * (number_of_frames - 1)))
+                return;
+
         ply_progress_animation_draw (progress_animation);
 }
 
@@ -182,8 +182,26 @@ void
 ply_progress_bar_set_fraction_done (ply_progress_bar_t *progress_bar,
                                     double              fraction_done)
 {
+        unsigned long old_width, new_width;
+
+        old_width = progress_bar->area.width * progress_bar->fraction_done;
+        new_width = progress_bar->area.width * fraction_done;
         progress_bar->fraction_done = fraction_done;
-        ply_progress_bar_draw (progress_bar);
+
+        /* Progress comes in every frame, but mostly moves by less than a
+         * pixel */
+        if (new_width == old_width)
+                return;
+
+        if (progress_bar->is_hidden)
+                return;
+
+        /* Only the sliver between the old and new ends of the fill changes */
+        ply_pixel_display_draw_area (progress_bar->display,
+                                     progress_bar->area.x + MIN (old_width, new_width),
+                                     progress_bar->area.y,
+                                     MAX (old_width, new_width) - MIN (old_width, new_width),
+                                     progress_bar->area.height);
 }
 
 double
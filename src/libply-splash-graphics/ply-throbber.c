@@ -42,11 +42,12 @@
 
 #include "ply-throbber.h"
 #include "ply-event-loop.h"
+#include "ply-frame-clock.h"
 #include "ply-pixel-buffer.h"
 #include "ply-pixel-display.h"
-#include "ply-array.h"
+#include "ply-frame-cache.h"
 #include "ply-logger.h"
-#include "ply-image.h"
+#include "ply-trace-points.h"
 #include "ply-utils.h"
 
 #include <linux/kd.h>
@@ -57,16 +58,20 @@
 
 #ifndef THROBBER_DURATION
 #define THROBBER_DURATION 2.0
+
+PLY_DEFINE_TRACE_POINT (throbber_frame_trace_point,
+                        "throbber %#x: showing frame %d of %d");
 #endif
 
 struct _ply_throbber
 {
-        ply_array_t         *frames;
+        ply_frame_cache_t   *frames;
         ply_event_loop_t    *loop;
         char                *image_dir;
         char                *frames_prefix;
 
         ply_pixel_display_t *display;
+        ply_renderer_plane_t *plane;
         ply_rectangle_t      frame_area;
         ply_trigger_t       *stop_trigger;
 
@@ -75,6 +80,7 @@ struct _ply_throbber
         double               start_time, now;
 
         int                  frame_number;
+        int                  drawn_frame_number; /* -1 when not on the display */
         uint32_t             is_stopped : 1;
 };
 
@@ -91,7 +97,7 @@ ply_throbber_new (const char *image_dir,
 
         throbber = calloc (1, sizeof(ply_throbber_t));
 
-        throbber->frames = ply_array_new (PLY_ARRAY_ELEMENT_TYPE_POINTER);
+        throbber->frames = ply_frame_cache_new ();
         throbber->frames_prefix = strdup (frames_prefix);
         throbber->image_dir = strdup (image_dir);
         throbber->is_stopped = true;
@@ -102,23 +108,11 @@ ply_throbber_new (const char *image_dir,
         throbber->frame_area.x = 0;
         throbber->frame_area.y = 0;
         throbber->frame_number = 0;
+        throbber->drawn_frame_number = -1;
 
         return throbber;
 }
 
-static void
-ply_throbber_remove_frames (ply_throbber_t *throbber)
-{
-        int i;
-        ply_pixel_buffer_t **frames;
-
-        frames = (ply_pixel_buffer_t **) ply_array_steal_pointer_elements (throbber->frames);
-        for (i = 0; frames[i] != NULL; i++) {
-                ply_pixel_buffer_free (frames[i]);
-        }
-        free (frames);
-}
-
 void
 ply_throbber_free (ply_throbber_t *throbber)
 {
@@ -128,8 +122,7 @@ ply_throbber_free (ply_throbber_t *throbber)
         if (!throbber->is_stopped)
                 ply_throbber_stop_now (throbber, false);
 
-        ply_throbber_remove_frames (throbber);
-        ply_array_free (throbber->frames);
+        ply_frame_cache_free (throbber->frames);
 
         free (throbber->frames_prefix);
         free (throbber->image_dir);
@@ -141,12 +134,12 @@ animate_at_time (ply_throbber_t *throbber,
                  double          time)
 {
         int number_of_frames;
-        ply_pixel_buffer_t *const *frames;
+        ply_pixel_buffer_t *frame;
         bool should_continue;
         double percent_in_sequence;
         int last_frame_number;
 
-        number_of_frames = ply_array_get_size (throbber->frames);
+        number_of_frames = ply_frame_cache_get_number_of_frames (throbber->frames);
 
         if (number_of_frames == 0)
                 return true;
@@ -167,135 +160,152 @@ animate_at_time (ply_throbber_t *throbber,
                         should_continue = false;
         }
 
-        frames = (ply_pixel_buffer_t *const *) ply_array_get_pointer_elements (throbber->frames);
-        ply_pixel_buffer_get_size (frames[throbber->frame_number], &throbber->frame_area);
+        ply_trace_point (throbber_frame_trace_point,
+                         (intptr_t) throbber, throbber->frame_number, number_of_frames);
+
+        frame = ply_frame_cache_get_frame (throbber->frames, throbber->frame_number);
+        if (frame == NULL)
+                return should_continue;
+
+        ply_frame_cache_prefetch_frame (throbber->frames,
+                                        (throbber->frame_number + 1) % number_of_frames);
+
+        ply_pixel_buffer_get_size (frame, &throbber->frame_area);
         throbber->frame_area.x = throbber->x;
         throbber->frame_area.y = throbber->y;
+
+        if (throbber->plane != NULL &&
+            !ply_pixel_display_show_image_on_plane (throbber->display, throbber->plane,
+                                                    frame,
+                                                    throbber->x, throbber->y)) {
+                ply_trace ("could not show throbber frame on plane, drawing it instead");
+                ply_pixel_display_free_plane (throbber->display, throbber->plane);
+                throbber->plane = NULL;
+        }
+
+        if (throbber->plane == NULL) {
+                ply_rectangle_t changed_area;
+
+                /* Only the pixels that differ from the frame on the
+                 * display need drawing again
+                 */
+                ply_frame_cache_get_changed_area (throbber->frames,
+                                                  throbber->drawn_frame_number,
+                                                  throbber->frame_number,
+                                                  &changed_area);
+                ply_pixel_display_draw_area (throbber->display,
+                                             throbber->x + changed_area.x,
+                                             throbber->y + changed_area.y,
+                                             changed_area.width,
+                                             changed_area.height);
+                throbber->drawn_frame_number = throbber->frame_number;
+        }
+
+        return should_continue;
+}
+
+/* Draws the frame on the plane into the display before letting the
+ * plane go, so the last frame stays up without a gap
+ */
+static void
+ply_throbber_release_plane (ply_throbber_t *throbber)
+{
+        ply_renderer_plane_t *plane;
+
+        if (throbber->plane == NULL)
+                return;
+
+        plane = throbber->plane;
+        throbber->plane = NULL;
         ply_pixel_display_draw_area (throbber->display,
                                      throbber->x, throbber->y,
                                      throbber->frame_area.width,
                                      throbber->frame_area.height);
-
-        return should_continue;
+        ply_pixel_display_free_plane (throbber->display, plane);
 }
 
 static void
-on_timeout (ply_throbber_t *throbber)
+on_frame (ply_throbber_t *throbber)
 {
-        double sleep_time;
         bool should_continue;
 
-        throbber->now = ply_get_timestamp ();
+        throbber->now = ply_event_loop_get_frame_time (throbber->loop);
 
         should_continue = animate_at_time (throbber,
                                            throbber->now - throbber->start_time);
 
-        sleep_time = 1.0 / FRAMES_PER_SECOND;
-        sleep_time = MAX (sleep_time - (ply_get_timestamp () - throbber->now),
-                          0.005);
-
         if (!should_continue) {
+                ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                          (ply_frame_clock_handler_t)
+                                                          on_frame, throbber);
+                ply_throbber_release_plane (throbber);
                 throbber->is_stopped = true;
                 if (throbber->stop_trigger != NULL) {
                         ply_trigger_pull (throbber->stop_trigger, NULL);
                         throbber->stop_trigger = NULL;
                 }
-        } else {
-                ply_event_loop_watch_for_timeout (throbber->loop,
-                                                  sleep_time,
-                                                  (ply_event_loop_timeout_handler_t)
-                                                  on_timeout, throbber);
         }
 }
 
-static bool
-ply_throbber_add_frame (ply_throbber_t *throbber,
-                        const char     *filename)
+void
+ply_throbber_set_prescale_frames (ply_throbber_t *throbber,
+                                  bool            should_prescale)
 {
-        ply_image_t *image;
-        ply_pixel_buffer_t *frame;
-
-        image = ply_image_new (filename);
-
-        if (!ply_image_load (image)) {
-                ply_image_free (image);
-                return false;
-        }
-
-        frame = ply_image_convert_to_pixel_buffer (image);
-
-        ply_array_add_pointer_element (throbber->frames, frame);
-
-        throbber->width = MAX (throbber->width, (long) ply_pixel_buffer_get_width (frame));
-        throbber->height = MAX (throbber->height, (long) ply_pixel_buffer_get_height (frame));
-
-        return true;
+        ply_frame_cache_set_prescale_frames (throbber->frames, should_prescale);
 }
 
-static bool
-ply_throbber_add_frames (ply_throbber_t *throbber)
+void
+ply_throbber_set_maximum_resident_frames (ply_throbber_t *throbber,
+                                          int             maximum_resident_frames)
 {
-        struct dirent **entries;
-        int number_of_entries;
-        int i;
-        bool load_finished;
-
-        entries = NULL;
-
-        number_of_entries = scandir (throbber->image_dir, &entries, NULL, versionsort);
-
-        if (number_of_entries <= 0)
-                return false;
-
-        load_finished = false;
-        for (i = 0; i < number_of_entries; i++) {
-                if (strncmp (entries[i]->d_name,
-                             throbber->frames_prefix,
-                             strlen (throbber->frames_prefix)) == 0
-                    && (strlen (entries[i]->d_name) > 4)
-                    && strcmp (entries[i]->d_name + strlen (entries[i]->d_name) - 4, ".png") == 0) {
-                        char *filename;
-
-                        filename = NULL;
-                        asprintf (&filename, "%s/%s", throbber->image_dir, entries[i]->d_name);
-
-                        if (!ply_throbber_add_frame (throbber, filename))
-                                goto out;
-
-                        free (filename);
-                }
+        ply_frame_cache_clear (throbber->frames);
+        ply_frame_cache_set_maximum_resident_frames (throbber->frames,
+                                                     maximum_resident_frames);
+}
 
-                free (entries[i]);
-                entries[i] = NULL;
-        }
-        load_finished = true;
+void
+ply_throbber_share_frames (ply_throbber_t *throbber,
+                           ply_throbber_t *source)
+{
+        ply_frame_cache_t *frames;
 
-out:
-        if (!load_finished) {
-                ply_throbber_remove_frames (throbber);
+        frames = ply_frame_cache_ref (source->frames);
+        ply_frame_cache_free (throbber->frames);
+        throbber->frames = frames;
 
-                while (entries[i] != NULL) {
-                        free (entries[i]);
-                        i++;
-                }
-        }
-        free (entries);
+        /* so reloading, say with fewer resident frames, gets the same ones */
+        free (throbber->image_dir);
+        free (throbber->frames_prefix);
+        throbber->image_dir = strdup (source->image_dir);
+        throbber->frames_prefix = strdup (source->frames_prefix);
 
-        return (ply_array_get_size (throbber->frames) > 0);
+        throbber->width = source->width;
+        throbber->height = source->height;
 }
 
 bool
 ply_throbber_load (ply_throbber_t *throbber)
 {
-        if (ply_array_get_size (throbber->frames) != 0)
-                ply_throbber_remove_frames (throbber);
-
-        if (!ply_throbber_add_frames (throbber))
+        if (!ply_frame_cache_load (throbber->frames,
+                                   throbber->image_dir,
+                                   throbber->frames_prefix))
                 return false;
 
+        throbber->width = ply_frame_cache_get_width (throbber->frames);
+        throbber->height = ply_frame_cache_get_height (throbber->frames);
+
         return true;
 }
 
+void
+ply_throbber_drop_frames (ply_throbber_t *throbber)
+{
+        if (!throbber->is_stopped)
+                return;
+
+        ply_frame_cache_drop_frames (throbber->frames);
+}
+
 bool
 ply_throbber_start (ply_throbber_t      *throbber,
                     ply_event_loop_t    *loop,
@@ -313,12 +323,19 @@ ply_throbber_start (ply_throbber_t      *throbber,
         throbber->x = x;
         throbber->y = y;
 
-        throbber->start_time = ply_get_timestamp ();
+        throbber->start_time = ply_event_loop_get_frame_time (throbber->loop);
+        throbber->drawn_frame_number = -1;
 
-        ply_event_loop_watch_for_timeout (throbber->loop,
-                                          1.0 / FRAMES_PER_SECOND,
-                                          (ply_event_loop_timeout_handler_t)
-                                          on_timeout, throbber);
+        throbber->plane = ply_pixel_display_create_plane (display,
+                                                          throbber->width,
+                                                          throbber->height);
+        if (throbber->plane != NULL)
+                ply_trace ("showing throbber on a hardware plane");
+
+        ply_frame_clock_watch_for_frames (ply_frame_clock_get_default (),
+                                          FRAMES_PER_SECOND,
+                                          (ply_frame_clock_handler_t)
+                                          on_frame, throbber);
 
         return true;
 }
@@ -328,6 +345,11 @@ ply_throbber_stop_now (ply_throbber_t *throbber, bool redraw)
 {
         throbber->is_stopped = true;
 
+        if (throbber->plane != NULL) {
+                ply_pixel_display_free_plane (throbber->display, throbber->plane);
+                throbber->plane = NULL;
+        }
+
         if (redraw) {
                 ply_pixel_display_draw_area (throbber->display,
                                              throbber->x,
@@ -337,9 +359,9 @@ ply_throbber_stop_now (ply_throbber_t *throbber, bool redraw)
         }
 
         if (throbber->loop != NULL) {
-                ply_event_loop_stop_watching_for_timeout (throbber->loop,
-                                                          (ply_event_loop_timeout_handler_t)
-                                                          on_timeout, throbber);
+                ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                          (ply_frame_clock_handler_t)
+                                                          on_frame, throbber);
                 throbber->loop = NULL;
         }
         throbber->display = NULL;
@@ -380,14 +402,18 @@ ply_throbber_draw_area (ply_throbber_t     *throbber,
                         unsigned long       width,
                         unsigned long       height)
 {
-        ply_pixel_buffer_t *const *frames;
+        ply_pixel_buffer_t *frame;
+
+        if (throbber->is_stopped || throbber->plane != NULL)
+                return;
 
-        if (throbber->is_stopped)
+        frame = ply_frame_cache_get_frame_for_device_scale (throbber->frames, throbber->frame_number,
+                                                            ply_pixel_buffer_get_device_scale (buffer));
+        if (frame == NULL)
                 return;
 
-        frames = (ply_pixel_buffer_t *const *) ply_array_get_pointer_elements (throbber->frames);
         ply_pixel_buffer_fill_with_buffer (buffer,
-                                           frames[throbber->frame_number],
+                                           frame,
                                            throbber->x,
                                            throbber->y);
 }
@@ -38,7 +38,26 @@ ply_throbber_t *ply_throbber_new (const char *image_dir,
                                   const char *frames_prefix);
 void ply_throbber_free (ply_throbber_t *throbber);
 
+/* Decode frames as they are needed, keeping at most this many around,
+ * instead of all of them up front.  Takes effect on the next load.
+ */
+/* Scale frames up to the display's device scale once, the first time
+ * each one is drawn, instead of every time
+ */
+void ply_throbber_set_prescale_frames (ply_throbber_t *throbber,
+                                       bool            should_prescale);
+void ply_throbber_set_maximum_resident_frames (ply_throbber_t *throbber,
+                                               int             maximum_resident_frames);
 bool ply_throbber_load (ply_throbber_t *throbber);
+/* Draws the frames another throbber loaded instead of loading them
+ * again; use in place of ply_throbber_load ()
+ */
+void ply_throbber_share_frames (ply_throbber_t *throbber,
+                                ply_throbber_t *source);
+/* Frees the decoded frames while the throbber isn't running; they get
+ * decoded again as they're drawn
+ */
+void ply_throbber_drop_frames (ply_throbber_t *throbber);
 bool ply_throbber_start (ply_throbber_t      *throbber,
                          ply_event_loop_t    *loop,
                          ply_pixel_display_t *display,
@@ -27,17 +27,42 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "ply-buffer.h"
-
-static const void *pointer_terminator = NULL;
-static const uint32_t uint32_terminator = 0;
+/* Room for this many pointers (or twice as many uint32s) is kept inside
+ * the array itself, so short arrays never touch the heap.  One slot is
+ * always taken by the terminator.
+ */
+#define PLY_ARRAY_INLINE_CAPACITY 8
 
 struct _ply_array
 {
-        ply_buffer_t            *buffer;
+        char                    *elements;
+        size_t                   element_size;
+        int                      number_of_elements;
+        int                      capacity; /* in elements, terminator included */
         ply_array_element_type_t element_type;
+
+        union
+        {
+                void    *pointers[PLY_ARRAY_INLINE_CAPACITY];
+                uint32_t uint32s[PLY_ARRAY_INLINE_CAPACITY * sizeof(void *) / sizeof(uint32_t)];
+        } inline_elements;
 };
 
+static void
+ply_array_reset (ply_array_t *array)
+{
+        array->elements = (char *) &array->inline_elements;
+        array->capacity = sizeof(array->inline_elements) / array->element_size;
+        array->number_of_elements = 0;
+        memset (array->elements, 0, array->element_size);
+}
+
+static bool
+ply_array_is_inline (ply_array_t *array)
+{
+        return array->elements == (char *) &array->inline_elements;
+}
+
 ply_array_t *
 ply_array_new (ply_array_element_type_t element_type)
 {
@@ -45,19 +70,20 @@ ply_array_new (ply_array_element_type_t element_type)
 
         array = calloc (1, sizeof(ply_array_t));
 
-        array->buffer = ply_buffer_new ();
         array->element_type = element_type;
 
         switch (array->element_type) {
         case PLY_ARRAY_ELEMENT_TYPE_POINTER:
-                ply_buffer_append_bytes (array->buffer, &pointer_terminator, sizeof(pointer_terminator));
+                array->element_size = sizeof(void *);
                 break;
 
         case PLY_ARRAY_ELEMENT_TYPE_UINT32:
-                ply_buffer_append_bytes (array->buffer, &uint32_terminator, sizeof(uint32_terminator));
+                array->element_size = sizeof(uint32_t);
                 break;
         }
 
+        ply_array_reset (array);
+
         return array;
 }
 
@@ -67,7 +93,8 @@ ply_array_free (ply_array_t *array)
         if (array == NULL)
                 return;
 
-        ply_buffer_free (array->buffer);
+        if (!ply_array_is_inline (array))
+                free (array->elements);
 
         free (array);
 }
@@ -75,39 +102,76 @@ ply_array_free (ply_array_t *array)
 int
 ply_array_get_size (ply_array_t *array)
 {
-        int size;
-
         assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_POINTER ||
                 array->element_type == PLY_ARRAY_ELEMENT_TYPE_UINT32);
 
-        switch (array->element_type) {
-        case PLY_ARRAY_ELEMENT_TYPE_POINTER:
-                size = (ply_buffer_get_size (array->buffer) / sizeof(const void *)) - 1;
-                break;
+        return array->number_of_elements;
+}
 
-        case PLY_ARRAY_ELEMENT_TYPE_UINT32:
-                size = (ply_buffer_get_size (array->buffer) / sizeof(const uint32_t)) - 1;
-                break;
+int
+ply_array_get_capacity (ply_array_t *array)
+{
+        return array->capacity - 1;
+}
+
+static void
+ply_array_resize (ply_array_t *array,
+                  int          capacity)
+{
+        char *elements;
+        size_t size;
+
+        size = (array->number_of_elements + 1) * array->element_size;
+
+        if (ply_array_is_inline (array)) {
+                elements = malloc (capacity * array->element_size);
+                memcpy (elements, array->elements, size);
+        } else {
+                elements = realloc (array->elements, capacity * array->element_size);
         }
 
-        return size;
+        array->elements = elements;
+        array->capacity = capacity;
 }
 
 void
-ply_array_add_pointer_element (ply_array_t *array,
-                               const void  *data)
+ply_array_reserve (ply_array_t *array,
+                   int          number_of_elements)
 {
-        assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_POINTER);
+        if (number_of_elements + 1 <= array->capacity)
+                return;
 
-        /* Temporarily remove NULL terminator
-         */
-        ply_buffer_remove_bytes_at_end (array->buffer, sizeof(pointer_terminator));
+        ply_array_resize (array, number_of_elements + 1);
+}
 
-        ply_buffer_append_bytes (array->buffer, &data, sizeof(const void *));
+static void *
+ply_array_add_element_slot (ply_array_t *array)
+{
+        void *slot;
 
-        /* Add NULL terminator back
+        /* Grow by doubling so filling an array one element at a time
+         * only reallocates a handful of times
          */
-        ply_buffer_append_bytes (array->buffer, &pointer_terminator, sizeof(pointer_terminator));
+        if (array->number_of_elements + 2 > array->capacity)
+                ply_array_resize (array, array->capacity * 2);
+
+        slot = array->elements + array->number_of_elements * array->element_size;
+        array->number_of_elements++;
+
+        /* Keep the array terminated */
+        memset (array->elements + array->number_of_elements * array->element_size,
+                0, array->element_size);
+
+        return slot;
+}
+
+void
+ply_array_add_pointer_element (ply_array_t *array,
+                               const void  *data)
+{
+        assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_POINTER);
+
+        memcpy (ply_array_add_element_slot (array), &data, sizeof(const void *));
 }
 
 void
@@ -116,71 +180,90 @@ ply_array_add_uint32_element (ply_array_t   *array,
 {
         assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_UINT32);
 
-        /* Temporarily remove 0 terminator
-         */
-        ply_buffer_remove_bytes_at_end (array->buffer, sizeof(uint32_terminator));
-
-        ply_buffer_append_bytes (array->buffer, &data, sizeof(const uint32_t));
-
-        /* Add 0 terminator back
-         */
-        ply_buffer_append_bytes (array->buffer, &uint32_terminator, sizeof(uint32_terminator));
+        memcpy (ply_array_add_element_slot (array), &data, sizeof(const uint32_t));
 }
 
 void *const *
 ply_array_get_pointer_elements (ply_array_t *array)
 {
         assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_POINTER);
-        return (void *const *) ply_buffer_get_bytes (array->buffer);
+        return (void *const *) array->elements;
 }
 
 uint32_t const *
 ply_array_get_uint32_elements (ply_array_t *array)
 {
         assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_UINT32);
-        return (uint32_t const *) ply_buffer_get_bytes (array->buffer);
+        return (uint32_t const *) array->elements;
 }
 
-void **
-ply_array_steal_pointer_elements (ply_array_t *array)
+void *
+ply_array_get_pointer_element (ply_array_t *array,
+                               int          index)
 {
-        void **data;
-
         assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_POINTER);
+        assert (index >= 0 && index < array->number_of_elements);
 
-        data = (void **) ply_buffer_steal_bytes (array->buffer);
+        return ((void **) array->elements)[index];
+}
 
-        ply_buffer_append_bytes (array->buffer, &pointer_terminator, sizeof(const void *));
+uint32_t
+ply_array_get_uint32_element (ply_array_t *array,
+                              int          index)
+{
+        assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_UINT32);
+        assert (index >= 0 && index < array->number_of_elements);
 
-        return data;
+        return ((uint32_t *) array->elements)[index];
 }
 
-uint32_t *
-ply_array_steal_uint32_elements (ply_array_t *array)
+static void *
+ply_array_steal_elements (ply_array_t *array)
 {
-        uint32_t *data;
+        void *data;
 
-        assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_UINT32);
+        if (ply_array_is_inline (array)) {
+                size_t size;
 
-        data = (uint32_t *) ply_buffer_steal_bytes (array->buffer);
+                size = (array->number_of_elements + 1) * array->element_size;
+                data = malloc (size);
+                memcpy (data, array->elements, size);
+        } else {
+                data = array->elements;
+        }
 
-        ply_buffer_append_bytes (array->buffer, &uint32_terminator, sizeof(const uint32_t));
+        ply_array_reset (array);
 
         return data;
 }
 
+void **
+ply_array_steal_pointer_elements (ply_array_t *array)
+{
+        assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_POINTER);
+
+        return (void **) ply_array_steal_elements (array);
+}
+
+uint32_t *
+ply_array_steal_uint32_elements (ply_array_t *array)
+{
+        assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_UINT32);
+
+        return (uint32_t *) ply_array_steal_elements (array);
+}
+
 bool
 ply_array_contains_uint32_element (ply_array_t *array, const uint32_t element)
 {
         uint32_t const *elements;
-        int i, size;
+        int i;
 
         assert (array->element_type == PLY_ARRAY_ELEMENT_TYPE_UINT32);
 
-        elements = (uint32_t const *) ply_buffer_get_bytes (array->buffer);
-        size = (ply_buffer_get_size (array->buffer) / sizeof(const uint32_t)) - 1;
+        elements = (uint32_t const *) array->elements;
 
-        for (i = 0; i < size; i++)
+        for (i = 0; i < array->number_of_elements; i++)
                 if (elements[i] == element)
                         return true;
 
@@ -38,12 +38,24 @@ enum _ply_array_element_type
 ply_array_t *ply_array_new (ply_array_element_type_t element_type);
 void ply_array_free (ply_array_t *array);
 int ply_array_get_size (ply_array_t *array);
+
+/* How many elements fit before the array has to grow again.  Callers
+ * that know how big an array will get can reserve the room up front.
+ */
+int ply_array_get_capacity (ply_array_t *array);
+void ply_array_reserve (ply_array_t *array,
+                        int          number_of_elements);
+
 void ply_array_add_pointer_element (ply_array_t *array,
                                     const void  *element);
 void ply_array_add_uint32_element (ply_array_t   *array,
                                    const uint32_t element);
 void *const *ply_array_get_pointer_elements (ply_array_t *array);
 uint32_t const *ply_array_get_uint32_elements (ply_array_t *array);
+void *ply_array_get_pointer_element (ply_array_t *array,
+                                     int          index);
+uint32_t ply_array_get_uint32_element (ply_array_t *array,
+                                       int          index);
 void **ply_array_steal_pointer_elements (ply_array_t *array);
 
 uint32_t *ply_array_steal_uint32_elements (ply_array_t *array);
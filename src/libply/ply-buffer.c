@@ -46,13 +46,29 @@
 #define PLY_BUFFER_MAX_BUFFER_CAPACITY (255 * 4096)
 #endif
 
+/* The bytes are kept contiguous and nul terminated, starting at
+ * data + start.  Taking bytes off the front just moves start along;
+ * the space it leaves behind gets reclaimed the next time the end
+ * runs out of room.
+ */
 struct _ply_buffer
 {
         char  *data;
+        size_t start;
         size_t size;
         size_t capacity;
 };
 
+static void
+ply_buffer_move_bytes_to_front (ply_buffer_t *buffer)
+{
+        if (buffer->start == 0)
+                return;
+
+        memmove (buffer->data, buffer->data + buffer->start, buffer->size + 1);
+        buffer->start = 0;
+}
+
 static bool
 ply_buffer_increase_capacity (ply_buffer_t *buffer)
 {
@@ -67,6 +83,34 @@ ply_buffer_increase_capacity (ply_buffer_t *buffer)
         return true;
 }
 
+/* Makes room for length more bytes, plus the nul, at the end.  Space
+ * freed at the front is reused once it's a good part of the buffer, so
+ * trickling bytes through a big buffer doesn't move it all every time.
+ */
+static void
+ply_buffer_make_room (ply_buffer_t *buffer,
+                      size_t        length)
+{
+        while ((buffer->start + buffer->size + length) >= buffer->capacity) {
+                if (buffer->start > 0 &&
+                    (buffer->size + length) < buffer->capacity &&
+                    buffer->start >= buffer->capacity / 4) {
+                        ply_buffer_move_bytes_to_front (buffer);
+                        continue;
+                }
+
+                if (ply_buffer_increase_capacity (buffer))
+                        continue;
+
+                if (buffer->start > 0 && (buffer->size + length) < buffer->capacity) {
+                        ply_buffer_move_bytes_to_front (buffer);
+                        continue;
+                }
+
+                ply_buffer_remove_bytes (buffer, length);
+        }
+}
+
 void
 ply_buffer_remove_bytes (ply_buffer_t *buffer,
                          size_t        bytes_to_remove)
@@ -76,13 +120,13 @@ ply_buffer_remove_bytes (ply_buffer_t *buffer,
         bytes_to_remove = MIN (buffer->size, bytes_to_remove);
 
         if (bytes_to_remove == buffer->size) {
+                buffer->start = 0;
                 buffer->size = 0;
         } else {
-                memmove (buffer->data, buffer->data + bytes_to_remove,
-                         buffer->size - bytes_to_remove);
+                buffer->start += bytes_to_remove;
                 buffer->size -= bytes_to_remove;
         }
-        buffer->data[buffer->size] = '\0';
+        buffer->data[buffer->start + buffer->size] = '\0';
 }
 
 void
@@ -94,7 +138,7 @@ ply_buffer_remove_bytes_at_end (ply_buffer_t *buffer,
         bytes_to_remove = MIN (buffer->size, bytes_to_remove);
 
         buffer->size -= bytes_to_remove;
-        buffer->data[buffer->size] = '\0';
+        buffer->data[buffer->start + buffer->size] = '\0';
 }
 
 ply_buffer_t *
@@ -190,25 +234,51 @@ ply_buffer_append_bytes (ply_buffer_t *buffer,
                 length = (PLY_BUFFER_MAX_BUFFER_CAPACITY - 1);
         }
 
-        while ((buffer->size + length) >= buffer->capacity) {
-                if (!ply_buffer_increase_capacity (buffer))
-                        ply_buffer_remove_bytes (buffer, length);
-        }
+        ply_buffer_make_room (buffer, length);
 
-        assert (buffer->size + length < buffer->capacity);
+        assert (buffer->start + buffer->size + length < buffer->capacity);
 
-        memcpy (buffer->data + buffer->size,
+        memcpy (buffer->data + buffer->start + buffer->size,
                 bytes, length);
 
         buffer->size += length;
-        buffer->data[buffer->size] = '\0';
+        buffer->data[buffer->start + buffer->size] = '\0';
+}
+
+void *
+ply_buffer_get_writable_region (ply_buffer_t *buffer,
+                                size_t        minimum_size,
+                                size_t       *size)
+{
+        assert (buffer != NULL);
+        assert (minimum_size != 0);
+        assert (size != NULL);
+
+        minimum_size = MIN (minimum_size, PLY_BUFFER_MAX_BUFFER_CAPACITY - 1);
+
+        ply_buffer_make_room (buffer, minimum_size);
+
+        *size = buffer->capacity - (buffer->start + buffer->size) - 1;
+        return buffer->data + buffer->start + buffer->size;
+}
+
+void
+ply_buffer_commit (ply_buffer_t *buffer,
+                   size_t        number_of_bytes)
+{
+        assert (buffer != NULL);
+        assert (buffer->start + buffer->size + number_of_bytes < buffer->capacity);
+
+        buffer->size += number_of_bytes;
+        buffer->data[buffer->start + buffer->size] = '\0';
 }
 
 void
 ply_buffer_append_from_fd (ply_buffer_t *buffer,
                            int           fd)
 {
-        char bytes[PLY_BUFFER_MAX_APPEND_SIZE] = "";
+        void *region;
+        size_t region_size;
         ssize_t bytes_read;
 
         assert (buffer != NULL);
@@ -217,17 +287,19 @@ ply_buffer_append_from_fd (ply_buffer_t *buffer,
         if (!ply_fd_has_data (fd))
                 return;
 
-        bytes_read = read (fd, bytes, sizeof(bytes));
+        region = ply_buffer_get_writable_region (buffer, PLY_BUFFER_MAX_APPEND_SIZE,
+                                                 &region_size);
+        bytes_read = read (fd, region, region_size);
 
         if (bytes_read > 0)
-                ply_buffer_append_bytes (buffer, bytes, bytes_read);
+                ply_buffer_commit (buffer, bytes_read);
 }
 
 const char *
 ply_buffer_get_bytes (ply_buffer_t *buffer)
 {
         assert (buffer != NULL);
-        return buffer->data;
+        return buffer->data + buffer->start;
 }
 
 char *
@@ -237,6 +309,7 @@ ply_buffer_steal_bytes (ply_buffer_t *buffer)
 
         assert (buffer != NULL);
 
+        ply_buffer_move_bytes_to_front (buffer);
         bytes = buffer->data;
 
         buffer->data = calloc (1, buffer->capacity);
@@ -255,6 +328,7 @@ void
 ply_buffer_clear (ply_buffer_t *buffer)
 {
         memset (buffer->data, '\0', buffer->capacity);
+        buffer->start = 0;
         buffer->size = 0;
 }
 
@@ -37,6 +37,17 @@ void ply_buffer_append_bytes (ply_buffer_t *buffer,
 
 void ply_buffer_append_from_fd (ply_buffer_t *buffer,
                                 int           fd);
+
+/* For reading straight into the buffer: returns where at least
+ * minimum_size bytes can go, with how much room there is in size.
+ * Nothing is part of the buffer until ply_buffer_commit says how many
+ * of those bytes got filled in.
+ */
+void *ply_buffer_get_writable_region (ply_buffer_t *buffer,
+                                      size_t        minimum_size,
+                                      size_t       *size);
+void ply_buffer_commit (ply_buffer_t *buffer,
+                        size_t        number_of_bytes);
 #define ply_buffer_append(buffer, format, args ...)                             \
         ply_buffer_append_with_non_literal_format_string (buffer,              \
                                                           format "", ## args)
@@ -23,9 +23,11 @@
 #include "ply-event-loop.h"
 
 #include <assert.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -34,11 +36,15 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/termios.h>
 #include <unistd.h>
 
+#include "ply-hashtable.h"
 #include "ply-logger.h"
 #include "ply-list.h"
+#include "ply-statistics.h"
 #include "ply-utils.h"
 
 #ifndef PLY_EVENT_LOOP_NUM_EVENT_HANDLERS
@@ -49,6 +55,12 @@
 #define PLY_EVENT_LOOP_NO_TIMED_WAKEUP 0.0
 #endif
 
+/* bucket 0 is under a microsecond, bucket n is [2^(n-1), 2^n) microseconds,
+ * and the last one takes everything from about 16 seconds up */
+#ifndef PLY_EVENT_LOOP_NUMBER_OF_LATENCY_BUCKETS
+#define PLY_EVENT_LOOP_NUMBER_OF_LATENCY_BUCKETS 26
+#endif
+
 typedef struct
 {
         int         fd;
@@ -89,6 +101,13 @@ static int ply_signal_dispatcher_sender_fd = -1,
 typedef struct
 {
         ply_list_t *sources;
+
+        /* Watched signals are blocked and read from a signalfd.  The
+         * self-pipe is still there for when signalfd isn't available, or
+         * a signal lands on a thread that doesn't have them blocked.
+         */
+        int         signal_fd;
+        sigset_t    watched_signals;
 } ply_signal_dispatcher_t;
 
 typedef struct
@@ -98,11 +117,39 @@ typedef struct
 } ply_event_loop_exit_closure_t;
 
 typedef struct
+{
+        ply_event_loop_idle_handler_t handler;
+        void                         *user_data;
+
+        /* closures queued while idle handlers run wait for the next pass */
+        unsigned long                 generation;
+} ply_event_loop_idle_closure_t;
+
+typedef struct _ply_event_loop_timeout_watch ply_event_loop_timeout_watch_t;
+
+struct _ply_event_loop_timeout_watch
 {
         double                           timeout;
         ply_event_loop_timeout_handler_t handler;
         void                            *user_data;
-} ply_event_loop_timeout_watch_t;
+
+        /* position in the timeout heap, and order of creation so watches
+         * due at the same time fire in the order they were added */
+        size_t                           heap_index;
+        unsigned long                    sequence;
+
+        /* other watches with the same handler and user data */
+        ply_event_loop_timeout_watch_t  *next_duplicate;
+};
+
+typedef struct
+{
+        void         *handler;
+        unsigned long number_of_calls;
+        double        total_time;
+        double        longest_time;
+        unsigned long latency_buckets[PLY_EVENT_LOOP_NUMBER_OF_LATENCY_BUCKETS];
+} ply_event_loop_handler_profile_t;
 
 struct _ply_event_loop
 {
@@ -110,17 +157,52 @@ struct _ply_event_loop
         int                      exit_code;
         double                   wakeup_time;
 
+        /* armed to wakeup_time, so epoll_wait doesn't need a timeout */
+        int                      timer_fd;
+        ply_fd_watch_t          *timer_fd_watch;
+        double                   armed_wakeup_time;
+
         ply_list_t              *sources;
         ply_list_t              *exit_closures;
-        ply_list_t              *timeout_watches;
+
+        /* run once, after fd events and timeouts, then forgotten */
+        ply_list_t              *idle_closures;
+        unsigned long            idle_generation;
+
+        /* list nodes of sources, keyed by fd */
+        ply_hashtable_t         *source_index;
+
+        /* binary min-heap of timeout watches ordered by deadline, plus
+         * an index by handler and user data for removing them */
+        ply_event_loop_timeout_watch_t **timeout_heap;
+        size_t                   number_of_timeout_watches;
+        size_t                   timeout_heap_size;
+        unsigned long            next_timeout_sequence;
+        ply_hashtable_t         *timeout_watch_index;
 
         ply_signal_dispatcher_t *signal_dispatcher;
 
+        /* ply_event_loop_handler_profile_t's keyed by handler */
+        ply_hashtable_t         *handler_profiles;
+
+        /* how long the loop has sat blocked in epoll_wait */
+        double                   time_spent_waiting;
+
+        /* when the iteration being handled woke up, or 0 between them */
+        double                   frame_time;
+
         uint32_t                 should_exit : 1;
+        uint32_t                 is_profiling : 1;
 };
 
 static void ply_event_loop_remove_source (ply_event_loop_t   *loop,
                                           ply_event_source_t *source);
+static unsigned int ply_event_loop_timeout_watch_hash (void *element);
+static void ply_event_loop_on_timer (ply_event_loop_t *loop,
+                                     int               fd);
+static void ply_event_loop_free_idle_closures (ply_event_loop_t *loop);
+static int ply_event_loop_timeout_watch_compare (void *elementa,
+                                                 void *elementb);
 static ply_list_node_t *ply_event_loop_find_source_node (ply_event_loop_t *loop,
                                                          int               fd);
 
@@ -166,6 +248,8 @@ ply_signal_dispatcher_new (void)
         dispatcher = calloc (1, sizeof(ply_signal_dispatcher_t));
 
         dispatcher->sources = ply_list_new ();
+        dispatcher->signal_fd = -1;
+        sigemptyset (&dispatcher->watched_signals);
 
         return dispatcher;
 }
@@ -183,6 +267,11 @@ ply_signal_dispatcher_free (ply_signal_dispatcher_t *dispatcher)
         close (ply_signal_dispatcher_sender_fd);
         ply_signal_dispatcher_sender_fd = -1;
 
+        if (dispatcher->signal_fd >= 0) {
+                close (dispatcher->signal_fd);
+                pthread_sigmask (SIG_UNBLOCK, &dispatcher->watched_signals, NULL);
+        }
+
         node = ply_list_get_first_node (dispatcher->sources);
         while (node != NULL) {
                 ply_list_node_t *next_node;
@@ -225,15 +314,10 @@ ply_signal_dispatcher_get_next_signal_from_pipe (ply_signal_dispatcher_t *dispat
 }
 
 static void
-ply_signal_dispatcher_dispatch_signal (ply_signal_dispatcher_t *dispatcher,
-                                       int                      fd)
+ply_signal_dispatcher_dispatch_signal_number (ply_signal_dispatcher_t *dispatcher,
+                                              int                      signal_number)
 {
         ply_list_node_t *node;
-        int signal_number;
-
-        assert (fd == ply_signal_dispatcher_receiver_fd);
-
-        signal_number = ply_signal_dispatcher_get_next_signal_from_pipe (dispatcher);
 
         node = ply_list_get_first_node (dispatcher->sources);
         while (node != NULL) {
@@ -249,6 +333,96 @@ ply_signal_dispatcher_dispatch_signal (ply_signal_dispatcher_t *dispatcher,
         }
 }
 
+static void
+ply_signal_dispatcher_dispatch_signal (ply_signal_dispatcher_t *dispatcher,
+                                       int                      fd)
+{
+        int signal_number;
+
+        assert (fd == ply_signal_dispatcher_receiver_fd);
+
+        signal_number = ply_signal_dispatcher_get_next_signal_from_pipe (dispatcher);
+
+        ply_signal_dispatcher_dispatch_signal_number (dispatcher, signal_number);
+}
+
+static void
+ply_signal_dispatcher_dispatch_signals_from_signal_fd (ply_signal_dispatcher_t *dispatcher,
+                                                       int                      fd)
+{
+        struct signalfd_siginfo info[8];
+        ssize_t bytes_read;
+        size_t i;
+
+        assert (fd == dispatcher->signal_fd);
+
+        do {
+                bytes_read = read (fd, info, sizeof(info));
+
+                if (bytes_read < 0)
+                        break;
+
+                for (i = 0; i < bytes_read / sizeof(struct signalfd_siginfo); i++) {
+                        ply_signal_dispatcher_dispatch_signal_number (dispatcher, info[i].ssi_signo);
+                }
+        } while (bytes_read == sizeof(info));
+}
+
+/* Blocks signal_number and starts reading it from the signalfd, or stops
+ * doing that when it's no longer watched
+ */
+static void
+ply_signal_dispatcher_update_signal_fd (ply_event_loop_t *loop,
+                                        int               signal_number,
+                                        bool              should_watch)
+{
+        ply_signal_dispatcher_t *dispatcher = loop->signal_dispatcher;
+        sigset_t signal_set;
+
+        sigemptyset (&signal_set);
+        sigaddset (&signal_set, signal_number);
+
+        if (!should_watch) {
+                if (!sigismember (&dispatcher->watched_signals, signal_number))
+                        return;
+
+                sigdelset (&dispatcher->watched_signals, signal_number);
+                signalfd (dispatcher->signal_fd, &dispatcher->watched_signals, 0);
+                pthread_sigmask (SIG_UNBLOCK, &signal_set, NULL);
+                return;
+        }
+
+        if (sigismember (&dispatcher->watched_signals, signal_number))
+                return;
+
+        sigaddset (&dispatcher->watched_signals, signal_number);
+
+        if (dispatcher->signal_fd < 0) {
+                dispatcher->signal_fd = signalfd (-1, &dispatcher->watched_signals,
+                                                  SFD_NONBLOCK | SFD_CLOEXEC);
+
+                if (dispatcher->signal_fd < 0) {
+                        ply_trace ("could not create signalfd, falling back to signal pipe: %m");
+                        sigdelset (&dispatcher->watched_signals, signal_number);
+                        return;
+                }
+
+                ply_event_loop_watch_fd (loop,
+                                         dispatcher->signal_fd,
+                                         PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                         (ply_event_handler_t)
+                                         ply_signal_dispatcher_dispatch_signals_from_signal_fd,
+                                         NULL,
+                                         dispatcher);
+        } else if (signalfd (dispatcher->signal_fd, &dispatcher->watched_signals, 0) < 0) {
+                ply_trace ("could not add signal %d to signalfd: %m", signal_number);
+                sigdelset (&dispatcher->watched_signals, signal_number);
+                return;
+        }
+
+        pthread_sigmask (SIG_BLOCK, &signal_set, NULL);
+}
+
 static void
 ply_signal_dispatcher_reset_signal_sources (ply_signal_dispatcher_t *dispatcher,
                                             int                      fd)
@@ -267,6 +441,9 @@ ply_signal_dispatcher_reset_signal_sources (ply_signal_dispatcher_t *dispatcher,
 
                 node = ply_list_get_next_node (dispatcher->sources, node);
         }
+
+        pthread_sigmask (SIG_UNBLOCK, &dispatcher->watched_signals, NULL);
+        sigemptyset (&dispatcher->watched_signals);
 }
 
 static ply_event_destination_t *
@@ -475,6 +652,211 @@ ply_event_loop_remove_destination_by_fd_watch (ply_event_loop_t *loop,
         ply_event_loop_update_source_event_mask (loop, source);
 }
 
+static void
+ply_event_loop_free_handler_profile (void *key,
+                                     void *data,
+                                     void *user_data)
+{
+        free (data);
+}
+
+static void
+ply_event_loop_free_handler_profiles (ply_event_loop_t *loop)
+{
+        if (loop->handler_profiles == NULL)
+                return;
+
+        ply_hashtable_foreach (loop->handler_profiles,
+                               ply_event_loop_free_handler_profile,
+                               NULL);
+        ply_hashtable_free (loop->handler_profiles);
+        loop->handler_profiles = NULL;
+}
+
+void
+ply_event_loop_set_profiling_enabled (ply_event_loop_t *loop,
+                                      bool              should_profile)
+{
+        assert (loop != NULL);
+
+        if (should_profile && loop->handler_profiles == NULL)
+                loop->handler_profiles = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                            ply_hashtable_direct_compare);
+
+        loop->is_profiling = should_profile;
+}
+
+static inline double
+ply_event_loop_start_profiling_handler (ply_event_loop_t *loop)
+{
+        if (!loop->is_profiling)
+                return 0.0;
+
+        return ply_get_timestamp ();
+}
+
+static void
+ply_event_loop_stop_profiling_handler (ply_event_loop_t *loop,
+                                       void             *handler,
+                                       double            start_time)
+{
+        ply_event_loop_handler_profile_t *profile;
+        double elapsed_time, microseconds;
+        int bucket;
+
+        if (!loop->is_profiling)
+                return;
+
+        elapsed_time = ply_get_timestamp () - start_time;
+
+        profile = ply_hashtable_lookup (loop->handler_profiles, handler);
+
+        if (profile == NULL) {
+                profile = calloc (1, sizeof(ply_event_loop_handler_profile_t));
+                profile->handler = handler;
+                ply_hashtable_insert (loop->handler_profiles, handler, profile);
+        }
+
+        profile->number_of_calls++;
+        profile->total_time += elapsed_time;
+        profile->longest_time = MAX (profile->longest_time, elapsed_time);
+
+        microseconds = elapsed_time * 1000000.0;
+        if (microseconds < 1.0)
+                bucket = 0;
+        else
+                bucket = MIN (ilogb (microseconds) + 1,
+                              PLY_EVENT_LOOP_NUMBER_OF_LATENCY_BUCKETS - 1);
+
+        profile->latency_buckets[bucket]++;
+}
+
+static void
+ply_event_loop_collect_handler_profile (void *key,
+                                        void *data,
+                                        void *user_data)
+{
+        ply_event_loop_handler_profile_t ***next_profile = user_data;
+
+        **next_profile = data;
+        (*next_profile)++;
+}
+
+static int
+ply_event_loop_compare_handler_profiles (const void *a,
+                                         const void *b)
+{
+        const ply_event_loop_handler_profile_t *profile_a = *(ply_event_loop_handler_profile_t * const *) a;
+        const ply_event_loop_handler_profile_t *profile_b = *(ply_event_loop_handler_profile_t * const *) b;
+
+        if (profile_a->total_time > profile_b->total_time)
+                return -1;
+        if (profile_a->total_time < profile_b->total_time)
+                return 1;
+        return 0;
+}
+
+static void
+ply_event_loop_describe_latency_bucket (int    bucket,
+                                        char  *description,
+                                        size_t size)
+{
+        double microseconds;
+
+        if (bucket == PLY_EVENT_LOOP_NUMBER_OF_LATENCY_BUCKETS - 1) {
+                microseconds = ldexp (1.0, bucket - 1);
+                snprintf (description, size, ">=%.0fs", microseconds / 1000000.0);
+                return;
+        }
+
+        microseconds = ldexp (1.0, bucket);
+
+        if (microseconds < 1000.0)
+                snprintf (description, size, "<%.0fus", microseconds);
+        else if (microseconds < 1000000.0)
+                snprintf (description, size, "<%.0fms", microseconds / 1000.0);
+        else
+                snprintf (description, size, "<%.0fs", microseconds / 1000000.0);
+}
+
+/* Writes how long each handler has taken so far to the debug log, worst
+ * offenders first
+ */
+void
+ply_event_loop_dump_profile (ply_event_loop_t *loop)
+{
+        ply_event_loop_handler_profile_t **profiles, **next_profile;
+        int number_of_profiles, i;
+
+        assert (loop != NULL);
+
+        if (loop->handler_profiles == NULL)
+                return;
+
+        number_of_profiles = ply_hashtable_get_size (loop->handler_profiles);
+        profiles = calloc (number_of_profiles + 1, sizeof(ply_event_loop_handler_profile_t *));
+        next_profile = profiles;
+        ply_hashtable_foreach (loop->handler_profiles,
+                               ply_event_loop_collect_handler_profile,
+                               &next_profile);
+        number_of_profiles = next_profile - profiles;
+
+        qsort (profiles, number_of_profiles, sizeof(ply_event_loop_handler_profile_t *),
+               ply_event_loop_compare_handler_profiles);
+
+        ply_trace ("event loop profile for %d handlers:", number_of_profiles);
+        for (i = 0; i < number_of_profiles; i++) {
+                ply_event_loop_handler_profile_t *profile = profiles[i];
+                char histogram[PLY_EVENT_LOOP_NUMBER_OF_LATENCY_BUCKETS * 24] = "";
+                size_t histogram_length = 0;
+                const char *name = NULL;
+                Dl_info symbol_info;
+                char fallback_name[64];
+                int bucket;
+
+                if (dladdr (profile->handler, &symbol_info) != 0) {
+                        if (symbol_info.dli_sname != NULL)
+                                name = symbol_info.dli_sname;
+                        else if (symbol_info.dli_fname != NULL) {
+                                const char *file_name;
+
+                                file_name = strrchr (symbol_info.dli_fname, '/');
+                                file_name = file_name != NULL ? file_name + 1 : symbol_info.dli_fname;
+                                snprintf (fallback_name, sizeof(fallback_name), "%s+%#lx",
+                                          file_name,
+                                          (unsigned long) ((char *) profile->handler - (char *) symbol_info.dli_fbase));
+                                name = fallback_name;
+                        }
+                }
+
+                if (name == NULL) {
+                        snprintf (fallback_name, sizeof(fallback_name), "%p", profile->handler);
+                        name = fallback_name;
+                }
+
+                for (bucket = 0; bucket < PLY_EVENT_LOOP_NUMBER_OF_LATENCY_BUCKETS; bucket++) {
+                        char description[16];
+
+                        if (profile->latency_buckets[bucket] == 0)
+                                continue;
+
+                        ply_event_loop_describe_latency_bucket (bucket, description, sizeof(description));
+                        histogram_length += snprintf (histogram + histogram_length,
+                                                      sizeof(histogram) - histogram_length,
+                                                      " %s:%lu", description,
+                                                      profile->latency_buckets[bucket]);
+                }
+
+                ply_trace ("%s: %lu calls, %.3fms total, %.3fms longest,%s",
+                           name, profile->number_of_calls,
+                           profile->total_time * 1000.0,
+                           profile->longest_time * 1000.0,
+                           histogram);
+        }
+
+        free (profiles);
+}
+
 ply_event_loop_t *
 ply_event_loop_new (void)
 {
@@ -484,6 +866,7 @@ ply_event_loop_new (void)
 
         loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
         loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+        loop->timer_fd = -1;
 
         assert (loop->epoll_fd >= 0);
 
@@ -491,8 +874,12 @@ ply_event_loop_new (void)
         loop->exit_code = 0;
 
         loop->sources = ply_list_new ();
+        loop->source_index = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                ply_hashtable_direct_compare);
         loop->exit_closures = ply_list_new ();
-        loop->timeout_watches = ply_list_new ();
+        loop->idle_closures = ply_list_new ();
+        loop->timeout_watch_index = ply_hashtable_new (ply_event_loop_timeout_watch_hash,
+                                                       ply_event_loop_timeout_watch_compare);
 
         loop->signal_dispatcher = ply_signal_dispatcher_new ();
 
@@ -510,6 +897,20 @@ ply_event_loop_new (void)
                                  ply_signal_dispatcher_reset_signal_sources,
                                  loop->signal_dispatcher);
 
+        loop->armed_wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+        loop->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+        if (loop->timer_fd >= 0)
+                loop->timer_fd_watch = ply_event_loop_watch_fd (loop,
+                                                                loop->timer_fd,
+                                                                PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                                                (ply_event_handler_t)
+                                                                ply_event_loop_on_timer,
+                                                                NULL,
+                                                                loop);
+        else
+                ply_trace ("could not create timerfd, using epoll timeouts: %m");
+
         return loop;
 }
 
@@ -571,13 +972,21 @@ ply_event_loop_free (ply_event_loop_t *loop)
                 return;
 
         assert (ply_list_get_length (loop->sources) == 0);
-        assert (ply_list_get_length (loop->timeout_watches) == 0);
+        assert (loop->number_of_timeout_watches == 0);
 
         ply_signal_dispatcher_free (loop->signal_dispatcher);
         ply_event_loop_free_exit_closures (loop);
+        ply_event_loop_free_idle_closures (loop);
+        ply_list_free (loop->idle_closures);
 
         ply_list_free (loop->sources);
-        ply_list_free (loop->timeout_watches);
+        ply_hashtable_free (loop->source_index);
+        ply_event_loop_free_handler_profiles (loop);
+        free (loop->timeout_heap);
+        ply_hashtable_free (loop->timeout_watch_index);
+
+        if (loop->timer_fd >= 0)
+                close (loop->timer_fd);
 
         close (loop->epoll_fd);
         free (loop);
@@ -587,21 +996,7 @@ static ply_list_node_t *
 ply_event_loop_find_source_node (ply_event_loop_t *loop,
                                  int               fd)
 {
-        ply_list_node_t *node;
-
-        node = ply_list_get_first_node (loop->sources);
-        while (node != NULL) {
-                ply_event_source_t *source;
-
-                source = (ply_event_source_t *) ply_list_node_get_data (node);
-
-                if (source->fd == fd)
-                        break;
-
-                node = ply_list_get_next_node (loop->sources, node);
-        }
-
-        return node;
+        return ply_hashtable_lookup (loop->source_index, (void *) (intptr_t) fd);
 }
 
 static void
@@ -624,6 +1019,8 @@ ply_event_loop_add_source (ply_event_loop_t   *loop,
 
         ply_event_source_take_reference (source);
         ply_list_append_data (loop->sources, source);
+        ply_hashtable_insert (loop->source_index, (void *) (intptr_t) source->fd,
+                              ply_list_get_last_node (loop->sources));
 }
 
 static void
@@ -650,6 +1047,7 @@ ply_event_loop_remove_source_node (ply_event_loop_t *loop,
                 source->is_getting_polled = false;
         }
 
+        ply_hashtable_remove (loop->source_index, (void *) (intptr_t) source->fd);
         ply_list_remove_node (loop->sources, source_node);
         ply_event_source_drop_reference (source);
 }
@@ -662,9 +1060,10 @@ ply_event_loop_remove_source (ply_event_loop_t   *loop,
 
         assert (ply_list_get_length (source->destinations) == 0);
 
-        source_node = ply_list_find_node (loop->sources, source);
+        source_node = ply_event_loop_find_source_node (loop, source->fd);
 
         assert (source_node != NULL);
+        assert (ply_list_node_get_data (source_node) == source);
 
         ply_event_loop_remove_source_node (loop, source_node);
 }
@@ -830,6 +1229,8 @@ ply_event_loop_watch_signal (ply_event_loop_t   *loop,
         source->old_posix_signal_handler =
                 signal (signal_number, ply_signal_dispatcher_posix_signal_handler);
         ply_list_append_data (loop->signal_dispatcher->sources, source);
+
+        ply_signal_dispatcher_update_signal_fd (loop, signal_number, true);
 }
 
 static void
@@ -860,6 +1261,9 @@ ply_event_loop_stop_watching_signal (ply_event_loop_t *loop,
                 return;
 
         ply_signal_dispatcher_remove_source_node (loop->signal_dispatcher, node);
+
+        if (ply_signal_dispatcher_find_source_node (loop->signal_dispatcher, signal_number) == NULL)
+                ply_signal_dispatcher_update_signal_fd (loop, signal_number, false);
 }
 
 void
@@ -904,13 +1308,283 @@ ply_event_loop_stop_watching_for_exit (ply_event_loop_t             *loop,
         }
 }
 
+static ply_list_node_t *
+ply_event_loop_find_idle_closure_node (ply_event_loop_t             *loop,
+                                       ply_event_loop_idle_handler_t idle_handler,
+                                       void                         *user_data)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (loop->idle_closures);
+        while (node != NULL) {
+                ply_event_loop_idle_closure_t *closure;
+
+                closure = (ply_event_loop_idle_closure_t *) ply_list_node_get_data (node);
+
+                if (closure->handler == idle_handler &&
+                    closure->user_data == user_data)
+                        break;
+
+                node = ply_list_get_next_node (loop->idle_closures, node);
+        }
+
+        return node;
+}
+
+void
+ply_event_loop_watch_for_idle (ply_event_loop_t             *loop,
+                               ply_event_loop_idle_handler_t idle_handler,
+                               void                         *user_data)
+{
+        ply_event_loop_idle_closure_t *closure;
+
+        assert (loop != NULL);
+        assert (idle_handler != NULL);
+
+        if (ply_event_loop_find_idle_closure_node (loop, idle_handler, user_data) != NULL)
+                return;
+
+        closure = calloc (1, sizeof(ply_event_loop_idle_closure_t));
+        closure->handler = idle_handler;
+        closure->user_data = user_data;
+        closure->generation = loop->idle_generation;
+
+        ply_list_append_data (loop->idle_closures, closure);
+}
+
+void
+ply_event_loop_stop_watching_for_idle (ply_event_loop_t             *loop,
+                                       ply_event_loop_idle_handler_t idle_handler,
+                                       void                         *user_data)
+{
+        ply_list_node_t *node;
+
+        assert (loop != NULL);
+
+        node = ply_event_loop_find_idle_closure_node (loop, idle_handler, user_data);
+
+        if (node == NULL)
+                return;
+
+        free (ply_list_node_get_data (node));
+        ply_list_remove_node (loop->idle_closures, node);
+}
+
+static void
+ply_event_loop_handle_idle_closures (ply_event_loop_t *loop)
+{
+        ply_list_node_t *node;
+        unsigned long generation;
+
+        generation = loop->idle_generation++;
+
+        /* Each closure is dequeued before its handler runs, so handlers
+         * can queue and cancel others.  Ones they queue are left for the
+         * next iteration.
+         */
+        while ((node = ply_list_get_first_node (loop->idle_closures)) != NULL) {
+                ply_event_loop_idle_closure_t *closure;
+                double start_time;
+
+                closure = (ply_event_loop_idle_closure_t *) ply_list_node_get_data (node);
+
+                if (closure->generation != generation)
+                        break;
+
+                ply_list_remove_node (loop->idle_closures, node);
+
+                start_time = ply_event_loop_start_profiling_handler (loop);
+                closure->handler (closure->user_data, loop);
+                ply_event_loop_stop_profiling_handler (loop, closure->handler, start_time);
+                free (closure);
+        }
+}
+
+static void
+ply_event_loop_free_idle_closures (ply_event_loop_t *loop)
+{
+        ply_list_node_t *node;
+
+        while ((node = ply_list_get_first_node (loop->idle_closures)) != NULL) {
+                free (ply_list_node_get_data (node));
+                ply_list_remove_node (loop->idle_closures, node);
+        }
+}
+
+static unsigned int
+ply_event_loop_timeout_watch_hash (void *element)
+{
+        ply_event_loop_timeout_watch_t *watch = element;
+
+        return (unsigned int) ((uintptr_t) watch->handler ^ ((uintptr_t) watch->user_data * 31));
+}
+
+static int
+ply_event_loop_timeout_watch_compare (void *elementa,
+                                      void *elementb)
+{
+        ply_event_loop_timeout_watch_t *watch_a = elementa;
+        ply_event_loop_timeout_watch_t *watch_b = elementb;
+
+        if (watch_a->handler != watch_b->handler)
+                return 1;
+
+        return watch_a->user_data != watch_b->user_data;
+}
+
+static bool
+ply_event_loop_timeout_watch_is_due_before (ply_event_loop_timeout_watch_t *watch_a,
+                                            ply_event_loop_timeout_watch_t *watch_b)
+{
+        if (watch_a->timeout != watch_b->timeout)
+                return watch_a->timeout < watch_b->timeout;
+
+        return watch_a->sequence < watch_b->sequence;
+}
+
+static void
+ply_event_loop_set_timeout_heap_entry (ply_event_loop_t               *loop,
+                                       size_t                          index,
+                                       ply_event_loop_timeout_watch_t *watch)
+{
+        loop->timeout_heap[index] = watch;
+        watch->heap_index = index;
+}
+
+static void
+ply_event_loop_sift_timeout_watch_up (ply_event_loop_t *loop,
+                                      size_t            index)
+{
+        ply_event_loop_timeout_watch_t *watch = loop->timeout_heap[index];
+
+        while (index > 0) {
+                size_t parent = (index - 1) / 2;
+
+                if (!ply_event_loop_timeout_watch_is_due_before (watch, loop->timeout_heap[parent]))
+                        break;
+
+                ply_event_loop_set_timeout_heap_entry (loop, index, loop->timeout_heap[parent]);
+                index = parent;
+        }
+
+        ply_event_loop_set_timeout_heap_entry (loop, index, watch);
+}
+
+static void
+ply_event_loop_sift_timeout_watch_down (ply_event_loop_t *loop,
+                                        size_t            index)
+{
+        ply_event_loop_timeout_watch_t *watch = loop->timeout_heap[index];
+
+        while (true) {
+                size_t child = 2 * index + 1;
+
+                if (child >= loop->number_of_timeout_watches)
+                        break;
+
+                if (child + 1 < loop->number_of_timeout_watches &&
+                    ply_event_loop_timeout_watch_is_due_before (loop->timeout_heap[child + 1],
+                                                                loop->timeout_heap[child]))
+                        child++;
+
+                if (!ply_event_loop_timeout_watch_is_due_before (loop->timeout_heap[child], watch))
+                        break;
+
+                ply_event_loop_set_timeout_heap_entry (loop, index, loop->timeout_heap[child]);
+                index = child;
+        }
+
+        ply_event_loop_set_timeout_heap_entry (loop, index, watch);
+}
+
+static void
+ply_event_loop_update_wakeup_time (ply_event_loop_t *loop)
+{
+        if (loop->number_of_timeout_watches == 0)
+                loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+        else
+                loop->wakeup_time = loop->timeout_heap[0]->timeout;
+}
+
+static void
+ply_event_loop_push_timeout_watch (ply_event_loop_t               *loop,
+                                   ply_event_loop_timeout_watch_t *watch)
+{
+        if (loop->number_of_timeout_watches == loop->timeout_heap_size) {
+                loop->timeout_heap_size = MAX (loop->timeout_heap_size * 2, 16);
+                loop->timeout_heap = realloc (loop->timeout_heap,
+                                              loop->timeout_heap_size * sizeof(ply_event_loop_timeout_watch_t *));
+        }
+
+        ply_event_loop_set_timeout_heap_entry (loop, loop->number_of_timeout_watches, watch);
+        loop->number_of_timeout_watches++;
+        ply_event_loop_sift_timeout_watch_up (loop, watch->heap_index);
+
+        ply_event_loop_update_wakeup_time (loop);
+}
+
+static void
+ply_event_loop_remove_timeout_watch_from_heap (ply_event_loop_t *loop,
+                                               size_t            index)
+{
+        size_t last;
+
+        assert (index < loop->number_of_timeout_watches);
+
+        last = --loop->number_of_timeout_watches;
+
+        if (index != last) {
+                ply_event_loop_set_timeout_heap_entry (loop, index, loop->timeout_heap[last]);
+
+                if (index > 0 &&
+                    ply_event_loop_timeout_watch_is_due_before (loop->timeout_heap[index],
+                                                                loop->timeout_heap[(index - 1) / 2]))
+                        ply_event_loop_sift_timeout_watch_up (loop, index);
+                else
+                        ply_event_loop_sift_timeout_watch_down (loop, index);
+        }
+
+        ply_event_loop_update_wakeup_time (loop);
+}
+
+/* Takes a watch that is about to fire out of the handler and user data
+ * index, leaving any duplicates of it in place
+ */
+static void
+ply_event_loop_unindex_timeout_watch (ply_event_loop_t               *loop,
+                                      ply_event_loop_timeout_watch_t *watch)
+{
+        ply_event_loop_timeout_watch_t *first_duplicate, *previous;
+
+        first_duplicate = ply_hashtable_lookup (loop->timeout_watch_index, watch);
+        assert (first_duplicate != NULL);
+
+        if (first_duplicate == watch) {
+                ply_hashtable_remove (loop->timeout_watch_index, watch);
+
+                if (watch->next_duplicate != NULL)
+                        ply_hashtable_insert (loop->timeout_watch_index,
+                                              watch->next_duplicate,
+                                              watch->next_duplicate);
+                return;
+        }
+
+        for (previous = first_duplicate;
+             previous->next_duplicate != watch;
+             previous = previous->next_duplicate) {
+                assert (previous->next_duplicate != NULL);
+        }
+
+        previous->next_duplicate = watch->next_duplicate;
+}
+
 void
 ply_event_loop_watch_for_timeout (ply_event_loop_t                *loop,
                                   double                           seconds,
                                   ply_event_loop_timeout_handler_t timeout_handler,
                                   void                            *user_data)
 {
-        ply_event_loop_timeout_watch_t *timeout_watch;
+        ply_event_loop_timeout_watch_t *timeout_watch, *first_duplicate;
 
         assert (loop != NULL);
         assert (timeout_handler != NULL);
@@ -920,13 +1594,17 @@ ply_event_loop_watch_for_timeout (ply_event_loop_t                *loop,
         timeout_watch->timeout = ply_get_timestamp () + seconds;
         timeout_watch->handler = timeout_handler;
         timeout_watch->user_data = user_data;
+        timeout_watch->sequence = loop->next_timeout_sequence++;
+
+        first_duplicate = ply_hashtable_lookup (loop->timeout_watch_index, timeout_watch);
+        if (first_duplicate != NULL) {
+                timeout_watch->next_duplicate = first_duplicate->next_duplicate;
+                first_duplicate->next_duplicate = timeout_watch;
+        } else {
+                ply_hashtable_insert (loop->timeout_watch_index, timeout_watch, timeout_watch);
+        }
 
-        if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-                loop->wakeup_time = timeout_watch->timeout;
-        else
-                loop->wakeup_time = MIN (loop->wakeup_time, timeout_watch->timeout);
-
-        ply_list_append_data (loop->timeout_watches, timeout_watch);
+        ply_event_loop_push_timeout_watch (loop, timeout_watch);
 }
 
 void
@@ -934,41 +1612,29 @@ ply_event_loop_stop_watching_for_timeout (ply_event_loop_t                *loop,
                                           ply_event_loop_timeout_handler_t timeout_handler,
                                           void                            *user_data)
 {
-        ply_list_node_t *node;
-        bool timeout_removed;
+        ply_event_loop_timeout_watch_t key, *timeout_watch;
 
-        loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
-
-        timeout_removed = false;
-        node = ply_list_get_first_node (loop->timeout_watches);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
-                ply_event_loop_timeout_watch_t *timeout_watch;
+        key.handler = timeout_handler;
+        key.user_data = user_data;
 
-                timeout_watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (loop->timeout_watches, node);
+        timeout_watch = ply_hashtable_remove (loop->timeout_watch_index, &key);
 
-                if (timeout_watch->handler == timeout_handler &&
-                    timeout_watch->user_data == user_data) {
-                        ply_list_remove_node (loop->timeout_watches, node);
-                        free (timeout_watch);
+        if (timeout_watch == NULL) {
+                ply_trace ("no matching timeout found for removal");
+                return;
+        }
 
-                        if (timeout_removed)
-                                ply_trace ("multiple matching timeouts found for removal");
+        if (timeout_watch->next_duplicate != NULL)
+                ply_trace ("multiple matching timeouts found for removal");
 
-                        timeout_removed = true;
-                } else {
-                        if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-                                loop->wakeup_time = timeout_watch->timeout;
-                        else
-                                loop->wakeup_time = MIN (loop->wakeup_time, timeout_watch->timeout);
-                }
+        while (timeout_watch != NULL) {
+                ply_event_loop_timeout_watch_t *next_duplicate;
 
-                node = next_node;
+                next_duplicate = timeout_watch->next_duplicate;
+                ply_event_loop_remove_timeout_watch_from_heap (loop, timeout_watch->heap_index);
+                free (timeout_watch);
+                timeout_watch = next_duplicate;
         }
-
-        if (!timeout_removed)
-                ply_trace ("no matching timeout found for removal");
 }
 
 static ply_event_loop_fd_status_t
@@ -1036,8 +1702,17 @@ ply_event_loop_handle_met_status_for_source (ply_event_loop_t          *loop,
                 next_node = ply_list_get_next_node (source->destinations, node);
 
                 if (((destination->status & status) != 0)
-                    && (destination->status_met_handler != NULL))
-                        destination->status_met_handler (destination->user_data, source->fd);
+                    && (destination->status_met_handler != NULL)) {
+                        ply_event_handler_t handler;
+                        double start_time;
+
+                        /* the handler can stop watching, which frees destination */
+                        handler = destination->status_met_handler;
+
+                        start_time = ply_event_loop_start_profiling_handler (loop);
+                        handler (destination->user_data, source->fd);
+                        ply_event_loop_stop_profiling_handler (loop, handler, start_time);
+                }
 
                 node = next_node;
         }
@@ -1061,8 +1736,17 @@ ply_event_loop_handle_disconnect_for_source (ply_event_loop_t   *loop,
                 destination = (ply_event_destination_t *) ply_list_node_get_data (node);
                 next_node = ply_list_get_next_node (source->destinations, node);
 
-                if (destination->disconnected_handler != NULL)
-                        destination->disconnected_handler (destination->user_data, source->fd);
+                if (destination->disconnected_handler != NULL) {
+                        ply_event_handler_t handler;
+                        double start_time;
+
+                        /* the handler can stop watching, which frees destination */
+                        handler = destination->disconnected_handler;
+
+                        start_time = ply_event_loop_start_profiling_handler (loop);
+                        handler (destination->user_data, source->fd);
+                        ply_event_loop_stop_profiling_handler (loop, handler, start_time);
+                }
 
                 node = next_node;
         }
@@ -1097,25 +1781,16 @@ ply_event_loop_free_watches_for_source (ply_event_loop_t   *loop,
 static void
 ply_event_loop_free_timeout_watches (ply_event_loop_t *loop)
 {
-        ply_list_node_t *node;
+        size_t i;
 
         assert (loop != NULL);
 
-        node = ply_list_get_first_node (loop->timeout_watches);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
-                ply_event_loop_timeout_watch_t *watch;
-
-                watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (loop->timeout_watches, node);
-
-                free (watch);
-                ply_list_remove_node (loop->timeout_watches, node);
-
-                node = next_node;
+        for (i = 0; i < loop->number_of_timeout_watches; i++) {
+                ply_hashtable_remove (loop->timeout_watch_index, loop->timeout_heap[i]);
+                free (loop->timeout_heap[i]);
         }
 
-        assert (ply_list_get_length (loop->timeout_watches) == 0);
+        loop->number_of_timeout_watches = 0;
         loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
 }
 
@@ -1169,41 +1844,103 @@ ply_event_loop_disconnect_source (ply_event_loop_t   *loop,
 static void
 ply_event_loop_handle_timeouts (ply_event_loop_t *loop)
 {
-        ply_list_node_t *node;
         double now;
 
         assert (loop != NULL);
 
-        now = ply_get_timestamp ();
-        node = ply_list_get_first_node (loop->timeout_watches);
-        loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
-        while (node != NULL) {
-                ply_list_node_t *next_node;
+        now = loop->frame_time;
+
+        /* Watches get taken out of the heap before their handler runs, so
+         * handlers are free to add and remove other timeouts.  New ones are
+         * always due after now, so this can't go on forever.
+         */
+        while (loop->number_of_timeout_watches > 0 &&
+               loop->timeout_heap[0]->timeout <= now) {
                 ply_event_loop_timeout_watch_t *watch;
+                double start_time;
+
+                watch = loop->timeout_heap[0];
+                assert (watch->handler != NULL);
+
+                ply_event_loop_remove_timeout_watch_from_heap (loop, 0);
+                ply_event_loop_unindex_timeout_watch (loop, watch);
+
+                start_time = ply_event_loop_start_profiling_handler (loop);
+                watch->handler (watch->user_data, loop);
+                ply_event_loop_stop_profiling_handler (loop, watch->handler, start_time);
+                free (watch);
+        }
+}
+
+static void
+ply_event_loop_on_timer (ply_event_loop_t *loop,
+                         int               fd)
+{
+        uint64_t number_of_expirations;
 
-                watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (loop->timeout_watches, node);
+        if (read (fd, &number_of_expirations, sizeof(number_of_expirations)) < 0)
+                return;
 
-                if (watch->timeout <= now) {
-                        assert (watch->handler != NULL);
+        ply_statistics_add_to_count ("event-loop.timer-wakeups", 1);
 
-                        ply_list_remove_node (loop->timeout_watches, node);
+        /* The deadline was exact to the nanosecond, but in case it still
+         * came in a hair early for the timestamp comparison, make sure it
+         * gets armed again
+         */
+        loop->armed_wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+}
 
-                        watch->handler (watch->user_data, loop);
-                        free (watch);
+static void
+ply_event_loop_arm_timer (ply_event_loop_t *loop)
+{
+        struct itimerspec timer_spec = { { 0, 0 }, { 0, 0 } };
 
-                        /* start over in case the handler invalidated the list
-                         */
-                        next_node = ply_list_get_first_node (loop->timeout_watches);
-                } else {
-                        if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-                                loop->wakeup_time = watch->timeout;
-                        else
-                                loop->wakeup_time = MIN (loop->wakeup_time, watch->timeout);
+        if (loop->armed_wakeup_time == loop->wakeup_time)
+                return;
+
+        if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) > 0) {
+                double seconds = floor (loop->wakeup_time);
+
+                timer_spec.it_value.tv_sec = (time_t) seconds;
+                timer_spec.it_value.tv_nsec = (long) ceil ((loop->wakeup_time - seconds) * 1000000000.0);
+
+                if (timer_spec.it_value.tv_nsec >= 1000000000L) {
+                        timer_spec.it_value.tv_sec++;
+                        timer_spec.it_value.tv_nsec -= 1000000000L;
                 }
 
-                node = next_node;
+                /* zero would disarm it */
+                if (timer_spec.it_value.tv_sec == 0 && timer_spec.it_value.tv_nsec == 0)
+                        timer_spec.it_value.tv_nsec = 1;
+        }
+
+        if (timerfd_settime (loop->timer_fd, TFD_TIMER_ABSTIME, &timer_spec, NULL) < 0) {
+                ply_trace ("could not arm timerfd, using epoll timeouts: %m");
+                ply_event_loop_stop_watching_fd (loop, loop->timer_fd_watch);
+                loop->timer_fd_watch = NULL;
+                close (loop->timer_fd);
+                loop->timer_fd = -1;
+                return;
         }
+
+        loop->armed_wakeup_time = loop->wakeup_time;
+}
+
+double
+ply_event_loop_get_time_spent_waiting (ply_event_loop_t *loop)
+{
+        return loop->time_spent_waiting;
+}
+
+double
+ply_event_loop_get_frame_time (ply_event_loop_t *loop)
+{
+        assert (loop != NULL);
+
+        if (loop->frame_time == 0.0)
+                return ply_get_timestamp ();
+
+        return loop->frame_time;
 }
 
 void
@@ -1211,6 +1948,7 @@ ply_event_loop_process_pending_events (ply_event_loop_t *loop)
 {
         int number_of_received_events, i;
         static struct epoll_event events[PLY_EVENT_LOOP_NUM_EVENT_HANDLERS];
+        double wait_start_time;
 
         assert (loop != NULL);
 
@@ -1220,22 +1958,41 @@ ply_event_loop_process_pending_events (ply_event_loop_t *loop)
         do {
                 int timeout;
 
-                if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0) {
+                if (loop->timer_fd >= 0)
+                        ply_event_loop_arm_timer (loop);
+
+                if (ply_list_get_length (loop->idle_closures) > 0) {
+                        timeout = 0;
+                } else if (loop->timer_fd >= 0 ||
+                           fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0) {
                         timeout = -1;
                 } else {
-                        timeout = (int) ((loop->wakeup_time - ply_get_timestamp ()) * 1000);
+                        /* round up, so we don't wake up just before the
+                         * deadline and spin with a zero timeout */
+                        timeout = (int) ceil ((loop->wakeup_time - ply_get_timestamp ()) * 1000);
                         timeout = MAX (timeout, 0);
                 }
 
+                wait_start_time = timeout != 0 ? ply_get_timestamp () : 0.0;
                 number_of_received_events = epoll_wait (loop->epoll_fd, events,
                                                         PLY_EVENT_LOOP_NUM_EVENT_HANDLERS,
                                                         timeout);
+                loop->frame_time = ply_get_timestamp ();
+                if (timeout != 0)
+                        loop->time_spent_waiting += loop->frame_time - wait_start_time;
                 if (number_of_received_events < 0) {
                         if (errno != EINTR && errno != EAGAIN) {
+                                loop->frame_time = 0.0;
                                 ply_event_loop_exit (loop, 255);
                                 return;
                         }
                 } else {
+                        ply_statistics_add_to_count ("event-loop.wakeups", 1);
+
+                        /* without the timerfd, timeouts wake us up this way */
+                        if (number_of_received_events == 0 && timeout > 0)
+                                ply_statistics_add_to_count ("event-loop.timer-wakeups", 1);
+
                         /* Reference all sources, so they stay alive for the duration of this
                          * iteration of the loop.
                          */
@@ -1291,6 +2048,11 @@ ply_event_loop_process_pending_events (ply_event_loop_t *loop)
 
                 ply_event_source_drop_reference (source);
         }
+
+        /* Last, whatever was put off until everything else was handled */
+        ply_event_loop_handle_idle_closures (loop);
+
+        loop->frame_time = 0.0;
 }
 
 void
@@ -1313,6 +2075,14 @@ ply_event_loop_run (ply_event_loop_t *loop)
         ply_event_loop_run_exit_closures (loop);
         ply_event_loop_free_sources (loop);
         ply_event_loop_free_timeout_watches (loop);
+        ply_event_loop_free_idle_closures (loop);
+
+        /* the timerfd isn't being polled anymore */
+        if (loop->timer_fd >= 0) {
+                close (loop->timer_fd);
+                loop->timer_fd = -1;
+                loop->timer_fd_watch = NULL;
+        }
 
         loop->should_exit = false;
 
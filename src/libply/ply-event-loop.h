@@ -45,6 +45,8 @@ typedef void (*ply_event_loop_exit_handler_t) (void             *user_data,
                                                ply_event_loop_t *loop);
 typedef void (*ply_event_loop_timeout_handler_t) (void             *user_data,
                                                   ply_event_loop_t *loop);
+typedef void (*ply_event_loop_idle_handler_t) (void             *user_data,
+                                               ply_event_loop_t *loop);
 
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_event_loop_t *ply_event_loop_new (void);
@@ -80,11 +82,41 @@ void ply_event_loop_stop_watching_for_timeout (ply_event_loop_t                *
                                                ply_event_loop_timeout_handler_t timeout_handler,
                                                void                            *user_data);
 
+/* Calls idle_handler once, after the current loop iteration has handled
+ * its fd events and timeouts.  Queueing the same handler and user data
+ * again before then does nothing.
+ */
+void ply_event_loop_watch_for_idle (ply_event_loop_t             *loop,
+                                    ply_event_loop_idle_handler_t idle_handler,
+                                    void                         *user_data);
+void ply_event_loop_stop_watching_for_idle (ply_event_loop_t             *loop,
+                                            ply_event_loop_idle_handler_t idle_handler,
+                                            void                         *user_data);
+
 int ply_event_loop_run (ply_event_loop_t *loop);
 void ply_event_loop_exit (ply_event_loop_t *loop,
                           int               exit_code);
 void
 ply_event_loop_process_pending_events (ply_event_loop_t *loop);
+
+/* Keeps track of how long each handler takes, for finding out what
+ * stalls the loop
+ */
+void ply_event_loop_set_profiling_enabled (ply_event_loop_t *loop,
+                                           bool              should_profile);
+void ply_event_loop_dump_profile (ply_event_loop_t *loop);
+
+/* Seconds spent blocked waiting for something to happen, so how busy the
+ * loop is can be worked out over an interval
+ */
+double ply_event_loop_get_time_spent_waiting (ply_event_loop_t *loop);
+
+/* When the loop last woke up.  Everything handled in the same iteration
+ * sees the same time, so animations drawn together stay in step, and it
+ * saves reading the clock over and over.  Outside of an iteration it's
+ * just the current time.
+ */
+double ply_event_loop_get_frame_time (ply_event_loop_t *loop);
 #endif
 
 #endif
@@ -22,7 +22,6 @@
 #include "config.h"
 #include "ply-hashtable.h"
 #include "ply-utils.h"
-#include "ply-bitarray.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -33,6 +32,16 @@
 
 #define MASKGEN(x) { x |= x >> 16; x |= x >> 8; x |= x >> 4; x |= x >> 2;  x |= x >> 1; }
 
+/* Slots in the hash array hold either one of these two markers or the
+ * (adjusted) hash of the key stored in the matching node.
+ */
+#define PLY_HASHTABLE_EMPTY_SLOT 0
+#define PLY_HASHTABLE_REMOVED_SLOT 1
+#define PLY_HASHTABLE_FIRST_HASH 2
+
+#define PLY_HASHTABLE_FNV_OFFSET_BASIS 2166136261u
+#define PLY_HASHTABLE_FNV_PRIME 16777619u
+
 struct _ply_hashtable_node
 {
         void *data;
@@ -41,11 +50,14 @@ struct _ply_hashtable_node
 
 struct _ply_hashtable
 {
+        /* The hashes are kept apart from the nodes so probing only walks
+         * a tightly packed array of integers, and the compare function
+         * only gets called when a full hash matches.
+         */
+        uint32_t                     *hashes;
         struct _ply_hashtable_node   *nodes;
         unsigned int                  total_node_count; /* must be a 2^X */
-        ply_bitarray_t               *dirty_node_bitmap;
         unsigned int                  dirty_node_count; /* live + dead nodes */
-        ply_bitarray_t               *live_node_bitmap;
         unsigned int                  live_node_count;
         ply_hashtable_compare_func_t *compare_func;
         ply_hashtable_hash_func_t    *hash_func;
@@ -54,7 +66,16 @@ struct _ply_hashtable
 unsigned int
 ply_hashtable_direct_hash (void *element)
 {
-        return (unsigned int) (intptr_t) element;
+        uint64_t hash = (uint64_t) (uintptr_t) element;
+
+        /* Pointers are aligned and integers are often small, so mix all
+         * the bits together before the low ones get used as an index
+         */
+        hash ^= hash >> 33;
+        hash *= UINT64_C (0xff51afd7ed558ccd);
+        hash ^= hash >> 33;
+
+        return (unsigned int) hash;
 }
 
 int
@@ -67,12 +88,12 @@ ply_hashtable_direct_compare (void *elementa,
 unsigned int
 ply_hashtable_string_hash (void *element)
 {
-        char *strptr;
-        unsigned int hash = 0;
+        const unsigned char *strptr;
+        uint32_t hash = PLY_HASHTABLE_FNV_OFFSET_BASIS;
 
         for (strptr = element; *strptr; strptr++) {
                 hash ^= *strptr;
-                hash ^= hash << 1;
+                hash *= PLY_HASHTABLE_FNV_PRIME;
         }
         return hash;
 }
@@ -84,6 +105,15 @@ ply_hashtable_string_compare (void *elementa,
         return strcmp (elementa, elementb);
 }
 
+static inline uint32_t
+ply_hashtable_adjust_hash (unsigned int hash)
+{
+        if (hash < PLY_HASHTABLE_FIRST_HASH)
+                hash += PLY_HASHTABLE_FIRST_HASH;
+
+        return hash;
+}
+
 ply_hashtable_t *
 ply_hashtable_new (ply_hashtable_hash_func_t    *hash_func,
                    ply_hashtable_compare_func_t *compare_func)
@@ -94,9 +124,8 @@ ply_hashtable_new (ply_hashtable_hash_func_t    *hash_func,
         hashtable->total_node_count = 0;
         hashtable->dirty_node_count = 0;
         hashtable->live_node_count = 0;
+        hashtable->hashes = NULL;
         hashtable->nodes = NULL;
-        hashtable->dirty_node_bitmap = NULL;
-        hashtable->live_node_bitmap = NULL;
         hashtable->compare_func = compare_func;
         hashtable->hash_func = hash_func;
 
@@ -112,8 +141,7 @@ void
 ply_hashtable_free (ply_hashtable_t *hashtable)
 {
         if (hashtable == NULL) return;
-        ply_bitarray_free (hashtable->dirty_node_bitmap);
-        ply_bitarray_free (hashtable->live_node_bitmap);
+        free (hashtable->hashes);
         free (hashtable->nodes);
         free (hashtable);
 }
@@ -122,21 +150,20 @@ ply_hashtable_free (ply_hashtable_t *hashtable)
 static void
 ply_hashtable_insert_internal (ply_hashtable_t *hashtable,
                                void            *key,
-                               void            *data)
+                               void            *data,
+                               uint32_t         hash)
 {
         unsigned int hash_index;
+        unsigned int mask = hashtable->total_node_count - 1;
         int step = 0;
 
-        hash_index = hashtable->hash_func (key);
-        hash_index &= hashtable->total_node_count - 1;
+        hash_index = hash & mask;
 
-        while (ply_bitarray_lookup (hashtable->dirty_node_bitmap, hash_index)) {
+        while (hashtable->hashes[hash_index] != PLY_HASHTABLE_EMPTY_SLOT) {
                 step++;
-                hash_index += step;
-                hash_index &= hashtable->total_node_count - 1;
+                hash_index = (hash_index + step) & mask;
         }
-        ply_bitarray_set (hashtable->dirty_node_bitmap, hash_index);
-        ply_bitarray_set (hashtable->live_node_bitmap, hash_index);
+        hashtable->hashes[hash_index] = hash;
         hashtable->nodes[hash_index].key = key;
         hashtable->nodes[hash_index].data = data;
 
@@ -151,28 +178,32 @@ ply_hashtable_resize (ply_hashtable_t *hashtable)
         unsigned int newsize, oldsize;
         unsigned int i;
         struct _ply_hashtable_node *oldnodes;
-        ply_bitarray_t *old_live_node_bitmap;
+        uint32_t *oldhashes;
 
         newsize = (hashtable->live_node_count + 1) * 4; /* make table 4x to 8x the number of live elements (at least 8) */
         MASKGEN (newsize);
         newsize++;
         oldsize = hashtable->total_node_count;
         oldnodes = hashtable->nodes;
+        oldhashes = hashtable->hashes;
 
         hashtable->total_node_count = newsize;
         hashtable->nodes = malloc (newsize * sizeof(struct _ply_hashtable_node));
-        ply_bitarray_free (hashtable->dirty_node_bitmap);
-        hashtable->dirty_node_bitmap = ply_bitarray_new (newsize);
-        old_live_node_bitmap = hashtable->live_node_bitmap;
-        hashtable->live_node_bitmap = ply_bitarray_new (newsize);
+        hashtable->hashes = calloc (newsize, sizeof(uint32_t));
         hashtable->dirty_node_count = 0;
         hashtable->live_node_count = 0;
 
+        /* The stored hashes are reused, so growing never calls back into
+         * the hash function
+         */
         for (i = 0; i < oldsize; i++) {
-                if (ply_bitarray_lookup (old_live_node_bitmap, i))
-                        ply_hashtable_insert_internal (hashtable, oldnodes[i].key, oldnodes[i].data);
+                if (oldhashes[i] >= PLY_HASHTABLE_FIRST_HASH)
+                        ply_hashtable_insert_internal (hashtable,
+                                                       oldnodes[i].key,
+                                                       oldnodes[i].data,
+                                                       oldhashes[i]);
         }
-        ply_bitarray_free (old_live_node_bitmap);
+        free (oldhashes);
         free (oldnodes);
 }
 
@@ -189,26 +220,26 @@ ply_hashtable_insert (ply_hashtable_t *hashtable,
                       void            *data)
 {
         ply_hashtable_resize_check (hashtable);
-        ply_hashtable_insert_internal (hashtable, key, data);
+        ply_hashtable_insert_internal (hashtable, key, data,
+                                       ply_hashtable_adjust_hash (hashtable->hash_func (key)));
 }
 
 static int
 ply_hashtable_lookup_index (ply_hashtable_t *hashtable,
-                            void            *key)
+                            void            *key,
+                            uint32_t         hash)
 {
         unsigned int hash_index;
+        unsigned int mask = hashtable->total_node_count - 1;
         int step = 0;
 
-        hash_index = hashtable->hash_func (key);
-        while (1) {
-                hash_index &= hashtable->total_node_count - 1;
-                if (!ply_bitarray_lookup (hashtable->dirty_node_bitmap, hash_index))
-                        break;
-                if (ply_bitarray_lookup (hashtable->live_node_bitmap, hash_index))
+        hash_index = hash & mask;
+        while (hashtable->hashes[hash_index] != PLY_HASHTABLE_EMPTY_SLOT) {
+                if (hashtable->hashes[hash_index] == hash)
                         if (!hashtable->compare_func (hashtable->nodes[hash_index].key, key))
                                 return hash_index;
-                hash_index += step;
                 step++;
+                hash_index = (hash_index + step) & mask;
         }
         return -1;
 }
@@ -219,11 +250,12 @@ ply_hashtable_remove (ply_hashtable_t *hashtable,
 {
         int index;
 
-        index = ply_hashtable_lookup_index (hashtable, key);
+        index = ply_hashtable_lookup_index (hashtable, key,
+                                            ply_hashtable_adjust_hash (hashtable->hash_func (key)));
         if (index < 0)
                 return NULL;
 
-        ply_bitarray_clear (hashtable->live_node_bitmap, index);
+        hashtable->hashes[index] = PLY_HASHTABLE_REMOVED_SLOT;
         hashtable->live_node_count--;
         return hashtable->nodes[index].data;
 }
@@ -231,10 +263,20 @@ ply_hashtable_remove (ply_hashtable_t *hashtable,
 void *
 ply_hashtable_lookup (ply_hashtable_t *hashtable,
                       void            *key)
+{
+        return ply_hashtable_lookup_with_hash (hashtable, key,
+                                               hashtable->hash_func (key));
+}
+
+void *
+ply_hashtable_lookup_with_hash (ply_hashtable_t *hashtable,
+                                void            *key,
+                                unsigned int     hash)
 {
         int index;
 
-        index = ply_hashtable_lookup_index (hashtable, key);
+        index = ply_hashtable_lookup_index (hashtable, key,
+                                            ply_hashtable_adjust_hash (hash));
         if (index < 0)
                 return NULL;
         return hashtable->nodes[index].data;
@@ -248,7 +290,8 @@ ply_hashtable_lookup_full (ply_hashtable_t *hashtable,
 {
         int index;
 
-        index = ply_hashtable_lookup_index (hashtable, key);
+        index = ply_hashtable_lookup_index (hashtable, key,
+                                            ply_hashtable_adjust_hash (hashtable->hash_func (key)));
         if (index < 0)
                 return false;
         *reply_key = hashtable->nodes[index].key;
@@ -264,7 +307,7 @@ ply_hashtable_foreach (ply_hashtable_t             *hashtable,
         unsigned int i;
 
         for (i = 0; i < hashtable->total_node_count; i++) {
-                if (ply_bitarray_lookup (hashtable->live_node_bitmap, i))
+                if (hashtable->hashes[i] >= PLY_HASHTABLE_FIRST_HASH)
                         func (hashtable->nodes[i].key, hashtable->nodes[i].data, user_data);
         }
 }
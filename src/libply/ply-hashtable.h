@@ -50,6 +50,14 @@ void *ply_hashtable_remove (ply_hashtable_t *hashtable,
                             void            *key);
 void *ply_hashtable_lookup (ply_hashtable_t *hashtable,
                             void            *key);
+
+/* Same as ply_hashtable_lookup, but for callers that look the same key
+ * up again and again.  hash must be what the table's hash function
+ * returns for key.
+ */
+void *ply_hashtable_lookup_with_hash (ply_hashtable_t *hashtable,
+                                      void            *key,
+                                      unsigned int     hash);
 int ply_hashtable_lookup_full (ply_hashtable_t *hashtable,
                                void            *key,
                                void           **reply_key,
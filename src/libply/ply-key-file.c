@@ -34,6 +34,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -42,25 +43,34 @@
 #include "ply-hashtable.h"
 #include "ply-logger.h"
 
-typedef struct
-{
-        char *key;
-        char *value;
-} ply_key_file_entry_t;
-
 typedef struct
 {
         char            *name;
         ply_hashtable_t *entries;
 } ply_key_file_group_t;
 
-struct _ply_key_file
+/* A parsed file.  The group names, keys and values all live back to back
+ * in one block of text, and never change once parsed, so every key file
+ * loaded from the same unchanged file shares one store.
+ */
+typedef struct
 {
-        char            *filename;
-        FILE            *fp;
-
-        ply_hashtable_t *groups;
+        char                 *filename;
+        dev_t                 device;
+        ino_t                 inode;
+        off_t                 size;
+        struct timespec       modification_time;
+        int                   reference_count;
+
+        char                 *text;
+        ply_hashtable_t      *groups;
         ply_key_file_group_t *groupless_group;
+} ply_key_file_store_t;
+
+struct _ply_key_file
+{
+        char                 *filename;
+        ply_key_file_store_t *store;
 };
 
 typedef struct
@@ -70,34 +80,11 @@ typedef struct
         char                        *group_name;
 } ply_key_file_foreach_func_data_t;
 
-static bool ply_key_file_open_file (ply_key_file_t *key_file);
-static void ply_key_file_close_file (ply_key_file_t *key_file);
-
-static bool
-ply_key_file_open_file (ply_key_file_t *key_file)
-{
-        assert (key_file != NULL);
-
-        key_file->fp = fopen (key_file->filename, "re");
-
-        if (key_file->fp == NULL) {
-                ply_trace ("Failed to open key file %s: %m",
-                           key_file->filename);
-                return false;
-        }
-        return true;
-}
-
-static void
-ply_key_file_close_file (ply_key_file_t *key_file)
-{
-        assert (key_file != NULL);
-
-        if (key_file->fp == NULL)
-                return;
-        fclose (key_file->fp);
-        key_file->fp = NULL;
-}
+/* Stores by filename.  Each one stays around for the life of the process,
+ * or until its file changes, so configuration and theme files that get
+ * looked at several times only get parsed once.
+ */
+static ply_hashtable_t *stores;
 
 ply_key_file_t *
 ply_key_file_new (const char *filename)
@@ -109,39 +96,55 @@ ply_key_file_new (const char *filename)
         key_file = calloc (1, sizeof(ply_key_file_t));
 
         key_file->filename = strdup (filename);
-        key_file->fp = NULL;
-        key_file->groups = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
 
         return key_file;
 }
 
-static void
-ply_key_file_free_entry_foreach (void *key,
-                                 void *data,
-                                 void *user_data)
+static ply_key_file_group_t *
+ply_key_file_group_new (char *name)
 {
-        ply_key_file_entry_t *entry = data;
+        ply_key_file_group_t *group;
+
+        group = calloc (1, sizeof(ply_key_file_group_t));
+        group->name = name;
+        group->entries = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
 
-        free (entry->key);
-        free (entry->value);
-        free (entry);
+        return group;
 }
 
 static void
-ply_key_file_free_group (void *key,
+ply_key_file_group_free (void *key,
                          void *data,
                          void *user_data)
 {
         ply_key_file_group_t *group = data;
 
-        ply_hashtable_foreach (group->entries,
-                               ply_key_file_free_entry_foreach,
-                               NULL);
         ply_hashtable_free (group->entries);
-        free (group->name);
         free (group);
 }
 
+static void
+ply_key_file_store_unref (ply_key_file_store_t *store)
+{
+        if (store == NULL)
+                return;
+
+        store->reference_count--;
+
+        if (store->reference_count > 0)
+                return;
+
+        ply_hashtable_foreach (store->groups, ply_key_file_group_free, NULL);
+        ply_hashtable_free (store->groups);
+
+        if (store->groupless_group != NULL)
+                ply_key_file_group_free (NULL, store->groupless_group, NULL);
+
+        free (store->text);
+        free (store->filename);
+        free (store);
+}
+
 void
 ply_key_file_free (ply_key_file_t *key_file)
 {
@@ -149,170 +152,220 @@ ply_key_file_free (ply_key_file_t *key_file)
                 return;
 
         assert (key_file->filename != NULL);
-        ply_hashtable_foreach (key_file->groups,
-                               ply_key_file_free_group,
-                               NULL);
 
-        if (key_file->groupless_group)
-                ply_key_file_free_group (NULL, key_file->groupless_group, NULL);
-
-        ply_hashtable_free (key_file->groups);
+        ply_key_file_store_unref (key_file->store);
         free (key_file->filename);
         free (key_file);
 }
 
-static ply_key_file_group_t *
-ply_key_file_load_group (ply_key_file_t *key_file,
-                         const char     *group_name)
+/* Copies the text between start and end, without surrounding white space,
+ * to the end of the store's text
+ */
+static char *
+ply_key_file_store_add_string (char      **text_end,
+                               const char *start,
+                               const char *end)
 {
-        int items_matched;
-        ply_key_file_group_t *group;
+        char *string = *text_end;
 
-        group = calloc (1, sizeof(ply_key_file_group_t));
-        group->name = strdup (group_name);
-        group->entries = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
+        while (start < end && isspace ((unsigned char) *start)) {
+                start++;
+        }
 
-        ply_trace ("trying to load group %s", group_name);
-        do {
-                ply_key_file_entry_t *entry;
-                char *key;
-                char *value;
-                off_t offset;
-                int first_byte;
+        while (end > start && isspace ((unsigned char) end[-1])) {
+                end--;
+        }
 
-                key = NULL;
-                value = NULL;
+        memcpy (string, start, end - start);
+        string[end - start] = '\0';
+        *text_end = string + (end - start) + 1;
 
-                do {
-                        first_byte = fgetc (key_file->fp);
-                } while (isspace (first_byte));
+        return string;
+}
 
-                if (first_byte == '#') {
-                        char *line_to_toss;
-                        size_t number_of_bytes;
+static void
+ply_key_file_store_parse (ply_key_file_store_t *store,
+                          const char           *data,
+                          size_t                size)
+{
+        const char *line, *line_end, *data_end;
+        ply_key_file_group_t *group = NULL;
+        char *text_end;
 
-                        line_to_toss = NULL;
-                        number_of_bytes = 0;
+        /* Every line gives up at least its newline, or the '=' or brackets
+         * it has, for the terminators, so the file's size and one more for
+         * the last line is always enough room
+         */
+        store->text = malloc (size + 1);
+        text_end = store->text;
+        data_end = data + size;
 
-                        getline (&line_to_toss, &number_of_bytes,
-                                 key_file->fp);
-                        free (line_to_toss);
-                        items_matched = 0;
-                        continue;
+        for (line = data; line < data_end; line = line_end + 1) {
+                const char *start, *end, *separator;
+                char *key, *name;
+
+                line_end = memchr (line, '\n', data_end - line);
+
+                if (line_end == NULL)
+                        line_end = data_end;
+
+                start = line;
+                end = line_end;
+
+                while (start < end && isspace ((unsigned char) *start)) {
+                        start++;
                 }
-                ungetc (first_byte, key_file->fp);
 
-                offset = ftello (key_file->fp);
-                items_matched = fscanf (key_file->fp, " %m[^= \t\n] = %m[^\n] ", &key, &value);
+                if (start == end || *start == '#')
+                        continue;
+
+                if (*start == '[') {
+                        separator = memchr (start, ']', end - start);
+
+                        if (separator == NULL)
+                                continue;
 
-                if (items_matched != 2) {
-                        if (items_matched == 1)
-                                fseeko (key_file->fp, offset, SEEK_SET);
+                        name = ply_key_file_store_add_string (&text_end, start + 1, separator);
 
-                        free (key);
-                        free (value);
-                        break;
+                        group = ply_hashtable_lookup (store->groups, name);
+
+                        if (group == NULL) {
+                                ply_trace ("found group %s", name);
+                                group = ply_key_file_group_new (name);
+                                ply_hashtable_insert (store->groups, group->name, group);
+                        }
+                        continue;
                 }
 
-                entry = calloc (1, sizeof(ply_key_file_entry_t));
+                separator = memchr (start, '=', end - start);
 
-                entry->key = key;
-                entry->value = value;
+                if (separator == NULL || separator == start)
+                        continue;
 
-                ply_hashtable_insert (group->entries, entry->key, entry);
-        } while (items_matched != EOF);
+                if (group == NULL) {
+                        if (store->groupless_group == NULL)
+                                store->groupless_group = ply_key_file_group_new (NULL);
 
-        return group;
+                        group = store->groupless_group;
+                }
+
+                key = ply_key_file_store_add_string (&text_end, start, separator);
+
+                /* The first time a key shows up in a group is what counts */
+                if (ply_hashtable_lookup (group->entries, key) != NULL)
+                        continue;
+
+                ply_hashtable_insert (group->entries, key,
+                                      ply_key_file_store_add_string (&text_end, separator + 1, end));
+        }
 }
 
-static bool
-ply_key_file_load_groups (ply_key_file_t *key_file)
+static ply_key_file_store_t *
+ply_key_file_store_load (const char *filename)
 {
-        int items_matched;
-        bool added_group = false;
-        bool has_comments = false;
+        ply_key_file_store_t *store;
+        struct stat file_info;
+        void *data = NULL;
+        int fd;
+
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
 
-        do {
-                char *group_name;
-                int first_byte;
+        if (fd < 0) {
+                ply_trace ("Failed to open key file %s: %m", filename);
+                return NULL;
+        }
 
-                ply_key_file_group_t *group;
+        if (fstat (fd, &file_info) < 0) {
+                ply_trace ("Failed to look at key file %s: %m", filename);
+                close (fd);
+                return NULL;
+        }
 
-                first_byte = fgetc (key_file->fp);
-                if (first_byte == '#') {
-                        char *line_to_toss;
-                        size_t number_of_bytes;
+        if (stores == NULL)
+                stores = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
 
-                        line_to_toss = NULL;
-                        number_of_bytes = 0;
+        store = ply_hashtable_lookup (stores, (void *) filename);
 
-                        getline (&line_to_toss, &number_of_bytes,
-                                 key_file->fp);
-                        free (line_to_toss);
-                        has_comments = true;
-                        items_matched = 0;
-                        continue;
+        if (store != NULL) {
+                if (store->device == file_info.st_dev &&
+                    store->inode == file_info.st_ino &&
+                    store->size == file_info.st_size &&
+                    store->modification_time.tv_sec == file_info.st_mtim.tv_sec &&
+                    store->modification_time.tv_nsec == file_info.st_mtim.tv_nsec) {
+                        close (fd);
+                        store->reference_count++;
+                        return store;
                 }
-                ungetc (first_byte, key_file->fp);
 
-                group_name = NULL;
-                items_matched = fscanf (key_file->fp, " [ %m[^]] ] ", &group_name);
+                ply_trace ("key file %s changed since it was last loaded", filename);
+                ply_hashtable_remove (stores, (void *) filename);
+                ply_key_file_store_unref (store);
+        }
 
-                if (items_matched <= 0) {
-                        ply_trace ("key file has no %sgroups",
-                                   added_group ? "more " : "");
-                        break;
-                }
+        if (file_info.st_size > 0) {
+                data = mmap (NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-                assert (group_name != NULL);
-                group = ply_key_file_load_group (key_file, group_name);
+                if (data == MAP_FAILED) {
+                        ply_trace ("Failed to map key file %s: %m", filename);
+                        close (fd);
+                        return NULL;
+                }
+        }
+        close (fd);
 
-                free (group_name);
+        store = calloc (1, sizeof(ply_key_file_store_t));
+        store->filename = strdup (filename);
+        store->device = file_info.st_dev;
+        store->inode = file_info.st_ino;
+        store->size = file_info.st_size;
+        store->modification_time = file_info.st_mtim;
+        store->groups = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
 
-                if (group == NULL)
-                        break;
+        ply_key_file_store_parse (store, data, file_info.st_size);
 
-                ply_hashtable_insert (key_file->groups, group->name, group);
-                added_group = true;
-        } while (items_matched != EOF);
+        if (data != NULL)
+                munmap (data, file_info.st_size);
 
-        if (!added_group && has_comments)
-                ply_trace ("key file has comments but no groups");
+        /* one reference for the cache, and one for the caller */
+        store->reference_count = 2;
+        ply_hashtable_insert (stores, store->filename, store);
 
-        return added_group;
+        return store;
 }
 
 bool
 ply_key_file_load (ply_key_file_t *key_file)
 {
-        bool was_loaded;
-
         assert (key_file != NULL);
 
-        if (!ply_key_file_open_file (key_file))
-                return false;
+        ply_key_file_store_unref (key_file->store);
+        key_file->store = ply_key_file_store_load (key_file->filename);
 
-        was_loaded = ply_key_file_load_groups (key_file);
+        if (key_file->store == NULL)
+                return false;
 
-        if (!was_loaded)
+        if (ply_hashtable_get_size (key_file->store->groups) == 0) {
                 ply_trace ("was unable to load any groups");
+                return false;
+        }
 
-        ply_key_file_close_file (key_file);
-
-        return was_loaded;
+        return true;
 }
 
 static ply_key_file_group_t *
 ply_key_file_find_group (ply_key_file_t *key_file,
                          const char     *group_name)
 {
+        if (key_file->store == NULL)
+                return NULL;
+
         if (!group_name)
-                return key_file->groupless_group;
+                return key_file->store->groupless_group;
 
-        return ply_hashtable_lookup (key_file->groups, (void *) group_name);
+        return ply_hashtable_lookup (key_file->store->groups, (void *) group_name);
 }
 
-static ply_key_file_entry_t *
+static char *
 ply_key_file_find_entry (ply_key_file_t       *key_file,
                          ply_key_file_group_t *group,
                          const char           *key)
@@ -326,16 +379,16 @@ ply_key_file_has_key (ply_key_file_t *key_file,
                       const char     *key)
 {
         ply_key_file_group_t *group;
-        ply_key_file_entry_t *entry;
+        char *value;
 
         group = ply_key_file_find_group (key_file, group_name);
 
         if (group == NULL)
                 return false;
 
-        entry = ply_key_file_find_entry (key_file, group, key);
+        value = ply_key_file_find_entry (key_file, group, key);
 
-        return entry != NULL;
+        return value != NULL;
 }
 
 static char *
@@ -344,7 +397,7 @@ ply_key_file_get_raw_value (ply_key_file_t *key_file,
                             const char     *key)
 {
         ply_key_file_group_t *group;
-        ply_key_file_entry_t *entry;
+        char *value;
 
         group = ply_key_file_find_group (key_file, group_name);
 
@@ -353,14 +406,14 @@ ply_key_file_get_raw_value (ply_key_file_t *key_file,
                 return NULL;
         }
 
-        entry = ply_key_file_find_entry (key_file, group, key);
+        value = ply_key_file_find_entry (key_file, group, key);
 
-        if (entry == NULL) {
+        if (value == NULL) {
                 ply_trace ("key file does not have entry for key '%s'", key);
                 return NULL;
         }
 
-        return entry->value;
+        return value;
 }
 
 char *
@@ -426,15 +479,13 @@ ply_key_file_foreach_entry_entries (void *key,
                                     void *data,
                                     void *user_data)
 {
-        ply_key_file_entry_t *entry;
         ply_key_file_foreach_func_data_t *func_data;
 
         func_data = user_data;
-        entry = data;
 
         func_data->func (func_data->group_name,
-                         entry->key,
-                         entry->value,
+                         key,
+                         data,
                          func_data->user_data);
 }
 
@@ -462,9 +513,12 @@ ply_key_file_foreach_entry (ply_key_file_t             *key_file,
 {
         ply_key_file_foreach_func_data_t func_data;
 
+        if (key_file->store == NULL)
+                return;
+
         func_data.func = func;
         func_data.user_data = user_data;
-        ply_hashtable_foreach (key_file->groups,
+        ply_hashtable_foreach (key_file->store->groups,
                                ply_key_file_foreach_entry_groups,
                                &func_data);
 }
@@ -472,15 +526,12 @@ ply_key_file_foreach_entry (ply_key_file_t             *key_file,
 bool
 ply_key_file_load_groupless_file (ply_key_file_t *key_file)
 {
-        if (!ply_key_file_open_file (key_file))
-                return false;
-
-        key_file->groupless_group =
-                ply_key_file_load_group (key_file, "NONE");
+        assert (key_file != NULL);
 
-        ply_key_file_close_file (key_file);
+        ply_key_file_store_unref (key_file->store);
+        key_file->store = ply_key_file_store_load (key_file->filename);
 
-        return key_file->groupless_group != NULL;
+        return key_file->store != NULL;
 }
 
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -26,6 +26,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -37,12 +38,14 @@ struct _ply_list
         int              number_of_nodes;
 };
 
-struct _ply_list_node
-{
-        void                  *data;
-        struct _ply_list_node *previous;
-        struct _ply_list_node *next;
-};
+/* Freed nodes are kept around for the next list that needs one, since
+ * lists get rebuilt all the time.  Lists get used on worker threads
+ * too, so each thread has its own stash.
+ */
+#define PLY_LIST_MAX_UNUSED_NODES 256
+
+static __thread ply_list_node_t *unused_nodes;
+static __thread int number_of_unused_nodes;
 
 ply_list_t *
 ply_list_new (void)
@@ -70,7 +73,15 @@ ply_list_node_new (void *data)
 {
         ply_list_node_t *node;
 
-        node = calloc (1, sizeof(ply_list_node_t));
+        if (unused_nodes != NULL) {
+                node = unused_nodes;
+                unused_nodes = node->next;
+                number_of_unused_nodes--;
+
+                node->next = NULL;
+        } else {
+                node = calloc (1, sizeof(ply_list_node_t));
+        }
         node->data = data;
 
         return node;
@@ -84,7 +95,19 @@ ply_list_node_free (ply_list_node_t *node)
 
         assert ((node->previous == NULL) && (node->next == NULL));
 
-        free (node);
+        /* belongs to whatever it's embedded in */
+        if (node->is_embedded)
+                return;
+
+        if (number_of_unused_nodes >= PLY_LIST_MAX_UNUSED_NODES) {
+                free (node);
+                return;
+        }
+
+        node->data = NULL;
+        node->next = unused_nodes;
+        unused_nodes = node;
+        number_of_unused_nodes++;
 }
 
 int
@@ -156,6 +179,30 @@ ply_list_insert_data (ply_list_t      *list,
         return node;
 }
 
+void
+ply_list_insert_embedded_node (ply_list_t      *list,
+                               ply_list_node_t *node,
+                               void            *data,
+                               ply_list_node_t *node_before)
+{
+        assert (node != NULL);
+
+        node->data = data;
+        node->previous = NULL;
+        node->next = NULL;
+        node->is_embedded = true;
+
+        ply_list_insert_node (list, node_before, node);
+}
+
+void
+ply_list_append_embedded_node (ply_list_t      *list,
+                               ply_list_node_t *node,
+                               void            *data)
+{
+        ply_list_insert_embedded_node (list, node, data, list->last_node);
+}
+
 ply_list_node_t *
 ply_list_append_data (ply_list_t *list,
                       void       *data)
@@ -279,79 +326,104 @@ ply_list_get_next_node (ply_list_t      *list,
         return node->next;
 }
 
-static void
-ply_list_sort_swap (void **element_a,
-                    void **element_b)
+ply_list_node_t *
+ply_list_get_previous_node (ply_list_t      *list,
+                            ply_list_node_t *node)
 {
-        void *temp;
-
-        temp = *element_a;
-        *element_a = *element_b;
-        *element_b = temp;
+        return node->previous;
 }
 
-static void
-ply_list_sort_body (ply_list_node_t         *node_start,
-                    ply_list_node_t         *node_end,
-                    ply_list_compare_func_t *compare)
+/* Sorting moves the nodes rather than the data in them, so a node
+ * embedded in an element stays with it
+ */
+static ply_list_node_t *
+ply_list_merge_sorted_nodes (ply_list_node_t         *node_a,
+                             ply_list_node_t         *node_b,
+                             ply_list_compare_func_t *compare)
 {
-        if (node_start == node_end) return;
-        ply_list_node_t *cur_node = node_start;
-        ply_list_node_t *top_node = node_end;
-        ply_list_node_t *next_node = cur_node->next;
-        while (cur_node != top_node) {
-                int diff = compare (cur_node->data, next_node->data);
-                if (diff > 0) {
-                        ply_list_sort_swap (&next_node->data,
-                                            &cur_node->data);
-                        cur_node = next_node;
-                        next_node = cur_node->next;
+        ply_list_node_t head = { NULL }, *tail = &head;
+
+        while (node_a != NULL && node_b != NULL) {
+                if (compare (node_a->data, node_b->data) <= 0) {
+                        tail->next = node_a;
+                        node_a = node_a->next;
                 } else {
-                        ply_list_sort_swap (&next_node->data,
-                                            &top_node->data);
-                        top_node = top_node->previous;
+                        tail->next = node_b;
+                        node_b = node_b->next;
                 }
+                tail = tail->next;
         }
 
-        if (cur_node != node_end)
-                ply_list_sort_body (cur_node->next,
-                                    node_end,
-                                    compare);
-        if (cur_node != node_start)
-                ply_list_sort_body (node_start,
-                                    cur_node->previous,
-                                    compare);
+        tail->next = node_a != NULL ? node_a : node_b;
+
+        return head.next;
+}
+
+/* Enough for any number of runs an int can count */
+#define PLY_LIST_MAX_MERGE_LEVELS (sizeof(int) * 8)
+
+/* A bottom up merge sort over the runs already in order, so a sorted list,
+ * like sprites that rarely change depth, takes one pass.  levels[i] holds
+ * 2^i runs merged together, and comes before anything in lower levels.
+ */
+static ply_list_node_t *
+ply_list_sort_nodes (ply_list_node_t         *first_node,
+                     ply_list_compare_func_t *compare)
+{
+        ply_list_node_t *levels[PLY_LIST_MAX_MERGE_LEVELS] = { NULL };
+        ply_list_node_t *node, *run, *sorted_nodes;
+        size_t i;
+
+        node = first_node;
+        while (node != NULL) {
+                run = node;
+                while (node->next != NULL && compare (node->data, node->next->data) <= 0) {
+                        node = node->next;
+                }
+                first_node = node->next;
+                node->next = NULL;
+                node = first_node;
+
+                for (i = 0; i < PLY_LIST_MAX_MERGE_LEVELS - 1 && levels[i] != NULL; i++) {
+                        run = ply_list_merge_sorted_nodes (levels[i], run, compare);
+                        levels[i] = NULL;
+                }
+                levels[i] = ply_list_merge_sorted_nodes (levels[i], run, compare);
+        }
+
+        sorted_nodes = NULL;
+        for (i = 0; i < PLY_LIST_MAX_MERGE_LEVELS; i++) {
+                if (levels[i] != NULL)
+                        sorted_nodes = ply_list_merge_sorted_nodes (levels[i], sorted_nodes, compare);
+        }
+
+        return sorted_nodes;
 }
 
 void
 ply_list_sort (ply_list_t              *list,
                ply_list_compare_func_t *compare)
 {
-        ply_list_sort_body (ply_list_get_first_node (list),
-                            ply_list_get_last_node (list),
-                            compare);
+        ply_list_node_t *node, *previous_node;
+
+        list->first_node = ply_list_sort_nodes (list->first_node, compare);
+
+        previous_node = NULL;
+        for (node = list->first_node; node != NULL; node = node->next) {
+                node->previous = previous_node;
+                previous_node = node;
+        }
+        list->last_node = previous_node;
 }
 
+/* Merging keeps nodes that compare equal in order, so this is the same
+ * sort as ply_list_sort
+ */
 void
 ply_list_sort_stable (ply_list_t              *list,
                       ply_list_compare_func_t *compare)
 {
-        ply_list_node_t *top_node;
-        ply_list_node_t *cur_node;
-
-        top_node = ply_list_get_first_node (list);
-        if (top_node == NULL) return;
-        top_node = top_node->next;
-
-        while (top_node) {
-                cur_node = top_node->previous;
-                while (cur_node && compare (cur_node->data, cur_node->next->data) > 0) {
-                        ply_list_sort_swap (&cur_node->data,
-                                            &cur_node->next->data);
-                        cur_node = cur_node->previous;
-                }
-                top_node = top_node->next;
-        }
+        ply_list_sort (list, compare);
 }
 
 void *
@@ -27,6 +27,17 @@ typedef struct _ply_list ply_list_t;
 typedef int (ply_list_compare_func_t) (void *elementa,
                                        void *elementb);
 
+/* Only public so a node can be embedded in the element it links; use
+ * the functions below rather than the fields
+ */
+struct _ply_list_node
+{
+        void                  *data;
+        struct _ply_list_node *previous;
+        struct _ply_list_node *next;
+        unsigned int           is_embedded : 1;
+};
+
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_list_t *ply_list_new (void);
 void ply_list_free (ply_list_t *list);
@@ -40,6 +51,18 @@ ply_list_node_t *ply_list_append_data (ply_list_t *list,
                                        void       *data);
 ply_list_node_t *ply_list_prepend_data (ply_list_t *list,
                                         void       *data);
+
+/* Links a node that lives inside the element itself, so adding the
+ * element doesn't allocate.  Removing it, or freeing the list, only
+ * unlinks the node; the element must not be freed while it's linked.
+ */
+void ply_list_insert_embedded_node (ply_list_t      *list,
+                                    ply_list_node_t *node,
+                                    void            *data,
+                                    ply_list_node_t *node_before);
+void ply_list_append_embedded_node (ply_list_t      *list,
+                                    ply_list_node_t *node,
+                                    void            *data);
 void ply_list_remove_data (ply_list_t *list,
                            void       *data);
 void ply_list_remove_node (ply_list_t      *list,
@@ -55,6 +78,8 @@ ply_list_node_t *ply_list_get_nth_node (ply_list_t *list,
                                         int         index);
 ply_list_node_t *ply_list_get_next_node (ply_list_t      *list,
                                          ply_list_node_t *node);
+ply_list_node_t *ply_list_get_previous_node (ply_list_t      *list,
+                                             ply_list_node_t *node);
 void *ply_list_node_get_data (ply_list_node_t *node);
 #endif
 
@@ -26,6 +26,8 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,6 +36,7 @@
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -64,15 +67,39 @@ struct _ply_logger
         bool                      output_fd_is_terminal;
         char                     *filename;
 
+        /* Ring of buffered log text: buffer_size bytes starting at
+         * buffer_start, wrapping around at buffer_capacity.  Once the
+         * capacity can't grow past buffer_capacity_limit anymore, new
+         * text overwrites the oldest.
+         */
         char                     *buffer;
+        size_t                    buffer_start;
         size_t                    buffer_size;
         size_t                    buffer_capacity;
+        size_t                    buffer_capacity_limit;
 
         ply_logger_flush_policy_t flush_policy;
         ply_list_t               *filters;
 
+        /* Set while attached to an event loop, where the output fd is
+         * made non-blocking and whatever couldn't be written right away
+         * goes out when the fd says it's writable.
+         */
+        ply_event_loop_t         *loop;
+        ply_fd_watch_t           *output_watch;
+        int                       output_fd_flags;
+
+        /* Text logged from other threads waits here until the thread
+         * that made the logger gets around to logging or flushing
+         */
+        pthread_t                 owner_thread;
+        pthread_mutex_t           foreign_bytes_lock;
+        char                     *foreign_bytes;
+        size_t                    foreign_bytes_size;
+
         uint32_t                  is_enabled : 1;
         uint32_t                  tracing_is_enabled : 1;
+        uint32_t                  is_flushing_in_background : 1;
 };
 
 static bool ply_text_is_loggable (const char *string,
@@ -87,7 +114,8 @@ static bool ply_logger_write (ply_logger_t *logger,
 static bool ply_logger_buffer (ply_logger_t *logger,
                                const char   *string,
                                size_t        length);
-static bool ply_logger_flush_buffer (ply_logger_t *logger);
+static bool ply_logger_flush_buffer (ply_logger_t *logger,
+                                     bool          should_block);
 
 static bool
 ply_text_is_loggable (const char *string,
@@ -147,52 +175,141 @@ ply_logger_write (ply_logger_t *logger,
         return true;
 }
 
-static bool
-ply_logger_flush_buffer (ply_logger_t *logger)
+static size_t
+ply_logger_get_buffer_segments (ply_logger_t *logger,
+                                struct iovec  segments[2])
+{
+        size_t bytes_before_wrap;
+
+        bytes_before_wrap = MIN (logger->buffer_size,
+                                 logger->buffer_capacity - logger->buffer_start);
+
+        segments[0].iov_base = logger->buffer + logger->buffer_start;
+        segments[0].iov_len = bytes_before_wrap;
+
+        if (bytes_before_wrap == logger->buffer_size)
+                return 1;
+
+        segments[1].iov_base = logger->buffer;
+        segments[1].iov_len = logger->buffer_size - bytes_before_wrap;
+
+        return 2;
+}
+
+static void
+ply_logger_decapitate_buffer (ply_logger_t *logger,
+                              size_t        bytes_in_head)
 {
         assert (logger != NULL);
 
+        bytes_in_head = MIN (logger->buffer_size, bytes_in_head);
+
+        logger->buffer_size -= bytes_in_head;
+
         if (logger->buffer_size == 0)
-                return true;
+                logger->buffer_start = 0;
+        else
+                logger->buffer_start = (logger->buffer_start + bytes_in_head) % logger->buffer_capacity;
+}
 
-        if (!ply_logger_write (logger, logger->buffer, logger->buffer_size, true))
-                return false;
+static bool
+ply_logger_wait_for_output_fd (ply_logger_t *logger)
+{
+        struct pollfd poll_descriptor = { .fd = logger->output_fd, .events = POLLOUT };
 
-        memset (logger->buffer, '\0', logger->buffer_size);
-        logger->buffer_size = 0;
+        while (poll (&poll_descriptor, 1, -1) < 0) {
+                if (errno != EINTR)
+                        return false;
+        }
 
         return true;
 }
 
 static bool
-ply_logger_increase_buffer_size (ply_logger_t *logger)
+ply_logger_flush_buffer (ply_logger_t *logger,
+                         bool          should_block)
 {
         assert (logger != NULL);
 
-        if ((logger->buffer_capacity * 2) > PLY_LOGGER_MAX_BUFFER_CAPACITY)
-                return false;
+        while (logger->buffer_size > 0) {
+                struct iovec segments[2];
+                size_t number_of_segments;
+                ssize_t bytes_written;
+
+                number_of_segments = ply_logger_get_buffer_segments (logger, segments);
+                bytes_written = writev (logger->output_fd, segments, number_of_segments);
 
-        logger->buffer_capacity *= 2;
+                if (bytes_written <= 0) {
+                        if (bytes_written < 0 && errno == EINTR)
+                                continue;
+
+                        if (bytes_written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                                if (!should_block)
+                                        return true;
+
+                                if (ply_logger_wait_for_output_fd (logger))
+                                        continue;
+                        }
+
+                        ply_logger_write_exception (logger, strerror (errno));
+                        return false;
+                }
+
+                ply_logger_decapitate_buffer (logger, bytes_written);
+        }
 
-        logger->buffer = realloc (logger->buffer, logger->buffer_capacity);
         return true;
 }
 
 static void
-ply_logger_decapitate_buffer (ply_logger_t *logger,
-                              size_t        bytes_in_head)
+ply_logger_resize_buffer (ply_logger_t *logger,
+                          size_t        capacity)
 {
+        struct iovec segments[2];
+        size_t number_of_segments, i;
+        char *buffer;
+        size_t size;
+
         assert (logger != NULL);
+        assert (capacity > 0);
 
-        bytes_in_head = MIN (logger->buffer_size, bytes_in_head);
+        /* Drop the oldest text if the new capacity can't hold all of it */
+        if (logger->buffer_size > capacity)
+                ply_logger_decapitate_buffer (logger, logger->buffer_size - capacity);
 
-        if (bytes_in_head == logger->buffer_size) {
-                logger->buffer_size = 0;
-        } else {
-                memmove (logger->buffer, logger->buffer + bytes_in_head,
-                         logger->buffer_size - bytes_in_head);
-                logger->buffer_size -= bytes_in_head;
+        buffer = malloc (capacity);
+        size = 0;
+
+        number_of_segments = ply_logger_get_buffer_segments (logger, segments);
+        for (i = 0; i < number_of_segments; i++) {
+                memcpy (buffer + size, segments[i].iov_base, segments[i].iov_len);
+                size += segments[i].iov_len;
         }
+
+        free (logger->buffer);
+        logger->buffer = buffer;
+        logger->buffer_start = 0;
+        logger->buffer_size = size;
+        logger->buffer_capacity = capacity;
+}
+
+static bool
+ply_logger_increase_buffer_size (ply_logger_t *logger,
+                                 size_t        size_needed)
+{
+        size_t capacity;
+
+        assert (logger != NULL);
+
+        if (logger->buffer_capacity >= logger->buffer_capacity_limit)
+                return false;
+
+        capacity = logger->buffer_capacity;
+        while (capacity < size_needed && capacity < logger->buffer_capacity_limit)
+                capacity *= 2;
+
+        ply_logger_resize_buffer (logger, MIN (capacity, logger->buffer_capacity_limit));
+        return true;
 }
 
 static bool
@@ -200,28 +317,226 @@ ply_logger_buffer (ply_logger_t *logger,
                    const char   *string,
                    size_t        length)
 {
+        size_t end, bytes_before_wrap;
+
         assert (logger != NULL);
 
-        if ((logger->buffer_size + length) >= logger->buffer_capacity) {
-                if (!ply_logger_increase_buffer_size (logger)) {
-                        ply_logger_decapitate_buffer (logger, length);
+        if ((logger->buffer_size + length) > logger->buffer_capacity)
+                ply_logger_increase_buffer_size (logger, logger->buffer_size + length);
 
-                        if ((logger->buffer_size + length) >= logger->buffer_capacity)
-                                if (!ply_logger_increase_buffer_size (logger))
-                                        return false;
-                }
+        /* Only the tail end of something bigger than the whole ring fits */
+        if (length > logger->buffer_capacity) {
+                string += length - logger->buffer_capacity;
+                length = logger->buffer_capacity;
         }
 
-        assert (logger->buffer_size + length < logger->buffer_capacity);
+        if ((logger->buffer_size + length) > logger->buffer_capacity)
+                ply_logger_decapitate_buffer (logger,
+                                              logger->buffer_size + length - logger->buffer_capacity);
+
+        end = (logger->buffer_start + logger->buffer_size) % logger->buffer_capacity;
+        bytes_before_wrap = MIN (length, logger->buffer_capacity - end);
 
-        memcpy (logger->buffer + logger->buffer_size,
-                string, length);
+        memcpy (logger->buffer + end, string, bytes_before_wrap);
+        memcpy (logger->buffer, string + bytes_before_wrap, length - bytes_before_wrap);
 
         logger->buffer_size += length;
 
         return true;
 }
 
+static void
+ply_logger_make_output_fd_nonblocking (ply_logger_t *logger)
+{
+        int flags;
+
+        if (logger->output_fd < 0)
+                return;
+
+        flags = fcntl (logger->output_fd, F_GETFL);
+
+        if (flags < 0 || (flags & O_NONBLOCK))
+                return;
+
+        if (fcntl (logger->output_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+                return;
+
+        logger->output_fd_flags = flags;
+}
+
+static void
+ply_logger_restore_output_fd_flags (ply_logger_t *logger)
+{
+        if (logger->output_fd_flags < 0)
+                return;
+
+        if (logger->output_fd >= 0)
+                fcntl (logger->output_fd, F_SETFL, logger->output_fd_flags);
+
+        logger->output_fd_flags = -1;
+}
+
+static void
+ply_logger_stop_watching_output_fd (ply_logger_t *logger)
+{
+        ply_fd_watch_t *watch;
+        bool was_flushing_in_background;
+
+        if (logger->output_watch == NULL)
+                return;
+
+        watch = logger->output_watch;
+        logger->output_watch = NULL;
+
+        /* The event loop traces, so keep it from coming back in here */
+        was_flushing_in_background = logger->is_flushing_in_background;
+        logger->is_flushing_in_background = true;
+        ply_event_loop_stop_watching_fd (logger->loop, watch);
+        logger->is_flushing_in_background = was_flushing_in_background;
+}
+
+static void
+on_output_fd_writable (ply_logger_t *logger)
+{
+        ply_logger_queue_flush (logger);
+}
+
+static void
+on_output_fd_disconnected (ply_logger_t *logger)
+{
+        logger->output_watch = NULL;
+}
+
+static void
+ply_logger_detach_from_event_loop (ply_logger_t *logger)
+{
+        assert (logger != NULL);
+
+        ply_logger_stop_watching_output_fd (logger);
+        ply_logger_restore_output_fd_flags (logger);
+        logger->loop = NULL;
+
+        if (ply_logger_is_logging (logger) && logger->output_fd >= 0)
+                ply_logger_flush (logger);
+}
+
+void
+ply_logger_attach_to_event_loop (ply_logger_t     *logger,
+                                 ply_event_loop_t *loop)
+{
+        assert (logger != NULL);
+        assert (loop != NULL);
+        assert (logger->loop == NULL);
+
+        logger->loop = loop;
+
+        ply_event_loop_watch_for_exit (loop, (ply_event_loop_exit_handler_t)
+                                       ply_logger_detach_from_event_loop,
+                                       logger);
+
+        ply_logger_make_output_fd_nonblocking (logger);
+}
+
+static bool
+ply_logger_is_on_owner_thread (ply_logger_t *logger)
+{
+        return pthread_equal (pthread_self (), logger->owner_thread);
+}
+
+static void
+ply_logger_hold_foreign_bytes (ply_logger_t *logger,
+                               const void   *bytes,
+                               size_t        number_of_bytes)
+{
+        size_t size;
+
+        pthread_mutex_lock (&logger->foreign_bytes_lock);
+        size = logger->foreign_bytes_size;
+        if (size + number_of_bytes <= PLY_LOGGER_MAX_BUFFER_CAPACITY) {
+                logger->foreign_bytes = realloc (logger->foreign_bytes, size + number_of_bytes);
+                memcpy (logger->foreign_bytes + size, bytes, number_of_bytes);
+                __atomic_store_n (&logger->foreign_bytes_size, size + number_of_bytes, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock (&logger->foreign_bytes_lock);
+}
+
+static void
+ply_logger_take_foreign_bytes (ply_logger_t *logger)
+{
+        char *bytes;
+        size_t number_of_bytes;
+
+        if (__atomic_load_n (&logger->foreign_bytes_size, __ATOMIC_RELAXED) == 0)
+                return;
+
+        pthread_mutex_lock (&logger->foreign_bytes_lock);
+        bytes = logger->foreign_bytes;
+        number_of_bytes = logger->foreign_bytes_size;
+        logger->foreign_bytes = NULL;
+        __atomic_store_n (&logger->foreign_bytes_size, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock (&logger->foreign_bytes_lock);
+
+        if (number_of_bytes > 0)
+                ply_logger_inject_bytes (logger, bytes, number_of_bytes);
+        free (bytes);
+}
+
+bool
+ply_logger_queue_flush (ply_logger_t *logger)
+{
+        bool flushed = true;
+
+        assert (logger != NULL);
+
+        if (!ply_logger_is_on_owner_thread (logger))
+                return true;
+
+        ply_logger_take_foreign_bytes (logger);
+
+        if (logger->loop == NULL)
+                return ply_logger_flush (logger);
+
+        if (!ply_logger_is_logging (logger))
+                return false;
+
+        if (logger->output_fd < 0)
+                return false;
+
+        if (logger->is_flushing_in_background)
+                return true;
+
+        logger->is_flushing_in_background = true;
+        while (true) {
+                if (!ply_logger_flush_buffer (logger, false)) {
+                        ply_logger_stop_watching_output_fd (logger);
+                        flushed = false;
+                        break;
+                }
+
+                if (logger->buffer_size == 0) {
+                        if (logger->output_watch == NULL)
+                                break;
+
+                        ply_logger_stop_watching_output_fd (logger);
+                        continue;
+                }
+
+                if (logger->output_watch == NULL)
+                        logger->output_watch = ply_event_loop_watch_fd (logger->loop,
+                                                                        logger->output_fd,
+                                                                        PLY_EVENT_LOOP_FD_STATUS_CAN_TAKE_DATA,
+                                                                        (ply_event_handler_t)
+                                                                        on_output_fd_writable,
+                                                                        (ply_event_handler_t)
+                                                                        on_output_fd_disconnected,
+                                                                        logger);
+                break;
+        }
+        logger->is_flushing_in_background = false;
+
+        return flushed;
+}
+
 ply_logger_t *
 ply_logger_new (void)
 {
@@ -235,12 +550,19 @@ ply_logger_new (void)
         logger->is_enabled = true;
         logger->tracing_is_enabled = false;
 
-        logger->buffer_capacity = 4096;
+        logger->buffer_capacity_limit = PLY_LOGGER_MAX_BUFFER_CAPACITY;
+        logger->buffer_capacity = MIN (4096, logger->buffer_capacity_limit);
         logger->buffer = calloc (1, logger->buffer_capacity);
+        logger->buffer_start = 0;
         logger->buffer_size = 0;
 
         logger->filters = ply_list_new ();
 
+        logger->output_fd_flags = -1;
+
+        logger->owner_thread = pthread_self ();
+        pthread_mutex_init (&logger->foreign_bytes_lock, NULL);
+
         return logger;
 }
 
@@ -298,6 +620,14 @@ ply_logger_free (ply_logger_t *logger)
         if (logger == NULL)
                 return;
 
+        if (logger->loop != NULL) {
+                ply_event_loop_stop_watching_for_exit (logger->loop,
+                                                       (ply_event_loop_exit_handler_t)
+                                                       ply_logger_detach_from_event_loop,
+                                                       logger);
+                ply_logger_detach_from_event_loop (logger);
+        }
+
         if (logger->output_fd >= 0) {
                 if (ply_logger_is_logging (logger))
                         ply_logger_flush (logger);
@@ -306,6 +636,8 @@ ply_logger_free (ply_logger_t *logger)
 
         ply_logger_free_filters (logger);
 
+        pthread_mutex_destroy (&logger->foreign_bytes_lock);
+        free (logger->foreign_bytes);
         free (logger->filename);
         free (logger->buffer);
         free (logger);
@@ -354,6 +686,9 @@ ply_logger_close_file (ply_logger_t *logger)
         if (logger->output_fd < 0)
                 return;
 
+        ply_logger_stop_watching_output_fd (logger);
+        ply_logger_restore_output_fd_flags (logger);
+
         close (logger->output_fd);
         ply_logger_set_output_fd (logger, -1);
 }
@@ -364,8 +699,14 @@ ply_logger_set_output_fd (ply_logger_t *logger,
 {
         assert (logger != NULL);
 
+        ply_logger_stop_watching_output_fd (logger);
+        ply_logger_restore_output_fd_flags (logger);
+
         logger->output_fd = fd;
         logger->output_fd_is_terminal = isatty(fd);
+
+        if (logger->loop != NULL)
+                ply_logger_make_output_fd_nonblocking (logger);
 }
 
 int
@@ -381,13 +722,24 @@ ply_logger_flush (ply_logger_t *logger)
 {
         assert (logger != NULL);
 
+        if (!ply_logger_is_on_owner_thread (logger))
+                return true;
+
+        ply_logger_take_foreign_bytes (logger);
+
         if (!ply_logger_is_logging (logger))
                 return false;
 
         if (logger->output_fd < 0)
                 return false;
 
-        if (!ply_logger_flush_buffer (logger))
+        if (!ply_logger_flush_buffer (logger, true))
+                return false;
+
+        ply_logger_stop_watching_output_fd (logger);
+
+        /* stopping the watch may have traced a little more */
+        if (!ply_logger_flush_buffer (logger, true))
                 return false;
 
 #ifdef SYNC_ON_FLUSH
@@ -399,6 +751,27 @@ ply_logger_flush (ply_logger_t *logger)
         return true;
 }
 
+void
+ply_logger_set_buffer_capacity_limit (ply_logger_t *logger,
+                                      size_t        limit)
+{
+        assert (logger != NULL);
+        assert (limit > 0);
+
+        logger->buffer_capacity_limit = limit;
+
+        if (logger->buffer_capacity > limit)
+                ply_logger_resize_buffer (logger, limit);
+}
+
+size_t
+ply_logger_get_buffer_capacity_limit (ply_logger_t *logger)
+{
+        assert (logger != NULL);
+
+        return logger->buffer_capacity_limit;
+}
+
 void
 ply_logger_set_flush_policy (ply_logger_t             *logger,
                              ply_logger_flush_policy_t policy)
@@ -505,6 +878,13 @@ ply_logger_inject_bytes (ply_logger_t *logger,
         assert (bytes != NULL);
         assert (number_of_bytes != 0);
 
+        if (!ply_logger_is_on_owner_thread (logger)) {
+                ply_logger_hold_foreign_bytes (logger, bytes, number_of_bytes);
+                return;
+        }
+
+        ply_logger_take_foreign_bytes (logger);
+
         filtered_bytes = NULL;
         filtered_size = 0;
         node = ply_list_get_first_node (logger->filters);
@@ -549,7 +929,7 @@ ply_logger_inject_bytes (ply_logger_t *logger,
                 || (logger->flush_policy == PLY_LOGGER_FLUSH_POLICY_EVERY_TIME));
 
         if (logger->flush_policy == PLY_LOGGER_FLUSH_POLICY_EVERY_TIME)
-                ply_logger_flush (logger);
+                ply_logger_queue_flush (logger);
 }
 
 void
@@ -28,6 +28,8 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "ply-event-loop.h"
+
 typedef struct _ply_logger ply_logger_t;
 
 typedef enum
@@ -53,6 +55,23 @@ void ply_logger_set_output_fd (ply_logger_t *logger,
                                int           fd);
 int ply_logger_get_output_fd (ply_logger_t *logger);
 bool ply_logger_flush (ply_logger_t *logger);
+
+/* Once attached to an event loop the output fd is made non-blocking.
+ * ply_logger_queue_flush then writes what it can right away and leaves
+ * the rest to go out when the fd becomes writable, while ply_logger_flush
+ * still waits until everything has been written.  Without an event loop
+ * the two are the same.
+ */
+void ply_logger_attach_to_event_loop (ply_logger_t     *logger,
+                                      ply_event_loop_t *loop);
+bool ply_logger_queue_flush (ply_logger_t *logger);
+
+/* Text that hasn't been flushed yet is kept in a ring that grows up to
+ * limit bytes, after which the oldest text gets overwritten.
+ */
+void ply_logger_set_buffer_capacity_limit (ply_logger_t *logger,
+                                           size_t        limit);
+size_t ply_logger_get_buffer_capacity_limit (ply_logger_t *logger);
 void ply_logger_set_flush_policy (ply_logger_t             *logger,
                                   ply_logger_flush_policy_t policy);
 ply_logger_flush_policy_t ply_logger_get_flush_policy (ply_logger_t *logger);
@@ -93,7 +112,7 @@ bool ply_logger_is_tracing_to_terminal (ply_logger_t *logger);
                         struct timespec timespec = { 0, 0 };                                   \
                         char buf[128];                                                         \
                         clock_gettime (CLOCK_MONOTONIC, &timespec);                            \
-                        ply_logger_flush (logger);                                             \
+                        ply_logger_queue_flush (logger);                                       \
                         snprintf (buf, sizeof(buf),                                            \
                                   "%02d:%02d:%02d.%03d %s:%d:%s",                              \
                                   (int)(timespec.tv_sec / 3600),                               \
@@ -105,7 +124,7 @@ bool ply_logger_is_tracing_to_terminal (ply_logger_t *logger);
                         ply_logger_inject (logger,                                             \
                                            "%-75.75s: " format "\n",                           \
                                            buf, ## args);                                      \
-                        ply_logger_flush (logger);                                             \
+                        ply_logger_queue_flush (logger);                                       \
                         errno = _old_errno;                                                    \
                 }                                                                        \
         }                                                                            \
@@ -0,0 +1,39 @@
+/* ply-probes.h - static probes for perf and bpftrace
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_PROBES_H
+#define PLY_PROBES_H
+
+/* Marks a spot perf or bpftrace can attach to as
+ * usdt:<binary>:plymouth:<name>, with up to a few integer or pointer
+ * arguments.  A probe that nothing is attached to is a nop instruction.
+ * Configuring with --enable-sdt-probes builds them in; otherwise they
+ * aren't there at all.  The probes are listed in docs/development.txt,
+ * so rename them with care.
+ */
+#ifdef PLY_ENABLE_SDT_PROBES
+#include <sys/sdt.h>
+
+#define ply_probe(name, args ...) STAP_PROBEV (plymouth, name, ## args)
+#else
+#define ply_probe(name, args ...)
+#endif
+
+#endif /* PLY_PROBES_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
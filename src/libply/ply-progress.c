@@ -32,11 +32,17 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 
+#include "ply-event-loop.h"
+#include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-progress.h"
@@ -46,10 +52,37 @@
 #define UPDATES_PER_SECOND 30
 #endif
 
+/* Past this, the estimate jumps ahead in one step instead of catching
+ * up an update at a time */
+#define MAX_CATCH_UP_TIME 10.0
+
 #ifndef DEFAULT_BOOT_DURATION
 #define DEFAULT_BOOT_DURATION 60.0
 #endif
 
+#define CACHE_MAGIC "PLYPROG1"
+
+/* The cache is this header, then number_of_buckets chains of messages
+ * hashed by their string, then the messages sorted by when they came,
+ * then their strings.  It gets used as it is on disk, in the byte order
+ * of the machine that saved it.
+ */
+typedef struct
+{
+        char     magic[8];
+        uint32_t number_of_messages;
+        uint32_t number_of_buckets;
+} ply_progress_cache_header_t;
+
+typedef struct
+{
+        double   percentage;
+        uint32_t string_offset;
+
+        /* index + 1 of the next message in the bucket, 0 ends it */
+        uint32_t next_in_bucket;
+} ply_progress_cache_message_t;
+
 
 struct _ply_progress
 {
@@ -58,11 +91,22 @@ struct _ply_progress
         double      scalar;
         double      last_percentage;
         double      last_percentage_time;
+        double      previous_percentage;
         double      dead_time;
         double      next_message_percentage;
         ply_list_t *current_message_list;
-        ply_list_t *previous_message_list;
+        ply_hashtable_t *current_messages;
+
+        /* what the last boot saved */
+        char                               *cache;
+        size_t                              cache_size;
+        const ply_progress_cache_header_t  *cache_header;
+        const uint32_t                     *cache_buckets;
+        const ply_progress_cache_message_t *cache_messages;
+        const char                         *cache_strings;
+
         uint32_t    paused : 1;
+        uint32_t    cache_is_mapped : 1;
 };
 
 typedef struct
@@ -86,7 +130,8 @@ ply_progress_new (void)
         progress->dead_time = 0.0;
         progress->next_message_percentage = 0.25;
         progress->current_message_list = ply_list_new ();
-        progress->previous_message_list = ply_list_new ();
+        progress->current_messages = ply_hashtable_new (ply_hashtable_string_hash,
+                                                        ply_hashtable_string_compare);
         progress->paused = false;
         return progress;
 }
@@ -108,98 +153,303 @@ ply_progress_free (ply_progress_t *progress)
                 node = next_node;
         }
         ply_list_free (progress->current_message_list);
+        ply_hashtable_free (progress->current_messages);
 
-        node = ply_list_get_first_node (progress->previous_message_list);
+        if (progress->cache_is_mapped)
+                munmap (progress->cache, progress->cache_size);
+        else
+                free (progress->cache);
 
-        while (node) {
-                ply_list_node_t *next_node;
-                ply_progress_message_t *message = ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (progress->previous_message_list, node);
-
-                free (message->string);
-                free (message);
-                node = next_node;
-        }
-        ply_list_free (progress->previous_message_list);
         free (progress);
         return;
 }
 
+/* FNV-1a, it has to come out the same for every build that reads the
+ * cache */
+static uint32_t
+hash_message (const char *string)
+{
+        uint32_t hash = 2166136261u;
+
+        while (*string != '\0') {
+                hash ^= (unsigned char) *string++;
+                hash *= 16777619u;
+        }
+
+        return hash;
+}
+
+/* strings and percentages have to be sorted by percentage */
+static char *
+build_cache (const char   **strings,
+             const double  *percentages,
+             uint32_t       number_of_messages,
+             size_t        *cache_size)
+{
+        ply_progress_cache_header_t *header;
+        ply_progress_cache_message_t *messages;
+        uint32_t *buckets, *last_in_bucket;
+        uint32_t number_of_buckets, i;
+        size_t strings_offset, strings_size;
+        char *cache;
+
+        strings_size = 0;
+        for (i = 0; i < number_of_messages; i++) {
+                strings_size += strlen (strings[i]) + 1;
+        }
+
+        /* At most half full, so chains stay short */
+        number_of_buckets = 2;
+        while (number_of_buckets < 2 * number_of_messages)
+                number_of_buckets *= 2;
+
+        strings_offset = sizeof(*header) +
+                         number_of_buckets * sizeof(uint32_t) +
+                         number_of_messages * sizeof(ply_progress_cache_message_t);
+        *cache_size = strings_offset + strings_size;
+
+        cache = calloc (1, *cache_size);
+        header = (ply_progress_cache_header_t *) cache;
+        memcpy (header->magic, CACHE_MAGIC, sizeof(header->magic));
+        header->number_of_messages = number_of_messages;
+        header->number_of_buckets = number_of_buckets;
+
+        buckets = (uint32_t *) (cache + sizeof(*header));
+        messages = (ply_progress_cache_message_t *) (buckets + number_of_buckets);
+        last_in_bucket = calloc (number_of_buckets, sizeof(uint32_t));
+
+        strings_size = 0;
+        for (i = 0; i < number_of_messages; i++) {
+                uint32_t bucket;
+                size_t length;
+
+                length = strlen (strings[i]) + 1;
+                memcpy (cache + strings_offset + strings_size, strings[i], length);
+                messages[i].percentage = percentages[i];
+                messages[i].string_offset = strings_size;
+                strings_size += length;
+
+                /* Chained in order, so a string that came up more than
+                 * once is found where it first did */
+                bucket = hash_message (strings[i]) & (number_of_buckets - 1);
+                if (last_in_bucket[bucket] == 0)
+                        buckets[bucket] = i + 1;
+                else
+                        messages[last_in_bucket[bucket] - 1].next_in_bucket = i + 1;
+                last_in_bucket[bucket] = i + 1;
+        }
+        free (last_in_bucket);
+
+        return cache;
+}
 
-static ply_progress_message_t *
-ply_progress_message_search (ply_list_t *message_list, const char *string)
+static bool
+use_cache (ply_progress_t *progress,
+           char           *cache,
+           size_t          cache_size,
+           bool            cache_is_mapped)
 {
-        ply_list_node_t *node;
+        const ply_progress_cache_header_t *header;
+        const ply_progress_cache_message_t *messages;
+        const uint32_t *buckets;
+        const char *strings;
+        size_t strings_offset, strings_size;
+        uint32_t i;
+
+        header = (const ply_progress_cache_header_t *) cache;
+
+        if (cache_size < sizeof(*header) ||
+            memcmp (header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0)
+                return false;
+
+        if (header->number_of_buckets == 0 ||
+            (header->number_of_buckets & (header->number_of_buckets - 1)) != 0 ||
+            header->number_of_buckets > cache_size / sizeof(uint32_t) ||
+            header->number_of_messages > cache_size / sizeof(ply_progress_cache_message_t))
+                return false;
+
+        strings_offset = sizeof(*header) +
+                         (size_t) header->number_of_buckets * sizeof(uint32_t) +
+                         (size_t) header->number_of_messages * sizeof(ply_progress_cache_message_t);
+
+        if (strings_offset > cache_size)
+                return false;
+
+        buckets = (const uint32_t *) (cache + sizeof(*header));
+        messages = (const ply_progress_cache_message_t *) (buckets + header->number_of_buckets);
+        strings = cache + strings_offset;
+        strings_size = cache_size - strings_offset;
+
+        if (strings_size > 0 && strings[strings_size - 1] != '\0')
+                return false;
+
+        for (i = 0; i < header->number_of_buckets; i++) {
+                if (buckets[i] > header->number_of_messages)
+                        return false;
+        }
+
+        for (i = 0; i < header->number_of_messages; i++) {
+                if (messages[i].string_offset >= strings_size ||
+                    messages[i].next_in_bucket > header->number_of_messages ||
+                    (messages[i].next_in_bucket != 0 && messages[i].next_in_bucket <= i + 1) ||
+                    (i > 0 && messages[i].percentage < messages[i - 1].percentage))
+                        return false;
+        }
 
-        node = ply_list_get_first_node (message_list);
+        progress->cache = cache;
+        progress->cache_size = cache_size;
+        progress->cache_is_mapped = cache_is_mapped;
+        progress->cache_header = header;
+        progress->cache_buckets = buckets;
+        progress->cache_messages = messages;
+        progress->cache_strings = strings;
 
-        while (node) {
-                ply_progress_message_t *message = ply_list_node_get_data (node);
-                if (strcmp (string, message->string) == 0)
+        return true;
+}
+
+static const ply_progress_cache_message_t *
+look_up_cached_message (ply_progress_t *progress,
+                        const char     *string)
+{
+        uint32_t index;
+
+        if (progress->cache_header == NULL)
+                return NULL;
+
+        index = progress->cache_buckets[hash_message (string) & (progress->cache_header->number_of_buckets - 1)];
+
+        while (index != 0) {
+                const ply_progress_cache_message_t *message = &progress->cache_messages[index - 1];
+
+                if (strcmp (progress->cache_strings + message->string_offset, string) == 0)
                         return message;
-                node = ply_list_get_next_node (message_list, node);
+
+                index = message->next_in_bucket;
         }
+
         return NULL;
 }
 
+/* The first message that came later than message did */
+static const ply_progress_cache_message_t *
+get_next_cached_message (ply_progress_t                     *progress,
+                         const ply_progress_cache_message_t *message)
+{
+        const ply_progress_cache_message_t *end;
+
+        end = progress->cache_messages + progress->cache_header->number_of_messages;
 
-static ply_progress_message_t *
-ply_progress_message_search_next (ply_list_t *message_list, double time)
+        for (message++; message < end; message++) {
+                if (message->percentage > (message - 1)->percentage)
+                        return message;
+        }
+
+        return NULL;
+}
+
+/* What older versions saved, one "percentage:message" per line */
+static bool
+load_text_cache (ply_progress_t *progress,
+                 FILE           *fp)
 {
-        ply_list_node_t *node;
+        const char **strings = NULL;
+        double *percentages = NULL;
+        uint32_t number_of_messages = 0, i;
+        char *line = NULL, *cache;
+        size_t line_size = 0, cache_size;
+        ssize_t length;
+        bool is_sorted = true;
+
+        while ((length = getline (&line, &line_size, fp)) > 0) {
+                double percentage;
+                char *end;
+
+                percentage = strtod (line, &end);
+                if (end == line || *end != ':')
+                        break;
+
+                if (line[length - 1] == '\n')
+                        line[length - 1] = '\0';
+
+                strings = realloc (strings, (number_of_messages + 1) * sizeof(char *));
+                percentages = realloc (percentages, (number_of_messages + 1) * sizeof(double));
+                strings[number_of_messages] = strdup (end + 1);
+                percentages[number_of_messages] = percentage;
+
+                if (number_of_messages > 0 && percentage < percentages[number_of_messages - 1])
+                        is_sorted = false;
+
+                number_of_messages++;
+        }
+        free (line);
 
-        node = ply_list_get_first_node (message_list);
-        ply_progress_message_t *best = NULL;
-        while (node) {
-                ply_progress_message_t *message = ply_list_node_get_data (node);
-                if (message->time > time && (!best || message->time < best->time))
-                        best = message;
-                node = ply_list_get_next_node (message_list, node);
+        /* Saved in the order they came, so this only happens for caches
+         * that were edited by hand */
+        for (i = 1; !is_sorted && i < number_of_messages; i++) {
+                uint32_t j;
+
+                for (j = i; j > 0 && percentages[j] < percentages[j - 1]; j--) {
+                        double percentage = percentages[j];
+                        const char *string = strings[j];
+
+                        percentages[j] = percentages[j - 1];
+                        strings[j] = strings[j - 1];
+                        percentages[j - 1] = percentage;
+                        strings[j - 1] = string;
+                }
         }
-        return best;
+
+        cache = build_cache (strings, percentages, number_of_messages, &cache_size);
+
+        for (i = 0; i < number_of_messages; i++) {
+                free ((char *) strings[i]);
+        }
+        free (strings);
+        free (percentages);
+
+        if (!use_cache (progress, cache, cache_size, false)) {
+                free (cache);
+                return false;
+        }
+
+        return true;
 }
 
 void
 ply_progress_load_cache (ply_progress_t *progress,
                          const char     *filename)
 {
+        struct stat file_info;
+        char *cache;
         FILE *fp;
+        int fd;
 
-        fp = fopen (filename, "r");
-        if (fp == NULL)
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
                 return;
 
-        while (1) {
-                int items_matched;
-                double time;
-                int string_size = 81;
-                char *string;
-                char colon;
-                int i = 0;
-
-                items_matched = fscanf (fp, "%lf", &time);
-                if (items_matched < 1) break;
-                items_matched = fscanf (fp, "%c", &colon);
-                if (items_matched < 1 || colon != ':') break;
-
-                string = malloc (sizeof(char) * string_size);
-                while (1) {
-                        if (i >= string_size) {
-                                string_size *= 2;
-                                string = realloc (string, sizeof(char) * string_size);
-                        }
-                        items_matched = fscanf (fp, "%c", &string[i]);
-                        if (items_matched < 1 || string[i] == '\n') {
-                                string[i] = '\0';
-                                break;
+        if (fstat (fd, &file_info) == 0 && file_info.st_size > 0) {
+                cache = mmap (NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (cache != MAP_FAILED) {
+                        if (use_cache (progress, cache, file_info.st_size, true)) {
+                                close (fd);
+                                return;
                         }
-                        i++;
+
+                        munmap (cache, file_info.st_size);
                 }
-                ply_progress_message_t *message = malloc (sizeof(ply_progress_message_t));
-                message->time = time;
-                message->string = string;
-                ply_list_append_data (progress->previous_message_list, message);
         }
+
+        fp = fdopen (fd, "r");
+        if (fp == NULL) {
+                close (fd);
+                return;
+        }
+
+        if (!load_text_cache (progress, fp))
+                ply_trace ("could not load progress cache %s", filename);
+
         fclose (fp);
 }
 
@@ -210,6 +460,11 @@ ply_progress_save_cache (ply_progress_t *progress,
         FILE *fp;
         ply_list_node_t *node;
         double cur_time = ply_progress_get_time (progress);
+        const char **strings;
+        double *percentages;
+        uint32_t number_of_messages = 0;
+        size_t cache_size;
+        char *cache;
 
         ply_trace ("saving progress cache to %s", filename);
 
@@ -219,24 +474,43 @@ ply_progress_save_cache (ply_progress_t *progress,
                 return;
         }
 
+        strings = calloc (ply_list_get_length (progress->current_message_list) + 1, sizeof(char *));
+        percentages = calloc (ply_list_get_length (progress->current_message_list) + 1, sizeof(double));
+
         node = ply_list_get_first_node (progress->current_message_list);
 
         while (node) {
                 ply_progress_message_t *message = ply_list_node_get_data (node);
                 double percentage = message->time / cur_time;
-                if (!message->disabled)
-                        fprintf (fp, "%.3lf:%s\n", percentage, message->string);
+                if (!message->disabled) {
+                        strings[number_of_messages] = message->string;
+                        percentages[number_of_messages] = percentage;
+                        number_of_messages++;
+                }
                 node = ply_list_get_next_node (progress->current_message_list, node);
         }
+
+        cache = build_cache (strings, percentages, number_of_messages, &cache_size);
+        free (strings);
+        free (percentages);
+
+        if (fwrite (cache, 1, cache_size, fp) != cache_size)
+                ply_trace ("failed to save cache: %m");
+        free (cache);
+
         fclose (fp);
 }
 
 
-double
-ply_progress_get_percentage (ply_progress_t *progress)
+/* Moves the estimate on to cur_time.  What it comes to depends on the
+ * steps it is moved in, so it only gets moved in steps of
+ * 1 / UPDATES_PER_SECOND, however often the percentage is asked for.
+ */
+static void
+ply_progress_update_estimate (ply_progress_t *progress,
+                              double          cur_time)
 {
         double percentage;
-        double cur_time = ply_progress_get_time (progress);
 
         if ((progress->last_percentage_time - progress->dead_time) * progress->scalar < 0.999) {
                 percentage = progress->last_percentage
@@ -254,9 +528,34 @@ ply_progress_get_percentage (ply_progress_t *progress)
                 percentage = 1.0;
         }
 
+        progress->previous_percentage = progress->last_percentage;
         progress->last_percentage_time = cur_time;
         progress->last_percentage = percentage;
-        return percentage;
+}
+
+/* Samples a curve through the estimates, so the percentage moves on
+ * smoothly between them, and comes out the same whether it gets asked for
+ * once a second or for every frame.  It trails the estimates by one step.
+ */
+double
+ply_progress_get_percentage (ply_progress_t *progress)
+{
+        double cur_time = ply_progress_get_time (progress);
+        double step = 1.0 / UPDATES_PER_SECOND;
+        double fraction;
+
+        if (cur_time - progress->last_percentage_time > MAX_CATCH_UP_TIME)
+                ply_progress_update_estimate (progress, cur_time - step);
+
+        while (progress->last_percentage_time + step <= cur_time) {
+                ply_progress_update_estimate (progress, progress->last_percentage_time + step);
+        }
+
+        fraction = (cur_time - progress->last_percentage_time) / step;
+        fraction = CLAMP (fraction, 0.0, 1.0);
+
+        return progress->previous_percentage +
+               (progress->last_percentage - progress->previous_percentage) * fraction;
 }
 
 void
@@ -273,13 +572,13 @@ ply_progress_get_time (ply_progress_t *progress)
 {
         if (progress->paused)
                 return progress->pause_time - progress->start_time;
-        return ply_get_timestamp () - progress->start_time;
+        return MAX (ply_event_loop_get_frame_time (ply_event_loop_get_default ()) - progress->start_time, 0.0);
 }
 
 void
 ply_progress_pause (ply_progress_t *progress)
 {
-        progress->pause_time = ply_get_timestamp ();
+        progress->pause_time = ply_event_loop_get_frame_time (ply_event_loop_get_default ());
         progress->paused = true;
         return;
 }
@@ -288,7 +587,7 @@ ply_progress_pause (ply_progress_t *progress)
 void
 ply_progress_unpause (ply_progress_t *progress)
 {
-        progress->start_time += ply_get_timestamp () - progress->pause_time;
+        progress->start_time += ply_event_loop_get_frame_time (ply_event_loop_get_default ()) - progress->pause_time;
         progress->paused = false;
         return;
 }
@@ -297,22 +596,23 @@ void
 ply_progress_status_update (ply_progress_t *progress,
                             const char     *status)
 {
-        ply_progress_message_t *message, *message_next;
+        ply_progress_message_t *message;
+        const ply_progress_cache_message_t *cached_message, *cached_message_next;
 
-        message = ply_progress_message_search (progress->current_message_list, status);
+        message = ply_hashtable_lookup (progress->current_messages, (void *) status);
         if (message) {
                 message->disabled = true;
         }                                               /* Remove duplicates as they confuse things*/
         else {
-                message = ply_progress_message_search (progress->previous_message_list, status);
-                if (message) {
-                        message_next = ply_progress_message_search_next (progress->previous_message_list, message->time);
-                        if (message_next)
-                                progress->next_message_percentage = message_next->time;
+                cached_message = look_up_cached_message (progress, status);
+                if (cached_message) {
+                        cached_message_next = get_next_cached_message (progress, cached_message);
+                        if (cached_message_next)
+                                progress->next_message_percentage = cached_message_next->percentage;
                         else
                                 progress->next_message_percentage = 1;
 
-                        progress->scalar += message->time / (ply_progress_get_time (progress) - progress->dead_time);
+                        progress->scalar += cached_message->percentage / (ply_progress_get_time (progress) - progress->dead_time);
                         progress->scalar /= 2;
                 }
                 message = malloc (sizeof(ply_progress_message_t));
@@ -320,6 +620,7 @@ ply_progress_status_update (ply_progress_t *progress,
                 message->string = strdup (status);
                 message->disabled = false;
                 ply_list_append_data (progress->current_message_list, message);
+                ply_hashtable_insert (progress->current_messages, message->string, message);
         }
 }
 
@@ -37,6 +37,15 @@ struct _ply_region
         ply_list_t *rectangle_list;
 };
 
+/* Rectangles carry their own list node, and since the rectangle comes
+ * first, freeing the rectangle frees both
+ */
+typedef struct
+{
+        ply_rectangle_t rectangle;
+        ply_list_node_t node;
+} ply_region_rectangle_t;
+
 ply_region_t *
 ply_region_new (void)
 {
@@ -63,8 +72,8 @@ ply_region_clear (ply_region_t *region)
 
                 next_node = ply_list_get_next_node (region->rectangle_list, node);
 
-                free (rectangle);
                 ply_list_remove_node (region->rectangle_list, node);
+                free (rectangle);
 
                 node = next_node;
         }
@@ -81,12 +90,12 @@ ply_region_free (ply_region_t *region)
 static ply_rectangle_t *
 copy_rectangle (ply_rectangle_t *rectangle)
 {
-        ply_rectangle_t *new_rectangle;
+        ply_region_rectangle_t *new_rectangle;
 
-        new_rectangle = malloc (sizeof(*rectangle));
-        *new_rectangle = *rectangle;
+        new_rectangle = malloc (sizeof(*new_rectangle));
+        new_rectangle->rectangle = *rectangle;
 
-        return new_rectangle;
+        return &new_rectangle->rectangle;
 }
 
 static void
@@ -283,8 +292,8 @@ merge_rectangle_with_sub_list (ply_region_t    *region,
                  */
                 case PLY_RECTANGLE_OVERLAP_ALL_EDGES:
                         merge_rectangle_with_sub_list (region, new_area, next_node);
-                        free (old_area);
                         ply_list_remove_node (region->rectangle_list, node);
+                        free (old_area);
                         return;
 
                 /*  NNN  We need to split the new rectangle into
@@ -367,8 +376,9 @@ merge_rectangle_with_sub_list (ply_region_t    *region,
                         old_area->height = (old_area->y + old_area->height) - new_area->y;
                         old_area->y = new_area->y;
                         free (new_area);
-                        merge_rectangle_with_sub_list (region, old_area, next_node);
+                        /* old_area gets merged back in with its own node */
                         ply_list_remove_node (region->rectangle_list, node);
+                        merge_rectangle_with_sub_list (region, old_area, next_node);
                 }
                         return;
 
@@ -381,8 +391,9 @@ merge_rectangle_with_sub_list (ply_region_t    *region,
                 {
                         old_area->height = (new_area->y + new_area->height) - old_area->y;
                         free (new_area);
-                        merge_rectangle_with_sub_list (region, old_area, next_node);
+                        /* old_area gets merged back in with its own node */
                         ply_list_remove_node (region->rectangle_list, node);
+                        merge_rectangle_with_sub_list (region, old_area, next_node);
                 }
                         return;
 
@@ -395,8 +406,9 @@ merge_rectangle_with_sub_list (ply_region_t    *region,
                         old_area->width = (old_area->x + old_area->width) - new_area->x;
                         old_area->x = new_area->x;
                         free (new_area);
-                        merge_rectangle_with_sub_list (region, old_area, next_node);
+                        /* old_area gets merged back in with its own node */
                         ply_list_remove_node (region->rectangle_list, node);
+                        merge_rectangle_with_sub_list (region, old_area, next_node);
                 }
                         return;
 
@@ -408,8 +420,9 @@ merge_rectangle_with_sub_list (ply_region_t    *region,
                 {
                         old_area->width = (new_area->x + new_area->width) - old_area->x;
                         free (new_area);
-                        merge_rectangle_with_sub_list (region, old_area, next_node);
+                        /* old_area gets merged back in with its own node */
                         ply_list_remove_node (region->rectangle_list, node);
+                        merge_rectangle_with_sub_list (region, old_area, next_node);
                 }
                         return;
                 }
@@ -417,7 +430,9 @@ merge_rectangle_with_sub_list (ply_region_t    *region,
                 node = ply_list_get_next_node (region->rectangle_list, node);
         }
 
-        ply_list_append_data (region->rectangle_list, new_area);
+        ply_list_append_embedded_node (region->rectangle_list,
+                                       &((ply_region_rectangle_t *) new_area)->node,
+                                       new_area);
 }
 
 void
@@ -438,6 +453,12 @@ ply_region_add_rectangle (ply_region_t    *region,
                                        first_node);
 }
 
+bool
+ply_region_is_empty (ply_region_t *region)
+{
+        return ply_list_get_length (region->rectangle_list) == 0;
+}
+
 ply_list_t *
 ply_region_get_rectangle_list (ply_region_t *region)
 {
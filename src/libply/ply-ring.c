@@ -0,0 +1,116 @@
+/* ply-ring.c - fixed size queue between two threads
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-ring.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CACHE_LINE_SIZE 64
+
+/* The two counters only ever go up, and each is only written by one side,
+ * so they sit on their own cache lines to keep the threads from fighting
+ * over them.  The ring is empty when they match, and full when they are
+ * capacity apart.
+ */
+struct _ply_ring
+{
+        size_t          next_push __attribute__((aligned (CACHE_LINE_SIZE)));
+        size_t          next_pop __attribute__((aligned (CACHE_LINE_SIZE)));
+
+        size_t          mask __attribute__((aligned (CACHE_LINE_SIZE)));
+        void          **slots;
+};
+
+ply_ring_t *
+ply_ring_new (size_t capacity)
+{
+        ply_ring_t *ring;
+        size_t size = 1;
+
+        assert (capacity > 0);
+
+        while (size < capacity) {
+                size <<= 1;
+        }
+
+        ring = aligned_alloc (CACHE_LINE_SIZE, sizeof(ply_ring_t));
+        ring->next_push = 0;
+        ring->next_pop = 0;
+        ring->mask = size - 1;
+        ring->slots = calloc (size, sizeof(void *));
+
+        return ring;
+}
+
+void
+ply_ring_free (ply_ring_t *ring)
+{
+        if (ring == NULL)
+                return;
+
+        free (ring->slots);
+        free (ring);
+}
+
+bool
+ply_ring_push (ply_ring_t *ring,
+               void       *data)
+{
+        size_t next_push, next_pop;
+
+        assert (data != NULL);
+
+        next_push = ring->next_push;
+        next_pop = __atomic_load_n (&ring->next_pop, __ATOMIC_ACQUIRE);
+
+        if (next_push - next_pop > ring->mask)
+                return false;
+
+        ring->slots[next_push & ring->mask] = data;
+
+        /* Publishes the slot along with the counter */
+        __atomic_store_n (&ring->next_push, next_push + 1, __ATOMIC_RELEASE);
+
+        return true;
+}
+
+void *
+ply_ring_pop (ply_ring_t *ring)
+{
+        size_t next_push, next_pop;
+        void *data;
+
+        next_pop = ring->next_pop;
+        next_push = __atomic_load_n (&ring->next_push, __ATOMIC_ACQUIRE);
+
+        if (next_pop == next_push)
+                return NULL;
+
+        data = ring->slots[next_pop & ring->mask];
+
+        /* The slot may get reused once the counter moves on */
+        __atomic_store_n (&ring->next_pop, next_pop + 1, __ATOMIC_RELEASE);
+
+        return data;
+}
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
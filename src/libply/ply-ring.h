@@ -0,0 +1,43 @@
+/* ply-ring.h - fixed size queue between two threads
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_RING_H
+#define PLY_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct _ply_ring ply_ring_t;
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+/* One thread may push while one other thread pops, without locking.
+ * capacity gets rounded up to a power of two.
+ */
+ply_ring_t *ply_ring_new (size_t capacity);
+void ply_ring_free (ply_ring_t *ring);
+
+/* Returns false when the ring is full */
+bool ply_ring_push (ply_ring_t *ring,
+                    void       *data);
+/* Returns NULL when the ring is empty */
+void *ply_ring_pop (ply_ring_t *ring);
+#endif
+
+#endif /* PLY_RING_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
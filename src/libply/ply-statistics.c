@@ -0,0 +1,315 @@
+/* ply-statistics.c - counters the daemon keeps about itself
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-statistics.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-buffer.h"
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-utils.h"
+
+/* Images can be loaded over and over when frames are decoded on demand,
+ * so the timeline stops growing at some point */
+#ifndef PLY_STATISTICS_MAX_TIMELINE_SPANS
+#define PLY_STATISTICS_MAX_TIMELINE_SPANS 1024
+#endif
+
+typedef enum
+{
+        PLY_STATISTIC_TYPE_COUNT,
+        PLY_STATISTIC_TYPE_DURATION,
+        PLY_STATISTIC_TYPE_LEVEL,
+        PLY_STATISTIC_TYPE_VALUE,
+} ply_statistic_type_t;
+
+typedef struct
+{
+        char                *name;
+        ply_statistic_type_t type;
+
+        uint64_t             count;
+        double               total_time;
+        double               maximum_time;
+
+        int64_t              level;
+        int64_t              peak_level;
+
+        double               value;
+        uint32_t             has_value : 1;
+} ply_statistic_t;
+
+typedef struct
+{
+        char  *name;
+        double start_time;
+        double end_time;
+} ply_timeline_span_t;
+
+/* Drawing can happen on worker threads, so this gets locked */
+static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
+static ply_hashtable_t *statistics_by_name;
+static ply_list_t *statistics;
+static ply_list_t *timeline;
+static int number_of_timeline_spans;
+static uint64_t number_of_dropped_timeline_spans;
+
+static ply_statistic_t *
+get_statistic (const char          *name,
+               ply_statistic_type_t type)
+{
+        ply_statistic_t *statistic;
+
+        assert (name != NULL);
+
+        if (statistics == NULL) {
+                statistics = ply_list_new ();
+                statistics_by_name = ply_hashtable_new (ply_hashtable_string_hash,
+                                                        ply_hashtable_string_compare);
+        }
+
+        statistic = ply_hashtable_lookup (statistics_by_name, (void *) name);
+        if (statistic != NULL) {
+                assert (statistic->type == type);
+                return statistic;
+        }
+
+        statistic = calloc (1, sizeof(ply_statistic_t));
+        statistic->name = strdup (name);
+        statistic->type = type;
+        ply_list_append_data (statistics, statistic);
+        ply_hashtable_insert (statistics_by_name, statistic->name, statistic);
+
+        return statistic;
+}
+
+void
+ply_statistics_add_to_count (const char *name,
+                             uint64_t    amount)
+{
+        ply_statistic_t *statistic;
+
+        pthread_mutex_lock (&statistics_lock);
+        statistic = get_statistic (name, PLY_STATISTIC_TYPE_COUNT);
+        statistic->count += amount;
+        pthread_mutex_unlock (&statistics_lock);
+}
+
+void
+ply_statistics_add_duration (const char *name,
+                             double      seconds)
+{
+        ply_statistic_t *statistic;
+
+        pthread_mutex_lock (&statistics_lock);
+        statistic = get_statistic (name, PLY_STATISTIC_TYPE_DURATION);
+        statistic->count++;
+        statistic->total_time += seconds;
+        if (seconds > statistic->maximum_time)
+                statistic->maximum_time = seconds;
+        pthread_mutex_unlock (&statistics_lock);
+}
+
+void
+ply_statistics_adjust_level (const char *name,
+                             int64_t     change)
+{
+        ply_statistic_t *statistic;
+
+        pthread_mutex_lock (&statistics_lock);
+        statistic = get_statistic (name, PLY_STATISTIC_TYPE_LEVEL);
+        statistic->level += change;
+        if (statistic->level > statistic->peak_level)
+                statistic->peak_level = statistic->level;
+        pthread_mutex_unlock (&statistics_lock);
+}
+
+void
+ply_statistics_set_value_once (const char *name,
+                               double      value)
+{
+        ply_statistic_t *statistic;
+
+        pthread_mutex_lock (&statistics_lock);
+        statistic = get_statistic (name, PLY_STATISTIC_TYPE_VALUE);
+        if (!statistic->has_value) {
+                statistic->value = value;
+                statistic->has_value = true;
+        }
+        pthread_mutex_unlock (&statistics_lock);
+}
+
+void
+ply_statistics_add_timeline_span (const char *name,
+                                  const char *detail,
+                                  double      start_time,
+                                  double      end_time)
+{
+        ply_timeline_span_t *span;
+        ply_list_node_t *node;
+
+        assert (name != NULL);
+
+        pthread_mutex_lock (&statistics_lock);
+        if (number_of_timeline_spans >= PLY_STATISTICS_MAX_TIMELINE_SPANS) {
+                number_of_dropped_timeline_spans++;
+                pthread_mutex_unlock (&statistics_lock);
+                return;
+        }
+
+        if (timeline == NULL)
+                timeline = ply_list_new ();
+
+        span = calloc (1, sizeof(ply_timeline_span_t));
+        if (detail != NULL)
+                asprintf (&span->name, "%s %s", name, detail);
+        else
+                span->name = strdup (name);
+        span->start_time = start_time;
+        span->end_time = end_time;
+
+        /* Spans mostly get added when they end, so this keeps them in
+         * the order they started, looking from the back */
+        node = ply_list_get_last_node (timeline);
+        while (node != NULL) {
+                ply_timeline_span_t *previous_span = ply_list_node_get_data (node);
+
+                if (previous_span->start_time <= start_time)
+                        break;
+
+                node = ply_list_get_previous_node (timeline, node);
+        }
+
+        ply_list_insert_data (timeline, span, node);
+        number_of_timeline_spans++;
+        pthread_mutex_unlock (&statistics_lock);
+}
+
+void
+ply_statistics_add_timeline_event (const char *name,
+                                   const char *detail)
+{
+        double now;
+
+        now = ply_get_timestamp ();
+        ply_statistics_add_timeline_span (name, detail, now, now);
+}
+
+static void
+format_timeline (ply_buffer_t *buffer)
+{
+        ply_list_node_t *node;
+
+        if (timeline == NULL)
+                return;
+
+        node = ply_list_get_first_node (timeline);
+        while (node != NULL) {
+                ply_timeline_span_t *span = ply_list_node_get_data (node);
+
+                ply_buffer_append (buffer, "timeline %" PRIu64 " %" PRIu64 " %s\n",
+                                   (uint64_t) (span->start_time * 1000000.0),
+                                   (uint64_t) (span->end_time * 1000000.0),
+                                   span->name);
+                node = ply_list_get_next_node (timeline, node);
+        }
+
+        if (number_of_dropped_timeline_spans > 0)
+                ply_buffer_append (buffer, "timeline-dropped-spans %" PRIu64 "\n",
+                                   number_of_dropped_timeline_spans);
+}
+
+static void
+format_statistic (ply_buffer_t    *buffer,
+                  ply_statistic_t *statistic)
+{
+        switch (statistic->type) {
+        case PLY_STATISTIC_TYPE_COUNT:
+                ply_buffer_append (buffer, "%s %" PRIu64 "\n",
+                                   statistic->name, statistic->count);
+                break;
+        case PLY_STATISTIC_TYPE_DURATION:
+                ply_buffer_append (buffer, "%s count=%" PRIu64 " average=%.3fms max=%.3fms\n",
+                                   statistic->name, statistic->count,
+                                   statistic->count > 0 ? 1000.0 * statistic->total_time / statistic->count : 0.0,
+                                   1000.0 * statistic->maximum_time);
+                break;
+        case PLY_STATISTIC_TYPE_LEVEL:
+                ply_buffer_append (buffer, "%s current=%" PRId64 " peak=%" PRId64 "\n",
+                                   statistic->name, statistic->level, statistic->peak_level);
+                break;
+        case PLY_STATISTIC_TYPE_VALUE:
+                ply_buffer_append (buffer, "%s %.3f\n",
+                                   statistic->name, statistic->value);
+                break;
+        }
+}
+
+char *
+ply_statistics_format (void)
+{
+        ply_buffer_t *buffer;
+        ply_list_node_t *node;
+        char *text;
+
+        buffer = ply_buffer_new ();
+
+        pthread_mutex_lock (&statistics_lock);
+        if (statistics != NULL) {
+                node = ply_list_get_first_node (statistics);
+                while (node != NULL) {
+                        format_statistic (buffer, ply_list_node_get_data (node));
+                        node = ply_list_get_next_node (statistics, node);
+                }
+        }
+        format_timeline (buffer);
+        pthread_mutex_unlock (&statistics_lock);
+
+        text = ply_buffer_steal_bytes (buffer);
+        ply_buffer_free (buffer);
+
+        return text;
+}
+
+char *
+ply_statistics_format_timeline (void)
+{
+        ply_buffer_t *buffer;
+        char *text;
+
+        buffer = ply_buffer_new ();
+
+        pthread_mutex_lock (&statistics_lock);
+        format_timeline (buffer);
+        pthread_mutex_unlock (&statistics_lock);
+
+        text = ply_buffer_steal_bytes (buffer);
+        ply_buffer_free (buffer);
+
+        return text;
+}
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,78 @@
+/* ply-statistics.h - counters the daemon keeps about itself
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_STATISTICS_H
+#define PLY_STATISTICS_H
+
+#include <stdint.h>
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+/* Statistics are created the first time they're used, and are kept for
+ * the life of the process.  A name should only ever be used with one
+ * kind of statistic.
+ */
+
+/* Counts how many times something happened */
+void ply_statistics_add_to_count (const char *name,
+                                  uint64_t    amount);
+
+/* Keeps how many times something took place, and how long that took
+ * on average and at most
+ */
+void ply_statistics_add_duration (const char *name,
+                                  double      seconds);
+
+/* Follows something that goes up and down, like memory in use, and
+ * remembers the highest it got
+ */
+void ply_statistics_adjust_level (const char *name,
+                                  int64_t     change);
+
+/* Keeps the first value given, like how long something took to first
+ * happen, and ignores any after that
+ */
+void ply_statistics_set_value_once (const char *name,
+                                    double      value);
+
+/* Puts a span on the startup timeline.  Times come from
+ * ply_get_timestamp (); something that happens at one instant has the
+ * same start and end.  detail, like a file name, can be NULL.
+ */
+void ply_statistics_add_timeline_span (const char *name,
+                                       const char *detail,
+                                       double      start_time,
+                                       double      end_time);
+void ply_statistics_add_timeline_event (const char *name,
+                                        const char *detail);
+
+/* One "name value..." line per statistic, in the order they were
+ * created, followed by the timeline.  The caller frees the string.
+ */
+char *ply_statistics_format (void);
+
+/* One "timeline start end name [detail]" line per span, in the order
+ * they started, with times in microseconds of CLOCK_MONOTONIC like
+ * systemd's *TimestampMonotonic properties.  The caller frees the
+ * string.
+ */
+char *ply_statistics_format_timeline (void);
+#endif
+
+#endif /* PLY_STATISTICS_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
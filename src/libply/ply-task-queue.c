@@ -0,0 +1,483 @@
+/* ply-task-queue.c - runs tasks on threads and reports back on the event loop
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-task-queue.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-ring.h"
+
+/* Tasks a thread can have handed to it at once.  Its rings are this big,
+ * so a finished task always fits on the way back.
+ */
+#define MAX_TASKS_PER_THREAD 64
+#define DEFAULT_NUMBER_OF_THREADS 2
+
+typedef struct
+{
+        ply_task_handler_t handler;
+        ply_task_handler_t done_handler;
+        void              *user_data;
+
+        /* which of the queue's lists the task is on */
+        ply_list_t        *list;
+        ply_list_node_t   *node;
+
+        int                is_cancelled;
+} ply_task_t;
+
+typedef struct
+{
+        ply_task_queue_t *queue;
+        pthread_t         thread;
+
+        /* the event loop thread writes to this, and the worker reads from
+         * it, when there's nothing to do
+         */
+        int               wake_up_fd;
+        ply_ring_t       *tasks;
+        ply_ring_t       *finished_tasks;
+
+        int               number_of_tasks;
+        int               should_exit;
+} ply_task_queue_worker_t;
+
+struct _ply_task_queue
+{
+        ply_event_loop_t        *loop;
+
+        ply_task_queue_worker_t *workers;
+        int                      number_of_workers;
+
+        /* workers write to this for every task they finish */
+        int                      finished_fd;
+        ply_fd_watch_t          *finished_watch;
+
+        /* Only touched on the event loop's thread: tasks waiting for room
+         * on a worker, tasks handed to one, and tasks that came back but
+         * haven't been reported yet
+         */
+        ply_list_t              *waiting_tasks;
+        ply_list_t              *sent_tasks;
+        ply_list_t              *finished_tasks;
+};
+
+static void
+ply_task_queue_move_task (ply_task_t *task,
+                          ply_list_t *list)
+{
+        if (task->list != NULL)
+                ply_list_remove_node (task->list, task->node);
+
+        task->list = list;
+        task->node = list != NULL ? ply_list_append_data (list, task) : NULL;
+}
+
+static void
+ply_task_queue_free_task (ply_task_t *task)
+{
+        ply_task_queue_move_task (task, NULL);
+        free (task);
+}
+
+static void
+ply_task_queue_wake_up (int fd)
+{
+        uint64_t count = 1;
+
+        if (write (fd, &count, sizeof(count)) < 0)
+                assert (errno == EAGAIN);
+}
+
+static void *
+ply_task_queue_worker_main (ply_task_queue_worker_t *worker)
+{
+        while (true) {
+                ply_task_t *task;
+                uint64_t count;
+
+                task = ply_ring_pop (worker->tasks);
+
+                if (task == NULL) {
+                        if (__atomic_load_n (&worker->should_exit, __ATOMIC_ACQUIRE))
+                                break;
+
+                        if (read (worker->wake_up_fd, &count, sizeof(count)) < 0)
+                                assert (errno == EINTR);
+                        continue;
+                }
+
+                if (!__atomic_load_n (&task->is_cancelled, __ATOMIC_ACQUIRE))
+                        task->handler (task->user_data);
+
+                ply_ring_push (worker->finished_tasks, task);
+                ply_task_queue_wake_up (worker->queue->finished_fd);
+        }
+
+        return NULL;
+}
+
+/* Takes everything the workers finished off of their rings */
+static void
+ply_task_queue_collect_finished_tasks (ply_task_queue_t *queue)
+{
+        ply_task_t *task;
+        int i;
+
+        for (i = 0; i < queue->number_of_workers; i++) {
+                ply_task_queue_worker_t *worker = &queue->workers[i];
+
+                while ((task = ply_ring_pop (worker->finished_tasks)) != NULL) {
+                        worker->number_of_tasks--;
+
+                        if (task->is_cancelled)
+                                ply_task_queue_free_task (task);
+                        else
+                                ply_task_queue_move_task (task, queue->finished_tasks);
+                }
+        }
+}
+
+static bool
+ply_task_queue_send_task (ply_task_queue_t *queue,
+                          ply_task_t       *task)
+{
+        ply_task_queue_worker_t *worker = NULL;
+        int i;
+
+        for (i = 0; i < queue->number_of_workers; i++) {
+                if (worker == NULL || queue->workers[i].number_of_tasks < worker->number_of_tasks)
+                        worker = &queue->workers[i];
+        }
+
+        if (worker == NULL || worker->number_of_tasks >= MAX_TASKS_PER_THREAD)
+                return false;
+
+        ply_task_queue_move_task (task, queue->sent_tasks);
+        worker->number_of_tasks++;
+        ply_ring_push (worker->tasks, task);
+        ply_task_queue_wake_up (worker->wake_up_fd);
+
+        return true;
+}
+
+static void
+ply_task_queue_send_waiting_tasks (ply_task_queue_t *queue)
+{
+        ply_list_node_t *node;
+
+        while ((node = ply_list_get_first_node (queue->waiting_tasks)) != NULL) {
+                if (!ply_task_queue_send_task (queue, ply_list_node_get_data (node)))
+                        break;
+        }
+}
+
+static void
+on_tasks_finished (ply_task_queue_t *queue)
+{
+        ply_list_node_t *node;
+        uint64_t count;
+
+        if (read (queue->finished_fd, &count, sizeof(count)) < 0)
+                assert (errno == EAGAIN);
+
+        ply_task_queue_collect_finished_tasks (queue);
+
+        /* done handlers may run and cancel tasks of their own, so the list
+         * is looked at again every time
+         */
+        while ((node = ply_list_get_first_node (queue->finished_tasks)) != NULL) {
+                ply_task_t *task = ply_list_node_get_data (node);
+                ply_task_handler_t done_handler = task->done_handler;
+                void *user_data = task->user_data;
+
+                ply_task_queue_free_task (task);
+
+                if (done_handler != NULL)
+                        done_handler (user_data);
+        }
+
+        ply_task_queue_send_waiting_tasks (queue);
+}
+
+ply_task_queue_t *
+ply_task_queue_new (ply_event_loop_t *loop,
+                    int               number_of_threads)
+{
+        ply_task_queue_t *queue;
+        sigset_t all_signals, old_signals;
+        int i, result;
+
+        assert (loop != NULL);
+        assert (number_of_threads > 0);
+
+        queue = calloc (1, sizeof(ply_task_queue_t));
+        queue->loop = loop;
+        queue->waiting_tasks = ply_list_new ();
+        queue->sent_tasks = ply_list_new ();
+        queue->finished_tasks = ply_list_new ();
+        queue->workers = calloc (number_of_threads, sizeof(ply_task_queue_worker_t));
+
+        queue->finished_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        if (queue->finished_fd < 0) {
+                ply_trace ("could not create event fd for finished tasks: %m");
+                return queue;
+        }
+
+        queue->finished_watch = ply_event_loop_watch_fd (loop, queue->finished_fd,
+                                                         PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                                         (ply_event_handler_t)
+                                                         on_tasks_finished,
+                                                         NULL, queue);
+
+        /* Signals are dispatched by the event loop on the main thread, keep
+         * the workers out of it
+         */
+        sigfillset (&all_signals);
+        pthread_sigmask (SIG_BLOCK, &all_signals, &old_signals);
+
+        for (i = 0; i < number_of_threads; i++) {
+                ply_task_queue_worker_t *worker = &queue->workers[queue->number_of_workers];
+
+                worker->queue = queue;
+                worker->wake_up_fd = eventfd (0, EFD_CLOEXEC);
+
+                if (worker->wake_up_fd < 0) {
+                        ply_trace ("could not create event fd for task thread: %m");
+                        break;
+                }
+
+                worker->tasks = ply_ring_new (MAX_TASKS_PER_THREAD);
+                worker->finished_tasks = ply_ring_new (MAX_TASKS_PER_THREAD);
+
+                result = pthread_create (&worker->thread, NULL,
+                                         (void *(*)(void *))ply_task_queue_worker_main, worker);
+                if (result != 0) {
+                        ply_trace ("could not start task thread: %s", strerror (result));
+                        ply_ring_free (worker->finished_tasks);
+                        ply_ring_free (worker->tasks);
+                        close (worker->wake_up_fd);
+                        break;
+                }
+                queue->number_of_workers++;
+        }
+
+        pthread_sigmask (SIG_SETMASK, &old_signals, NULL);
+
+        return queue;
+}
+
+static void
+ply_task_queue_free_tasks (ply_list_t *list)
+{
+        ply_list_node_t *node;
+
+        while ((node = ply_list_get_first_node (list)) != NULL) {
+                ply_task_queue_free_task (ply_list_node_get_data (node));
+        }
+
+        ply_list_free (list);
+}
+
+void
+ply_task_queue_free (ply_task_queue_t *queue)
+{
+        ply_list_node_t *node;
+        int i;
+
+        if (queue == NULL)
+                return;
+
+        for (node = ply_list_get_first_node (queue->sent_tasks);
+             node != NULL;
+             node = ply_list_get_next_node (queue->sent_tasks, node)) {
+                ply_task_t *task = ply_list_node_get_data (node);
+
+                __atomic_store_n (&task->is_cancelled, true, __ATOMIC_RELEASE);
+        }
+
+        for (i = 0; i < queue->number_of_workers; i++) {
+                ply_task_queue_worker_t *worker = &queue->workers[i];
+
+                __atomic_store_n (&worker->should_exit, true, __ATOMIC_RELEASE);
+                ply_task_queue_wake_up (worker->wake_up_fd);
+        }
+
+        for (i = 0; i < queue->number_of_workers; i++) {
+                ply_task_queue_worker_t *worker = &queue->workers[i];
+
+                pthread_join (worker->thread, NULL);
+                ply_ring_free (worker->finished_tasks);
+                ply_ring_free (worker->tasks);
+                close (worker->wake_up_fd);
+        }
+
+        if (queue->finished_watch != NULL)
+                ply_event_loop_stop_watching_fd (queue->loop, queue->finished_watch);
+
+        if (queue->finished_fd >= 0)
+                close (queue->finished_fd);
+
+        /* Every task the workers got is on sent_tasks still, the rings
+         * only hold pointers to them
+         */
+        ply_task_queue_free_tasks (queue->waiting_tasks);
+        ply_task_queue_free_tasks (queue->sent_tasks);
+        ply_task_queue_free_tasks (queue->finished_tasks);
+
+        free (queue->workers);
+        free (queue);
+}
+
+ply_task_queue_t *
+ply_task_queue_get_default (void)
+{
+        static ply_task_queue_t *queue = NULL;
+
+        if (queue == NULL)
+                queue = ply_task_queue_new (ply_event_loop_get_default (),
+                                            DEFAULT_NUMBER_OF_THREADS);
+
+        return queue;
+}
+
+void
+ply_task_queue_run (ply_task_queue_t  *queue,
+                    ply_task_handler_t handler,
+                    ply_task_handler_t done_handler,
+                    void              *user_data)
+{
+        ply_task_t *task;
+
+        assert (queue != NULL);
+        assert (handler != NULL);
+
+        /* Without threads, the work still gets done, just not in the
+         * background
+         */
+        if (queue->number_of_workers == 0) {
+                handler (user_data);
+
+                if (done_handler != NULL)
+                        done_handler (user_data);
+                return;
+        }
+
+        task = calloc (1, sizeof(ply_task_t));
+        task->handler = handler;
+        task->done_handler = done_handler;
+        task->user_data = user_data;
+
+        if (ply_list_get_length (queue->waiting_tasks) > 0 ||
+            !ply_task_queue_send_task (queue, task))
+                ply_task_queue_move_task (task, queue->waiting_tasks);
+}
+
+static ply_task_t *
+ply_task_queue_find_task (ply_list_t        *list,
+                          ply_task_handler_t handler,
+                          void              *user_data)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (list);
+             node != NULL;
+             node = ply_list_get_next_node (list, node)) {
+                ply_task_t *task = ply_list_node_get_data (node);
+
+                if (task->handler == handler && task->user_data == user_data &&
+                    !task->is_cancelled)
+                        return task;
+        }
+
+        return NULL;
+}
+
+void
+ply_task_queue_cancel (ply_task_queue_t  *queue,
+                       ply_task_handler_t handler,
+                       void              *user_data)
+{
+        ply_task_t *task;
+        bool is_waiting = false;
+
+        assert (queue != NULL);
+
+        while ((task = ply_task_queue_find_task (queue->waiting_tasks, handler, user_data)) != NULL ||
+               (task = ply_task_queue_find_task (queue->finished_tasks, handler, user_data)) != NULL) {
+                ply_task_queue_free_task (task);
+        }
+
+        while ((task = ply_task_queue_find_task (queue->sent_tasks, handler, user_data)) != NULL) {
+                __atomic_store_n (&task->is_cancelled, true, __ATOMIC_RELEASE);
+        }
+
+        /* Cancelled tasks that are still out get freed when they come back,
+         * so wait for that.  Whatever else finishes in the mean time still
+         * gets reported from the event loop.
+         */
+        while (true) {
+                struct pollfd poll_fd = { .fd = queue->finished_fd, .events = POLLIN };
+                ply_list_node_t *node;
+                uint64_t count;
+
+                ply_task_queue_collect_finished_tasks (queue);
+
+                for (node = ply_list_get_first_node (queue->sent_tasks);
+                     node != NULL;
+                     node = ply_list_get_next_node (queue->sent_tasks, node)) {
+                        task = ply_list_node_get_data (node);
+
+                        if (task->handler == handler && task->user_data == user_data)
+                                break;
+                }
+
+                if (node == NULL)
+                        break;
+
+                is_waiting = true;
+                if (poll (&poll_fd, 1, -1) > 0 &&
+                    read (queue->finished_fd, &count, sizeof(count)) < 0)
+                        assert (errno == EAGAIN);
+        }
+
+        if (is_waiting) {
+                if (ply_list_get_length (queue->finished_tasks) > 0)
+                        ply_task_queue_wake_up (queue->finished_fd);
+
+                ply_task_queue_send_waiting_tasks (queue);
+        }
+}
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
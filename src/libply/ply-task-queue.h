@@ -0,0 +1,58 @@
+/* ply-task-queue.h - runs tasks on threads and reports back on the event loop
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_TASK_QUEUE_H
+#define PLY_TASK_QUEUE_H
+
+#include "ply-event-loop.h"
+
+typedef struct _ply_task_queue ply_task_queue_t;
+
+typedef void (*ply_task_handler_t) (void *user_data);
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+ply_task_queue_t *ply_task_queue_new (ply_event_loop_t *loop,
+                                      int               number_of_threads);
+/* Waits for tasks that already started, and drops the rest without
+ * calling their done handlers.  Don't call it from a done handler.
+ */
+void ply_task_queue_free (ply_task_queue_t *queue);
+
+/* The queue for background work on the default event loop */
+ply_task_queue_t *ply_task_queue_get_default (void);
+
+/* Calls handler with user_data on one of the queue's threads, and then
+ * done_handler, if not NULL, on the event loop once handler returned.
+ * Tasks run in order on each thread, but threads don't wait for each other.
+ */
+void ply_task_queue_run (ply_task_queue_t  *queue,
+                         ply_task_handler_t handler,
+                         ply_task_handler_t done_handler,
+                         void              *user_data);
+/* Makes sure the task queued with handler and user_data isn't running,
+ * and won't run or report back anymore.  If it already started, this
+ * waits for it to return.
+ */
+void ply_task_queue_cancel (ply_task_queue_t  *queue,
+                            ply_task_handler_t handler,
+                            void              *user_data);
+#endif
+
+#endif /* PLY_TASK_QUEUE_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
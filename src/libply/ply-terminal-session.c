@@ -41,6 +41,12 @@
 #include "ply-logger.h"
 #include "ply-utils.h"
 
+/* Console output gets written to the log once this much has piled up,
+ * or once the oldest of it has waited this long
+ */
+#define PLY_TERMINAL_SESSION_LOG_FLUSH_SIZE (16 * 1024)
+#define PLY_TERMINAL_SESSION_LOG_FLUSH_TIMEOUT 0.25
+
 struct _ply_terminal_session
 {
         int                                   pseudoterminal_master_fd;
@@ -54,13 +60,18 @@ struct _ply_terminal_session
         ply_terminal_session_hangup_handler_t hangup_handler;
         void                                 *user_data;
 
+        size_t                                bytes_waiting_to_be_logged;
+
         uint32_t                              is_running : 1;
+        uint32_t                              log_flush_is_scheduled : 1;
         uint32_t                              console_is_redirected : 1;
         uint32_t                              created_terminal_device : 1;
 };
 
 static void ply_terminal_session_start_logging (ply_terminal_session_t *session);
 static void ply_terminal_session_stop_logging (ply_terminal_session_t *session);
+static void ply_terminal_session_write_log (ply_terminal_session_t *session);
+static void ply_terminal_session_flush_log (ply_terminal_session_t *session);
 
 ply_terminal_session_t *
 ply_terminal_session_new (const char *const *argv)
@@ -100,6 +111,7 @@ ply_terminal_session_detach_from_event_loop (ply_terminal_session_t *session)
 {
         assert (session != NULL);
         session->loop = NULL;
+        session->log_flush_is_scheduled = false;
 }
 
 void
@@ -115,6 +127,8 @@ ply_terminal_session_attach_to_event_loop (ply_terminal_session_t *session,
         ply_event_loop_watch_for_exit (loop, (ply_event_loop_exit_handler_t)
                                        ply_terminal_session_detach_from_event_loop,
                                        session);
+
+        ply_logger_attach_to_event_loop (session->logger, loop);
 }
 
 static bool
@@ -300,6 +314,35 @@ ply_terminal_session_log_bytes (ply_terminal_session_t *session,
                                          bytes, number_of_bytes, session);
 }
 
+static void
+ply_terminal_session_cancel_log_flush (ply_terminal_session_t *session)
+{
+        if (session->log_flush_is_scheduled && session->loop != NULL)
+                ply_event_loop_stop_watching_for_timeout (session->loop,
+                                                          (ply_event_loop_timeout_handler_t)
+                                                          ply_terminal_session_write_log,
+                                                          session);
+        session->log_flush_is_scheduled = false;
+        session->bytes_waiting_to_be_logged = 0;
+}
+
+/* Hands everything waiting over to the logger, which writes what it
+ * can without blocking */
+static void
+ply_terminal_session_write_log (ply_terminal_session_t *session)
+{
+        ply_terminal_session_cancel_log_flush (session);
+        ply_logger_queue_flush (session->logger);
+}
+
+/* Writes everything waiting before returning */
+static void
+ply_terminal_session_flush_log (ply_terminal_session_t *session)
+{
+        ply_terminal_session_cancel_log_flush (session);
+        ply_logger_flush (session->logger);
+}
+
 static void
 ply_terminal_session_on_new_data (ply_terminal_session_t *session,
                                   int                     session_fd)
@@ -312,10 +355,23 @@ ply_terminal_session_on_new_data (ply_terminal_session_t *session,
 
         bytes_read = read (session_fd, buffer, sizeof(buffer));
 
-        if (bytes_read > 0)
-                ply_terminal_session_log_bytes (session, buffer, bytes_read);
+        if (bytes_read <= 0)
+                return;
 
-        ply_logger_flush (session->logger);
+        ply_terminal_session_log_bytes (session, buffer, bytes_read);
+        session->bytes_waiting_to_be_logged += bytes_read;
+
+        if (session->bytes_waiting_to_be_logged >= PLY_TERMINAL_SESSION_LOG_FLUSH_SIZE ||
+            session->loop == NULL) {
+                ply_terminal_session_write_log (session);
+        } else if (!session->log_flush_is_scheduled) {
+                ply_event_loop_watch_for_timeout (session->loop,
+                                                  PLY_TERMINAL_SESSION_LOG_FLUSH_TIMEOUT,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  ply_terminal_session_write_log,
+                                                  session);
+                session->log_flush_is_scheduled = true;
+        }
 }
 
 static void
@@ -336,7 +392,7 @@ ply_terminal_session_on_hangup (ply_terminal_session_t *session)
         attach_flags = session->attach_flags;
         created_terminal_device = session->created_terminal_device;
 
-        ply_logger_flush (session->logger);
+        ply_terminal_session_flush_log (session);
 
         session->is_running = false;
         ply_trace ("stopping terminal logging");
@@ -391,8 +447,10 @@ ply_terminal_session_stop_logging (ply_terminal_session_t *session)
         assert (session->logger != NULL);
 
         ply_trace ("stopping logging of incoming console messages");
-        if (ply_logger_is_logging (session->logger))
+        if (ply_logger_is_logging (session->logger)) {
+                ply_terminal_session_flush_log (session);
                 ply_logger_toggle_logging (session->logger);
+        }
 
         if (session->loop != NULL &&
             session->fd_watch != NULL)
@@ -420,12 +478,29 @@ ply_terminal_session_open_log (ply_terminal_session_t *session,
         return log_is_opened;
 }
 
+void
+ply_terminal_session_add_to_log (ply_terminal_session_t *session,
+                                 const char             *text)
+{
+        assert (session != NULL);
+        assert (session->logger != NULL);
+        assert (text != NULL);
+
+        if (text[0] == '\0' || !ply_logger_is_logging (session->logger))
+                return;
+
+        ply_logger_inject_bytes (session->logger, text, strlen (text));
+        ply_terminal_session_write_log (session);
+}
+
 void
 ply_terminal_session_close_log (ply_terminal_session_t *session)
 {
         assert (session != NULL);
         assert (session->logger != NULL);
 
+        ply_terminal_session_flush_log (session);
+
         return ply_logger_close_file (session->logger);
 }
 
@@ -68,6 +68,11 @@ int ply_terminal_session_get_fd (ply_terminal_session_t *session);
 bool ply_terminal_session_open_log (ply_terminal_session_t *session,
                                     const char             *filename);
 void ply_terminal_session_close_log (ply_terminal_session_t *session);
+
+/* Puts plymouthd's own text in the log, without it going to the output
+ * handler with what the console printed */
+void ply_terminal_session_add_to_log (ply_terminal_session_t *session,
+                                      const char             *text);
 #endif
 
 #endif /* PLY_TERMINAL_SESSION_H */
@@ -0,0 +1,387 @@
+/* ply-tiled-region.c - damage tracking on a grid of tiles
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-tiled-region.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-rectangle.h"
+
+/* Unlike ply_region_t, which keeps an exact, non-overlapping list of
+ * rectangles and has to split every new rectangle against all of the
+ * existing ones, a tiled region just marks the tiles a rectangle touches.
+ * Adding damage costs one memset per tile row, and turning the tiles back
+ * into rectangles is a single pass over the dirty rows.  The price is some
+ * overdraw, since whole tiles get flushed.
+ */
+struct _ply_tiled_region
+{
+        unsigned long    width;
+        unsigned long    height;
+
+        unsigned long    tile_size;
+        unsigned long    max_gap;
+        unsigned long    max_rectangles;
+
+        unsigned long    columns;
+        unsigned long    rows;
+        uint8_t         *tiles;
+
+        /* range of dirty tiles on each row, first > last when clean */
+        unsigned long   *first_dirty_column;
+        unsigned long   *last_dirty_column;
+        unsigned long    first_dirty_row;
+        unsigned long    last_dirty_row;
+
+        ply_rectangle_t  extents;
+
+        ply_rectangle_t *rectangles;
+        size_t           number_of_rectangles;
+        size_t           rectangles_size;
+        size_t          *open_rectangles;
+        size_t          *next_open_rectangles;
+        uint32_t         rectangles_are_stale : 1;
+};
+
+static void
+free_tiles (ply_tiled_region_t *region)
+{
+        free (region->tiles);
+        free (region->first_dirty_column);
+        free (region->last_dirty_column);
+        free (region->open_rectangles);
+        free (region->next_open_rectangles);
+}
+
+static void
+allocate_tiles (ply_tiled_region_t *region)
+{
+        unsigned long row;
+
+        region->columns = (region->width + region->tile_size - 1) / region->tile_size;
+        region->rows = (region->height + region->tile_size - 1) / region->tile_size;
+        region->columns = MAX (region->columns, 1);
+        region->rows = MAX (region->rows, 1);
+
+        region->tiles = calloc (region->columns * region->rows, sizeof(uint8_t));
+        region->first_dirty_column = malloc (region->rows * sizeof(unsigned long));
+        region->last_dirty_column = malloc (region->rows * sizeof(unsigned long));
+        region->open_rectangles = malloc (region->columns * sizeof(size_t));
+        region->next_open_rectangles = malloc (region->columns * sizeof(size_t));
+
+        for (row = 0; row < region->rows; row++) {
+                region->first_dirty_column[row] = region->columns;
+                region->last_dirty_column[row] = 0;
+        }
+
+        region->first_dirty_row = region->rows;
+        region->last_dirty_row = 0;
+        region->extents.x = 0;
+        region->extents.y = 0;
+        region->extents.width = 0;
+        region->extents.height = 0;
+        region->number_of_rectangles = 0;
+        region->rectangles_are_stale = false;
+}
+
+ply_tiled_region_t *
+ply_tiled_region_new (unsigned long width,
+                      unsigned long height)
+{
+        ply_tiled_region_t *region;
+
+        region = calloc (1, sizeof(ply_tiled_region_t));
+
+        region->width = width;
+        region->height = height;
+        region->tile_size = PLY_TILED_REGION_DEFAULT_TILE_SIZE;
+        region->max_gap = PLY_TILED_REGION_DEFAULT_MAX_GAP;
+        region->max_rectangles = PLY_TILED_REGION_DEFAULT_MAX_RECTANGLES;
+
+        allocate_tiles (region);
+
+        return region;
+}
+
+void
+ply_tiled_region_free (ply_tiled_region_t *region)
+{
+        if (region == NULL)
+                return;
+
+        free_tiles (region);
+        free (region->rectangles);
+        free (region);
+}
+
+void
+ply_tiled_region_set_coalescing_policy (ply_tiled_region_t *region,
+                                        unsigned long       tile_size,
+                                        unsigned long       max_gap,
+                                        unsigned long       max_rectangles)
+{
+        assert (region != NULL);
+        assert (tile_size > 0);
+        assert (max_rectangles > 0);
+
+        region->max_gap = max_gap;
+        region->max_rectangles = max_rectangles;
+
+        if (region->tile_size == tile_size) {
+                ply_tiled_region_clear (region);
+                return;
+        }
+
+        region->tile_size = tile_size;
+        free_tiles (region);
+        allocate_tiles (region);
+}
+
+void
+ply_tiled_region_add_rectangle (ply_tiled_region_t *region,
+                                ply_rectangle_t    *rectangle)
+{
+        ply_rectangle_t bounds, area;
+        unsigned long first_column, last_column;
+        unsigned long first_row, last_row;
+        unsigned long row;
+
+        assert (region != NULL);
+        assert (rectangle != NULL);
+
+        bounds.x = 0;
+        bounds.y = 0;
+        bounds.width = region->width;
+        bounds.height = region->height;
+
+        ply_rectangle_intersect (rectangle, &bounds, &area);
+
+        if (ply_rectangle_is_empty (&area))
+                return;
+
+        if (ply_rectangle_is_empty (&region->extents)) {
+                region->extents = area;
+        } else {
+                long right, bottom;
+
+                right = MAX (region->extents.x + region->extents.width, area.x + area.width);
+                bottom = MAX (region->extents.y + region->extents.height, area.y + area.height);
+                region->extents.x = MIN (region->extents.x, area.x);
+                region->extents.y = MIN (region->extents.y, area.y);
+                region->extents.width = right - region->extents.x;
+                region->extents.height = bottom - region->extents.y;
+        }
+
+        first_column = area.x / region->tile_size;
+        last_column = (area.x + area.width - 1) / region->tile_size;
+        first_row = area.y / region->tile_size;
+        last_row = (area.y + area.height - 1) / region->tile_size;
+
+        for (row = first_row; row <= last_row; row++) {
+                memset (region->tiles + row * region->columns + first_column, 1,
+                        last_column - first_column + 1);
+
+                region->first_dirty_column[row] = MIN (region->first_dirty_column[row], first_column);
+                region->last_dirty_column[row] = MAX (region->last_dirty_column[row], last_column);
+        }
+
+        region->first_dirty_row = MIN (region->first_dirty_row, first_row);
+        region->last_dirty_row = MAX (region->last_dirty_row, last_row);
+        region->rectangles_are_stale = true;
+}
+
+void
+ply_tiled_region_clear (ply_tiled_region_t *region)
+{
+        unsigned long row;
+
+        assert (region != NULL);
+
+        for (row = region->first_dirty_row; row <= region->last_dirty_row && row < region->rows; row++) {
+                unsigned long first_column, last_column;
+
+                first_column = region->first_dirty_column[row];
+                last_column = region->last_dirty_column[row];
+
+                if (first_column <= last_column)
+                        memset (region->tiles + row * region->columns + first_column, 0,
+                                last_column - first_column + 1);
+
+                region->first_dirty_column[row] = region->columns;
+                region->last_dirty_column[row] = 0;
+        }
+
+        region->first_dirty_row = region->rows;
+        region->last_dirty_row = 0;
+        region->extents.width = 0;
+        region->extents.height = 0;
+        region->number_of_rectangles = 0;
+        region->rectangles_are_stale = false;
+}
+
+bool
+ply_tiled_region_is_empty (ply_tiled_region_t *region)
+{
+        return ply_rectangle_is_empty (&region->extents);
+}
+
+void
+ply_tiled_region_get_extents (ply_tiled_region_t *region,
+                              ply_rectangle_t    *extents)
+{
+        *extents = region->extents;
+}
+
+static ply_rectangle_t *
+append_rectangle (ply_tiled_region_t *region)
+{
+        if (region->number_of_rectangles == region->rectangles_size) {
+                region->rectangles_size = MAX (region->rectangles_size * 2, 16);
+                region->rectangles = realloc (region->rectangles,
+                                              region->rectangles_size * sizeof(ply_rectangle_t));
+        }
+
+        return &region->rectangles[region->number_of_rectangles++];
+}
+
+/* Finds the end of the run of dirty tiles starting at column, bridging
+ * gaps of up to max_gap clean tiles
+ */
+static unsigned long
+find_end_of_run (ply_tiled_region_t *region,
+                 uint8_t            *tiles,
+                 unsigned long       column,
+                 unsigned long       last_column)
+{
+        unsigned long end = column + 1;
+
+        while (end <= last_column) {
+                unsigned long gap = 0;
+
+                while (end + gap <= last_column && !tiles[end + gap]) {
+                        gap++;
+                }
+
+                if (end + gap > last_column || gap > region->max_gap)
+                        break;
+
+                end += gap + 1;
+        }
+
+        return end;
+}
+
+static void
+update_rectangles (ply_tiled_region_t *region)
+{
+        size_t number_of_open_rectangles = 0;
+        unsigned long row;
+        size_t i;
+
+        region->number_of_rectangles = 0;
+
+        for (row = region->first_dirty_row; row <= region->last_dirty_row && row < region->rows; row++) {
+                size_t number_of_next_open_rectangles = 0;
+                size_t open_index = 0;
+                uint8_t *tiles;
+                unsigned long column, last_column;
+                size_t *swap;
+
+                tiles = region->tiles + row * region->columns;
+                column = region->first_dirty_column[row];
+                last_column = region->last_dirty_column[row];
+
+                while (column <= last_column && column < region->columns) {
+                        ply_rectangle_t run;
+                        unsigned long end;
+
+                        if (!tiles[column]) {
+                                column++;
+                                continue;
+                        }
+
+                        end = find_end_of_run (region, tiles, column, last_column);
+
+                        run.x = column * region->tile_size;
+                        run.y = row * region->tile_size;
+                        run.width = MIN (end * region->tile_size, region->width) - run.x;
+                        run.height = MIN ((row + 1) * region->tile_size, region->height) - run.y;
+
+                        /* Grow a rectangle from the previous row if it has
+                         * exactly the same horizontal extent
+                         */
+                        while (open_index < number_of_open_rectangles &&
+                               region->rectangles[region->open_rectangles[open_index]].x < run.x) {
+                                open_index++;
+                        }
+
+                        if (open_index < number_of_open_rectangles &&
+                            region->rectangles[region->open_rectangles[open_index]].x == run.x &&
+                            region->rectangles[region->open_rectangles[open_index]].width == run.width) {
+                                region->rectangles[region->open_rectangles[open_index]].height += run.height;
+                                region->next_open_rectangles[number_of_next_open_rectangles++] = region->open_rectangles[open_index];
+                                open_index++;
+                        } else {
+                                *append_rectangle (region) = run;
+                                region->next_open_rectangles[number_of_next_open_rectangles++] = region->number_of_rectangles - 1;
+                        }
+
+                        column = end;
+                }
+
+                swap = region->open_rectangles;
+                region->open_rectangles = region->next_open_rectangles;
+                region->next_open_rectangles = swap;
+                number_of_open_rectangles = number_of_next_open_rectangles;
+        }
+
+        if (region->number_of_rectangles > region->max_rectangles) {
+                region->rectangles[0] = region->extents;
+                region->number_of_rectangles = 1;
+        } else {
+                /* Tiles overshoot the damage at its outer edges, so trim
+                 * that back off
+                 */
+                for (i = 0; i < region->number_of_rectangles; i++) {
+                        ply_rectangle_intersect (&region->rectangles[i], &region->extents,
+                                                 &region->rectangles[i]);
+                }
+        }
+
+        region->rectangles_are_stale = false;
+}
+
+ply_rectangle_t *
+ply_tiled_region_get_rectangles (ply_tiled_region_t *region,
+                                 size_t             *number_of_rectangles)
+{
+        assert (region != NULL);
+        assert (number_of_rectangles != NULL);
+
+        if (region->rectangles_are_stale)
+                update_rectangles (region);
+
+        *number_of_rectangles = region->number_of_rectangles;
+        return region->rectangles;
+}
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,66 @@
+/* ply-tiled-region.h - damage tracking on a grid of tiles
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_TILED_REGION_H
+#define PLY_TILED_REGION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ply-rectangle.h"
+#include "ply-utils.h"
+
+typedef struct _ply_tiled_region ply_tiled_region_t;
+
+#define PLY_TILED_REGION_DEFAULT_TILE_SIZE 32
+#define PLY_TILED_REGION_DEFAULT_MAX_GAP 1
+#define PLY_TILED_REGION_DEFAULT_MAX_RECTANGLES 64
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+ply_tiled_region_t *ply_tiled_region_new (unsigned long width,
+                                          unsigned long height);
+void ply_tiled_region_free (ply_tiled_region_t *region);
+
+/* tile_size is in pixels.  Dirty runs of tiles on a tile row that are at
+ * most max_gap clean tiles apart are flushed as one rectangle, and if the
+ * damage still needs more than max_rectangles rectangles, its bounding
+ * box is used instead.  Calling this clears the region.
+ */
+void ply_tiled_region_set_coalescing_policy (ply_tiled_region_t *region,
+                                             unsigned long       tile_size,
+                                             unsigned long       max_gap,
+                                             unsigned long       max_rectangles);
+
+void ply_tiled_region_add_rectangle (ply_tiled_region_t *region,
+                                     ply_rectangle_t    *rectangle);
+void ply_tiled_region_clear (ply_tiled_region_t *region);
+bool ply_tiled_region_is_empty (ply_tiled_region_t *region);
+void ply_tiled_region_get_extents (ply_tiled_region_t *region,
+                                   ply_rectangle_t    *extents);
+
+/* Returns the damage as non-overlapping rectangles sorted by y.  The
+ * array belongs to the region and stays valid until it is next changed.
+ */
+ply_rectangle_t *ply_tiled_region_get_rectangles (ply_tiled_region_t *region,
+                                                  size_t             *number_of_rectangles);
+#endif
+
+#endif /* PLY_TILED_REGION_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
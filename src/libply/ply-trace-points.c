@@ -0,0 +1,217 @@
+/* ply-trace-points.c - compact binary records of hot code paths
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-trace-points.h"
+
+#ifdef PLY_ENABLE_TRACE_POINTS
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ply-array.h"
+#include "ply-utils.h"
+
+#define PLY_TRACE_POINTS_FILE_MAGIC "PLYTRACE"
+#define PLY_TRACE_POINTS_FILE_VERSION 1
+
+/* What gets written out, in the byte order of the machine that did the
+ * recording:
+ *
+ *   header, then number_of_points point descriptions, each followed by
+ *   its name and format (not nul terminated), then number_of_entries
+ *   entries, oldest first.
+ */
+typedef struct
+{
+        char     magic[8];
+        uint32_t version;
+        uint32_t number_of_points;
+        uint64_t number_of_entries;
+} ply_trace_points_file_header_t;
+
+typedef struct
+{
+        uint32_t id;
+        uint32_t name_length;
+        uint32_t format_length;
+} ply_trace_points_file_point_t;
+
+typedef struct
+{
+        uint64_t timestamp;
+        uint32_t id;
+        uint32_t padding;
+        int64_t  arguments[PLY_TRACE_POINT_MAX_ARGUMENTS];
+} ply_trace_point_entry_t;
+
+typedef struct
+{
+        char *name;
+        char *format;
+} ply_registered_trace_point_t;
+
+bool ply_trace_points_are_recording;
+
+/* Plugins get unloaded, so their names and formats are copied here */
+static pthread_mutex_t trace_points_lock = PTHREAD_MUTEX_INITIALIZER;
+static ply_array_t *registered_trace_points;
+
+static ply_trace_point_entry_t *entries;
+static size_t number_of_entries;
+static uint64_t next_entry;
+
+static uint32_t
+register_trace_point (ply_trace_point_t *point)
+{
+        ply_registered_trace_point_t *registered_point;
+        uint32_t id;
+
+        pthread_mutex_lock (&trace_points_lock);
+        id = point->id;
+        if (id == 0) {
+                if (registered_trace_points == NULL)
+                        registered_trace_points = ply_array_new (PLY_ARRAY_ELEMENT_TYPE_POINTER);
+
+                registered_point = calloc (1, sizeof(ply_registered_trace_point_t));
+                registered_point->name = strdup (point->name);
+                registered_point->format = strdup (point->format);
+                ply_array_add_pointer_element (registered_trace_points, registered_point);
+
+                /* ids start at 1 so 0 can mean unregistered */
+                id = ply_array_get_size (registered_trace_points);
+                __atomic_store_n (&point->id, id, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock (&trace_points_lock);
+
+        return id;
+}
+
+void
+ply_trace_points_record (ply_trace_point_t *point,
+                         int64_t            a,
+                         int64_t            b,
+                         int64_t            c,
+                         int64_t            d)
+{
+        ply_trace_point_entry_t *entry;
+        struct timespec now = { 0, 0 };
+        uint64_t position;
+        uint32_t id;
+
+        id = __atomic_load_n (&point->id, __ATOMIC_ACQUIRE);
+        if (id == 0)
+                id = register_trace_point (point);
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+
+        position = __atomic_fetch_add (&next_entry, 1, __ATOMIC_RELAXED);
+        entry = &entries[position % number_of_entries];
+
+        entry->timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+        entry->id = id;
+        entry->arguments[0] = a;
+        entry->arguments[1] = b;
+        entry->arguments[2] = c;
+        entry->arguments[3] = d;
+}
+
+void
+ply_trace_points_start_recording (size_t size)
+{
+        assert (size > 0);
+
+        if (ply_trace_points_are_recording)
+                return;
+
+        if (size != number_of_entries) {
+                free (entries);
+                entries = calloc (size, sizeof(ply_trace_point_entry_t));
+                number_of_entries = size;
+                next_entry = 0;
+        }
+
+        ply_trace_points_are_recording = true;
+}
+
+void
+ply_trace_points_stop_recording (void)
+{
+        ply_trace_points_are_recording = false;
+}
+
+bool
+ply_trace_points_write_to_fd (int fd)
+{
+        ply_trace_points_file_header_t header = { PLY_TRACE_POINTS_FILE_MAGIC };
+        ply_registered_trace_point_t *const *points = NULL;
+        uint64_t first_entry, entries_before_wrap;
+        uint32_t i;
+        bool written = false;
+
+        pthread_mutex_lock (&trace_points_lock);
+
+        header.version = PLY_TRACE_POINTS_FILE_VERSION;
+        if (registered_trace_points != NULL) {
+                header.number_of_points = ply_array_get_size (registered_trace_points);
+                points = (ply_registered_trace_point_t *const *)
+                         ply_array_get_pointer_elements (registered_trace_points);
+        }
+
+        if (next_entry > number_of_entries) {
+                header.number_of_entries = number_of_entries;
+                first_entry = next_entry % number_of_entries;
+        } else {
+                header.number_of_entries = next_entry;
+                first_entry = 0;
+        }
+
+        if (!ply_write (fd, &header, sizeof(header)))
+                goto out;
+
+        for (i = 0; i < header.number_of_points; i++) {
+                ply_trace_points_file_point_t point;
+
+                point.id = i + 1;
+                point.name_length = strlen (points[i]->name);
+                point.format_length = strlen (points[i]->format);
+
+                if (!ply_write (fd, &point, sizeof(point)) ||
+                    !ply_write (fd, points[i]->name, point.name_length) ||
+                    !ply_write (fd, points[i]->format, point.format_length))
+                        goto out;
+        }
+
+        entries_before_wrap = MIN (header.number_of_entries, number_of_entries - first_entry);
+        if (!ply_write (fd, entries + first_entry,
+                        entries_before_wrap * sizeof(ply_trace_point_entry_t)) ||
+            !ply_write (fd, entries,
+                        (header.number_of_entries - entries_before_wrap) * sizeof(ply_trace_point_entry_t)))
+                goto out;
+
+        written = true;
+out:
+        pthread_mutex_unlock (&trace_points_lock);
+        return written;
+}
+#endif /* PLY_ENABLE_TRACE_POINTS */
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,91 @@
+/* ply-trace-points.h - compact binary records of hot code paths
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_TRACE_POINTS_H
+#define PLY_TRACE_POINTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Trace points are for paths that run every frame, where formatting a
+ * ply_trace line would cost more than the work being traced.  Each one
+ * is a static descriptor with a printf style format for up to four
+ * integer arguments:
+ *
+ *   PLY_DEFINE_TRACE_POINT (flush_head_trace_point, "flushed %d areas");
+ *   ...
+ *   ply_trace_point (flush_head_trace_point, number_of_areas);
+ *
+ * While recording, each hit stores a timestamp, the point's id and the
+ * arguments in a ring, and nothing gets formatted until the ring is
+ * written out and decoded with scripts/plymouth-decode-trace-points.py.
+ * Configuring with --disable-trace-points compiles them all away.
+ */
+#define PLY_TRACE_POINT_MAX_ARGUMENTS 4
+
+#ifdef PLY_ENABLE_TRACE_POINTS
+typedef struct
+{
+        const char *name;
+        const char *format;
+        uint32_t    id;
+} ply_trace_point_t;
+
+extern bool ply_trace_points_are_recording;
+
+#define PLY_DEFINE_TRACE_POINT(point, format)                                  \
+        static ply_trace_point_t point = { #point, format, 0 }
+
+#define ply_trace_point(point, args ...)                                       \
+        ply_trace_point_with_arguments (&(point), ## args, 0, 0, 0, 0)
+#define ply_trace_point_with_arguments(point, a, b, c, d, ...)                 \
+        do                                                                     \
+        {                                                                      \
+                if (ply_trace_points_are_recording)                            \
+                        ply_trace_points_record ((point),                      \
+                                                 (int64_t) (a), (int64_t) (b), \
+                                                 (int64_t) (c), (int64_t) (d)); \
+        }                                                                      \
+        while (0)
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+void ply_trace_points_record (ply_trace_point_t *point,
+                              int64_t            a,
+                              int64_t            b,
+                              int64_t            c,
+                              int64_t            d);
+
+/* Keeps the last number_of_entries hits, overwriting the oldest */
+void ply_trace_points_start_recording (size_t number_of_entries);
+void ply_trace_points_stop_recording (void);
+bool ply_trace_points_write_to_fd (int fd);
+#endif
+
+#else
+#define PLY_DEFINE_TRACE_POINT(point, format)                                  \
+        extern int ply_trace_point_ ## point ## _is_compiled_out
+#define ply_trace_point(point, args ...)
+#define ply_trace_points_start_recording(number_of_entries)
+#define ply_trace_points_stop_recording()
+#define ply_trace_points_write_to_fd(fd) (false)
+#endif
+
+#endif /* PLY_TRACE_POINTS_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -46,6 +46,10 @@
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
 #include <linux/fs.h>
 #include <linux/vt.h>
 
@@ -77,14 +81,23 @@
 #define PLY_MAX_COMMAND_LINE_SIZE 4096
 #endif
 
-static int errno_stack[PLY_ERRNO_STACK_SIZE];
-static int errno_stack_position = 0;
+static __thread int errno_stack[PLY_ERRNO_STACK_SIZE];
+static __thread int errno_stack_position = 0;
 
 static int overridden_device_scale = 0;
+static int configured_render_threads = 0;
+static bool should_use_flush_threads = false;
 
 static char kernel_command_line[PLY_MAX_COMMAND_LINE_SIZE];
 static bool kernel_command_line_is_set;
 
+/* The same arguments, each NUL terminated and in command line order, with
+ * pointers to them sorted so they can be looked up by binary search
+ */
+static char kernel_command_line_arguments[PLY_MAX_COMMAND_LINE_SIZE];
+static const char *kernel_command_line_index[PLY_MAX_COMMAND_LINE_SIZE / 2];
+static size_t kernel_command_line_index_size;
+
 bool
 ply_open_unidirectional_pipe (int *sender_fd,
                               int *receiver_fd)
@@ -844,6 +857,77 @@ out:
         return (pid_t) ppid;
 }
 
+static bool
+read_power_supply_attribute (const char *power_supply,
+                             const char *attribute,
+                             char       *value,
+                             size_t      size)
+{
+        char *path;
+        FILE *fp;
+        bool read_value = false;
+
+        asprintf (&path, "/sys/class/power_supply/%s/%s", power_supply, attribute);
+        fp = fopen (path, "re");
+        free (path);
+
+        if (fp == NULL)
+                return false;
+
+        if (fgets (value, size, fp) != NULL) {
+                value[strcspn (value, "\n")] = '\0';
+                read_value = true;
+        }
+        fclose (fp);
+
+        return read_value;
+}
+
+/* On battery means a battery is discharging and nothing is plugged in,
+ * machines without a battery never are */
+bool
+ply_is_on_battery_power (void)
+{
+        DIR *dir;
+        struct dirent *entry;
+        bool has_discharging_battery = false, is_plugged_in = false;
+
+        dir = opendir ("/sys/class/power_supply");
+        if (dir == NULL)
+                return false;
+
+        while ((entry = readdir (dir)) != NULL) {
+                char type[32], value[32];
+
+                if (entry->d_name[0] == '.')
+                        continue;
+
+                if (!read_power_supply_attribute (entry->d_name, "type", type, sizeof(type)))
+                        continue;
+
+                if (strcmp (type, "Battery") == 0) {
+                        if (read_power_supply_attribute (entry->d_name, "status", value, sizeof(value)) &&
+                            strcmp (value, "Discharging") == 0)
+                                has_discharging_battery = true;
+                } else if (strcmp (type, "Mains") == 0 || strncmp (type, "USB", strlen ("USB")) == 0) {
+                        if (read_power_supply_attribute (entry->d_name, "online", value, sizeof(value)) &&
+                            strcmp (value, "1") == 0)
+                                is_plugged_in = true;
+                }
+        }
+        closedir (dir);
+
+        return has_discharging_battery && !is_plugged_in;
+}
+
+void
+ply_trim_memory (void)
+{
+#ifdef HAVE_MALLOC_TRIM
+        malloc_trim (0);
+#endif
+}
+
 void
 ply_set_device_scale (int device_scale)
 {
@@ -897,6 +981,90 @@ ply_get_device_scale (uint32_t width,
         return device_scale;
 }
 
+void
+ply_set_render_threads (int render_threads)
+{
+        configured_render_threads = render_threads;
+        ply_trace ("Render threads set to %d", render_threads);
+}
+
+/* The most threads worth splitting a flush over, beyond this the bands get
+ * too thin to pay for the hand off
+ */
+#define MAX_RENDER_THREADS 16
+
+int
+ply_get_render_threads (void)
+{
+        long number_of_cpus;
+        int render_threads;
+
+        if (configured_render_threads == 0 || configured_render_threads == 1)
+                return 1;
+
+        number_of_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+        if (number_of_cpus <= 1)
+                return 1;
+
+        /* negative means one per cpu */
+        if (configured_render_threads < 0)
+                render_threads = number_of_cpus;
+        else
+                render_threads = MIN (configured_render_threads, number_of_cpus);
+
+        return MIN (render_threads, MAX_RENDER_THREADS);
+}
+
+void
+ply_set_flush_threads (bool use_flush_threads)
+{
+        should_use_flush_threads = use_flush_threads;
+        ply_trace ("Flush threads %s", use_flush_threads ? "enabled" : "disabled");
+}
+
+bool
+ply_get_flush_threads (void)
+{
+        return should_use_flush_threads;
+}
+
+static int
+compare_kernel_command_line_arguments (const void *a,
+                                       const void *b)
+{
+        return strcmp (*(const char * const *) a, *(const char * const *) b);
+}
+
+static void
+index_kernel_command_line (void)
+{
+        char *argument;
+
+        memcpy (kernel_command_line_arguments, kernel_command_line,
+                sizeof(kernel_command_line_arguments));
+        kernel_command_line_index_size = 0;
+
+        argument = kernel_command_line_arguments;
+        while (*argument != '\0') {
+                if (isspace ((unsigned char) *argument)) {
+                        argument++;
+                        continue;
+                }
+
+                kernel_command_line_index[kernel_command_line_index_size++] = argument;
+
+                while (*argument != '\0' && !isspace ((unsigned char) *argument)) {
+                        argument++;
+                }
+
+                if (*argument != '\0')
+                        *argument++ = '\0';
+        }
+
+        qsort (kernel_command_line_index, kernel_command_line_index_size,
+               sizeof(const char *), compare_kernel_command_line_arguments);
+}
+
 static const char *
 ply_get_kernel_command_line (void)
 {
@@ -938,45 +1106,70 @@ ply_get_kernel_command_line (void)
 
         close (fd);
 
+        index_kernel_command_line ();
         kernel_command_line_is_set = true;
         return kernel_command_line;
 }
 
+/* Returns where the first argument that isn't sorted before prefix is in
+ * the index.  Every argument starting with prefix sorts together from there.
+ */
+static size_t
+ply_kernel_command_line_find_prefix (const char *prefix)
+{
+        size_t low = 0, high = kernel_command_line_index_size;
+
+        while (low < high) {
+                size_t middle = low + (high - low) / 2;
+
+                if (strcmp (kernel_command_line_index[middle], prefix) < 0)
+                        low = middle + 1;
+                else
+                        high = middle;
+        }
+
+        return low;
+}
+
 const char *
 ply_kernel_command_line_get_string_after_prefix (const char *prefix)
 {
-        const char *command_line = ply_get_kernel_command_line();
-        char *argument;
+        const char *argument = NULL;
+        size_t prefix_length;
+        size_t i;
 
-        if (!command_line)
+        if (!ply_get_kernel_command_line ())
                 return NULL;
 
-        argument = strstr (command_line, prefix);
+        prefix_length = strlen (prefix);
+
+        /* The argument the furthest left on the command line wins */
+        for (i = ply_kernel_command_line_find_prefix (prefix);
+             i < kernel_command_line_index_size &&
+             strncmp (kernel_command_line_index[i], prefix, prefix_length) == 0;
+             i++) {
+                if (argument == NULL || kernel_command_line_index[i] < argument)
+                        argument = kernel_command_line_index[i];
+        }
 
         if (argument == NULL)
                 return NULL;
 
-        if (argument == command_line ||
-            argument[-1] == ' ')
-                return argument + strlen (prefix);
-
-        return NULL;
+        return argument + prefix_length;
 }
 
 bool
 ply_kernel_command_line_has_argument (const char *argument)
 {
-        const char *string;
-
-        string = ply_kernel_command_line_get_string_after_prefix (argument);
+        size_t i;
 
-        if (string == NULL)
+        if (!ply_get_kernel_command_line ())
                 return false;
 
-        if (!isspace ((int) string[0]) && string[0] != '\0')
-                return false;
+        i = ply_kernel_command_line_find_prefix (argument);
 
-        return true;
+        return i < kernel_command_line_index_size &&
+               strcmp (kernel_command_line_index[i], argument) == 0;
 }
 
 char *
@@ -996,6 +1189,7 @@ ply_kernel_command_line_override (const char *command_line)
 {
         strncpy (kernel_command_line, command_line, sizeof(kernel_command_line));
         kernel_command_line[sizeof(kernel_command_line) - 1] = '\0';
+        index_kernel_command_line ();
         kernel_command_line_is_set = true;
 }
 
@@ -118,6 +118,13 @@ int ply_utf8_string_get_length (const char *string,
 char *ply_get_process_command_line (pid_t pid);
 pid_t ply_get_process_parent_pid (pid_t pid);
 
+bool ply_is_on_battery_power (void);
+
+/* Hands memory that was freed back to the system, for when a lot of it
+ * was just released and the process sticks around
+ */
+void ply_trim_memory (void);
+
 void ply_set_device_scale (int device_scale);
 
 int ply_get_device_scale (uint32_t width,
@@ -125,6 +132,17 @@ int ply_get_device_scale (uint32_t width,
                           uint32_t width_mm,
                           uint32_t height_mm);
 
+/* 0 or 1 renders on the main thread only, a negative value uses one
+ * thread per cpu.  Single cpu systems always get 1.
+ */
+void ply_set_render_threads (int render_threads);
+int ply_get_render_threads (void);
+/* Gives each renderer that can do it a thread of its own to flush its
+ * heads on, so a slow device doesn't hold the others back
+ */
+void ply_set_flush_threads (bool should_use_flush_threads);
+bool ply_get_flush_threads (void);
+
 const char *ply_kernel_command_line_get_string_after_prefix (const char *prefix);
 bool ply_kernel_command_line_has_argument (const char *argument);
 void ply_kernel_command_line_override (const char *command_line);
@@ -0,0 +1,224 @@
+/* ply-worker-pool.c - runs batches of jobs on a set of threads
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-worker-pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-logger.h"
+#include "ply-utils.h"
+
+struct _ply_worker_pool
+{
+        pthread_t                    *threads;
+        int                           number_of_threads;
+
+        pthread_mutex_t               mutex;
+        pthread_cond_t                jobs_available;
+        pthread_cond_t                jobs_done;
+
+        ply_worker_pool_job_handler_t handler;
+        void                         *user_data;
+        int                           number_of_jobs;
+        int                           next_job;
+        int                           number_of_unfinished_jobs;
+
+        uint32_t                      is_quitting : 1;
+};
+
+/* Runs jobs until none are left to hand out.  Called with the mutex held,
+ * and returns with it held.
+ */
+static void
+ply_worker_pool_run_jobs (ply_worker_pool_t *pool)
+{
+        while (pool->next_job < pool->number_of_jobs) {
+                int job_index;
+
+                job_index = pool->next_job++;
+
+                pthread_mutex_unlock (&pool->mutex);
+                pool->handler (pool->user_data, job_index);
+                pthread_mutex_lock (&pool->mutex);
+
+                pool->number_of_unfinished_jobs--;
+                if (pool->number_of_unfinished_jobs == 0)
+                        pthread_cond_signal (&pool->jobs_done);
+        }
+}
+
+static void *
+ply_worker_pool_thread_main (void *user_data)
+{
+        ply_worker_pool_t *pool = user_data;
+
+        pthread_mutex_lock (&pool->mutex);
+        while (!pool->is_quitting) {
+                if (pool->next_job >= pool->number_of_jobs) {
+                        pthread_cond_wait (&pool->jobs_available, &pool->mutex);
+                        continue;
+                }
+
+                ply_worker_pool_run_jobs (pool);
+        }
+        pthread_mutex_unlock (&pool->mutex);
+
+        return NULL;
+}
+
+ply_worker_pool_t *
+ply_worker_pool_new (int number_of_threads)
+{
+        ply_worker_pool_t *pool;
+        sigset_t all_signals, old_signals;
+        int i, result;
+
+        assert (number_of_threads > 0);
+
+        pool = calloc (1, sizeof(ply_worker_pool_t));
+        pthread_mutex_init (&pool->mutex, NULL);
+        pthread_cond_init (&pool->jobs_available, NULL);
+        pthread_cond_init (&pool->jobs_done, NULL);
+
+        pool->threads = calloc (number_of_threads, sizeof(pthread_t));
+        pool->number_of_threads = 1;
+
+        /* Signals are dispatched by the event loop on the main thread, keep
+         * the workers out of it
+         */
+        sigfillset (&all_signals);
+        pthread_sigmask (SIG_BLOCK, &all_signals, &old_signals);
+
+        for (i = 1; i < number_of_threads; i++) {
+                result = pthread_create (&pool->threads[pool->number_of_threads - 1], NULL,
+                                         ply_worker_pool_thread_main, pool);
+                if (result != 0) {
+                        ply_trace ("could not start worker thread: %s", strerror (result));
+                        break;
+                }
+                pool->number_of_threads++;
+        }
+
+        pthread_sigmask (SIG_SETMASK, &old_signals, NULL);
+
+        return pool;
+}
+
+void
+ply_worker_pool_free (ply_worker_pool_t *pool)
+{
+        int i;
+
+        if (pool == NULL)
+                return;
+
+        pthread_mutex_lock (&pool->mutex);
+        pool->is_quitting = true;
+        pthread_cond_broadcast (&pool->jobs_available);
+        pthread_mutex_unlock (&pool->mutex);
+
+        for (i = 0; i < pool->number_of_threads - 1; i++) {
+                pthread_join (pool->threads[i], NULL);
+        }
+
+        pthread_cond_destroy (&pool->jobs_done);
+        pthread_cond_destroy (&pool->jobs_available);
+        pthread_mutex_destroy (&pool->mutex);
+        free (pool->threads);
+        free (pool);
+}
+
+ply_worker_pool_t *
+ply_worker_pool_get_default (void)
+{
+        static ply_worker_pool_t *worker_pool = NULL;
+        static bool worker_pool_checked = false;
+        int render_threads;
+
+        if (worker_pool_checked)
+                return worker_pool;
+
+        worker_pool_checked = true;
+
+        render_threads = ply_get_render_threads ();
+        if (render_threads <= 1)
+                return NULL;
+
+        ply_trace ("using %d render threads", render_threads);
+        worker_pool = ply_worker_pool_new (render_threads);
+        return worker_pool;
+}
+
+int
+ply_worker_pool_get_number_of_threads (ply_worker_pool_t *pool)
+{
+        return pool->number_of_threads;
+}
+
+void
+ply_worker_pool_run (ply_worker_pool_t            *pool,
+                     ply_worker_pool_job_handler_t handler,
+                     void                         *user_data,
+                     int                           number_of_jobs)
+{
+        int i;
+
+        assert (pool != NULL);
+        assert (handler != NULL);
+
+        if (number_of_jobs <= 0)
+                return;
+
+        if (pool->number_of_threads == 1 || number_of_jobs == 1) {
+                for (i = 0; i < number_of_jobs; i++) {
+                        handler (user_data, i);
+                }
+                return;
+        }
+
+        pthread_mutex_lock (&pool->mutex);
+        pool->handler = handler;
+        pool->user_data = user_data;
+        pool->number_of_jobs = number_of_jobs;
+        pool->next_job = 0;
+        pool->number_of_unfinished_jobs = number_of_jobs;
+        pthread_cond_broadcast (&pool->jobs_available);
+
+        ply_worker_pool_run_jobs (pool);
+
+        while (pool->number_of_unfinished_jobs > 0) {
+                pthread_cond_wait (&pool->jobs_done, &pool->mutex);
+        }
+
+        pool->handler = NULL;
+        pool->user_data = NULL;
+        pool->number_of_jobs = 0;
+        pool->next_job = 0;
+        pthread_mutex_unlock (&pool->mutex);
+}
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,53 @@
+/* ply-worker-pool.h - runs batches of jobs on a set of threads
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_WORKER_POOL_H
+#define PLY_WORKER_POOL_H
+
+typedef struct _ply_worker_pool ply_worker_pool_t;
+
+typedef void (*ply_worker_pool_job_handler_t) (void *user_data,
+                                               int   job_index);
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+/* number_of_threads counts the calling thread, so a pool of n threads
+ * starts n - 1 workers
+ */
+ply_worker_pool_t *ply_worker_pool_new (int number_of_threads);
+void ply_worker_pool_free (ply_worker_pool_t *pool);
+
+/* The pool shared by everything that splits work up, sized by the
+ * configured number of render threads.  Returns NULL when that is one.
+ * Only call it, and run jobs on it, from the main thread.
+ */
+ply_worker_pool_t *ply_worker_pool_get_default (void);
+int ply_worker_pool_get_number_of_threads (ply_worker_pool_t *pool);
+
+/* Calls handler once for every job index in [0, number_of_jobs), spread
+ * over the pool, and returns when all of them are done.  The calling
+ * thread takes part in the work.
+ */
+void ply_worker_pool_run (ply_worker_pool_t            *pool,
+                          ply_worker_pool_job_handler_t handler,
+                          void                         *user_data,
+                          int                           number_of_jobs);
+#endif
+
+#endif /* PLY_WORKER_POOL_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
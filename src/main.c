@@ -37,6 +37,8 @@
 #include <assert.h>
 #include <values.h>
 #include <locale.h>
+#include <signal.h>
+#include <sys/mman.h>
 
 #include <linux/kd.h>
 #include <linux/vt.h>
@@ -47,17 +49,40 @@
 #include "ply-boot-splash.h"
 #include "ply-device-manager.h"
 #include "ply-event-loop.h"
+#include "ply-frame-clock.h"
 #include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-logger.h"
+#include "ply-pixel-buffer.h"
 #include "ply-renderer.h"
 #include "ply-terminal-session.h"
+#include "ply-trace-points.h"
 #include "ply-trigger.h"
+#include "ply-statistics.h"
 #include "ply-utils.h"
 #include "ply-progress.h"
 
 #define BOOT_DURATION_FILE     PLYMOUTH_TIME_DIRECTORY "/boot-duration"
 #define SHUTDOWN_DURATION_FILE PLYMOUTH_TIME_DIRECTORY "/shutdown-duration"
+#define SNAPSHOT_FILE_PREFIX   PLYMOUTH_TIME_DIRECTORY "/snapshot-"
+
+/* Status updates and messages reach the splash at most this often */
+#define SPLASH_UPDATES_PER_SECOND 60.0
+
+/* Animations slow down to IdleFrameRate, or this by default, after this
+ * long without progress or input, and further on battery
+ */
+#define ANIMATION_IDLE_TIMEOUT 5.0
+#define DEFAULT_IDLE_FRAMES_PER_SECOND 5.0
+#define BATTERY_IDLE_FRAMES_PER_SECOND 1.0
+
+/* How long the last boot frame is kept around for the display server,
+ * after quitting with --retain-splash
+ */
+#define HAND_OVER_TIMEOUT "60"
+
+#define TRACE_POINTS_RING_SIZE 16384
+#define TRACE_POINTS_FILE      PLYMOUTH_LOG_DIRECTORY "/plymouth-trace-points.bin"
 
 typedef struct
 {
@@ -74,11 +99,27 @@ typedef struct
         ply_trigger_t *trigger;
 } ply_entry_trigger_t;
 
+typedef struct
+{
+        const ply_boot_protocol_progress_record_t *record;
+        ply_boot_protocol_progress_record_t        last_sample;
+} progress_channel_t;
+
 typedef struct
 {
         ply_event_loop_t       *loop;
         ply_boot_server_t      *boot_server;
         ply_boot_splash_t      *boot_splash;
+
+        /* the theme most likely to be shown, loading while devices are
+         * probed, and the path it was loaded from */
+        ply_boot_splash_t      *preloaded_splash;
+        char                   *preloaded_splash_path;
+
+        /* the theme boot_splash was loaded from, NULL for the built-in
+         * one */
+        char                   *splash_path;
+
         ply_terminal_session_t *session;
         ply_buffer_t           *boot_buffer;
         ply_progress_t         *progress;
@@ -87,6 +128,13 @@ typedef struct
         ply_buffer_t           *entry_buffer;
         ply_list_t             *messages;
         ply_command_parser_t   *command_parser;
+
+        /* updates waiting for the next frame */
+        char                   *pending_status;
+        ply_list_t             *pending_messages;
+
+        /* progress records clients update in place, read once a frame */
+        ply_list_t             *progress_channels;
         ply_boot_splash_mode_t  mode;
         ply_terminal_t         *local_console_terminal;
         ply_device_manager_t   *device_manager;
@@ -98,6 +146,10 @@ typedef struct
         double                  splash_delay;
         double                  device_timeout;
 
+        /* what animations slow down to when nothing is happening */
+        double                  idle_frames_per_second;
+        double                  last_activity_time;
+
         uint32_t                no_boot_log : 1;
         uint32_t                showing_details : 1;
         uint32_t                system_initialized : 1;
@@ -109,6 +161,12 @@ typedef struct
         uint32_t                is_shown : 1;
         uint32_t                should_force_details : 1;
         uint32_t                splash_is_becoming_idle : 1;
+        uint32_t                is_waiting_for_splash_update_frame : 1;
+        uint32_t                snapshot_is_shown : 1;
+        uint32_t                should_show_debug_hud : 1;
+        uint32_t                is_waiting_for_animation_idle : 1;
+        uint32_t                animations_are_idle : 1;
+        uint32_t                fd_escrow_is_running : 1;
 
         char                   *override_splash_path;
         char                   *system_default_splash_path;
@@ -119,6 +177,8 @@ typedef struct
 } state_t;
 
 static void show_splash (state_t *state);
+static void start_plymouthd_fd_escrow (state_t    *state,
+                                       const char *timeout);
 static ply_boot_splash_t *load_built_in_theme (state_t *state);
 static ply_boot_splash_t *load_theme (state_t    *state,
                                       const char *theme_path);
@@ -133,12 +193,28 @@ static void on_escape_pressed (state_t *state);
 static void dump_details_and_quit_splash (state_t *state);
 static void update_display (state_t *state);
 
-static void on_error_message (ply_buffer_t *debug_buffer,
-                              const void   *bytes,
-                              size_t        number_of_bytes);
-static ply_buffer_t *debug_buffer;
+/* Where the debug log is kept until it gets written out.  It's mapped in
+ * one go up front, so writing it out from the crash handler needs nothing
+ * but write (), however broken the heap is by then.  It keeps the most
+ * recent DEBUG_BUFFER_SIZE bytes.
+ */
+typedef struct
+{
+        char  *bytes;
+        size_t number_of_bytes_written;
+} debug_buffer_t;
+
+#define DEBUG_BUFFER_SIZE (16 * 1024 * 1024)
+
+static void on_error_message (debug_buffer_t *debug_buffer,
+                              const void     *bytes,
+                              size_t          number_of_bytes);
+static debug_buffer_t *debug_buffer_new (void);
+static void debug_buffer_free (debug_buffer_t *debug_buffer);
+static debug_buffer_t *debug_buffer;
 static char *debug_buffer_path = NULL;
 static char *pid_file = NULL;
+static bool trace_points_are_recording;
 static void toggle_between_splash_and_details (state_t *state);
 #ifdef PLY_ENABLE_SYSTEMD_INTEGRATION
 static void tell_systemd_to_print_details (state_t *state);
@@ -159,6 +235,65 @@ static bool sh_is_init (state_t *state);
 static void cancel_pending_delayed_show (state_t *state);
 static void prepare_logging (state_t *state);
 static void dump_debug_buffer_to_file (void);
+static void dump_trace_points_to_file (void);
+
+static void
+on_animation_idle_timeout (state_t *state)
+{
+        double time_left, frames_per_second;
+
+        state->is_waiting_for_animation_idle = false;
+
+        time_left = state->last_activity_time + ANIMATION_IDLE_TIMEOUT - ply_get_timestamp ();
+        if (time_left > 0.0) {
+                state->is_waiting_for_animation_idle = true;
+                ply_event_loop_watch_for_timeout (state->loop,
+                                                  time_left,
+                                                  (ply_event_loop_timeout_handler_t)
+                                                  on_animation_idle_timeout,
+                                                  state);
+                return;
+        }
+
+        frames_per_second = state->idle_frames_per_second;
+        if (ply_is_on_battery_power ())
+                frames_per_second = MIN (frames_per_second, BATTERY_IDLE_FRAMES_PER_SECOND);
+
+        ply_trace ("nothing is happening, slowing animations down to %.1f frames per second",
+                   frames_per_second);
+        ply_frame_clock_set_maximum_frame_rate (ply_frame_clock_get_default (),
+                                                frames_per_second);
+        state->animations_are_idle = true;
+}
+
+/* Animations run at their full rate while boot makes progress or someone
+ * types, and slow down once neither has happened for a while, so a
+ * splash left waiting at a prompt doesn't run the battery down.
+ */
+static void
+note_activity (state_t *state)
+{
+        if (state->idle_frames_per_second <= 0.0)
+                return;
+
+        state->last_activity_time = ply_get_timestamp ();
+
+        if (state->animations_are_idle) {
+                ply_trace ("speeding animations back up");
+                ply_frame_clock_set_maximum_frame_rate (ply_frame_clock_get_default (), 0.0);
+                state->animations_are_idle = false;
+        }
+
+        if (state->is_waiting_for_animation_idle)
+                return;
+
+        state->is_waiting_for_animation_idle = true;
+        ply_event_loop_watch_for_timeout (state->loop,
+                                          ANIMATION_IDLE_TIMEOUT,
+                                          (ply_event_loop_timeout_handler_t)
+                                          on_animation_idle_timeout,
+                                          state);
+}
 
 static void
 on_session_output (state_t    *state,
@@ -177,16 +312,72 @@ on_session_hangup (state_t *state)
         ply_trace ("got hang up on terminal session fd");
 }
 
+static void
+on_splash_update_frame (state_t *state)
+{
+        ply_list_node_t *node;
+
+        ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                  (ply_frame_clock_handler_t)
+                                                  on_splash_update_frame,
+                                                  state);
+        state->is_waiting_for_splash_update_frame = false;
+
+        if (state->pending_status != NULL) {
+                if (state->boot_splash != NULL)
+                        ply_boot_splash_update_status (state->boot_splash,
+                                                       state->pending_status);
+                free (state->pending_status);
+                state->pending_status = NULL;
+        }
+
+        node = ply_list_get_first_node (state->pending_messages);
+        while (node != NULL) {
+                const char *message = ply_list_node_get_data (node);
+
+                if (state->boot_splash != NULL)
+                        ply_boot_splash_display_message (state->boot_splash, message);
+
+                node = ply_list_get_next_node (state->pending_messages, node);
+        }
+        ply_list_remove_all_nodes (state->pending_messages);
+}
+
+/* Clients can send updates much faster than anyone can read them, so
+ * they're held until the next frame, and only the last status sent by
+ * then gets shown.
+ */
+static void
+wait_for_splash_update_frame (state_t *state)
+{
+        if (state->is_waiting_for_splash_update_frame)
+                return;
+
+        ply_frame_clock_watch_for_frames (ply_frame_clock_get_default (),
+                                          SPLASH_UPDATES_PER_SECOND,
+                                          (ply_frame_clock_handler_t)
+                                          on_splash_update_frame,
+                                          state);
+        state->is_waiting_for_splash_update_frame = true;
+}
+
 static void
 on_update (state_t    *state,
            const char *status)
 {
         ply_trace ("updating status to '%s'", status);
+        note_activity (state);
+
+        /* every status goes into the history, for the boot time cache */
         ply_progress_status_update (state->progress,
                                     status);
-        if (state->boot_splash != NULL)
-                ply_boot_splash_update_status (state->boot_splash,
-                                               status);
+
+        if (state->boot_splash == NULL)
+                return;
+
+        free (state->pending_status);
+        state->pending_status = strdup (status);
+        wait_for_splash_update_frame (state);
 }
 
 static void
@@ -228,6 +419,8 @@ static void
 on_system_update (state_t *state,
                   int      progress)
 {
+        note_activity (state);
+
         if (state->boot_splash == NULL) {
                 ply_trace ("no splash set");
                 return;
@@ -240,6 +433,119 @@ on_system_update (state_t *state,
         }
 }
 
+/* Takes a consistent copy of a record the client may be writing to */
+static bool
+sample_progress_record (const ply_boot_protocol_progress_record_t *record,
+                        ply_boot_protocol_progress_record_t       *sample)
+{
+        int tries;
+
+        for (tries = 0; tries < 4; tries++) {
+                uint32_t sequence;
+
+                sequence = __atomic_load_n (&record->sequence, __ATOMIC_ACQUIRE);
+                if (sequence & 1)
+                        continue;
+
+                sample->percent = __atomic_load_n (&record->percent, __ATOMIC_RELAXED);
+                memcpy (sample->text, (const char *) record->text, sizeof(sample->text));
+                __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+                if (__atomic_load_n (&record->sequence, __ATOMIC_RELAXED) != sequence)
+                        continue;
+
+                sample->sequence = sequence;
+                sample->text[sizeof(sample->text) - 1] = '\0';
+                return true;
+        }
+
+        /* it's changing faster than we can read it, next frame then */
+        return false;
+}
+
+static void
+read_progress_channel (state_t            *state,
+                       progress_channel_t *channel)
+{
+        ply_boot_protocol_progress_record_t sample;
+
+        if (__atomic_load_n (&channel->record->sequence, __ATOMIC_ACQUIRE) == channel->last_sample.sequence)
+                return;
+
+        if (!sample_progress_record (channel->record, &sample))
+                return;
+
+        if (sample.text[0] != '\0' && strcmp (sample.text, channel->last_sample.text) != 0)
+                on_update (state, sample.text);
+
+        if (sample.percent != channel->last_sample.percent)
+                on_system_update (state, MIN (sample.percent, 100));
+
+        channel->last_sample = sample;
+}
+
+static void
+on_progress_channel_frame (state_t *state)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (state->progress_channels);
+        while (node != NULL) {
+                read_progress_channel (state, ply_list_node_get_data (node));
+                node = ply_list_get_next_node (state->progress_channels, node);
+        }
+}
+
+static void
+on_progress_channel (state_t                                   *state,
+                     const ply_boot_protocol_progress_record_t *record,
+                     bool                                       is_open)
+{
+        progress_channel_t *channel;
+        ply_list_node_t *node;
+
+        if (is_open) {
+                ply_trace ("reading progress from a new progress channel");
+                channel = calloc (1, sizeof(progress_channel_t));
+                channel->record = record;
+                ply_list_append_data (state->progress_channels, channel);
+
+                if (ply_list_get_length (state->progress_channels) == 1)
+                        ply_frame_clock_watch_for_frames (ply_frame_clock_get_default (),
+                                                          SPLASH_UPDATES_PER_SECOND,
+                                                          (ply_frame_clock_handler_t)
+                                                          on_progress_channel_frame,
+                                                          state);
+                return;
+        }
+
+        node = ply_list_get_first_node (state->progress_channels);
+        while (node != NULL) {
+                channel = ply_list_node_get_data (node);
+
+                if (channel->record == record)
+                        break;
+
+                node = ply_list_get_next_node (state->progress_channels, node);
+        }
+
+        if (node == NULL)
+                return;
+
+        ply_trace ("progress channel closed");
+
+        /* don't lose whatever was written last */
+        read_progress_channel (state, channel);
+        ply_list_remove_node (state->progress_channels, node);
+        free (channel);
+
+        if (ply_list_get_length (state->progress_channels) == 0)
+                ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                          (ply_frame_clock_handler_t)
+                                                          on_progress_channel_frame,
+                                                          state);
+}
+
 static void
 show_messages (state_t *state)
 {
@@ -248,6 +554,9 @@ show_messages (state_t *state)
                 return;
         }
 
+        /* they're all about to be shown anyway */
+        ply_list_remove_all_nodes (state->pending_messages);
+
         ply_list_node_t *node = ply_list_get_first_node (state->messages);
         while (node != NULL) {
                 ply_list_node_t *next_node;
@@ -299,6 +608,8 @@ load_settings (state_t    *state,
         bool settings_loaded = false;
         char *scale_string = NULL;
         char *splash_string = NULL;
+        char *render_threads_string = NULL;
+        char *memory_budget_string = NULL;
 
         ply_trace ("Trying to load %s", path);
         key_file = ply_key_file_new (path);
@@ -326,6 +637,11 @@ load_settings (state_t    *state,
                 ply_trace ("Device timeout is set to %lf", state->device_timeout);
         }
 
+        if (isnan (state->idle_frames_per_second)) {
+                state->idle_frames_per_second = ply_key_file_get_double (key_file, "Daemon", "IdleFrameRate", NAN);
+                ply_trace ("Idle frame rate is set to %lf", state->idle_frames_per_second);
+        }
+
         scale_string = ply_key_file_get_value (key_file, "Daemon", "DeviceScale");
 
         if (scale_string != NULL) {
@@ -333,6 +649,28 @@ load_settings (state_t    *state,
                 free (scale_string);
         }
 
+        render_threads_string = ply_key_file_get_value (key_file, "Daemon", "RenderThreads");
+
+        if (render_threads_string != NULL) {
+                if (strcmp (render_threads_string, "auto") == 0)
+                        ply_set_render_threads (-1);
+                else
+                        ply_set_render_threads (strtol (render_threads_string, NULL, 0));
+                free (render_threads_string);
+        }
+
+        if (ply_key_file_has_key (key_file, "Daemon", "FlushThreads"))
+                ply_set_flush_threads (ply_key_file_get_bool (key_file, "Daemon", "FlushThreads"));
+
+        memory_budget_string = ply_key_file_get_value (key_file, "Daemon", "MemoryBudget");
+
+        if (memory_budget_string != NULL) {
+                ply_pixel_buffer_set_memory_budget (strtoul (memory_budget_string, NULL, 0) * 1024 * 1024);
+                ply_trace ("Pixel memory budget is set to %zu bytes",
+                           ply_pixel_buffer_get_memory_budget ());
+                free (memory_budget_string);
+        }
+
         settings_loaded = true;
 out:
         free (splash_string);
@@ -437,6 +775,144 @@ find_distribution_default_splash (state_t *state)
                 ply_trace ("Distribution default theme file is '%s'", state->distribution_default_splash_path);
 }
 
+/* The theme show_default_splash tries first */
+static const char *
+get_default_splash_path (state_t *state)
+{
+        if (state->override_splash_path != NULL)
+                return state->override_splash_path;
+
+        if (state->system_default_splash_path != NULL)
+                return state->system_default_splash_path;
+
+        if (state->distribution_default_splash_path != NULL)
+                return state->distribution_default_splash_path;
+
+        return PLYMOUTH_THEME_PATH "default.plymouth";
+}
+
+static char *
+get_snapshot_file_for_display (ply_pixel_display_t *display)
+{
+        char *filename;
+        int scale;
+
+        scale = ply_pixel_display_get_device_scale (display);
+        asprintf (&filename, SNAPSHOT_FILE_PREFIX "%lux%lu",
+                  ply_pixel_display_get_width (display) * scale,
+                  ply_pixel_display_get_height (display) * scale);
+
+        return filename;
+}
+
+/* Puts up the first frame the default theme drew last boot, while it
+ * loads, and keeps this boot's first frames to save for next time */
+static void
+show_snapshots (state_t *state)
+{
+        const char *theme_path;
+        ply_list_t *pixel_displays;
+        ply_list_node_t *node;
+
+        if (state->mode != PLY_BOOT_SPLASH_MODE_BOOT_UP)
+                return;
+
+        theme_path = get_default_splash_path (state);
+
+        pixel_displays = ply_device_manager_get_pixel_displays (state->device_manager);
+        node = ply_list_get_first_node (pixel_displays);
+        while (node != NULL) {
+                ply_pixel_display_t *display;
+                char *filename;
+
+                display = ply_list_node_get_data (node);
+                filename = get_snapshot_file_for_display (display);
+
+                if (ply_pixel_display_show_snapshot (display, filename, theme_path)) {
+                        ply_trace ("showing snapshot %s while the splash loads", filename);
+                        state->snapshot_is_shown = true;
+                }
+
+                ply_pixel_display_keep_first_frame (display);
+                free (filename);
+
+                node = ply_list_get_next_node (pixel_displays, node);
+        }
+
+        if (state->snapshot_is_shown)
+                ply_device_manager_activate_renderers (state->device_manager);
+}
+
+static void
+save_snapshots (state_t *state)
+{
+        ply_list_t *pixel_displays;
+        ply_list_node_t *node;
+
+        if (state->mode != PLY_BOOT_SPLASH_MODE_BOOT_UP ||
+            state->splash_path == NULL || state->showing_details)
+                return;
+
+        pixel_displays = ply_device_manager_get_pixel_displays (state->device_manager);
+        node = ply_list_get_first_node (pixel_displays);
+        while (node != NULL) {
+                ply_pixel_display_t *display;
+                char *filename;
+
+                display = ply_list_node_get_data (node);
+                filename = get_snapshot_file_for_display (display);
+
+                if (ply_pixel_display_save_first_frame (display, filename, state->splash_path))
+                        ply_trace ("saved first frame to %s", filename);
+
+                free (filename);
+
+                node = ply_list_get_next_node (pixel_displays, node);
+        }
+}
+
+static void
+preload_default_splash (state_t *state)
+{
+        const char *theme_path;
+
+        theme_path = get_default_splash_path (state);
+
+        ply_trace ("Loading boot splash theme '%s' while devices are set up", theme_path);
+
+        state->preloaded_splash = ply_boot_splash_new (theme_path,
+                                                       PLYMOUTH_PLUGIN_PATH,
+                                                       state->boot_buffer);
+        state->preloaded_splash_path = strdup (theme_path);
+        ply_boot_splash_load_in_background (state->preloaded_splash);
+}
+
+static ply_boot_splash_t *
+take_preloaded_splash (state_t    *state,
+                       const char *theme_path)
+{
+        ply_boot_splash_t *splash;
+        bool matches;
+
+        if (state->preloaded_splash == NULL)
+                return NULL;
+
+        splash = state->preloaded_splash;
+        matches = strcmp (state->preloaded_splash_path, theme_path) == 0;
+
+        state->preloaded_splash = NULL;
+        free (state->preloaded_splash_path);
+        state->preloaded_splash_path = NULL;
+
+        /* The boot buffer goes away if attaching to the session fails */
+        if (matches && state->boot_buffer != NULL)
+                return splash;
+
+        ply_trace ("not using the preloaded splash");
+        ply_boot_splash_free (splash);
+        return NULL;
+}
+
 static void
 show_default_splash (state_t *state)
 {
@@ -537,6 +1013,7 @@ on_ask_for_password (state_t       *state,
         entry_trigger->prompt = prompt;
         entry_trigger->trigger = answer;
         ply_trace ("queuing password request with boot splash");
+        note_activity (state);
         ply_list_append_data (state->entry_triggers, entry_trigger);
         update_display (state);
 }
@@ -553,6 +1030,7 @@ on_ask_question (state_t       *state,
         entry_trigger->prompt = prompt;
         entry_trigger->trigger = answer;
         ply_trace ("queuing question with boot splash");
+        note_activity (state);
         ply_list_append_data (state->entry_triggers, entry_trigger);
         update_display (state);
 }
@@ -561,13 +1039,28 @@ static void
 on_display_message (state_t    *state,
                     const char *message)
 {
+        ply_list_node_t *last_node;
+        char *copied_message;
+
+        last_node = ply_list_get_last_node (state->messages);
+        if (last_node != NULL &&
+            strcmp (ply_list_node_get_data (last_node), message) == 0) {
+                ply_trace ("message %s is already the latest one", message);
+                return;
+        }
+
+        note_activity (state);
+
+        copied_message = strdup (message);
+        ply_list_append_data (state->messages, copied_message);
+
         if (state->boot_splash != NULL) {
                 ply_trace ("displaying message %s", message);
-                ply_boot_splash_display_message (state->boot_splash, message);
+                ply_list_append_data (state->pending_messages, copied_message);
+                wait_for_splash_update_frame (state);
         } else {
                 ply_trace ("not displaying message %s as no splash", message);
         }
-        ply_list_append_data (state->messages, strdup (message));
 }
 
 static void
@@ -587,11 +1080,17 @@ on_hide_message (state_t    *state,
                 next_node = ply_list_get_next_node (state->messages, node);
 
                 if (strcmp (list_message, message) == 0) {
+                        ply_list_node_t *pending_node;
+
+                        /* no need to hide what never got shown */
+                        pending_node = ply_list_find_node (state->pending_messages, list_message);
+                        if (pending_node != NULL)
+                                ply_list_remove_node (state->pending_messages, pending_node);
+                        else if (state->boot_splash != NULL)
+                                ply_boot_splash_hide_message (state->boot_splash, message);
+
                         free (list_message);
                         ply_list_remove_node (state->messages, node);
-                        if (state->boot_splash != NULL) {
-                            ply_boot_splash_hide_message (state->boot_splash, message);
-                        }
                 }
                 node = next_node;
         }
@@ -933,6 +1432,8 @@ on_show_splash (state_t *state)
                 return;
         }
 
+        note_activity (state);
+
         state->is_shown = true;
         has_displays = ply_device_manager_has_displays (state->device_manager);
 
@@ -979,6 +1480,7 @@ show_splash (state_t *state)
         }
 
         if (plymouth_should_show_default_splash (state)) {
+                show_snapshots (state);
                 show_default_splash (state);
                 state->showing_details = false;
         } else {
@@ -987,10 +1489,71 @@ show_splash (state_t *state)
         }
 }
 
+static void
+record_keyboard_input (state_t    *state,
+                       const char *keyboard_input,
+                       size_t      character_size)
+{
+        ply_list_node_t *node;
+        ply_entry_trigger_t *entry_trigger;
+        char *masked_input;
+        ssize_t key_size;
+        size_t i;
+
+        if (state->boot_server == NULL ||
+            !ply_boot_server_is_recording (state->boot_server))
+                return;
+
+        node = ply_list_get_first_node (state->entry_triggers);
+        entry_trigger = node != NULL ? ply_list_node_get_data (node) : NULL;
+
+        if (entry_trigger == NULL ||
+            entry_trigger->type != PLY_ENTRY_TRIGGER_TYPE_PASSWORD ||
+            (unsigned char) keyboard_input[0] < ' ' || keyboard_input[0] == '\x7f') {
+                ply_boot_server_record_event (state->boot_server,
+                                              PLY_BOOT_SERVER_EVENT_KEYBOARD,
+                                              "input", keyboard_input,
+                                              character_size);
+                return;
+        }
+
+        /* passwords don't get written down, just how long they are */
+        masked_input = calloc (character_size + 1, sizeof(char));
+        i = 0;
+        while (character_size > 0) {
+                key_size = ply_utf8_character_get_size (keyboard_input, character_size);
+                if (key_size <= 0)
+                        break;
+
+                masked_input[i++] = '*';
+                keyboard_input += key_size;
+                character_size -= key_size;
+        }
+
+        ply_boot_server_record_event (state->boot_server,
+                                      PLY_BOOT_SERVER_EVENT_KEYBOARD,
+                                      "input", masked_input, i);
+        free (masked_input);
+}
+
+static void
+record_device_event (state_t    *state,
+                     const char *name)
+{
+        if (state->boot_server == NULL)
+                return;
+
+        ply_boot_server_record_event (state->boot_server,
+                                      PLY_BOOT_SERVER_EVENT_DEVICE,
+                                      name, NULL, 0);
+}
+
 static void
 on_keyboard_added (state_t        *state,
                    ply_keyboard_t *keyboard)
 {
+        record_device_event (state, "keyboard-added");
+
         ply_trace ("listening for keystrokes");
         ply_keyboard_add_input_handler (keyboard,
                                         (ply_keyboard_input_handler_t)
@@ -1018,6 +1581,8 @@ static void
 on_keyboard_removed (state_t        *state,
                      ply_keyboard_t *keyboard)
 {
+    record_device_event (state, "keyboard-removed");
+
     ply_trace ("no longer listening for keystrokes");
     ply_keyboard_remove_input_handler (keyboard,
                                        (ply_keyboard_input_handler_t)
@@ -1043,6 +1608,11 @@ static void
 on_pixel_display_added (state_t             *state,
                         ply_pixel_display_t *display)
 {
+        record_device_event (state, "pixel-display-added");
+
+        if (state->should_show_debug_hud)
+                ply_pixel_display_show_hud (display);
+
         if (state->is_shown) {
                 if (state->boot_splash == NULL) {
                         ply_trace ("pixel display added before splash loaded, so loading splash now");
@@ -1060,6 +1630,8 @@ static void
 on_pixel_display_removed (state_t             *state,
                           ply_pixel_display_t *display)
 {
+        record_device_event (state, "pixel-display-removed");
+
         if (state->boot_splash == NULL)
                 return;
 
@@ -1070,6 +1642,8 @@ static void
 on_text_display_added (state_t            *state,
                        ply_text_display_t *display)
 {
+        record_device_event (state, "text-display-added");
+
         if (state->is_shown) {
                 if (state->boot_splash == NULL) {
                         ply_trace ("text display added before splash loaded, so loading splash now");
@@ -1087,6 +1661,8 @@ static void
 on_text_display_removed (state_t            *state,
                          ply_text_display_t *display)
 {
+        record_device_event (state, "text-display-removed");
+
         if (state->boot_splash == NULL)
                 return;
 
@@ -1129,6 +1705,11 @@ quit_splash (state_t *state)
                 ply_trace ("freeing splash");
                 ply_boot_splash_free (state->boot_splash);
                 state->boot_splash = NULL;
+
+                /* plymouthd can stay around for a while after this, so
+                 * give back what the splash was using */
+                ply_pixel_buffer_flush_cache ();
+                ply_trim_memory ();
         }
 
         ply_device_manager_deactivate_keyboards (state->device_manager);
@@ -1193,6 +1774,8 @@ quit_program (state_t *state)
         ply_trace ("cleaning up devices");
         ply_device_manager_free (state->device_manager);
 
+        ply_event_loop_dump_profile (state->loop);
+
         ply_trace ("exiting event loop");
         ply_event_loop_exit (state->loop, 0);
 
@@ -1240,6 +1823,9 @@ deactivate_splash (state_t *state)
 
         deactivate_console (state);
 
+        if (state->boot_splash != NULL)
+                ply_boot_splash_trim_memory (state->boot_splash);
+
         state->is_inactive = true;
 
         ply_trigger_pull (state->deactivate_trigger, NULL);
@@ -1255,13 +1841,32 @@ on_boot_splash_idle (state_t *state)
          * quit command, the quit command takes precedence.
          */
         if (state->quit_trigger != NULL) {
+                bool should_hand_over = false;
+
                 if (!state->should_retain_splash) {
                         ply_trace ("hiding splash");
                         hide_splash (state);
+                } else if (!state->is_inactive) {
+                        should_hand_over = ply_boot_splash_uses_pixel_displays (state->boot_splash);
                 }
 
                 ply_trace ("quitting splash");
                 quit_splash (state);
+
+                /* Keep the last frame up until the display server replaces
+                 * it, rather than going black when the device closes
+                 */
+                if (should_hand_over) {
+                        ply_trace ("handing the last frame over");
+                        ply_device_manager_hand_over_renderers (state->device_manager);
+
+                        if (state->mode == PLY_BOOT_SPLASH_MODE_SHUTDOWN ||
+                            state->mode == PLY_BOOT_SPLASH_MODE_REBOOT)
+                                start_plymouthd_fd_escrow (state, NULL);
+                        else
+                                start_plymouthd_fd_escrow (state, HAND_OVER_TIMEOUT);
+                }
+
                 ply_trace ("quitting program");
                 quit_program (state);
         } else if (state->deactivate_trigger != NULL) {
@@ -1341,6 +1946,18 @@ on_reactivate (state_t *state)
         update_display (state);
 }
 
+static void
+write_timeline_to_boot_log (state_t *state)
+{
+        char *timeline;
+
+        timeline = ply_statistics_format_timeline ();
+        ply_terminal_session_add_to_log (state->session,
+                                         "plymouthd timeline (start and end in microseconds since boot):\n");
+        ply_terminal_session_add_to_log (state->session, timeline);
+        free (timeline);
+}
+
 static void
 on_quit (state_t       *state,
          bool           retain_splash,
@@ -1362,6 +1979,7 @@ on_quit (state_t       *state,
                 ply_create_directory (PLYMOUTH_TIME_DIRECTORY);
                 ply_progress_save_cache (state->progress,
                                          get_cache_file_for_mode (state->mode));
+                save_snapshots (state);
         } else {
                 ply_trace ("system not initialized so skipping saving boot-duration file");
         }
@@ -1372,9 +1990,13 @@ on_quit (state_t       *state,
         tell_systemd_to_stop_printing_details (state);
 #endif
 
+        ply_statistics_add_timeline_event ("quit", NULL);
+
         ply_trace ("closing log");
-        if (state->session != NULL)
+        if (state->session != NULL) {
+                write_timeline_to_boot_log (state);
                 ply_terminal_session_close_log (state->session);
+        }
 
         ply_device_manager_deactivate_keyboards (state->device_manager);
 
@@ -1431,6 +2053,7 @@ start_boot_server (state_t *state)
                                       (ply_boot_server_reactivate_handler_t) on_reactivate,
                                       (ply_boot_server_quit_handler_t) on_quit,
                                       (ply_boot_server_has_active_vt_handler_t) on_has_active_vt,
+                                      (ply_boot_server_progress_channel_handler_t) on_progress_channel,
                                       state);
 
         if (!ply_boot_server_listen (server)) {
@@ -1440,6 +2063,8 @@ start_boot_server (state_t *state)
                 return NULL;
         }
 
+        ply_statistics_add_timeline_event ("boot-server-listening", NULL);
+
         ply_boot_server_attach_to_event_loop (server, state->loop);
 
         return server;
@@ -1498,9 +2123,29 @@ static void
 on_escape_pressed (state_t *state)
 {
         ply_trace ("escape key pressed");
+        record_keyboard_input (state, "\033", 1);
+        note_activity (state);
         toggle_between_splash_and_details (state);
 }
 
+static void
+on_keystroke (state_t    *state,
+              const char *key)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (state->keystroke_triggers); node;
+             node = ply_list_get_next_node (state->keystroke_triggers, node)) {
+                ply_keystroke_watch_t *keystroke_trigger = ply_list_node_get_data (node);
+                if (!keystroke_trigger->keys || strstr (keystroke_trigger->keys, key)) { /* assume strstr works on utf8 arrays */
+                        ply_trigger_pull (keystroke_trigger->trigger, key);
+                        ply_list_remove_node (state->keystroke_triggers, node);
+                        free (keystroke_trigger);
+                        return;
+                }
+        }
+}
+
 static void
 on_keyboard_input (state_t    *state,
                    const char *keyboard_input,
@@ -1508,6 +2153,9 @@ on_keyboard_input (state_t    *state,
 {
         ply_list_node_t *node;
 
+        record_keyboard_input (state, keyboard_input, character_size);
+        note_activity (state);
+
         node = ply_list_get_first_node (state->entry_triggers);
         if (node) { /* \x3 (ETX) is Ctrl+C and \x4 (EOT) is Ctrl+D */
                 if (character_size == 1 && (keyboard_input[0] == '\x3' || keyboard_input[0] == '\x4')) {
@@ -1521,17 +2169,23 @@ on_keyboard_input (state_t    *state,
                 }
                 update_display (state);
         } else {
-                for (node = ply_list_get_first_node (state->keystroke_triggers); node;
-                     node = ply_list_get_next_node (state->keystroke_triggers, node)) {
-                        ply_keystroke_watch_t *keystroke_trigger = ply_list_node_get_data (node);
-                        if (!keystroke_trigger->keys || strstr (keystroke_trigger->keys, keyboard_input)) { /* assume strstr works on utf8 arrays */
-                                ply_trigger_pull (keystroke_trigger->trigger, keyboard_input);
-                                ply_list_remove_node (state->keystroke_triggers, node);
-                                free (keystroke_trigger);
-                                return;
-                        }
+                /* Pasted text comes in all at once, but keystroke
+                 * watches go by single keys */
+                while (character_size > 0) {
+                        ssize_t key_size;
+                        char key[PLY_UTF8_CHARACTER_SIZE_MAX + 1];
+
+                        key_size = ply_utf8_character_get_size (keyboard_input, character_size);
+                        if (key_size <= 0)
+                                break;
+
+                        memcpy (key, keyboard_input, key_size);
+                        key[key_size] = '\0';
+                        on_keystroke (state, key);
+
+                        keyboard_input += key_size;
+                        character_size -= key_size;
                 }
-                return;
         }
 }
 
@@ -1544,6 +2198,9 @@ on_backspace (state_t *state)
         size_t size;
         ply_list_node_t *node = ply_list_get_first_node (state->entry_triggers);
 
+        record_keyboard_input (state, "\177", 1);
+        note_activity (state);
+
         if (!node) return;
 
         bytes = ply_buffer_get_bytes (state->entry_buffer);
@@ -1569,6 +2226,9 @@ on_enter (state_t    *state,
 {
         ply_list_node_t *node;
 
+        record_keyboard_input (state, "\n", 1);
+        note_activity (state);
+
         node = ply_list_get_first_node (state->entry_triggers);
         if (node) {
                 ply_entry_trigger_t *entry_trigger = ply_list_node_get_data (node);
@@ -1703,9 +2363,12 @@ load_theme (state_t    *state,
         ply_trace ("Loading boot splash theme '%s'",
                    theme_path);
 
-        splash = ply_boot_splash_new (theme_path,
-                                      PLYMOUTH_PLUGIN_PATH,
-                                      state->boot_buffer);
+        splash = take_preloaded_splash (state, theme_path);
+
+        if (splash == NULL)
+                splash = ply_boot_splash_new (theme_path,
+                                              PLYMOUTH_PLUGIN_PATH,
+                                              state->boot_buffer);
 
         is_loaded = ply_boot_splash_load (splash);
 
@@ -1740,8 +2403,15 @@ show_theme (state_t    *state,
                 return NULL;
 
         attach_splash_to_devices (state, splash);
-        if (ply_boot_splash_uses_pixel_displays (splash))
+        if (ply_boot_splash_uses_pixel_displays (splash)) {
                 ply_device_manager_activate_renderers (state->device_manager);
+        } else if (state->snapshot_is_shown) {
+                /* a text theme took over from the snapshot */
+                ply_device_manager_deactivate_renderers (state->device_manager);
+                if (state->local_console_terminal != NULL)
+                        ply_terminal_set_mode (state->local_console_terminal, PLY_TERMINAL_MODE_TEXT);
+        }
+        state->snapshot_is_shown = false;
 
         if (!ply_boot_splash_show (splash, state->mode)) {
                 ply_save_errno ();
@@ -1752,6 +2422,9 @@ show_theme (state_t    *state,
 
         ply_device_manager_activate_keyboards (state->device_manager);
 
+        free (state->splash_path);
+        state->splash_path = theme_path != NULL ? strdup (theme_path) : NULL;
+
         return splash;
 }
 
@@ -1826,6 +2499,17 @@ detach_from_running_session (state_t *state)
         state->is_attached = false;
 }
 
+static void
+check_trace_points (state_t *state)
+{
+        if (!ply_kernel_command_line_has_argument ("plymouth.trace-points"))
+                return;
+
+        ply_trace ("recording trace points to " TRACE_POINTS_FILE);
+        ply_trace_points_start_recording (TRACE_POINTS_RING_SIZE);
+        trace_points_are_recording = true;
+}
+
 static void
 check_verbosity (state_t *state)
 {
@@ -1846,7 +2530,7 @@ check_verbosity (state_t *state)
                         ply_toggle_tracing ();
 
                 if (debug_buffer == NULL)
-                        debug_buffer = ply_buffer_new ();
+                        debug_buffer = debug_buffer_new ();
 
                 if (stream != NULL) {
                         ply_trace ("streaming debug output to %s instead of screen", stream);
@@ -1958,10 +2642,14 @@ find_fallback_tty (state_t *state)
 static bool
 initialize_environment (state_t *state)
 {
+        double start_time;
+
+        start_time = ply_get_timestamp ();
         ply_trace ("initializing minimal work environment");
 
         if (!state->default_tty)
-                if (getenv ("DISPLAY") != NULL && access (PLYMOUTH_PLUGIN_PATH "renderers/x11.so", F_OK) == 0)
+                if ((getenv ("DISPLAY") != NULL && access (PLYMOUTH_PLUGIN_PATH "renderers/x11.so", F_OK) == 0) ||
+                    getenv ("PLY_OFFSCREEN_HEADS") != NULL)
                         state->default_tty = "/dev/tty";
         if (!state->default_tty) {
                 if (state->mode == PLY_BOOT_SPLASH_MODE_SHUTDOWN ||
@@ -1981,6 +2669,7 @@ initialize_environment (state_t *state)
         }
 
         check_verbosity (state);
+        check_trace_points (state);
         check_logging (state);
 
         ply_trace ("source built on %s", __DATE__);
@@ -1989,6 +2678,8 @@ initialize_environment (state_t *state)
         state->entry_triggers = ply_list_new ();
         state->entry_buffer = ply_buffer_new ();
         state->messages = ply_list_new ();
+        state->pending_messages = ply_list_new ();
+        state->progress_channels = ply_list_new ();
 
         if (!ply_is_tracing_to_terminal ())
                 redirect_standard_io_to_dev_null ();
@@ -1998,23 +2689,67 @@ initialize_environment (state_t *state)
                 ply_trace ("could not create " PLYMOUTH_RUNTIME_DIR ": %m");
 
         ply_trace ("initialized minimal work environment");
+        ply_statistics_add_timeline_span ("initialize-environment", NULL,
+                                          start_time, ply_get_timestamp ());
         return true;
 }
 
+static debug_buffer_t *
+debug_buffer_new (void)
+{
+        debug_buffer_t *debug_buffer;
+        void *bytes;
+
+        /* pages only get used as the log reaches them */
+        bytes = mmap (NULL, DEBUG_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (bytes == MAP_FAILED)
+                return NULL;
+
+        debug_buffer = calloc (1, sizeof(debug_buffer_t));
+        debug_buffer->bytes = bytes;
+
+        return debug_buffer;
+}
+
 static void
-on_error_message (ply_buffer_t *debug_buffer,
-                  const void   *bytes,
-                  size_t        number_of_bytes)
+debug_buffer_free (debug_buffer_t *debug_buffer)
 {
-        ply_buffer_append_bytes (debug_buffer, bytes, number_of_bytes);
+        munmap (debug_buffer->bytes, DEBUG_BUFFER_SIZE);
+        free (debug_buffer);
 }
 
+static void
+on_error_message (debug_buffer_t *debug_buffer,
+                  const void     *bytes,
+                  size_t          number_of_bytes)
+{
+        size_t offset, bytes_to_end;
+
+        if (number_of_bytes > DEBUG_BUFFER_SIZE) {
+                bytes = (const char *) bytes + number_of_bytes - DEBUG_BUFFER_SIZE;
+                debug_buffer->number_of_bytes_written += number_of_bytes - DEBUG_BUFFER_SIZE;
+                number_of_bytes = DEBUG_BUFFER_SIZE;
+        }
+
+        offset = debug_buffer->number_of_bytes_written % DEBUG_BUFFER_SIZE;
+        bytes_to_end = MIN (number_of_bytes, DEBUG_BUFFER_SIZE - offset);
+
+        memcpy (debug_buffer->bytes + offset, bytes, bytes_to_end);
+        memcpy (debug_buffer->bytes, (const char *) bytes + bytes_to_end,
+                number_of_bytes - bytes_to_end);
+
+        debug_buffer->number_of_bytes_written += number_of_bytes;
+}
+
+/* Gets called from the crash handler, so it sticks to async-signal-safe
+ * calls */
 static void
 dump_debug_buffer_to_file (void)
 {
         int fd;
-        const char *bytes;
-        size_t size;
+        size_t offset;
 
         fd = open (debug_buffer_path,
                    O_WRONLY | O_CREAT | O_TRUNC, 0600);
@@ -2022,9 +2757,30 @@ dump_debug_buffer_to_file (void)
         if (fd < 0)
                 return;
 
-        size = ply_buffer_get_size (debug_buffer);
-        bytes = ply_buffer_get_bytes (debug_buffer);
-        ply_write (fd, bytes, size);
+        offset = debug_buffer->number_of_bytes_written % DEBUG_BUFFER_SIZE;
+
+        /* oldest first, once the log has wrapped around */
+        if (debug_buffer->number_of_bytes_written > DEBUG_BUFFER_SIZE)
+                ply_write (fd, debug_buffer->bytes + offset, DEBUG_BUFFER_SIZE - offset);
+        else
+                offset = debug_buffer->number_of_bytes_written;
+
+        ply_write (fd, debug_buffer->bytes, offset);
+        close (fd);
+}
+
+static void
+dump_trace_points_to_file (void)
+{
+        int fd;
+
+        fd = open (TRACE_POINTS_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+        if (fd < 0)
+                return;
+
+        if (!ply_trace_points_write_to_fd (fd))
+                ply_trace ("could not write trace points to " TRACE_POINTS_FILE ": %m");
         close (fd);
 }
 
@@ -2054,6 +2810,11 @@ on_crash (int signum)
 
         close (fd);
 
+        ply_logger_flush (ply_logger_get_error_default ());
+
+        if (trace_points_are_recording)
+                dump_trace_points_to_file ();
+
         if (debug_buffer != NULL) {
                 dump_debug_buffer_to_file ();
                 sleep (30);
@@ -2070,13 +2831,25 @@ on_crash (int signum)
 }
 
 static void
-start_plymouthd_fd_escrow (void)
+start_plymouthd_fd_escrow (state_t    *state,
+                           const char *timeout)
 {
         pid_t pid;
 
+        if (state->fd_escrow_is_running)
+                return;
+
+        state->fd_escrow_is_running = true;
+
         pid = fork ();
         if (pid == 0) {
-                const char *argv[] = { PLYMOUTH_DRM_ESCROW_DIRECTORY "/plymouthd-fd-escrow", NULL };
+                const char *argv[] = { PLYMOUTH_DRM_ESCROW_DIRECTORY "/plymouthd-fd-escrow", timeout, NULL };
+                sigset_t signal_set;
+
+                /* the event loop reads signals from a signalfd, so they're
+                 * blocked here, and the mask would survive the exec */
+                sigfillset (&signal_set);
+                sigprocmask (SIG_UNBLOCK, &signal_set, NULL);
 
                 execve (argv[0], (char * const *) argv, NULL);
                 ply_trace ("could not launch fd escrow process: %m");
@@ -2084,6 +2857,12 @@ start_plymouthd_fd_escrow (void)
         }
 }
 
+static void
+on_profile_signal (state_t *state)
+{
+        ply_event_loop_dump_profile (state->loop);
+}
+
 static void
 on_term_signal (state_t *state)
 {
@@ -2099,7 +2878,7 @@ on_term_signal (state_t *state)
              state->mode == PLY_BOOT_SPLASH_MODE_REBOOT) &&
             !state->is_inactive && state->boot_splash &&
             ply_boot_splash_uses_pixel_displays (state->boot_splash)) {
-                start_plymouthd_fd_escrow ();
+                start_plymouthd_fd_escrow (state, NULL);
                 retain_splash = true;
         }
 
@@ -2136,12 +2915,15 @@ main (int    argc,
         char *mode_string = NULL;
         char *kernel_command_line = NULL;
         char *tty = NULL;
+        char *record_file = NULL;
         ply_device_manager_flags_t device_manager_flags = PLY_DEVICE_MANAGER_FLAGS_NONE;
 
         state.start_time = ply_get_timestamp ();
+        ply_statistics_add_timeline_event ("plymouthd-start", NULL);
         state.command_parser = ply_command_parser_new ("plymouthd", "Splash server");
 
         state.loop = ply_event_loop_get_default ();
+        ply_logger_attach_to_event_loop (ply_logger_get_error_default (), state.loop);
 
         /* Initialize the translations if they are available (!initrd) */
         if (ply_directory_exists (PLYMOUTH_LOCALE_DIRECTORY))
@@ -2159,6 +2941,7 @@ main (int    argc,
                                         "tty", "TTY to use instead of default", PLY_COMMAND_OPTION_TYPE_STRING,
                                         "no-boot-log", "Do not write boot log file", PLY_COMMAND_OPTION_TYPE_FLAG,
                                         "ignore-serial-consoles", "Ignore serial consoles", PLY_COMMAND_OPTION_TYPE_FLAG,
+                                        "record-file", "File to record requests and input to, for plymouth-replay", PLY_COMMAND_OPTION_TYPE_STRING,
                                         NULL);
 
         if (!ply_command_parser_parse_arguments (state.command_parser, state.loop, argv, argc)) {
@@ -2184,6 +2967,7 @@ main (int    argc,
                                         "pid-file", &pid_file,
                                         "tty", &tty,
                                         "kernel-command-line", &kernel_command_line,
+                                        "record-file", &record_file,
                                         NULL);
 
         if (should_help) {
@@ -2246,7 +3030,7 @@ main (int    argc,
         }
 
         if (debug)
-                debug_buffer = ply_buffer_new ();
+                debug_buffer = debug_buffer_new ();
 
         signal (SIGABRT, on_crash);
         signal (SIGSEGV, on_crash);
@@ -2281,6 +3065,17 @@ main (int    argc,
         ply_event_loop_watch_signal (state.loop, SIGTERM,
                                      (ply_event_handler_t) on_term_signal, &state);
 
+        /* Log which handlers keep the event loop busy on SIGUSR1 and quit */
+        if (ply_kernel_command_line_has_argument ("plymouth.profile-event-loop")) {
+                ply_event_loop_set_profiling_enabled (state.loop, true);
+                ply_event_loop_watch_signal (state.loop, SIGUSR1,
+                                             (ply_event_handler_t) on_profile_signal, &state);
+        }
+
+        /* Draw frame timings over the splash on each pixel display */
+        if (ply_kernel_command_line_has_argument ("plymouth.debug-hud"))
+                state.should_show_debug_hud = true;
+
         state.boot_server = start_boot_server (&state);
 
         if (state.boot_server == NULL) {
@@ -2291,6 +3086,14 @@ main (int    argc,
                 return EX_OK;
         }
 
+        if (record_file == NULL)
+                record_file = ply_kernel_command_line_get_key_value ("plymouth.record=");
+
+        if (record_file != NULL) {
+                ply_boot_server_start_recording (state.boot_server, record_file);
+                free (record_file);
+        }
+
         state.boot_buffer = ply_buffer_new ();
 
         if (attach_to_session) {
@@ -2306,6 +3109,7 @@ main (int    argc,
         state.progress = ply_progress_new ();
         state.splash_delay = NAN;
         state.device_timeout = NAN;
+        state.idle_frames_per_second = NAN;
 
         ply_progress_load_cache (state.progress,
                                  get_cache_file_for_mode (state.mode));
@@ -2323,6 +3127,9 @@ main (int    argc,
         find_system_default_splash (&state);
         find_distribution_default_splash (&state);
 
+        if (isnan (state.idle_frames_per_second))
+                state.idle_frames_per_second = DEFAULT_IDLE_FRAMES_PER_SECOND;
+
         if (ply_kernel_command_line_has_argument ("plymouth.ignore-serial-consoles") ||
             ignore_serial_consoles == true)
                 device_manager_flags |= PLY_DEVICE_MANAGER_FLAGS_IGNORE_SERIAL_CONSOLES;
@@ -2331,6 +3138,9 @@ main (int    argc,
             (getenv ("DISPLAY") != NULL))
                 device_manager_flags |= PLY_DEVICE_MANAGER_FLAGS_IGNORE_UDEV;
 
+        if (getenv ("PLY_OFFSCREEN_HEADS") != NULL)
+                device_manager_flags |= PLY_DEVICE_MANAGER_FLAGS_USE_OFFSCREEN_RENDERER;
+
         if (!plymouth_should_show_default_splash (&state)) {
                 /* don't bother listening for udev events or setting up a graphical renderer
                  * if we're forcing details */
@@ -2339,6 +3149,10 @@ main (int    argc,
 
                 /* don't ever delay showing the detailed splash */
                 state.splash_delay = NAN;
+        } else {
+                /* The theme's plugin and files load while udev and the
+                 * renderers are probed, and the first display waits for them */
+                preload_default_splash (&state);
         }
 
         find_force_scale (&state);
@@ -2352,6 +3166,11 @@ main (int    argc,
         ply_boot_splash_free (state.boot_splash);
         state.boot_splash = NULL;
 
+        ply_boot_splash_free (state.preloaded_splash);
+        state.preloaded_splash = NULL;
+        free (state.preloaded_splash_path);
+        free (state.splash_path);
+
         ply_command_parser_free (state.command_parser);
 
         ply_boot_server_free (state.boot_server);
@@ -2367,9 +3186,12 @@ main (int    argc,
 
         if (debug_buffer != NULL) {
                 dump_debug_buffer_to_file ();
-                ply_buffer_free (debug_buffer);
+                debug_buffer_free (debug_buffer);
         }
 
+        if (trace_points_are_recording)
+                dump_trace_points_to_file ();
+
         ply_free_error_log ();
 
         free (state.override_splash_path);
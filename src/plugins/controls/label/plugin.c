@@ -65,6 +65,12 @@ struct _ply_label_plugin_control
         float                blue;
         float                alpha;
 
+        /* Laying text out and rasterizing it is slow, so both are kept
+         * until something that changes how the text looks does */
+        PangoLayout         *pango_layout;
+        ply_pixel_buffer_t  *rendered_buffer;
+        ply_rectangle_t      rendered_area;
+
         uint32_t             is_hidden : 1;
         uint32_t             needs_size_update : 1;
 };
@@ -91,66 +97,14 @@ destroy_control (ply_label_plugin_control_t *label)
         if (label == NULL)
                 return;
 
+        if (label->pango_layout != NULL)
+                g_object_unref (label->pango_layout);
+        ply_pixel_buffer_free (label->rendered_buffer);
+        free (label->text);
+        free (label->fontdesc);
         free (label);
 }
 
-static cairo_t *
-get_cairo_context_for_pixel_buffer (ply_label_plugin_control_t *label,
-                                    ply_pixel_buffer_t         *pixel_buffer,
-                                    long                       *center_x,
-                                    long                       *center_y)
-{
-        cairo_surface_t *cairo_surface;
-        cairo_t *cairo_context;
-        unsigned char *data;
-        unsigned long width, height;
-        uint32_t scale;
-        ply_pixel_buffer_rotation_t rotation;
-
-        data = (unsigned char *) ply_pixel_buffer_get_argb32_data (pixel_buffer);
-        width = ply_pixel_buffer_get_width (pixel_buffer);
-        height = ply_pixel_buffer_get_height (pixel_buffer);
-        scale = ply_pixel_buffer_get_device_scale (pixel_buffer);
-        rotation = ply_pixel_buffer_get_device_rotation (pixel_buffer);
-
-        *center_x = width / 2;
-        *center_y = height / 2;
-
-        if (rotation == PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE ||
-            rotation == PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE) {
-                unsigned long tmp = width;
-                width = height;
-                height = tmp;
-        }
-
-        cairo_surface = cairo_image_surface_create_for_data (data,
-                                                             CAIRO_FORMAT_ARGB32,
-                                                             width * scale,
-                                                             height * scale,
-                                                             width * scale * 4);
-        cairo_surface_set_device_scale (cairo_surface, scale, scale);
-        cairo_context = cairo_create (cairo_surface);
-        cairo_surface_destroy (cairo_surface);
-
-        /* Rotate around the center */
-        cairo_translate (cairo_context, width / 2, height / 2);
-        switch (rotation) {
-        case PLY_PIXEL_BUFFER_ROTATE_UPRIGHT:
-                break;
-        case PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN:
-                cairo_rotate (cairo_context, M_PI);
-                break;
-        case PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE:
-                cairo_rotate (cairo_context, 0.5 * M_PI);
-                break;
-        case PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE:
-                cairo_rotate (cairo_context, -0.5 * M_PI);
-                break;
-        }
-
-        return cairo_context;
-}
-
 static cairo_t *
 get_cairo_context_for_sizing (ply_label_plugin_control_t *label)
 {
@@ -195,9 +149,40 @@ init_pango_text_layout (cairo_t       *cairo_context,
 }
 
 static void
-size_control (ply_label_plugin_control_t *label, bool force)
+invalidate_rendered_text (ply_label_plugin_control_t *label)
+{
+        ply_pixel_buffer_free (label->rendered_buffer);
+        label->rendered_buffer = NULL;
+}
+
+static void
+invalidate_layout (ply_label_plugin_control_t *label)
+{
+        if (label->pango_layout != NULL)
+                g_object_unref (label->pango_layout);
+        label->pango_layout = NULL;
+
+        invalidate_rendered_text (label);
+}
+
+static PangoLayout *
+get_pango_layout (ply_label_plugin_control_t *label)
 {
         cairo_t *cairo_context;
+
+        if (label->pango_layout != NULL)
+                return label->pango_layout;
+
+        cairo_context = get_cairo_context_for_sizing (label);
+        label->pango_layout = init_pango_text_layout (cairo_context, label->text, label->fontdesc, label->alignment, label->width);
+        cairo_destroy (cairo_context);
+
+        return label->pango_layout;
+}
+
+static void
+size_control (ply_label_plugin_control_t *label, bool force)
+{
         PangoLayout *pango_layout;
         int text_width;
         int text_height;
@@ -210,19 +195,77 @@ size_control (ply_label_plugin_control_t *label, bool force)
                 return;
         }
 
-        cairo_context = get_cairo_context_for_sizing (label);
-
-        pango_layout = init_pango_text_layout (cairo_context, label->text, label->fontdesc, label->alignment, label->width);
+        pango_layout = get_pango_layout (label);
 
         pango_layout_get_size (pango_layout, &text_width, &text_height);
         label->area.width = (long) ((double) text_width / PANGO_SCALE);
         label->area.height = (long) ((double) text_height / PANGO_SCALE);
 
-        g_object_unref (pango_layout);
-        cairo_destroy (cairo_context);
         label->needs_size_update = false;
 }
 
+/* Renders the text, premultiplied, into a buffer of its own at the
+ * display's scale.  The buffer covers the inked area as well as the
+ * logical one, since some glyphs reach outside of it.
+ */
+static ply_pixel_buffer_t *
+get_rendered_buffer (ply_label_plugin_control_t *label,
+                     uint32_t                    scale)
+{
+        PangoLayout *pango_layout;
+        PangoRectangle ink_rectangle, logical_rectangle;
+        cairo_surface_t *cairo_surface;
+        cairo_t *cairo_context;
+        long x1, y1, x2, y2;
+
+        if (label->rendered_buffer != NULL &&
+            ply_pixel_buffer_get_device_scale (label->rendered_buffer) == scale)
+                return label->rendered_buffer;
+
+        invalidate_rendered_text (label);
+
+        pango_layout = get_pango_layout (label);
+        pango_layout_get_pixel_extents (pango_layout, &ink_rectangle, &logical_rectangle);
+
+        x1 = MIN (ink_rectangle.x, logical_rectangle.x);
+        y1 = MIN (ink_rectangle.y, logical_rectangle.y);
+        x2 = MAX (ink_rectangle.x + ink_rectangle.width, logical_rectangle.x + logical_rectangle.width);
+        y2 = MAX (ink_rectangle.y + ink_rectangle.height, logical_rectangle.y + logical_rectangle.height);
+
+        label->rendered_area.x = x1;
+        label->rendered_area.y = y1;
+        label->rendered_area.width = x2 - x1;
+        label->rendered_area.height = y2 - y1;
+
+        if (label->rendered_area.width == 0 || label->rendered_area.height == 0)
+                return NULL;
+
+        label->rendered_buffer = ply_pixel_buffer_new (label->rendered_area.width * scale,
+                                                       label->rendered_area.height * scale);
+        ply_pixel_buffer_set_device_scale (label->rendered_buffer, scale);
+
+        cairo_surface = cairo_image_surface_create_for_data ((unsigned char *) ply_pixel_buffer_get_argb32_data (label->rendered_buffer),
+                                                             CAIRO_FORMAT_ARGB32,
+                                                             label->rendered_area.width * scale,
+                                                             label->rendered_area.height * scale,
+                                                             label->rendered_area.width * scale * 4);
+        cairo_surface_set_device_scale (cairo_surface, scale, scale);
+        cairo_context = cairo_create (cairo_surface);
+        cairo_surface_destroy (cairo_surface);
+
+        cairo_move_to (cairo_context, -x1, -y1);
+        cairo_set_source_rgba (cairo_context,
+                               label->red,
+                               label->green,
+                               label->blue,
+                               label->alpha);
+        pango_cairo_update_layout (cairo_context, pango_layout);
+        pango_cairo_show_layout (cairo_context, pango_layout);
+        cairo_destroy (cairo_context);
+
+        return label->rendered_buffer;
+}
+
 static void
 draw_control (ply_label_plugin_control_t *label,
               ply_pixel_buffer_t         *pixel_buffer,
@@ -231,39 +274,29 @@ draw_control (ply_label_plugin_control_t *label,
               unsigned long               width,
               unsigned long               height)
 {
-        cairo_t *cairo_context;
-        PangoLayout *pango_layout;
-        long center_x;
-        long center_y;
-        int text_width;
-        int text_height;
+        ply_pixel_buffer_t *rendered_buffer;
+        ply_rectangle_t clip_area;
 
         if (label->is_hidden)
                 return;
 
-        cairo_context = get_cairo_context_for_pixel_buffer (label, pixel_buffer, &center_x, &center_y);
-
-        pango_layout = init_pango_text_layout (cairo_context, label->text, label->fontdesc, label->alignment, label->width);
+        size_control (label, false);
 
-        pango_layout_get_size (pango_layout, &text_width, &text_height);
-        label->area.width = (long) ((double) text_width / PANGO_SCALE);
-        label->area.height = (long) ((double) text_height / PANGO_SCALE);
-
-        cairo_rectangle (cairo_context, x - center_x, y - center_y, width, height);
-        cairo_clip (cairo_context);
-        cairo_move_to (cairo_context,
-                       label->area.x - center_x,
-                       label->area.y - center_y);
-        cairo_set_source_rgba (cairo_context,
-                               label->red,
-                               label->green,
-                               label->blue,
-                               label->alpha);
-        pango_cairo_show_layout (cairo_context,
-                                 pango_layout);
+        rendered_buffer = get_rendered_buffer (label, ply_pixel_buffer_get_device_scale (pixel_buffer));
+        if (rendered_buffer == NULL)
+                return;
 
-        g_object_unref (pango_layout);
-        cairo_destroy (cairo_context);
+        clip_area.x = x;
+        clip_area.y = y;
+        clip_area.width = width;
+        clip_area.height = height;
+
+        ply_pixel_buffer_push_clip_area (pixel_buffer, &clip_area);
+        ply_pixel_buffer_fill_with_buffer (pixel_buffer,
+                                           rendered_buffer,
+                                           label->area.x + label->rendered_area.x,
+                                           label->area.y + label->rendered_area.y);
+        ply_pixel_buffer_pop_clip_area (pixel_buffer);
 }
 
 static void
@@ -289,6 +322,7 @@ set_alignment_for_control (ply_label_plugin_control_t *label,
         if (label->alignment != pango_alignment) {
                 dirty_area = label->area;
                 label->alignment = pango_alignment;
+                invalidate_layout (label);
                 size_control (label, false);
                 if (!label->is_hidden && label->display != NULL)
                         ply_pixel_display_draw_area (label->display,
@@ -306,6 +340,7 @@ set_width_for_control (ply_label_plugin_control_t *label,
         if (label->width != width) {
                 dirty_area = label->area;
                 label->width = width;
+                invalidate_layout (label);
                 size_control (label, false);
                 if (!label->is_hidden && label->display != NULL)
                         ply_pixel_display_draw_area (label->display,
@@ -320,10 +355,11 @@ set_text_for_control (ply_label_plugin_control_t *label,
 {
         ply_rectangle_t dirty_area;
 
-        if (label->text != text) {
+        if (label->text == NULL || strcmp (label->text, text) != 0) {
                 dirty_area = label->area;
                 free (label->text);
                 label->text = strdup (text);
+                invalidate_layout (label);
                 size_control (label, false);
                 if (!label->is_hidden && label->display != NULL)
                         ply_pixel_display_draw_area (label->display,
@@ -338,13 +374,14 @@ set_font_for_control (ply_label_plugin_control_t *label,
 {
         ply_rectangle_t dirty_area;
 
-        if (label->fontdesc != fontdesc) {
+        if (g_strcmp0 (label->fontdesc, fontdesc) != 0) {
                 dirty_area = label->area;
                 free (label->fontdesc);
                 if (fontdesc)
                         label->fontdesc = strdup (fontdesc);
                 else
                         label->fontdesc = NULL;
+                invalidate_layout (label);
                 size_control (label, false);
                 if (!label->is_hidden && label->display != NULL)
                         ply_pixel_display_draw_area (label->display,
@@ -360,6 +397,10 @@ set_color_for_control (ply_label_plugin_control_t *label,
                        float                       blue,
                        float                       alpha)
 {
+        if (label->red != red || label->green != green ||
+            label->blue != blue || label->alpha != alpha)
+                invalidate_rendered_text (label);
+
         label->red = red;
         label->green = green;
         label->blue = blue;
@@ -431,6 +472,25 @@ get_height_of_control (ply_label_plugin_control_t *label)
         return label->area.height;
 }
 
+/* Fontconfig scans its caches the first time any font is looked up,
+ * and that is shared by every thread.  Font maps are per thread, so this
+ * one only exists to get the scanning done.
+ */
+static void
+preload (void)
+{
+        cairo_t *cairo_context;
+        PangoLayout *pango_layout;
+        int text_width, text_height;
+
+        cairo_context = get_cairo_context_for_sizing (NULL);
+        pango_layout = init_pango_text_layout (cairo_context, "x", NULL, PANGO_ALIGN_LEFT, -1);
+        pango_layout_get_size (pango_layout, &text_width, &text_height);
+
+        g_object_unref (pango_layout);
+        cairo_destroy (cairo_context);
+}
+
 ply_label_plugin_interface_t *
 ply_label_plugin_get_interface (void)
 {
@@ -448,7 +508,8 @@ ply_label_plugin_get_interface (void)
                 .set_font_for_control      = set_font_for_control,
                 .set_color_for_control     = set_color_for_control,
                 .get_width_of_control      = get_width_of_control,
-                .get_height_of_control     = get_height_of_control
+                .get_height_of_control     = get_height_of_control,
+                .preload                   = preload
         };
 
         return &plugin_interface;
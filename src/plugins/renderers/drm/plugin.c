@@ -43,7 +43,13 @@
 #include <values.h>
 #include <unistd.h>
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define PLY_DRM_HAVE_STREAMING_COPY
+#endif
+
 #include <drm.h>
+#include <drm_fourcc.h>
 #include <drm_mode.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -54,8 +60,12 @@
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-hashtable.h"
+#include "ply-probes.h"
 #include "ply-rectangle.h"
-#include "ply-region.h"
+#include "ply-statistics.h"
+#include "ply-task-queue.h"
+#include "ply-tiled-region.h"
+#include "ply-trace-points.h"
 #include "ply-utils.h"
 #include "ply-terminal.h"
 
@@ -64,6 +74,19 @@
 
 #define BYTES_PER_PIXEL (4)
 
+#define WRITE_COMBINE_CHUNK_SIZE 64
+
+/* Used when the driver doesn't say how big its cursors are */
+#define DEFAULT_CURSOR_SIZE 64
+
+/* Enough for the frames of a typical throbber */
+#define MAX_PLANE_IMAGES 64
+
+PLY_DEFINE_TRACE_POINT (drm_flush_head_trace_point,
+                        "drm: flushing %d updated areas on controller %d");
+PLY_DEFINE_TRACE_POINT (drm_page_flip_trace_point,
+                        "drm: page flip landed on controller %d at frame %d");
+
 /* For builds with libdrm < 2.4.89 */
 #ifndef DRM_MODE_ROTATE_0
 #define DRM_MODE_ROTATE_0 (1<<0)
@@ -81,13 +104,54 @@ struct _ply_renderer_head
         drmModeModeInfo         connector0_mode;
 
         uint32_t                controller_id;
+        int                     pipe;
         uint32_t                console_buffer_id;
         uint32_t                scan_out_buffer_id;
         bool                    scan_out_buffer_needs_reset;
+
+        /* When page flipping, scan_out_buffer_id is the buffer being shown
+         * and drawing goes to the back buffer, which only needs the areas
+         * that changed since it was last shown copied over.
+         */
+        uint32_t                back_buffer_id;
+        ply_tiled_region_t     *back_buffer_damage;
+        bool                    page_flip_pending;
+
+        /* Set while the pixel buffer draws straight into the back buffer,
+         * instead of into a shadow that gets copied out on every flush.
+         * Only the back buffer of a page flipped head is drawn to, and only
+         * while no flip is in flight: once it's queued to be shown,
+         * drawing goes to shadow_bytes until the flip lands, so nothing
+         * gets drawn into a buffer that is on screen.
+         */
+        bool                    draws_to_device;
+        uint32_t               *shadow_bytes;
+
+        /* Heads with the same size, scale and rotation show one shared
+         * pixel buffer.  Only the clone source is handed out to be drawn
+         * to, and flushing it updates the clones too.  pending_damage is
+         * what this head hasn't copied out of the shared buffer yet.
+         */
+        ply_renderer_head_t    *clone_source;
+        ply_tiled_region_t     *pending_damage;
+
+        ply_renderer_plane_t   *plane;
+
+        /* for tracing flush throughput */
+        unsigned long long      bytes_flushed;
+        double                  flush_statistics_start_time;
+
+        /* Set while activating, when the mode set is left for the atomic
+         * commit that covers every head */
+        bool                    mode_set_is_queued;
         bool                    uses_hw_rotation;
 
         int                     gamma_size;
         uint16_t                *gamma;
+
+        /* backend->heads_epoch when the head was set up or last got a
+         * different pixel buffer */
+        uint32_t                epoch;
 };
 
 struct _ply_renderer_input_source
@@ -117,6 +181,40 @@ typedef struct
         uint32_t added_fb : 1;
 } ply_renderer_buffer_t;
 
+typedef struct
+{
+        ply_renderer_backend_t *backend;
+        uint32_t                controller_id;
+} ply_renderer_page_flip_t;
+
+typedef struct
+{
+        ply_renderer_vblank_handler_t handler;
+        void                         *user_data;
+} ply_renderer_vblank_t;
+
+typedef struct
+{
+        ply_pixel_buffer_t    *image;
+        ply_renderer_buffer_t *buffer;
+} ply_renderer_plane_image_t;
+
+/* Planes are backed by the controller's cursor.  Every image shown keeps
+ * its own uploaded cursor buffer, so stepping through the frames of an
+ * animation is only a matter of pointing the cursor at another buffer.
+ */
+struct _ply_renderer_plane
+{
+        ply_renderer_head_t        *head;
+        uint32_t                    width;
+        uint32_t                    height;
+
+        /* most recently shown first */
+        ply_list_t                 *images;
+        ply_renderer_plane_image_t *shown_image;
+        long                        x, y;
+};
+
 typedef struct
 {
         drmModeModeInfo mode;
@@ -138,11 +236,13 @@ struct _ply_renderer_backend
         ply_terminal_t                  *terminal;
 
         int                              device_fd;
+        ply_fd_watch_t                  *device_watch;
         char                            *device_name;
         drmModeRes                      *resources;
 
         ply_renderer_input_source_t      input_source;
         ply_list_t                      *heads;
+        ply_list_t                      *rendered_heads;
         ply_hashtable_t                 *heads_by_controller_id;
 
         ply_hashtable_t                 *output_buffers;
@@ -151,17 +251,35 @@ struct _ply_renderer_backend
         int                              outputs_len;
         int                              connected_count;
 
+        /* bumped every time the outputs get enumerated */
+        uint32_t                         heads_epoch;
+
         int32_t                          dither_red;
         int32_t                          dither_green;
         int32_t                          dither_blue;
 
         uint32_t                         is_active : 1;
         uint32_t        requires_explicit_flushing : 1;
+        uint32_t            page_flips_unsupported : 1;
+        uint32_t          direct_scan_out_disabled : 1;
+        uint32_t                  supports_atomic : 1;
+        uint32_t            mode_sets_are_batched : 1;
 
         int                              panel_width;
         int                              panel_height;
         ply_pixel_buffer_rotation_t      panel_rotation;
         int                              panel_scale;
+
+        /* Connectors that weren't lit at startup.  Probing them can mean
+         * slow EDID reads, so that happens on the task queue once the
+         * first frame is out, and the heads get reconciled afterwards.
+         */
+        uint32_t                        *connectors_to_probe;
+        int                              number_of_connectors_to_probe;
+        uint32_t          is_probing_connectors : 1;
+
+        ply_renderer_backend_heads_changed_handler_t heads_changed_handler;
+        void                                        *heads_changed_handler_user_data;
 };
 
 ply_renderer_plugin_interface_t *ply_renderer_backend_get_interface (void);
@@ -169,6 +287,11 @@ static bool open_input_source (ply_renderer_backend_t      *backend,
                                ply_renderer_input_source_t *input_source);
 static void flush_head (ply_renderer_backend_t *backend,
                         ply_renderer_head_t    *head);
+static void ply_renderer_plane_detach (ply_renderer_backend_t *backend,
+                                       ply_renderer_plane_t   *plane);
+static void stop_probing_connectors (ply_renderer_backend_t *backend);
+static void ply_renderer_head_stop_drawing_to_device (ply_renderer_backend_t *backend,
+                                                      ply_renderer_head_t    *head);
 
 static bool
 ply_renderer_buffer_map (ply_renderer_backend_t *backend,
@@ -357,9 +480,14 @@ begin_flush (ply_renderer_backend_t *backend,
         return buffer->map_address;
 }
 
+/* The kernel refuses DirtyFB calls with more clips than this */
+#define MAX_DIRTY_CLIPS 256
+
 static void
 end_flush (ply_renderer_backend_t *backend,
-           uint32_t                buffer_id)
+           uint32_t                buffer_id,
+           ply_rectangle_t        *areas,
+           size_t                  number_of_areas)
 {
         ply_renderer_buffer_t *buffer;
 
@@ -368,15 +496,46 @@ end_flush (ply_renderer_backend_t *backend,
         assert (buffer != NULL);
 
         if (backend->requires_explicit_flushing) {
-                struct drm_clip_rect flush_area;
+                struct drm_clip_rect flush_areas[MAX_DIRTY_CLIPS];
+                uint32_t number_of_flush_areas;
+                size_t i;
                 int ret;
 
-                flush_area.x1 = 0;
-                flush_area.y1 = 0;
-                flush_area.x2 = buffer->width;
-                flush_area.y2 = buffer->height;
+                /* Only hand over what changed, so virtual and USB displays
+                 * don't have to copy the whole frame.  Too many rectangles
+                 * get folded into their bounding box.
+                 */
+                if (number_of_areas == 0) {
+                        flush_areas[0].x1 = 0;
+                        flush_areas[0].y1 = 0;
+                        flush_areas[0].x2 = buffer->width;
+                        flush_areas[0].y2 = buffer->height;
+                        number_of_flush_areas = 1;
+                } else if (number_of_areas > MAX_DIRTY_CLIPS) {
+                        flush_areas[0].x1 = buffer->width;
+                        flush_areas[0].y1 = buffer->height;
+                        flush_areas[0].x2 = 0;
+                        flush_areas[0].y2 = 0;
+
+                        for (i = 0; i < number_of_areas; i++) {
+                                flush_areas[0].x1 = MIN (flush_areas[0].x1, areas[i].x);
+                                flush_areas[0].y1 = MIN (flush_areas[0].y1, areas[i].y);
+                                flush_areas[0].x2 = MAX (flush_areas[0].x2, MIN (areas[i].x + areas[i].width, buffer->width));
+                                flush_areas[0].y2 = MAX (flush_areas[0].y2, MIN (areas[i].y + areas[i].height, buffer->height));
+                        }
+                        number_of_flush_areas = 1;
+                } else {
+                        for (i = 0; i < number_of_areas; i++) {
+                                flush_areas[i].x1 = areas[i].x;
+                                flush_areas[i].y1 = areas[i].y;
+                                flush_areas[i].x2 = MIN (areas[i].x + areas[i].width, buffer->width);
+                                flush_areas[i].y2 = MIN (areas[i].y + areas[i].height, buffer->height);
+                        }
+                        number_of_flush_areas = number_of_areas;
+                }
 
-                ret = drmModeDirtyFB (backend->device_fd, buffer->id, &flush_area, 1);
+                ret = drmModeDirtyFB (backend->device_fd, buffer->id,
+                                      flush_areas, number_of_flush_areas);
 
                 if (ret == -ENOSYS)
                         backend->requires_explicit_flushing = false;
@@ -595,6 +754,16 @@ ply_renderer_head_new (ply_renderer_backend_t     *backend,
         head->connector_ids = ply_array_new (PLY_ARRAY_ELEMENT_TYPE_UINT32);
         head->controller_id = output->controller_id;
         head->console_buffer_id = console_buffer_id;
+        head->epoch = backend->heads_epoch;
+
+        /* vblank requests name the CRTC by its index, not its id */
+        for (i = 0; i < backend->resources->count_crtcs; i++) {
+                if (backend->resources->crtcs[i] == output->controller_id) {
+                        head->pipe = i;
+                        break;
+                }
+        }
+
         head->connector0_mode = output->mode;
         head->uses_hw_rotation = output->uses_hw_rotation;
 
@@ -602,6 +771,8 @@ ply_renderer_head_new (ply_renderer_backend_t     *backend,
         head->area.y = 0;
         head->area.width = output->mode.hdisplay;
         head->area.height = output->mode.vdisplay;
+        head->back_buffer_damage = ply_tiled_region_new (head->area.width, head->area.height);
+        head->pending_damage = ply_tiled_region_new (head->area.width, head->area.height);
 
         if (gamma_size) {
                 head->gamma_size = gamma_size;
@@ -619,13 +790,14 @@ ply_renderer_head_new (ply_renderer_backend_t     *backend,
         assert (ply_array_get_size (head->connector_ids) > 0);
 
         head->pixel_buffer = ply_pixel_buffer_new_with_device_rotation (head->area.width, head->area.height, output->rotation);
+        ply_pixel_buffer_set_owner (head->pixel_buffer, "display");
         ply_pixel_buffer_set_device_scale (head->pixel_buffer, output->device_scale);
 
         ply_trace ("Creating %ldx%ld renderer head", head->area.width, head->area.height);
         ply_pixel_buffer_fill_with_color (head->pixel_buffer, NULL,
                                           0.0, 0.0, 0.0, 1.0);
         /* Delay flush till first actual draw */
-        ply_region_clear (ply_pixel_buffer_get_updated_areas (head->pixel_buffer));
+        ply_tiled_region_clear (ply_pixel_buffer_get_updated_areas (head->pixel_buffer));
 
         if (output->connector_type == DRM_MODE_CONNECTOR_LVDS ||
             output->connector_type == DRM_MODE_CONNECTOR_eDP ||
@@ -648,8 +820,11 @@ ply_renderer_head_free (ply_renderer_head_t *head)
 {
         ply_trace ("freeing %ldx%ld renderer head", head->area.width, head->area.height);
         ply_pixel_buffer_free (head->pixel_buffer);
+        free (head->shadow_bytes);
 
         ply_array_free (head->connector_ids);
+        ply_tiled_region_free (head->back_buffer_damage);
+        ply_tiled_region_free (head->pending_damage);
         free (head->gamma);
         free (head);
 }
@@ -678,6 +853,23 @@ ply_renderer_head_clear_plane_rotation (ply_renderer_backend_t *backend,
         }
 }
 
+static void
+ply_renderer_head_load_gamma (ply_renderer_backend_t *backend,
+                              ply_renderer_head_t    *head)
+{
+        /* Set gamma table, do this only once */
+        if (head->gamma) {
+                drmModeCrtcSetGamma (backend->device_fd,
+                                     head->controller_id,
+                                     head->gamma_size,
+                                     head->gamma + 0 * head->gamma_size,
+                                     head->gamma + 1 * head->gamma_size,
+                                     head->gamma + 2 * head->gamma_size);
+                free (head->gamma);
+                head->gamma = NULL;
+        }
+}
+
 static bool
 ply_renderer_head_set_scan_out_buffer (ply_renderer_backend_t *backend,
                                        ply_renderer_head_t    *head,
@@ -693,17 +885,7 @@ ply_renderer_head_set_scan_out_buffer (ply_renderer_backend_t *backend,
         ply_trace ("Setting scan out buffer of %ldx%ld head to our buffer",
                    head->area.width, head->area.height);
 
-        /* Set gamma table, do this only once */
-        if (head->gamma) {
-                drmModeCrtcSetGamma (backend->device_fd,
-                                     head->controller_id,
-                                     head->gamma_size,
-                                     head->gamma + 0 * head->gamma_size,
-                                     head->gamma + 1 * head->gamma_size,
-                                     head->gamma + 2 * head->gamma_size);
-                free (head->gamma);
-                head->gamma = NULL;
-        }
+        ply_renderer_head_load_gamma (backend, head);
 
         /* Tell the controller to use the allocated scan out buffer on each connectors
          */
@@ -718,6 +900,335 @@ ply_renderer_head_set_scan_out_buffer (ply_renderer_backend_t *backend,
         return true;
 }
 
+static uint32_t
+find_property_id (ply_renderer_backend_t *backend,
+                  uint32_t                object_id,
+                  uint32_t                object_type,
+                  const char             *name)
+{
+        drmModeObjectPropertiesPtr properties;
+        drmModePropertyPtr property;
+        uint32_t property_id = 0;
+        uint32_t i;
+
+        properties = drmModeObjectGetProperties (backend->device_fd, object_id, object_type);
+        if (properties == NULL)
+                return 0;
+
+        for (i = 0; i < properties->count_props && property_id == 0; i++) {
+                property = drmModeGetProperty (backend->device_fd, properties->props[i]);
+                if (property == NULL)
+                        continue;
+
+                if (strcmp (property->name, name) == 0)
+                        property_id = property->prop_id;
+
+                drmModeFreeProperty (property);
+        }
+
+        drmModeFreeObjectProperties (properties);
+
+        return property_id;
+}
+
+static bool
+add_atomic_property (ply_renderer_backend_t *backend,
+                     drmModeAtomicReqPtr     request,
+                     uint32_t                object_id,
+                     uint32_t                object_type,
+                     const char             *name,
+                     uint64_t                value)
+{
+        uint32_t property_id;
+
+        property_id = find_property_id (backend, object_id, object_type, name);
+        if (property_id == 0) {
+                ply_trace ("object %u has no %s property", object_id, name);
+                return false;
+        }
+
+        return drmModeAtomicAddProperty (request, object_id, property_id, value) >= 0;
+}
+
+/* Finds the primary plane feeding the controller, preferring the one that
+ * is already attached to it
+ */
+static uint32_t
+find_primary_plane_for_controller (ply_renderer_backend_t *backend,
+                                   uint32_t                controller_id)
+{
+        drmModePlaneResPtr plane_resources;
+        drmModeResPtr resources;
+        drmModePlanePtr plane;
+        uint32_t type_property_id, plane_id = 0;
+        uint32_t controller_mask = 0;
+        uint32_t i, j;
+        int k;
+
+        resources = drmModeGetResources (backend->device_fd);
+        if (resources == NULL)
+                return 0;
+
+        for (k = 0; k < resources->count_crtcs; k++) {
+                if (resources->crtcs[k] == controller_id)
+                        controller_mask = 1 << k;
+        }
+        drmModeFreeResources (resources);
+
+        plane_resources = drmModeGetPlaneResources (backend->device_fd);
+        if (plane_resources == NULL)
+                return 0;
+
+        for (i = 0; i < plane_resources->count_planes; i++) {
+                drmModeObjectPropertiesPtr properties;
+                bool is_primary = false;
+
+                plane = drmModeGetPlane (backend->device_fd, plane_resources->planes[i]);
+                if (plane == NULL)
+                        continue;
+
+                if (plane->crtc_id != controller_id &&
+                    (plane_id != 0 || !(plane->possible_crtcs & controller_mask))) {
+                        drmModeFreePlane (plane);
+                        continue;
+                }
+
+                type_property_id = find_property_id (backend, plane->plane_id,
+                                                     DRM_MODE_OBJECT_PLANE, "type");
+                properties = drmModeObjectGetProperties (backend->device_fd,
+                                                         plane->plane_id,
+                                                         DRM_MODE_OBJECT_PLANE);
+                for (j = 0; properties && j < properties->count_props; j++) {
+                        if (properties->props[j] == type_property_id &&
+                            properties->prop_values[j] == DRM_PLANE_TYPE_PRIMARY)
+                                is_primary = true;
+                }
+                drmModeFreeObjectProperties (properties);
+
+                if (is_primary) {
+                        plane_id = plane->plane_id;
+
+                        if (plane->crtc_id == controller_id) {
+                                drmModeFreePlane (plane);
+                                break;
+                        }
+                }
+
+                drmModeFreePlane (plane);
+        }
+
+        drmModeFreePlaneResources (plane_resources);
+
+        return plane_id;
+}
+
+static bool
+ply_renderer_head_add_to_atomic_request (ply_renderer_backend_t *backend,
+                                         ply_renderer_head_t    *head,
+                                         drmModeAtomicReqPtr     request,
+                                         uint32_t               *mode_blob_id)
+{
+        uint32_t *connector_ids;
+        int number_of_connectors, i;
+        uint32_t plane_id;
+        uint64_t rotation;
+        bool added = true;
+
+        plane_id = find_primary_plane_for_controller (backend, head->controller_id);
+        if (plane_id == 0) {
+                ply_trace ("Couldn't find primary plane for controller %u", head->controller_id);
+                return false;
+        }
+
+        if (drmModeCreatePropertyBlob (backend->device_fd, &head->connector0_mode,
+                                       sizeof(head->connector0_mode), mode_blob_id) < 0) {
+                *mode_blob_id = 0;
+                return false;
+        }
+
+        connector_ids = (uint32_t *) ply_array_get_uint32_elements (head->connector_ids);
+        number_of_connectors = ply_array_get_size (head->connector_ids);
+        for (i = 0; i < number_of_connectors; i++) {
+                added &= add_atomic_property (backend, request, connector_ids[i],
+                                              DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID",
+                                              head->controller_id);
+        }
+
+        added &= add_atomic_property (backend, request, head->controller_id,
+                                      DRM_MODE_OBJECT_CRTC, "MODE_ID", *mode_blob_id);
+        added &= add_atomic_property (backend, request, head->controller_id,
+                                      DRM_MODE_OBJECT_CRTC, "ACTIVE", 1);
+
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "FB_ID", head->scan_out_buffer_id);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "CRTC_ID", head->controller_id);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "SRC_X", 0);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "SRC_Y", 0);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "SRC_W", (uint64_t) head->area.width << 16);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "SRC_H", (uint64_t) head->area.height << 16);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "CRTC_X", 0);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "CRTC_Y", 0);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "CRTC_W", head->area.width);
+        added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                      "CRTC_H", head->area.height);
+
+        /* Same rule as ply_renderer_head_clear_plane_rotation (), but folded
+         * into the commit.  Planes without a rotation property can only
+         * scan out upright anyway.
+         */
+        rotation = head->uses_hw_rotation ? DRM_MODE_ROTATE_180 : DRM_MODE_ROTATE_0;
+        if (find_property_id (backend, plane_id, DRM_MODE_OBJECT_PLANE, "rotation") != 0)
+                added &= add_atomic_property (backend, request, plane_id, DRM_MODE_OBJECT_PLANE,
+                                              "rotation", rotation);
+
+        return added;
+}
+
+/* Does the mode sets queued up while activating in one atomic commit, so
+ * every head changes on the same vblank instead of each waiting its turn.
+ * Heads fall back to a legacy mode set if the commit can't be done.
+ */
+static void
+commit_queued_mode_sets (ply_renderer_backend_t *backend)
+{
+        drmModeAtomicReqPtr request;
+        ply_renderer_head_t *head;
+        ply_list_node_t *node;
+        uint32_t *mode_blob_ids;
+        int number_of_heads, i;
+        bool committed = false;
+
+        number_of_heads = ply_list_get_length (backend->heads);
+        mode_blob_ids = calloc (number_of_heads, sizeof(uint32_t));
+        request = drmModeAtomicAlloc ();
+
+        i = 0;
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+                node = ply_list_get_next_node (backend->heads, node);
+
+                if (!head->mode_set_is_queued)
+                        continue;
+
+                if (request != NULL &&
+                    !ply_renderer_head_add_to_atomic_request (backend, head, request,
+                                                              &mode_blob_ids[i])) {
+                        drmModeAtomicFree (request);
+                        request = NULL;
+                }
+                i++;
+        }
+
+        if (i > 0 && request != NULL) {
+                if (drmModeAtomicCommit (backend->device_fd, request,
+                                         DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET,
+                                         NULL) < 0) {
+                        ply_trace ("Atomic test commit for %d heads failed: %m", i);
+                } else {
+                        node = ply_list_get_first_node (backend->heads);
+                        while (node != NULL) {
+                                head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+                                node = ply_list_get_next_node (backend->heads, node);
+
+                                if (head->mode_set_is_queued)
+                                        ply_renderer_head_load_gamma (backend, head);
+                        }
+
+                        if (drmModeAtomicCommit (backend->device_fd, request,
+                                                 DRM_MODE_ATOMIC_ALLOW_MODESET, NULL) < 0)
+                                ply_trace ("Atomic commit for %d heads failed: %m", i);
+                        else
+                                committed = true;
+                }
+        }
+
+        if (committed)
+                ply_trace ("Set scan out buffers of %d heads in one atomic commit", i);
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+                node = ply_list_get_next_node (backend->heads, node);
+
+                if (!head->mode_set_is_queued)
+                        continue;
+
+                head->mode_set_is_queued = false;
+
+                if (!committed)
+                        ply_renderer_head_set_scan_out_buffer (backend, head,
+                                                               head->scan_out_buffer_id);
+        }
+
+        for (i = 0; i < number_of_heads; i++) {
+                if (mode_blob_ids[i] != 0)
+                        drmModeDestroyPropertyBlob (backend->device_fd, mode_blob_ids[i]);
+        }
+        free (mode_blob_ids);
+
+        if (request != NULL)
+                drmModeAtomicFree (request);
+}
+
+static void
+ply_renderer_head_unmap_back_buffer (ply_renderer_backend_t *backend,
+                                     ply_renderer_head_t    *head)
+{
+        if (head->back_buffer_id == 0)
+                return;
+
+        unmap_buffer (backend, head->back_buffer_id);
+        destroy_output_buffer (backend, head->back_buffer_id);
+        head->back_buffer_id = 0;
+        head->page_flip_pending = false;
+}
+
+static void
+ply_renderer_head_map_back_buffer (ply_renderer_backend_t *backend,
+                                   ply_renderer_head_t    *head)
+{
+        unsigned long row_stride;
+        ply_rectangle_t area;
+
+        ply_trace ("Creating back buffer for %ldx%ld renderer head", head->area.width, head->area.height);
+        head->back_buffer_id = create_output_buffer (backend,
+                                                     head->area.width, head->area.height,
+                                                     &row_stride);
+
+        if (head->back_buffer_id == 0)
+                return;
+
+        if (!map_buffer (backend, head->back_buffer_id)) {
+                destroy_output_buffer (backend, head->back_buffer_id);
+                head->back_buffer_id = 0;
+                return;
+        }
+
+        /* Both buffers get filled from the same shadow rows */
+        if (row_stride != head->row_stride) {
+                ply_trace ("Back buffer has a different stride, not page flipping");
+                ply_renderer_head_unmap_back_buffer (backend, head);
+                return;
+        }
+
+        /* The new buffer is blank, so all of it is out of date */
+        area.x = 0;
+        area.y = 0;
+        area.width = head->area.width;
+        area.height = head->area.height;
+        ply_tiled_region_clear (head->back_buffer_damage);
+        ply_tiled_region_add_rectangle (head->back_buffer_damage, &area);
+}
+
 static bool
 ply_renderer_head_map (ply_renderer_backend_t *backend,
                        ply_renderer_head_t    *head)
@@ -743,6 +1254,9 @@ ply_renderer_head_map (ply_renderer_backend_t *backend,
                 return false;
         }
 
+        if (!backend->page_flips_unsupported)
+                ply_renderer_head_map_back_buffer (backend, head);
+
         head->scan_out_buffer_needs_reset = true;
         return true;
 }
@@ -752,6 +1266,8 @@ ply_renderer_head_unmap (ply_renderer_backend_t *backend,
                          ply_renderer_head_t    *head)
 {
         ply_trace ("unmapping %ldx%ld renderer head", head->area.width, head->area.height);
+        ply_renderer_head_stop_drawing_to_device (backend, head);
+        ply_renderer_head_unmap_back_buffer (backend, head);
         unmap_buffer (backend, head->scan_out_buffer_id);
 
         destroy_output_buffer (backend, head->scan_out_buffer_id);
@@ -762,12 +1278,31 @@ static void
 ply_renderer_head_remove (ply_renderer_backend_t *backend,
                           ply_renderer_head_t    *head)
 {
+        ply_list_node_t *node;
+
         if (head->scan_out_buffer_id)
                 ply_renderer_head_unmap (backend, head);
 
         ply_hashtable_remove (backend->heads_by_controller_id,
                               (void *) (intptr_t) head->controller_id);
         ply_list_remove_data (backend->heads, head);
+        ply_list_remove_data (backend->rendered_heads, head);
+
+        if (head->plane != NULL)
+                ply_renderer_plane_detach (backend, head->plane);
+
+        /* Clones keep their reference on the pixel buffer, and get
+         * regrouped once the heads have been updated */
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_renderer_head_t *clone = ply_list_node_get_data (node);
+
+                if (clone->clone_source == head)
+                        clone->clone_source = NULL;
+
+                node = ply_list_get_next_node (backend->heads, node);
+        }
+
         ply_renderer_head_free (head);
 }
 
@@ -799,6 +1334,88 @@ ply_renderer_head_remove_connector (ply_renderer_backend_t *backend,
         free (connector_ids);
 }
 
+typedef void (*copy_row_function_t) (char       *destination,
+                                     const char *source,
+                                     size_t      length);
+
+static void
+copy_row_memcpy (char       *destination,
+                 const char *source,
+                 size_t      length)
+{
+        memcpy (destination, source, length);
+}
+
+#ifdef PLY_DRM_HAVE_STREAMING_COPY
+/* Scan-out buffers are usually mapped write-combining, which is only fast
+ * if every 64 byte chunk gets filled completely and nothing reads it back.
+ * So go pixel by pixel up to a chunk boundary, then stream out whole
+ * chunks with non-temporal stores that keep the cache out of it.
+ */
+__attribute__((__target__ ("sse2")))
+static void
+copy_row_streaming_sse2 (char       *destination,
+                         const char *source,
+                         size_t      length)
+{
+        while (length >= BYTES_PER_PIXEL && ((uintptr_t) destination & (WRITE_COMBINE_CHUNK_SIZE - 1)) != 0) {
+                _mm_stream_si32 ((int *) destination, *(const int *) source);
+                destination += BYTES_PER_PIXEL;
+                source += BYTES_PER_PIXEL;
+                length -= BYTES_PER_PIXEL;
+        }
+
+        while (length >= WRITE_COMBINE_CHUNK_SIZE) {
+                __m128i chunk0, chunk1, chunk2, chunk3;
+
+                chunk0 = _mm_loadu_si128 ((const __m128i *) source);
+                chunk1 = _mm_loadu_si128 ((const __m128i *) (source + 16));
+                chunk2 = _mm_loadu_si128 ((const __m128i *) (source + 32));
+                chunk3 = _mm_loadu_si128 ((const __m128i *) (source + 48));
+                _mm_stream_si128 ((__m128i *) destination, chunk0);
+                _mm_stream_si128 ((__m128i *) (destination + 16), chunk1);
+                _mm_stream_si128 ((__m128i *) (destination + 32), chunk2);
+                _mm_stream_si128 ((__m128i *) (destination + 48), chunk3);
+                destination += WRITE_COMBINE_CHUNK_SIZE;
+                source += WRITE_COMBINE_CHUNK_SIZE;
+                length -= WRITE_COMBINE_CHUNK_SIZE;
+        }
+
+        while (length >= BYTES_PER_PIXEL) {
+                _mm_stream_si32 ((int *) destination, *(const int *) source);
+                destination += BYTES_PER_PIXEL;
+                source += BYTES_PER_PIXEL;
+                length -= BYTES_PER_PIXEL;
+        }
+}
+
+__attribute__((__target__ ("sse2")))
+static void
+finish_streaming_copy_sse2 (void)
+{
+        _mm_sfence ();
+}
+#endif
+
+static copy_row_function_t
+get_copy_row_function (void)
+{
+        static copy_row_function_t copy_row = NULL;
+
+        if (copy_row != NULL)
+                return copy_row;
+
+        copy_row = copy_row_memcpy;
+
+#ifdef PLY_DRM_HAVE_STREAMING_COPY
+        __builtin_cpu_init ();
+        if (__builtin_cpu_supports ("sse2"))
+                copy_row = copy_row_streaming_sse2;
+#endif
+
+        return copy_row;
+}
+
 static void
 flush_area (const char      *src,
             unsigned long    src_row_stride,
@@ -806,6 +1423,7 @@ flush_area (const char      *src,
             unsigned long    dst_row_stride,
             ply_rectangle_t *area_to_flush)
 {
+        copy_row_function_t copy_row = get_copy_row_function ();
         unsigned long y1, y2, y;
 
         y1 = area_to_flush->y;
@@ -813,15 +1431,20 @@ flush_area (const char      *src,
 
         if (area_to_flush->width * 4 == src_row_stride &&
             area_to_flush->width * 4 == dst_row_stride) {
-                memcpy (dst, src, area_to_flush->width * area_to_flush->height * 4);
-                return;
+                copy_row (dst, src, area_to_flush->width * area_to_flush->height * 4);
+        } else {
+                for (y = y1; y < y2; y++) {
+                        copy_row (dst, src, area_to_flush->width * 4);
+                        dst += dst_row_stride;
+                        src += src_row_stride;
+                }
         }
 
-        for (y = y1; y < y2; y++) {
-                memcpy (dst, src, area_to_flush->width * 4);
-                dst += dst_row_stride;
-                src += src_row_stride;
-        }
+#ifdef PLY_DRM_HAVE_STREAMING_COPY
+        /* Make sure the streamed stores land before the driver is told */
+        if (copy_row == copy_row_streaming_sse2)
+                finish_streaming_copy_sse2 ();
+#endif
 }
 
 static void
@@ -838,26 +1461,212 @@ ply_renderer_head_flush_area (ply_renderer_head_t *head,
         src = (char *) &shadow_buffer[area_to_flush->y * head->area.width + area_to_flush->x];
 
         flush_area (src, head->area.width * 4, dst, head->row_stride, area_to_flush);
+
+        head->bytes_flushed += area_to_flush->width * area_to_flush->height * BYTES_PER_PIXEL;
+        ply_statistics_add_to_count ("renderer.drm.bytes-flushed",
+                                     area_to_flush->width * area_to_flush->height * BYTES_PER_PIXEL);
 }
 
-static void
-free_heads (ply_renderer_backend_t *backend)
+static bool
+ply_renderer_head_can_draw_to_device (ply_renderer_backend_t *backend,
+                                      ply_renderer_head_t    *head)
 {
         ply_list_node_t *node;
 
-        node = ply_list_get_first_node (backend->heads);
-        while (node != NULL) {
+        if (backend->direct_scan_out_disabled || head->scan_out_buffer_id == 0)
+                return false;
+
+        /* A single buffer is always on screen, so drawing there would show
+         * half drawn frames, and blending would read back from it */
+        if (head->back_buffer_id == 0 || backend->page_flips_unsupported)
+                return false;
+
+        /* Pixel buffers have their rows right after each other */
+        if (head->row_stride != head->area.width * BYTES_PER_PIXEL)
+                return false;
+
+        /* Clones copy out of the shared pixel buffer on every flush, which
+         * is slow when it's device memory */
+        if (head->clone_source != NULL)
+                return false;
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_renderer_head_t *clone = ply_list_node_get_data (node);
+
+                if (clone->clone_source == head)
+                        return false;
+
+                node = ply_list_get_next_node (backend->heads, node);
+        }
+
+        return true;
+}
+
+static bool
+ply_renderer_head_draws_to_shadow (ply_renderer_head_t *head)
+{
+        return ply_pixel_buffer_get_argb32_data (head->pixel_buffer) == head->shadow_bytes;
+}
+
+/* Gives the pixel buffer a shadow it doesn't own, that it can come back
+ * to whenever the back buffer gets queued to be shown.  It starts out
+ * drawing to the shadow, and moves over to the back buffer once a flip
+ * has landed.
+ */
+static void
+ply_renderer_head_start_drawing_to_device (ply_renderer_backend_t *backend,
+                                           ply_renderer_head_t    *head)
+{
+        size_t size;
+
+        if (head->draws_to_device)
+                return;
+
+        ply_trace ("Drawing straight to the back buffer of %ldx%ld renderer head",
+                   head->area.width, head->area.height);
+
+        size = head->area.width * head->area.height * BYTES_PER_PIXEL;
+        head->shadow_bytes = malloc (size);
+        memcpy (head->shadow_bytes, ply_pixel_buffer_get_argb32_data (head->pixel_buffer), size);
+        ply_pixel_buffer_set_data (head->pixel_buffer, head->shadow_bytes);
+
+        head->draws_to_device = true;
+}
+
+/* Moves the pixel buffer back to pixels of its own, before the buffer it
+ * draws to goes away or starts getting read by clones.  Whatever the back
+ * buffer has that the buffer on screen doesn't is still pending damage,
+ * so nothing needs doing about the buffers.
+ */
+static void
+ply_renderer_head_stop_drawing_to_device (ply_renderer_backend_t *backend,
+                                          ply_renderer_head_t    *head)
+{
+        uint32_t *bytes;
+
+        if (!head->draws_to_device)
+                return;
+
+        ply_trace ("Drawing to a shadow of %ldx%ld renderer head again",
+                   head->area.width, head->area.height);
+
+        bytes = ply_pixel_buffer_get_argb32_data (head->pixel_buffer);
+        ply_pixel_buffer_set_data (head->pixel_buffer, NULL);
+        memcpy (ply_pixel_buffer_get_argb32_data (head->pixel_buffer), bytes,
+                head->area.width * head->area.height * BYTES_PER_PIXEL);
+
+        free (head->shadow_bytes);
+        head->shadow_bytes = NULL;
+        head->draws_to_device = false;
+}
+
+/* Once a flip lands and nothing got drawn while it was in flight, the
+ * buffer that left the screen catches up with the shadow, and gets drawn
+ * to next.  Otherwise drawing stays on the shadow, and the flush that
+ * follows sends it out with the next flip like without drawing to the
+ * device.
+ */
+static void
+ply_renderer_head_sync_back_buffer (ply_renderer_backend_t *backend,
+                                    ply_renderer_head_t    *head)
+{
+        ply_rectangle_t *areas;
+        size_t number_of_areas, i;
+        char *map_address;
+
+        if (!ply_renderer_head_draws_to_shadow (head) ||
+            !ply_tiled_region_is_empty (head->pending_damage) ||
+            !ply_tiled_region_is_empty (ply_pixel_buffer_get_updated_areas (head->pixel_buffer)))
+                return;
+
+        map_address = begin_flush (backend, head->back_buffer_id);
+
+        areas = ply_tiled_region_get_rectangles (head->back_buffer_damage, &number_of_areas);
+        for (i = 0; i < number_of_areas; i++) {
+                ply_renderer_head_flush_area (head, &areas[i], map_address);
+        }
+        ply_tiled_region_clear (head->back_buffer_damage);
+
+        ply_pixel_buffer_set_data (head->pixel_buffer, (uint32_t *) map_address);
+}
+
+/* Brings the shadow up to date with what got drawn straight to the back
+ * buffer, which is about to be shown, and moves drawing over to it
+ */
+static void
+ply_renderer_head_move_to_shadow (ply_renderer_head_t *head,
+                                  ply_rectangle_t     *areas,
+                                  size_t               number_of_areas)
+{
+        uint32_t *bytes;
+        size_t i;
+        long y;
+
+        bytes = ply_pixel_buffer_get_argb32_data (head->pixel_buffer);
+
+        for (i = 0; i < number_of_areas; i++) {
+                for (y = areas[i].y; y < areas[i].y + (long) areas[i].height; y++) {
+                        memcpy (&head->shadow_bytes[y * head->area.width + areas[i].x],
+                                &bytes[y * head->area.width + areas[i].x],
+                                areas[i].width * BYTES_PER_PIXEL);
+                }
+        }
+
+        ply_pixel_buffer_set_data (head->pixel_buffer, head->shadow_bytes);
+}
+
+static void
+ply_renderer_head_update_flush_statistics (ply_renderer_head_t *head)
+{
+        double now, elapsed;
+
+        if (!ply_is_tracing ())
+                return;
+
+        now = ply_get_timestamp ();
+
+        if (head->flush_statistics_start_time == 0.0) {
+                head->flush_statistics_start_time = now;
+                head->bytes_flushed = 0;
+                return;
+        }
+
+        elapsed = now - head->flush_statistics_start_time;
+        if (elapsed < 1.0)
+                return;
+
+        ply_trace ("%ldx%ld head on controller %u flushed %.1f KiB/s",
+                   head->area.width, head->area.height, head->controller_id,
+                   head->bytes_flushed / elapsed / 1024.0);
+
+        head->flush_statistics_start_time = now;
+        head->bytes_flushed = 0;
+}
+
+static void
+free_heads (ply_renderer_backend_t *backend)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
                 ply_list_node_t *next_node;
                 ply_renderer_head_t *head;
 
                 head = (ply_renderer_head_t *) ply_list_node_get_data (node);
                 next_node = ply_list_get_next_node (backend->heads, node);
 
+                if (head->plane != NULL)
+                        ply_renderer_plane_detach (backend, head->plane);
+
                 ply_renderer_head_free (head);
                 ply_list_remove_node (backend->heads, node);
 
                 node = next_node;
         }
+
+        ply_list_remove_all_nodes (backend->rendered_heads);
 }
 
 static ply_renderer_backend_t *
@@ -879,9 +1688,12 @@ create_backend (const char     *device_name,
 
         backend->loop = ply_event_loop_get_default ();
         backend->heads = ply_list_new ();
+        backend->rendered_heads = ply_list_new ();
         backend->input_source.key_buffer = ply_buffer_new ();
         backend->terminal = terminal;
         backend->requires_explicit_flushing = true;
+        backend->page_flips_unsupported = ply_kernel_command_line_has_argument ("plymouth.no-page-flip");
+        backend->direct_scan_out_disabled = ply_kernel_command_line_has_argument ("plymouth.no-direct-scan-out");
         backend->output_buffers = ply_hashtable_new (ply_hashtable_direct_hash,
                                                      ply_hashtable_direct_compare);
         backend->heads_by_controller_id = ply_hashtable_new (NULL, NULL);
@@ -900,6 +1712,7 @@ destroy_backend (ply_renderer_backend_t *backend)
 {
         ply_trace ("destroying renderer backend for device %s", backend->device_name);
         free_heads (backend);
+        ply_list_free (backend->rendered_heads);
 
         free (backend->device_name);
         ply_hashtable_free (backend->output_buffers);
@@ -919,13 +1732,30 @@ activate (ply_renderer_backend_t *backend)
         backend->is_active = true;
 
         drmSetMaster (backend->device_fd);
+
+        /* Mode set all heads together once their buffers are filled in */
+        backend->mode_sets_are_batched = backend->supports_atomic;
+
         node = ply_list_get_first_node (backend->heads);
         while (node != NULL) {
                 head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+                /* Someone else may have been scanning out in the mean time,
+                 * so take the controller back with a mode set rather than
+                 * a flip */
+                if (head->back_buffer_id != 0)
+                        head->scan_out_buffer_needs_reset = true;
+                /* and may have moved the cursor */
+                if (head->plane != NULL)
+                        head->plane->shown_image = NULL;
                 /* Flush out any pending drawing to the buffer */
                 flush_head (backend, head);
                 node = ply_list_get_next_node (backend->heads, node);
         }
+
+        if (backend->mode_sets_are_batched) {
+                backend->mode_sets_are_batched = false;
+                commit_queued_mode_sets (backend);
+        }
 }
 
 static void
@@ -936,6 +1766,47 @@ deactivate (ply_renderer_backend_t *backend)
         backend->is_active = false;
 }
 
+/* Leaves the frames on screen registered with the kernel for whoever
+ * takes the device over next.  They stay alive for as long as some
+ * process, like plymouthd-fd-escrow, keeps the device open, so the
+ * display server can scan them out, or read them back from the
+ * controller, until its own first frame is ready.
+ */
+static void
+hand_over (ply_renderer_backend_t *backend)
+{
+        ply_renderer_head_t *head;
+        ply_list_node_t *node;
+
+        stop_probing_connectors (backend);
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+                node = ply_list_get_next_node (backend->heads, node);
+
+                if (head->scan_out_buffer_id == 0)
+                        continue;
+
+                ply_renderer_head_stop_drawing_to_device (backend, head);
+
+                /* Nothing will draw to the back buffer anymore, but a flip
+                 * that is still in flight may have it on screen until the
+                 * next vblank
+                 */
+                if (!head->page_flip_pending)
+                        ply_renderer_head_unmap_back_buffer (backend, head);
+
+                ply_trace ("handing over frame buffer %u on controller %u",
+                           head->scan_out_buffer_id, head->controller_id);
+        }
+
+        /* The drm file stays open in other processes, so it has to stop
+         * being master for the display server to become it
+         */
+        deactivate (backend);
+}
+
 static void
 on_active_vt_changed (ply_renderer_backend_t *backend)
 {
@@ -948,6 +1819,66 @@ on_active_vt_changed (ply_renderer_backend_t *backend)
         }
 }
 
+static void
+on_page_flip (int          device_fd,
+              unsigned int frame,
+              unsigned int seconds,
+              unsigned int microseconds,
+              void        *user_data)
+{
+        ply_renderer_page_flip_t *page_flip = user_data;
+        ply_renderer_backend_t *backend = page_flip->backend;
+        ply_renderer_head_t *head;
+
+        ply_trace_point (drm_page_flip_trace_point, page_flip->controller_id, frame);
+
+        /* The head may have been unplugged while the flip was in flight */
+        head = ply_hashtable_lookup (backend->heads_by_controller_id,
+                                     (void *) (intptr_t) page_flip->controller_id);
+        free (page_flip);
+
+        if (head == NULL || !head->page_flip_pending)
+                return;
+
+        head->page_flip_pending = false;
+
+        if (head->draws_to_device)
+                ply_renderer_head_sync_back_buffer (backend, head);
+
+        /* Draw whatever piled up while waiting */
+        if (!ply_tiled_region_is_empty (head->pending_damage) ||
+            !ply_tiled_region_is_empty (ply_pixel_buffer_get_updated_areas (head->pixel_buffer)))
+                flush_head (backend, head);
+}
+
+static void
+on_vblank (int          device_fd,
+           unsigned int sequence,
+           unsigned int seconds,
+           unsigned int microseconds,
+           void        *user_data)
+{
+        ply_renderer_vblank_t *vblank = user_data;
+
+        vblank->handler (vblank->user_data, sequence,
+                         seconds + microseconds / 1000000.0);
+        free (vblank);
+}
+
+static void
+on_device_event (ply_renderer_backend_t *backend,
+                 int                     device_fd)
+{
+        drmEventContext event_context;
+
+        memset (&event_context, 0, sizeof(event_context));
+        event_context.version = 2;
+        event_context.vblank_handler = on_vblank;
+        event_context.page_flip_handler = on_page_flip;
+
+        drmHandleEvent (device_fd, &event_context);
+}
+
 static bool
 load_driver (ply_renderer_backend_t *backend)
 {
@@ -962,6 +1893,16 @@ load_driver (ply_renderer_backend_t *backend)
         }
 
         backend->device_fd = device_fd;
+        backend->device_watch = ply_event_loop_watch_fd (backend->loop, device_fd,
+                                                         PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                                         (ply_event_handler_t) on_device_event,
+                                                         NULL, backend);
+
+        if (!ply_kernel_command_line_has_argument ("plymouth.no-atomic") &&
+            drmSetClientCap (device_fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0) {
+                ply_trace ("Using atomic mode setting");
+                backend->supports_atomic = true;
+        }
 
         drmDropMaster (device_fd);
 
@@ -976,6 +1917,13 @@ unload_backend (ply_renderer_backend_t *backend)
 
         ply_trace ("unloading backend");
 
+        stop_probing_connectors (backend);
+
+        if (backend->device_watch != NULL) {
+                ply_event_loop_stop_watching_fd (backend->loop, backend->device_watch);
+                backend->device_watch = NULL;
+        }
+
         if (backend->device_fd >= 0) {
                 drmClose (backend->device_fd);
                 backend->device_fd = -1;
@@ -1157,9 +2105,13 @@ get_active_mode (ply_renderer_backend_t *backend,
         return mode;
 }
 
+/* Without probe_connector, this only returns what the kernel already
+ * knows about the connector, which is enough for ones that are lit.
+ */
 static void
 get_output_info (ply_renderer_backend_t *backend,
                  uint32_t                connector_id,
+                 bool                    probe_connector,
                  ply_output_t           *output)
 {
         drmModeModeInfo *mode = NULL;
@@ -1168,7 +2120,10 @@ get_output_info (ply_renderer_backend_t *backend,
         memset (output, 0, sizeof(*output));
         output->connector_id = connector_id;
 
-        connector = drmModeGetConnector (backend->device_fd, connector_id);
+        if (probe_connector)
+                connector = drmModeGetConnector (backend->device_fd, connector_id);
+        else
+                connector = drmModeGetConnectorCurrent (backend->device_fd, connector_id);
         if (connector == NULL)
                 return;
 
@@ -1322,6 +2277,24 @@ remove_output (ply_renderer_backend_t *backend, ply_output_t *output)
         ply_renderer_head_remove_connector (backend, head, output->connector_id);
 }
 
+/* Whether the output would still be shown the same way by the head it
+ * is on.  Things like the link status can change without that, and are
+ * dealt with when the connector gets added to its head again.
+ */
+static bool
+output_shows_the_same (const ply_output_t *old_output,
+                       const ply_output_t *new_output)
+{
+        return old_output->connected == new_output->connected &&
+               old_output->controller_id == new_output->controller_id &&
+               modes_are_equal ((drmModeModeInfo *) &old_output->mode,
+                                (drmModeModeInfo *) &new_output->mode) &&
+               old_output->device_scale == new_output->device_scale &&
+               old_output->rotation == new_output->rotation &&
+               old_output->tiled == new_output->tiled &&
+               old_output->uses_hw_rotation == new_output->uses_hw_rotation;
+}
+
 /* Check if an output has changed since we last enumerated it; and if
  * it has changed remove it from the head it is part of.
  */
@@ -1342,7 +2315,15 @@ check_if_output_has_changed (ply_renderer_backend_t *backend,
         if (!old_output || !old_output->controller_id)
                 return false;
 
-        if (memcmp(old_output, new_output, sizeof(ply_output_t)) == 0)
+        /* We picked the controller ourselves if the output wasn't lit
+         * when it was last enumerated, and the kernel won't report it
+         * until the mode gets set, so keep it rather than start over */
+        if (new_output->connected && new_output->controller_id == 0 &&
+            ply_hashtable_lookup (backend->heads_by_controller_id,
+                                  (void *) (intptr_t) old_output->controller_id) != NULL)
+                new_output->controller_id = old_output->controller_id;
+
+        if (output_shows_the_same (old_output, new_output))
                 return false;
 
         ply_trace ("Output for connector %u changed, removing", old_output->connector_id);
@@ -1354,8 +2335,70 @@ check_if_output_has_changed (ply_renderer_backend_t *backend,
  * create and/or remove heads as necessary.
  * Returns true if any heads were modified.
  */
+/* Lets heads that would render the exact same image share one pixel
+ * buffer, so splash plugins draw it once instead of once per head
+ */
+static void
+group_cloned_heads (ply_renderer_backend_t *backend)
+{
+        ply_list_node_t *node, *source_node;
+
+        ply_list_remove_all_nodes (backend->rendered_heads);
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_renderer_head_t *head = ply_list_node_get_data (node);
+                ply_renderer_head_t *source = NULL;
+
+                source_node = ply_list_get_first_node (backend->rendered_heads);
+                while (source_node != NULL) {
+                        ply_renderer_head_t *candidate = ply_list_node_get_data (source_node);
+
+                        if (candidate->area.width == head->area.width &&
+                            candidate->area.height == head->area.height &&
+                            ply_pixel_buffer_get_device_scale (candidate->pixel_buffer) ==
+                            ply_pixel_buffer_get_device_scale (head->pixel_buffer) &&
+                            ply_pixel_buffer_get_device_rotation (candidate->pixel_buffer) ==
+                            ply_pixel_buffer_get_device_rotation (head->pixel_buffer)) {
+                                source = candidate;
+                                break;
+                        }
+
+                        source_node = ply_list_get_next_node (backend->rendered_heads, source_node);
+                }
+
+                head->clone_source = source;
+
+                if (source == NULL) {
+                        ply_list_append_data (backend->rendered_heads, head);
+                } else if (head->pixel_buffer != source->pixel_buffer) {
+                        ply_rectangle_t area;
+
+                        ply_trace ("%ldx%ld head on controller %u clones controller %u",
+                                   head->area.width, head->area.height,
+                                   head->controller_id, source->controller_id);
+
+                        ply_renderer_head_stop_drawing_to_device (backend, head);
+                        ply_pixel_buffer_free (head->pixel_buffer);
+                        head->pixel_buffer = ply_pixel_buffer_ref (source->pixel_buffer);
+                        head->epoch = backend->heads_epoch;
+
+                        /* What was shown came from the old buffer */
+                        area.x = 0;
+                        area.y = 0;
+                        area.width = head->area.width;
+                        area.height = head->area.height;
+                        ply_tiled_region_add_rectangle (head->pending_damage, &area);
+                }
+
+                node = ply_list_get_next_node (backend->heads, node);
+        }
+}
+
 static bool
-create_heads_for_active_connectors (ply_renderer_backend_t *backend, bool change)
+create_heads_for_active_connectors (ply_renderer_backend_t *backend,
+                                    bool                    change,
+                                    bool                    probe_connectors)
 {
         int i, j, number_of_setup_outputs, outputs_len;
         ply_output_t *outputs;
@@ -1370,13 +2413,15 @@ create_heads_for_active_connectors (ply_renderer_backend_t *backend, bool change
          *     added connector.
          */
         ply_trace ("(Re)enumerating all outputs");
+        backend->heads_epoch++;
 
         outputs = calloc (backend->resources->count_connectors, sizeof(*outputs));
         outputs_len = backend->resources->count_connectors;
 
         backend->connected_count = 0;
         for (i = 0; i < outputs_len; i++) {
-                get_output_info (backend, backend->resources->connectors[i], &outputs[i]);
+                get_output_info (backend, backend->resources->connectors[i],
+                                 probe_connectors, &outputs[i]);
 
                 if (check_if_output_has_changed (backend, &outputs[i]))
                         changed = true;
@@ -1480,6 +2525,8 @@ create_heads_for_active_connectors (ply_renderer_backend_t *backend, bool change
         backend->outputs_len = outputs_len;
         backend->outputs = outputs;
 
+        group_cloned_heads (backend);
+
         ply_trace ("outputs %schanged\n", changed ? "" : "un");
 
         return changed;
@@ -1519,6 +2566,26 @@ has_32bpp_support (ply_renderer_backend_t *backend)
         return true;
 }
 
+static void
+find_connectors_to_probe (ply_renderer_backend_t *backend)
+{
+        int i;
+
+        free (backend->connectors_to_probe);
+        backend->connectors_to_probe = NULL;
+        backend->number_of_connectors_to_probe = 0;
+
+        for (i = 0; i < backend->outputs_len; i++) {
+                if (backend->outputs[i].connected)
+                        continue;
+
+                if (backend->connectors_to_probe == NULL)
+                        backend->connectors_to_probe = calloc (backend->outputs_len, sizeof(uint32_t));
+
+                backend->connectors_to_probe[backend->number_of_connectors_to_probe++] = backend->outputs[i].connector_id;
+        }
+}
+
 static bool
 query_device (ply_renderer_backend_t *backend)
 {
@@ -1534,10 +2601,21 @@ query_device (ply_renderer_backend_t *backend)
                 return false;
         }
 
-        if (!create_heads_for_active_connectors (backend, false)) {
-                ply_trace ("Could not initialize heads");
-                ret = false;
-        } else if (!has_32bpp_support (backend)) {
+        /* Start with the connectors that are already lit, and leave the
+         * rest to be probed after the first frame.  If nothing is lit,
+         * there's nothing to show without probing, so probe right away.
+         */
+        if (create_heads_for_active_connectors (backend, false, false)) {
+                find_connectors_to_probe (backend);
+        } else {
+                ply_trace ("No outputs are lit, probing all of them");
+                if (!create_heads_for_active_connectors (backend, false, true)) {
+                        ply_trace ("Could not initialize heads");
+                        ret = false;
+                }
+        }
+
+        if (ret && !has_32bpp_support (backend)) {
                 ply_trace ("Device doesn't support 32bpp framebuffer");
                 ret = false;
         }
@@ -1549,7 +2627,8 @@ query_device (ply_renderer_backend_t *backend)
 }
 
 static bool
-handle_change_event (ply_renderer_backend_t *backend)
+update_heads (ply_renderer_backend_t *backend,
+              bool                    probe_connectors)
 {
         bool ret = true;
 
@@ -1559,7 +2638,7 @@ handle_change_event (ply_renderer_backend_t *backend)
                 return false;
         }
 
-        ret = create_heads_for_active_connectors (backend, true);
+        ret = create_heads_for_active_connectors (backend, true, probe_connectors);
 
         drmModeFreeResources (backend->resources);
         backend->resources = NULL;
@@ -1567,6 +2646,99 @@ handle_change_event (ply_renderer_backend_t *backend)
         return ret;
 }
 
+/* Heads that just turned up as clones of a head already on screen won't
+ * be drawn for, so copy over what the heads they clone show now */
+static void
+flush_new_clones (ply_renderer_backend_t *backend)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_renderer_head_t *head = ply_list_node_get_data (node);
+
+                if (head->clone_source != NULL && head->epoch == backend->heads_epoch)
+                        flush_head (backend, head);
+
+                node = ply_list_get_next_node (backend->heads, node);
+        }
+}
+
+static bool
+handle_change_event (ply_renderer_backend_t *backend)
+{
+        bool changed;
+
+        changed = update_heads (backend, true);
+
+        if (changed)
+                flush_new_clones (backend);
+
+        return changed;
+}
+
+static void
+probe_connectors (ply_renderer_backend_t *backend)
+{
+        int i;
+
+        /* The results are thrown away, the point is to get the kernel to
+         * refresh what it knows, so drmModeGetConnectorCurrent sees it */
+        for (i = 0; i < backend->number_of_connectors_to_probe; i++) {
+                drmModeConnector *connector;
+
+                connector = drmModeGetConnector (backend->device_fd, backend->connectors_to_probe[i]);
+                if (connector != NULL)
+                        drmModeFreeConnector (connector);
+        }
+}
+
+static void
+stop_probing_connectors (ply_renderer_backend_t *backend)
+{
+        if (backend->is_probing_connectors) {
+                ply_task_queue_cancel (ply_task_queue_get_default (),
+                                       (ply_task_handler_t) probe_connectors,
+                                       backend);
+                backend->is_probing_connectors = false;
+        }
+
+        free (backend->connectors_to_probe);
+        backend->connectors_to_probe = NULL;
+        backend->number_of_connectors_to_probe = 0;
+}
+
+static void
+on_connectors_probed (ply_renderer_backend_t *backend)
+{
+        backend->is_probing_connectors = false;
+        stop_probing_connectors (backend);
+
+        ply_trace ("Probed connectors that weren't lit, checking for new outputs");
+        if (!update_heads (backend, false))
+                return;
+
+        flush_new_clones (backend);
+
+        if (backend->heads_changed_handler != NULL)
+                backend->heads_changed_handler (backend->heads_changed_handler_user_data);
+}
+
+static void
+start_probing_connectors (ply_renderer_backend_t *backend)
+{
+        if (backend->connectors_to_probe == NULL || backend->is_probing_connectors)
+                return;
+
+        ply_trace ("Probing %d connectors that weren't lit", backend->number_of_connectors_to_probe);
+
+        backend->is_probing_connectors = true;
+        ply_task_queue_run (ply_task_queue_get_default (),
+                            (ply_task_handler_t) probe_connectors,
+                            (ply_task_handler_t) on_connectors_probed,
+                            backend);
+}
+
 static bool
 map_to_device (ply_renderer_backend_t *backend)
 {
@@ -1611,6 +2783,19 @@ unmap_from_device (ply_renderer_backend_t *backend)
         }
 }
 
+static void
+ply_renderer_head_reset_scan_out_buffer (ply_renderer_backend_t *backend,
+                                         ply_renderer_head_t    *head)
+{
+        if (backend->mode_sets_are_batched) {
+                head->mode_set_is_queued = true;
+                return;
+        }
+
+        ply_renderer_head_set_scan_out_buffer (backend, head,
+                                               head->scan_out_buffer_id);
+}
+
 static bool
 reset_scan_out_buffer_if_needed (ply_renderer_backend_t *backend,
                                  ply_renderer_head_t    *head)
@@ -1623,8 +2808,7 @@ reset_scan_out_buffer_if_needed (ply_renderer_backend_t *backend,
                         return false;
 
         if (head->scan_out_buffer_needs_reset) {
-                ply_renderer_head_set_scan_out_buffer (backend, head,
-                                                       head->scan_out_buffer_id);
+                ply_renderer_head_reset_scan_out_buffer (backend, head);
                 head->scan_out_buffer_needs_reset = false;
                 return true;
         }
@@ -1635,8 +2819,7 @@ reset_scan_out_buffer_if_needed (ply_renderer_backend_t *backend,
                 return false;
 
         if (controller->buffer_id != head->scan_out_buffer_id) {
-                ply_renderer_head_set_scan_out_buffer (backend, head,
-                                                       head->scan_out_buffer_id);
+                ply_renderer_head_reset_scan_out_buffer (backend, head);
                 did_reset = true;
         }
 
@@ -1645,30 +2828,96 @@ reset_scan_out_buffer_if_needed (ply_renderer_backend_t *backend,
         return did_reset;
 }
 
-static void
-flush_head (ply_renderer_backend_t *backend,
-            ply_renderer_head_t    *head)
-{
-        ply_rectangle_t *area_to_flush;
-        ply_region_t *updated_region;
-        ply_list_t *areas_to_flush;
-        ply_list_node_t *node;
-        ply_pixel_buffer_t *pixel_buffer;
+/* Brings the back buffer up to date and queues a flip to it.  Returns
+ * false if the flip has to be tried again on the next flush.
+ */
+static bool
+flush_head_with_page_flip (ply_renderer_backend_t *backend,
+                           ply_renderer_head_t    *head,
+                           ply_rectangle_t        *areas_to_flush,
+                           size_t                  number_of_areas_to_flush)
+{
+        ply_renderer_page_flip_t *page_flip;
+        ply_rectangle_t *stale_areas;
+        size_t number_of_stale_areas, i;
         char *map_address;
-        bool dirty = false;
+        uint32_t buffer_id;
 
-        assert (backend != NULL);
+        if (!head->draws_to_device || ply_renderer_head_draws_to_shadow (head)) {
+                for (i = 0; i < number_of_areas_to_flush; i++) {
+                        ply_tiled_region_add_rectangle (head->back_buffer_damage, &areas_to_flush[i]);
+                }
 
-        if (!backend->is_active)
-                return;
+                map_address = begin_flush (backend, head->back_buffer_id);
+                stale_areas = ply_tiled_region_get_rectangles (head->back_buffer_damage,
+                                                               &number_of_stale_areas);
+                for (i = 0; i < number_of_stale_areas; i++) {
+                        ply_renderer_head_flush_area (head, &stale_areas[i], map_address);
+                }
+        } else {
+                /* The back buffer has it all already, but is about to be
+                 * shown, so drawing can't stay there */
+                ply_renderer_head_move_to_shadow (head, areas_to_flush,
+                                                  number_of_areas_to_flush);
+        }
+        ply_tiled_region_clear (head->back_buffer_damage);
 
-        if (backend->terminal != NULL) {
-                ply_terminal_set_mode (backend->terminal, PLY_TERMINAL_MODE_GRAPHICS);
-                ply_terminal_set_unbuffered_input (backend->terminal);
+        page_flip = calloc (1, sizeof(ply_renderer_page_flip_t));
+        page_flip->backend = backend;
+        page_flip->controller_id = head->controller_id;
+
+        if (drmModePageFlip (backend->device_fd, head->controller_id,
+                             head->back_buffer_id, DRM_MODE_PAGE_FLIP_EVENT,
+                             page_flip) < 0) {
+                free (page_flip);
+
+                if (errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP) {
+                        /* Try again on the next flush, everything is
+                         * already in the back buffer */
+                        ply_trace ("Could not page flip %ldx%ld renderer head: %m",
+                                   head->area.width, head->area.height);
+                        return false;
+                }
+
+                /* Show the back buffer the old fashioned way, and stick to
+                 * single buffering from now on */
+                ply_trace ("Page flipping not supported, using a single buffer: %m");
+                backend->page_flips_unsupported = true;
+                ply_renderer_head_set_scan_out_buffer (backend, head, head->back_buffer_id);
+        } else {
+                head->page_flip_pending = true;
         }
-        pixel_buffer = head->pixel_buffer;
-        updated_region = ply_pixel_buffer_get_updated_areas (pixel_buffer);
-        areas_to_flush = ply_region_get_sorted_rectangle_list (updated_region);
+
+        buffer_id = head->scan_out_buffer_id;
+        head->scan_out_buffer_id = head->back_buffer_id;
+        head->back_buffer_id = buffer_id;
+
+        if (backend->page_flips_unsupported) {
+                ply_renderer_head_unmap_back_buffer (backend, head);
+                end_flush (backend, head->scan_out_buffer_id, NULL, 0);
+                return true;
+        }
+
+        /* The buffer that was just taken off the screen misses this frame */
+        for (i = 0; i < number_of_areas_to_flush; i++) {
+                ply_tiled_region_add_rectangle (head->back_buffer_damage, &areas_to_flush[i]);
+        }
+
+        return true;
+}
+
+/* Copies the damage the head hasn't shown yet into its scan-out buffer */
+static void
+flush_pending_damage (ply_renderer_backend_t *backend,
+                      ply_renderer_head_t    *head)
+{
+        ply_rectangle_t *areas_to_flush;
+        size_t number_of_areas_to_flush, i;
+        char *map_address;
+        bool will_page_flip;
+
+        areas_to_flush = ply_tiled_region_get_rectangles (head->pending_damage,
+                                                          &number_of_areas_to_flush);
 
         /* A hotplugged head may not be mapped yet, map it now. */
         if (!head->scan_out_buffer_id) {
@@ -1676,33 +2925,149 @@ flush_head (ply_renderer_backend_t *backend,
                         return;
         }
 
+        if (number_of_areas_to_flush == 0)
+                return;
+
+        /* Keep the damage around until the flip in flight lands */
+        if (head->page_flip_pending) {
+                ply_statistics_add_to_count ("renderer.drm.flushes-waiting-for-page-flip", 1);
+                return;
+        }
+
+        /* The first frame still needs a mode set, which goes through the
+         * front buffer like before */
+        will_page_flip = head->back_buffer_id != 0 && !head->scan_out_buffer_needs_reset &&
+                         (backend->terminal == NULL || ply_terminal_is_active (backend->terminal));
+
+        if (will_page_flip && ply_renderer_head_can_draw_to_device (backend, head))
+                ply_renderer_head_start_drawing_to_device (backend, head);
+        else
+                ply_renderer_head_stop_drawing_to_device (backend, head);
+
+        if (will_page_flip) {
+                if (flush_head_with_page_flip (backend, head, areas_to_flush,
+                                               number_of_areas_to_flush)) {
+                        ply_statistics_add_to_count ("renderer.drm.page-flips", 1);
+                        ply_tiled_region_clear (head->pending_damage);
+                }
+                ply_renderer_head_update_flush_statistics (head);
+                return;
+        }
+
         map_address = begin_flush (backend, head->scan_out_buffer_id);
 
-        node = ply_list_get_first_node (areas_to_flush);
+        for (i = 0; i < number_of_areas_to_flush; i++) {
+                ply_renderer_head_flush_area (head, &areas_to_flush[i], map_address);
+
+                if (head->back_buffer_id != 0)
+                        ply_tiled_region_add_rectangle (head->back_buffer_damage, &areas_to_flush[i]);
+        }
+
+        if (reset_scan_out_buffer_if_needed (backend, head))
+                ply_trace ("Needed to reset scan out buffer on %ldx%ld renderer head",
+                           head->area.width, head->area.height);
+
+        end_flush (backend, head->scan_out_buffer_id,
+                   areas_to_flush, number_of_areas_to_flush);
+
+        ply_tiled_region_clear (head->pending_damage);
+        ply_renderer_head_update_flush_statistics (head);
+}
+
+static inline unsigned long
+get_number_of_pixels (ply_rectangle_t *areas,
+                      size_t           number_of_areas)
+{
+        unsigned long number_of_pixels = 0;
+        size_t i;
+
+        for (i = 0; i < number_of_areas; i++) {
+                number_of_pixels += areas[i].width * areas[i].height;
+        }
+
+        return number_of_pixels;
+}
+
+static void
+flush_head (ply_renderer_backend_t *backend,
+            ply_renderer_head_t    *head)
+{
+        ply_tiled_region_t *updated_region;
+        ply_rectangle_t *updated_areas;
+        size_t number_of_updated_areas, i;
+        ply_list_node_t *node;
+
+        assert (backend != NULL);
+
+        if (!backend->is_active)
+                return;
+
+        if (backend->terminal != NULL) {
+                ply_terminal_set_mode (backend->terminal, PLY_TERMINAL_MODE_GRAPHICS);
+                ply_terminal_set_unbuffered_input (backend->terminal);
+        }
+
+        if (head->clone_source != NULL)
+                head = head->clone_source;
+
+        /* Hand the new drawing to every head showing this pixel buffer */
+        updated_region = ply_pixel_buffer_get_updated_areas (head->pixel_buffer);
+        updated_areas = ply_tiled_region_get_rectangles (updated_region,
+                                                         &number_of_updated_areas);
+        ply_trace_point (drm_flush_head_trace_point,
+                         number_of_updated_areas, head->controller_id);
+        ply_probe (renderer_flush_begin, head, number_of_updated_areas,
+                   get_number_of_pixels (updated_areas, number_of_updated_areas) * BYTES_PER_PIXEL);
+
+        node = ply_list_get_first_node (backend->heads);
         while (node != NULL) {
-                area_to_flush = (ply_rectangle_t *) ply_list_node_get_data (node);
+                ply_renderer_head_t *clone = ply_list_node_get_data (node);
 
-                ply_renderer_head_flush_area (head, area_to_flush, map_address);
-                dirty = true;
+                if (clone == head || clone->clone_source == head) {
+                        for (i = 0; i < number_of_updated_areas; i++) {
+                                ply_tiled_region_add_rectangle (clone->pending_damage,
+                                                                &updated_areas[i]);
+                        }
+                }
 
-                node = ply_list_get_next_node (areas_to_flush, node);
+                node = ply_list_get_next_node (backend->heads, node);
         }
 
-        if (dirty) {
-                if (reset_scan_out_buffer_if_needed (backend, head))
-                        ply_trace ("Needed to reset scan out buffer on %ldx%ld renderer head",
-                                   head->area.width, head->area.height);
+        ply_tiled_region_clear (updated_region);
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_renderer_head_t *clone = ply_list_node_get_data (node);
+
+                if (clone == head || clone->clone_source == head)
+                        flush_pending_damage (backend, clone);
 
-                end_flush (backend, head->scan_out_buffer_id);
+                node = ply_list_get_next_node (backend->heads, node);
         }
 
-        ply_region_clear (updated_region);
+        ply_probe (renderer_flush_end, head);
+
+        /* The first frame is out, now the slow probing can happen */
+        start_probing_connectors (backend);
+}
+
+static ply_renderer_capabilities_t
+get_head_capabilities (ply_renderer_backend_t *backend,
+                       ply_renderer_head_t    *head)
+{
+        if (head->clone_source != NULL)
+                head = head->clone_source;
+
+        if (head->draws_to_device)
+                return PLY_RENDERER_CAPABILITY_DIRECT_SCAN_OUT;
+
+        return PLY_RENDERER_CAPABILITY_NONE;
 }
 
 static ply_list_t *
 get_heads (ply_renderer_backend_t *backend)
 {
-        return backend->heads;
+        return backend->rendered_heads;
 }
 
 static ply_pixel_buffer_t *
@@ -1715,6 +3080,259 @@ get_buffer_for_head (ply_renderer_backend_t *backend,
         return head->pixel_buffer;
 }
 
+static bool
+set_cursor_on_head_and_clones (ply_renderer_backend_t *backend,
+                               ply_renderer_plane_t   *plane,
+                               ply_renderer_buffer_t  *buffer)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_renderer_head_t *head = ply_list_node_get_data (node);
+
+                node = ply_list_get_next_node (backend->heads, node);
+
+                if (head != plane->head && head->clone_source != plane->head)
+                        continue;
+
+                if (drmModeSetCursor (backend->device_fd, head->controller_id,
+                                      buffer != NULL ? buffer->handle : 0,
+                                      buffer != NULL ? plane->width : 0,
+                                      buffer != NULL ? plane->height : 0) < 0) {
+                        ply_trace ("Could not set cursor on controller %u: %m",
+                                   head->controller_id);
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static bool
+move_cursor_on_head_and_clones (ply_renderer_backend_t *backend,
+                                ply_renderer_plane_t   *plane)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_renderer_head_t *head = ply_list_node_get_data (node);
+
+                node = ply_list_get_next_node (backend->heads, node);
+
+                if (head != plane->head && head->clone_source != plane->head)
+                        continue;
+
+                if (drmModeMoveCursor (backend->device_fd, head->controller_id,
+                                       plane->x, plane->y) < 0) {
+                        ply_trace ("Could not move cursor on controller %u: %m",
+                                   head->controller_id);
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static void
+ply_renderer_plane_remove_images (ply_renderer_backend_t *backend,
+                                  ply_renderer_plane_t   *plane)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (plane->images);
+        while (node != NULL) {
+                ply_renderer_plane_image_t *plane_image = ply_list_node_get_data (node);
+
+                ply_renderer_buffer_free (backend, plane_image->buffer);
+                ply_pixel_buffer_free (plane_image->image);
+                free (plane_image);
+
+                node = ply_list_get_next_node (plane->images, node);
+        }
+        ply_list_remove_all_nodes (plane->images);
+        plane->shown_image = NULL;
+}
+
+/* For when the plane's head goes away before the plane does */
+static void
+ply_renderer_plane_detach (ply_renderer_backend_t *backend,
+                           ply_renderer_plane_t   *plane)
+{
+        ply_renderer_plane_remove_images (backend, plane);
+        plane->head->plane = NULL;
+        plane->head = NULL;
+}
+
+static ply_renderer_plane_t *
+create_plane (ply_renderer_backend_t *backend,
+              ply_renderer_head_t    *head,
+              unsigned long           width,
+              unsigned long           height)
+{
+        ply_renderer_plane_t *plane;
+        uint64_t cursor_width, cursor_height;
+
+        if (head->backend != backend || head->plane != NULL)
+                return NULL;
+
+        if (drmGetCap (backend->device_fd, DRM_CAP_CURSOR_WIDTH, &cursor_width) != 0 ||
+            cursor_width == 0)
+                cursor_width = DEFAULT_CURSOR_SIZE;
+
+        if (drmGetCap (backend->device_fd, DRM_CAP_CURSOR_HEIGHT, &cursor_height) != 0 ||
+            cursor_height == 0)
+                cursor_height = DEFAULT_CURSOR_SIZE;
+
+        if (width == 0 || height == 0 || width > cursor_width || height > cursor_height) {
+                ply_trace ("%lux%lu image does not fit in %ux%u cursor",
+                           width, height, (unsigned) cursor_width, (unsigned) cursor_height);
+                return NULL;
+        }
+
+        plane = calloc (1, sizeof(ply_renderer_plane_t));
+        plane->head = head;
+        plane->width = cursor_width;
+        plane->height = cursor_height;
+        plane->images = ply_list_new ();
+
+        head->plane = plane;
+
+        return plane;
+}
+
+static void
+hide_plane (ply_renderer_backend_t *backend,
+            ply_renderer_plane_t   *plane)
+{
+        if (plane->head == NULL || plane->shown_image == NULL)
+                return;
+
+        if (backend->is_active)
+                set_cursor_on_head_and_clones (backend, plane, NULL);
+
+        plane->shown_image = NULL;
+}
+
+static void
+free_plane (ply_renderer_backend_t *backend,
+            ply_renderer_plane_t   *plane)
+{
+        if (plane->head != NULL) {
+                hide_plane (backend, plane);
+                ply_renderer_plane_detach (backend, plane);
+        }
+
+        ply_list_free (plane->images);
+        free (plane);
+}
+
+static ply_renderer_plane_image_t *
+ply_renderer_plane_upload_image (ply_renderer_backend_t *backend,
+                                 ply_renderer_plane_t   *plane,
+                                 ply_pixel_buffer_t     *image)
+{
+        ply_renderer_plane_image_t *plane_image;
+        ply_list_node_t *node;
+        unsigned long width, height, row;
+        uint32_t *image_data;
+        char *map_address;
+
+        node = ply_list_get_first_node (plane->images);
+        while (node != NULL) {
+                plane_image = ply_list_node_get_data (node);
+
+                if (plane_image->image == image) {
+                        ply_list_remove_node (plane->images, node);
+                        ply_list_prepend_data (plane->images, plane_image);
+                        return plane_image;
+                }
+
+                node = ply_list_get_next_node (plane->images, node);
+        }
+
+        if (ply_list_get_length (plane->images) >= MAX_PLANE_IMAGES) {
+                node = ply_list_get_last_node (plane->images);
+                plane_image = ply_list_node_get_data (node);
+                ply_list_remove_node (plane->images, node);
+
+                if (plane_image == plane->shown_image)
+                        plane->shown_image = NULL;
+
+                ply_pixel_buffer_free (plane_image->image);
+        } else {
+                plane_image = calloc (1, sizeof(ply_renderer_plane_image_t));
+                plane_image->buffer = ply_renderer_buffer_new (backend, plane->width, plane->height);
+
+                if (plane_image->buffer == NULL ||
+                    !ply_renderer_buffer_map (backend, plane_image->buffer)) {
+                        if (plane_image->buffer != NULL)
+                                ply_renderer_buffer_free (backend, plane_image->buffer);
+                        free (plane_image);
+                        return NULL;
+                }
+        }
+
+        plane_image->image = ply_pixel_buffer_ref (image);
+
+        width = MIN (ply_pixel_buffer_get_width (image), plane->width);
+        height = MIN (ply_pixel_buffer_get_height (image), plane->height);
+        image_data = ply_pixel_buffer_get_argb32_data (image);
+        map_address = plane_image->buffer->map_address;
+
+        memset (map_address, 0, plane_image->buffer->map_size);
+        for (row = 0; row < height; row++) {
+                memcpy (map_address + row * plane_image->buffer->row_stride,
+                        image_data + row * ply_pixel_buffer_get_width (image),
+                        width * BYTES_PER_PIXEL);
+        }
+
+        ply_list_prepend_data (plane->images, plane_image);
+
+        return plane_image;
+}
+
+static bool
+show_image_on_plane (ply_renderer_backend_t *backend,
+                     ply_renderer_plane_t   *plane,
+                     ply_pixel_buffer_t     *image,
+                     long                    x,
+                     long                    y)
+{
+        ply_renderer_plane_image_t *plane_image;
+        bool needs_move;
+
+        if (plane->head == NULL)
+                return false;
+
+        /* Nothing gets shown while someone else has the device, activating
+         * puts the cursor back on the next frame */
+        if (!backend->is_active || (backend->terminal != NULL &&
+                                    !ply_terminal_is_active (backend->terminal)))
+                return true;
+
+        plane_image = ply_renderer_plane_upload_image (backend, plane, image);
+        if (plane_image == NULL)
+                return false;
+
+        needs_move = plane->shown_image == NULL || plane->x != x || plane->y != y;
+        plane->x = x;
+        plane->y = y;
+
+        if (needs_move && !move_cursor_on_head_and_clones (backend, plane))
+                return false;
+
+        if (plane_image != plane->shown_image) {
+                if (!set_cursor_on_head_and_clones (backend, plane, plane_image->buffer))
+                        return false;
+
+                plane->shown_image = plane_image;
+        }
+
+        return true;
+}
+
 static bool
 has_input_source (ply_renderer_backend_t      *backend,
                   ply_renderer_input_source_t *input_source)
@@ -1832,6 +3450,181 @@ get_keymap (ply_renderer_backend_t *backend)
         return ply_terminal_get_keymap (backend->terminal);
 }
 
+static void
+set_handler_for_heads_changed (ply_renderer_backend_t                      *backend,
+                               ply_renderer_backend_heads_changed_handler_t handler,
+                               void                                        *user_data)
+{
+        backend->heads_changed_handler = handler;
+        backend->heads_changed_handler_user_data = user_data;
+}
+
+static uint32_t
+get_head_epoch (ply_renderer_backend_t *backend,
+                ply_renderer_head_t    *head)
+{
+        return head->epoch;
+}
+
+static bool
+capture_console_contents (ply_renderer_backend_t *backend,
+                          ply_renderer_head_t    *head)
+{
+        struct drm_mode_map_dumb map_dumb_buffer_request;
+        struct drm_gem_close gem_close_request;
+        drmModeCrtc *controller;
+        drmModeFB2 *console_buffer;
+        ply_rectangle_t area;
+        uint32_t buffer_id;
+        uint32_t *shadow;
+        char *map_address;
+        size_t map_size;
+        unsigned long row;
+        bool captured = false;
+
+        if (ply_pixel_buffer_get_device_rotation (head->pixel_buffer) != PLY_PIXEL_BUFFER_ROTATE_UPRIGHT)
+                return false;
+
+        controller = drmModeGetCrtc (backend->device_fd, head->controller_id);
+        if (controller == NULL)
+                return false;
+
+        buffer_id = controller->buffer_id;
+        drmModeFreeCrtc (controller);
+
+        /* Nothing to carry over, or we're already showing our own buffer */
+        if (buffer_id == 0 ||
+            buffer_id == head->scan_out_buffer_id ||
+            buffer_id == head->back_buffer_id)
+                return false;
+
+        console_buffer = drmModeGetFB2 (backend->device_fd, buffer_id);
+        if (console_buffer == NULL) {
+                ply_trace ("Could not look up console buffer %u: %m", buffer_id);
+                return false;
+        }
+
+        if (console_buffer->handles[0] == 0 ||
+            console_buffer->width != head->area.width ||
+            console_buffer->height != head->area.height ||
+            (console_buffer->pixel_format != DRM_FORMAT_XRGB8888 &&
+             console_buffer->pixel_format != DRM_FORMAT_ARGB8888) ||
+            ((console_buffer->flags & DRM_MODE_FB_MODIFIERS) &&
+             console_buffer->modifier != DRM_FORMAT_MOD_LINEAR)) {
+                ply_trace ("Console buffer %u can't be carried over", buffer_id);
+                goto out;
+        }
+
+        memset (&map_dumb_buffer_request, 0, sizeof(struct drm_mode_map_dumb));
+        map_dumb_buffer_request.handle = console_buffer->handles[0];
+        if (drmIoctl (backend->device_fd, DRM_IOCTL_MODE_MAP_DUMB, &map_dumb_buffer_request) < 0) {
+                ply_trace ("Could not map console buffer %u: %m", buffer_id);
+                goto out;
+        }
+
+        map_size = console_buffer->offsets[0] + (size_t) console_buffer->pitches[0] * console_buffer->height;
+        map_address = mmap (0, map_size, PROT_READ, MAP_SHARED,
+                            backend->device_fd, map_dumb_buffer_request.offset);
+        if (map_address == MAP_FAILED) {
+                ply_trace ("Could not map console buffer %u: %m", buffer_id);
+                goto out;
+        }
+
+        shadow = ply_pixel_buffer_get_argb32_data (head->pixel_buffer);
+        for (row = 0; row < head->area.height; row++) {
+                uint32_t *source, *destination;
+                unsigned long column;
+
+                source = (uint32_t *) (map_address + console_buffer->offsets[0] + row * console_buffer->pitches[0]);
+                destination = shadow + row * head->area.width;
+
+                memcpy (destination, source, head->area.width * BYTES_PER_PIXEL);
+
+                /* Whatever is in the X channel, the screen shows it opaque */
+                for (column = 0; column < head->area.width; column++) {
+                        destination[column] |= 0xff000000;
+                }
+        }
+        munmap (map_address, map_size);
+
+        /* All of it has to make it into the scan-out buffer before that
+         * replaces the console buffer on screen */
+        area.x = 0;
+        area.y = 0;
+        area.width = head->area.width;
+        area.height = head->area.height;
+        ply_tiled_region_add_rectangle (ply_pixel_buffer_get_updated_areas (head->pixel_buffer), &area);
+
+        ply_trace ("Carried over console buffer %u for %ldx%ld renderer head",
+                   buffer_id, head->area.width, head->area.height);
+        captured = true;
+out:
+        memset (&gem_close_request, 0, sizeof(struct drm_gem_close));
+        gem_close_request.handle = console_buffer->handles[0];
+        if (gem_close_request.handle != 0)
+                drmIoctl (backend->device_fd, DRM_IOCTL_GEM_CLOSE, &gem_close_request);
+
+        drmModeFreeFB2 (console_buffer);
+
+        return captured;
+}
+
+static bool
+watch_for_vblank (ply_renderer_backend_t       *backend,
+                  unsigned int                  vblanks_from_now,
+                  ply_renderer_vblank_handler_t handler,
+                  void                         *user_data)
+{
+        ply_renderer_vblank_t *vblank;
+        ply_renderer_head_t *head = NULL;
+        ply_list_node_t *node;
+        drmVBlank request;
+
+        if (!backend->is_active)
+                return false;
+
+        if (backend->terminal != NULL && !ply_terminal_is_active (backend->terminal))
+                return false;
+
+        /* Any lit head will do, cloned heads scan out in step anyway */
+        node = ply_list_get_first_node (backend->rendered_heads);
+        while (node != NULL) {
+                ply_renderer_head_t *rendered_head = ply_list_node_get_data (node);
+
+                if (rendered_head->scan_out_buffer_id != 0) {
+                        head = rendered_head;
+                        break;
+                }
+
+                node = ply_list_get_next_node (backend->rendered_heads, node);
+        }
+
+        if (head == NULL)
+                return false;
+
+        vblank = calloc (1, sizeof(ply_renderer_vblank_t));
+        vblank->handler = handler;
+        vblank->user_data = user_data;
+
+        memset (&request, 0, sizeof(request));
+        request.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+        if (head->pipe == 1)
+                request.request.type |= DRM_VBLANK_SECONDARY;
+        else if (head->pipe > 1)
+                request.request.type |= (head->pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) &
+                                        DRM_VBLANK_HIGH_CRTC_MASK;
+        request.request.sequence = vblanks_from_now;
+        request.request.signal = (unsigned long) vblank;
+
+        if (drmWaitVBlank (backend->device_fd, &request) != 0) {
+                ply_trace ("Couldn't wait for vblank on controller %u: %m", head->controller_id);
+                free (vblank);
+                return false;
+        }
+
+        return true;
+}
+
 ply_renderer_plugin_interface_t *
 ply_renderer_backend_get_interface (void)
 {
@@ -1858,6 +3651,16 @@ ply_renderer_backend_get_interface (void)
                 .get_panel_properties         = get_panel_properties,
                 .get_capslock_state           = get_capslock_state,
                 .get_keymap                   = get_keymap,
+                .create_plane                 = create_plane,
+                .free_plane                   = free_plane,
+                .show_image_on_plane          = show_image_on_plane,
+                .hide_plane                   = hide_plane,
+                .watch_for_vblank             = watch_for_vblank,
+                .set_handler_for_heads_changed = set_handler_for_heads_changed,
+                .capture_console_contents     = capture_console_contents,
+                .get_head_epoch               = get_head_epoch,
+                .get_head_capabilities        = get_head_capabilities,
+                .hand_over                    = hand_over,
         };
 
         return &plugin_interface;
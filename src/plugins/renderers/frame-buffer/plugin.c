@@ -48,15 +48,21 @@
 #include "ply-event-loop.h"
 #include "ply-list.h"
 #include "ply-logger.h"
+#include "ply-probes.h"
 #include "ply-rectangle.h"
-#include "ply-region.h"
+#include "ply-statistics.h"
+#include "ply-tiled-region.h"
 #include "ply-terminal.h"
+#include "ply-trace-points.h"
 
 #include "ply-renderer.h"
 #include "ply-renderer-plugin.h"
 
 #ifndef PLY_FRAME_BUFFER_DEFAULT_FB_DEVICE_NAME
 #define PLY_FRAME_BUFFER_DEFAULT_FB_DEVICE_NAME "/dev/fb0"
+
+PLY_DEFINE_TRACE_POINT (frame_buffer_flush_head_trace_point,
+                        "frame-buffer: flushing %d pixels in %d areas");
 #endif
 
 struct _ply_renderer_head
@@ -65,6 +71,11 @@ struct _ply_renderer_head
         ply_rectangle_t     area;
         char               *map_address;
         size_t              size;
+
+        /* the half of the mapping flushes go to; while double buffering
+         * this is the one not being scanned out
+         */
+        char               *draw_address;
 };
 
 struct _ply_renderer_input_source
@@ -78,6 +89,13 @@ struct _ply_renderer_input_source
         void                               *user_data;
 };
 
+typedef void (*ply_renderer_row_converter_t) (ply_renderer_backend_t *backend,
+                                              const uint32_t         *source,
+                                              char                   *destination,
+                                              unsigned long           x,
+                                              unsigned long           y,
+                                              unsigned long           width);
+
 struct _ply_renderer_backend
 {
         ply_event_loop_t           *loop;
@@ -106,12 +124,22 @@ struct _ply_renderer_backend
 
         unsigned int                bytes_per_pixel;
         unsigned int                row_stride;
+        char                       *row_buffer;
+
+        struct fb_var_screeninfo    screen_info;
+        struct fb_var_screeninfo    original_screen_info;
+        ply_tiled_region_t         *back_buffer_damage;
 
         uint32_t                    is_active : 1;
+        uint32_t                    should_dither : 1;
+        uint32_t                    is_double_buffered : 1;
+        uint32_t                    has_resized_virtual_screen : 1;
+        uint32_t                    front_buffer : 1;
 
         void                        (*flush_area) (ply_renderer_backend_t *backend,
                                                    ply_renderer_head_t    *head,
                                                    ply_rectangle_t        *area_to_flush);
+        ply_renderer_row_converter_t convert_row;
 };
 
 ply_renderer_plugin_interface_t *ply_renderer_backend_get_interface (void);
@@ -201,7 +229,7 @@ flush_area_to_any_device (ply_renderer_backend_t *backend,
                 }
 
                 offset = row * backend->row_stride + x1 * backend->bytes_per_pixel;
-                memcpy (head->map_address + offset, row_backend + x1 * backend->bytes_per_pixel,
+                memcpy (head->draw_address + offset, row_backend + x1 * backend->bytes_per_pixel,
                         area_to_flush->width * backend->bytes_per_pixel);
         }
         free (row_backend);
@@ -222,7 +250,7 @@ flush_area_to_xrgb32_device (ply_renderer_backend_t *backend,
 
         shadow_buffer = ply_pixel_buffer_get_argb32_data (backend->head.pixel_buffer);
 
-        dst = &head->map_address[y1 * backend->row_stride + x * backend->bytes_per_pixel];
+        dst = &head->draw_address[y1 * backend->row_stride + x * backend->bytes_per_pixel];
         src = (char *) &shadow_buffer[y1 * head->area.width + x];
 
         if (area_to_flush->width * 4 == backend->row_stride &&
@@ -238,6 +266,195 @@ flush_area_to_xrgb32_device (ply_renderer_backend_t *backend,
         }
 }
 
+/* 4x4 Bayer matrix for ordered dithering.  Unlike error diffusion, the
+ * offset added to each pixel only depends on where it is on screen, so
+ * rows can be converted independently and a partial flush dithers the
+ * same way a full redraw does.
+ */
+static const uint8_t dither_matrix[4][4] =
+{
+        {  0,  8,  2, 10 },
+        { 12,  4, 14,  6 },
+        {  3, 11,  1,  9 },
+        { 15,  7, 13,  5 },
+};
+
+static void
+convert_row_to_rgb565 (ply_renderer_backend_t *backend,
+                       const uint32_t         *source,
+                       char                   *destination,
+                       unsigned long           x,
+                       unsigned long           y,
+                       unsigned long           width)
+{
+        uint16_t *pixels = (uint16_t *) destination;
+        unsigned long i;
+
+        if (!backend->should_dither) {
+                for (i = 0; i < width; i++) {
+                        uint32_t pixel_value = source[i];
+
+                        pixels[i] = ((pixel_value >> 8) & 0xf800)
+                                    | ((pixel_value >> 5) & 0x07e0)
+                                    | ((pixel_value >> 3) & 0x001f);
+                }
+                return;
+        }
+
+        for (i = 0; i < width; i++) {
+                uint32_t pixel_value = source[i];
+                uint_fast32_t threshold, r, g, b;
+
+                threshold = dither_matrix[y & 3][(x + i) & 3];
+
+                /* 5 bit channels lose 3 bits, so spread the threshold over
+                 * 0-7, and over 0-3 for the 6 bit green channel
+                 */
+                r = MIN (((pixel_value >> 16) & 0xff) + (threshold >> 1), 255);
+                g = MIN (((pixel_value >> 8) & 0xff) + (threshold >> 2), 255);
+                b = MIN ((pixel_value & 0xff) + (threshold >> 1), 255);
+
+                pixels[i] = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+        }
+}
+
+static void
+convert_row_to_rgb888 (ply_renderer_backend_t *backend,
+                       const uint32_t         *source,
+                       char                   *destination,
+                       unsigned long           x,
+                       unsigned long           y,
+                       unsigned long           width)
+{
+        uint8_t *bytes = (uint8_t *) destination;
+        unsigned long i;
+
+        for (i = 0; i < width; i++) {
+                uint32_t pixel_value = source[i];
+
+                bytes[0] = pixel_value;
+                bytes[1] = pixel_value >> 8;
+                bytes[2] = pixel_value >> 16;
+                bytes += 3;
+        }
+}
+
+static void
+convert_row_to_bgr888 (ply_renderer_backend_t *backend,
+                       const uint32_t         *source,
+                       char                   *destination,
+                       unsigned long           x,
+                       unsigned long           y,
+                       unsigned long           width)
+{
+        uint8_t *bytes = (uint8_t *) destination;
+        unsigned long i;
+
+        for (i = 0; i < width; i++) {
+                uint32_t pixel_value = source[i];
+
+                bytes[0] = pixel_value >> 16;
+                bytes[1] = pixel_value >> 8;
+                bytes[2] = pixel_value;
+                bytes += 3;
+        }
+}
+
+static void
+convert_row_to_xbgr8888 (ply_renderer_backend_t *backend,
+                         const uint32_t         *source,
+                         char                   *destination,
+                         unsigned long           x,
+                         unsigned long           y,
+                         unsigned long           width)
+{
+        uint32_t *pixels = (uint32_t *) destination;
+        unsigned long i;
+
+        for (i = 0; i < width; i++) {
+                uint32_t pixel_value = source[i];
+
+                pixels[i] = (pixel_value & 0xff00ff00)
+                            | ((pixel_value >> 16) & 0xff)
+                            | ((pixel_value & 0xff) << 16);
+        }
+}
+
+static void
+flush_area_with_row_converter (ply_renderer_backend_t *backend,
+                               ply_renderer_head_t    *head,
+                               ply_rectangle_t        *area_to_flush)
+{
+        unsigned long x, y, y1, y2;
+        uint32_t *shadow_buffer;
+        size_t row_size;
+        char *dst;
+
+        x = area_to_flush->x;
+        y1 = area_to_flush->y;
+        y2 = y1 + area_to_flush->height;
+        row_size = area_to_flush->width * backend->bytes_per_pixel;
+
+        shadow_buffer = ply_pixel_buffer_get_argb32_data (backend->head.pixel_buffer);
+        dst = &head->draw_address[y1 * backend->row_stride + x * backend->bytes_per_pixel];
+
+        /* Build each row in system memory and write it out in one go, since
+         * device memory is often uncached and byte wide writes to it are slow
+         */
+        for (y = y1; y < y2; y++) {
+                backend->convert_row (backend, &shadow_buffer[y * head->area.width + x],
+                                      backend->row_buffer, x, y, area_to_flush->width);
+                memcpy (dst, backend->row_buffer, row_size);
+                dst += backend->row_stride;
+        }
+}
+
+static bool
+has_channel_layout (ply_renderer_backend_t *backend,
+                    unsigned int            bytes_per_pixel,
+                    uint32_t                red_bit_position,
+                    uint32_t                bits_for_red,
+                    uint32_t                green_bit_position,
+                    uint32_t                bits_for_green,
+                    uint32_t                blue_bit_position,
+                    uint32_t                bits_for_blue)
+{
+        return backend->bytes_per_pixel == bytes_per_pixel &&
+               backend->red_bit_position == red_bit_position &&
+               backend->bits_for_red == bits_for_red &&
+               backend->green_bit_position == green_bit_position &&
+               backend->bits_for_green == bits_for_green &&
+               backend->blue_bit_position == blue_bit_position &&
+               backend->bits_for_blue == bits_for_blue;
+}
+
+static ply_renderer_row_converter_t
+find_row_converter (ply_renderer_backend_t *backend)
+{
+        if (has_channel_layout (backend, 2, 11, 5, 5, 6, 0, 5)) {
+                ply_trace ("using RGB565 row converter%s",
+                           backend->should_dither ? " with dithering" : "");
+                return convert_row_to_rgb565;
+        }
+
+        if (has_channel_layout (backend, 3, 16, 8, 8, 8, 0, 8)) {
+                ply_trace ("using RGB888 row converter");
+                return convert_row_to_rgb888;
+        }
+
+        if (has_channel_layout (backend, 3, 0, 8, 8, 8, 16, 8)) {
+                ply_trace ("using BGR888 row converter");
+                return convert_row_to_bgr888;
+        }
+
+        if (has_channel_layout (backend, 4, 0, 8, 8, 8, 16, 8)) {
+                ply_trace ("using XBGR8888 row converter");
+                return convert_row_to_xbgr8888;
+        }
+
+        return NULL;
+}
+
 static ply_renderer_backend_t *
 create_backend (const char     *device_name,
                 ply_terminal_t *terminal)
@@ -273,6 +490,7 @@ initialize_head (ply_renderer_backend_t *backend,
                    head->area.width, head->area.height);
         head->pixel_buffer = ply_pixel_buffer_new (head->area.width,
                                                    head->area.height);
+        ply_pixel_buffer_set_owner (head->pixel_buffer, "display");
         ply_pixel_buffer_fill_with_color (backend->head.pixel_buffer, NULL,
                                           0.0, 0.0, 0.0, 1.0);
         ply_list_append_data (backend->heads, head);
@@ -382,9 +600,24 @@ close_device (ply_renderer_backend_t *backend)
         }
         uninitialize_head (backend, &backend->head);
 
+        if (backend->has_resized_virtual_screen) {
+                ply_trace ("restoring original virtual screen size");
+                backend->original_screen_info.activate = FB_ACTIVATE_NOW;
+                ioctl (backend->device_fd, FBIOPUT_VSCREENINFO, &backend->original_screen_info);
+                backend->has_resized_virtual_screen = false;
+        }
+
+        ply_tiled_region_free (backend->back_buffer_damage);
+        backend->back_buffer_damage = NULL;
+        backend->is_double_buffered = false;
+
         close (backend->device_fd);
         backend->device_fd = -1;
 
+        free (backend->row_buffer);
+        backend->row_buffer = NULL;
+        backend->convert_row = NULL;
+
         backend->bytes_per_pixel = 0;
         backend->head.area.x = 0;
         backend->head.area.y = 0;
@@ -414,6 +647,62 @@ static const char *get_visual_name (int visual)
         return visuals[visual];
 }
 
+/* Scanning out of one half of a double height virtual screen while
+ * drawing into the other, then panning between them, keeps fades from
+ * tearing on devices like efifb and simplefb that have no other way to
+ * flip.
+ */
+static bool
+set_up_double_buffering (ply_renderer_backend_t   *backend,
+                         struct fb_var_screeninfo *variable_screen_info,
+                         struct fb_fix_screeninfo *fixed_screen_info)
+{
+        struct fb_var_screeninfo double_height_screen_info;
+
+        if (ply_kernel_command_line_has_argument ("plymouth.fbdev-single-buffer")) {
+                ply_trace ("double buffering disabled on kernel command line");
+                return false;
+        }
+
+        if (fixed_screen_info->ypanstep == 0 ||
+            variable_screen_info->yres % fixed_screen_info->ypanstep != 0) {
+                ply_trace ("device can't pan by a whole screen, not double buffering");
+                return false;
+        }
+
+        if (variable_screen_info->yres_virtual < 2 * variable_screen_info->yres) {
+                if (fixed_screen_info->smem_len < 2 * variable_screen_info->yres * fixed_screen_info->line_length) {
+                        ply_trace ("not enough video memory for double buffering");
+                        return false;
+                }
+
+                double_height_screen_info = *variable_screen_info;
+                double_height_screen_info.yres_virtual = 2 * variable_screen_info->yres;
+                double_height_screen_info.yoffset = 0;
+                double_height_screen_info.activate = FB_ACTIVATE_NOW;
+
+                if (ioctl (backend->device_fd, FBIOPUT_VSCREENINFO, &double_height_screen_info) < 0) {
+                        ply_trace ("could not grow virtual screen for double buffering: %m");
+                        return false;
+                }
+
+                backend->original_screen_info = *variable_screen_info;
+                backend->has_resized_virtual_screen = true;
+
+                if (ioctl (backend->device_fd, FBIOGET_VSCREENINFO, variable_screen_info) < 0 ||
+                    ioctl (backend->device_fd, FBIOGET_FSCREENINFO, fixed_screen_info) < 0)
+                        return false;
+        }
+
+        if (variable_screen_info->yres_virtual < 2 * variable_screen_info->yres ||
+            fixed_screen_info->smem_len < 2 * variable_screen_info->yres * fixed_screen_info->line_length) {
+                ply_trace ("virtual screen is too small for double buffering");
+                return false;
+        }
+
+        return true;
+}
+
 static bool
 query_device (ply_renderer_backend_t *backend)
 {
@@ -474,11 +763,35 @@ query_device (ply_renderer_backend_t *backend)
                 return false;
         }
 
+        backend->is_double_buffered = set_up_double_buffering (backend,
+                                                               &variable_screen_info,
+                                                               &fixed_screen_info);
+
+        if (!backend->is_double_buffered && backend->has_resized_virtual_screen) {
+                backend->original_screen_info.activate = FB_ACTIVATE_NOW;
+                ioctl (backend->device_fd, FBIOPUT_VSCREENINFO, &backend->original_screen_info);
+                backend->has_resized_virtual_screen = false;
+
+                if (ioctl (backend->device_fd, FBIOGET_VSCREENINFO, &variable_screen_info) < 0 ||
+                    ioctl (backend->device_fd, FBIOGET_FSCREENINFO, &fixed_screen_info) < 0)
+                        return false;
+        }
+
+        backend->screen_info = variable_screen_info;
+
         backend->head.area.x = variable_screen_info.xoffset;
         backend->head.area.y = variable_screen_info.yoffset;
         backend->head.area.width = variable_screen_info.xres;
         backend->head.area.height = variable_screen_info.yres;
 
+        if (backend->is_double_buffered) {
+                ply_trace ("double buffering with a %ux%u virtual screen",
+                           variable_screen_info.xres_virtual,
+                           variable_screen_info.yres_virtual);
+                backend->front_buffer = variable_screen_info.yoffset >= variable_screen_info.yres;
+                backend->head.area.y = 0;
+        }
+
         backend->red_bit_position = variable_screen_info.red.offset;
         backend->bits_for_red = variable_screen_info.red.length;
 
@@ -507,19 +820,57 @@ query_device (ply_renderer_backend_t *backend)
 
         backend->head.size = backend->head.area.height * backend->row_stride;
 
-        if (backend->bytes_per_pixel == 4 &&
-            backend->red_bit_position == 16 && backend->bits_for_red == 8 &&
-            backend->green_bit_position == 8 && backend->bits_for_green == 8 &&
-            backend->blue_bit_position == 0 && backend->bits_for_blue == 8)
+        if (backend->is_double_buffered) {
+                backend->head.size *= 2;
+                backend->back_buffer_damage = ply_tiled_region_new (backend->head.area.width,
+                                                                    backend->head.area.height);
+        }
+
+        backend->should_dither = !ply_kernel_command_line_has_argument ("plymouth.no-dither");
+
+        if (has_channel_layout (backend, 4, 16, 8, 8, 8, 0, 8)) {
                 backend->flush_area = flush_area_to_xrgb32_device;
-        else
-                backend->flush_area = flush_area_to_any_device;
+        } else {
+                backend->convert_row = find_row_converter (backend);
+
+                if (backend->convert_row != NULL) {
+                        free (backend->row_buffer);
+                        backend->row_buffer = malloc (backend->row_stride);
+                        backend->flush_area = flush_area_with_row_converter;
+                } else {
+                        backend->flush_area = flush_area_to_any_device;
+                }
+        }
 
         initialize_head (backend, &backend->head);
 
         return true;
 }
 
+static bool
+pan_to_buffer (ply_renderer_backend_t *backend,
+               int                     buffer)
+{
+        uint32_t crtc = 0;
+
+        backend->screen_info.yoffset = buffer * backend->screen_info.yres;
+
+        if (ioctl (backend->device_fd, FBIOPAN_DISPLAY, &backend->screen_info) < 0) {
+                ply_trace ("could not pan display: %m");
+                return false;
+        }
+
+        /* The pan only takes effect at the next vblank, so wait for it
+         * before drawing into the buffer that is now hidden.  Not every
+         * driver can, in which case we may tear occasionally but still
+         * much less than drawing to the visible buffer.
+         */
+        ioctl (backend->device_fd, FBIO_WAITFORVSYNC, &crtc);
+
+        backend->front_buffer = buffer;
+        return true;
+}
+
 static bool
 map_to_device (ply_renderer_backend_t *backend)
 {
@@ -539,6 +890,10 @@ map_to_device (ply_renderer_backend_t *backend)
                 return false;
         }
 
+        head->draw_address = head->map_address;
+        if (backend->is_double_buffered && !backend->front_buffer)
+                head->draw_address += head->size / 2;
+
         if (backend->terminal != NULL) {
                 if (ply_terminal_is_active (backend->terminal)) {
                         ply_trace ("already on right vt, activating");
@@ -563,20 +918,69 @@ unmap_from_device (ply_renderer_backend_t *backend)
 
         ply_trace ("unmapping device");
         if (head->map_address != MAP_FAILED) {
+                /* leave the console scanning out of the top half, the way
+                 * it was before we started flipping
+                 */
+                if (backend->is_double_buffered && backend->front_buffer) {
+                        memcpy (head->map_address, head->map_address + head->size / 2, head->size / 2);
+                        pan_to_buffer (backend, 0);
+                }
+
                 munmap (head->map_address, head->size);
                 head->map_address = MAP_FAILED;
         }
 }
 
 static void
-flush_head (ply_renderer_backend_t *backend,
-            ply_renderer_head_t    *head)
+flush_head_to_back_buffer (ply_renderer_backend_t *backend,
+                           ply_renderer_head_t    *head,
+                           ply_rectangle_t        *areas_to_flush,
+                           size_t                  number_of_areas_to_flush)
 {
-        ply_region_t *updated_region;
-        ply_list_t *areas_to_flush;
-        ply_list_node_t *node;
-        ply_pixel_buffer_t *pixel_buffer;
+        ply_rectangle_t *back_buffer_areas;
+        size_t number_of_back_buffer_areas, i;
+        int back_buffer;
+
+        if (number_of_areas_to_flush == 0)
+                return;
+
+        /* The back buffer was last drawn two frames ago, so it is missing
+         * what was drawn into the front buffer last time as well as this
+         * frame's damage
+         */
+        for (i = 0; i < number_of_areas_to_flush; i++) {
+                ply_tiled_region_add_rectangle (backend->back_buffer_damage, &areas_to_flush[i]);
+        }
+
+        back_buffer_areas = ply_tiled_region_get_rectangles (backend->back_buffer_damage,
+                                                             &number_of_back_buffer_areas);
 
+        for (i = 0; i < number_of_back_buffer_areas; i++) {
+                backend->flush_area (backend, head, &back_buffer_areas[i]);
+        }
+
+        ply_tiled_region_clear (backend->back_buffer_damage);
+
+        back_buffer = !backend->front_buffer;
+        if (!pan_to_buffer (backend, back_buffer)) {
+                ply_trace ("falling back to single buffering");
+                backend->is_double_buffered = false;
+                head->draw_address = head->map_address + backend->front_buffer * (head->size / 2);
+                backend->flush_area (backend, head, &head->area);
+                return;
+        }
+
+        head->draw_address = head->map_address + !backend->front_buffer * (head->size / 2);
+
+        for (i = 0; i < number_of_areas_to_flush; i++) {
+                ply_tiled_region_add_rectangle (backend->back_buffer_damage, &areas_to_flush[i]);
+        }
+}
+
+static void
+prepare_to_flush_head (ply_renderer_backend_t *backend,
+                       ply_renderer_head_t    *head)
+{
         assert (backend != NULL);
         assert (&backend->head == head);
 
@@ -587,36 +991,69 @@ flush_head (ply_renderer_backend_t *backend,
                 ply_terminal_set_mode (backend->terminal, PLY_TERMINAL_MODE_GRAPHICS);
                 ply_terminal_set_unbuffered_input (backend->terminal);
         }
-        pixel_buffer = head->pixel_buffer;
-        updated_region = ply_pixel_buffer_get_updated_areas (pixel_buffer);
-        areas_to_flush = ply_region_get_sorted_rectangle_list (updated_region);
+}
 
-        node = ply_list_get_first_node (areas_to_flush);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
-                ply_rectangle_t *area_to_flush;
+/* Only touches the device and the head's pixel buffer, so this can run on
+ * a flush thread */
+static void
+flush_head_on_thread (ply_renderer_backend_t *backend,
+                      ply_renderer_head_t    *head)
+{
+        ply_tiled_region_t *updated_region;
+        ply_rectangle_t *areas_to_flush;
+        size_t number_of_areas_to_flush, i;
+        ply_pixel_buffer_t *pixel_buffer;
+        uint64_t number_of_pixels = 0;
 
-                area_to_flush = (ply_rectangle_t *) ply_list_node_get_data (node);
+        assert (backend != NULL);
+        assert (&backend->head == head);
 
-                next_node = ply_list_get_next_node (areas_to_flush, node);
+        if (!backend->is_active)
+                return;
 
-                backend->flush_area (backend, head, area_to_flush);
+        pixel_buffer = head->pixel_buffer;
+        updated_region = ply_pixel_buffer_get_updated_areas (pixel_buffer);
+        areas_to_flush = ply_tiled_region_get_rectangles (updated_region,
+                                                          &number_of_areas_to_flush);
 
-                node = next_node;
+        for (i = 0; i < number_of_areas_to_flush; i++) {
+                number_of_pixels += (uint64_t) areas_to_flush[i].width * areas_to_flush[i].height;
+        }
+        ply_statistics_add_to_count ("renderer.frame-buffer.pixels-flushed", number_of_pixels);
+        ply_trace_point (frame_buffer_flush_head_trace_point,
+                         number_of_pixels, number_of_areas_to_flush);
+        ply_probe (renderer_flush_begin, head, number_of_areas_to_flush,
+                   number_of_pixels * backend->bytes_per_pixel);
+
+        if (backend->is_double_buffered) {
+                flush_head_to_back_buffer (backend, head, areas_to_flush, number_of_areas_to_flush);
+        } else {
+                for (i = 0; i < number_of_areas_to_flush; i++) {
+                        backend->flush_area (backend, head, &areas_to_flush[i]);
+                }
         }
 
-        ply_region_clear (updated_region);
+        ply_tiled_region_clear (updated_region);
+        ply_probe (renderer_flush_end, head);
+}
+
+static void
+flush_head (ply_renderer_backend_t *backend,
+            ply_renderer_head_t    *head)
+{
+        prepare_to_flush_head (backend, head);
+        flush_head_on_thread (backend, head);
 }
 
 static void
 ply_renderer_head_redraw (ply_renderer_backend_t *backend,
                           ply_renderer_head_t    *head)
 {
-        ply_region_t *region;
+        ply_tiled_region_t *region;
 
         region = ply_pixel_buffer_get_updated_areas (head->pixel_buffer);
 
-        ply_region_add_rectangle (region, &head->area);
+        ply_tiled_region_add_rectangle (region, &head->area);
 
         flush_head (backend, head);
 }
@@ -760,6 +1197,8 @@ ply_renderer_backend_get_interface (void)
                 .get_device_name              = get_device_name,
                 .get_capslock_state           = get_capslock_state,
                 .get_keymap                   = get_keymap,
+                .prepare_to_flush_head        = prepare_to_flush_head,
+                .flush_head_on_thread         = flush_head_on_thread,
         };
 
         return &plugin_interface;
@@ -0,0 +1,693 @@
+/* plugin.c - offscreen renderer plugin
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <png.h>
+
+#include "ply-buffer.h"
+#include "ply-event-loop.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-rectangle.h"
+#include "ply-tiled-region.h"
+#include "ply-utils.h"
+
+#include "ply-renderer.h"
+#include "ply-renderer-plugin.h"
+
+/* Renders into plain memory, so splashes can run without any display
+ * hardware.  It's configured from the environment:
+ *
+ *   PLY_OFFSCREEN_HEADS        comma separated list of heads, each
+ *                              WIDTHxHEIGHT[@SCALE][/ROTATION] where
+ *                              ROTATION is one of upright, upside-down,
+ *                              clockwise or counter-clockwise
+ *   PLY_OFFSCREEN_DUMP_DIR     if set, every flushed frame gets written
+ *                              to this directory
+ *   PLY_OFFSCREEN_DUMP_FORMAT  "png" (the default) or "raw" for the
+ *                              premultiplied ARGB32 pixels as they are
+ *   PLY_OFFSCREEN_STATS_FILE   if set, gets one line per flush with its
+ *                              timing and how much was damaged
+ *   PLY_OFFSCREEN_INPUT        if set, a file or fifo to read keyboard
+ *                              input from, as a terminal would send it
+ */
+
+#define DEFAULT_HEAD_SPECIFICATION "1024x768"
+
+typedef enum
+{
+        DUMP_FORMAT_NONE,
+        DUMP_FORMAT_PNG,
+        DUMP_FORMAT_RAW,
+} dump_format_t;
+
+struct _ply_renderer_head
+{
+        ply_renderer_backend_t     *backend;
+        ply_pixel_buffer_t         *pixel_buffer;
+        ply_rectangle_t             area;
+        int                         scale;
+        ply_pixel_buffer_rotation_t rotation;
+        int                         index;
+
+        unsigned long               number_of_frames;
+        double                      last_flush_time;
+        double                      total_interval;
+        unsigned long long          total_damaged_pixels;
+};
+
+struct _ply_renderer_input_source
+{
+        ply_buffer_t                       *key_buffer;
+        ply_renderer_input_source_handler_t handler;
+        void                               *user_data;
+
+        int                                 fd;
+        ply_fd_watch_t                     *watch;
+};
+
+struct _ply_renderer_backend
+{
+        ply_renderer_input_source_t input_source;
+        ply_list_t                 *heads;
+
+        char                       *head_specification;
+        char                       *dump_directory;
+        dump_format_t               dump_format;
+        char                       *input_file_name;
+        FILE                       *stats_file;
+        double                      start_time;
+
+        uint32_t                    is_active : 1;
+};
+
+ply_renderer_plugin_interface_t *ply_renderer_backend_get_interface (void);
+
+static ply_renderer_backend_t *
+create_backend (const char     *device_name,
+                ply_terminal_t *terminal)
+{
+        ply_renderer_backend_t *backend;
+        const char *value;
+
+        backend = calloc (1, sizeof(ply_renderer_backend_t));
+
+        backend->heads = ply_list_new ();
+        backend->input_source.key_buffer = ply_buffer_new ();
+        backend->input_source.fd = -1;
+
+        value = getenv ("PLY_OFFSCREEN_HEADS");
+        backend->head_specification = strdup (value != NULL && value[0] != '\0' ? value : DEFAULT_HEAD_SPECIFICATION);
+
+        value = getenv ("PLY_OFFSCREEN_DUMP_DIR");
+        if (value != NULL && value[0] != '\0') {
+                backend->dump_directory = strdup (value);
+
+                value = getenv ("PLY_OFFSCREEN_DUMP_FORMAT");
+                if (value != NULL && strcmp (value, "raw") == 0)
+                        backend->dump_format = DUMP_FORMAT_RAW;
+                else
+                        backend->dump_format = DUMP_FORMAT_PNG;
+        }
+
+        value = getenv ("PLY_OFFSCREEN_INPUT");
+        if (value != NULL && value[0] != '\0')
+                backend->input_file_name = strdup (value);
+
+        return backend;
+}
+
+static void
+destroy_backend (ply_renderer_backend_t *backend)
+{
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_list_node_t *next_node;
+                ply_renderer_head_t *head;
+
+                head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (backend->heads, node);
+
+                ply_pixel_buffer_free (head->pixel_buffer);
+                free (head);
+                node = next_node;
+        }
+
+        ply_list_free (backend->heads);
+        ply_buffer_free (backend->input_source.key_buffer);
+        free (backend->head_specification);
+        free (backend->dump_directory);
+        free (backend->input_file_name);
+        free (backend);
+}
+
+static bool
+open_device (ply_renderer_backend_t *backend)
+{
+        const char *stats_file_name;
+
+        backend->start_time = ply_get_timestamp ();
+
+        stats_file_name = getenv ("PLY_OFFSCREEN_STATS_FILE");
+        if (stats_file_name == NULL || stats_file_name[0] == '\0')
+                return true;
+
+        backend->stats_file = fopen (stats_file_name, "we");
+        if (backend->stats_file == NULL) {
+                ply_trace ("could not open stats file %s: %m", stats_file_name);
+                return true;
+        }
+
+        fprintf (backend->stats_file, "# time head frame interval rectangles damaged-pixels damaged-fraction\n");
+        return true;
+}
+
+static void
+write_head_summaries (ply_renderer_backend_t *backend)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (backend->heads);
+             node != NULL;
+             node = ply_list_get_next_node (backend->heads, node)) {
+                ply_renderer_head_t *head;
+                double mean_interval = 0.0;
+
+                head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+
+                if (head->number_of_frames > 1)
+                        mean_interval = head->total_interval / (head->number_of_frames - 1);
+
+                fprintf (backend->stats_file,
+                         "# head %d: %lux%lu, %lu frames, %.6f mean interval, %llu damaged pixels\n",
+                         head->index, head->area.width, head->area.height,
+                         head->number_of_frames, mean_interval,
+                         head->total_damaged_pixels);
+        }
+}
+
+static void
+close_device (ply_renderer_backend_t *backend)
+{
+        if (backend->stats_file == NULL)
+                return;
+
+        write_head_summaries (backend);
+        fclose (backend->stats_file);
+        backend->stats_file = NULL;
+}
+
+static const char *
+get_device_name (ply_renderer_backend_t *backend)
+{
+        return "offscreen";
+}
+
+static bool
+parse_rotation (const char                  *name,
+                ply_pixel_buffer_rotation_t *rotation)
+{
+        if (strcmp (name, "upright") == 0)
+                *rotation = PLY_PIXEL_BUFFER_ROTATE_UPRIGHT;
+        else if (strcmp (name, "upside-down") == 0)
+                *rotation = PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN;
+        else if (strcmp (name, "clockwise") == 0)
+                *rotation = PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE;
+        else if (strcmp (name, "counter-clockwise") == 0)
+                *rotation = PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE;
+        else
+                return false;
+
+        return true;
+}
+
+static ply_renderer_head_t *
+create_head_from_specification (ply_renderer_backend_t *backend,
+                                const char             *specification)
+{
+        ply_renderer_head_t *head;
+        unsigned long width, height;
+        int scale = 1;
+        ply_pixel_buffer_rotation_t rotation = PLY_PIXEL_BUFFER_ROTATE_UPRIGHT;
+        char *end;
+
+        width = strtoul (specification, &end, 10);
+        if (*end != 'x')
+                return NULL;
+
+        height = strtoul (end + 1, &end, 10);
+
+        if (*end == '@') {
+                scale = strtol (end + 1, &end, 10);
+                if (scale < 1)
+                        return NULL;
+        }
+
+        if (*end == '/') {
+                if (!parse_rotation (end + 1, &rotation))
+                        return NULL;
+        } else if (*end != '\0') {
+                return NULL;
+        }
+
+        if (width == 0 || height == 0)
+                return NULL;
+
+        head = calloc (1, sizeof(ply_renderer_head_t));
+
+        head->backend = backend;
+        head->area.width = width;
+        head->area.height = height;
+        head->scale = scale;
+        head->rotation = rotation;
+        head->index = ply_list_get_length (backend->heads);
+
+        head->pixel_buffer = ply_pixel_buffer_new_with_device_rotation (width, height, rotation);
+        ply_pixel_buffer_set_owner (head->pixel_buffer, "display");
+        ply_pixel_buffer_set_device_scale (head->pixel_buffer, scale);
+        ply_pixel_buffer_fill_with_color (head->pixel_buffer, NULL, 0.0, 0.0, 0.0, 1.0);
+
+        return head;
+}
+
+static bool
+query_device (ply_renderer_backend_t *backend)
+{
+        char *specifications, *specification, *state = NULL;
+
+        assert (backend != NULL);
+
+        if (ply_list_get_first_node (backend->heads) != NULL)
+                return true;
+
+        specifications = strdup (backend->head_specification);
+
+        for (specification = strtok_r (specifications, ",", &state);
+             specification != NULL;
+             specification = strtok_r (NULL, ",", &state)) {
+                ply_renderer_head_t *head;
+
+                head = create_head_from_specification (backend, specification);
+
+                if (head == NULL) {
+                        ply_trace ("ignoring malformed head '%s'", specification);
+                        continue;
+                }
+
+                ply_trace ("created %lux%lu offscreen head with scale %d",
+                           head->area.width, head->area.height, head->scale);
+                ply_list_append_data (backend->heads, head);
+        }
+
+        free (specifications);
+
+        return ply_list_get_first_node (backend->heads) != NULL;
+}
+
+static bool
+map_to_device (ply_renderer_backend_t *backend)
+{
+        backend->is_active = true;
+        return true;
+}
+
+static void
+unmap_from_device (ply_renderer_backend_t *backend)
+{
+        backend->is_active = false;
+}
+
+static void
+activate (ply_renderer_backend_t *backend)
+{
+        backend->is_active = true;
+}
+
+static void
+deactivate (ply_renderer_backend_t *backend)
+{
+        backend->is_active = false;
+}
+
+/* The pixels are kept the way the panel would scan them out, so rotated
+ * heads come out sideways, just like they would on the real hardware
+ */
+static bool
+write_png (const char          *filename,
+           ply_renderer_head_t *head)
+{
+        png_structp png;
+        png_infop info;
+        uint32_t *pixels;
+        png_bytep row;
+        unsigned long x, y;
+        FILE *fp;
+
+        fp = fopen (filename, "we");
+        if (fp == NULL)
+                return false;
+
+        png = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        info = png != NULL ? png_create_info_struct (png) : NULL;
+        if (info == NULL) {
+                png_destroy_write_struct (&png, NULL);
+                fclose (fp);
+                return false;
+        }
+
+        pixels = ply_pixel_buffer_get_argb32_data (head->pixel_buffer);
+        row = malloc (head->area.width * 4);
+
+        if (setjmp (png_jmpbuf (png))) {
+                png_destroy_write_struct (&png, &info);
+                free (row);
+                fclose (fp);
+                return false;
+        }
+
+        png_init_io (png, fp);
+        png_set_IHDR (png, info, head->area.width, head->area.height, 8,
+                      PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+                      PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_set_compression_level (png, 1);
+        png_write_info (png, info);
+
+        for (y = 0; y < head->area.height; y++) {
+                for (x = 0; x < head->area.width; x++) {
+                        uint32_t pixel_value = pixels[y * head->area.width + x];
+                        uint8_t alpha = pixel_value >> 24;
+                        uint8_t red = (pixel_value >> 16) & 0xff;
+                        uint8_t green = (pixel_value >> 8) & 0xff;
+                        uint8_t blue = pixel_value & 0xff;
+
+                        /* PNG wants straight alpha */
+                        if (alpha != 0 && alpha != 0xff) {
+                                red = red * 255 / alpha;
+                                green = green * 255 / alpha;
+                                blue = blue * 255 / alpha;
+                        }
+
+                        row[x * 4] = red;
+                        row[x * 4 + 1] = green;
+                        row[x * 4 + 2] = blue;
+                        row[x * 4 + 3] = alpha;
+                }
+                png_write_row (png, row);
+        }
+
+        png_write_end (png, info);
+        png_destroy_write_struct (&png, &info);
+        free (row);
+
+        return fclose (fp) == 0;
+}
+
+static bool
+write_raw (const char          *filename,
+           ply_renderer_head_t *head)
+{
+        size_t number_of_pixels;
+        uint32_t *pixels;
+        FILE *fp;
+        bool written;
+
+        fp = fopen (filename, "we");
+        if (fp == NULL)
+                return false;
+
+        number_of_pixels = head->area.width * head->area.height;
+        pixels = ply_pixel_buffer_get_argb32_data (head->pixel_buffer);
+
+        written = fwrite (pixels, sizeof(uint32_t), number_of_pixels, fp) == number_of_pixels;
+
+        return fclose (fp) == 0 && written;
+}
+
+static void
+dump_frame (ply_renderer_backend_t *backend,
+            ply_renderer_head_t    *head)
+{
+        char *filename = NULL;
+        bool written;
+
+        switch (backend->dump_format) {
+        case DUMP_FORMAT_PNG:
+                asprintf (&filename, "%s/head-%d-frame-%06lu.png",
+                          backend->dump_directory, head->index, head->number_of_frames);
+                written = write_png (filename, head);
+                break;
+
+        case DUMP_FORMAT_RAW:
+                asprintf (&filename, "%s/head-%d-frame-%06lu.argb32",
+                          backend->dump_directory, head->index, head->number_of_frames);
+                written = write_raw (filename, head);
+                break;
+
+        case DUMP_FORMAT_NONE:
+        default:
+                return;
+        }
+
+        if (!written)
+                ply_trace ("could not write frame to %s: %m", filename);
+
+        free (filename);
+}
+
+/* Touches nothing but the head and its statistics, so this doubles as
+ * flush_head_on_thread */
+static void
+flush_head (ply_renderer_backend_t *backend,
+            ply_renderer_head_t    *head)
+{
+        ply_tiled_region_t *updated_region;
+        ply_rectangle_t *areas_to_flush;
+        size_t number_of_areas_to_flush, i;
+        unsigned long damaged_pixels = 0;
+        double now, interval = 0.0;
+
+        assert (backend != NULL);
+
+        if (!backend->is_active)
+                return;
+
+        updated_region = ply_pixel_buffer_get_updated_areas (head->pixel_buffer);
+
+        if (ply_tiled_region_is_empty (updated_region))
+                return;
+
+        areas_to_flush = ply_tiled_region_get_rectangles (updated_region,
+                                                          &number_of_areas_to_flush);
+
+        for (i = 0; i < number_of_areas_to_flush; i++) {
+                damaged_pixels += areas_to_flush[i].width * areas_to_flush[i].height;
+        }
+
+        now = ply_get_timestamp ();
+        if (head->number_of_frames > 0) {
+                interval = now - head->last_flush_time;
+                head->total_interval += interval;
+        }
+        head->last_flush_time = now;
+        head->total_damaged_pixels += damaged_pixels;
+
+        if (backend->stats_file != NULL)
+                fprintf (backend->stats_file, "%.6f %d %lu %.6f %zu %lu %.4f\n",
+                         now - backend->start_time, head->index, head->number_of_frames,
+                         interval, number_of_areas_to_flush, damaged_pixels,
+                         (double) damaged_pixels / (head->area.width * head->area.height));
+
+        if (backend->dump_directory != NULL)
+                dump_frame (backend, head);
+
+        head->number_of_frames++;
+        ply_tiled_region_clear (updated_region);
+}
+
+static ply_list_t *
+get_heads (ply_renderer_backend_t *backend)
+{
+        return backend->heads;
+}
+
+static ply_pixel_buffer_t *
+get_buffer_for_head (ply_renderer_backend_t *backend,
+                     ply_renderer_head_t    *head)
+{
+        if (head->backend != backend)
+                return NULL;
+
+        return head->pixel_buffer;
+}
+
+static bool
+get_panel_properties (ply_renderer_backend_t      *backend,
+                      int                         *width,
+                      int                         *height,
+                      ply_pixel_buffer_rotation_t *rotation,
+                      int                         *scale)
+{
+        ply_renderer_head_t *head;
+        ply_list_node_t *node;
+
+        node = ply_list_get_first_node (backend->heads);
+        if (node == NULL)
+                return false;
+
+        head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+
+        *width = head->area.width;
+        *height = head->area.height;
+        *rotation = head->rotation;
+        *scale = head->scale;
+
+        return true;
+}
+
+static bool
+has_input_source (ply_renderer_backend_t      *backend,
+                  ply_renderer_input_source_t *input_source)
+{
+        return input_source == &backend->input_source;
+}
+
+static ply_renderer_input_source_t *
+get_input_source (ply_renderer_backend_t *backend)
+{
+        return &backend->input_source;
+}
+
+static void
+on_input (ply_renderer_input_source_t *input_source)
+{
+        ply_buffer_append_from_fd (input_source->key_buffer, input_source->fd);
+
+        if (input_source->handler != NULL)
+                input_source->handler (input_source->user_data, input_source->key_buffer, input_source);
+}
+
+static void
+on_input_hangup (ply_renderer_input_source_t *input_source)
+{
+        ply_trace ("input file hung up");
+        input_source->watch = NULL;
+}
+
+static bool
+open_input_source (ply_renderer_backend_t      *backend,
+                   ply_renderer_input_source_t *input_source)
+{
+        assert (backend != NULL);
+        assert (has_input_source (backend, input_source));
+
+        if (backend->input_file_name == NULL || input_source->fd >= 0)
+                return true;
+
+        /* opened for writing too, so a fifo doesn't hang up whenever
+         * the other end closes it between writes */
+        input_source->fd = open (backend->input_file_name, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (input_source->fd < 0) {
+                ply_trace ("could not open input file %s: %m", backend->input_file_name);
+                return true;
+        }
+
+        input_source->watch = ply_event_loop_watch_fd (ply_event_loop_get_default (),
+                                                       input_source->fd,
+                                                       PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                                       (ply_event_handler_t) on_input,
+                                                       (ply_event_handler_t) on_input_hangup,
+                                                       input_source);
+        return true;
+}
+
+static void
+set_handler_for_input_source (ply_renderer_backend_t             *backend,
+                              ply_renderer_input_source_t        *input_source,
+                              ply_renderer_input_source_handler_t handler,
+                              void                               *user_data)
+{
+        assert (backend != NULL);
+        assert (has_input_source (backend, input_source));
+
+        input_source->handler = handler;
+        input_source->user_data = user_data;
+}
+
+static void
+close_input_source (ply_renderer_backend_t      *backend,
+                    ply_renderer_input_source_t *input_source)
+{
+        assert (backend != NULL);
+        assert (has_input_source (backend, input_source));
+
+        if (input_source->fd < 0)
+                return;
+
+        if (input_source->watch != NULL) {
+                ply_event_loop_stop_watching_fd (ply_event_loop_get_default (), input_source->watch);
+                input_source->watch = NULL;
+        }
+
+        close (input_source->fd);
+        input_source->fd = -1;
+}
+
+ply_renderer_plugin_interface_t *
+ply_renderer_backend_get_interface (void)
+{
+        static ply_renderer_plugin_interface_t plugin_interface =
+        {
+                .create_backend               = create_backend,
+                .destroy_backend              = destroy_backend,
+                .open_device                  = open_device,
+                .close_device                 = close_device,
+                .query_device                 = query_device,
+                .map_to_device                = map_to_device,
+                .unmap_from_device            = unmap_from_device,
+                .activate                     = activate,
+                .deactivate                   = deactivate,
+                .flush_head                   = flush_head,
+                .get_heads                    = get_heads,
+                .get_buffer_for_head          = get_buffer_for_head,
+                .get_input_source             = get_input_source,
+                .open_input_source            = open_input_source,
+                .set_handler_for_input_source = set_handler_for_input_source,
+                .close_input_source           = close_input_source,
+                .get_device_name              = get_device_name,
+                .get_panel_properties         = get_panel_properties,
+                .flush_head_on_thread         = flush_head
+        };
+
+        return &plugin_interface;
+}
+
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -49,13 +49,15 @@
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 #include <gdk/gdkx.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
 
 #include "ply-buffer.h"
 #include "ply-event-loop.h"
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-rectangle.h"
-#include "ply-region.h"
+#include "ply-tiled-region.h"
 #include "ply-utils.h"
 
 #include "ply-renderer.h"
@@ -69,7 +71,16 @@ struct _ply_renderer_head
         GtkWidget              *window;
         cairo_surface_t        *image;
         uint32_t                scale;
+
+        /* when the server supports it, the shadow buffer lives in shared
+         * memory and damage is pushed straight to the window
+         */
+        XShmSegmentInfo         shm_info;
+        XImage                 *shm_image;
+        GC                      gc;
+
         uint32_t                is_fullscreen : 1;
+        uint32_t                is_waiting_for_completion : 1;
 };
 
 struct _ply_renderer_input_source
@@ -86,8 +97,12 @@ struct _ply_renderer_backend
         ply_list_t                 *heads;
 
         ply_fd_watch_t             *display_watch;
+        Display                    *display;
+        int                         shm_completion_event;
 
         uint32_t                    is_active : 1;
+        uint32_t                    has_shm : 1;
+        uint32_t                    is_unthrottled : 1;
 };
 
 ply_renderer_plugin_interface_t *ply_renderer_backend_get_interface (void);
@@ -98,6 +113,8 @@ static gboolean on_motion_notify_event (GtkWidget      *widget,
 static gboolean on_key_event (GtkWidget   *widget,
                               GdkEventKey *event,
                               gpointer     user_data);
+static void flush_head (ply_renderer_backend_t *backend,
+                        ply_renderer_head_t    *head);
 
 static ply_renderer_backend_t *
 create_backend (const char     *device_name,
@@ -149,6 +166,40 @@ on_display_event (ply_renderer_backend_t *backend)
         }
 }
 
+static GdkFilterReturn
+on_x_event (GdkXEvent *gdk_xevent,
+            GdkEvent  *event,
+            gpointer   user_data)
+{
+        ply_renderer_backend_t *backend = user_data;
+        XEvent *xevent = gdk_xevent;
+        XShmCompletionEvent *completion_event;
+        ply_list_node_t *node;
+
+        if (!backend->has_shm || xevent->type != backend->shm_completion_event)
+                return GDK_FILTER_CONTINUE;
+
+        completion_event = (XShmCompletionEvent *) xevent;
+
+        node = ply_list_get_first_node (backend->heads);
+        while (node != NULL) {
+                ply_renderer_head_t *head;
+
+                head = (ply_renderer_head_t *) ply_list_node_get_data (node);
+                node = ply_list_get_next_node (backend->heads, node);
+
+                if (head->shm_image == NULL || head->shm_info.shmseg != completion_event->shmseg)
+                        continue;
+
+                /* push out whatever got drawn while the server was busy */
+                head->is_waiting_for_completion = false;
+                if (!ply_tiled_region_is_empty (ply_pixel_buffer_get_updated_areas (head->pixel_buffer)))
+                        flush_head (backend, head);
+        }
+
+        return GDK_FILTER_REMOVE;
+}
+
 static bool
 open_device (ply_renderer_backend_t *backend)
 {
@@ -160,6 +211,23 @@ open_device (ply_renderer_backend_t *backend)
 
         display = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
         display_fd = ConnectionNumber (display);
+        backend->display = display;
+
+        if (getenv ("PLY_X11_DISABLE_SHM") == NULL && XShmQueryExtension (display)) {
+                backend->has_shm = true;
+                backend->shm_completion_event = XShmGetEventBase (display) + ShmCompletion;
+                gdk_window_add_filter (NULL, on_x_event, backend);
+        }
+
+        /* For benchmarking themes: hand every frame to the server as soon as
+         * it is drawn, rather than waiting for the last one to be shown
+         */
+        backend->is_unthrottled = getenv ("PLY_X11_UNTHROTTLED") != NULL;
+
+        ply_trace ("using %s, %s",
+                   backend->has_shm ? "MIT-SHM" : "cairo",
+                   backend->is_unthrottled ? "unthrottled" : "throttled");
+
         backend->display_watch = ply_event_loop_watch_fd (backend->loop,
                                                           display_fd,
                                                           PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
@@ -181,7 +249,121 @@ close_device (ply_renderer_backend_t *backend)
 {
         ply_event_loop_stop_watching_fd (backend->loop, backend->display_watch);
         backend->display_watch = NULL;
-        return;
+
+        if (backend->has_shm) {
+                gdk_window_remove_filter (NULL, on_x_event, backend);
+                backend->has_shm = false;
+        }
+}
+
+static bool
+create_shm_image_for_head (ply_renderer_backend_t *backend,
+                           ply_renderer_head_t    *head)
+{
+        GdkVisual *visual;
+        XImage *image;
+        bool is_big_endian;
+        int error;
+
+        visual = gdk_screen_get_system_visual (gdk_screen_get_default ());
+
+        image = XShmCreateImage (backend->display,
+                                 gdk_x11_visual_get_xvisual (visual),
+                                 gdk_visual_get_depth (visual),
+                                 ZPixmap, NULL, &head->shm_info,
+                                 head->area.width, head->area.height);
+        if (image == NULL) {
+                ply_trace ("could not create shared memory image");
+                return false;
+        }
+
+        /* The shadow buffer is handed to the server as is, so the image
+         * has to have the same layout as ARGB32 in host byte order
+         */
+        is_big_endian = htonl (1) == 1;
+        if (image->bits_per_pixel != 32 ||
+            image->bytes_per_line != (int) head->area.width * 4 ||
+            image->red_mask != 0xff0000 ||
+            image->green_mask != 0xff00 ||
+            image->blue_mask != 0xff ||
+            (image->byte_order == MSBFirst) != is_big_endian) {
+                ply_trace ("visual doesn't match shadow buffer layout, not using MIT-SHM");
+                XDestroyImage (image);
+                return false;
+        }
+
+        head->shm_info.shmid = shmget (IPC_PRIVATE, image->bytes_per_line * image->height,
+                                       IPC_CREAT | 0600);
+        if (head->shm_info.shmid < 0) {
+                ply_trace ("could not create shared memory segment: %m");
+                XDestroyImage (image);
+                return false;
+        }
+
+        head->shm_info.shmaddr = shmat (head->shm_info.shmid, NULL, 0);
+        if (head->shm_info.shmaddr == (char *) -1) {
+                ply_trace ("could not attach shared memory segment: %m");
+                shmctl (head->shm_info.shmid, IPC_RMID, NULL);
+                XDestroyImage (image);
+                return false;
+        }
+
+        image->data = head->shm_info.shmaddr;
+        head->shm_info.readOnly = False;
+
+        /* The server can't attach segments when it's on another machine */
+        gdk_x11_display_error_trap_push (gdk_display_get_default ());
+        XShmAttach (backend->display, &head->shm_info);
+        XSync (backend->display, False);
+        error = gdk_x11_display_error_trap_pop (gdk_display_get_default ());
+
+        /* the segment goes away once both sides have detached */
+        shmctl (head->shm_info.shmid, IPC_RMID, NULL);
+
+        if (error != 0) {
+                ply_trace ("X server could not attach shared memory segment");
+                shmdt (head->shm_info.shmaddr);
+                image->data = NULL;
+                XDestroyImage (image);
+                return false;
+        }
+
+        head->shm_image = image;
+        return true;
+}
+
+static void
+destroy_shm_image_for_head (ply_renderer_backend_t *backend,
+                            ply_renderer_head_t    *head)
+{
+        if (head->shm_image == NULL)
+                return;
+
+        XShmDetach (backend->display, &head->shm_info);
+        XSync (backend->display, False);
+
+        head->shm_image->data = NULL;
+        XDestroyImage (head->shm_image);
+        head->shm_image = NULL;
+
+        shmdt (head->shm_info.shmaddr);
+        head->shm_info.shmaddr = NULL;
+        head->is_waiting_for_completion = false;
+}
+
+static void
+create_pixel_buffer_for_head (ply_renderer_backend_t *backend,
+                              ply_renderer_head_t    *head)
+{
+        if (backend->has_shm && create_shm_image_for_head (backend, head))
+                head->pixel_buffer = ply_pixel_buffer_new_for_data (head->area.width,
+                                                                    head->area.height,
+                                                                    (uint32_t *) head->shm_image->data);
+        else
+                head->pixel_buffer = ply_pixel_buffer_new (head->area.width, head->area.height);
+
+        ply_pixel_buffer_set_owner (head->pixel_buffer, "display");
+        ply_pixel_buffer_set_device_scale (head->pixel_buffer, head->scale);
 }
 
 static void
@@ -197,8 +379,7 @@ create_fake_multi_head_setup (ply_renderer_backend_t *backend)
         head->area.width = 800;   /* FIXME hardcoded */
         head->area.height = 600;
         head->scale = 1;
-        head->pixel_buffer = ply_pixel_buffer_new (head->area.width, head->area.height);
-        ply_pixel_buffer_set_device_scale (head->pixel_buffer, head->scale);
+        create_pixel_buffer_for_head (backend, head);
 
         ply_list_append_data (backend->heads, head);
 
@@ -210,8 +391,7 @@ create_fake_multi_head_setup (ply_renderer_backend_t *backend)
         head->area.width = 640;   /* FIXME hardcoded */
         head->area.height = 480;
         head->scale = 1;
-        head->pixel_buffer = ply_pixel_buffer_new (head->area.width, head->area.height);
-        ply_pixel_buffer_set_device_scale (head->pixel_buffer, head->scale);
+        create_pixel_buffer_for_head (backend, head);
 
         ply_list_append_data (backend->heads, head);
 }
@@ -245,8 +425,7 @@ create_fullscreen_single_head_setup (ply_renderer_backend_t *backend)
         head->scale = ply_get_device_scale (monitor_geometry.width,
                                             monitor_geometry.height,
                                             width_mm, height_mm);
-        head->pixel_buffer = ply_pixel_buffer_new (head->area.width, head->area.height);
-        ply_pixel_buffer_set_device_scale (head->pixel_buffer, head->scale);
+        create_pixel_buffer_for_head (backend, head);
 
         ply_list_append_data (backend->heads, head);
 }
@@ -281,6 +460,10 @@ on_draw (GtkWidget *widget,
 {
         ply_renderer_head_t *head = user_data;
 
+        /* with MIT-SHM nothing tells cairo when the pixels change */
+        if (head->shm_image != NULL)
+                cairo_surface_mark_dirty (head->image);
+
         cairo_set_source_surface (cr, head->image, 0, 0);
         cairo_paint (cr);
 
@@ -338,6 +521,11 @@ map_to_device (ply_renderer_backend_t *backend)
                         g_signal_connect (head->window, "delete-event",
                                           G_CALLBACK (on_window_destroy),
                                           NULL);
+
+                        if (head->shm_image != NULL)
+                                head->gc = XCreateGC (backend->display,
+                                                      GDK_WINDOW_XID (gtk_widget_get_window (head->window)),
+                                                      0, NULL);
                 }
                 node = next_node;
         }
@@ -362,12 +550,17 @@ unmap_from_device (ply_renderer_backend_t *backend)
                 head = (ply_renderer_head_t *) ply_list_node_get_data (node);
                 next_node = ply_list_get_next_node (backend->heads, node);
 
+                if (head->gc != NULL) {
+                        XFreeGC (backend->display, head->gc);
+                        head->gc = NULL;
+                }
                 gtk_widget_destroy (head->window);
                 head->window = NULL;
                 ply_pixel_buffer_free (head->pixel_buffer);
                 head->pixel_buffer = NULL;
                 cairo_surface_destroy (head->image);
                 head->image = NULL;
+                destroy_shm_image_for_head (backend, head);
 
                 node = next_node;
         }
@@ -385,13 +578,54 @@ deactivate (ply_renderer_backend_t *backend)
         backend->is_active = false;
 }
 
+static void
+flush_head_with_shm (ply_renderer_backend_t *backend,
+                     ply_renderer_head_t    *head)
+{
+        ply_tiled_region_t *updated_region;
+        ply_rectangle_t *areas_to_flush;
+        size_t number_of_areas_to_flush, i;
+        Window window;
+
+        /* Until the server has copied the last frame out, leave the damage
+         * queued up; it gets flushed when the completion event comes in
+         */
+        if (head->is_waiting_for_completion || head->gc == NULL)
+                return;
+
+        window = GDK_WINDOW_XID (gtk_widget_get_window (head->window));
+        updated_region = ply_pixel_buffer_get_updated_areas (head->pixel_buffer);
+        areas_to_flush = ply_tiled_region_get_rectangles (updated_region,
+                                                          &number_of_areas_to_flush);
+
+        for (i = 0; i < number_of_areas_to_flush; i++) {
+                ply_rectangle_t *area_to_flush = &areas_to_flush[i];
+                bool should_send_completion_event;
+
+                should_send_completion_event = !backend->is_unthrottled &&
+                                               i == number_of_areas_to_flush - 1;
+
+                XShmPutImage (backend->display, window, head->gc, head->shm_image,
+                              area_to_flush->x, area_to_flush->y,
+                              area_to_flush->x, area_to_flush->y,
+                              area_to_flush->width, area_to_flush->height,
+                              should_send_completion_event);
+
+                if (should_send_completion_event)
+                        head->is_waiting_for_completion = true;
+        }
+        ply_tiled_region_clear (updated_region);
+
+        XFlush (backend->display);
+}
+
 static void
 flush_head (ply_renderer_backend_t *backend,
             ply_renderer_head_t    *head)
 {
-        ply_region_t *updated_region;
-        ply_list_t *areas_to_flush;
-        ply_list_node_t *node;
+        ply_tiled_region_t *updated_region;
+        ply_rectangle_t *areas_to_flush;
+        size_t number_of_areas_to_flush, i;
         ply_pixel_buffer_t *pixel_buffer;
 
         assert (backend != NULL);
@@ -399,17 +633,18 @@ flush_head (ply_renderer_backend_t *backend,
         if (!backend->is_active)
                 return;
 
+        if (head->shm_image != NULL) {
+                flush_head_with_shm (backend, head);
+                return;
+        }
+
         pixel_buffer = head->pixel_buffer;
         updated_region = ply_pixel_buffer_get_updated_areas (pixel_buffer);
-        areas_to_flush = ply_region_get_sorted_rectangle_list (updated_region);
+        areas_to_flush = ply_tiled_region_get_rectangles (updated_region,
+                                                          &number_of_areas_to_flush);
 
-        node = ply_list_get_first_node (areas_to_flush);
-        while (node != NULL) {
-                ply_list_node_t *next_node;
-                ply_rectangle_t *area_to_flush;
-
-                area_to_flush = (ply_rectangle_t *) ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (areas_to_flush, node);
+        for (i = 0; i < number_of_areas_to_flush; i++) {
+                ply_rectangle_t *area_to_flush = &areas_to_flush[i];
 
                 cairo_surface_mark_dirty_rectangle (head->image,
                                                     area_to_flush->x,
@@ -422,10 +657,8 @@ flush_head (ply_renderer_backend_t *backend,
                                             area_to_flush->y,
                                             area_to_flush->width,
                                             area_to_flush->height);
-
-                node = next_node;
         }
-        ply_region_clear (updated_region);
+        ply_tiled_region_clear (updated_region);
 }
 
 static ply_list_t *
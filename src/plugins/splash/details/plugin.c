@@ -54,6 +54,13 @@
 
 #define CLEAR_LINE_SEQUENCE "\033[2K\r"
 
+/* for terminals that don't know their size */
+#define DEFAULT_NUMBER_OF_ROWS 25
+#define DEFAULT_NUMBER_OF_COLUMNS 80
+
+/* cells are UTF-8, so up to four bytes each */
+#define MAX_BYTES_PER_CELL 4
+
 typedef enum
 {
         PLY_BOOT_SPLASH_DISPLAY_NORMAL,
@@ -199,7 +206,58 @@ view_write (view_t     *view,
         ply_terminal_t *terminal;
 
         terminal = ply_text_display_get_terminal (view->display);
-        ply_terminal_write (terminal, "%.*s", (int) number_of_bytes, text);
+        ply_terminal_write_bytes (terminal, text, number_of_bytes);
+}
+
+/* Only the last screenful of what's been written so far could still be
+ * seen, so that's all that gets written when a view starts showing it.
+ * The lines are found by looking back from the end, which goes no
+ * further than the bytes that get written.
+ */
+static void
+view_write_boot_buffer (view_t       *view,
+                        ply_buffer_t *boot_buffer)
+{
+        const char *bytes, *newline;
+        size_t size, max_size, line_start, search_end;
+        int number_of_rows, number_of_columns, row;
+
+        bytes = ply_buffer_get_bytes (boot_buffer);
+        size = ply_buffer_get_size (boot_buffer);
+
+        number_of_rows = ply_text_display_get_number_of_rows (view->display);
+        number_of_columns = ply_text_display_get_number_of_columns (view->display);
+        if (number_of_rows <= 0 || number_of_columns <= 0) {
+                number_of_rows = DEFAULT_NUMBER_OF_ROWS;
+                number_of_columns = DEFAULT_NUMBER_OF_COLUMNS;
+        }
+
+        /* one very long line still only fills a screen */
+        max_size = (size_t) number_of_rows * number_of_columns * MAX_BYTES_PER_CELL;
+        if (size > max_size) {
+                bytes += size - max_size;
+                size = max_size;
+        }
+
+        /* a newline at the very end finishes the last line, it doesn't start another */
+        search_end = size;
+        if (search_end > 0 && bytes[search_end - 1] == '\n')
+                search_end--;
+
+        line_start = 0;
+        for (row = 0; row < number_of_rows; row++) {
+                newline = memrchr (bytes, '\n', search_end);
+
+                if (newline == NULL) {
+                        line_start = 0;
+                        break;
+                }
+
+                line_start = newline - bytes + 1;
+                search_end = newline - bytes;
+        }
+
+        view_write (view, bytes + line_start, size - line_start);
 }
 
 static void
@@ -244,14 +302,8 @@ add_text_display (ply_boot_splash_plugin_t *plugin,
 
         ply_list_append_data (plugin->views, view);
 
-        if (plugin->boot_buffer != NULL) {
-                size_t size;
-                const char *bytes;
-
-                size = ply_buffer_get_size (plugin->boot_buffer);
-                bytes = ply_buffer_get_bytes (plugin->boot_buffer);
-                view_write (view, bytes, size);
-        }
+        if (plugin->boot_buffer != NULL)
+                view_write_boot_buffer (view, plugin->boot_buffer);
 }
 
 static void
@@ -283,7 +335,7 @@ show_splash_screen (ply_boot_splash_plugin_t *plugin,
                     ply_buffer_t             *boot_buffer,
                     ply_boot_splash_mode_t    mode)
 {
-        size_t size;
+        ply_list_node_t *node;
 
         assert (plugin != NULL);
 
@@ -297,8 +349,11 @@ show_splash_screen (ply_boot_splash_plugin_t *plugin,
         if (boot_buffer) {
                 plugin->boot_buffer = boot_buffer;
 
-                size = ply_buffer_get_size (boot_buffer);
-                write_on_views (plugin, ply_buffer_get_bytes (boot_buffer), size);
+                node = ply_list_get_first_node (plugin->views);
+                while (node != NULL) {
+                        view_write_boot_buffer (ply_list_node_get_data (node), boot_buffer);
+                        node = ply_list_get_next_node (plugin->views, node);
+                }
         }
 
         return true;
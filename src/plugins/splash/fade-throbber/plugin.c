@@ -43,6 +43,7 @@
 #include "ply-buffer.h"
 #include "ply-entry.h"
 #include "ply-event-loop.h"
+#include "ply-frame-clock.h"
 #include "ply-label.h"
 #include "ply-list.h"
 #include "ply-logger.h"
@@ -74,6 +75,7 @@ typedef struct
         double       start_time;
         double       speed;
         double       opacity;
+        int          opacity_step;
 } star_t;
 
 typedef struct
@@ -86,6 +88,11 @@ typedef struct
         ply_label_t              *message_label;
         ply_rectangle_t           lock_area;
         double                    logo_opacity;
+        int                       logo_opacity_step;
+
+        ply_pixel_buffer_t       *background_layer;
+        ply_pixel_buffer_t       *logo_layer;
+        bool                      layers_are_valid;
 } view_t;
 
 struct _ply_boot_splash_plugin
@@ -203,6 +210,7 @@ star_new (int    x,
         star->y = y;
         star->speed = speed;
         star->start_time = ply_get_timestamp ();
+        star->opacity_step = -1;
 
         return star;
 }
@@ -254,6 +262,7 @@ view_new (ply_boot_splash_plugin_t *plugin,
         view->label = ply_label_new ();
 
         view->message_label = ply_label_new ();
+        view->logo_opacity_step = -1;
 
         return view;
 }
@@ -264,6 +273,8 @@ view_free (view_t *view)
         ply_entry_free (view->entry);
         ply_label_free (view->message_label);
         free_stars (view);
+        ply_pixel_buffer_free (view->background_layer);
+        ply_pixel_buffer_free (view->logo_layer);
 
         ply_pixel_display_set_draw_handler (view->display, NULL, NULL);
 
@@ -422,6 +433,12 @@ destroy_plugin (ply_boot_splash_plugin_t *plugin)
         free (plugin);
 }
 
+static int
+get_opacity_step (double opacity)
+{
+        return (int) (opacity * 255 + .5);
+}
+
 static void
 view_animate_at_time (view_t *view,
                       double  time)
@@ -452,12 +469,24 @@ view_animate_at_time (view_t *view,
         while (node != NULL) {
                 ply_list_node_t *next_node;
                 star_t *star;
+                double opacity;
+                int opacity_step;
 
                 star = (star_t *) ply_list_node_get_data (node);
                 next_node = ply_list_get_next_node (view->stars, node);
 
-                star->opacity = .5 * sin (((plugin->now - star->start_time) / star->speed) * (2 * M_PI)) + .5;
-                star->opacity = CLAMP (star->opacity, 0, 1.0);
+                opacity = .5 * sin (((plugin->now - star->start_time) / star->speed) * (2 * M_PI)) + .5;
+                opacity = CLAMP (opacity, 0, 1.0);
+
+                /* Slow stars spend many frames within one step of the
+                 * 8-bit framebuffer, where redrawing them changes nothing */
+                opacity_step = get_opacity_step (opacity);
+                if (opacity_step == star->opacity_step) {
+                        node = next_node;
+                        continue;
+                }
+                star->opacity = opacity;
+                star->opacity_step = opacity_step;
 
                 ply_pixel_display_draw_area (view->display,
                                              star->x, star->y,
@@ -472,10 +501,11 @@ view_animate_at_time (view_t *view,
             plugin->mode == PLY_BOOT_SPLASH_MODE_REBOOT)
                 logo_opacity = 1.0;
 
-        if (fabs (logo_opacity - view->logo_opacity) <= DBL_MIN)
+        if (get_opacity_step (logo_opacity) == view->logo_opacity_step)
                 return;
 
         view->logo_opacity = logo_opacity;
+        view->logo_opacity_step = get_opacity_step (logo_opacity);
 
         ply_pixel_display_draw_area (view->display,
                                      logo_x, logo_y,
@@ -503,11 +533,9 @@ animate_at_time (ply_boot_splash_plugin_t *plugin,
 }
 
 static void
-on_timeout (ply_boot_splash_plugin_t *plugin)
+on_frame (ply_boot_splash_plugin_t *plugin)
 {
-        double sleep_time;
-
-        plugin->now = ply_get_timestamp ();
+        plugin->now = ply_event_loop_get_frame_time (ply_event_loop_get_default ());
 
         /* The choice below is between
          *
@@ -529,15 +557,6 @@ on_timeout (ply_boot_splash_plugin_t *plugin)
         time += 1.0 / FRAMES_PER_SECOND;
         animate_at_time (plugin, time);
 #endif
-
-        sleep_time = 1.0 / FRAMES_PER_SECOND;
-        sleep_time = MAX (sleep_time - (ply_get_timestamp () - plugin->now),
-                          0.005);
-
-        ply_event_loop_watch_for_timeout (plugin->loop,
-                                          sleep_time,
-                                          (ply_event_loop_timeout_handler_t)
-                                          on_timeout, plugin);
 }
 
 static void
@@ -577,17 +596,17 @@ start_animation (ply_boot_splash_plugin_t *plugin)
 
         plugin->is_animating = true;
 
-        plugin->start_time = ply_get_timestamp ();
+        plugin->start_time = ply_event_loop_get_frame_time (ply_event_loop_get_default ());
         animate_at_time (plugin, plugin->start_time);
 
         if (plugin->mode == PLY_BOOT_SPLASH_MODE_SHUTDOWN ||
             plugin->mode == PLY_BOOT_SPLASH_MODE_REBOOT)
                 return;
 
-        ply_event_loop_watch_for_timeout (plugin->loop,
-                                          1.0 / FRAMES_PER_SECOND,
-                                          (ply_event_loop_timeout_handler_t)
-                                          on_timeout, plugin);
+        ply_frame_clock_watch_for_frames (ply_frame_clock_get_default (),
+                                          FRAMES_PER_SECOND,
+                                          (ply_frame_clock_handler_t)
+                                          on_frame, plugin);
 }
 
 static void
@@ -601,11 +620,9 @@ stop_animation (ply_boot_splash_plugin_t *plugin)
 
         plugin->is_animating = false;
 
-        if (plugin->loop != NULL) {
-                ply_event_loop_stop_watching_for_timeout (plugin->loop,
-                                                          (ply_event_loop_timeout_handler_t)
-                                                          on_timeout, plugin);
-        }
+        ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                  (ply_frame_clock_handler_t)
+                                                  on_frame, plugin);
         redraw_views (plugin);
 }
 
@@ -615,6 +632,94 @@ detach_from_event_loop (ply_boot_splash_plugin_t *plugin)
         plugin->loop = NULL;
 }
 
+static void
+get_logo_area (view_t          *view,
+               ply_rectangle_t *logo_area)
+{
+        ply_boot_splash_plugin_t *plugin = view->plugin;
+        unsigned long screen_width, screen_height;
+
+        logo_area->width = ply_image_get_width (plugin->logo_image);
+        logo_area->height = ply_image_get_height (plugin->logo_image);
+
+        screen_width = ply_pixel_display_get_width (view->display);
+        screen_height = ply_pixel_display_get_height (view->display);
+
+        logo_area->x = (screen_width / 2) - (logo_area->width / 2);
+        logo_area->y = (screen_height / 2) - (logo_area->height / 2);
+}
+
+static bool
+rectangles_overlap (ply_rectangle_t *rectangle1,
+                    ply_rectangle_t *rectangle2)
+{
+        ply_rectangle_t overlap;
+
+        ply_rectangle_intersect (rectangle1, rectangle2, &overlap);
+
+        return !ply_rectangle_is_empty (&overlap);
+}
+
+/* The gradient never changes and the logo is mostly fully opaque while
+ * it pulses, so both get rendered once: the gradient on its own, and the
+ * logo already blended onto its patch of gradient.  Redraws then copy
+ * them instead of blending every pixel again.
+ */
+static void
+view_update_layers (view_t *view)
+{
+        ply_boot_splash_plugin_t *plugin = view->plugin;
+        unsigned long screen_width, screen_height, screen_scale;
+        ply_rectangle_t area, logo_area;
+        ply_pixel_buffer_t *buffer;
+
+        if (view->layers_are_valid)
+                return;
+
+        view->layers_are_valid = true;
+
+        screen_width = ply_pixel_display_get_width (view->display);
+        screen_height = ply_pixel_display_get_height (view->display);
+        buffer = ply_renderer_get_buffer_for_head (ply_pixel_display_get_renderer (view->display),
+                                                   ply_pixel_display_get_renderer_head (view->display));
+        screen_scale = ply_pixel_buffer_get_device_scale (buffer);
+
+        view->background_layer = ply_pixel_buffer_new (screen_width * screen_scale, screen_height * screen_scale);
+        ply_pixel_buffer_set_owner (view->background_layer, "background layer");
+        ply_pixel_buffer_set_device_scale (view->background_layer, screen_scale);
+
+        get_logo_area (view, &logo_area);
+        view->logo_layer = ply_pixel_buffer_new (logo_area.width * screen_scale, logo_area.height * screen_scale);
+        ply_pixel_buffer_set_owner (view->logo_layer, "logo layer");
+        ply_pixel_buffer_set_device_scale (view->logo_layer, screen_scale);
+
+        if (ply_pixel_buffer_is_over_memory_budget ()) {
+                ply_trace ("no memory left to cache the background and logo");
+                ply_pixel_buffer_free (view->background_layer);
+                ply_pixel_buffer_free (view->logo_layer);
+                view->background_layer = NULL;
+                view->logo_layer = NULL;
+                return;
+        }
+
+        area.x = 0;
+        area.y = 0;
+        area.width = screen_width;
+        area.height = screen_height;
+
+        ply_pixel_buffer_fill_with_gradient (view->background_layer, &area,
+                                             PLYMOUTH_BACKGROUND_START_COLOR,
+                                             PLYMOUTH_BACKGROUND_END_COLOR);
+
+        logo_area.x = 0;
+        logo_area.y = 0;
+        ply_pixel_buffer_fill_with_buffer (view->logo_layer, view->background_layer,
+                                           -((long) screen_width / 2 - (long) logo_area.width / 2),
+                                           -((long) screen_height / 2 - (long) logo_area.height / 2));
+        ply_pixel_buffer_fill_with_argb32_data (view->logo_layer, &logo_area,
+                                                ply_image_get_data (plugin->logo_image));
+}
+
 static void
 draw_background (view_t             *view,
                  ply_pixel_buffer_t *pixel_buffer,
@@ -625,6 +730,13 @@ draw_background (view_t             *view,
 {
         ply_rectangle_t area;
 
+        view_update_layers (view);
+
+        if (view->background_layer != NULL) {
+                ply_pixel_buffer_fill_with_buffer (pixel_buffer, view->background_layer, 0, 0);
+                return;
+        }
+
         area.x = x;
         area.y = y;
         area.width = width;
@@ -645,30 +757,31 @@ draw_normal_view (view_t             *view,
 {
         ply_boot_splash_plugin_t *plugin;
         ply_list_node_t *node;
+        ply_rectangle_t area;
         ply_rectangle_t logo_area;
         ply_rectangle_t star_area;
         uint32_t *logo_data, *star_data;
-        unsigned long screen_width, screen_height;
+        bool logo_is_covering_stars;
 
         plugin = view->plugin;
 
         if (!plugin->is_animating)
                 return;
 
-        logo_area.width = ply_image_get_width (plugin->logo_image);
-        logo_area.height = ply_image_get_height (plugin->logo_image);
-        logo_data = ply_image_get_data (plugin->logo_image);
-
-        screen_width = ply_pixel_display_get_width (view->display);
-        screen_height = ply_pixel_display_get_height (view->display);
+        area.x = x;
+        area.y = y;
+        area.width = width;
+        area.height = height;
 
-        logo_area.x = (screen_width / 2) - (logo_area.width / 2);
-        logo_area.y = (screen_height / 2) - (logo_area.height / 2);
+        get_logo_area (view, &logo_area);
+        logo_data = ply_image_get_data (plugin->logo_image);
 
         star_data = ply_image_get_data (plugin->star_image);
         star_area.width = ply_image_get_width (plugin->star_image);
         star_area.height = ply_image_get_height (plugin->star_image);
 
+        /* Only the stars under the area being redrawn need blending */
+        logo_is_covering_stars = false;
         node = ply_list_get_first_node (view->stars);
         while (node != NULL) {
                 ply_list_node_t *next_node;
@@ -679,13 +792,32 @@ draw_normal_view (view_t             *view,
 
                 star_area.x = star->x;
                 star_area.y = star->y;
-                ply_pixel_buffer_fill_with_argb32_data_at_opacity (pixel_buffer,
-                                                                   &star_area,
-                                                                   star_data,
-                                                                   star->opacity);
+
+                if (rectangles_overlap (&star_area, &area)) {
+                        if (rectangles_overlap (&star_area, &logo_area))
+                                logo_is_covering_stars = true;
+
+                        ply_pixel_buffer_fill_with_argb32_data_at_opacity (pixel_buffer,
+                                                                           &star_area,
+                                                                           star_data,
+                                                                           star->opacity);
+                }
                 node = next_node;
         }
 
+        if (!rectangles_overlap (&logo_area, &area))
+                return;
+
+        /* The cached logo already has the gradient under it, so it can
+         * only stand in when there's nothing else under it to show through
+         */
+        if (view->logo_layer != NULL && view->logo_opacity_step == 255 &&
+            !logo_is_covering_stars) {
+                ply_pixel_buffer_fill_with_buffer (pixel_buffer, view->logo_layer,
+                                                   logo_area.x, logo_area.y);
+                return;
+        }
+
         ply_pixel_buffer_fill_with_argb32_data_at_opacity (pixel_buffer,
                                                            &logo_area,
                                                            logo_data,
@@ -730,7 +862,12 @@ on_draw (view_t             *view,
 
         plugin = view->plugin;
 
-        draw_background (view, pixel_buffer, x, y, width, height);
+        /* A bullet being typed or erased only touches the entry, and
+         * the entry paints over everything under it
+         */
+        if (plugin->state == PLY_BOOT_SPLASH_DISPLAY_NORMAL ||
+            !ply_entry_is_covering_area (view->entry, x, y, width, height))
+                draw_background (view, pixel_buffer, x, y, width, height);
 
         if (plugin->state == PLY_BOOT_SPLASH_DISPLAY_NORMAL)
                 draw_normal_view (view, pixel_buffer, x, y, width, height);
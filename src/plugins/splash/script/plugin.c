@@ -45,11 +45,13 @@
 #include "ply-buffer.h"
 #include "ply-entry.h"
 #include "ply-event-loop.h"
+#include "ply-frame-clock.h"
 #include "ply-key-file.h"
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-image.h"
 #include "ply-pixel-display.h"
+#include "ply-statistics.h"
 #include "ply-trigger.h"
 #include "ply-utils.h"
 
@@ -57,6 +59,7 @@
 #include "script-parse.h"
 #include "script-object.h"
 #include "script-execute.h"
+#include "script-profile.h"
 #include "script-lib-image.h"
 #include "script-lib-sprite.h"
 #include "script-lib-plymouth.h"
@@ -69,6 +72,12 @@
 #define FRAMES_PER_SECOND 50
 #endif
 
+/* How much of each frame the script's refresh function may use before
+ * it gets called less often, so input still gets handled in time
+ */
+#define REFRESH_BUDGET_FRACTION 0.5
+#define MAX_SKIPPED_REFRESHES 4
+
 struct _ply_boot_splash_plugin
 {
         ply_event_loop_t           *loop;
@@ -78,6 +87,7 @@ struct _ply_boot_splash_plugin
 
         char                       *script_filename;
         char                       *image_dir;
+        char                       *profile_filename;
 
         ply_list_t                 *script_env_vars;
         script_op_t                *script_main_op;
@@ -89,6 +99,10 @@ struct _ply_boot_splash_plugin
         script_lib_math_data_t     *script_math_lib;
         script_lib_string_data_t   *script_string_lib;
 
+        int                         frames_per_second;
+        int                         refreshes_to_skip;
+        int                         refreshes_skipped;
+
         uint32_t                    is_animating : 1;
 };
 
@@ -176,6 +190,15 @@ create_plugin (ply_key_file_t *key_file)
                                                           "script",
                                                           "ScriptFile");
 
+        /* Profile=true times the script's functions and lines, for theme
+         * authors to see where a frame goes.  The results are written to
+         * ProfileFile, or to the debug log, when the splash stops.
+         */
+        script_profile_set_enabled (ply_key_file_get_bool (key_file, "script", "Profile"));
+        plugin->profile_filename = ply_key_file_get_value (key_file,
+                                                           "script",
+                                                           "ProfileFile");
+
         plugin->script_env_vars = ply_list_new ();
         ply_key_file_foreach_entry (key_file, add_script_env_var, plugin->script_env_vars);
 
@@ -212,26 +235,80 @@ destroy_plugin (ply_boot_splash_plugin_t *plugin)
         ply_list_free (plugin->script_env_vars);
         free (plugin->script_filename);
         free (plugin->image_dir);
+        free (plugin->profile_filename);
         free (plugin);
 }
 
+/* Calls the refresh function less often while it takes more than its
+ * share of a frame, and goes back up once it's quick again
+ */
 static void
-on_timeout (ply_boot_splash_plugin_t *plugin)
+update_refresh_budget (ply_boot_splash_plugin_t *plugin,
+                       double                    duration)
 {
-        double sleep_time;
-
-        sleep_time = 1.0 / plugin->script_plymouth_lib->refresh_rate;
-        ply_event_loop_watch_for_timeout (plugin->loop,
-                                          sleep_time,
-                                          (ply_event_loop_timeout_handler_t)
-                                          on_timeout, plugin);
+        double budget = REFRESH_BUDGET_FRACTION / plugin->frames_per_second;
+        int refreshes_to_skip;
+
+        if (duration > budget) {
+                refreshes_to_skip = MIN ((int) ceil (duration / budget) - 1, MAX_SKIPPED_REFRESHES);
+                if (refreshes_to_skip > plugin->refreshes_to_skip) {
+                        ply_trace ("refresh took %.1fms, calling it once every %d frames",
+                                   duration * 1000, refreshes_to_skip + 1);
+                        plugin->refreshes_to_skip = refreshes_to_skip;
+                }
+        } else if (duration < budget / 2 && plugin->refreshes_to_skip > 0) {
+                plugin->refreshes_to_skip--;
+        }
+}
 
-        script_lib_plymouth_on_refresh (plugin->script_state,
-                                        plugin->script_plymouth_lib);
+/* Runs after the event loop has handled everything else that woke it up,
+ * so key presses and prompts that came in with the frame go first
+ */
+static void
+on_refresh (ply_boot_splash_plugin_t *plugin)
+{
+        double start_time, duration;
+
+        if (plugin->refreshes_skipped < plugin->refreshes_to_skip) {
+                plugin->refreshes_skipped++;
+                ply_statistics_add_to_count ("script.skipped-refreshes", 1);
+        } else {
+                plugin->refreshes_skipped = 0;
+
+                start_time = ply_get_timestamp ();
+                script_lib_plymouth_on_refresh (plugin->script_state,
+                                                plugin->script_plymouth_lib);
+                duration = ply_get_timestamp () - start_time;
+                ply_statistics_add_duration ("script.refresh", duration);
+                update_refresh_budget (plugin, duration);
+        }
 
+        /* Still draw what the input handlers changed on skipped frames */
+        start_time = ply_get_timestamp ();
         pause_displays (plugin);
         script_lib_sprite_refresh (plugin->script_sprite_lib);
         unpause_displays (plugin);
+        ply_statistics_add_duration ("script.sprite-refresh", ply_get_timestamp () - start_time);
+}
+
+static void
+on_frame (ply_boot_splash_plugin_t *plugin)
+{
+        int frames_per_second;
+
+        /* The script may have changed its refresh rate since the last frame */
+        frames_per_second = MAX (plugin->script_plymouth_lib->refresh_rate, 1);
+        if (frames_per_second != plugin->frames_per_second) {
+                plugin->frames_per_second = frames_per_second;
+                ply_frame_clock_watch_for_frames (ply_frame_clock_get_default (),
+                                                  frames_per_second,
+                                                  (ply_frame_clock_handler_t)
+                                                  on_frame, plugin);
+        }
+
+        ply_event_loop_watch_for_idle (plugin->loop,
+                                       (ply_event_loop_idle_handler_t)
+                                       on_refresh, plugin);
 }
 
 static void
@@ -285,7 +362,10 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
                 ply_keyboard_add_input_handler (plugin->keyboard,
                                                 (ply_keyboard_input_handler_t)
                                                 on_keyboard_input, plugin);
-        on_timeout (plugin);
+        plugin->frames_per_second = 0;
+        plugin->refreshes_to_skip = 0;
+        plugin->refreshes_skipped = 0;
+        on_frame (plugin);
 
         return true;
 }
@@ -315,10 +395,15 @@ stop_script_animation (ply_boot_splash_plugin_t *plugin)
                                      plugin->script_plymouth_lib);
         script_lib_sprite_refresh (plugin->script_sprite_lib);
 
-        if (plugin->loop != NULL)
-                ply_event_loop_stop_watching_for_timeout (plugin->loop,
-                                                          (ply_event_loop_timeout_handler_t)
-                                                          on_timeout, plugin);
+        if (script_profile_is_enabled ())
+                script_profile_dump (plugin->profile_filename);
+
+        ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                  (ply_frame_clock_handler_t)
+                                                  on_frame, plugin);
+        ply_event_loop_stop_watching_for_idle (plugin->loop,
+                                               (ply_event_loop_idle_handler_t)
+                                               on_refresh, plugin);
 
         if (plugin->keyboard != NULL) {
                 ply_keyboard_remove_input_handler (plugin->keyboard,
@@ -362,14 +447,25 @@ on_keyboard_input (ply_boot_splash_plugin_t *plugin,
                    const char               *keyboard_input,
                    size_t                    character_size)
 {
-        char keyboard_string[character_size + 1];
+        /* Scripts get called once per key, even for pasted text */
+        while (character_size > 0) {
+                char keyboard_string[PLY_UTF8_CHARACTER_SIZE_MAX + 1];
+                ssize_t key_size;
+
+                key_size = ply_utf8_character_get_size (keyboard_input, character_size);
+                if (key_size <= 0)
+                        break;
 
-        memcpy (keyboard_string, keyboard_input, character_size);
-        keyboard_string[character_size] = '\0';
+                memcpy (keyboard_string, keyboard_input, key_size);
+                keyboard_string[key_size] = '\0';
 
-        script_lib_plymouth_on_keyboard_input (plugin->script_state,
-                                               plugin->script_plymouth_lib,
-                                               keyboard_string);
+                script_lib_plymouth_on_keyboard_input (plugin->script_state,
+                                                       plugin->script_plymouth_lib,
+                                                       keyboard_string);
+
+                keyboard_input += key_size;
+                character_size -= key_size;
+        }
 }
 
 static void
@@ -0,0 +1,196 @@
+/* plymouth-script-benchmark.c - times script themes without a display
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-boot-splash-plugin.h"
+#include "ply-list.h"
+#include "ply-utils.h"
+
+#include "script.h"
+#include "script-execute.h"
+#include "script-object.h"
+#include "script-parse.h"
+#include "script-lib-image.h"
+#include "script-lib-sprite.h"
+#include "script-lib-plymouth.h"
+#include "script-lib-math.h"
+#include "script-lib-string.h"
+
+/* Runs each script the way the script plugin does, but with no displays
+ * to draw to, and calls its refresh function for a number of frames.
+ * Prints one line per script, so results can be diffed between builds:
+ *
+ *   SCRIPT PARSE_MS FRAMES US_PER_FRAME ALLOCATIONS_PER_FRAME PEAK_OBJECTS
+ *
+ * PEAK_OBJECTS is the most script objects alive at once while the
+ * frames ran.
+ */
+
+#define DEFAULT_NUMBER_OF_FRAMES 1000
+#define FRAMES_PER_SECOND 50
+
+/* glibc lets a program put its own malloc in front of the real one, which
+ * is how allocations made anywhere, libply included, get counted */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t number_of_elements,
+                            size_t element_size);
+extern void *__libc_realloc (void  *pointer,
+                             size_t size);
+
+static unsigned long number_of_allocations = 0;
+
+void *
+malloc (size_t size)
+{
+        number_of_allocations++;
+        return __libc_malloc (size);
+}
+
+void *
+calloc (size_t number_of_elements,
+        size_t element_size)
+{
+        number_of_allocations++;
+        return __libc_calloc (number_of_elements, element_size);
+}
+
+void *
+realloc (void  *pointer,
+         size_t size)
+{
+        number_of_allocations++;
+        return __libc_realloc (pointer, size);
+}
+
+static bool
+run_script (const char *filename,
+            int         number_of_frames)
+{
+        script_op_t *main_op;
+        script_state_t *state;
+        script_lib_image_data_t *image_lib;
+        script_lib_sprite_data_t *sprite_lib;
+        script_lib_plymouth_data_t *plymouth_lib;
+        script_lib_math_data_t *math_lib;
+        script_lib_string_data_t *string_lib;
+        script_return_t ret;
+        ply_list_t *displays;
+        char *directory_name, *image_dir;
+        double start_time, parse_time, frame_time;
+        unsigned long allocations;
+        int frame;
+
+        start_time = ply_get_timestamp ();
+        main_op = script_parse_file (filename);
+        parse_time = ply_get_timestamp () - start_time;
+
+        if (main_op == NULL) {
+                fprintf (stderr, "could not parse %s\n", filename);
+                return false;
+        }
+
+        /* images get looked up next to the script, like in a theme */
+        directory_name = strdup (filename);
+        image_dir = strdup (dirname (directory_name));
+        free (directory_name);
+
+        displays = ply_list_new ();
+
+        state = script_state_new (NULL);
+        image_lib = script_lib_image_setup (state, image_dir);
+        sprite_lib = script_lib_sprite_setup (state, displays);
+        plymouth_lib = script_lib_plymouth_setup (state, PLY_BOOT_SPLASH_MODE_BOOT_UP,
+                                                  FRAMES_PER_SECOND);
+        math_lib = script_lib_math_setup (state);
+        string_lib = script_lib_string_setup (state);
+
+        ret = script_execute (state, main_op);
+        script_obj_unref (ret.object);
+
+        script_obj_reset_peak_live_count ();
+        allocations = number_of_allocations;
+        start_time = ply_get_timestamp ();
+
+        for (frame = 0; frame < number_of_frames; frame++) {
+                script_lib_plymouth_on_boot_progress (state, plymouth_lib,
+                                                      (double) frame / FRAMES_PER_SECOND,
+                                                      (double) frame / number_of_frames);
+                script_lib_plymouth_on_refresh (state, plymouth_lib);
+                script_lib_sprite_refresh (sprite_lib);
+        }
+
+        frame_time = (ply_get_timestamp () - start_time) / number_of_frames;
+        allocations = number_of_allocations - allocations;
+
+        printf ("%s %.3f %d %.3f %.1f %u\n", filename, parse_time * 1000.0,
+                number_of_frames, frame_time * 1000000.0,
+                (double) allocations / number_of_frames,
+                script_obj_get_peak_live_count ());
+        fflush (stdout);
+
+        script_lib_plymouth_on_quit (state, plymouth_lib);
+
+        script_state_destroy (state);
+        script_lib_sprite_destroy (sprite_lib);
+        script_lib_image_destroy (image_lib);
+        script_lib_plymouth_destroy (plymouth_lib);
+        script_lib_math_destroy (math_lib);
+        script_lib_string_destroy (string_lib);
+        script_parse_op_free (main_op);
+
+        ply_list_free (displays);
+        free (image_dir);
+
+        return true;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        int number_of_frames = DEFAULT_NUMBER_OF_FRAMES;
+        bool ret = true;
+        int i = 1;
+
+        if (argc > 2 && strcmp (argv[1], "--frames") == 0) {
+                number_of_frames = atoi (argv[2]);
+                i = 3;
+        }
+
+        if (i >= argc || number_of_frames <= 0) {
+                fprintf (stderr, "usage: %s [--frames FRAMES] SCRIPT...\n", argv[0]);
+                return 1;
+        }
+
+        printf ("# script parse_ms frames us_per_frame allocations_per_frame peak_objects\n");
+
+        for (; i < argc; i++) {
+                if (!run_script (argv[i], number_of_frames))
+                        ret = false;
+        }
+
+        return ret ? 0 : 1;
+}
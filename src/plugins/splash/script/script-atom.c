@@ -0,0 +1,101 @@
+/* script-atom.c - shared copies of identifier strings
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-hashtable.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "script-atom.h"
+
+typedef struct
+{
+        int          refcount;
+        unsigned int hash;
+        char         string[];
+} script_atom_t;
+
+static ply_hashtable_t *script_atoms = NULL;
+
+static script_atom_t *script_atom_from_string (const char *atom)
+{
+        return (script_atom_t *) (atom - offsetof (script_atom_t, string));
+}
+
+const char *script_atom_get (const char *string)
+{
+        script_atom_t *atom;
+        unsigned int hash;
+        size_t length;
+
+        if (!string) return NULL;
+
+        hash = ply_hashtable_string_hash ((void *) string);
+        if (script_atoms == NULL) {
+                script_atoms = ply_hashtable_new (ply_hashtable_string_hash,
+                                                  ply_hashtable_string_compare);
+        } else {
+                atom = ply_hashtable_lookup_with_hash (script_atoms, (void *) string, hash);
+                if (atom) {
+                        atom->refcount++;
+                        return atom->string;
+                }
+        }
+
+        length = strlen (string);
+        atom = malloc (sizeof(script_atom_t) + length + 1);
+        atom->refcount = 1;
+        atom->hash = hash;
+        memcpy (atom->string, string, length + 1);
+        ply_hashtable_insert (script_atoms, atom->string, atom);
+        return atom->string;
+}
+
+const char *script_atom_ref (const char *string)
+{
+        if (!string) return NULL;
+        script_atom_from_string (string)->refcount++;
+        return string;
+}
+
+void script_atom_unref (const char *string)
+{
+        script_atom_t *atom;
+
+        if (!string) return;
+        atom = script_atom_from_string (string);
+        atom->refcount--;
+        if (atom->refcount > 0) return;
+
+        ply_hashtable_remove (script_atoms, atom->string);
+        free (atom);
+}
+
+unsigned int script_atom_get_hash (const char *string)
+{
+        return script_atom_from_string (string)->hash;
+}
+
+int script_atom_compare (void *atom,
+                         void *string)
+{
+        if (atom == string) return 0;
+        return strcmp (atom, string);
+}
@@ -0,0 +1,37 @@
+/* script-atom.h - shared copies of identifier strings
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_ATOM_H
+#define SCRIPT_ATOM_H
+
+/* An atom is the one shared copy of a string.  Getting the same string
+ * twice gives the same pointer, so hash tables keyed by atoms can match
+ * keys by pointer before falling back to comparing the strings.  Atoms
+ * are plain nul terminated strings and can be used wherever one is.
+ */
+const char *script_atom_get (const char *string);
+const char *script_atom_ref (const char *atom);
+void script_atom_unref (const char *atom);
+unsigned int script_atom_get_hash (const char *atom);
+
+/* ply_hashtable compare function for tables keyed by atoms */
+int script_atom_compare (void *atom,
+                         void *string);
+
+#endif /* SCRIPT_ATOM_H */
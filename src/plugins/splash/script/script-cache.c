@@ -0,0 +1,662 @@
+/* script-cache.c - parsed scripts saved for fast loading
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-list.h"
+#include "ply-utils.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "script.h"
+#include "script-atom.h"
+#include "script-cache.h"
+#include "script-debug.h"
+#include "script-parse.h"
+
+/* After the header, each op and expression is written depth first as its
+ * type, line and column followed by what it holds.  Numbers are kept in
+ * the byte order of the machine that wrote them.  Locations are named
+ * after the file being loaded rather than the one that was cached, which
+ * may have been a copy somewhere else.
+ */
+#define SCRIPT_CACHE_VERSION 1
+#define SCRIPT_CACHE_NO_ELEMENT UINT32_MAX
+
+typedef struct
+{
+        char     magic[8];
+        uint32_t version; /* also reads wrong if the byte order differs */
+        uint32_t number_size;
+        uint64_t source_size;
+        uint64_t source_hash;
+} script_cache_header_t;
+
+typedef struct
+{
+        const char *data;
+        size_t      size;
+        size_t      offset;
+        const char *name;
+} script_cache_reader_t;
+
+static const char script_cache_magic[8] = { 'P', 'L', 'Y', 'S', 'C', 'R', 'P', 'T' };
+
+static bool script_cache_read_op (script_cache_reader_t *reader,
+                                  script_op_t          **op);
+static void script_cache_write_op (FILE         *stream,
+                                   script_op_t  *op);
+
+static uint64_t script_cache_hash (const char *data,
+                                   size_t      size)
+{
+        uint64_t hash = UINT64_C (14695981039346656037);
+        size_t i;
+
+        for (i = 0; i < size; i++) {
+                hash ^= (unsigned char) data[i];
+                hash *= UINT64_C (1099511628211);
+        }
+        return hash;
+}
+
+static char *script_cache_map_file (const char *filename,
+                                    size_t     *size)
+{
+        struct stat file_info;
+        char *data;
+        int fd;
+
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return NULL;
+
+        data = NULL;
+        if (fstat (fd, &file_info) == 0 && file_info.st_size > 0) {
+                data = mmap (NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED)
+                        data = NULL;
+                else
+                        *size = file_info.st_size;
+        }
+        close (fd);
+        return data;
+}
+
+static bool script_cache_read_bytes (script_cache_reader_t *reader,
+                                     void                  *bytes,
+                                     size_t                 size)
+{
+        if (reader->size - reader->offset < size) return false;
+        memcpy (bytes, reader->data + reader->offset, size);
+        reader->offset += size;
+        return true;
+}
+
+static bool script_cache_read_string (script_cache_reader_t *reader,
+                                      char                 **string)
+{
+        uint32_t length;
+
+        if (!script_cache_read_bytes (reader, &length, sizeof(length))) return false;
+        if (reader->size - reader->offset < length) return false;
+        *string = strndup (reader->data + reader->offset, length);
+        reader->offset += length;
+        return true;
+}
+
+/* Reads the type and location that start every element.  Returns false
+ * when the element is missing, or the cache ends too early.
+ */
+static bool script_cache_read_element_start (script_cache_reader_t   *reader,
+                                             uint32_t                *type,
+                                             script_debug_location_t *location)
+{
+        int32_t line_and_column[2];
+
+        if (!script_cache_read_bytes (reader, type, sizeof(*type)) ||
+            *type == SCRIPT_CACHE_NO_ELEMENT ||
+            !script_cache_read_bytes (reader, line_and_column, sizeof(line_and_column)))
+                return false;
+
+        location->line_index = line_and_column[0];
+        location->column_index = line_and_column[1];
+        location->name = (char *) reader->name;
+        return true;
+}
+
+static bool script_cache_read_exp (script_cache_reader_t *reader,
+                                   script_exp_t         **exp_out);
+
+/* An element that is allowed to be missing */
+static bool script_cache_read_optional_exp (script_cache_reader_t *reader,
+                                            script_exp_t         **exp)
+{
+        size_t offset = reader->offset;
+        uint32_t type;
+
+        if (script_cache_read_bytes (reader, &type, sizeof(type)) &&
+            type == SCRIPT_CACHE_NO_ELEMENT) {
+                *exp = NULL;
+                return true;
+        }
+        reader->offset = offset;
+        return script_cache_read_exp (reader, exp);
+}
+
+static bool script_cache_read_optional_op (script_cache_reader_t *reader,
+                                           script_op_t          **op)
+{
+        size_t offset = reader->offset;
+        uint32_t type;
+
+        if (script_cache_read_bytes (reader, &type, sizeof(type)) &&
+            type == SCRIPT_CACHE_NO_ELEMENT) {
+                *op = NULL;
+                return true;
+        }
+        reader->offset = offset;
+        return script_cache_read_op (reader, op);
+}
+
+static bool script_cache_read_exp_list (script_cache_reader_t *reader,
+                                        ply_list_t            *list)
+{
+        uint32_t count, i;
+
+        if (!script_cache_read_bytes (reader, &count, sizeof(count))) return false;
+        for (i = 0; i < count; i++) {
+                script_exp_t *sub;
+                if (!script_cache_read_exp (reader, &sub)) return false;
+                ply_list_append_data (list, sub);
+        }
+        return true;
+}
+
+static bool script_cache_read_exp (script_cache_reader_t *reader,
+                                   script_exp_t         **exp_out)
+{
+        script_debug_location_t location;
+        script_exp_t *exp;
+        uint32_t type;
+        bool ret = false;
+
+        if (!script_cache_read_element_start (reader, &type, &location)) return false;
+        if (type > SCRIPT_EXP_TYPE_ASSIGN_EXTEND) return false;
+
+        /* Built with everything it owns empty, so it can be freed as far
+         * as it got if the cache turns out to be broken
+         */
+        exp = calloc (1, sizeof(script_exp_t));
+        exp->type = type;
+        script_debug_add_element (exp, &location);
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                ret = script_cache_read_exp (reader, &exp->data.dual.sub_a) &&
+                      script_cache_read_exp (reader, &exp->data.dual.sub_b);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                ret = script_cache_read_exp (reader, &exp->data.sub);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                ret = script_cache_read_bytes (reader, &exp->data.number, sizeof(exp->data.number));
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                ret = true;
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        {
+                char *string;
+                ret = script_cache_read_string (reader, &string);
+                if (ret) {
+                        exp->data.string = (char *) script_atom_get (string);
+                        free (string);
+                }
+                break;
+        }
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                exp->data.parameters = ply_list_new ();
+                ret = script_cache_read_exp_list (reader, exp->data.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                exp->data.function_exe.parameters = ply_list_new ();
+                ret = script_cache_read_exp (reader, &exp->data.function_exe.name) &&
+                      script_cache_read_exp_list (reader, exp->data.function_exe.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+        {
+                script_function_t *function;
+                uint32_t count, i;
+
+                function = script_function_script_new (NULL, NULL, ply_list_new ());
+                exp->data.function_def = function;
+                if (!script_cache_read_bytes (reader, &count, sizeof(count))) break;
+                for (i = 0; i < count; i++) {
+                        char *parameter;
+                        if (!script_cache_read_string (reader, &parameter)) break;
+                        ply_list_append_data (function->parameters, parameter);
+                }
+                if (i < count) break;
+                ret = script_cache_read_optional_op (reader, &function->data.script);
+                break;
+        }
+        }
+
+        if (!ret) {
+                script_parse_exp_free (exp);
+                return false;
+        }
+        *exp_out = exp;
+        return true;
+}
+
+static bool script_cache_read_op (script_cache_reader_t *reader,
+                                  script_op_t          **op_out)
+{
+        script_debug_location_t location;
+        script_op_t *op;
+        uint32_t type;
+        bool ret = false;
+
+        if (!script_cache_read_element_start (reader, &type, &location)) return false;
+        if (type > SCRIPT_OP_TYPE_CONTINUE) return false;
+
+        op = calloc (1, sizeof(script_op_t));
+        op->type = type;
+        script_debug_add_element (op, &location);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+                ret = script_cache_read_exp (reader, &op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+        {
+                uint32_t count, i;
+
+                op->data.list = ply_list_new ();
+                if (!script_cache_read_bytes (reader, &count, sizeof(count))) break;
+                for (i = 0; i < count; i++) {
+                        script_op_t *sub;
+                        if (!script_cache_read_op (reader, &sub)) break;
+                        ply_list_append_data (op->data.list, sub);
+                }
+                ret = i == count;
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                ret = script_cache_read_exp (reader, &op->data.cond_op.cond) &&
+                      script_cache_read_optional_op (reader, &op->data.cond_op.op1) &&
+                      script_cache_read_optional_op (reader, &op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_RETURN:
+                ret = script_cache_read_optional_exp (reader, &op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                ret = true;
+                break;
+        }
+
+        if (!ret) {
+                script_parse_op_free (op);
+                return false;
+        }
+        *op_out = op;
+        return true;
+}
+
+script_op_t *script_cache_load (const char *filename)
+{
+        script_cache_header_t header;
+        script_cache_reader_t reader;
+        script_op_t *op = NULL;
+        char *cache_filename;
+        char *source, *cache;
+        size_t source_size = 0, cache_size = 0;
+        uint64_t source_hash;
+
+        source = script_cache_map_file (filename, &source_size);
+        if (source == NULL) return NULL;
+        source_hash = script_cache_hash (source, source_size);
+        munmap (source, source_size);
+
+        asprintf (&cache_filename, "%s" SCRIPT_CACHE_SUFFIX, filename);
+        cache = script_cache_map_file (cache_filename, &cache_size);
+        free (cache_filename);
+        if (cache == NULL) return NULL;
+
+        reader.data = cache;
+        reader.size = cache_size;
+        reader.offset = 0;
+        reader.name = filename;
+
+        if (script_cache_read_bytes (&reader, &header, sizeof(header)) &&
+            memcmp (header.magic, script_cache_magic, sizeof(script_cache_magic)) == 0 &&
+            header.version == SCRIPT_CACHE_VERSION &&
+            header.number_size == sizeof(script_number_t) &&
+            header.source_size == source_size &&
+            header.source_hash == source_hash) {
+                if (!script_cache_read_op (&reader, &op) || reader.offset != reader.size) {
+                        if (op) script_parse_op_free (op);
+                        op = NULL;
+                }
+        }
+
+        munmap (cache, cache_size);
+        return op;
+}
+
+static void script_cache_write_bytes (FILE       *stream,
+                                      const void *bytes,
+                                      size_t      size)
+{
+        fwrite (bytes, 1, size, stream);
+}
+
+static void script_cache_write_uint32 (FILE         *stream,
+                                       uint32_t      value)
+{
+        script_cache_write_bytes (stream, &value, sizeof(value));
+}
+
+static void script_cache_write_string (FILE         *stream,
+                                       const char   *string)
+{
+        uint32_t length = strlen (string);
+
+        script_cache_write_uint32 (stream, length);
+        script_cache_write_bytes (stream, string, length);
+}
+
+/* Returns false, having written that it is missing, when element is NULL */
+static bool script_cache_write_element_start (FILE         *stream,
+                                              void         *element,
+                                              uint32_t      type)
+{
+        script_debug_location_t *location;
+        int32_t line_and_column[2] = { 0, 0 };
+
+        if (element == NULL) {
+                script_cache_write_uint32 (stream, SCRIPT_CACHE_NO_ELEMENT);
+                return false;
+        }
+
+        location = script_debug_lookup_element (element);
+        if (location) {
+                line_and_column[0] = location->line_index;
+                line_and_column[1] = location->column_index;
+        }
+        script_cache_write_uint32 (stream, type);
+        script_cache_write_bytes (stream, line_and_column, sizeof(line_and_column));
+        return true;
+}
+
+static void script_cache_write_exp (FILE         *stream,
+                                    script_exp_t *exp);
+
+static void script_cache_write_exp_list (FILE         *stream,
+                                         ply_list_t   *list)
+{
+        ply_list_node_t *node;
+
+        script_cache_write_uint32 (stream, ply_list_get_length (list));
+        for (node = ply_list_get_first_node (list);
+             node;
+             node = ply_list_get_next_node (list, node)) {
+                script_cache_write_exp (stream, ply_list_node_get_data (node));
+        }
+}
+
+static void script_cache_write_exp (FILE         *stream,
+                                    script_exp_t *exp)
+{
+        if (!script_cache_write_element_start (stream, exp, exp ? exp->type : 0))
+                return;
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                script_cache_write_exp (stream, exp->data.dual.sub_a);
+                script_cache_write_exp (stream, exp->data.dual.sub_b);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                script_cache_write_exp (stream, exp->data.sub);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                script_cache_write_bytes (stream, &exp->data.number, sizeof(exp->data.number));
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                script_cache_write_string (stream, exp->data.string);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                script_cache_write_exp_list (stream, exp->data.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_cache_write_exp (stream, exp->data.function_exe.name);
+                script_cache_write_exp_list (stream, exp->data.function_exe.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+        {
+                script_function_t *function = exp->data.function_def;
+                ply_list_node_t *node;
+
+                script_cache_write_uint32 (stream, ply_list_get_length (function->parameters));
+                for (node = ply_list_get_first_node (function->parameters);
+                     node;
+                     node = ply_list_get_next_node (function->parameters, node)) {
+                        script_cache_write_string (stream, ply_list_node_get_data (node));
+                }
+                script_cache_write_op (stream, function->data.script);
+                break;
+        }
+        }
+}
+
+static void script_cache_write_op (FILE         *stream,
+                                   script_op_t  *op)
+{
+        if (!script_cache_write_element_start (stream, op, op ? op->type : 0))
+                return;
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+                script_cache_write_exp (stream, op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+        {
+                ply_list_node_t *node;
+
+                script_cache_write_uint32 (stream, ply_list_get_length (op->data.list));
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_cache_write_op (stream, ply_list_node_get_data (node));
+                }
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_cache_write_exp (stream, op->data.cond_op.cond);
+                script_cache_write_op (stream, op->data.cond_op.op1);
+                script_cache_write_op (stream, op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_RETURN:
+                script_cache_write_exp (stream, op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+bool script_cache_save (script_op_t *op,
+                        const char  *filename)
+{
+        script_cache_header_t header = { { 0 } };
+        char *cache_filename, *temporary_filename;
+        FILE *stream;
+        char *source;
+        size_t source_size = 0;
+        bool ret = false;
+        int fd;
+
+        source = script_cache_map_file (filename, &source_size);
+        if (source == NULL) return false;
+
+        memcpy (header.magic, script_cache_magic, sizeof(script_cache_magic));
+        header.version = SCRIPT_CACHE_VERSION;
+        header.number_size = sizeof(script_number_t);
+        header.source_size = source_size;
+        header.source_hash = script_cache_hash (source, source_size);
+        munmap (source, source_size);
+
+        /* Written to the side and renamed into place, so a reader never
+         * sees a half written file
+         */
+        asprintf (&cache_filename, "%s" SCRIPT_CACHE_SUFFIX, filename);
+        asprintf (&temporary_filename, "%s.XXXXXX", cache_filename);
+
+        fd = mkostemp (temporary_filename, O_CLOEXEC);
+        if (fd < 0)
+                goto out;
+
+        stream = fdopen (fd, "w");
+        if (stream == NULL) {
+                close (fd);
+                unlink (temporary_filename);
+                goto out;
+        }
+
+        script_cache_write_bytes (stream, &header, sizeof(header));
+        script_cache_write_op (stream, op);
+
+        if (!ferror (stream) && fchmod (fd, 0644) == 0)
+                ret = true;
+
+        if (fclose (stream) != 0)
+                ret = false;
+
+        if (ret && rename (temporary_filename, cache_filename) < 0)
+                ret = false;
+
+        if (!ret)
+                unlink (temporary_filename);
+out:
+        free (temporary_filename);
+        free (cache_filename);
+        return ret;
+}
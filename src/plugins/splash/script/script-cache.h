@@ -0,0 +1,41 @@
+/* script-cache.h - parsed scripts saved for fast loading
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include <stdbool.h>
+
+#include "script.h"
+
+/* A script can have its parsed and optimized ops saved next to it, in a
+ * file named after it with SCRIPT_CACHE_SUFFIX appended, so loading it
+ * skips scanning and parsing.  The cache holds a hash of the source it
+ * was made from, and is ignored once the source no longer matches.
+ */
+#define SCRIPT_CACHE_SUFFIX ".cache"
+
+/* Gives back the ops saved for filename, not yet compiled, or NULL when
+ * there is no up to date cache
+ */
+script_op_t *script_cache_load (const char *filename);
+bool script_cache_save (script_op_t *op,
+                        const char  *filename);
+
+#endif /* SCRIPT_CACHE_H */
@@ -0,0 +1,562 @@
+/* script-compile.c - lowering of parsed scripts to bytecode
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "script.h"
+#include "script-atom.h"
+#include "script-compile.h"
+#include "script-object.h"
+#include "script-profile.h"
+
+typedef struct
+{
+        script_code_t *code;
+        unsigned int   capacity;
+        unsigned int   stack_depth;
+
+        /* Breaks and continues waiting for the end of the innermost loop
+         * to be known, or for the end of the code when they are not in a
+         * loop, which hands them back to the caller like the tree walker
+         */
+        ply_list_t    *pending_jumps;
+
+        ply_hashtable_t *slots; /* names are atoms, so keyed by pointer */
+} script_compiler_t;
+
+typedef struct
+{
+        unsigned int instruction;
+        bool         is_break;
+} script_compile_pending_jump_t;
+
+static void script_compile_exp (script_compiler_t *compiler,
+                                script_exp_t      *exp);
+static void script_compile_op (script_compiler_t *compiler,
+                               script_op_t       *op);
+
+static script_instruction_t *script_compile_emit (script_compiler_t *compiler,
+                                                  script_opcode_t    opcode,
+                                                  int                stack_change)
+{
+        script_code_t *code = compiler->code;
+        script_instruction_t *instruction;
+
+        if (code->instruction_count == compiler->capacity) {
+                compiler->capacity = compiler->capacity ? compiler->capacity * 2 : 16;
+                code->instructions = realloc (code->instructions,
+                                              compiler->capacity * sizeof(script_instruction_t));
+        }
+
+        instruction = &code->instructions[code->instruction_count++];
+        memset (instruction, 0, sizeof(script_instruction_t));
+        instruction->opcode = opcode;
+
+        compiler->stack_depth += stack_change;
+        if (compiler->stack_depth > code->max_stack_depth)
+                code->max_stack_depth = compiler->stack_depth;
+
+        return instruction;
+}
+
+static void script_compile_emit_name (script_compiler_t *compiler,
+                                      script_opcode_t    opcode,
+                                      int                stack_change,
+                                      char              *name)
+{
+        script_instruction_t *instruction = script_compile_emit (compiler, opcode, stack_change);
+
+        instruction->data.string = name;
+        instruction->operand = script_atom_get_hash (name);
+}
+
+static void script_compile_emit_variable (script_compiler_t *compiler,
+                                          script_opcode_t    opcode,
+                                          int                stack_change,
+                                          char              *name)
+{
+        script_code_t *code = compiler->code;
+        unsigned int slot = (uintptr_t) ply_hashtable_lookup (compiler->slots, name);
+
+        if (slot == 0) {
+                slot = ++code->slot_count;
+                ply_hashtable_insert (compiler->slots, name, (void *) (uintptr_t) slot);
+        }
+
+        script_compile_emit_name (compiler, opcode, stack_change, name);
+        code->instructions[code->instruction_count - 1].slot = slot - 1;
+}
+
+static unsigned int script_compile_get_position (script_compiler_t *compiler)
+{
+        return compiler->code->instruction_count;
+}
+
+static void script_compile_set_target (script_compiler_t *compiler,
+                                       unsigned int       instruction,
+                                       unsigned int       target)
+{
+        compiler->code->instructions[instruction].operand = target;
+}
+
+static void script_compile_dual (script_compiler_t *compiler,
+                                 script_exp_t      *exp)
+{
+        script_compile_exp (compiler, exp->data.dual.sub_a);
+        script_compile_exp (compiler, exp->data.dual.sub_b);
+}
+
+static void script_compile_apply (script_compiler_t *compiler,
+                                  script_exp_t      *exp,
+                                  script_opcode_t    opcode,
+                                  script_obj_t *(*function)(script_obj_t *,
+                                                            script_obj_t *))
+{
+        script_instruction_t *instruction;
+
+        script_compile_dual (compiler, exp);
+        instruction = script_compile_emit (compiler, opcode, -1);
+        instruction->data.apply = function;
+}
+
+static void script_compile_cmp (script_compiler_t      *compiler,
+                                script_exp_t           *exp,
+                                script_obj_cmp_result_t condition)
+{
+        script_instruction_t *instruction;
+
+        script_compile_dual (compiler, exp);
+        instruction = script_compile_emit (compiler, SCRIPT_OPCODE_CMP, -1);
+        instruction->operand = condition;
+}
+
+static void script_compile_logic (script_compiler_t *compiler,
+                                  script_exp_t      *exp)
+{
+        unsigned int jump;
+
+        script_compile_exp (compiler, exp->data.dual.sub_a);
+        jump = script_compile_get_position (compiler);
+        script_compile_emit (compiler,
+                             exp->type == SCRIPT_EXP_TYPE_AND ? SCRIPT_OPCODE_AND : SCRIPT_OPCODE_OR,
+                             -1);
+        script_compile_exp (compiler, exp->data.dual.sub_b);
+        script_compile_set_target (compiler, jump, script_compile_get_position (compiler));
+}
+
+static void script_compile_func (script_compiler_t *compiler,
+                                 script_exp_t      *exp)
+{
+        script_exp_t *name_exp = exp->data.function_exe.name;
+        ply_list_t *parameter_expressions = exp->data.function_exe.parameters;
+        ply_list_node_t *node;
+        script_instruction_t *instruction;
+        unsigned int count = 0;
+
+        if (name_exp->type == SCRIPT_EXP_TYPE_HASH &&
+            name_exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING) {
+                script_compile_exp (compiler, name_exp->data.dual.sub_a);
+                script_compile_emit_name (compiler, SCRIPT_OPCODE_METHOD_STRING, 1,
+                                          name_exp->data.dual.sub_b->data.string);
+        } else if (name_exp->type == SCRIPT_EXP_TYPE_HASH) {
+                /* The key is looked up before the object, as the tree walker does */
+                script_compile_exp (compiler, name_exp->data.dual.sub_b);
+                script_compile_exp (compiler, name_exp->data.dual.sub_a);
+                script_compile_emit (compiler, SCRIPT_OPCODE_METHOD, 0);
+        } else if (name_exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
+                script_compile_emit_variable (compiler, SCRIPT_OPCODE_FUNCTION_VAR, 2,
+                                              name_exp->data.string);
+        } else {
+                script_compile_exp (compiler, name_exp);
+                script_compile_emit (compiler, SCRIPT_OPCODE_NO_THIS, 1);
+        }
+
+        for (node = ply_list_get_first_node (parameter_expressions);
+             node;
+             node = ply_list_get_next_node (parameter_expressions, node)) {
+                script_compile_exp (compiler, ply_list_node_get_data (node));
+                count++;
+        }
+
+        instruction = script_compile_emit (compiler, SCRIPT_OPCODE_CALL, -(int) (count + 1));
+        instruction->operand = count;
+}
+
+static void script_compile_exp (script_compiler_t *compiler,
+                                script_exp_t      *exp)
+{
+        script_instruction_t *instruction;
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY, script_obj_plus);
+                return;
+        case SCRIPT_EXP_TYPE_MINUS:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY, script_obj_minus);
+                return;
+        case SCRIPT_EXP_TYPE_MUL:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY, script_obj_mul);
+                return;
+        case SCRIPT_EXP_TYPE_DIV:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY, script_obj_div);
+                return;
+        case SCRIPT_EXP_TYPE_MOD:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY, script_obj_mod);
+                return;
+        case SCRIPT_EXP_TYPE_EXTEND:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY, script_obj_new_extend);
+                return;
+
+        case SCRIPT_EXP_TYPE_EQ:
+                script_compile_cmp (compiler, exp, SCRIPT_OBJ_CMP_RESULT_EQ);
+                return;
+        case SCRIPT_EXP_TYPE_NE:
+                script_compile_cmp (compiler, exp, SCRIPT_OBJ_CMP_RESULT_NE |
+                                    SCRIPT_OBJ_CMP_RESULT_LT |
+                                    SCRIPT_OBJ_CMP_RESULT_GT);
+                return;
+        case SCRIPT_EXP_TYPE_GT:
+                script_compile_cmp (compiler, exp, SCRIPT_OBJ_CMP_RESULT_GT);
+                return;
+        case SCRIPT_EXP_TYPE_GE:
+                script_compile_cmp (compiler, exp, SCRIPT_OBJ_CMP_RESULT_GT |
+                                    SCRIPT_OBJ_CMP_RESULT_EQ);
+                return;
+        case SCRIPT_EXP_TYPE_LT:
+                script_compile_cmp (compiler, exp, SCRIPT_OBJ_CMP_RESULT_LT);
+                return;
+        case SCRIPT_EXP_TYPE_LE:
+                script_compile_cmp (compiler, exp, SCRIPT_OBJ_CMP_RESULT_LT |
+                                    SCRIPT_OBJ_CMP_RESULT_EQ);
+                return;
+
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+                script_compile_logic (compiler, exp);
+                return;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                script_compile_exp (compiler, exp->data.sub);
+                instruction = script_compile_emit (compiler, SCRIPT_OPCODE_UNARY, 0);
+                instruction->data.exp = exp;
+                return;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                instruction = script_compile_emit (compiler, SCRIPT_OPCODE_NUMBER, 1);
+                instruction->data.number = exp->data.number;
+                return;
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+                instruction = script_compile_emit (compiler, SCRIPT_OPCODE_STRING, 1);
+                instruction->data.string = exp->data.string;
+                return;
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+                script_compile_emit (compiler, SCRIPT_OPCODE_NULL, 1);
+                return;
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+                script_compile_emit (compiler, SCRIPT_OPCODE_LOCAL, 1);
+                return;
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+                script_compile_emit (compiler, SCRIPT_OPCODE_GLOBAL, 1);
+                return;
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                script_compile_emit (compiler, SCRIPT_OPCODE_THIS, 1);
+                return;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+        {
+                ply_list_node_t *node;
+                unsigned int count = 0;
+
+                for (node = ply_list_get_first_node (exp->data.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.parameters, node)) {
+                        script_compile_exp (compiler, ply_list_node_get_data (node));
+                        count++;
+                }
+                instruction = script_compile_emit (compiler, SCRIPT_OPCODE_SET, 1 - (int) count);
+                instruction->operand = count;
+                return;
+        }
+
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                script_compile_emit_variable (compiler, SCRIPT_OPCODE_VAR, 1, exp->data.string);
+                return;
+
+        case SCRIPT_EXP_TYPE_ASSIGN:
+                script_compile_dual (compiler, exp);
+                script_compile_emit (compiler, SCRIPT_OPCODE_ASSIGN, -1);
+                return;
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY_AND_ASSIGN, script_obj_plus);
+                return;
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY_AND_ASSIGN, script_obj_minus);
+                return;
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY_AND_ASSIGN, script_obj_mul);
+                return;
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY_AND_ASSIGN, script_obj_div);
+                return;
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY_AND_ASSIGN, script_obj_mod);
+                return;
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                script_compile_apply (compiler, exp, SCRIPT_OPCODE_APPLY_AND_ASSIGN, script_obj_new_extend);
+                return;
+
+        case SCRIPT_EXP_TYPE_HASH:
+                /* Constant keys, as in hash.key, skip making a string to look up */
+                if (exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING) {
+                        script_compile_exp (compiler, exp->data.dual.sub_a);
+                        script_compile_emit_name (compiler, SCRIPT_OPCODE_HASH_STRING, 0,
+                                                  exp->data.dual.sub_b->data.string);
+                        return;
+                }
+                script_compile_dual (compiler, exp);
+                script_compile_emit (compiler, SCRIPT_OPCODE_HASH, -1);
+                return;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_compile_func (compiler, exp);
+                return;
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                        script_compile (exp->data.function_def->data.script);
+                instruction = script_compile_emit (compiler, SCRIPT_OPCODE_FUNCTION, 1);
+                instruction->data.function = exp->data.function_def;
+                return;
+        }
+        script_compile_emit (compiler, SCRIPT_OPCODE_NULL, 1);
+}
+
+static void script_compile_jump_out_of_loop (script_compiler_t *compiler,
+                                             script_opcode_t    opcode,
+                                             bool               is_break)
+{
+        script_compile_pending_jump_t *pending_jump;
+
+        pending_jump = malloc (sizeof(script_compile_pending_jump_t));
+        pending_jump->instruction = script_compile_get_position (compiler);
+        pending_jump->is_break = is_break;
+        ply_list_append_data (compiler->pending_jumps, pending_jump);
+        script_compile_emit (compiler, opcode, 0);
+}
+
+static void script_compile_profile_line (script_compiler_t *compiler,
+                                         script_op_t       *op)
+{
+        if (script_profile_is_enabled ())
+                script_compile_emit (compiler, SCRIPT_OPCODE_PROFILE_LINE, 0)->data.op = op;
+}
+
+static void script_compile_loop (script_compiler_t *compiler,
+                                 script_op_t       *op)
+{
+        ply_list_t *old_pending_jumps = compiler->pending_jumps;
+        ply_list_t *pending_jumps = ply_list_new ();
+        ply_list_node_t *node;
+        unsigned int top, exit_jump, body_jump = 0;
+        unsigned int continue_position, break_position, end_jump;
+        bool is_do_while = op->type == SCRIPT_OP_TYPE_DO_WHILE;
+
+        if (is_do_while) {
+                body_jump = script_compile_get_position (compiler);
+                script_compile_emit (compiler, SCRIPT_OPCODE_JUMP, 0);
+        }
+
+        top = script_compile_get_position (compiler);
+        script_compile_profile_line (compiler, op);
+        script_compile_exp (compiler, op->data.cond_op.cond);
+        exit_jump = script_compile_get_position (compiler);
+        script_compile_emit (compiler, SCRIPT_OPCODE_JUMP_IF_FALSE, -1);
+
+        if (is_do_while)
+                script_compile_set_target (compiler, body_jump, script_compile_get_position (compiler));
+
+        compiler->pending_jumps = pending_jumps;
+
+        script_compile_emit (compiler, SCRIPT_OPCODE_CLEAR_RESULT, 0);
+        script_compile_op (compiler, op->data.cond_op.op1);
+
+        compiler->pending_jumps = old_pending_jumps;
+
+        /* A continue carries on from here, leaving the reply type as
+         * continue unless there is an op2 to replace the reply
+         */
+        continue_position = script_compile_get_position (compiler);
+        if (op->data.cond_op.op2) {
+                script_compile_emit (compiler, SCRIPT_OPCODE_CLEAR_RESULT, 0);
+                script_compile_op (compiler, op->data.cond_op.op2);
+        }
+        script_compile_emit (compiler, SCRIPT_OPCODE_JUMP, 0)->operand = top;
+
+        break_position = script_compile_get_position (compiler);
+        script_compile_emit (compiler, SCRIPT_OPCODE_END_LOOP, 0);
+        end_jump = script_compile_get_position (compiler);
+        script_compile_emit (compiler, SCRIPT_OPCODE_JUMP, 0);
+
+        script_compile_set_target (compiler, exit_jump, script_compile_get_position (compiler));
+        /* When the last pass ended in a continue the loop returns it, and
+         * the enclosing block passes it on
+         */
+        script_compile_jump_out_of_loop (compiler, SCRIPT_OPCODE_PROPAGATE_CONTINUE, false);
+        script_compile_set_target (compiler, end_jump, script_compile_get_position (compiler));
+
+        for (node = ply_list_get_first_node (pending_jumps);
+             node;
+             node = ply_list_get_next_node (pending_jumps, node)) {
+                script_compile_pending_jump_t *pending_jump = ply_list_node_get_data (node);
+
+                script_compile_set_target (compiler,
+                                           pending_jump->instruction,
+                                           pending_jump->is_break ? break_position : continue_position);
+                free (pending_jump);
+        }
+        ply_list_free (pending_jumps);
+}
+
+static void script_compile_op (script_compiler_t *compiler,
+                               script_op_t       *op)
+{
+        if (!op) return;
+        /* Loops enter their line each time they test their condition */
+        if (op->type != SCRIPT_OP_TYPE_OP_BLOCK &&
+            op->type != SCRIPT_OP_TYPE_WHILE &&
+            op->type != SCRIPT_OP_TYPE_DO_WHILE &&
+            op->type != SCRIPT_OP_TYPE_FOR)
+                script_compile_profile_line (compiler, op);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+                script_compile_exp (compiler, op->data.exp);
+                script_compile_emit (compiler, SCRIPT_OPCODE_STORE_RESULT, -1);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+        {
+                ply_list_node_t *node;
+
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_compile_emit (compiler, SCRIPT_OPCODE_CLEAR_RESULT, 0);
+                        script_compile_op (compiler, ply_list_node_get_data (node));
+                }
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_IF:
+        {
+                unsigned int else_jump, end_jump;
+
+                script_compile_exp (compiler, op->data.cond_op.cond);
+                else_jump = script_compile_get_position (compiler);
+                script_compile_emit (compiler, SCRIPT_OPCODE_JUMP_IF_FALSE, -1);
+                script_compile_op (compiler, op->data.cond_op.op1);
+                end_jump = script_compile_get_position (compiler);
+                script_compile_emit (compiler, SCRIPT_OPCODE_JUMP, 0);
+                script_compile_set_target (compiler, else_jump, script_compile_get_position (compiler));
+                script_compile_op (compiler, op->data.cond_op.op2);
+                script_compile_set_target (compiler, end_jump, script_compile_get_position (compiler));
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_compile_loop (compiler, op);
+                break;
+
+        case SCRIPT_OP_TYPE_RETURN:
+                if (op->data.exp)
+                        script_compile_exp (compiler, op->data.exp);
+                else
+                        script_compile_emit (compiler, SCRIPT_OPCODE_NULL, 1);
+                script_compile_emit (compiler, SCRIPT_OPCODE_RETURN, -1);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+                script_compile_emit (compiler, SCRIPT_OPCODE_FAIL, 0);
+                break;
+
+        case SCRIPT_OP_TYPE_BREAK:
+                script_compile_jump_out_of_loop (compiler, SCRIPT_OPCODE_BREAK, true);
+                break;
+
+        case SCRIPT_OP_TYPE_CONTINUE:
+                script_compile_jump_out_of_loop (compiler, SCRIPT_OPCODE_CONTINUE, false);
+                break;
+        }
+}
+
+void script_compile (script_op_t *op)
+{
+        script_compiler_t compiler;
+        ply_list_node_t *node;
+
+        if (!op || op->code) return;
+
+        memset (&compiler, 0, sizeof(compiler));
+        compiler.code = calloc (1, sizeof(script_code_t));
+        compiler.pending_jumps = ply_list_new ();
+        compiler.slots = ply_hashtable_new (ply_hashtable_direct_hash,
+                                            ply_hashtable_direct_compare);
+
+        script_compile_op (&compiler, op);
+
+        for (node = ply_list_get_first_node (compiler.pending_jumps);
+             node;
+             node = ply_list_get_next_node (compiler.pending_jumps, node)) {
+                script_compile_pending_jump_t *pending_jump = ply_list_node_get_data (node);
+
+                script_compile_set_target (&compiler,
+                                           pending_jump->instruction,
+                                           compiler.code->instruction_count);
+                free (pending_jump);
+        }
+        ply_list_free (compiler.pending_jumps);
+        ply_hashtable_free (compiler.slots);
+
+        op->code = compiler.code;
+}
+
+void script_code_free (script_code_t *code)
+{
+        unsigned int i;
+
+        if (!code) return;
+        for (i = 0; i < code->instruction_count; i++) {
+                free (code->instructions[i].call_cache);
+        }
+        free (code->instructions);
+        free (code);
+}
@@ -0,0 +1,117 @@
+/* script-compile.h - lowering of parsed scripts to bytecode
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_COMPILE_H
+#define SCRIPT_COMPILE_H
+
+#include "script.h"
+#include "script-object.h"
+
+/* The code runs on a stack of referenced objects.  Every opcode does
+ * exactly what the matching case of the tree walker in script-execute.c
+ * does, in the same order, so the two can be used interchangeably.
+ */
+typedef enum
+{
+        SCRIPT_OPCODE_APPLY,             /* a b -- function (a, b) */
+        SCRIPT_OPCODE_APPLY_AND_ASSIGN,  /* a b -- a = function (a, b) */
+        SCRIPT_OPCODE_CMP,               /* a b -- (a cmp b) & operand */
+        SCRIPT_OPCODE_UNARY,             /* a -- exp->type applied to a */
+        SCRIPT_OPCODE_NUMBER,            /* -- number */
+        SCRIPT_OPCODE_STRING,            /* -- string */
+        SCRIPT_OPCODE_NULL,              /* -- null */
+        SCRIPT_OPCODE_LOCAL,             /* -- local */
+        SCRIPT_OPCODE_GLOBAL,            /* -- global */
+        SCRIPT_OPCODE_THIS,              /* -- this */
+        SCRIPT_OPCODE_SET,               /* operand values -- set */
+        SCRIPT_OPCODE_VAR,               /* -- variable called string, cached in slot */
+        SCRIPT_OPCODE_ASSIGN,            /* a b -- a = b */
+        SCRIPT_OPCODE_HASH,              /* hash key -- hash[key] */
+        SCRIPT_OPCODE_HASH_STRING,       /* hash -- hash[string] */
+        SCRIPT_OPCODE_FUNCTION,          /* -- function */
+        SCRIPT_OPCODE_FUNCTION_VAR,      /* -- function this, cached in slot */
+        SCRIPT_OPCODE_METHOD,            /* key this -- function this */
+        SCRIPT_OPCODE_METHOD_STRING,     /* this -- function this */
+        SCRIPT_OPCODE_NO_THIS,           /* -- NULL */
+        SCRIPT_OPCODE_CALL,              /* function this operand parameters -- result */
+        SCRIPT_OPCODE_AND,               /* a -- a, and jump if a is false */
+        SCRIPT_OPCODE_OR,                /* a -- a, and jump if a is true */
+        SCRIPT_OPCODE_JUMP,
+        SCRIPT_OPCODE_JUMP_IF_FALSE,     /* a -- */
+        SCRIPT_OPCODE_CLEAR_RESULT,
+        SCRIPT_OPCODE_STORE_RESULT,      /* a -- */
+        SCRIPT_OPCODE_RETURN,            /* a -- */
+        SCRIPT_OPCODE_FAIL,
+        SCRIPT_OPCODE_BREAK,
+        SCRIPT_OPCODE_CONTINUE,
+        SCRIPT_OPCODE_END_LOOP,
+        SCRIPT_OPCODE_PROPAGATE_CONTINUE,
+        SCRIPT_OPCODE_PROFILE_LINE,      /* only emitted while profiling */
+} script_opcode_t;
+
+/* What the last call through an instruction to an idempotent native
+ * function gave back, so the next call with the same argument can skip it
+ */
+typedef struct
+{
+        script_function_t *function;
+        unsigned int       generation;
+        unsigned int       parameter_count;
+        script_number_t    parameter;
+        bool               result_is_null;
+        script_number_t    result;
+} script_call_cache_t;
+
+typedef struct
+{
+        script_opcode_t opcode;
+        unsigned int    operand; /* jump target, count, condition or name hash */
+        unsigned int    slot;
+        script_call_cache_t *call_cache;
+        union
+        {
+                script_number_t    number;
+                char              *string;
+                script_exp_t      *exp;
+                script_op_t       *op;
+                script_function_t *function;
+                script_obj_t *(*apply)(script_obj_t *,
+                                       script_obj_t *);
+        } data;
+} script_instruction_t;
+
+typedef struct script_code_t
+{
+        script_instruction_t *instructions;
+        unsigned int          instruction_count;
+        unsigned int          max_stack_depth;
+
+        /* Each variable name used in the code gets a slot, which holds the
+         * variable while it is known to be in the local hash
+         */
+        unsigned int          slot_count;
+} script_code_t;
+
+/* Compiles op, and the bodies of all the functions defined in it, storing
+ * the code in op->code.  Ops without code are walked as a tree instead.
+ */
+void script_compile (script_op_t *op);
+void script_code_free (script_code_t *code);
+
+#endif /* SCRIPT_COMPILE_H */
@@ -27,6 +27,7 @@
 #include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-logger.h"
+#include "ply-probes.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -41,6 +42,11 @@
 #include "script-debug.h"
 #include "script-execute.h"
 #include "script-object.h"
+#include "script-compile.h"
+#include "script-profile.h"
+
+#define SCRIPT_EXECUTE_STACK_SIZE 32
+#define SCRIPT_EXECUTE_SLOT_COUNT 32
 
 static script_obj_t *script_evaluate (script_state_t *state,
                                       script_exp_t   *exp);
@@ -96,13 +102,11 @@ static script_obj_t *script_evaluate_apply_function_and_assign (script_state_t
         return obj;
 }
 
-static script_obj_t *script_evaluate_hash (script_state_t *state,
-                                           script_exp_t   *exp)
+static script_obj_t *script_evaluate_hash_element (script_obj_t *hash,
+                                                   script_obj_t *key)
 {
-        script_obj_t *hash = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *key = script_evaluate (state, exp->data.dual.sub_b);
         script_obj_t *obj;
-        char *name = script_obj_as_string (key);
+        unsigned int index;
 
         if (!script_obj_is_hash (hash)) {
                 script_obj_t *newhash = script_obj_new_hash ();
@@ -110,29 +114,87 @@ static script_obj_t *script_evaluate_hash (script_state_t *state,
                 script_obj_unref (newhash);
         }
 
-        obj = script_obj_hash_get_element (hash, name);
-        free (name);
+        /* Whole number keys, as in stars[i], need no string made */
+        if (script_obj_get_hash_index (key, &index)) {
+                obj = script_obj_hash_get_index (hash, index);
+        } else {
+                char *name = script_obj_as_string (key);
+                obj = script_obj_hash_get_element (hash, name);
+                free (name);
+        }
 
         script_obj_unref (hash);
         script_obj_unref (key);
         return obj;
 }
 
-static script_obj_t *script_evaluate_var (script_state_t *state,
-                                          script_exp_t   *exp)
+static script_obj_t *script_evaluate_hash_element_with_hash (script_obj_t *hash,
+                                                             const char   *name,
+                                                             unsigned int  name_hash)
 {
-        char *name = exp->data.string;
-        script_obj_t *obj = script_obj_hash_peek_element (state->local, name);
+        script_obj_t *obj;
 
+        if (!script_obj_is_hash (hash)) {
+                script_obj_t *newhash = script_obj_new_hash ();
+                script_obj_assign (hash, newhash);
+                script_obj_unref (newhash);
+        }
+
+        obj = script_obj_hash_get_element_with_hash (hash, name, name_hash);
+        script_obj_unref (hash);
+        return obj;
+}
+
+static script_obj_t *script_evaluate_hash (script_state_t *state,
+                                           script_exp_t   *exp)
+{
+        script_obj_t *hash = script_evaluate (state, exp->data.dual.sub_a);
+        script_obj_t *key = script_evaluate (state, exp->data.dual.sub_b);
+
+        return script_evaluate_hash_element (hash, key);
+}
+
+/* Looks a variable up once it is known not to be in the local hash */
+static script_obj_t *script_evaluate_var_outside_local (script_state_t *state,
+                                                        char           *name,
+                                                        unsigned int    name_hash)
+{
+        script_obj_t *obj = script_obj_hash_peek_element_with_hash (state->this, name, name_hash);
         if (obj) return obj;
-        obj = script_obj_hash_peek_element (state->this, name);
-        if (obj) return obj;
-        obj = script_obj_hash_peek_element (state->global, name);
+        obj = script_obj_hash_peek_element_with_hash (state->global, name, name_hash);
         if (obj) return obj;
-        obj = script_obj_hash_get_element (state->local, name);
+        obj = script_obj_hash_get_element_with_hash (state->local, name, name_hash);
         return obj;
 }
 
+static script_obj_t *script_evaluate_var_with_hash (script_state_t *state,
+                                                    char           *name,
+                                                    unsigned int    name_hash)
+{
+        script_obj_t *obj = script_obj_hash_peek_element_with_hash (state->local, name, name_hash);
+
+        if (obj) return obj;
+        return script_evaluate_var_outside_local (state, name, name_hash);
+}
+
+static script_obj_t *script_evaluate_var (script_state_t *state,
+                                          script_exp_t   *exp)
+{
+        char *name = exp->data.string;
+
+        return script_evaluate_var_with_hash (state, name, script_obj_hash_get_name_hash (name));
+}
+
+static void script_evaluate_set_add_element (script_obj_t *obj,
+                                             int           index,
+                                             script_obj_t *data_obj)
+{
+        script_obj_t *element = script_obj_hash_get_index (obj, index);
+
+        script_obj_assign (element, data_obj);
+        script_obj_unref (element);
+}
+
 static script_obj_t *script_evaluate_set (script_state_t *state,
                                           script_exp_t   *exp)
 {
@@ -144,11 +206,8 @@ static script_obj_t *script_evaluate_set (script_state_t *state,
         while (node_data) {
                 script_exp_t *data_exp = ply_list_node_get_data (node_data);
                 script_obj_t *data_obj = script_evaluate (state, data_exp);
-                char *name;
-                asprintf (&name, "%d", index);
+                script_evaluate_set_add_element (obj, index, data_obj);
                 index++;
-                script_obj_hash_add_element (obj, data_obj, name);
-                free (name);
 
                 node_data = ply_list_get_next_node (parameter_data, node_data);
         }
@@ -167,12 +226,10 @@ static script_obj_t *script_evaluate_assign (script_state_t *state,
         return script_obj_a;
 }
 
-static script_obj_t *script_evaluate_cmp (script_state_t         *state,
-                                          script_exp_t           *exp,
-                                          script_obj_cmp_result_t condition)
+static script_obj_t *script_evaluate_cmp_result (script_obj_t           *script_obj_a,
+                                                 script_obj_t           *script_obj_b,
+                                                 script_obj_cmp_result_t condition)
 {
-        script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
         script_obj_cmp_result_t cmp_result = script_obj_cmp (script_obj_a, script_obj_b);
 
         script_obj_unref (script_obj_a);
@@ -183,6 +240,16 @@ static script_obj_t *script_evaluate_cmp (script_state_t         *state,
         return script_obj_new_number (0);
 }
 
+static script_obj_t *script_evaluate_cmp (script_state_t         *state,
+                                          script_exp_t           *exp,
+                                          script_obj_cmp_result_t condition)
+{
+        script_obj_t *script_obj_a = script_evaluate (state, exp->data.dual.sub_a);
+        script_obj_t *script_obj_b = script_evaluate (state, exp->data.dual.sub_b);
+
+        return script_evaluate_cmp_result (script_obj_a, script_obj_b, condition);
+}
+
 static script_obj_t *script_evaluate_logic (script_state_t *state,
                                             script_exp_t   *exp)
 {
@@ -197,10 +264,9 @@ static script_obj_t *script_evaluate_logic (script_state_t *state,
         return obj;
 }
 
-static script_obj_t *script_evaluate_unary (script_state_t *state,
-                                            script_exp_t   *exp)
+static script_obj_t *script_evaluate_unary_obj (script_exp_t *exp,
+                                                script_obj_t *obj)
 {
-        script_obj_t *obj = script_evaluate (state, exp->data.sub);
         script_obj_t *new_obj;
 
         if (exp->type == SCRIPT_EXP_TYPE_NOT) {
@@ -249,6 +315,15 @@ static script_obj_t *script_evaluate_unary (script_state_t *state,
         script_obj_unref (obj);
         return new_obj;
 }
+
+static script_obj_t *script_evaluate_unary (script_state_t *state,
+                                            script_exp_t   *exp)
+{
+        script_obj_t *obj = script_evaluate (state, exp->data.sub);
+
+        return script_evaluate_unary_obj (exp, obj);
+}
+
 typedef struct
 {
         script_state_t *state;
@@ -290,6 +365,94 @@ static script_return_t script_execute_object_with_parlist (script_state_t *state
         return script_return_fail ();
 }
 
+static script_obj_t *script_evaluate_method_with_hash (script_state_t *state,
+                                                       script_obj_t   *this_obj,
+                                                       const char     *name,
+                                                       unsigned int    name_hash)
+{
+        script_obj_t *func_obj = script_obj_hash_peek_element_with_hash (this_obj, name, name_hash);
+
+        if (!func_obj && script_obj_is_string (this_obj)) {
+                script_obj_t *string_hash = script_obj_hash_peek_element (state->global, "String");
+                func_obj = script_obj_hash_peek_element_with_hash (string_hash, name, name_hash);
+                script_obj_unref (string_hash);
+        }
+
+        if (!func_obj)
+                func_obj = script_obj_hash_get_element_with_hash (this_obj, name, name_hash);
+
+        return func_obj;
+}
+
+static script_obj_t *script_evaluate_method (script_state_t *state,
+                                             script_obj_t   *this_obj,
+                                             script_obj_t   *this_key)
+{
+        script_obj_t *func_obj;
+        char *this_key_name = script_obj_as_string (this_key);
+
+        script_obj_unref (this_key);
+        if (!this_key_name)
+                return script_obj_new_null ();
+
+        func_obj = script_evaluate_method_with_hash (state,
+                                                     this_obj,
+                                                     this_key_name,
+                                                     script_obj_hash_get_name_hash (this_key_name));
+        free (this_key_name);
+        return func_obj;
+}
+
+static script_obj_t *script_evaluate_function_var_outside_local (script_state_t *state,
+                                                                 char           *name,
+                                                                 unsigned int    name_hash,
+                                                                 script_obj_t  **this_obj)
+{
+        script_obj_t *func_obj = script_obj_hash_peek_element_with_hash (state->this, name, name_hash);
+
+        if (func_obj) {
+                *this_obj = state->this;
+                script_obj_ref (*this_obj);
+        } else {
+                func_obj = script_obj_hash_peek_element_with_hash (state->global, name, name_hash);
+                if (!func_obj) func_obj = script_obj_new_null ();
+        }
+        return func_obj;
+}
+
+static script_obj_t *script_evaluate_function_var (script_state_t *state,
+                                                   char           *name,
+                                                   unsigned int    name_hash,
+                                                   script_obj_t  **this_obj)
+{
+        script_obj_t *func_obj = script_obj_hash_peek_element_with_hash (state->local, name, name_hash);
+
+        if (func_obj) return func_obj;
+        return script_evaluate_function_var_outside_local (state, name, name_hash, this_obj);
+}
+
+/* Takes the references to func_obj, this_obj and the parameters */
+static script_obj_t *script_evaluate_call (script_state_t *state,
+                                           script_obj_t   *func_obj,
+                                           script_obj_t   *this_obj,
+                                           ply_list_t     *parameter_data)
+{
+        script_return_t reply = script_execute_object_with_parlist (state, func_obj, this_obj, parameter_data);
+
+        ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
+        while (node_data) {
+                script_obj_t *data_obj = ply_list_node_get_data (node_data);
+                script_obj_unref (data_obj);
+                node_data = ply_list_get_next_node (parameter_data, node_data);
+        }
+        ply_list_free (parameter_data);
+
+        script_obj_unref (func_obj);
+        if (this_obj) script_obj_unref (this_obj);
+
+        return reply.object ? reply.object : script_obj_new_null ();
+}
+
 static script_obj_t *script_evaluate_func (script_state_t *state,
                                            script_exp_t   *exp)
 {
@@ -300,33 +463,13 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
         if (name_exp->type == SCRIPT_EXP_TYPE_HASH) {
                 script_obj_t *this_key = script_evaluate (state, name_exp->data.dual.sub_b);
                 this_obj = script_evaluate (state, name_exp->data.dual.sub_a);
-                char *this_key_name = script_obj_as_string (this_key);
-                script_obj_unref (this_key);
-                func_obj = script_obj_hash_peek_element (this_obj, this_key_name);
-
-                if (!func_obj && script_obj_is_string (this_obj)) {
-                        script_obj_t *string_hash = script_obj_hash_peek_element (state->global, "String");
-                        func_obj = script_obj_hash_peek_element (string_hash, this_key_name);
-                        script_obj_unref (string_hash);
-                }
-
-                if (!func_obj)
-                        func_obj = script_obj_hash_get_element (this_obj, this_key_name);
-
-                free (this_key_name);
+                func_obj = script_evaluate_method (state, this_obj, this_key);
         } else if (name_exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
                 char *name = name_exp->data.string;
-                func_obj = script_obj_hash_peek_element (state->local, name);
-                if (!func_obj) {
-                        func_obj = script_obj_hash_peek_element (state->this, name);
-                        if (func_obj) {
-                                this_obj = state->this;
-                                script_obj_ref (this_obj);
-                        } else {
-                                func_obj = script_obj_hash_peek_element (state->global, name);
-                                if (!func_obj) func_obj = script_obj_new_null ();
-                        }
-                }
+                func_obj = script_evaluate_function_var (state,
+                                                         name,
+                                                         script_obj_hash_get_name_hash (name),
+                                                         &this_obj);
         } else {
                 func_obj = script_evaluate (state, name_exp);
         }
@@ -343,20 +486,7 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
                                                           node_expression);
         }
 
-        script_return_t reply = script_execute_object_with_parlist (state, func_obj, this_obj, parameter_data);
-
-        ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
-        while (node_data) {
-                script_obj_t *data_obj = ply_list_node_get_data (node_data);
-                script_obj_unref (data_obj);
-                node_data = ply_list_get_next_node (parameter_data, node_data);
-        }
-        ply_list_free (parameter_data);
-
-        script_obj_unref (func_obj);
-        if (this_obj) script_obj_unref (this_obj);
-
-        return reply.object ? reply.object : script_obj_new_null ();
+        return script_evaluate_call (state, func_obj, this_obj, parameter_data);
 }
 
 static script_obj_t *script_evaluate (script_state_t *state,
@@ -583,14 +713,13 @@ static script_return_t script_execute_function_with_parlist (script_state_t    *
 
         while (node_data) {
                 script_obj_t *data_obj = ply_list_node_get_data (node_data);
-                char *name;
-                asprintf (&name, "%d", index);
+                script_obj_t *element = script_obj_hash_get_index (arg_obj, index);
                 index++;
-                script_obj_hash_add_element (arg_obj, data_obj, name);
-                free (name);
+                script_obj_assign (element, data_obj);
+                script_obj_unref (element);
 
                 if (node_name) {
-                        name = ply_list_node_get_data (node_name);
+                        char *name = ply_list_node_get_data (node_name);
                         script_obj_hash_add_element (sub_state->local, data_obj, name);
                         node_name = ply_list_get_next_node (parameter_names, node_name);
                 }
@@ -607,6 +736,12 @@ static script_return_t script_execute_function_with_parlist (script_state_t    *
                 script_obj_hash_add_element (sub_state->local, this, "this");
 
         script_return_t reply;
+        script_profile_call_t profile_call;
+        bool profiling = script_profile_is_enabled ();
+
+        if (profiling)
+                script_profile_enter_call (&profile_call);
+
         switch (function->type) {
         case SCRIPT_FUNCTION_TYPE_SCRIPT:
         {
@@ -621,12 +756,21 @@ static script_return_t script_execute_function_with_parlist (script_state_t    *
                 break;
         }
         }
+
+        if (profiling)
+                script_profile_leave_call (&profile_call, function);
+
         script_state_destroy (sub_state);
         if (reply.type != SCRIPT_RETURN_TYPE_FAIL)
                 reply.type = SCRIPT_RETURN_TYPE_RETURN;
         return reply;
 }
 
+script_obj_t *script_evaluate_constant (script_exp_t *exp)
+{
+        return script_evaluate (NULL, exp);
+}
+
 script_return_t script_execute_object (script_state_t *state,
                                        script_obj_t   *function,
                                        script_obj_t   *this,
@@ -646,18 +790,405 @@ script_return_t script_execute_object (script_state_t *state,
         }
         va_end (args);
 
+        ply_probe (script_callback_enter, function, ply_list_get_length (parameter_data));
         reply = script_execute_object_with_parlist (state, function, this, parameter_data);
+        ply_probe (script_callback_return, function, reply.type);
         ply_list_free (parameter_data);
 
         return reply;
 }
 
-script_return_t script_execute (script_state_t *state,
-                                script_op_t    *op)
+typedef struct
+{
+        script_obj_t  *local;
+        script_obj_t **objects;
+        unsigned int   count;
+} script_execute_slots_t;
+
+/* Variables are never taken out of a hash, so once a name is found in the
+ * local hash it stays there, as the same object, until the hash itself
+ * goes away or the local variable stops being that hash
+ */
+static script_obj_t **script_execute_get_slot (script_state_t         *state,
+                                               script_execute_slots_t *slots,
+                                               unsigned int            slot)
+{
+        script_obj_t *local = script_obj_deref_direct (state->local);
+
+        if (local != slots->local || local->type != SCRIPT_OBJ_TYPE_HASH) {
+                if (slots->local) script_obj_unref (slots->local);
+                memset (slots->objects, 0, slots->count * sizeof(script_obj_t *));
+                slots->local = NULL;
+                if (local->type == SCRIPT_OBJ_TYPE_HASH) {
+                        script_obj_ref (local);
+                        slots->local = local;
+                }
+        }
+
+        if (!slots->local) return NULL;
+        return &slots->objects[slot];
+}
+
+static script_obj_t *script_execute_lookup_local (script_state_t         *state,
+                                                  script_execute_slots_t *slots,
+                                                  script_instruction_t   *instruction)
+{
+        script_obj_t **slot = script_execute_get_slot (state, slots, instruction->slot);
+        script_obj_t *obj;
+
+        if (slot && *slot) {
+                script_obj_ref (*slot);
+                return *slot;
+        }
+
+        obj = script_obj_hash_peek_element_with_hash (state->local,
+                                                      instruction->data.string,
+                                                      instruction->operand);
+        if (obj && slot)
+                *slot = obj;
+        return obj;
+}
+
+/* Gives the function a call would run if it is an idempotent native whose
+ * result can be remembered for these arguments
+ */
+static script_function_t *script_execute_get_idempotent_function (script_obj_t **call,
+                                                                  unsigned int   parameter_count)
+{
+        script_obj_t *func_obj = script_obj_deref_direct (call[0]);
+        script_function_t *function;
+
+        if (func_obj->type != SCRIPT_OBJ_TYPE_FUNCTION) return NULL;
+        function = func_obj->data.function;
+        if (function->type != SCRIPT_FUNCTION_TYPE_NATIVE || !function->idempotent) return NULL;
+        if (parameter_count > 1) return NULL;
+        if (parameter_count == 1 && !script_obj_is_number (call[2])) return NULL;
+        return function;
+}
+
+static bool script_execute_call_is_cached (script_call_cache_t *cache,
+                                           script_function_t   *function,
+                                           script_obj_t       **call,
+                                           unsigned int         parameter_count)
+{
+        if (!cache || cache->function != function) return false;
+        if (cache->generation != script_get_idempotent_generation ()) return false;
+        if (cache->parameter_count != parameter_count) return false;
+        if (parameter_count == 1 && cache->parameter != script_obj_as_number (call[2])) return false;
+        return true;
+}
+
+static void script_execute_cache_call (script_instruction_t *instruction,
+                                       script_function_t    *function,
+                                       script_number_t       parameter,
+                                       script_obj_t         *result)
+{
+        script_call_cache_t *cache;
+
+        if (!script_obj_is_number (result) && !script_obj_is_null (result)) return;
+
+        if (!instruction->call_cache)
+                instruction->call_cache = malloc (sizeof(script_call_cache_t));
+        cache = instruction->call_cache;
+        cache->function = function;
+        cache->generation = script_get_idempotent_generation ();
+        cache->parameter_count = instruction->operand;
+        cache->parameter = parameter;
+        cache->result_is_null = script_obj_is_null (result);
+        cache->result = script_obj_as_number (result);
+}
+
+static script_return_t script_execute_code (script_state_t *state,
+                                            script_code_t  *code)
+{
+        script_obj_t *stack_storage[SCRIPT_EXECUTE_STACK_SIZE];
+        script_obj_t **stack = stack_storage;
+        script_obj_t *slot_storage[SCRIPT_EXECUTE_SLOT_COUNT];
+        script_execute_slots_t slots = { NULL, slot_storage, code->slot_count };
+        script_return_t reply = script_return_normal ();
+        unsigned int stack_top = 0;
+        unsigned int pc = 0;
+
+        if (code->max_stack_depth > SCRIPT_EXECUTE_STACK_SIZE)
+                stack = malloc (code->max_stack_depth * sizeof(script_obj_t *));
+        if (code->slot_count > SCRIPT_EXECUTE_SLOT_COUNT)
+                slots.objects = malloc (code->slot_count * sizeof(script_obj_t *));
+
+        while (pc < code->instruction_count) {
+                script_instruction_t *instruction = &code->instructions[pc++];
+                script_obj_t *obj;
+
+                switch (instruction->opcode) {
+                case SCRIPT_OPCODE_APPLY:
+                        obj = instruction->data.apply (stack[stack_top - 2], stack[stack_top - 1]);
+                        script_obj_unref (stack[stack_top - 2]);
+                        script_obj_unref (stack[stack_top - 1]);
+                        stack[--stack_top - 1] = obj;
+                        break;
+
+                case SCRIPT_OPCODE_APPLY_AND_ASSIGN:
+                        obj = instruction->data.apply (stack[stack_top - 2], stack[stack_top - 1]);
+                        script_obj_assign (stack[stack_top - 2], obj);
+                        script_obj_unref (stack[stack_top - 2]);
+                        script_obj_unref (stack[stack_top - 1]);
+                        stack[--stack_top - 1] = obj;
+                        break;
+
+                case SCRIPT_OPCODE_CMP:
+                        obj = script_evaluate_cmp_result (stack[stack_top - 2],
+                                                          stack[stack_top - 1],
+                                                          instruction->operand);
+                        stack[--stack_top - 1] = obj;
+                        break;
+
+                case SCRIPT_OPCODE_UNARY:
+                        stack[stack_top - 1] = script_evaluate_unary_obj (instruction->data.exp,
+                                                                          stack[stack_top - 1]);
+                        break;
+
+                case SCRIPT_OPCODE_NUMBER:
+                        stack[stack_top++] = script_obj_new_number (instruction->data.number);
+                        break;
+
+                case SCRIPT_OPCODE_STRING:
+                        stack[stack_top++] = script_obj_new_string (instruction->data.string);
+                        break;
+
+                case SCRIPT_OPCODE_NULL:
+                        stack[stack_top++] = script_obj_new_null ();
+                        break;
+
+                case SCRIPT_OPCODE_LOCAL:
+                        script_obj_ref (state->local);
+                        stack[stack_top++] = state->local;
+                        break;
+
+                case SCRIPT_OPCODE_GLOBAL:
+                        script_obj_ref (state->global);
+                        stack[stack_top++] = state->global;
+                        break;
+
+                case SCRIPT_OPCODE_THIS:
+                        script_obj_ref (state->this);
+                        stack[stack_top++] = state->this;
+                        break;
+
+                case SCRIPT_OPCODE_SET:
+                {
+                        unsigned int count = instruction->operand;
+                        unsigned int index;
+
+                        obj = script_obj_new_hash ();
+                        stack_top -= count;
+                        for (index = 0; index < count; index++) {
+                                script_evaluate_set_add_element (obj, index, stack[stack_top + index]);
+                        }
+                        stack[stack_top++] = obj;
+                        break;
+                }
+
+                case SCRIPT_OPCODE_VAR:
+                        obj = script_execute_lookup_local (state, &slots, instruction);
+                        if (!obj) {
+                                obj = script_evaluate_var_outside_local (state,
+                                                                         instruction->data.string,
+                                                                         instruction->operand);
+                        }
+                        stack[stack_top++] = obj;
+                        break;
+
+                case SCRIPT_OPCODE_ASSIGN:
+                        script_obj_assign (stack[stack_top - 2], stack[stack_top - 1]);
+                        script_obj_unref (stack[--stack_top]);
+                        break;
+
+                case SCRIPT_OPCODE_HASH:
+                        obj = script_evaluate_hash_element (stack[stack_top - 2], stack[stack_top - 1]);
+                        stack[--stack_top - 1] = obj;
+                        break;
+
+                case SCRIPT_OPCODE_HASH_STRING:
+                        stack[stack_top - 1] = script_evaluate_hash_element_with_hash (stack[stack_top - 1],
+                                                                                       instruction->data.string,
+                                                                                       instruction->operand);
+                        break;
+
+                case SCRIPT_OPCODE_FUNCTION:
+                        stack[stack_top++] = script_obj_new_function (instruction->data.function);
+                        break;
+
+                case SCRIPT_OPCODE_FUNCTION_VAR:
+                {
+                        script_obj_t *this_obj = NULL;
+
+                        obj = script_execute_lookup_local (state, &slots, instruction);
+                        if (!obj) {
+                                obj = script_evaluate_function_var_outside_local (state,
+                                                                                  instruction->data.string,
+                                                                                  instruction->operand,
+                                                                                  &this_obj);
+                        }
+                        stack[stack_top++] = obj;
+                        stack[stack_top++] = this_obj;
+                        break;
+                }
+
+                case SCRIPT_OPCODE_METHOD:
+                        obj = script_evaluate_method (state, stack[stack_top - 1], stack[stack_top - 2]);
+                        stack[stack_top - 2] = obj;
+                        break;
+
+                case SCRIPT_OPCODE_METHOD_STRING:
+                        obj = script_evaluate_method_with_hash (state,
+                                                                stack[stack_top - 1],
+                                                                instruction->data.string,
+                                                                instruction->operand);
+                        stack[stack_top] = stack[stack_top - 1];
+                        stack[stack_top - 1] = obj;
+                        stack_top++;
+                        break;
+
+                case SCRIPT_OPCODE_NO_THIS:
+                        stack[stack_top++] = NULL;
+                        break;
+
+                case SCRIPT_OPCODE_CALL:
+                {
+                        unsigned int count = instruction->operand;
+                        script_obj_t **call = &stack[stack_top - count - 2];
+                        script_function_t *idempotent_function;
+                        script_number_t parameter = 0;
+                        ply_list_t *parameter_data;
+                        unsigned int index;
+
+                        idempotent_function = script_execute_get_idempotent_function (call, count);
+                        if (idempotent_function && count == 1)
+                                parameter = script_obj_as_number (call[2]);
+
+                        if (idempotent_function &&
+                            script_execute_call_is_cached (instruction->call_cache, idempotent_function, call, count)) {
+                                if (instruction->call_cache->result_is_null)
+                                        obj = script_obj_new_null ();
+                                else
+                                        obj = script_obj_new_number (instruction->call_cache->result);
+                                for (index = 0; index < count + 2; index++) {
+                                        if (call[index]) script_obj_unref (call[index]);
+                                }
+                        } else {
+                                parameter_data = ply_list_new ();
+                                for (index = 0; index < count; index++) {
+                                        ply_list_append_data (parameter_data, call[index + 2]);
+                                }
+                                obj = script_evaluate_call (state, call[0], call[1], parameter_data);
+                                if (idempotent_function)
+                                        script_execute_cache_call (instruction, idempotent_function, parameter, obj);
+                        }
+
+                        stack_top -= count + 2;
+                        stack[stack_top++] = obj;
+                        break;
+                }
+
+                case SCRIPT_OPCODE_AND:
+                        if (!script_obj_as_bool (stack[stack_top - 1])) {
+                                pc = instruction->operand;
+                                break;
+                        }
+                        script_obj_unref (stack[--stack_top]);
+                        break;
+
+                case SCRIPT_OPCODE_OR:
+                        if (script_obj_as_bool (stack[stack_top - 1])) {
+                                pc = instruction->operand;
+                                break;
+                        }
+                        script_obj_unref (stack[--stack_top]);
+                        break;
+
+                case SCRIPT_OPCODE_JUMP:
+                        pc = instruction->operand;
+                        break;
+
+                case SCRIPT_OPCODE_JUMP_IF_FALSE:
+                        obj = stack[--stack_top];
+                        if (!script_obj_as_bool (obj))
+                                pc = instruction->operand;
+                        script_obj_unref (obj);
+                        break;
+
+                case SCRIPT_OPCODE_CLEAR_RESULT:
+                        script_obj_unref (reply.object);
+                        reply = script_return_normal ();
+                        break;
+
+                case SCRIPT_OPCODE_STORE_RESULT:
+                        script_obj_unref (reply.object);
+                        reply.object = stack[--stack_top];
+                        break;
+
+                case SCRIPT_OPCODE_RETURN:
+                        script_obj_unref (reply.object);
+                        reply = script_return_obj (stack[--stack_top]);
+                        pc = code->instruction_count;
+                        break;
+
+                case SCRIPT_OPCODE_FAIL:
+                        script_obj_unref (reply.object);
+                        reply = script_return_fail ();
+                        pc = code->instruction_count;
+                        break;
+
+                case SCRIPT_OPCODE_BREAK:
+                        script_obj_unref (reply.object);
+                        reply = script_return_break ();
+                        pc = instruction->operand;
+                        break;
+
+                case SCRIPT_OPCODE_CONTINUE:
+                        script_obj_unref (reply.object);
+                        reply = script_return_continue ();
+                        pc = instruction->operand;
+                        break;
+
+                case SCRIPT_OPCODE_END_LOOP:
+                        reply = script_return_normal ();
+                        break;
+
+                case SCRIPT_OPCODE_PROPAGATE_CONTINUE:
+                        if (reply.type == SCRIPT_RETURN_TYPE_CONTINUE)
+                                pc = instruction->operand;
+                        break;
+
+                case SCRIPT_OPCODE_PROFILE_LINE:
+                        script_profile_enter_line (instruction->data.op);
+                        break;
+                }
+        }
+
+        assert (stack_top == 0);
+        if (stack != stack_storage)
+                free (stack);
+        if (slots.objects != slot_storage)
+                free (slots.objects);
+        if (slots.local)
+                script_obj_unref (slots.local);
+        return reply;
+}
+
+static script_return_t script_execute_op (script_state_t *state,
+                                          script_op_t    *op)
 {
         script_return_t reply = script_return_normal ();
 
         if (!op) return reply;
+        if (op->code) return script_execute_code (state, op->code);
+        /* Loops enter their line each time they test their condition */
+        if (script_profile_is_enabled () &&
+            op->type != SCRIPT_OP_TYPE_OP_BLOCK &&
+            op->type != SCRIPT_OP_TYPE_WHILE &&
+            op->type != SCRIPT_OP_TYPE_DO_WHILE &&
+            op->type != SCRIPT_OP_TYPE_FOR)
+                script_profile_enter_line (op);
         switch (op->type) {
         case SCRIPT_OP_TYPE_EXPRESSION:
         {
@@ -691,6 +1222,8 @@ script_return_t script_execute (script_state_t *state,
                 if (op->type == SCRIPT_OP_TYPE_DO_WHILE) cond = true;
                 while (1) {
                         if (!cond) {
+                                if (script_profile_is_enabled ())
+                                        script_profile_enter_line (op);
                                 obj = script_evaluate (state, op->data.cond_op.cond);
                                 cond = script_obj_as_bool (obj);
                                 script_obj_unref (obj);
@@ -754,3 +1287,21 @@ script_return_t script_execute (script_state_t *state,
         }
         return reply;
 }
+
+script_return_t script_execute (script_state_t *state,
+                                script_op_t    *op)
+{
+        script_profile_call_t profile_call;
+        script_return_t reply;
+
+        if (!script_profile_is_enabled () || script_profile_is_running ())
+                return script_execute_op (state, op);
+
+        /* Scripts run from outside any function, like a file's top level,
+         * are timed as calls too, so their last line stops when they do
+         */
+        script_profile_enter_call (&profile_call);
+        reply = script_execute_op (state, op);
+        script_profile_leave_call (&profile_call, NULL);
+        return reply;
+}
@@ -26,6 +26,10 @@
 
 script_return_t script_execute (script_state_t *state,
                                 script_op_t    *op);
+/* For expressions made only of constants and the operators on them, which
+ * need no state
+ */
+script_obj_t *script_evaluate_constant (script_exp_t *exp);
 script_return_t script_execute_object (script_state_t * state,
                                        script_obj_t * function,
                                        script_obj_t * this,
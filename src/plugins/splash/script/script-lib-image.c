@@ -40,6 +40,19 @@
 
 #include "script-lib-image.script.h"
 
+/* Status and message callbacks tend to make the same few texts over and
+ * over, so the last few rendered ones are kept */
+#define TEXT_CACHE_SIZE 16
+
+typedef struct
+{
+        char               *text;
+        char               *font;
+        float               red, green, blue, alpha;
+        int                 align;
+        ply_pixel_buffer_t *image;
+} text_cache_entry_t;
+
 static void image_free (script_obj_t *obj)
 {
         ply_pixel_buffer_t *image = obj->data.native.object_data;
@@ -69,14 +82,13 @@ static script_return_t image_new (script_state_t *state,
         } else {
                 asprintf (&path_filename, "%s/%s", data->image_dir, filename);
         }
-        ply_image_t *file_image = ply_image_new (path_filename);
-        if (ply_image_load (file_image)) {
-                ply_pixel_buffer_t *buffer = ply_image_convert_to_pixel_buffer (file_image);
+        /* Themes often load the same image for many sprites, and nothing
+         * a script can do to an image changes it, so they all share one */
+        ply_pixel_buffer_t *buffer = ply_image_load_buffer_cached (path_filename);
+        if (buffer)
                 reply = script_obj_new_native (buffer, data->class);
-        } else {
-                ply_image_free (file_image);
+        else
                 reply = script_obj_new_null ();
-        }
         free (filename);
         free (path_filename);
         return script_return_obj (reply);
@@ -122,10 +134,10 @@ static script_return_t image_rotate (script_state_t *state,
 
         if (image) {
                 ply_pixel_buffer_get_size (image, &size);
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_rotate (image,
-                                                                         size.width / 2,
-                                                                         size.height / 2,
-                                                                         angle);
+                ply_pixel_buffer_t *new_image = ply_pixel_buffer_rotate_cached (image,
+                                                                                size.width / 2,
+                                                                                size.height / 2,
+                                                                                angle);
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
@@ -144,6 +156,7 @@ static script_return_t image_crop (script_state_t *state,
         if (image) {
                 ply_rectangle_t clip_area = { 0, 0, width, height };
                 ply_pixel_buffer_t *new_image = ply_pixel_buffer_new (width, height);
+                ply_pixel_buffer_set_owner (new_image, "image");
                 ply_pixel_buffer_fill_with_buffer_with_clip (new_image, image, -x, -y, &clip_area);
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
@@ -159,7 +172,7 @@ static script_return_t image_scale (script_state_t *state,
         int height = script_obj_hash_get_number (state->local, "height");
 
         if (image) {
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_resize (image, width, height);
+                ply_pixel_buffer_t *new_image = ply_pixel_buffer_resize_cached (image, width, height);
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
@@ -174,12 +187,89 @@ static script_return_t image_tile (script_state_t *state,
         int height = script_obj_hash_get_number (state->local, "height");
 
         if (image) {
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_tile (image, width, height);
+                ply_pixel_buffer_t *new_image = ply_pixel_buffer_tile_cached (image, width, height);
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
 }
 
+static void text_cache_entry_free (text_cache_entry_t *entry)
+{
+        ply_pixel_buffer_free (entry->image);
+        free (entry->text);
+        free (entry->font);
+        free (entry);
+}
+
+/* Gives a new reference to the image, which is shared, so nothing may
+ * draw to it; none of the Image functions do */
+static ply_pixel_buffer_t *text_cache_lookup (script_lib_image_data_t *data,
+                                              const char              *text,
+                                              const char              *font,
+                                              float                    red,
+                                              float                    green,
+                                              float                    blue,
+                                              float                    alpha,
+                                              int                      align)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (data->text_cache);
+             node;
+             node = ply_list_get_next_node (data->text_cache, node)) {
+                text_cache_entry_t *entry = ply_list_node_get_data (node);
+
+                if (strcmp (entry->text, text) != 0 ||
+                    (entry->font == NULL) != (font == NULL) ||
+                    (font && strcmp (entry->font, font) != 0) ||
+                    entry->red != red || entry->green != green ||
+                    entry->blue != blue || entry->alpha != alpha ||
+                    entry->align != align)
+                        continue;
+
+                if (node != ply_list_get_first_node (data->text_cache)) {
+                        ply_list_remove_node (data->text_cache, node);
+                        ply_list_prepend_data (data->text_cache, entry);
+                }
+
+                return ply_pixel_buffer_ref (entry->image);
+        }
+
+        return NULL;
+}
+
+static void text_cache_insert (script_lib_image_data_t *data,
+                               const char              *text,
+                               const char              *font,
+                               float                    red,
+                               float                    green,
+                               float                    blue,
+                               float                    alpha,
+                               int                      align,
+                               ply_pixel_buffer_t      *image)
+{
+        text_cache_entry_t *entry;
+
+        if (ply_list_get_length (data->text_cache) >= TEXT_CACHE_SIZE) {
+                ply_list_node_t *node = ply_list_get_last_node (data->text_cache);
+
+                text_cache_entry_free (ply_list_node_get_data (node));
+                ply_list_remove_node (data->text_cache, node);
+        }
+
+        entry = calloc (1, sizeof(text_cache_entry_t));
+        entry->text = strdup (text);
+        entry->font = font ? strdup (font) : NULL;
+        entry->red = red;
+        entry->green = green;
+        entry->blue = blue;
+        entry->alpha = alpha;
+        entry->align = align;
+        entry->image = ply_pixel_buffer_ref (image);
+
+        ply_list_prepend_data (data->text_cache, entry);
+}
+
 static script_return_t image_text (script_state_t *state,
                                    void           *user_data)
 {
@@ -239,6 +329,13 @@ static script_return_t image_text (script_state_t *state,
                 return script_return_obj_null ();
         }
 
+        image = text_cache_lookup (data, text, font, red, green, blue, alpha, align);
+        if (image) {
+                free (text);
+                free (font);
+                return script_return_obj (script_obj_new_native (image, data->class));
+        }
+
         label = ply_label_new ();
         ply_label_set_text (label, text);
         if (font)
@@ -251,8 +348,11 @@ static script_return_t image_text (script_state_t *state,
         height = ply_label_get_height (label);
 
         image = ply_pixel_buffer_new (width, height);
+        ply_pixel_buffer_set_owner (image, "label");
         ply_label_draw_area (label, image, 0, 0, width, height);
 
+        text_cache_insert (data, text, font, red, green, blue, alpha, align, image);
+
         free (text);
         free (font);
         ply_label_free (label);
@@ -267,6 +367,7 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
 
         data->class = script_obj_native_class_new (image_free, "image", data);
         data->image_dir = strdup (image_dir);
+        data->text_cache = ply_list_new ();
 
         script_obj_t *image_hash = script_obj_hash_get_element (state->global, "Image");
 
@@ -337,6 +438,15 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
 
 void script_lib_image_destroy (script_lib_image_data_t *data)
 {
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (data->text_cache);
+             node;
+             node = ply_list_get_next_node (data->text_cache, node)) {
+                text_cache_entry_free (ply_list_node_get_data (node));
+        }
+        ply_list_free (data->text_cache);
+
         script_obj_native_class_destroy (data->class);
         free (data->image_dir);
         script_parse_op_free (data->script_main_op);
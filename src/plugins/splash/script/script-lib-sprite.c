@@ -25,6 +25,7 @@
 #include "ply-logger.h"
 #include "ply-key-file.h"
 #include "ply-pixel-buffer.h"
+#include "ply-region.h"
 #include "ply-pixel-display.h"
 #include "script.h"
 #include "script-parse.h"
@@ -33,11 +34,18 @@
 #include "script-lib-image.h"
 #include "script-lib-sprite.h"
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 
 #include "script-lib-sprite.script.h"
 
+/* The screen is split into squares this many pixels wide, each keeping a
+ * list of the sprites over it, so drawing a small area only has to look
+ * at the sprites near it rather than every sprite there is.
+ */
+#define SPRITE_GRID_CELL_SIZE 64
+
 static void sprite_free (script_obj_t *obj)
 {
         sprite_t *sprite = obj->data.native.object_data;
@@ -45,13 +53,24 @@ static void sprite_free (script_obj_t *obj)
         sprite->remove_me = true;
 }
 
-static script_return_t sprite_new (script_state_t *state,
-                                   void           *user_data)
+/* The sprite list is kept sorted by z, and only needs sorting again once
+ * a sprite's depth changes
+ */
+static void sprite_set_depth (script_lib_sprite_data_t *data,
+                              sprite_t                 *sprite,
+                              int                       z)
 {
-        script_lib_sprite_data_t *data = user_data;
-        script_obj_t *reply;
+        if (sprite->z == z)
+                return;
+
+        sprite->z = z;
+        data->z_order_changed = true;
+}
 
+static sprite_t *sprite_create (script_lib_sprite_data_t *data)
+{
         sprite_t *sprite = calloc (1, sizeof(sprite_t));
+        ply_list_node_t *last_node = ply_list_get_last_node (data->sprite_list);
 
         sprite->x = 0;
         sprite->y = 0;
@@ -67,7 +86,18 @@ static script_return_t sprite_new (script_state_t *state,
         sprite->remove_me = false;
         sprite->image = NULL;
         sprite->image_obj = NULL;
-        ply_list_append_data (data->sprite_list, sprite);
+        if (last_node && ((sprite_t *) ply_list_node_get_data (last_node))->z > sprite->z)
+                data->z_order_changed = true;
+        ply_list_append_embedded_node (data->sprite_list, &sprite->list_node, sprite);
+        return sprite;
+}
+
+static script_return_t sprite_new (script_state_t *state,
+                                   void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = sprite_create (data);
+        script_obj_t *reply;
 
         reply = script_obj_new_native (sprite, data->class);
         return script_return_obj (reply);
@@ -183,7 +213,7 @@ static script_return_t sprite_set_z (script_state_t *state,
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
         if (sprite)
-                sprite->z = script_obj_hash_get_number (state->local, "value");
+                sprite_set_depth (data, sprite, script_obj_hash_get_number (state->local, "value"));
         return script_return_obj_null ();
 }
 
@@ -198,6 +228,287 @@ static script_return_t sprite_set_opacity (script_state_t *state,
         return script_return_obj_null ();
 }
 
+/* Only changes what the hash has an element for */
+static void peek_number (script_obj_t    *hash,
+                         const char      *name,
+                         script_number_t *number)
+{
+        script_obj_t *obj = script_obj_hash_peek_element (hash, name);
+
+        if (obj && script_obj_is_number (obj))
+                *number = script_obj_as_number (obj);
+        script_obj_unref (obj);
+}
+
+/* Moves a whole array of sprites in one call.  Each element holds a
+ * sprite, and any of the x, y, z and opacity it should take.
+ */
+static script_return_t sprite_set_positions (script_state_t *state,
+                                             void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        script_obj_t *array = script_obj_hash_peek_element (state->local, "positions");
+        int index;
+
+        if (array == NULL)
+                return script_return_obj_null ();
+
+        for (index = 0;; index++) {
+                script_obj_t *element, *sprite_obj;
+                sprite_t *sprite = NULL;
+
+                element = script_obj_hash_peek_index (array, index);
+                if (element == NULL)
+                        break;
+
+                sprite_obj = script_obj_hash_peek_element (element, "sprite");
+                if (sprite_obj)
+                        sprite = script_obj_as_native_of_class (sprite_obj, data->class);
+
+                if (sprite) {
+                        script_number_t x = sprite->x, y = sprite->y, z = sprite->z;
+
+                        peek_number (element, "x", &x);
+                        peek_number (element, "y", &y);
+                        peek_number (element, "z", &z);
+                        peek_number (element, "opacity", &sprite->opacity);
+                        sprite->x = x;
+                        sprite->y = y;
+                        sprite_set_depth (data, sprite, z);
+                }
+                script_obj_unref (sprite_obj);
+                script_obj_unref (element);
+        }
+        script_obj_unref (array);
+
+        return script_return_obj_null ();
+}
+
+static void particle_emitter_free (script_obj_t *obj)
+{
+        particle_emitter_t *emitter = obj->data.native.object_data;
+
+        emitter->remove_me = true;
+}
+
+static script_return_t particle_emitter_new (script_state_t *state,
+                                             void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        particle_emitter_t *emitter = calloc (1, sizeof(particle_emitter_t));
+
+        emitter->lifetime = 1.0;
+        emitter->fade = true;
+        emitter->particles = ply_list_new ();
+        ply_list_append_data (data->emitter_list, emitter);
+
+        return script_return_obj (script_obj_new_native (emitter, data->emitter_class));
+}
+
+static script_return_t particle_emitter_set_image (script_state_t *state,
+                                                   void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        particle_emitter_t *emitter = script_obj_as_native_of_class (state->this, data->emitter_class);
+        script_obj_t *script_obj_image = script_obj_hash_get_element (state->local,
+                                                                      "image");
+
+        script_obj_deref (&script_obj_image);
+        ply_pixel_buffer_t *image = script_obj_as_native_of_class_name (script_obj_image,
+                                                                        "image");
+
+        if (image && emitter) {
+                script_obj_unref (emitter->image_obj);
+                script_obj_ref (script_obj_image);
+                emitter->image = image;
+                emitter->image_obj = script_obj_image;
+        }
+        script_obj_unref (script_obj_image);
+
+        return script_return_obj_null ();
+}
+
+static script_return_t particle_emitter_set_position (script_state_t *state,
+                                                      void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        particle_emitter_t *emitter = script_obj_as_native_of_class (state->this, data->emitter_class);
+
+        if (emitter) {
+                emitter->x = script_obj_hash_get_number (state->local, "x");
+                emitter->y = script_obj_hash_get_number (state->local, "y");
+                emitter->z = script_obj_hash_get_number (state->local, "z");
+        }
+        return script_return_obj_null ();
+}
+
+static script_return_t particle_emitter_set_spawn_rate (script_state_t *state,
+                                                        void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        particle_emitter_t *emitter = script_obj_as_native_of_class (state->this, data->emitter_class);
+
+        if (emitter)
+                emitter->spawn_rate = MAX (script_obj_hash_get_number (state->local, "value"), 0);
+        return script_return_obj_null ();
+}
+
+static script_return_t particle_emitter_set_velocity (script_state_t *state,
+                                                      void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        particle_emitter_t *emitter = script_obj_as_native_of_class (state->this, data->emitter_class);
+
+        if (emitter) {
+                emitter->velocity_x = script_obj_hash_get_number (state->local, "x");
+                emitter->velocity_y = script_obj_hash_get_number (state->local, "y");
+                emitter->velocity_spread = script_obj_hash_get_number (state->local, "spread");
+        }
+        return script_return_obj_null ();
+}
+
+static script_return_t particle_emitter_set_lifetime (script_state_t *state,
+                                                      void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        particle_emitter_t *emitter = script_obj_as_native_of_class (state->this, data->emitter_class);
+
+        if (emitter)
+                emitter->lifetime = script_obj_hash_get_number (state->local, "value");
+        return script_return_obj_null ();
+}
+
+static script_return_t particle_emitter_set_fade (script_state_t *state,
+                                                  void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        particle_emitter_t *emitter = script_obj_as_native_of_class (state->this, data->emitter_class);
+
+        if (emitter)
+                emitter->fade = script_obj_hash_get_bool (state->local, "value");
+        return script_return_obj_null ();
+}
+
+static script_return_t particle_emitter_get_particle_count (script_state_t *state,
+                                                            void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        particle_emitter_t *emitter = script_obj_as_native_of_class (state->this, data->emitter_class);
+
+        if (emitter)
+                return script_return_obj (script_obj_new_number (ply_list_get_length (emitter->particles)));
+        return script_return_obj_null ();
+}
+
+static double particle_emitter_get_spread (particle_emitter_t *emitter)
+{
+        return emitter->velocity_spread * (2.0 * random () / ((double) RAND_MAX + 1) - 1.0);
+}
+
+static void particle_emitter_spawn (script_lib_sprite_data_t *data,
+                                    particle_emitter_t       *emitter)
+{
+        particle_t *particle = calloc (1, sizeof(particle_t));
+
+        particle->x = emitter->x;
+        particle->y = emitter->y;
+        particle->velocity_x = emitter->velocity_x + particle_emitter_get_spread (emitter);
+        particle->velocity_y = emitter->velocity_y + particle_emitter_get_spread (emitter);
+
+        particle->sprite = sprite_create (data);
+        particle->sprite->x = particle->x;
+        particle->sprite->y = particle->y;
+        sprite_set_depth (data, particle->sprite, emitter->z);
+        particle->sprite->image = emitter->image;
+        particle->sprite->image_obj = emitter->image_obj;
+        particle->sprite->refresh_me = true;
+        script_obj_ref (emitter->image_obj);
+
+        ply_list_append_data (emitter->particles, particle);
+}
+
+static void particle_emitter_update (script_lib_sprite_data_t *data,
+                                     particle_emitter_t       *emitter,
+                                     double                    elapsed)
+{
+        ply_list_node_t *node, *next_node;
+
+        for (node = ply_list_get_first_node (emitter->particles);
+             node;
+             node = next_node) {
+                particle_t *particle = ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (emitter->particles, node);
+
+                particle->age += elapsed;
+                if (emitter->remove_me || particle->age >= emitter->lifetime) {
+                        particle->sprite->remove_me = true;
+                        ply_list_remove_node (emitter->particles, node);
+                        free (particle);
+                        continue;
+                }
+
+                particle->x += particle->velocity_x * elapsed;
+                particle->y += particle->velocity_y * elapsed;
+                particle->sprite->x = particle->x;
+                particle->sprite->y = particle->y;
+                if (emitter->fade)
+                        particle->sprite->opacity = 1.0 - particle->age / emitter->lifetime;
+        }
+
+        if (emitter->remove_me || emitter->image == NULL || emitter->lifetime <= 0)
+                return;
+
+        emitter->spawns_owed += emitter->spawn_rate * elapsed;
+        while (emitter->spawns_owed >= 1.0) {
+                particle_emitter_spawn (data, emitter);
+                emitter->spawns_owed -= 1.0;
+        }
+}
+
+static void particle_emitter_destroy (particle_emitter_t *emitter)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (emitter->particles);
+             node;
+             node = ply_list_get_next_node (emitter->particles, node)) {
+                particle_t *particle = ply_list_node_get_data (node);
+                particle->sprite->remove_me = true;
+                free (particle);
+        }
+        ply_list_free (emitter->particles);
+        script_obj_unref (emitter->image_obj);
+        free (emitter);
+}
+
+static void update_particle_emitters (script_lib_sprite_data_t *data)
+{
+        ply_list_node_t *node, *next_node;
+        double now, elapsed;
+
+        now = ply_get_timestamp ();
+        elapsed = data->last_refresh_time > 0 ? now - data->last_refresh_time : 0;
+        data->last_refresh_time = now;
+
+        /* Frames that came late, or not at all while the splash was
+         * hidden, shouldn't come back as a burst of particles
+         */
+        elapsed = MIN (elapsed, 0.25);
+
+        for (node = ply_list_get_first_node (data->emitter_list);
+             node;
+             node = next_node) {
+                particle_emitter_t *emitter = ply_list_node_get_data (node);
+                next_node = ply_list_get_next_node (data->emitter_list, node);
+
+                particle_emitter_update (data, emitter, elapsed);
+                if (emitter->remove_me) {
+                        ply_list_remove_node (data->emitter_list, node);
+                        particle_emitter_destroy (emitter);
+                }
+        }
+}
+
 static script_return_t sprite_window_get_width (script_state_t *state,
                                                 void           *user_data)
 {
@@ -432,6 +743,182 @@ static void script_lib_draw_brackground (ply_pixel_buffer_t *pixel_buffer,
         }
 }
 
+static bool
+sprite_is_visible (sprite_t *sprite)
+{
+        if (!sprite->image) return false;
+        if (sprite->remove_me) return false;
+        if (sprite->opacity < 0.011) return false;
+
+        return true;
+}
+
+/* Whether the sprite paints every pixel of the area without letting
+ * anything underneath show through */
+static bool
+sprite_occludes_area (sprite_t             *sprite,
+                      script_lib_display_t *display,
+                      ply_rectangle_t      *area)
+{
+        int position_x, position_y;
+
+        if (!sprite_is_visible (sprite)) return false;
+        if (sprite->opacity != 1.0) return false;
+        if (!ply_pixel_buffer_is_opaque (sprite->image)) return false;
+
+        position_x = sprite->x - display->x;
+        position_y = sprite->y - display->y;
+
+        if (position_x > area->x) return false;
+        if (position_y > area->y) return false;
+        if (((int) ply_pixel_buffer_get_width (sprite->image) + position_x) < (area->x + (int) area->width)) return false;
+        if (((int) ply_pixel_buffer_get_height (sprite->image) + position_y) < (area->y + (int) area->height)) return false;
+
+        return true;
+}
+
+static int
+sprite_grid_get_cell (int position,
+                      int count)
+{
+        if (position < 0) return 0;
+        position /= SPRITE_GRID_CELL_SIZE;
+        if (position >= count) return count - 1;
+        return position;
+}
+
+static void
+sprite_grid_cell_add (sprite_grid_cell_t *cell,
+                      sprite_t           *sprite)
+{
+        if (cell->count == cell->capacity) {
+                cell->capacity = MAX (cell->capacity * 2, 8);
+                cell->sprites = realloc (cell->sprites, cell->capacity * sizeof(sprite_t *));
+        }
+        cell->sprites[cell->count++] = sprite;
+}
+
+static void
+sprite_grid_cell_remove (sprite_grid_cell_t *cell,
+                         sprite_t           *sprite)
+{
+        int i;
+
+        for (i = 0; i < cell->count; i++) {
+                if (cell->sprites[i] == sprite) {
+                        cell->sprites[i] = cell->sprites[--cell->count];
+                        return;
+                }
+        }
+}
+
+static void
+sprite_grid_remove (script_lib_sprite_data_t *data,
+                    sprite_t                 *sprite)
+{
+        int column, row;
+
+        if (!sprite->is_in_grid) return;
+
+        for (row = sprite->grid_row_start; row <= sprite->grid_row_end; row++) {
+                for (column = sprite->grid_column_start; column <= sprite->grid_column_end; column++) {
+                        sprite_grid_cell_remove (&data->grid_cells[row * data->grid_columns + column], sprite);
+                }
+        }
+        sprite->is_in_grid = false;
+}
+
+static void
+sprite_grid_add (script_lib_sprite_data_t *data,
+                 sprite_t                 *sprite,
+                 int                       width,
+                 int                       height)
+{
+        int column, row;
+
+        sprite->grid_column_start = sprite_grid_get_cell (sprite->x, data->grid_columns);
+        sprite->grid_row_start = sprite_grid_get_cell (sprite->y, data->grid_rows);
+        sprite->grid_column_end = sprite_grid_get_cell (sprite->x + MAX (width, 1) - 1, data->grid_columns);
+        sprite->grid_row_end = sprite_grid_get_cell (sprite->y + MAX (height, 1) - 1, data->grid_rows);
+
+        for (row = sprite->grid_row_start; row <= sprite->grid_row_end; row++) {
+                for (column = sprite->grid_column_start; column <= sprite->grid_column_end; column++) {
+                        sprite_grid_cell_add (&data->grid_cells[row * data->grid_columns + column], sprite);
+                }
+        }
+        sprite->is_in_grid = true;
+}
+
+static int
+sprite_compare_order (const void *pointer_a,
+                      const void *pointer_b)
+{
+        const sprite_t *sprite_a = *(sprite_t *const *) pointer_a;
+        const sprite_t *sprite_b = *(sprite_t *const *) pointer_b;
+
+        if (sprite_a->order != sprite_b->order)
+                return sprite_a->order < sprite_b->order ? -1 : 1;
+
+        return 0;
+}
+
+/* Collects the sprites over an area, bottom to top, in a newly allocated
+ * array.  Several bands of a display can be drawn at once, so this must
+ * only read the grid.
+ */
+static sprite_t **
+sprite_grid_get_sprites_in_area (script_lib_sprite_data_t *data,
+                                 int                       x,
+                                 int                       y,
+                                 int                       width,
+                                 int                       height,
+                                 int                      *sprite_count)
+{
+        int column_start, column_end, row_start, row_end;
+        int column, row, count, capacity, i, unique_count;
+        sprite_t **sprites;
+
+        column_start = sprite_grid_get_cell (x, data->grid_columns);
+        column_end = sprite_grid_get_cell (x + MAX (width, 1) - 1, data->grid_columns);
+        row_start = sprite_grid_get_cell (y, data->grid_rows);
+        row_end = sprite_grid_get_cell (y + MAX (height, 1) - 1, data->grid_rows);
+
+        capacity = 0;
+        for (row = row_start; row <= row_end; row++) {
+                for (column = column_start; column <= column_end; column++) {
+                        capacity += data->grid_cells[row * data->grid_columns + column].count;
+                }
+        }
+
+        *sprite_count = 0;
+        if (capacity == 0)
+                return NULL;
+
+        sprites = malloc (capacity * sizeof(sprite_t *));
+        count = 0;
+        for (row = row_start; row <= row_end; row++) {
+                for (column = column_start; column <= column_end; column++) {
+                        sprite_grid_cell_t *cell = &data->grid_cells[row * data->grid_columns + column];
+
+                        for (i = 0; i < cell->count; i++) {
+                                sprites[count++] = cell->sprites[i];
+                        }
+                }
+        }
+
+        /* A sprite over more than one square turns up once for each */
+        qsort (sprites, count, sizeof(sprite_t *), sprite_compare_order);
+        unique_count = 0;
+        for (i = 0; i < count; i++) {
+                if (unique_count > 0 && sprites[unique_count - 1] == sprites[i])
+                        continue;
+                sprites[unique_count++] = sprites[i];
+        }
+
+        *sprite_count = unique_count;
+        return sprites;
+}
+
 static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                          ply_pixel_buffer_t   *pixel_buffer,
                                          int                   x,
@@ -440,7 +927,8 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                          int                   height)
 {
         ply_rectangle_t clip_area;
-        ply_list_node_t *node;
+        sprite_t **sprites;
+        int sprite_count, first_sprite, i;
         sprite_t *sprite;
         script_lib_sprite_data_t *data = display->data;
 
@@ -449,36 +937,39 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
         clip_area.width = width;
         clip_area.height = height;
 
+        /* The grid holds where the sprites were at the last refresh, which
+         * is also what the damage being drawn here came from.
+         */
+        sprites = sprite_grid_get_sprites_in_area (data,
+                                                   x + display->x,
+                                                   y + display->y,
+                                                   width,
+                                                   height,
+                                                   &sprite_count);
+
+        /* The sprites are sorted bottom to top, so look for the topmost
+         * sprite that hides the whole area.  Nothing below it, including
+         * the background, needs to be drawn.
+         */
+        first_sprite = -1;
+        for (i = sprite_count - 1; i >= 0; i--) {
+                if (sprite_occludes_area (sprites[i], display, &clip_area)) {
+                        first_sprite = i;
+                        break;
+                }
+        }
 
-        node = ply_list_get_first_node (data->sprite_list);
-        sprite = ply_list_node_get_data (node);
-
-        /* Check If the first sprite should be rendered opaque */
-        if (sprite->image && !sprite->remove_me &&
-            ply_pixel_buffer_is_opaque (sprite->image) && sprite->opacity == 1.0)  {
-                int position_x = sprite->x - display->x;
-                int position_y = sprite->y - display->y;
-
-                /* In that case only draw the background if the sprite doesn't
-                 * cover the complete area */
-                if (position_x > x || position_y > y ||
-                    ((int)ply_pixel_buffer_get_width (sprite->image) + position_x) < (x + width) ||
-                    ((int)ply_pixel_buffer_get_height (sprite->image) + position_y) < (y + height))
-                        script_lib_draw_brackground (pixel_buffer, &clip_area, data);
-        } else {
+        if (first_sprite < 0) {
                 script_lib_draw_brackground (pixel_buffer, &clip_area, data);
+                first_sprite = 0;
         }
 
-        for (node = ply_list_get_first_node (data->sprite_list);
-             node;
-             node = ply_list_get_next_node (data->sprite_list, node)) {
+        for (i = first_sprite; i < sprite_count; i++) {
                 int position_x, position_y;
 
-                sprite = ply_list_node_get_data (node);
+                sprite = sprites[i];
 
-                if (!sprite->image) continue;
-                if (sprite->remove_me) continue;
-                if (sprite->opacity < 0.011) continue;
+                if (!sprite_is_visible (sprite)) continue;
 
                 position_x = sprite->x - display->x;
                 position_y = sprite->y - display->y;
@@ -495,6 +986,8 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                                                         &clip_area,
                                                                         sprite->opacity);
         }
+
+        free (sprites);
 }
 
 static void
@@ -528,6 +1021,9 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
 
         data->class = script_obj_native_class_new (sprite_free, "sprite", data);
         data->sprite_list = ply_list_new ();
+        data->emitter_class = script_obj_native_class_new (particle_emitter_free, "particle emitter", data);
+        data->emitter_list = ply_list_new ();
+        data->last_refresh_time = 0;
         data->displays = ply_list_new ();
 
         max_width = 0;
@@ -541,6 +1037,10 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                 max_height = MAX (max_height, ply_pixel_display_get_height (pixel_display));
         }
 
+        data->grid_columns = max_width / SPRITE_GRID_CELL_SIZE + 1;
+        data->grid_rows = max_height / SPRITE_GRID_CELL_SIZE + 1;
+        data->grid_cells = calloc (data->grid_columns * data->grid_rows, sizeof(sprite_grid_cell_t));
+
         for (node = ply_list_get_first_node (pixel_displays);
              node;
              node = ply_list_get_next_node (pixel_displays, node)) {
@@ -555,6 +1055,8 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                 ply_pixel_display_set_draw_handler (pixel_display,
                                                     (ply_pixel_display_draw_handler_t)
                                                     script_lib_sprite_draw_area, script_display);
+                /* Drawing only reads the sprites, so bands can go in parallel */
+                ply_pixel_display_set_draw_handler_is_thread_safe (pixel_display, true);
 
                 ply_list_append_data (data->displays, script_display);
         }
@@ -620,8 +1122,67 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                                     data,
                                     "value",
                                     NULL);
+        script_add_native_function (sprite_hash,
+                                    "SetPositions",
+                                    sprite_set_positions,
+                                    data,
+                                    "positions",
+                                    NULL);
         script_obj_unref (sprite_hash);
 
+        script_obj_t *emitter_hash = script_obj_hash_get_element (state->global, "ParticleEmitter");
+        script_add_native_function (emitter_hash,
+                                    "_New",
+                                    particle_emitter_new,
+                                    data,
+                                    NULL);
+        script_add_native_function (emitter_hash,
+                                    "SetImage",
+                                    particle_emitter_set_image,
+                                    data,
+                                    "image",
+                                    NULL);
+        script_add_native_function (emitter_hash,
+                                    "SetPosition",
+                                    particle_emitter_set_position,
+                                    data,
+                                    "x",
+                                    "y",
+                                    "z",
+                                    NULL);
+        script_add_native_function (emitter_hash,
+                                    "SetSpawnRate",
+                                    particle_emitter_set_spawn_rate,
+                                    data,
+                                    "value",
+                                    NULL);
+        script_add_native_function (emitter_hash,
+                                    "SetVelocity",
+                                    particle_emitter_set_velocity,
+                                    data,
+                                    "x",
+                                    "y",
+                                    "spread",
+                                    NULL);
+        script_add_native_function (emitter_hash,
+                                    "SetLifetime",
+                                    particle_emitter_set_lifetime,
+                                    data,
+                                    "value",
+                                    NULL);
+        script_add_native_function (emitter_hash,
+                                    "SetFade",
+                                    particle_emitter_set_fade,
+                                    data,
+                                    "value",
+                                    NULL);
+        script_add_native_function (emitter_hash,
+                                    "GetParticleCount",
+                                    particle_emitter_get_particle_count,
+                                    data,
+                                    NULL);
+        script_obj_unref (emitter_hash);
+
 
         script_obj_t *window_hash = script_obj_hash_get_element (state->global, "Window");
         script_add_native_function (window_hash,
@@ -678,12 +1239,17 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                                     "green",
                                     "blue",
                                     NULL);
+        /* The display sizes only change when a display goes away */
+        script_set_native_function_idempotent (window_hash, "GetWidth");
+        script_set_native_function_idempotent (window_hash, "GetHeight");
+        script_forget_idempotent_results ();
         script_obj_unref (window_hash);
 
         data->script_main_op = script_parse_string (script_lib_sprite_string, "script-lib-sprite.script");
         data->background_color_start = 0x000000;
         data->background_color_end = 0x000000;
         data->full_refresh = true;
+        data->z_order_changed = false;
         script_return_t ret = script_execute (state, data->script_main_op);
         script_obj_unref (ret.object);
         return data;
@@ -732,6 +1298,7 @@ void script_lib_sprite_pixel_display_removed (script_lib_sprite_data_t *data, pl
         if (display->pixel_display == pixel_display)
         {
             ply_list_remove_node (data->displays, node);
+            script_forget_idempotent_results ();
         }
         node = next_node;
     }
@@ -743,13 +1310,18 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
         ply_list_node_t *node;
         ply_region_t *region;
         ply_list_t *rectable_list;
+        int order;
 
         if (!data)
             return;
 
         region = ply_region_new ();
 
-        ply_list_sort_stable (data->sprite_list, &sprite_compare_z);
+        update_particle_emitters (data);
+        if (data->z_order_changed) {
+                ply_list_sort_stable (data->sprite_list, &sprite_compare_z);
+                data->z_order_changed = false;
+        }
 
         node = ply_list_get_first_node (data->sprite_list);
 
@@ -781,6 +1353,7 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                                                  sprite->old_width,
                                                  sprite->old_height);
                         }
+                        sprite_grid_remove (data, sprite);
                         ply_list_remove_node (data->sprite_list, node);
                         script_obj_unref (sprite->image_obj);
                         free (sprite);
@@ -788,10 +1361,12 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                 node = next_node;
         }
 
+        order = 0;
         for (node = ply_list_get_first_node (data->sprite_list);
              node;
              node = ply_list_get_next_node (data->sprite_list, node)) {
                 sprite_t *sprite = ply_list_node_get_data (node);
+                sprite->order = order++;
                 if (!sprite->image) continue;
                 if ((sprite->x != sprite->old_x)
                     || (sprite->y != sprite->old_y)
@@ -818,6 +1393,9 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                         sprite->old_height = size.height;
                         sprite->old_opacity = sprite->opacity;
                         sprite->refresh_me = false;
+
+                        sprite_grid_remove (data, sprite);
+                        sprite_grid_add (data, sprite, size.width, size.height);
                 }
         }
 
@@ -840,6 +1418,7 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
 void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
 {
         ply_list_node_t *node;
+        int i;
 
         for (node = ply_list_get_first_node (data->displays);
              node;
@@ -848,6 +1427,13 @@ void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
                 ply_pixel_display_set_draw_handler (display->pixel_display, NULL, NULL);
         }
 
+        for (node = ply_list_get_first_node (data->emitter_list);
+             node;
+             node = ply_list_get_next_node (data->emitter_list, node)) {
+                particle_emitter_destroy (ply_list_node_get_data (node));
+        }
+        ply_list_free (data->emitter_list);
+
         node = ply_list_get_first_node (data->sprite_list);
 
         while (node) {
@@ -861,8 +1447,15 @@ void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
         }
 
         ply_list_free (data->sprite_list);
+
+        for (i = 0; i < data->grid_columns * data->grid_rows; i++) {
+                free (data->grid_cells[i].sprites);
+        }
+        free (data->grid_cells);
+
         script_parse_op_free (data->script_main_op);
         script_obj_native_class_destroy (data->class);
+        script_obj_native_class_destroy (data->emitter_class);
         free (data);
         data = NULL;
 }
@@ -26,15 +26,32 @@
 #include "ply-pixel-buffer.h"
 #include "ply-pixel-display.h"
 
+/* The sprites whose bounds, as of the last refresh, touch one square of
+ * the screen
+ */
+typedef struct
+{
+        struct sprite_t **sprites;
+        int               count;
+        int               capacity;
+} sprite_grid_cell_t;
+
 typedef struct
 {
         ply_list_t                *displays;
         ply_list_t                *sprite_list;
         script_obj_native_class_t *class;
+        ply_list_t                *emitter_list;
+        script_obj_native_class_t *emitter_class;
+        double                     last_refresh_time;
         script_op_t               *script_main_op;
         uint32_t                   background_color_start;
         uint32_t                   background_color_end;
         bool                       full_refresh;
+        bool                       z_order_changed;
+        sprite_grid_cell_t        *grid_cells;
+        int                        grid_columns;
+        int                        grid_rows;
 } script_lib_sprite_data_t;
 
 typedef struct
@@ -45,7 +62,7 @@ typedef struct
         int                       y;
 } script_lib_display_t;
 
-typedef struct
+typedef struct sprite_t
 {
         int                 x;
         int                 y;
@@ -61,8 +78,48 @@ typedef struct
         bool                remove_me;
         ply_pixel_buffer_t *image;
         script_obj_t       *image_obj;
+        ply_list_node_t     list_node;
+
+        /* Where the sprite is in the grid, and in the sorted sprite list */
+        bool                is_in_grid;
+        int                 grid_column_start;
+        int                 grid_row_start;
+        int                 grid_column_end;
+        int                 grid_row_end;
+        int                 order;
 } sprite_t;
 
+/* Spawns sprites that move in a straight line and go away when they get
+ * too old, all updated in C at each refresh
+ */
+typedef struct
+{
+        double              x;
+        double              y;
+        int                 z;
+        double              spawn_rate;    /* particles per second */
+        double              velocity_x;    /* pixels per second */
+        double              velocity_y;
+        double              velocity_spread;
+        double              lifetime;      /* seconds */
+        bool                fade;
+        double              spawns_owed;   /* fraction of a particle left over */
+        bool                remove_me;
+        ply_pixel_buffer_t *image;
+        script_obj_t       *image_obj;
+        ply_list_t         *particles;
+} particle_emitter_t;
+
+typedef struct
+{
+        sprite_t *sprite;
+        double    x;
+        double    y;
+        double    velocity_x;
+        double    velocity_y;
+        double    age;
+} particle_t;
+
 script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                                                    ply_list_t     *displays);
 void script_lib_sprite_pixel_display_removed (script_lib_sprite_data_t *data, ply_pixel_display_t *pixel_display);
@@ -38,15 +38,93 @@
 #include <values.h>
 
 #include "script.h"
+#include "script-atom.h"
 #include "script-object.h"
 
+#define SCRIPT_OBJ_SLAB_SIZE 256
+
+/* "%g" prints whole numbers below this as just their digits */
+#define SCRIPT_OBJ_HASH_INDEX_LIMIT 1000000
+#define SCRIPT_OBJ_HASH_MIN_ARRAY_SIZE 16
+
+/* Scripts make and drop objects for nearly every value they compute, so
+ * objects come from slabs and go back onto a free list instead of going
+ * through malloc each time.  The slabs are given back once no objects
+ * are left.
+ */
+typedef struct script_obj_slab_t
+{
+        struct script_obj_slab_t *next;
+        script_obj_t              objects[SCRIPT_OBJ_SLAB_SIZE];
+} script_obj_slab_t;
+
+static script_obj_slab_t *script_obj_slabs = NULL;
+static script_obj_t *script_obj_free_list = NULL;
+static unsigned int script_obj_live_count = 0;
+static unsigned int script_obj_peak_live_count = 0;
+
 void script_obj_reset (script_obj_t *obj);
 
+static script_obj_t *script_obj_alloc (void)
+{
+        script_obj_t *obj;
+
+        if (!script_obj_free_list) {
+                script_obj_slab_t *slab = malloc (sizeof(script_obj_slab_t));
+                int i;
+
+                slab->next = script_obj_slabs;
+                script_obj_slabs = slab;
+                for (i = SCRIPT_OBJ_SLAB_SIZE - 1; i >= 0; i--) {
+                        slab->objects[i].data.obj = script_obj_free_list;
+                        script_obj_free_list = &slab->objects[i];
+                }
+        }
+
+        obj = script_obj_free_list;
+        script_obj_free_list = obj->data.obj;
+        script_obj_live_count++;
+        if (script_obj_live_count > script_obj_peak_live_count)
+                script_obj_peak_live_count = script_obj_live_count;
+        return obj;
+}
+
+static void script_obj_release (script_obj_t *obj)
+{
+        obj->data.obj = script_obj_free_list;
+        script_obj_free_list = obj;
+        script_obj_live_count--;
+
+        if (script_obj_live_count > 0) return;
+
+        while (script_obj_slabs) {
+                script_obj_slab_t *slab = script_obj_slabs;
+                script_obj_slabs = slab->next;
+                free (slab);
+        }
+        script_obj_free_list = NULL;
+}
+
+unsigned int script_obj_get_live_count (void)
+{
+        return script_obj_live_count;
+}
+
+unsigned int script_obj_get_peak_live_count (void)
+{
+        return script_obj_peak_live_count;
+}
+
+void script_obj_reset_peak_live_count (void)
+{
+        script_obj_peak_live_count = script_obj_live_count;
+}
+
 void script_obj_free (script_obj_t *obj)
 {
         assert (!obj->refcount);
         script_obj_reset (obj);
-        free (obj);
+        script_obj_release (obj);
 }
 
 void script_obj_ref (script_obj_t *obj)
@@ -70,7 +148,7 @@ static void foreach_free_variable (void *key,
         script_variable_t *variable = data;
 
         script_obj_unref (variable->object);
-        free (variable->name);
+        script_atom_unref (variable->name);
         free (variable);
 }
 
@@ -94,8 +172,17 @@ void script_obj_reset (script_obj_t *obj)
                 break;
 
         case SCRIPT_OBJ_TYPE_HASH:              /* FIXME nightmare */
-                ply_hashtable_foreach (obj->data.hash, foreach_free_variable, NULL);
-                ply_hashtable_free (obj->data.hash);
+                ply_hashtable_foreach (obj->data.hash.table, foreach_free_variable, NULL);
+                ply_hashtable_free (obj->data.hash.table);
+                if (obj->data.hash.array) {
+                        unsigned int index;
+
+                        for (index = 0; index < obj->data.hash.array->size; index++) {
+                                if (obj->data.hash.array->elements[index])
+                                        script_obj_unref (obj->data.hash.array->elements[index]);
+                        }
+                        free (obj->data.hash.array);
+                }
                 break;
 
         case SCRIPT_OBJ_TYPE_FUNCTION:
@@ -148,7 +235,7 @@ void script_obj_deref (script_obj_t **obj_ptr)
 
 script_obj_t *script_obj_new_null (void)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_NULL;
         obj->refcount = 1;
@@ -157,7 +244,7 @@ script_obj_t *script_obj_new_null (void)
 
 script_obj_t *script_obj_new_number (script_number_t number)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_NUMBER;
         obj->refcount = 1;
@@ -168,7 +255,7 @@ script_obj_t *script_obj_new_number (script_number_t number)
 script_obj_t *script_obj_new_string (const char *string)
 {
         if (!string) return script_obj_new_null ();
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
         obj->type = SCRIPT_OBJ_TYPE_STRING;
         obj->refcount = 1;
         obj->data.string = strdup (string);
@@ -177,18 +264,19 @@ script_obj_t *script_obj_new_string (const char *string)
 
 script_obj_t *script_obj_new_hash (void)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_HASH;
-        obj->data.hash = ply_hashtable_new (ply_hashtable_string_hash,
-                                            ply_hashtable_string_compare);
+        obj->data.hash.table = ply_hashtable_new (ply_hashtable_string_hash,
+                                                  script_atom_compare);
+        obj->data.hash.array = NULL;
         obj->refcount = 1;
         return obj;
 }
 
 script_obj_t *script_obj_new_function (script_function_t *function)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_FUNCTION;
         obj->data.function = function;
@@ -198,7 +286,7 @@ script_obj_t *script_obj_new_function (script_function_t *function)
 
 script_obj_t *script_obj_new_ref (script_obj_t *sub_obj)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         sub_obj = script_obj_deref_direct (sub_obj);
         script_obj_ref (sub_obj);
@@ -210,7 +298,7 @@ script_obj_t *script_obj_new_ref (script_obj_t *sub_obj)
 
 script_obj_t *script_obj_new_extend (script_obj_t *obj_a, script_obj_t *obj_b)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj_a = script_obj_deref_direct (obj_a);
         obj_b = script_obj_deref_direct (obj_b);
@@ -227,7 +315,7 @@ script_obj_t *script_obj_new_native (void                      *object_data,
                                      script_obj_native_class_t *class)
 {
         if (!object_data) return script_obj_new_null ();
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
         obj->type = SCRIPT_OBJ_TYPE_NATIVE;
         obj->data.native.class = class;
         obj->data.native.object_data = object_data;
@@ -406,37 +494,223 @@ void script_obj_assign (script_obj_t *obj_a,
         obj_a->data.obj = obj_b;
 }
 
+typedef struct
+{
+        const char  *name;
+        unsigned int hash;
+} script_obj_hash_key_t;
+
 static void *script_obj_direct_as_hash_element (script_obj_t *obj,
                                                 void         *user_data)
 {
-        const char *name = user_data;
+        script_obj_hash_key_t *key = user_data;
 
         if (obj->type == SCRIPT_OBJ_TYPE_HASH) {
-                script_variable_t *variable = ply_hashtable_lookup (obj->data.hash, (void *) name);
+                script_variable_t *variable = ply_hashtable_lookup_with_hash (obj->data.hash.table,
+                                                                              (void *) key->name,
+                                                                              key->hash);
                 if (variable)
                         return variable->object;
         }
         return NULL;
 }
 
-script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
-                                            const char   *name)
+unsigned int script_obj_hash_get_name_hash (const char *name)
+{
+        return ply_hashtable_string_hash ((void *) name);
+}
+
+bool script_obj_get_hash_index (script_obj_t *obj,
+                                unsigned int *index)
+{
+        script_obj_t *number_obj = script_obj_as_obj_type (obj, SCRIPT_OBJ_TYPE_NUMBER);
+        script_number_t number;
+
+        if (!number_obj) return false;
+        number = number_obj->data.number;
+
+        /* Past this, numbers stop turning into the string of their digits */
+        if (!(number >= 0 && number < SCRIPT_OBJ_HASH_INDEX_LIMIT) ||
+            signbit (number) || number != floor (number))
+                return false;
+
+        *index = number;
+        return true;
+}
+
+/* Names that are the digits of an index, the way a number prints, go
+ * with the elements kept by number */
+static bool script_obj_hash_name_get_index (const char   *name,
+                                            unsigned int *index)
+{
+        unsigned int value = 0;
+        int length;
+
+        if (name[0] < '0' || name[0] > '9') return false;
+        if (name[0] == '0' && name[1] != '\0') return false;
+
+        for (length = 0; name[length] != '\0'; length++) {
+                if (name[length] < '0' || name[length] > '9') return false;
+                value = value * 10 + name[length] - '0';
+                if (value >= SCRIPT_OBJ_HASH_INDEX_LIMIT) return false;
+        }
+
+        *index = value;
+        return true;
+}
+
+static script_obj_t *script_obj_hash_lookup_index (script_obj_t *hash,
+                                                   unsigned int  index)
+{
+        script_obj_hash_array_t *array = hash->data.hash.array;
+        script_variable_t *variable;
+        char name[16];
+
+        if (!array) return NULL;
+        if (index < array->size) return array->elements[index];
+        if (array->number_of_indices_in_table == 0) return NULL;
+
+        snprintf (name, sizeof(name), "%u", index);
+        variable = ply_hashtable_lookup (hash->data.hash.table, name);
+        return variable ? variable->object : NULL;
+}
+
+/* Brings elements the array now reaches over from the hash table */
+static void script_obj_hash_grow_array (script_obj_t *hash,
+                                        unsigned int  size)
+{
+        script_obj_hash_array_t *array = hash->data.hash.array;
+        unsigned int old_size = array ? array->size : 0;
+        unsigned int index;
+
+        array = realloc (array, sizeof(script_obj_hash_array_t) + size * sizeof(script_obj_t *));
+        if (!hash->data.hash.array) array->number_of_indices_in_table = 0;
+        memset (array->elements + old_size, 0, (size - old_size) * sizeof(script_obj_t *));
+        array->size = size;
+        hash->data.hash.array = array;
+
+        for (index = old_size; index < size && array->number_of_indices_in_table > 0; index++) {
+                script_variable_t *variable;
+                char name[16];
+
+                snprintf (name, sizeof(name), "%u", index);
+                variable = ply_hashtable_remove (hash->data.hash.table, name);
+                if (!variable) continue;
+
+                array->elements[index] = variable->object;
+                array->number_of_indices_in_table--;
+                script_atom_unref (variable->name);
+                free (variable);
+        }
+}
+
+static void *script_obj_direct_as_hash_index (script_obj_t *obj,
+                                              void         *user_data)
+{
+        unsigned int *index = user_data;
+
+        if (obj->type == SCRIPT_OBJ_TYPE_HASH)
+                return script_obj_hash_lookup_index (obj, *index);
+        return NULL;
+}
+
+script_obj_t *script_obj_hash_peek_index (script_obj_t *hash,
+                                          unsigned int  index)
 {
         script_obj_t *object;
 
+        object = script_obj_as_custom (hash,
+                                       script_obj_direct_as_hash_index,
+                                       &index);
+        if (object) script_obj_ref (object);
+        return object;
+}
+
+script_obj_t *script_obj_hash_get_index (script_obj_t *hash,
+                                         unsigned int  index)
+{
+        script_obj_t *obj = script_obj_hash_peek_index (hash, index);
+        script_obj_hash_array_t *array;
+        unsigned int size;
+
+        if (obj) return obj;
+        script_obj_t *realhash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
+        if (!realhash) {
+                realhash = script_obj_new_hash (); /* If it wasn't a hash then make it into one */
+                script_obj_assign (hash, realhash);
+        }
+
+        obj = script_obj_new_null ();
+
+        /* Growing to reach far off numbers would leave most of the array
+         * empty, so only grow by doubling */
+        array = realhash->data.hash.array;
+        size = array ? array->size * 2 : 0;
+        if (size < SCRIPT_OBJ_HASH_MIN_ARRAY_SIZE) size = SCRIPT_OBJ_HASH_MIN_ARRAY_SIZE;
+        if (index >= (array ? array->size : 0) && index < size) {
+                script_obj_hash_grow_array (realhash, size);
+                array = realhash->data.hash.array;
+        }
+
+        if (array && index < array->size) {
+                array->elements[index] = obj;
+        } else {
+                script_variable_t *variable = malloc (sizeof(script_variable_t));
+                char name[16];
+
+                if (!array) {
+                        script_obj_hash_grow_array (realhash, 0);
+                        array = realhash->data.hash.array;
+                }
+
+                snprintf (name, sizeof(name), "%u", index);
+                variable->name = (char *) script_atom_get (name);
+                variable->object = obj;
+                ply_hashtable_insert (realhash->data.hash.table, variable->name, variable);
+                array->number_of_indices_in_table++;
+        }
+
+        script_obj_ref (obj);
+        return obj;
+}
+
+script_obj_t *script_obj_hash_peek_element_with_hash (script_obj_t *hash,
+                                                      const char   *name,
+                                                      unsigned int  name_hash)
+{
+        script_obj_t *object;
+        script_obj_hash_key_t key = { name, name_hash };
+        unsigned int index;
+
         if (!name) return script_obj_new_null ();
+        if (script_obj_hash_name_get_index (name, &index))
+                return script_obj_hash_peek_index (hash, index);
         object = script_obj_as_custom (hash,
                                        script_obj_direct_as_hash_element,
-                                       (void *) name);
+                                       &key);
         if (object) script_obj_ref (object);
         return object;
 }
 
-script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
-                                           const char   *name)
+script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
+                                            const char   *name)
+{
+        if (!name) return script_obj_new_null ();
+        return script_obj_hash_peek_element_with_hash (hash, name,
+                                                       script_obj_hash_get_name_hash (name));
+}
+
+script_obj_t *script_obj_hash_get_element_with_hash (script_obj_t *hash,
+                                                     const char   *name,
+                                                     unsigned int  name_hash)
 {
-        script_obj_t *obj = script_obj_hash_peek_element (hash, name);
+        script_obj_t *obj;
+        unsigned int index;
 
+        if (script_obj_hash_name_get_index (name, &index))
+                return script_obj_hash_get_index (hash, index);
+
+        obj = script_obj_hash_peek_element_with_hash (hash, name, name_hash);
         if (obj) return obj;
         script_obj_t *realhash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
         if (!realhash) {
@@ -444,13 +718,21 @@ script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                 script_obj_assign (hash, realhash);
         }
         script_variable_t *variable = malloc (sizeof(script_variable_t));
-        variable->name = strdup (name);
+        variable->name = (char *) script_atom_get (name);
         variable->object = script_obj_new_null ();
-        ply_hashtable_insert (realhash->data.hash, variable->name, variable);
+        ply_hashtable_insert (realhash->data.hash.table, variable->name, variable);
         script_obj_ref (variable->object);
         return variable->object;
 }
 
+script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
+                                           const char   *name)
+{
+        if (!name) return script_obj_new_null ();
+        return script_obj_hash_get_element_with_hash (hash, name,
+                                                      script_obj_hash_get_name_hash (name));
+}
+
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
                                             const char   *name)
 {
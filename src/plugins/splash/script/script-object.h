@@ -39,6 +39,12 @@ typedef void *(*script_obj_direct_func_t)(script_obj_t *,
                                           void         *);
 
 
+/* How many objects exist right now, and the most there were at once since
+ * the peak was last reset */
+unsigned int script_obj_get_live_count (void);
+unsigned int script_obj_get_peak_live_count (void);
+void script_obj_reset_peak_live_count (void);
+
 void script_obj_free (script_obj_t *obj);
 void script_obj_ref (script_obj_t *obj);
 void script_obj_unref (script_obj_t *obj);
@@ -84,6 +90,20 @@ script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
                                             const char   *name);
 script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                                            const char   *name);
+/* For looking one name up in several hashes without rehashing it */
+unsigned int script_obj_hash_get_name_hash (const char *name);
+bool script_obj_get_hash_index (script_obj_t *obj,
+                                unsigned int *index);
+script_obj_t *script_obj_hash_peek_index (script_obj_t *hash,
+                                          unsigned int  index);
+script_obj_t *script_obj_hash_get_index (script_obj_t *hash,
+                                         unsigned int  index);
+script_obj_t *script_obj_hash_peek_element_with_hash (script_obj_t *hash,
+                                                      const char   *name,
+                                                      unsigned int  name_hash);
+script_obj_t *script_obj_hash_get_element_with_hash (script_obj_t *hash,
+                                                     const char   *name,
+                                                     unsigned int  name_hash);
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
                                             const char   *name);
 bool script_obj_hash_get_bool (script_obj_t *hash,
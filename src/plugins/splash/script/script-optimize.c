@@ -0,0 +1,356 @@
+/* script-optimize.c - simplification of parsed scripts
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-list.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "script.h"
+#include "script-atom.h"
+#include "script-debug.h"
+#include "script-execute.h"
+#include "script-object.h"
+#include "script-parse.h"
+#include "script-optimize.h"
+
+static void script_optimize_exp (script_exp_t *exp);
+static void script_optimize_op (script_op_t *op);
+
+static bool script_optimize_exp_is_constant (script_exp_t *exp)
+{
+        return exp->type == SCRIPT_EXP_TYPE_TERM_NUMBER ||
+               exp->type == SCRIPT_EXP_TYPE_TERM_STRING ||
+               exp->type == SCRIPT_EXP_TYPE_TERM_NULL;
+}
+
+/* Moves what an element holds into its parent, which keeps its place in
+ * the tree, and takes the child's debug location so errors still point
+ * at the code that causes them
+ */
+static void script_optimize_take_location (void *parent,
+                                           void *child)
+{
+        script_debug_location_t *location = script_debug_lookup_element (child);
+        script_debug_location_t location_copy;
+
+        if (!location) return;
+        location_copy = *location;
+        script_debug_remove_element (parent);
+        script_debug_add_element (parent, &location_copy);
+        script_debug_remove_element (child);
+}
+
+static void script_optimize_exp_replace (script_exp_t *exp,
+                                         script_exp_t *child)
+{
+        script_optimize_take_location (exp, child);
+        *exp = *child;
+        free (child);
+}
+
+static void script_optimize_op_replace (script_op_t *op,
+                                        script_op_t *child)
+{
+        if (!child) {
+                op->type = SCRIPT_OP_TYPE_OP_BLOCK;
+                op->data.list = ply_list_new ();
+                return;
+        }
+        script_optimize_take_location (op, child);
+        *op = *child;
+        free (child);
+}
+
+static void script_optimize_exp_free_operands (script_exp_t *exp)
+{
+        if (exp->type == SCRIPT_EXP_TYPE_NOT ||
+            exp->type == SCRIPT_EXP_TYPE_POS ||
+            exp->type == SCRIPT_EXP_TYPE_NEG) {
+                script_parse_exp_free (exp->data.sub);
+        } else {
+                script_parse_exp_free (exp->data.dual.sub_a);
+                script_parse_exp_free (exp->data.dual.sub_b);
+        }
+}
+
+static void script_optimize_fold (script_exp_t *exp)
+{
+        script_obj_t *obj;
+
+        /* Only replace the expression if the result can be written as a
+         * constant.  Each evaluation makes a new object, as the constant
+         * does, so nothing can tell the difference
+         */
+        obj = script_evaluate_constant (exp);
+
+        if (script_obj_is_number (obj)) {
+                script_number_t number = script_obj_as_number (obj);
+                script_obj_unref (obj);
+                script_optimize_exp_free_operands (exp);
+                exp->type = SCRIPT_EXP_TYPE_TERM_NUMBER;
+                exp->data.number = number;
+        } else if (script_obj_is_string (obj)) {
+                char *string = script_obj_as_string (obj);
+                script_obj_unref (obj);
+                script_optimize_exp_free_operands (exp);
+                exp->type = SCRIPT_EXP_TYPE_TERM_STRING;
+                exp->data.string = (char *) script_atom_get (string);
+                free (string);
+        } else if (script_obj_is_null (obj)) {
+                script_obj_unref (obj);
+                script_optimize_exp_free_operands (exp);
+                exp->type = SCRIPT_EXP_TYPE_TERM_NULL;
+        } else {
+                script_obj_unref (obj);
+        }
+}
+
+static void script_optimize_exp (script_exp_t *exp)
+{
+        ply_list_node_t *node;
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+                script_optimize_exp (exp->data.dual.sub_a);
+                script_optimize_exp (exp->data.dual.sub_b);
+                if (script_optimize_exp_is_constant (exp->data.dual.sub_a) &&
+                    script_optimize_exp_is_constant (exp->data.dual.sub_b))
+                        script_optimize_fold (exp);
+                return;
+
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        {
+                script_exp_t *sub_a, *sub_b;
+                script_obj_t *obj;
+                bool value;
+
+                script_optimize_exp (exp->data.dual.sub_a);
+                script_optimize_exp (exp->data.dual.sub_b);
+                sub_a = exp->data.dual.sub_a;
+                sub_b = exp->data.dual.sub_b;
+                if (!script_optimize_exp_is_constant (sub_a))
+                        return;
+
+                /* The result is whichever side decides it */
+                obj = script_evaluate_constant (sub_a);
+                value = script_obj_as_bool (obj);
+                script_obj_unref (obj);
+                if (value == (exp->type == SCRIPT_EXP_TYPE_OR)) {
+                        script_parse_exp_free (sub_b);
+                        script_optimize_exp_replace (exp, sub_a);
+                } else {
+                        script_parse_exp_free (sub_a);
+                        script_optimize_exp_replace (exp, sub_b);
+                }
+                return;
+        }
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+                script_optimize_exp (exp->data.sub);
+                if (script_optimize_exp_is_constant (exp->data.sub))
+                        script_optimize_fold (exp);
+                return;
+
+        case SCRIPT_EXP_TYPE_NEG:
+                /* Negating anything but a number is an error when it runs */
+                script_optimize_exp (exp->data.sub);
+                if (exp->data.sub->type == SCRIPT_EXP_TYPE_TERM_NUMBER)
+                        script_optimize_fold (exp);
+                return;
+
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                script_optimize_exp (exp->data.sub);
+                return;
+
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                script_optimize_exp (exp->data.dual.sub_a);
+                script_optimize_exp (exp->data.dual.sub_b);
+                return;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                for (node = ply_list_get_first_node (exp->data.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.parameters, node)) {
+                        script_optimize_exp (ply_list_node_get_data (node));
+                }
+                return;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_optimize_exp (exp->data.function_exe.name);
+                for (node = ply_list_get_first_node (exp->data.function_exe.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_exe.parameters, node)) {
+                        script_optimize_exp (ply_list_node_get_data (node));
+                }
+                return;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                        script_optimize_op (exp->data.function_def->data.script);
+                return;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                return;
+        }
+}
+
+static bool script_optimize_exp_get_constant_bool (script_exp_t *exp,
+                                                   bool         *value)
+{
+        script_obj_t *obj;
+
+        if (!script_optimize_exp_is_constant (exp))
+                return false;
+
+        obj = script_evaluate_constant (exp);
+        *value = script_obj_as_bool (obj);
+        script_obj_unref (obj);
+        return true;
+}
+
+static void script_optimize_op_list (ply_list_t *list)
+{
+        ply_list_node_t *node = ply_list_get_first_node (list);
+        bool unreachable = false;
+
+        /* A block stops at the first op that leaves it, so the ops after
+         * one that always does can never run
+         */
+        while (node) {
+                ply_list_node_t *next_node = ply_list_get_next_node (list, node);
+                script_op_t *op = ply_list_node_get_data (node);
+
+                if (unreachable) {
+                        script_parse_op_free (op);
+                        ply_list_remove_node (list, node);
+                } else {
+                        script_optimize_op (op);
+                        unreachable = op->type == SCRIPT_OP_TYPE_RETURN ||
+                                      op->type == SCRIPT_OP_TYPE_FAIL ||
+                                      op->type == SCRIPT_OP_TYPE_BREAK ||
+                                      op->type == SCRIPT_OP_TYPE_CONTINUE;
+                }
+                node = next_node;
+        }
+}
+
+static void script_optimize_op (script_op_t *op)
+{
+        bool value;
+
+        if (!op) return;
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+                script_optimize_exp (op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                script_optimize_op_list (op->data.list);
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        {
+                script_op_t *op1 = op->data.cond_op.op1;
+                script_op_t *op2 = op->data.cond_op.op2;
+
+                script_optimize_exp (op->data.cond_op.cond);
+                script_optimize_op (op1);
+                script_optimize_op (op2);
+                if (!script_optimize_exp_get_constant_bool (op->data.cond_op.cond, &value))
+                        break;
+
+                script_parse_exp_free (op->data.cond_op.cond);
+                if (value) {
+                        script_parse_op_free (op2);
+                        script_optimize_op_replace (op, op1);
+                } else {
+                        script_parse_op_free (op1);
+                        script_optimize_op_replace (op, op2);
+                }
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_optimize_exp (op->data.cond_op.cond);
+                script_optimize_op (op->data.cond_op.op1);
+                script_optimize_op (op->data.cond_op.op2);
+
+                /* A loop that never starts ends normally with no result */
+                if (script_optimize_exp_get_constant_bool (op->data.cond_op.cond, &value) && !value) {
+                        script_parse_exp_free (op->data.cond_op.cond);
+                        script_parse_op_free (op->data.cond_op.op1);
+                        script_parse_op_free (op->data.cond_op.op2);
+                        script_optimize_op_replace (op, NULL);
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_DO_WHILE:
+                script_optimize_exp (op->data.cond_op.cond);
+                script_optimize_op (op->data.cond_op.op1);
+                script_optimize_op (op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_RETURN:
+                if (op->data.exp)
+                        script_optimize_exp (op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+void script_optimize (script_op_t *op)
+{
+        script_optimize_op (op);
+}
@@ -0,0 +1,30 @@
+/* script-optimize.h - simplification of parsed scripts
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_OPTIMIZE_H
+#define SCRIPT_OPTIMIZE_H
+
+#include "script.h"
+
+/* Folds constant expressions and drops code that can never run, in op
+ * and in the bodies of all the functions defined in it
+ */
+void script_optimize (script_op_t *op);
+
+#endif /* SCRIPT_OPTIMIZE_H */
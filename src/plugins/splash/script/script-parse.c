@@ -40,6 +40,10 @@
 #include "script-debug.h"
 #include "script-scan.h"
 #include "script-parse.h"
+#include "script-compile.h"
+#include "script-atom.h"
+#include "script-optimize.h"
+#include "script-cache.h"
 
 #define WITH_SEMIES
 
@@ -54,7 +58,6 @@ static script_op_t *script_parse_op (script_scan_t *scan);
 static script_exp_t *script_parse_exp (script_scan_t *scan);
 static ply_list_t *script_parse_op_list (script_scan_t *scan);
 static void script_parse_op_list_free (ply_list_t *op_list);
-static void script_parse_exp_free (script_exp_t *exp);
 
 static script_exp_t *script_parse_new_exp (script_exp_type_t        type,
                                            script_debug_location_t *location)
@@ -102,7 +105,7 @@ static script_exp_t *script_parse_new_exp_string (char                    *strin
 {
         script_exp_t *exp = script_parse_new_exp (SCRIPT_EXP_TYPE_TERM_STRING, location);
 
-        exp->data.string = strdup (string);
+        exp->data.string = (char *) script_atom_get (string);
         return exp;
 }
 
@@ -111,7 +114,7 @@ static script_exp_t *script_parse_new_exp_var (char                    *string,
 {
         script_exp_t *exp = script_parse_new_exp (SCRIPT_EXP_TYPE_TERM_VAR, location);
 
-        exp->data.string = strdup (string);
+        exp->data.string = (char *) script_atom_get (string);
         return exp;
 }
 
@@ -150,6 +153,7 @@ static script_op_t *script_parse_new_op (script_op_type_t         type,
         script_op_t *op = malloc (sizeof(script_op_t));
 
         op->type = type;
+        op->code = NULL;
         script_debug_add_element (op, location);
         return op;
 }
@@ -880,7 +884,7 @@ static ply_list_t *script_parse_op_list (script_scan_t *scan)
         return op_list;
 }
 
-static void script_parse_exp_free (script_exp_t *exp)
+void script_parse_exp_free (script_exp_t *exp)
 {
         if (!exp) return;
         switch (exp->type) {
@@ -969,7 +973,7 @@ static void script_parse_exp_free (script_exp_t *exp)
 
         case SCRIPT_EXP_TYPE_TERM_STRING:
         case SCRIPT_EXP_TYPE_TERM_VAR:
-                free (exp->data.string);
+                script_atom_unref (exp->data.string);
                 break;
         }
         script_debug_remove_element (exp);
@@ -979,6 +983,7 @@ static void script_parse_exp_free (script_exp_t *exp)
 void script_parse_op_free (script_op_t *op)
 {
         if (!op) return;
+        script_code_free (op->code);
         switch (op->type) {
         case SCRIPT_OP_TYPE_EXPRESSION:
                 script_parse_exp_free (op->data.exp);
@@ -1026,6 +1031,13 @@ static void script_parse_op_list_free (ply_list_t *op_list)
 
 script_op_t *script_parse_file (const char *filename)
 {
+        script_op_t *cached_op = script_cache_load (filename);
+
+        if (cached_op) {
+                script_compile (cached_op);
+                return cached_op;
+        }
+
         script_scan_t *scan = script_scan_file (filename);
 
         if (!scan) {
@@ -1044,6 +1056,8 @@ script_op_t *script_parse_file (const char *filename)
         }
         script_op_t *op = script_parse_new_op_block (list, &location);
         script_scan_free (scan);
+        script_optimize (op);
+        script_compile (op);
         return op;
 }
 
@@ -1068,5 +1082,7 @@ script_op_t *script_parse_string (const char *string,
         }
         script_op_t *op = script_parse_new_op_block (list, &location);
         script_scan_free (scan);
+        script_optimize (op);
+        script_compile (op);
         return op;
 }
@@ -0,0 +1,296 @@
+/* script-profile.c - time spent in each script function and line
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+#include "script-debug.h"
+#include "script-profile.h"
+
+typedef enum
+{
+        SCRIPT_PROFILE_ENTRY_TYPE_FUNCTION,
+        SCRIPT_PROFILE_ENTRY_TYPE_LINE,
+} script_profile_entry_type_t;
+
+typedef struct script_profile_entry_t
+{
+        script_profile_entry_type_t type;
+        char                       *label;
+        unsigned long               count;
+        double                      seconds;
+} script_profile_entry_t;
+
+static bool script_profile_enabled = false;
+
+static ply_list_t *script_profile_entries = NULL;
+static ply_hashtable_t *script_profile_entry_for_op = NULL;       /* statement op to its line */
+static ply_hashtable_t *script_profile_entry_for_line = NULL;     /* "name:line" to its line */
+static ply_hashtable_t *script_profile_entry_for_function = NULL; /* body op or native to its function */
+static ply_hashtable_t *script_profile_native_names = NULL;
+
+static script_profile_entry_t *script_profile_current_line = NULL;
+static double script_profile_line_start_time;
+static int script_profile_call_depth = 0;
+
+void script_profile_set_enabled (bool enabled)
+{
+        script_profile_enabled = enabled;
+}
+
+bool script_profile_is_enabled (void)
+{
+        return script_profile_enabled;
+}
+
+static void script_profile_setup (void)
+{
+        if (script_profile_entries) return;
+
+        script_profile_entries = ply_list_new ();
+        script_profile_entry_for_op = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                         ply_hashtable_direct_compare);
+        script_profile_entry_for_line = ply_hashtable_new (ply_hashtable_string_hash,
+                                                           ply_hashtable_string_compare);
+        script_profile_entry_for_function = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                               ply_hashtable_direct_compare);
+}
+
+static script_profile_entry_t *script_profile_entry_new (script_profile_entry_type_t type,
+                                                         char                       *label)
+{
+        script_profile_entry_t *entry = calloc (1, sizeof(script_profile_entry_t));
+
+        entry->type = type;
+        entry->label = label;
+        ply_list_append_data (script_profile_entries, entry);
+        return entry;
+}
+
+static char *script_profile_describe_location (void *element)
+{
+        script_debug_location_t *location = script_debug_lookup_element (element);
+        char *label;
+
+        if (location)
+                asprintf (&label, "%s:%d", location->name, location->line_index);
+        else
+                label = strdup ("unknown");
+        return label;
+}
+
+void script_profile_name_native (script_native_function_t native_function,
+                                 const char              *name)
+{
+        if (!script_profile_enabled) return;
+
+        if (script_profile_native_names == NULL)
+                script_profile_native_names = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                                 ply_hashtable_direct_compare);
+        if (ply_hashtable_lookup (script_profile_native_names, (void *) native_function))
+                return;
+        ply_hashtable_insert (script_profile_native_names, (void *) native_function, strdup (name));
+}
+
+static script_profile_entry_t *script_profile_get_line (script_op_t *op)
+{
+        script_profile_entry_t *entry;
+        char *label;
+
+        entry = ply_hashtable_lookup (script_profile_entry_for_op, op);
+        if (entry) return entry;
+
+        /* Statements sharing a line share its entry */
+        label = script_profile_describe_location (op);
+        entry = ply_hashtable_lookup (script_profile_entry_for_line, label);
+        if (entry) {
+                free (label);
+        } else {
+                entry = script_profile_entry_new (SCRIPT_PROFILE_ENTRY_TYPE_LINE, label);
+                ply_hashtable_insert (script_profile_entry_for_line, entry->label, entry);
+        }
+        ply_hashtable_insert (script_profile_entry_for_op, op, entry);
+        return entry;
+}
+
+static script_profile_entry_t *script_profile_get_function (script_function_t *function)
+{
+        script_profile_entry_t *entry;
+        void *key;
+        char *label, *where;
+
+        if (function->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                key = function->data.script;
+        else
+                key = (void *) function->data.native;
+
+        entry = ply_hashtable_lookup (script_profile_entry_for_function, key);
+        if (entry) return entry;
+
+        if (function->type == SCRIPT_FUNCTION_TYPE_SCRIPT) {
+                where = script_profile_describe_location (function->data.script);
+                asprintf (&label, "function at %s", where);
+                free (where);
+        } else {
+                const char *name = NULL;
+                if (script_profile_native_names)
+                        name = ply_hashtable_lookup (script_profile_native_names, key);
+                asprintf (&label, "native %s", name ? name : "function");
+        }
+
+        entry = script_profile_entry_new (SCRIPT_PROFILE_ENTRY_TYPE_FUNCTION, label);
+        ply_hashtable_insert (script_profile_entry_for_function, key, entry);
+        return entry;
+}
+
+static void script_profile_charge_current_line (double now)
+{
+        if (script_profile_current_line)
+                script_profile_current_line->seconds += now - script_profile_line_start_time;
+        script_profile_line_start_time = now;
+}
+
+void script_profile_enter_line (script_op_t *op)
+{
+        script_profile_setup ();
+        script_profile_charge_current_line (ply_get_timestamp ());
+        script_profile_current_line = script_profile_get_line (op);
+        script_profile_current_line->count++;
+}
+
+void script_profile_enter_call (script_profile_call_t *call)
+{
+        double now = ply_get_timestamp ();
+
+        script_profile_setup ();
+        script_profile_charge_current_line (now);
+        call->line = script_profile_current_line;
+        call->start_time = now;
+        script_profile_call_depth++;
+}
+
+void script_profile_leave_call (script_profile_call_t *call,
+                                script_function_t     *function)
+{
+        double now = ply_get_timestamp ();
+
+        script_profile_charge_current_line (now);
+        if (function) {
+                script_profile_entry_t *entry = script_profile_get_function (function);
+                entry->count++;
+                entry->seconds += now - call->start_time;
+        }
+
+        script_profile_current_line = call->line;
+        script_profile_call_depth--;
+}
+
+bool script_profile_is_running (void)
+{
+        return script_profile_call_depth > 0;
+}
+
+static int script_profile_compare_entries (const void *a,
+                                           const void *b)
+{
+        const script_profile_entry_t *entry_a = *(script_profile_entry_t *const *) a;
+        const script_profile_entry_t *entry_b = *(script_profile_entry_t *const *) b;
+
+        if (entry_a->type != entry_b->type)
+                return entry_a->type < entry_b->type ? -1 : 1;
+        if (entry_a->seconds != entry_b->seconds)
+                return entry_a->seconds > entry_b->seconds ? -1 : 1;
+        return strcmp (entry_a->label, entry_b->label);
+}
+
+static void script_profile_reset (void)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (script_profile_entries);
+             node;
+             node = ply_list_get_next_node (script_profile_entries, node)) {
+                script_profile_entry_t *entry = ply_list_node_get_data (node);
+                free (entry->label);
+                free (entry);
+        }
+        ply_list_free (script_profile_entries);
+        ply_hashtable_free (script_profile_entry_for_op);
+        ply_hashtable_free (script_profile_entry_for_line);
+        ply_hashtable_free (script_profile_entry_for_function);
+        script_profile_entries = NULL;
+        script_profile_current_line = NULL;
+        script_profile_call_depth = 0;
+}
+
+void script_profile_dump (const char *filename)
+{
+        script_profile_entry_t **entries;
+        ply_list_node_t *node;
+        FILE *file = NULL;
+        int count, index;
+
+        if (script_profile_entries == NULL) return;
+
+        if (filename) {
+                file = fopen (filename, "w");
+                if (file == NULL)
+                        ply_trace ("could not write script profile to %s: %m", filename);
+        }
+
+        count = ply_list_get_length (script_profile_entries);
+        entries = malloc (count * sizeof(script_profile_entry_t *));
+        index = 0;
+        for (node = ply_list_get_first_node (script_profile_entries);
+             node;
+             node = ply_list_get_next_node (script_profile_entries, node)) {
+                entries[index++] = ply_list_node_get_data (node);
+        }
+        qsort (entries, count, sizeof(script_profile_entry_t *), script_profile_compare_entries);
+
+        /* Functions include everything they call, lines only their own time */
+        for (index = 0; index < count; index++) {
+                const char *type = entries[index]->type == SCRIPT_PROFILE_ENTRY_TYPE_FUNCTION ? "calls" : "runs";
+
+                if (file)
+                        fprintf (file, "%12.3fms %10lu %-5s %s\n",
+                                 entries[index]->seconds * 1000.0,
+                                 entries[index]->count,
+                                 type,
+                                 entries[index]->label);
+                else
+                        ply_trace ("script profile: %.3fms %lu %s %s",
+                                   entries[index]->seconds * 1000.0,
+                                   entries[index]->count,
+                                   type,
+                                   entries[index]->label);
+        }
+
+        free (entries);
+        if (file)
+                fclose (file);
+        script_profile_reset ();
+}
@@ -0,0 +1,63 @@
+/* script-profile.h - time spent in each script function and line
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_PROFILE_H
+#define SCRIPT_PROFILE_H
+
+#include <stdbool.h>
+
+#include "script.h"
+
+/* When enabled, every script function call, native call and statement
+ * is timed.  Time spent on a line only counts while that line is the one
+ * running, so a call made from a line is charged to the function it
+ * calls, unless it is a native function, which has no lines of its own.
+ */
+typedef struct
+{
+        struct script_profile_entry_t *line;
+        double                         start_time;
+} script_profile_call_t;
+
+void script_profile_set_enabled (bool enabled);
+bool script_profile_is_enabled (void);
+
+/* Native functions have no location in a script, so they are reported
+ * under the name they were added with
+ */
+void script_profile_name_native (script_native_function_t native_function,
+                                 const char              *name);
+
+void script_profile_enter_line (script_op_t *op);
+
+/* Brackets every call to function, which is NULL for a script run from
+ * outside any function
+ */
+void script_profile_enter_call (script_profile_call_t *call);
+void script_profile_leave_call (script_profile_call_t *call,
+                                script_function_t     *function);
+bool script_profile_is_running (void);
+
+/* Writes what has been timed so far to filename, or to the debug log if
+ * filename is NULL, and starts again from nothing.  The ops that were
+ * timed must not have been freed yet.
+ */
+void script_profile_dump (const char *filename);
+
+#endif /* SCRIPT_PROFILE_H */
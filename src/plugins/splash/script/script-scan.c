@@ -30,7 +30,8 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
-#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "ply-bitarray.h"
 #include "script-scan.h"
@@ -41,9 +42,11 @@ static script_scan_t *script_scan_new (void)
 {
         unsigned char *chars;
         script_scan_t *scan = calloc (1, sizeof(script_scan_t));
+        int i;
 
-        scan->tokens = NULL;
-        scan->tokencount = 0;
+        for (i = 0; i < SCRIPT_SCAN_LOOKAHEAD; i++) {
+                scan->tokens[i].type = SCRIPT_SCAN_TOKEN_TYPE_EMPTY;
+        }
         scan->cur_char = '\0';
         scan->line_index = 1;           /* According to Nedit the first line is 1 but first column is 0 */
         scan->column_index = COLUMN_START_INDEX;
@@ -68,13 +71,33 @@ static script_scan_t *script_scan_new (void)
 
 script_scan_t *script_scan_file (const char *filename)
 {
+        struct stat file_info;
+        script_scan_t *scan;
+        void *data = NULL;
+        size_t size = 0;
         int fd = open (filename, O_RDONLY | O_CLOEXEC);
 
         if (fd < 0) return NULL;
-        script_scan_t *scan = script_scan_new ();
+        if (fstat (fd, &file_info) < 0) {
+                close (fd);
+                return NULL;
+        }
+        if (file_info.st_size > 0) {
+                size = file_info.st_size;
+                data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                        close (fd);
+                        return NULL;
+                }
+        }
+        close (fd);
+
+        scan = script_scan_new ();
         scan->name = strdup (filename);
-        scan->source.fd = fd;
-        scan->source_is_file = true;
+        scan->mapping = data;
+        scan->mapping_size = size;
+        scan->source = data;
+        scan->source_end = scan->source + size;
         script_scan_get_next_char (scan);
         return scan;
 }
@@ -85,8 +108,8 @@ script_scan_t *script_scan_string (const char *string,
         script_scan_t *scan = script_scan_new ();
 
         scan->name = strdup (name);
-        scan->source.string = string;
-        scan->source_is_file = false;
+        scan->source = string;
+        scan->source_end = string + strlen (string);
         script_scan_get_next_char (scan);
         return scan;
 }
@@ -115,15 +138,13 @@ void script_scan_free (script_scan_t *scan)
 {
         int i;
 
-        if (scan->source_is_file) close (scan->source.fd);
-        for (i = 0; i < scan->tokencount; i++) {
-                script_scan_token_clean (scan->tokens[i]);
-                free (scan->tokens[i]);
+        if (scan->mapping != NULL) munmap (scan->mapping, scan->mapping_size);
+        for (i = 0; i < SCRIPT_SCAN_LOOKAHEAD; i++) {
+                script_scan_token_clean (&scan->tokens[i]);
         }
         ply_bitarray_free (scan->identifier_1st_char);
         ply_bitarray_free (scan->identifier_nth_char);
         free (scan->name);
-        free (scan->tokens);
         free (scan);
 }
 
@@ -140,12 +161,11 @@ unsigned char script_scan_get_next_char (script_scan_t *scan)
         } else if (scan->cur_char != '\0') {
                 scan->column_index++;
         }
-        if (scan->source_is_file) {
-                int got = read (scan->source.fd, &scan->cur_char, 1);
-                if (!got) scan->cur_char = 0;          /* FIXME a better way of doing EOF etc */
+        if (scan->source < scan->source_end) {
+                scan->cur_char = *scan->source;
+                if (scan->cur_char) scan->source++;
         } else {
-                scan->cur_char = *scan->source.string;
-                if (scan->cur_char) scan->source.string++;
+                scan->cur_char = 0;
         }
         return scan->cur_char;
 }
@@ -340,42 +360,33 @@ void script_scan_read_next_token (script_scan_t       *scan,
         return;
 }
 
+/* The parser keeps pointers to the current token around, so tokens stay
+ * in their slots and get moved along when advancing instead */
 static script_scan_token_t *script_scan_peek_token (script_scan_t *scan,
                                                     int            n)
 {
-        int i;
+        assert (n >= 0 && n < SCRIPT_SCAN_LOOKAHEAD);
 
-        /* we're screwed long before we ever actually hit INT_MAX; but at least
-         * we shouldn't get ourselves stuck in an infinite loop. */
-        if (scan->tokencount <= n && n < INT_MAX) {
-                scan->tokens =
-                        realloc (scan->tokens, (n + 1) * sizeof(script_scan_token_t *));
-                for (i = scan->tokencount; i <= n; i++) {
-                        scan->tokens[i] = malloc (sizeof(script_scan_token_t));
-                        scan->tokens[i]->type = SCRIPT_SCAN_TOKEN_TYPE_EMPTY;
-                }
-                scan->tokencount = n + 1;
-        }
-        if (scan->tokens[n]->type == SCRIPT_SCAN_TOKEN_TYPE_EMPTY) {
-                if ((n > 0) && (scan->tokens[n - 1]->type == SCRIPT_SCAN_TOKEN_TYPE_EMPTY))
+        if (scan->tokens[n].type == SCRIPT_SCAN_TOKEN_TYPE_EMPTY) {
+                if ((n > 0) && (scan->tokens[n - 1].type == SCRIPT_SCAN_TOKEN_TYPE_EMPTY))
                         script_scan_peek_token (scan, n - 1);
                 do {
-                        script_scan_token_clean (scan->tokens[n]);
-                        script_scan_read_next_token (scan, scan->tokens[n]);       /* FIXME if skipping comments, add whitespace to next token */
-                } while (scan->tokens[n]->type == SCRIPT_SCAN_TOKEN_TYPE_COMMENT); /* FIXME optionally pass comments back */
+                        script_scan_token_clean (&scan->tokens[n]);
+                        script_scan_read_next_token (scan, &scan->tokens[n]);      /* FIXME if skipping comments, add whitespace to next token */
+                } while (scan->tokens[n].type == SCRIPT_SCAN_TOKEN_TYPE_COMMENT); /* FIXME optionally pass comments back */
         }
-        return scan->tokens[n];
+        return &scan->tokens[n];
 }
 
 script_scan_token_t *script_scan_get_next_token (script_scan_t *scan)
 {
         int i;
 
-        script_scan_token_clean (scan->tokens[0]);
-        for (i = 0; i < (scan->tokencount - 1); i++) {
-                *scan->tokens[i] = *scan->tokens[i + 1];
+        script_scan_token_clean (&scan->tokens[0]);
+        for (i = 0; i < (SCRIPT_SCAN_LOOKAHEAD - 1); i++) {
+                scan->tokens[i] = scan->tokens[i + 1];
         }
-        scan->tokens[(scan->tokencount - 1)]->type = SCRIPT_SCAN_TOKEN_TYPE_EMPTY;
+        scan->tokens[(SCRIPT_SCAN_LOOKAHEAD - 1)].type = SCRIPT_SCAN_TOKEN_TYPE_EMPTY;
         return script_scan_peek_token (scan, 0);
 }
 
@@ -53,22 +53,24 @@ typedef struct
         script_debug_location_t location;
 } script_scan_token_t;
 
+/* The current token and the one after it, which is as far as the parser
+ * ever peeks */
+#define SCRIPT_SCAN_LOOKAHEAD 2
+
 typedef struct
 {
-        union
-        {
-                int         fd;
-                const char *string;
-        } source;
+        /* Files get mapped, so both kinds of source are walked the same */
+        const char           *source;
+        const char           *source_end;
+        void                 *mapping;
+        size_t                mapping_size;
         char                 *name;
         unsigned char         cur_char;
         ply_bitarray_t       *identifier_1st_char;
         ply_bitarray_t       *identifier_nth_char;
-        int                   tokencount;
-        script_scan_token_t **tokens;
+        script_scan_token_t   tokens[SCRIPT_SCAN_LOOKAHEAD];
         int                   line_index;
         int                   column_index;
-        bool                  source_is_file;
 } script_scan_t;
 
 
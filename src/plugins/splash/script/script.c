@@ -39,6 +39,7 @@
 #include "script.h"
 #include "script-parse.h"
 #include "script-object.h"
+#include "script-profile.h"
 
 script_function_t *script_function_script_new (script_op_t *script,
                                                void        *user_data,
@@ -50,6 +51,7 @@ script_function_t *script_function_script_new (script_op_t *script,
         function->parameters = parameter_list;
         function->data.script = script;
         function->freeable = false;
+        function->idempotent = false;
         function->user_data = user_data;
         return function;
 }
@@ -64,6 +66,7 @@ script_function_t *script_function_native_new (script_native_function_t native_f
         function->parameters = parameter_list;
         function->data.native = native_function;
         function->freeable = true;
+        function->idempotent = false;
         function->user_data = user_data;
         return function;
 }
@@ -93,6 +96,32 @@ void script_add_native_function (script_obj_t            *hash,
         script_obj_t *obj = script_obj_new_function (function);
         script_obj_hash_add_element (hash, obj, name);
         script_obj_unref (obj);
+        script_profile_name_native (native_function, name);
+}
+
+static unsigned int script_idempotent_generation = 0;
+
+void script_set_native_function_idempotent (script_obj_t *hash,
+                                            const char   *name)
+{
+        script_obj_t *obj = script_obj_hash_peek_element (hash, name);
+        script_obj_t *function_obj;
+
+        if (!obj) return;
+        function_obj = script_obj_as_obj_type (obj, SCRIPT_OBJ_TYPE_FUNCTION);
+        if (function_obj && function_obj->data.function->type == SCRIPT_FUNCTION_TYPE_NATIVE)
+                function_obj->data.function->idempotent = true;
+        script_obj_unref (obj);
+}
+
+void script_forget_idempotent_results (void)
+{
+        script_idempotent_generation++;
+}
+
+unsigned int script_get_idempotent_generation (void)
+{
+        return script_idempotent_generation;
 }
 
 script_obj_native_class_t *script_obj_native_class_new (script_obj_function_t free_func,
@@ -71,6 +71,7 @@ typedef struct script_function_t
                 struct script_op_t      *script;
         } data;
         bool                   freeable;
+        bool                   idempotent; /* native that gives the same result for the same arguments */
 } script_function_t;
 
 typedef void (*script_obj_function_t)(struct script_obj_t *);
@@ -102,6 +103,17 @@ typedef enum
         SCRIPT_OBJ_TYPE_NATIVE,
 } script_obj_type_t;
 
+/* Elements of a hash whose keys are small whole numbers, as in
+ * stars[i], kept by number.  Numbers too far past the end to grow it to
+ * are kept as strings in the hash table, and counted here.
+ */
+typedef struct
+{
+        unsigned int         size;
+        unsigned int         number_of_indices_in_table;
+        struct script_obj_t *elements[];
+} script_obj_hash_array_t;
+
 typedef struct script_obj_t
 {
         script_obj_type_t type;
@@ -117,7 +129,11 @@ typedef struct script_obj_t
                         struct script_obj_t *obj_b;
                 } dual_obj;
                 script_function_t   *function;
-                ply_hashtable_t     *hash;
+                struct
+                {
+                        ply_hashtable_t         *table;
+                        script_obj_hash_array_t *array;
+                } hash;
                 script_obj_native_t  native;
         } data;
 } script_obj_t;
@@ -216,6 +232,7 @@ typedef struct script_op_t
                         struct script_op_t *op2;
                 } cond_op;
         } data;
+        struct script_code_t *code; /* set by script_compile */
 } script_op_t;
 
 typedef struct
@@ -245,6 +262,15 @@ void script_add_native_function (script_obj_t            *hash,
                                  void                    *user_data,
                                  const char              *first_arg,
                                  ...);
+/* Lets the results of calls to the named native function be remembered
+ * until script_forget_idempotent_results is next called.  Only for
+ * functions that depend on nothing but their arguments and on state that
+ * rarely changes, such as the size of the displays.
+ */
+void script_set_native_function_idempotent (script_obj_t *hash,
+                                            const char   *name);
+void script_forget_idempotent_results (void);
+unsigned int script_get_idempotent_generation (void);
 script_obj_native_class_t *script_obj_native_class_new (script_obj_function_t free_func,
                                                         const char           *name,
                                                         void                 *user_data);
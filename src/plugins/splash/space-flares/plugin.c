@@ -45,6 +45,7 @@
 #include "ply-buffer.h"
 #include "ply-entry.h"
 #include "ply-event-loop.h"
+#include "ply-frame-clock.h"
 #include "ply-key-file.h"
 #include "ply-label.h"
 #include "ply-list.h"
@@ -65,6 +66,8 @@
 #define FLARE_LINE_COUNT 20
 #define HALO_BLUR 4
 #define STAR_HZ 0.08
+#define SINE_TABLE_SIZE 1024 /* a power of two */
+#define FLARE_THETA_STEP 0.05
 
 /*you can comment one or both of these out*/
 /*#define SHOW_PLANETS */
@@ -151,11 +154,15 @@ typedef struct
 
 typedef struct
 {
-        int  star_count;
-        int *star_x;
-        int *star_y;
-        int *star_refresh;
-        int  frame_count;
+        int       star_count;
+        int      *star_x;
+        int      *star_y;
+        int      *star_refresh;
+        int       frame_count;
+
+        /* What each star's twinkle doesn't change, worked out up front */
+        uint32_t *star_colour;
+        float    *star_phase;
 } star_bg_t;
 
 typedef struct
@@ -622,6 +629,8 @@ free_sprite (sprite_t *sprite)
                         free (star_bg->star_x);
                         free (star_bg->star_y);
                         free (star_bg->star_refresh);
+                        free (star_bg->star_colour);
+                        free (star_bg->star_phase);
                         break;
                 }
                 }
@@ -647,13 +656,25 @@ stretch_image (ply_image_t *scaled_image, ply_image_t *orig_image, int width)
         int x, y;
         int stretched_width = ply_image_get_width (scaled_image);
         int stretched_height = ply_image_get_height (scaled_image);
-        int orig_width = ply_image_get_width (orig_image);
         uint32_t *scaled_image_data = ply_image_get_data (scaled_image);
-        uint32_t *orig_image_data = ply_image_get_data (orig_image);
+        ply_pixel_buffer_t *resized_buffer;
+        uint32_t *resized_data;
 
+        if (width <= 0) {
+                memset (scaled_image_data, 0, stretched_width * stretched_height * sizeof(uint32_t));
+                return;
+        }
+
+        /* filtered rather than picking the nearest pixel, so the bar
+         * doesn't shimmer as it grows */
+        resized_buffer = ply_pixel_buffer_resize (ply_image_get_buffer (orig_image),
+                                                  width, stretched_height);
+        resized_data = ply_pixel_buffer_get_argb32_data (resized_buffer);
 
         for (y = 0; y < stretched_height; y++) {
                 float my_width = y + 0.5;
+                int visible_width;
+
                 my_width /= (stretched_height);
                 my_width *= 2;
                 my_width -= 1;
@@ -662,17 +683,17 @@ stretch_image (ply_image_t *scaled_image, ply_image_t *orig_image, int width)
                 my_width *= stretched_height;
                 my_width /= 2;
                 my_width = width + my_width;
-                for (x = 0; x < stretched_width; x++) {
-                        if (x < my_width) {
-                                uint32_t value = 0x0;
-                                int new_x = (x * orig_width) / width;
-                                value = orig_image_data[new_x + y * orig_width];
-                                scaled_image_data[x + y * stretched_width] = value;
-                        } else {
-                                scaled_image_data[x + y * stretched_width] = 0;
-                        }
+
+                visible_width = MAX (0, MIN ((int) ceilf (my_width), MIN (width, stretched_width)));
+                memcpy (scaled_image_data + y * stretched_width,
+                        resized_data + y * width,
+                        visible_width * sizeof(uint32_t));
+                for (x = visible_width; x < stretched_width; x++) {
+                        scaled_image_data[x + y * stretched_width] = 0;
                 }
         }
+
+        ply_pixel_buffer_free (resized_buffer);
 }
 
 static void
@@ -743,12 +764,80 @@ star_bg_gradient_colour (int x, int y, int width, int height, bool star, float t
 
 
 
+static float sine_table[SINE_TABLE_SIZE];
+
+static void
+sine_table_init (void)
+{
+        static bool is_initialized = false;
+        int i;
+
+        if (is_initialized)
+                return;
+
+        for (i = 0; i < SINE_TABLE_SIZE; i++) {
+                sine_table[i] = sin (i * (2 * M_PI / SINE_TABLE_SIZE));
+        }
+        is_initialized = true;
+}
+
+/* Good to about a third of a degree, which is plenty for a twinkle */
+static inline float
+table_sin (float angle)
+{
+        int index = (int) (angle * (SINE_TABLE_SIZE / (2 * M_PI)));
+
+        return sine_table[index & (SINE_TABLE_SIZE - 1)];
+}
+
+/* The part of star_bg_gradient_colour () that changes from frame to
+ * frame, in fixed point, on top of the colour and phase kept per star
+ */
+static inline uint32_t
+star_bg_twinkle_colour (star_bg_t *star_bg,
+                        int        star,
+                        float      time)
+{
+        uint32_t colour = star_bg->star_colour[star];
+        uint32_t r = (colour >> 16) & 0xff;
+        uint32_t g = (colour >> 8) & 0xff;
+        uint32_t b = colour & 0xff;
+        float val;
+        uint32_t weight;
+
+        val = (table_sin (star_bg->star_phase[star] - time * (2 * M_PI) * STAR_HZ) + 1) / 2;
+        weight = val * 0.3 * 256;
+
+        r = (r * (256 - weight) + 0xff * weight) >> 8;
+        g = (g * (256 - weight) + 0xff * weight) >> 8;
+        b = (b * (256 - weight) + 0xff * weight) >> 8;
+
+        return 0xff000000 | r << 16 | g << 8 | b;
+}
+
+static void
+star_bg_set_star (star_bg_t *star_bg,
+                  int        star,
+                  int        x,
+                  int        y,
+                  int        width,
+                  int        height)
+{
+        int star_x = x - (width + 720 - 800);
+        int star_y = y - (height + 300 - 480);
+
+        star_bg->star_x[star] = x;
+        star_bg->star_y[star] = y;
+        star_bg->star_refresh[star] = 0;
+        star_bg->star_colour[star] = star_bg_gradient_colour (x, y, width, height, false, 0);
+        star_bg->star_phase[star] = sqrt (star_x * star_x + star_y * star_y) / 100 + atan2 (star_y, star_x) * 2;
+}
+
 static void
 star_bg_update (view_t *view, sprite_t *sprite, double time)
 {
         star_bg_t *star_bg = sprite->data;
         int width = ply_image_get_width (sprite->image);
-        int height = ply_image_get_height (sprite->image);
         uint32_t *image_data = ply_image_get_data (sprite->image);
         int i, x, y;
 
@@ -758,7 +847,7 @@ star_bg_update (view_t *view, sprite_t *sprite, double time)
         for (i = star_bg->frame_count; i < star_bg->star_count; i += FRAMES_PER_SECOND / BG_STARS_FRAMES_PER_SECOND) {
                 x = star_bg->star_x[i];
                 y = star_bg->star_y[i];
-                uint32_t pixel_colour = star_bg_gradient_colour (x, y, width, height, true, time);
+                uint32_t pixel_colour = star_bg_twinkle_colour (star_bg, i, time);
                 if (abs ((int)((image_data[x + y * width] >> 16) & 0xff) - (int)((pixel_colour >> 16) & 0xff)) > 8) {
                         image_data[x + y * width] = pixel_colour;
                         star_bg->star_refresh[i] = 1;
@@ -804,17 +893,20 @@ satellite_move (view_t *view, sprite_t *sprite, double time)
 
                 uint32_t *image_data = ply_image_get_data (satellite->image);
                 uint32_t *cresent_data = ply_image_get_data (satellite->image_altered);
+                float cos_offset = cos (angle_offset), sin_offset = sin (angle_offset);
+                float cos_cresent = cos (cresent_angle);
 
                 for (y = 0; y < height; y++) {
                         for (x = 0; x < width; x++) {
                                 float fx = x - (float) width / 2;
                                 float fy = y - (float) height / 2;
-                                float angle = atan2 (fy, fx) + angle_offset;
-                                float distance = sqrt (fy * fy + fx * fx);
-                                fx = cos (angle) * (distance / (width / 2));
-                                fy = sin (angle) * (distance / (height / 2));
+                                /* turning by angle_offset, without going through polar coordinates */
+                                float turned_x = fx * cos_offset - fy * sin_offset;
+                                float turned_y = fx * sin_offset + fy * cos_offset;
+                                fx = turned_x / (width / 2);
+                                fy = turned_y / (height / 2);
                                 float want_y = sqrt (1 - fx * fx);
-                                want_y *= -cos (cresent_angle);
+                                want_y *= -cos_cresent;
                                 if (fy < want_y) {
                                         cresent_data[x + y * width] = image_data[x + y * width];
                                 } else {
@@ -861,18 +953,22 @@ satellite_move (view_t *view, sprite_t *sprite, double time)
                 for (x = 1; x < width - 1; x++) {
                         image_data[x] = 0x0;
                 }
+
+                float scale = cos (M_PI * 0.4);
+                float turn = satellite->theta + (1 - plugin->progress) * 2000 / (satellite->distance);
+                float cos_turn = cos (turn), sin_turn = sin (turn);
+
                 for (y = 0; y < height; y++) {
                         for (x = 0; x < width; x++) {
-                                float scale = cos (M_PI * 0.4);
                                 float fx = x;
                                 float fy = y;
                                 fx -= (float) width / 2;
                                 fy -= (float) height / 2;
                                 fy /= scale;
-                                float angle = atan2 (fy, fx) - (satellite->theta + (1 - plugin->progress) * 2000 / (satellite->distance)) + M_PI / 2 * 0.0;
-                                float distance = sqrt (fy * fy + fx * fx);
-                                fx = cos (angle) * distance;
-                                fy = sin (angle) * distance;
+                                float turned_x = fx * cos_turn + fy * sin_turn;
+                                float turned_y = fy * cos_turn - fx * sin_turn;
+                                fx = turned_x;
+                                fy = turned_y;
                                 fx += (fy * fy * 2) / (satellite->distance);
                                 fx += (float) width / 2;
                                 fy += (float) height / 2;
@@ -907,6 +1003,28 @@ flare_reset (flare_t *flare, int index)
         flare->z_offset_strength[index] = 0.1;
 }
 
+static inline void
+rotation_get (double  angle,
+              double *cos_angle,
+              double *sin_angle)
+{
+        *cos_angle = cos (angle);
+        *sin_angle = sin (angle);
+}
+
+/* Moves cos and sin of an angle on to those of the angle plus a step */
+static inline void
+rotation_step (double *cos_angle,
+               double *sin_angle,
+               double  step_cos,
+               double  step_sin)
+{
+        double next_cos = *cos_angle * step_cos - *sin_angle * step_sin;
+
+        *sin_angle = *sin_angle * step_cos + *cos_angle * step_sin;
+        *cos_angle = next_cos;
+}
+
 static void
 flare_update (sprite_t *sprite, double time)
 {
@@ -932,6 +1050,9 @@ flare_update (sprite_t *sprite, double time)
         height = ply_image_get_height (new_image);
 
 
+        double theta_step_cos, theta_step_sin;
+        rotation_get (FLARE_THETA_STEP, &theta_step_cos, &theta_step_sin);
+
         int b;
         for (b = 0; b < FLARE_COUNT; b++) {
                 int flare_line;
@@ -942,78 +1063,105 @@ flare_update (sprite_t *sprite, double time)
                 if (flare->stretch[b] > 2 || flare->stretch[b] < 0.2)
                         flare_reset (flare, b);
                 for (flare_line = 0; flare_line < FLARE_LINE_COUNT; flare_line++) {
-                        double x, y, z;
-                        double angle, distance;
-                        float theta;
-                        for (theta = -M_PI + (0.05 * cos (flare->increase_speed[b] * 1000 + flare_line)); theta < M_PI; theta += 0.05) {
+                        double x, y, z, turned;
+                        double theta, cos_theta, sin_theta, cos_wobble, sin_wobble;
+                        double wobble_rate, wobble_step_cos, wobble_step_sin, z_factor;
+                        double cos_xy, sin_xy, cos_yz, sin_yz, cos_xz, sin_xz;
+
+                        /* Everything that only depends on the line is worked out
+                         * once.  Turning a point by an angle is a multiply by the
+                         * angle's cosine and sine, and the sines along the line
+                         * are stepped by turning the previous one a little, so
+                         * the loop below is all multiplies and adds.
+                         */
+                        wobble_rate = 4 * sin (b + flare_line * 5);
+                        z_factor = sin (b + flare_line * flare_line) * flare->z_offset_strength[b];
+                        rotation_get (flare->rotate_xy[b] + 0.02 * sin (b * flare_line), &cos_xy, &sin_xy);
+                        rotation_get (flare->rotate_yz[b] + 0.02 * sin (3 * b * flare_line), &cos_yz, &sin_yz);
+                        rotation_get (flare->rotate_xz[b] + 0.02 * sin (8 * b * flare_line), &cos_xz, &sin_xz);
+
+                        theta = -M_PI + (0.05 * cos (flare->increase_speed[b] * 1000 + flare_line));
+                        rotation_get (theta, &cos_theta, &sin_theta);
+                        rotation_get (wobble_rate * theta, &cos_wobble, &sin_wobble);
+                        rotation_get (wobble_rate * FLARE_THETA_STEP, &wobble_step_cos, &wobble_step_sin);
+
+                        for (; theta < M_PI; theta += FLARE_THETA_STEP) {
                                 int ix;
                                 int iy;
 
-                                x = (cos (theta) + 0.5) * flare->stretch[b] * 0.8;
-                                y = (sin (theta)) * flare->y_size[b];
-                                z = x * (sin (b + flare_line * flare_line)) * flare->z_offset_strength[b];
+                                x = (cos_theta + 0.5) * flare->stretch[b] * 0.8;
+                                y = sin_theta * flare->y_size[b];
+                                z = x * z_factor;
 
                                 float strength = 1.1 - (x / 2) + flare->increase_speed[b] * 3;
                                 x += 4.5;
-                                if ((x * x + y * y + z * z) < 25) continue;
 
-                                strength = CLAMP (strength, 0, 1);
-                                strength *= 32;
+                                if ((x * x + y * y + z * z) >= 25) {
+                                        strength = CLAMP (strength, 0, 1);
+                                        strength *= 32;
 
-                                x += 0.05 * sin (4 * theta * (sin (b + flare_line * 5)));
-                                y += 0.05 * cos (4 * theta * (sin (b + flare_line * 5)));
-                                z += 0.05 * sin (4 * theta * (sin (b + flare_line * 5)));
+                                        x += 0.05 * sin_wobble;
+                                        y += 0.05 * cos_wobble;
+                                        z += 0.05 * sin_wobble;
 
-                                distance = sqrt (x * x + y * y);
-                                angle = atan2 (y, x) + flare->rotate_xy[b] + 0.02 * sin (b * flare_line);
-                                x = distance * cos (angle);
-                                y = distance * sin (angle);
+                                        turned = x * cos_xy - y * sin_xy;
+                                        y = x * sin_xy + y * cos_xy;
+                                        x = turned;
 
-                                distance = sqrt (z * z + y * y);
-                                angle = atan2 (y, z) + flare->rotate_yz[b] + 0.02 * sin (3 * b * flare_line);
-                                z = distance * cos (angle);
-                                y = distance * sin (angle);
+                                        turned = z * cos_yz - y * sin_yz;
+                                        y = z * sin_yz + y * cos_yz;
+                                        z = turned;
 
-                                distance = sqrt (x * x + z * z);
-                                angle = atan2 (z, x) + flare->rotate_xz[b] + 0.02 * sin (8 * b * flare_line);
-                                x = distance * cos (angle);
-                                z = distance * sin (angle);
+                                        turned = x * cos_xz - z * sin_xz;
+                                        z = x * sin_xz + z * cos_xz;
+                                        x = turned;
 
+                                        x *= 41;
+                                        y *= 41;
 
-                                x *= 41;
-                                y *= 41;
+                                        x += 720 - 800 + width;
+                                        y += 300 - 480 + height;
 
-                                x += 720 - 800 + width;
-                                y += 300 - 480 + height;
-
-                                ix = x;
-                                iy = y;
-                                if (ix >= (width - 1) || iy >= (height - 1) || ix <= 0 || iy <= 0) continue;
+                                        ix = x;
+                                        iy = y;
+                                        if (ix < (width - 1) && iy < (height - 1) && ix > 0 && iy > 0) {
+                                                uint32_t colour = MIN (strength + (old_image_data[ix + iy * width] >> 24), 255);
+                                                colour <<= 24;
+                                                old_image_data[ix + iy * width] = colour;
+                                        }
+                                }
 
-                                uint32_t colour = MIN (strength + (old_image_data[ix + iy * width] >> 24), 255);
-                                colour <<= 24;
-                                old_image_data[ix + iy * width] = colour;
+                                rotation_step (&cos_theta, &sin_theta, theta_step_cos, theta_step_sin);
+                                rotation_step (&cos_wobble, &sin_wobble, wobble_step_cos, wobble_step_sin);
                         }
                 }
         }
 
+        /* The blur works on one row of alpha values at a time, with no
+         * branches, so the compiler can vectorize it
+         */
         {
                 int x, y;
                 for (y = 1; y < (height - 1); y++) {
+                        const uint32_t *above = old_image_data + (y - 1) * width;
+                        const uint32_t *row = old_image_data + y * width;
+                        const uint32_t *below = old_image_data + (y + 1) * width;
+                        uint32_t *out = new_image_data + y * width;
+
                         for (x = 1; x < (width - 1); x++) {
                                 uint32_t value = 0;
-                                value += (old_image_data[(x - 1) + (y - 1) * width] >> 24) * 1;
-                                value += (old_image_data[x + (y - 1) * width] >> 24) * 2;
-                                value += (old_image_data[(x + 1) + (y - 1) * width] >> 24) * 1;
-                                value += (old_image_data[(x - 1) + y * width] >> 24) * 2;
-                                value += (old_image_data[x + y * width] >> 24) * 8;
-                                value += (old_image_data[(x + 1) + y * width] >> 24) * 2;
-                                value += (old_image_data[(x - 1) + (y + 1) * width] >> 24) * 1;
-                                value += (old_image_data[x + (y + 1) * width] >> 24) * 2;
-                                value += (old_image_data[(x + 1) + (y + 1) * width] >> 24) * 1;
-                                value /= 21;
-                                value = (value << 24) | ((int) (value * 0.7) << 16) | (value << 8) | (value << 0);
-                                new_image_data[x + y * width] = value;
+                                value += (above[x - 1] >> 24) * 1;
+                                value += (above[x] >> 24) * 2;
+                                value += (above[x + 1] >> 24) * 1;
+                                value += (row[x - 1] >> 24) * 2;
+                                value += (row[x] >> 24) * 8;
+                                value += (row[x + 1] >> 24) * 2;
+                                value += (below[x - 1] >> 24) * 1;
+                                value += (below[x] >> 24) * 2;
+                                value += (below[x + 1] >> 24) * 1;
+                                /* value / 21, as a multiply and shift */
+                                value = (value * 3121) >> 16;
+                                out[x] = (value << 24) | ((value * 7 / 10) << 16) | (value << 8) | (value << 0);
                         }
                 }
         }
@@ -1053,6 +1201,7 @@ view_animate_attime (view_t *view, double time)
 {
         ply_list_node_t *node;
         ply_boot_splash_plugin_t *plugin;
+        bool depth_changed = false;
 
         plugin = view->plugin;
 
@@ -1063,10 +1212,15 @@ view_animate_attime (view_t *view, double time)
         while (node) {
                 sprite_t *sprite = ply_list_node_get_data (node);
                 sprite_move (view, sprite, time);
+                if (sprite->z != sprite->oldz)
+                        depth_changed = true;
                 node = ply_list_get_next_node (view->sprites, node);
         }
 
-        sprite_list_sort (view);
+        /* The list stays sorted from frame to frame until something moves
+         * in or out of the screen */
+        if (depth_changed)
+                sprite_list_sort (view);
 
         for (node = ply_list_get_first_node (view->sprites); node; node = ply_list_get_next_node (view->sprites, node)) {
                 sprite_t *sprite = ply_list_node_get_data (node);
@@ -1115,13 +1269,12 @@ view_animate_attime (view_t *view, double time)
 }
 
 static void
-on_timeout (ply_boot_splash_plugin_t *plugin)
+on_frame (ply_boot_splash_plugin_t *plugin)
 {
         ply_list_node_t *node;
-        double sleep_time;
         double now;
 
-        now = ply_get_timestamp ();
+        now = ply_event_loop_get_frame_time (ply_event_loop_get_default ());
 
         node = ply_list_get_first_node (plugin->views);
 
@@ -1137,13 +1290,6 @@ on_timeout (ply_boot_splash_plugin_t *plugin)
                 node = next_node;
         }
         plugin->now = now;
-
-        sleep_time = 1.0 / FRAMES_PER_SECOND;
-
-        ply_event_loop_watch_for_timeout (plugin->loop,
-                                          sleep_time,
-                                          (ply_event_loop_timeout_handler_t)
-                                          on_timeout, plugin);
 }
 
 static void
@@ -1177,7 +1323,11 @@ start_animation (ply_boot_splash_plugin_t *plugin)
                 node = next_node;
         }
 
-        on_timeout (plugin);
+        on_frame (plugin);
+        ply_frame_clock_watch_for_frames (ply_frame_clock_get_default (),
+                                          FRAMES_PER_SECOND,
+                                          (ply_frame_clock_handler_t)
+                                          on_frame, plugin);
 
         plugin->is_animating = true;
 }
@@ -1209,11 +1359,9 @@ stop_animation (ply_boot_splash_plugin_t *plugin)
 
         plugin->is_animating = false;
 
-        if (plugin->loop != NULL) {
-                ply_event_loop_stop_watching_for_timeout (plugin->loop,
-                                                          (ply_event_loop_timeout_handler_t)
-                                                          on_timeout, plugin);
-        }
+        ply_frame_clock_stop_watching_for_frames (ply_frame_clock_get_default (),
+                                                  (ply_frame_clock_handler_t)
+                                                  on_frame, plugin);
 
 #ifdef  SHOW_LOGO_HALO
         ply_image_free (plugin->highlight_logo_image);
@@ -1268,12 +1416,17 @@ on_draw (view_t             *view,
             plugin->state == PLY_BOOT_SPLASH_DISPLAY_PASSWORD_ENTRY) {
                 uint32_t *box_data, *lock_data;
 
-                draw_background (view, pixel_buffer, x, y, width, height);
+                /* A bullet being typed or erased only touches the entry,
+                 * and the entry paints over everything under it
+                 */
+                if (!ply_entry_is_covering_area (view->entry, x, y, width, height)) {
+                        draw_background (view, pixel_buffer, x, y, width, height);
 
-                box_data = ply_image_get_data (plugin->box_image);
-                ply_pixel_buffer_fill_with_argb32_data (pixel_buffer,
-                                                        &view->box_area,
-                                                        box_data);
+                        box_data = ply_image_get_data (plugin->box_image);
+                        ply_pixel_buffer_fill_with_argb32_data (pixel_buffer,
+                                                                &view->box_area,
+                                                                box_data);
+                }
                 ply_entry_draw_area (view->entry, pixel_buffer, x, y, width, height);
                 ply_label_draw_area (view->label, pixel_buffer, x, y, width, height);
                 lock_data = ply_image_get_data (plugin->lock_image);
@@ -1448,7 +1601,10 @@ view_setup_scene (view_t *view)
                 star_bg->star_x = malloc (sizeof(int) * star_bg->star_count);
                 star_bg->star_y = malloc (sizeof(int) * star_bg->star_count);
                 star_bg->star_refresh = malloc (sizeof(int) * star_bg->star_count);
+                star_bg->star_colour = malloc (sizeof(uint32_t) * star_bg->star_count);
+                star_bg->star_phase = malloc (sizeof(float) * star_bg->star_count);
                 star_bg->frame_count = 0;
+                sine_table_init ();
                 sprite = add_sprite (view, view->scaled_background_image, SPRITE_TYPE_STAR_BG, star_bg);
                 sprite->z = -10000;
 
@@ -1464,9 +1620,7 @@ view_setup_scene (view_t *view)
                                 x = rand () % screen_width;
                                 y = rand () % screen_height;
                         } while (image_data[x + y * screen_width] == 0xFFFFFFFF);
-                        star_bg->star_refresh[i] = 0;
-                        star_bg->star_x[i] = x;
-                        star_bg->star_y[i] = y;
+                        star_bg_set_star (star_bg, i, x, y, screen_width, screen_height);
                         image_data[x + y * screen_width] = 0xFFFFFFFF;
                 }
                 for (i = 0; i < (int) (screen_width * screen_height) / 400; i++) {
@@ -1477,7 +1631,7 @@ view_setup_scene (view_t *view)
 
                 for (i = 0; i < star_bg->star_count; i++) {
                         image_data[star_bg->star_x[i] + star_bg->star_y[i] * screen_width] =
-                                star_bg_gradient_colour (star_bg->star_x[i], star_bg->star_y[i], screen_width, screen_height, true, 0.0);
+                                star_bg_twinkle_colour (star_bg, i, 0.0);
                 }
         }
 
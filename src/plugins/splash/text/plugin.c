@@ -452,6 +452,9 @@ on_draw (view_t         *view,
          int             height)
 {
         ply_text_display_clear_screen (view->display);
+
+        /* the bar only draws what changed, and all of it just went */
+        ply_text_step_bar_redraw (view->step_bar);
 }
 
 static void
@@ -458,6 +458,9 @@ on_draw (view_t         *view,
          int             height)
 {
         ply_text_display_clear_screen (view->display);
+
+        /* the bar only draws what changed, and all of it just went */
+        ply_text_progress_bar_redraw (view->progress_bar);
 }
 
 static void
@@ -113,8 +113,34 @@ typedef struct
         ply_trigger_t            *end_trigger;
         ply_pixel_buffer_t       *background_buffer;
         int                       animation_bottom;
+
+        /* The background with the watermark over it, made when first
+         * needed and again when the mode or prompt turns it black or back */
+        ply_pixel_buffer_t       *background_layer;
+        bool                      background_layer_is_valid;
+        bool                      background_layer_is_black;
+
+        /* Set when the background is what the firmware left on the screen,
+         * and the screen still shows it */
+        bool                      background_is_firmware_framebuffer;
+        bool                      firmware_background_is_on_screen;
+
+        bool                      is_loaded;
 } view_t;
 
+/* A background made for one display, kept for the other displays with
+ * the same size, scale and rotation instead of making it again
+ */
+typedef struct
+{
+        char                       *name;
+        unsigned long               width, height;
+        int                         scale;
+        ply_pixel_buffer_rotation_t rotation;
+        ply_pixel_buffer_t         *buffer;
+        int                         reference_count;
+} shared_buffer_t;
+
 typedef struct
 {
         bool                      suppress_messages;
@@ -142,6 +168,7 @@ struct _ply_boot_splash_plugin
         ply_image_t                        *background_bgrt_fallback_image;
         ply_image_t                        *watermark_image;
         ply_list_t                         *views;
+        ply_list_t                         *shared_buffers;
 
         ply_boot_splash_display_type_t      state;
 
@@ -176,6 +203,11 @@ struct _ply_boot_splash_plugin
 
         progress_function_t                 progress_function;
 
+        /* 0 keeps every animation frame decoded */
+        long                                max_resident_frames;
+        uint32_t                            prescale_frames : 1;
+        uint32_t                            stream_end_animation : 1;
+
         ply_trigger_t                      *idle_trigger;
         ply_trigger_t                      *stop_trigger;
 
@@ -185,6 +217,8 @@ struct _ply_boot_splash_plugin
         uint32_t                            is_idle : 1;
         uint32_t                            use_firmware_background : 1;
         uint32_t                            dialog_clears_firmware_background : 1;
+        uint32_t                            reuse_firmware_framebuffer : 1;
+        uint32_t                            bgrt_images_are_loaded : 1;
         uint32_t                            message_below_animation : 1;
 };
 
@@ -197,6 +231,130 @@ static void display_message (ply_boot_splash_plugin_t *plugin,
 static void become_idle (ply_boot_splash_plugin_t *plugin,
                          ply_trigger_t            *idle_trigger);
 static void view_show_message (view_t *view, const char *message);
+static void view_update_background_layer (view_t *view);
+
+static void
+view_get_buffer_key (view_t                      *view,
+                     unsigned long               *width,
+                     unsigned long               *height,
+                     int                         *scale,
+                     ply_pixel_buffer_rotation_t *rotation)
+{
+        ply_pixel_buffer_t *buffer;
+
+        buffer = ply_renderer_get_buffer_for_head (ply_pixel_display_get_renderer (view->display),
+                                                   ply_pixel_display_get_renderer_head (view->display));
+
+        *width = ply_pixel_display_get_width (view->display);
+        *height = ply_pixel_display_get_height (view->display);
+        *scale = ply_pixel_buffer_get_device_scale (buffer);
+        *rotation = ply_pixel_buffer_get_device_rotation (buffer);
+}
+
+/* Returns a new reference to the buffer another view made under this
+ * name, or NULL if none has yet
+ */
+static ply_pixel_buffer_t *
+view_find_shared_buffer (view_t     *view,
+                         const char *name)
+{
+        ply_list_t *shared_buffers = view->plugin->shared_buffers;
+        ply_pixel_buffer_rotation_t rotation;
+        unsigned long width, height;
+        ply_list_node_t *node;
+        int scale;
+
+        view_get_buffer_key (view, &width, &height, &scale, &rotation);
+
+        for (node = ply_list_get_first_node (shared_buffers);
+             node != NULL;
+             node = ply_list_get_next_node (shared_buffers, node)) {
+                shared_buffer_t *shared_buffer = ply_list_node_get_data (node);
+
+                if (strcmp (shared_buffer->name, name) != 0 ||
+                    shared_buffer->width != width ||
+                    shared_buffer->height != height ||
+                    shared_buffer->scale != scale ||
+                    shared_buffer->rotation != rotation)
+                        continue;
+
+                ply_trace ("reusing %s made for another %lux%lu display", name, width, height);
+                shared_buffer->reference_count++;
+                return ply_pixel_buffer_ref (shared_buffer->buffer);
+        }
+
+        return NULL;
+}
+
+/* Offers a buffer the view just made to the views that come after it */
+static void
+view_share_buffer (view_t             *view,
+                   const char         *name,
+                   ply_pixel_buffer_t *buffer)
+{
+        shared_buffer_t *shared_buffer;
+
+        shared_buffer = calloc (1, sizeof(shared_buffer_t));
+        shared_buffer->name = strdup (name);
+        view_get_buffer_key (view,
+                             &shared_buffer->width,
+                             &shared_buffer->height,
+                             &shared_buffer->scale,
+                             &shared_buffer->rotation);
+        shared_buffer->buffer = buffer;
+        shared_buffer->reference_count = 1;
+
+        ply_list_append_data (view->plugin->shared_buffers, shared_buffer);
+}
+
+static void
+view_release_buffer (view_t             *view,
+                     ply_pixel_buffer_t *buffer)
+{
+        ply_list_t *shared_buffers = view->plugin->shared_buffers;
+        ply_list_node_t *node;
+
+        if (buffer == NULL)
+                return;
+
+        for (node = ply_list_get_first_node (shared_buffers);
+             node != NULL;
+             node = ply_list_get_next_node (shared_buffers, node)) {
+                shared_buffer_t *shared_buffer = ply_list_node_get_data (node);
+
+                if (shared_buffer->buffer != buffer)
+                        continue;
+
+                if (--shared_buffer->reference_count == 0) {
+                        free (shared_buffer->name);
+                        free (shared_buffer);
+                        ply_list_remove_node (shared_buffers, node);
+                }
+                break;
+        }
+
+        ply_pixel_buffer_free (buffer);
+}
+
+/* Animation frames look the same on every display, so any view that got
+ * its own loaded can lend them out
+ */
+static view_t *
+view_find_other_loaded_view (view_t *view)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (view->plugin->views);
+             node != NULL;
+             node = ply_list_get_next_node (view->plugin->views, node)) {
+                view_t *other_view = ply_list_node_get_data (node);
+
+                if (other_view != view && other_view->is_loaded)
+                        return other_view;
+        }
+
+        return NULL;
+}
 
 static view_t *
 view_new (ply_boot_splash_plugin_t *plugin,
@@ -224,6 +382,10 @@ view_new (ply_boot_splash_plugin_t *plugin,
 
         view->throbber = ply_throbber_new (plugin->animation_dir,
                                            "throbber-");
+        ply_throbber_set_maximum_resident_frames (view->throbber,
+                                                  plugin->max_resident_frames);
+        ply_throbber_set_prescale_frames (view->throbber,
+                                          plugin->prescale_frames);
 
         view->label = ply_label_new ();
         ply_label_set_font (view->label, plugin->font);
@@ -255,8 +417,8 @@ view_free (view_t *view)
         ply_label_free (view->title_label);
         ply_label_free (view->subtitle_label);
 
-        if (view->background_buffer != NULL)
-                ply_pixel_buffer_free (view->background_buffer);
+        view_release_buffer (view, view->background_buffer);
+        view_release_buffer (view, view->background_layer);
 
         free (view);
 }
@@ -267,9 +429,21 @@ view_load_end_animation (view_t *view)
         ply_boot_splash_plugin_t *plugin = view->plugin;
         const char *animation_prefix;
 
+        view_t *other_view;
+
         if (!plugin->mode_settings[plugin->mode].use_end_animation)
                 return;
 
+        other_view = view_find_other_loaded_view (view);
+        if (other_view != NULL && other_view->end_animation != NULL) {
+                ply_trace ("sharing animation frames with another view");
+                view->end_animation = ply_animation_new (plugin->animation_dir,
+                                                         "animation-");
+                ply_animation_share_frames (view->end_animation,
+                                            other_view->end_animation);
+                return;
+        }
+
         ply_trace ("loading animation");
 
         switch (plugin->mode) {
@@ -292,6 +466,12 @@ view_load_end_animation (view_t *view)
         ply_trace ("trying prefix: %s", animation_prefix);
         view->end_animation = ply_animation_new (plugin->animation_dir,
                                                  animation_prefix);
+        ply_animation_set_maximum_resident_frames (view->end_animation,
+                                                   plugin->max_resident_frames);
+        ply_animation_set_streaming (view->end_animation,
+                                     plugin->stream_end_animation);
+        ply_animation_set_prescale_frames (view->end_animation,
+                                           plugin->prescale_frames);
 
         if (ply_animation_load (view->end_animation))
                 return;
@@ -300,6 +480,12 @@ view_load_end_animation (view_t *view)
         ply_trace ("now trying more general prefix: animation-");
         view->end_animation = ply_animation_new (plugin->animation_dir,
                                                  "animation-");
+        ply_animation_set_maximum_resident_frames (view->end_animation,
+                                                   plugin->max_resident_frames);
+        ply_animation_set_streaming (view->end_animation,
+                                     plugin->stream_end_animation);
+        ply_animation_set_prescale_frames (view->end_animation,
+                                           plugin->prescale_frames);
         if (ply_animation_load (view->end_animation))
                 return;
         ply_animation_free (view->end_animation);
@@ -307,6 +493,12 @@ view_load_end_animation (view_t *view)
         ply_trace ("now trying old compat prefix: throbber-");
         view->end_animation = ply_animation_new (plugin->animation_dir,
                                                  "throbber-");
+        ply_animation_set_maximum_resident_frames (view->end_animation,
+                                                   plugin->max_resident_frames);
+        ply_animation_set_streaming (view->end_animation,
+                                     plugin->stream_end_animation);
+        ply_animation_set_prescale_frames (view->end_animation,
+                                           plugin->prescale_frames);
         if (ply_animation_load (view->end_animation)) {
                 /* files named throbber- are for end animation, so
                  * there's no throbber */
@@ -552,6 +744,8 @@ view_set_bgrt_background (view_t *view)
                    width, height, x_offset, y_offset, screen_width, screen_height);
 
         view->background_buffer = ply_pixel_buffer_new (screen_width * screen_scale, screen_height * screen_scale);
+
+        ply_pixel_buffer_set_owner (view->background_buffer, "background");
         ply_pixel_buffer_set_device_scale (view->background_buffer, screen_scale);
         ply_pixel_buffer_fill_with_hex_color (view->background_buffer, NULL, 0x000000);
         if (x_offset >= 0 && y_offset >= 0) {
@@ -580,18 +774,216 @@ view_set_bgrt_fallback_background (view_t *view)
         y_offset = screen_height * 382 / 1000 - height / 2;
 
         view->background_buffer = ply_pixel_buffer_new (screen_width * screen_scale, screen_height * screen_scale);
+
+        ply_pixel_buffer_set_owner (view->background_buffer, "background");
         ply_pixel_buffer_set_device_scale (view->background_buffer, screen_scale);
         ply_pixel_buffer_fill_with_hex_color (view->background_buffer, NULL, 0x000000);
         ply_pixel_buffer_fill_with_buffer (view->background_buffer, image_buffer, x_offset, y_offset);
 }
 
+static void
+load_bgrt_images (ply_boot_splash_plugin_t *plugin)
+{
+        if (plugin->bgrt_images_are_loaded)
+                return;
+
+        plugin->bgrt_images_are_loaded = true;
+
+        if (plugin->background_bgrt_image != NULL) {
+                ply_trace ("loading background bgrt image");
+                if (ply_image_load (plugin->background_bgrt_image)) {
+                        plugin->background_bgrt_raw_width = ply_image_get_width (plugin->background_bgrt_image);
+                        plugin->background_bgrt_raw_height = ply_image_get_height (plugin->background_bgrt_image);
+                } else {
+                        ply_image_free (plugin->background_bgrt_image);
+                        plugin->background_bgrt_image = NULL;
+                }
+        }
+
+        if (plugin->background_bgrt_fallback_image != NULL) {
+                ply_trace ("loading background bgrt fallback image");
+                if (!ply_image_load (plugin->background_bgrt_fallback_image)) {
+                        ply_image_free (plugin->background_bgrt_fallback_image);
+                        plugin->background_bgrt_fallback_image = NULL;
+                }
+        }
+}
+
+/* Takes what the firmware left on the screen as the background.  For a
+ * BGRT theme, that's the logo in the right spot already, and keeping it
+ * avoids a flash while taking over.
+ */
 static bool
-view_load (view_t *view)
+view_capture_firmware_background (view_t *view)
 {
+        ply_boot_splash_plugin_t *plugin = view->plugin;
+        ply_renderer_t *renderer;
+        ply_renderer_head_t *head;
+        ply_pixel_buffer_t *buffer;
+
+        if (view->background_is_firmware_framebuffer)
+                return true;
+
+        if (!plugin->reuse_firmware_framebuffer ||
+            plugin->background_bgrt_image == NULL ||
+            view->background_buffer != NULL)
+                return false;
+
+        /* Only at boot is the firmware's logo what's on the screen, and
+         * without quiet the console may have printed over it already */
+        if (plugin->mode != PLY_BOOT_SPLASH_MODE_BOOT_UP ||
+            !ply_kernel_command_line_has_argument ("quiet"))
+                return false;
+
+        renderer = ply_pixel_display_get_renderer (view->display);
+        head = ply_pixel_display_get_renderer_head (view->display);
+
+        if (!ply_renderer_capture_console_contents (renderer, head))
+                return false;
+
+        buffer = ply_renderer_get_buffer_for_head (renderer, head);
+        view->background_buffer = ply_pixel_buffer_duplicate (buffer);
+        ply_pixel_buffer_set_device_scale (view->background_buffer,
+                                           ply_pixel_buffer_get_device_scale (buffer));
+        view->background_is_firmware_framebuffer = true;
+        view->firmware_background_is_on_screen = true;
+
+        ply_trace ("using the firmware framebuffer as background");
+        return true;
+}
+
+static bool
+capture_firmware_backgrounds (ply_boot_splash_plugin_t *plugin)
+{
+        ply_list_node_t *node;
+        bool all_captured = false;
+
+        node = ply_list_get_first_node (plugin->views);
+        while (node != NULL) {
+                view_t *view = ply_list_node_get_data (node);
+
+                if (!view_capture_firmware_background (view))
+                        return false;
+
+                all_captured = true;
+                node = ply_list_get_next_node (plugin->views, node);
+        }
+
+        return all_captured;
+}
+
+/* Themes get loaded whole.  If that goes over the memory budget, the
+ * throbber frames get decoded as they come up instead and the end
+ * animation gets streamed, and if that still isn't enough, the end
+ * animation is left out.
+ */
+static void
+view_fit_in_memory_budget (view_t *view)
+{
+        ply_boot_splash_plugin_t *plugin = view->plugin;
+
+        ply_trace ("pixel buffers hold %zu bytes, budget is %zu bytes",
+                   ply_pixel_buffer_get_bytes_in_use (),
+                   ply_pixel_buffer_get_memory_budget ());
+
+        if (!ply_pixel_buffer_is_over_memory_budget ())
+                return;
+
+        if (plugin->max_resident_frames == 0) {
+                ply_trace ("over memory budget, decoding animation frames on demand");
+                plugin->max_resident_frames = 2;
+
+                /* The end animation plays once through, so it can be
+                 * streamed without holding up the event loop */
+                if (view->end_animation != NULL) {
+                        plugin->stream_end_animation = true;
+                        ply_animation_set_streaming (view->end_animation, true);
+                        if (!ply_animation_load (view->end_animation)) {
+                                ply_animation_free (view->end_animation);
+                                view->end_animation = NULL;
+                                plugin->mode_settings[plugin->mode].use_end_animation = false;
+                        }
+                }
+
+                if (view->throbber != NULL) {
+                        ply_throbber_set_maximum_resident_frames (view->throbber,
+                                                                  plugin->max_resident_frames);
+                        if (!ply_throbber_load (view->throbber)) {
+                                ply_throbber_free (view->throbber);
+                                view->throbber = NULL;
+                        }
+                }
+
+                if (!ply_pixel_buffer_is_over_memory_budget ())
+                        return;
+        }
+
+        if (view->end_animation != NULL) {
+                ply_trace ("still over memory budget, leaving out the end animation");
+                ply_animation_free (view->end_animation);
+                view->end_animation = NULL;
+                plugin->mode_settings[plugin->mode].use_end_animation = false;
+        }
+
+        if (ply_pixel_buffer_is_over_memory_budget ())
+                ply_trace ("theme needs %zu bytes, more than the memory budget",
+                           ply_pixel_buffer_get_bytes_in_use ());
+}
+
+static void
+view_show_titles (view_t *view)
+{
+        ply_boot_splash_plugin_t *plugin = view->plugin;
         unsigned long x, y, width, title_height = 0, subtitle_height = 0;
+        unsigned long screen_width, screen_height;
+
+        screen_width = ply_pixel_display_get_width (view->display);
+        screen_height = ply_pixel_display_get_height (view->display);
+
+        if (plugin->mode_settings[plugin->mode].title) {
+                ply_label_set_text (view->title_label,
+                                    _(plugin->mode_settings[plugin->mode].title));
+                title_height = ply_label_get_height (view->title_label);
+        } else {
+                ply_label_hide (view->title_label);
+        }
+
+        if (plugin->mode_settings[plugin->mode].subtitle) {
+                ply_label_set_text (view->subtitle_label,
+                                    _(plugin->mode_settings[plugin->mode].subtitle));
+                subtitle_height = ply_label_get_height (view->subtitle_label);
+        } else {
+                ply_label_hide (view->subtitle_label);
+        }
+
+        y = (screen_height - title_height - 2 * subtitle_height) * plugin->title_vertical_alignment;
+
+        if (plugin->mode_settings[plugin->mode].title) {
+                width = ply_label_get_width (view->title_label);
+                x = (screen_width - width) * plugin->title_horizontal_alignment;
+                ply_trace ("using %ldx%ld title centered at %ldx%ld for %ldx%ld screen",
+                           width, title_height, x, y, screen_width, screen_height);
+                ply_label_show (view->title_label, view->display, x, y);
+                /* Use subtitle_height pixels seperation between title and subtitle */
+                y += title_height + subtitle_height;
+        }
+
+        if (plugin->mode_settings[plugin->mode].subtitle) {
+                width = ply_label_get_width (view->subtitle_label);
+                x = (screen_width - width) * plugin->title_horizontal_alignment;
+                ply_trace ("using %ldx%ld subtitle centered at %ldx%ld for %ldx%ld screen",
+                           width, subtitle_height, x, y, screen_width, screen_height);
+                ply_label_show (view->subtitle_label, view->display, x, y);
+        }
+}
+
+static bool
+view_load (view_t *view)
+{
         unsigned long screen_width, screen_height, screen_scale;
         ply_boot_splash_plugin_t *plugin;
         ply_pixel_buffer_t *buffer;
+        view_t *other_view;
 
         plugin = view->plugin;
 
@@ -603,16 +995,27 @@ view_load (view_t *view)
                         ply_pixel_display_get_renderer_head (view->display));
         screen_scale = ply_pixel_buffer_get_device_scale (buffer);
 
-        view_set_bgrt_background (view);
+        if (!view_capture_firmware_background (view)) {
+                view->background_buffer = view_find_shared_buffer (view, "background");
 
-        if (!view->background_buffer && plugin->background_bgrt_fallback_image != NULL)
-                view_set_bgrt_fallback_background (view);
+                if (view->background_buffer == NULL) {
+                        load_bgrt_images (plugin);
+                        view_set_bgrt_background (view);
+
+                        if (!view->background_buffer && plugin->background_bgrt_fallback_image != NULL)
+                                view_set_bgrt_fallback_background (view);
+
+                        if (view->background_buffer != NULL)
+                                view_share_buffer (view, "background", view->background_buffer);
+                }
+        }
 
         if (!view->background_buffer && plugin->background_tile_image != NULL) {
                 ply_trace ("tiling background to %lux%lu", screen_width, screen_height);
 
                 /* Create a buffer at screen scale so that we only do the slow interpolating scale once */
                 view->background_buffer = ply_pixel_buffer_new (screen_width * screen_scale, screen_height * screen_scale);
+                ply_pixel_buffer_set_owner (view->background_buffer, "background");
                 ply_pixel_buffer_set_device_scale (view->background_buffer, screen_scale);
 
                 if (plugin->background_start_color != plugin->background_end_color)
@@ -626,6 +1029,8 @@ view_load (view_t *view)
                 buffer = ply_pixel_buffer_tile (ply_image_get_buffer (plugin->background_tile_image), screen_width, screen_height);
                 ply_pixel_buffer_fill_with_buffer (view->background_buffer, buffer, 0, 0);
                 ply_pixel_buffer_free (buffer);
+
+                view_share_buffer (view, "background", view->background_buffer);
         }
 
         if (plugin->watermark_image != NULL) {
@@ -659,7 +1064,11 @@ view_load (view_t *view)
                 ply_trace ("this theme has no progress animation");
         }
 
-        if (view->throbber != NULL) {
+        other_view = view_find_other_loaded_view (view);
+        if (view->throbber != NULL && other_view != NULL && other_view->throbber != NULL) {
+                ply_trace ("sharing throbber frames with another view");
+                ply_throbber_share_frames (view->throbber, other_view->throbber);
+        } else if (view->throbber != NULL) {
                 ply_trace ("loading throbber");
                 if (!ply_throbber_load (view->throbber)) {
                         ply_trace ("optional throbber was not loaded");
@@ -670,42 +1079,12 @@ view_load (view_t *view)
                 ply_trace ("this theme has no throbber\n");
         }
 
-        if (plugin->mode_settings[plugin->mode].title) {
-                ply_label_set_text (view->title_label,
-                                    _(plugin->mode_settings[plugin->mode].title));
-                title_height = ply_label_get_height (view->title_label);
-        } else {
-                ply_label_hide (view->title_label);
-        }
-
-        if (plugin->mode_settings[plugin->mode].subtitle) {
-                ply_label_set_text (view->subtitle_label,
-                                    _(plugin->mode_settings[plugin->mode].subtitle));
-                subtitle_height = ply_label_get_height (view->subtitle_label);
-        } else {
-                ply_label_hide (view->subtitle_label);
-        }
+        view_fit_in_memory_budget (view);
+        view_update_background_layer (view);
 
-        y = (screen_height - title_height - 2 * subtitle_height) * plugin->title_vertical_alignment;
-
-        if (plugin->mode_settings[plugin->mode].title) {
-                width = ply_label_get_width (view->title_label);
-                x = (screen_width - width) * plugin->title_horizontal_alignment;
-                ply_trace ("using %ldx%ld title centered at %ldx%ld for %ldx%ld screen",
-                           width, title_height, x, y, screen_width, screen_height);
-                ply_label_show (view->title_label, view->display, x, y);
-                /* Use subtitle_height pixels seperation between title and subtitle */
-                y += title_height + subtitle_height;
-        }
-
-        if (plugin->mode_settings[plugin->mode].subtitle) {
-                width = ply_label_get_width (view->subtitle_label);
-                x = (screen_width - width) * plugin->title_horizontal_alignment;
-                ply_trace ("using %ldx%ld subtitle centered at %ldx%ld for %ldx%ld screen",
-                           width, subtitle_height, x, y, screen_width, screen_height);
-                ply_label_show (view->subtitle_label, view->display, x, y);
-        }
+        view_show_titles (view);
 
+        view->is_loaded = true;
         return true;
 }
 
@@ -840,8 +1219,14 @@ view_start_progress_animation (view_t *view)
         screen_width = ply_pixel_display_get_width (view->display);
         screen_height = ply_pixel_display_get_height (view->display);
 
-        ply_pixel_display_draw_area (view->display, 0, 0,
-                                     screen_width, screen_height);
+        /* The firmware's framebuffer is still up, and there's nothing to
+         * put over it, so only the animations below need drawing */
+        if (!view->firmware_background_is_on_screen ||
+            plugin->watermark_image != NULL ||
+            !plugin->mode_settings[plugin->mode].use_firmware_background)
+                ply_pixel_display_draw_area (view->display, 0, 0,
+                                             screen_width, screen_height);
+        view->firmware_background_is_on_screen = false;
 
         if (plugin->mode_settings[plugin->mode].use_progress_bar) {
                 if (plugin->progress_bar_width != -1)
@@ -1189,9 +1574,32 @@ create_plugin (ply_key_file_t *key_file)
         plugin->dialog_clears_firmware_background =
                 ply_key_file_get_bool (key_file, "two-step", "DialogClearsFirmwareBackground");
 
+        plugin->reuse_firmware_framebuffer =
+                ply_key_file_get_bool (key_file, "two-step", "ReuseFirmwareFramebuffer");
+
         plugin->message_below_animation =
                 ply_key_file_get_bool (key_file, "two-step", "MessageBelowAnimation");
 
+        /* Themes with big or many frames can have them decoded as they
+         * come up instead of holding them all in memory
+         */
+        plugin->max_resident_frames =
+                ply_key_file_get_long (key_file, "two-step",
+                                       "MaxResidentFrames", 0);
+
+        /* On HiDPI displays, frames can be scaled up once and kept that
+         * way, for themes that can spare the memory
+         */
+        plugin->prescale_frames =
+                ply_key_file_get_bool (key_file, "two-step", "PrescaleFrames");
+
+        /* On machines really short of memory, the end animation can be
+         * played back from disk, with frames dropped if decoding them
+         * falls behind
+         */
+        plugin->stream_end_animation =
+                ply_key_file_get_bool (key_file, "two-step", "StreamEndAnimation");
+
         progress_function = ply_key_file_get_value (key_file, "two-step", "ProgressFunction");
 
         if (progress_function != NULL) {
@@ -1210,6 +1618,7 @@ create_plugin (ply_key_file_t *key_file)
         }
 
         plugin->views = ply_list_new ();
+        plugin->shared_buffers = ply_list_new ();
 
         return plugin;
 }
@@ -1291,6 +1700,7 @@ destroy_plugin (ply_boot_splash_plugin_t *plugin)
         free (plugin->title_font);
         free (plugin->animation_dir);
         free_views (plugin);
+        ply_list_free (plugin->shared_buffers);
         free (plugin);
 }
 
@@ -1419,34 +1829,20 @@ detach_from_event_loop (ply_boot_splash_plugin_t *plugin)
         plugin->loop = NULL;
 }
 
-static void
-draw_background (view_t             *view,
-                 ply_pixel_buffer_t *pixel_buffer,
-                 int                 x,
-                 int                 y,
-                 int                 width,
-                 int                 height)
+static bool
+view_uses_black_background (view_t *view)
 {
-        ply_boot_splash_plugin_t *plugin;
-        ply_rectangle_t area;
-        bool use_black_background = false;
+        ply_boot_splash_plugin_t *plugin = view->plugin;
         bool using_fw_background;
 
-        plugin = view->plugin;
-
         using_fw_background = (plugin->background_bgrt_image || plugin->background_bgrt_fallback_image);
 
-        area.x = x;
-        area.y = y;
-        area.width = width;
-        area.height = height;
-
         /* When using the firmware logo as background and we should not use
          * it for this mode, use solid black as background.
          */
         if (using_fw_background &&
             !plugin->mode_settings[plugin->mode].use_firmware_background)
-                use_black_background = true;
+                return true;
 
         /* When using the firmware logo as background, use solid black as
          * background for dialogs.
@@ -1454,18 +1850,29 @@ draw_background (view_t             *view,
         if ((plugin->state == PLY_BOOT_SPLASH_DISPLAY_QUESTION_ENTRY ||
              plugin->state == PLY_BOOT_SPLASH_DISPLAY_PASSWORD_ENTRY) &&
             using_fw_background && plugin->dialog_clears_firmware_background)
-                use_black_background = true;
+                return true;
+
+        return false;
+}
+
+static void
+composite_background (view_t             *view,
+                      ply_pixel_buffer_t *pixel_buffer,
+                      ply_rectangle_t    *area,
+                      bool                use_black_background)
+{
+        ply_boot_splash_plugin_t *plugin = view->plugin;
 
         if (use_black_background)
-                ply_pixel_buffer_fill_with_hex_color (pixel_buffer, &area, 0);
+                ply_pixel_buffer_fill_with_hex_color (pixel_buffer, area, 0);
         else if (view->background_buffer != NULL)
                 ply_pixel_buffer_fill_with_buffer (pixel_buffer, view->background_buffer, 0, 0);
         else if (plugin->background_start_color != plugin->background_end_color)
-                ply_pixel_buffer_fill_with_gradient (pixel_buffer, &area,
+                ply_pixel_buffer_fill_with_gradient (pixel_buffer, area,
                                                      plugin->background_start_color,
                                                      plugin->background_end_color);
         else
-                ply_pixel_buffer_fill_with_hex_color (pixel_buffer, &area,
+                ply_pixel_buffer_fill_with_hex_color (pixel_buffer, area,
                                                       plugin->background_start_color);
 
         if (plugin->watermark_image != NULL) {
@@ -1476,6 +1883,100 @@ draw_background (view_t             *view,
         }
 }
 
+/* Nothing under the animations changes while the mode and prompt stay the
+ * same, so when putting the background together takes more than one plain
+ * fill or copy, it's done once and every redraw copies the result.
+ */
+static void
+view_update_background_layer (view_t *view)
+{
+        ply_boot_splash_plugin_t *plugin = view->plugin;
+        unsigned long screen_width, screen_height, screen_scale;
+        ply_rectangle_t area;
+        ply_pixel_buffer_t *buffer;
+        const char *layer_name;
+        bool use_black_background;
+
+        use_black_background = view_uses_black_background (view);
+
+        if (view->background_layer_is_valid &&
+            view->background_layer_is_black == use_black_background)
+                return;
+
+        view_release_buffer (view, view->background_layer);
+        view->background_layer = NULL;
+        view->background_layer_is_valid = true;
+        view->background_layer_is_black = use_black_background;
+
+        if (plugin->watermark_image == NULL &&
+            (use_black_background || view->background_buffer != NULL ||
+             plugin->background_start_color == plugin->background_end_color))
+                return;
+
+        /* What the firmware left on one screen says nothing about another */
+        layer_name = use_black_background ? "black background layer" : "background layer";
+        if (!view->background_is_firmware_framebuffer) {
+                view->background_layer = view_find_shared_buffer (view, layer_name);
+                if (view->background_layer != NULL)
+                        return;
+        }
+
+        screen_width = ply_pixel_display_get_width (view->display);
+        screen_height = ply_pixel_display_get_height (view->display);
+        buffer = ply_renderer_get_buffer_for_head (ply_pixel_display_get_renderer (view->display),
+                                                   ply_pixel_display_get_renderer_head (view->display));
+        screen_scale = ply_pixel_buffer_get_device_scale (buffer);
+
+        view->background_layer = ply_pixel_buffer_new (screen_width * screen_scale, screen_height * screen_scale);
+        ply_pixel_buffer_set_owner (view->background_layer, "background layer");
+        ply_pixel_buffer_set_device_scale (view->background_layer, screen_scale);
+
+        /* The layer is only a shortcut, so it gives way to the animations */
+        if (ply_pixel_buffer_is_over_memory_budget ()) {
+                ply_trace ("no memory left to cache the composited background");
+                ply_pixel_buffer_free (view->background_layer);
+                view->background_layer = NULL;
+                return;
+        }
+
+        area.x = 0;
+        area.y = 0;
+        area.width = screen_width;
+        area.height = screen_height;
+
+        /* Starting out opaque lets redraws take the plain copy path */
+        ply_pixel_buffer_fill_with_hex_color (view->background_layer, NULL, 0x000000);
+        composite_background (view, view->background_layer, &area, use_black_background);
+
+        if (!view->background_is_firmware_framebuffer)
+                view_share_buffer (view, layer_name, view->background_layer);
+}
+
+static void
+draw_background (view_t             *view,
+                 ply_pixel_buffer_t *pixel_buffer,
+                 int                 x,
+                 int                 y,
+                 int                 width,
+                 int                 height)
+{
+        ply_rectangle_t area;
+
+        view_update_background_layer (view);
+
+        if (view->background_layer != NULL) {
+                ply_pixel_buffer_fill_with_buffer (pixel_buffer, view->background_layer, 0, 0);
+                return;
+        }
+
+        area.x = x;
+        area.y = y;
+        area.width = width;
+        area.height = height;
+
+        composite_background (view, pixel_buffer, &area, view->background_layer_is_black);
+}
+
 static void
 on_draw (view_t             *view,
          ply_pixel_buffer_t *pixel_buffer,
@@ -1487,18 +1988,28 @@ on_draw (view_t             *view,
         ply_boot_splash_plugin_t *plugin;
         ply_rectangle_t screen_area;
         ply_rectangle_t image_area;
+        bool is_prompt, entry_covers_area;
 
         plugin = view->plugin;
 
-        draw_background (view, pixel_buffer, x, y, width, height);
+        is_prompt = plugin->state == PLY_BOOT_SPLASH_DISPLAY_QUESTION_ENTRY ||
+                    plugin->state == PLY_BOOT_SPLASH_DISPLAY_PASSWORD_ENTRY;
+
+        /* A bullet being typed or erased only touches the entry, and
+         * the entry paints over everything under it
+         */
+        entry_covers_area = is_prompt &&
+                            ply_entry_is_covering_area (view->entry, x, y, width, height);
+
+        if (!entry_covers_area)
+                draw_background (view, pixel_buffer, x, y, width, height);
 
         ply_pixel_buffer_get_size (pixel_buffer, &screen_area);
 
-        if (plugin->state == PLY_BOOT_SPLASH_DISPLAY_QUESTION_ENTRY ||
-            plugin->state == PLY_BOOT_SPLASH_DISPLAY_PASSWORD_ENTRY) {
+        if (is_prompt) {
                 uint32_t *box_data, *lock_data;
 
-                if (plugin->box_image) {
+                if (plugin->box_image && !entry_covers_area) {
                         box_data = ply_image_get_data (plugin->box_image);
                         ply_pixel_buffer_fill_with_argb32_data (pixel_buffer,
                                                                 &view->box_area,
@@ -1686,24 +2197,10 @@ show_splash_screen (ply_boot_splash_plugin_t *plugin,
                 }
         }
 
-        if (plugin->background_bgrt_image != NULL) {
-                ply_trace ("loading background bgrt image");
-                if (ply_image_load (plugin->background_bgrt_image)) {
-                        plugin->background_bgrt_raw_width = ply_image_get_width (plugin->background_bgrt_image);
-                        plugin->background_bgrt_raw_height = ply_image_get_height (plugin->background_bgrt_image);
-                } else {
-                        ply_image_free (plugin->background_bgrt_image);
-                        plugin->background_bgrt_image = NULL;
-                }
-        }
-
-        if (plugin->background_bgrt_fallback_image != NULL) {
-                ply_trace ("loading background bgrt fallback image");
-                if (!ply_image_load (plugin->background_bgrt_fallback_image)) {
-                        ply_image_free (plugin->background_bgrt_fallback_image);
-                        plugin->background_bgrt_fallback_image = NULL;
-                }
-        }
+        /* If every screen still shows what the firmware left on it, the
+         * BGRT image doesn't need to be decoded at all */
+        if (!capture_firmware_backgrounds (plugin))
+                load_bgrt_images (plugin);
 
         if (plugin->watermark_image != NULL) {
                 ply_trace ("loading watermark image");
@@ -1730,6 +2227,74 @@ show_splash_screen (ply_boot_splash_plugin_t *plugin,
         return true;
 }
 
+static bool
+mode_is_shutdown (ply_boot_splash_mode_t mode)
+{
+        return mode == PLY_BOOT_SPLASH_MODE_SHUTDOWN ||
+               mode == PLY_BOOT_SPLASH_MODE_REBOOT;
+}
+
+/* Switches a splash that's already up over to another mode, keeping the
+ * images, views and backgrounds it has loaded.  Only the end animation
+ * gets loaded again, when the new mode has a different one.
+ */
+static bool
+change_mode (ply_boot_splash_plugin_t *plugin,
+             ply_boot_splash_mode_t    mode)
+{
+        ply_list_node_t *node;
+        bool end_animation_changes;
+        view_t *view;
+
+        assert (plugin != NULL);
+
+        if (!plugin->is_visible || plugin->loop == NULL)
+                return false;
+
+        /* the background for each view gets picked when it loads */
+        if (plugin->mode_settings[mode].use_firmware_background !=
+            plugin->mode_settings[plugin->mode].use_firmware_background)
+                return false;
+
+        ply_trace ("changing mode without reloading splash");
+
+        end_animation_changes = mode_is_shutdown (mode) != mode_is_shutdown (plugin->mode);
+
+        stop_animation (plugin);
+        plugin->mode = mode;
+
+        node = ply_list_get_first_node (plugin->views);
+        while (node != NULL) {
+                view = ply_list_node_get_data (node);
+
+                if (end_animation_changes && view->end_animation != NULL) {
+                        ply_animation_free (view->end_animation);
+                        view->end_animation = NULL;
+                }
+
+                node = ply_list_get_next_node (plugin->views, node);
+        }
+
+        node = ply_list_get_first_node (plugin->views);
+        while (node != NULL) {
+                view = ply_list_node_get_data (node);
+
+                if (view->is_loaded) {
+                        if (view->end_animation == NULL)
+                                view_load_end_animation (view);
+
+                        view_show_titles (view);
+                }
+
+                node = ply_list_get_next_node (plugin->views, node);
+        }
+
+        start_progress_animation (plugin);
+        redraw_views (plugin);
+
+        return true;
+}
+
 static void
 update_status (ply_boot_splash_plugin_t *plugin,
                const char               *status)
@@ -2020,6 +2585,25 @@ display_message (ply_boot_splash_plugin_t *plugin,
         show_message (plugin, message);
 }
 
+static void
+trim_memory (ply_boot_splash_plugin_t *plugin)
+{
+        ply_list_node_t *node;
+        view_t *view;
+
+        node = ply_list_get_first_node (plugin->views);
+        while (node != NULL) {
+                view = ply_list_node_get_data (node);
+
+                if (view->throbber != NULL)
+                        ply_throbber_drop_frames (view->throbber);
+                if (view->end_animation != NULL)
+                        ply_animation_drop_frames (view->end_animation);
+
+                node = ply_list_get_next_node (plugin->views, node);
+        }
+}
+
 ply_boot_splash_plugin_interface_t *
 ply_boot_splash_plugin_get_interface (void)
 {
@@ -2030,6 +2614,7 @@ ply_boot_splash_plugin_get_interface (void)
                 .add_pixel_display    = add_pixel_display,
                 .remove_pixel_display = remove_pixel_display,
                 .show_splash_screen   = show_splash_screen,
+                .change_mode          = change_mode,
                 .update_status        = update_status,
                 .on_boot_progress     = on_boot_progress,
                 .hide_splash_screen   = hide_splash_screen,
@@ -2040,6 +2625,7 @@ ply_boot_splash_plugin_get_interface (void)
                 .display_question     = display_question,
                 .display_message      = display_message,
                 .system_update        = system_update,
+                .trim_memory          = trim_memory,
         };
 
         return &plugin_interface;
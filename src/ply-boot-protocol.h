@@ -22,6 +22,8 @@
 #ifndef PLY_BOOT_PROTOCOL_H
 #define PLY_BOOT_PROTOCOL_H
 
+#include <stdint.h>
+
 #define PLY_BOOT_PROTOCOL_TRIMMED_ABSTRACT_SOCKET_PATH "/org/freedesktop/plymouthd"
 #define PLY_BOOT_PROTOCOL_OLD_ABSTRACT_SOCKET_PATH "/ply-boot-protocol"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING "P"
@@ -47,11 +49,48 @@
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_HAS_ACTIVE_VT "V"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_ERROR "!"
 
+/* Answered with the daemon's performance counters, as text */
+#define PLY_BOOT_PROTOCOL_REQUEST_TYPE_STATISTICS "s"
+
+/* Sent on its own, "B" asks whether the daemon takes batches, and gets
+ * an ACK if it does (older daemons NAK it as unknown).  After that, "B"
+ * followed by \003, a uint32 size and that many bytes carries a batch of
+ * requests, each a uint32 id, the command byte, an argument size byte and
+ * the argument.  The daemon answers the whole batch with one
+ * RESPONSE_TYPE_BATCH: a uint32 count, then a uint32 id and an ACK or NAK
+ * byte for each request.  Requests that answer later, like passwords or
+ * quit, can't be batched.
+ */
+#define PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH "B"
+#define PLY_BOOT_PROTOCOL_MAX_BATCH_SIZE 65536
+
+/* "p" comes with a memfd passed along as SCM_RIGHTS, holding a
+ * ply_boot_protocol_progress_record_t that the client keeps updating in
+ * place.  The memfd has to be sealed against shrinking.  The daemon reads
+ * it once a frame, for as long as the connection stays open, instead of
+ * getting a request for every change.
+ */
+#define PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_CHANNEL "p"
+#define PLY_BOOT_PROTOCOL_PROGRESS_TEXT_SIZE 64
+
+/* The writer makes sequence odd, changes the rest, then makes it even
+ * again.  A reader that sees it odd, or changed by the time it's done,
+ * has to try again.  text is the status, and percent the progress out of
+ * 100.
+ */
+typedef struct
+{
+        uint32_t sequence;
+        uint32_t percent;
+        char     text[PLY_BOOT_PROTOCOL_PROGRESS_TEXT_SIZE];
+} ply_boot_protocol_progress_record_t;
+
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK "\x6"
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK "\x15"
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER "\x2"
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS "\t"
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER "\x5"
+#define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_BATCH "\x16"
 
 #endif /* PLY_BOOT_PROTOCOL_H */
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,296 @@
+/* ply-boot-server-test.c - checks plymouthd's replies to odd requests
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ply-boot-protocol.h"
+#include "ply-utils.h"
+
+/* Starts the plymouthd that was just built on a pseudo terminal, with the
+ * built-in details splash, and checks that replies with nothing after
+ * their header get through: an empty answer to a password prompt, from
+ * pressing enter straight away, and the reply to an empty batch.
+ *
+ * The daemon needs the boot protocol socket to itself, so with no root
+ * or with another plymouthd running the test gets skipped.
+ */
+
+#define TEST_SKIPPED 77
+#define TEST_TIMEOUT 60
+#define REPLY_TIMEOUT 5000
+#define CONNECT_TIMEOUT 10.0
+
+static int terminal_fd = -1;
+static pid_t daemon_pid = 0;
+
+/* keeps the pseudo terminal from filling up while waiting on the daemon */
+static void
+drain_terminal (void)
+{
+        char bytes[4096];
+
+        while (read (terminal_fd, bytes, sizeof(bytes)) > 0) {
+        }
+}
+
+static bool
+read_reply (int     fd,
+            void   *reply,
+            size_t  reply_size)
+{
+        uint8_t *bytes = reply;
+        size_t bytes_read = 0;
+
+        while (bytes_read < reply_size) {
+                struct pollfd poll_fds[2] = {
+                        { .fd = fd,          .events = POLLIN },
+                        { .fd = terminal_fd, .events = POLLIN },
+                };
+                ssize_t result;
+
+                if (poll (poll_fds, 2, REPLY_TIMEOUT) <= 0)
+                        return false;
+
+                if (poll_fds[1].revents & POLLIN)
+                        drain_terminal ();
+
+                if (!(poll_fds[0].revents & (POLLIN | POLLHUP)))
+                        continue;
+
+                result = read (fd, bytes + bytes_read, reply_size - bytes_read);
+
+                if (result <= 0)
+                        return false;
+
+                bytes_read += result;
+        }
+
+        return true;
+}
+
+static bool
+send_request (int         fd,
+              const char *request,
+              size_t      request_size)
+{
+        return ply_write (fd, request, request_size);
+}
+
+static bool
+start_daemon (void)
+{
+        char *tty_argument;
+
+        terminal_fd = posix_openpt (O_RDWR | O_NOCTTY);
+
+        if (terminal_fd < 0 || grantpt (terminal_fd) < 0 || unlockpt (terminal_fd) < 0)
+                return false;
+
+        asprintf (&tty_argument, "--tty=%s", ptsname (terminal_fd));
+        fcntl (terminal_fd, F_SETFL, O_NONBLOCK);
+
+        daemon_pid = fork ();
+
+        if (daemon_pid < 0)
+                return false;
+
+        if (daemon_pid == 0) {
+                execl (PLYMOUTHD_PATH, PLYMOUTHD_PATH, "--no-daemon", "--no-boot-log",
+                       tty_argument,
+                       "--kernel-command-line=plymouth.splash=details splash plymouth.ignore-serial-consoles",
+                       NULL);
+                _exit (127);
+        }
+
+        free (tty_argument);
+        return true;
+}
+
+static int
+connect_to_daemon (void)
+{
+        double start_time;
+        int fd;
+
+        start_time = ply_get_timestamp ();
+        do {
+                fd = ply_connect_to_unix_socket (PLY_BOOT_PROTOCOL_TRIMMED_ABSTRACT_SOCKET_PATH,
+                                                 PLY_UNIX_SOCKET_TYPE_TRIMMED_ABSTRACT);
+
+                if (fd >= 0)
+                        return fd;
+
+                if (waitpid (daemon_pid, NULL, WNOHANG) == daemon_pid) {
+                        daemon_pid = 0;
+                        return -1;
+                }
+
+                drain_terminal ();
+                usleep (50000);
+        } while (ply_get_timestamp () - start_time < CONNECT_TIMEOUT);
+
+        return -1;
+}
+
+static bool
+check_reply (int            fd,
+             const char    *name,
+             const uint8_t *expected_reply,
+             size_t         expected_reply_size)
+{
+        uint8_t reply[16];
+
+        if (!read_reply (fd, reply, expected_reply_size)) {
+                fprintf (stderr, "FAIL: %s: no reply, the daemon may have crashed\n", name);
+                return false;
+        }
+
+        if (memcmp (reply, expected_reply, expected_reply_size) != 0) {
+                fprintf (stderr, "FAIL: %s: unexpected reply\n", name);
+                return false;
+        }
+
+        printf ("PASS: %s\n", name);
+        return true;
+}
+
+static bool
+test_empty_answer (int fd)
+{
+        static const uint8_t ack[] = { 0x06 };
+        static const uint8_t empty_answer[] = { 0x02, 0, 0, 0, 0 };
+
+        if (!send_request (fd, PLY_BOOT_PROTOCOL_REQUEST_TYPE_SHOW_SPLASH, 2) ||
+            !check_reply (fd, "show splash", ack, sizeof(ack)))
+                return false;
+
+        if (!send_request (fd, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PASSWORD, 2))
+                return false;
+
+        /* give the prompt a moment to come up before pressing enter */
+        usleep (500000);
+        drain_terminal ();
+
+        if (write (terminal_fd, "\r", 1) != 1)
+                return false;
+
+        return check_reply (fd, "empty answer", empty_answer, sizeof(empty_answer));
+}
+
+static bool
+test_empty_batch (int fd)
+{
+        static const char empty_batch[] = PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH "\003\0\0\0";
+        static const uint8_t empty_batch_reply[] = { 0x16, 0, 0, 0, 0 };
+        static const uint8_t ack[] = { 0x06 };
+
+        if (!send_request (fd, empty_batch, sizeof(empty_batch)) ||
+            !check_reply (fd, "empty batch", empty_batch_reply, sizeof(empty_batch_reply)))
+                return false;
+
+        /* and the daemon still answers afterward */
+        return send_request (fd, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING, 2) &&
+               check_reply (fd, "ping after empty batch", ack, sizeof(ack));
+}
+
+static bool
+run_test (bool (*test)(int fd))
+{
+        static const char quit[] = PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUIT "\002\001";
+        int status, fd;
+        bool passed;
+
+        if (!start_daemon ()) {
+                fprintf (stderr, "FAIL: could not start %s: %m\n", PLYMOUTHD_PATH);
+                return false;
+        }
+
+        fd = connect_to_daemon ();
+
+        if (fd < 0) {
+                fprintf (stderr, "FAIL: could not connect to %s\n", PLYMOUTHD_PATH);
+                passed = false;
+        } else {
+                passed = test (fd);
+
+                /* sizeof counts the argument's terminating nul */
+                send_request (fd, quit, sizeof(quit));
+                close (fd);
+        }
+
+        if (!passed && daemon_pid > 0)
+                kill (daemon_pid, SIGKILL);
+
+        if (daemon_pid > 0 && waitpid (daemon_pid, &status, 0) == daemon_pid &&
+            passed && (!WIFEXITED (status) || WEXITSTATUS (status) != 0)) {
+                fprintf (stderr, "FAIL: daemon exited with status %d\n", status);
+                passed = false;
+        }
+
+        close (terminal_fd);
+        terminal_fd = -1;
+        daemon_pid = 0;
+
+        return passed;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        bool passed;
+        int fd;
+
+        /* rather than hang make check if the daemon never quits */
+        alarm (TEST_TIMEOUT);
+        signal (SIGPIPE, SIG_IGN);
+
+        if (getuid () != 0) {
+                printf ("SKIP: needs root\n");
+                return TEST_SKIPPED;
+        }
+
+        fd = ply_connect_to_unix_socket (PLY_BOOT_PROTOCOL_TRIMMED_ABSTRACT_SOCKET_PATH,
+                                         PLY_UNIX_SOCKET_TYPE_TRIMMED_ABSTRACT);
+        if (fd >= 0) {
+                close (fd);
+                printf ("SKIP: another plymouthd is running\n");
+                return TEST_SKIPPED;
+        }
+
+        /* each with a daemon of its own, so one crashing doesn't fail both */
+        passed = run_test (test_empty_answer);
+        passed = run_test (test_empty_batch) && passed;
+
+        return passed ? 0 : 1;
+}
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -24,9 +24,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -36,21 +39,54 @@
 #include "ply-event-loop.h"
 #include "ply-list.h"
 #include "ply-logger.h"
+#include "ply-probes.h"
+#include "ply-statistics.h"
 #include "ply-trigger.h"
 #include "ply-utils.h"
 
+/* A client that lets this much pile up unread gets dropped */
+#define PLY_BOOT_CONNECTION_MAX_OUTGOING_SIZE (64 * 1024)
+
 typedef struct
 {
         int                fd;
         ply_fd_watch_t    *watch;
         ply_boot_server_t *server;
+
+        /* replies the client hasn't taken yet, so a stuck client can't
+         * hold up the event loop */
+        ply_buffer_t      *outgoing_buffer;
+        ply_fd_watch_t    *outgoing_watch;
+
+        /* bytes read from the client that don't make up a whole request
+         * yet, or that haven't been handled yet */
+        ply_buffer_t      *incoming_buffer;
+
+        /* an fd the client sent along with the current request */
+        int                passed_fd;
+
+        /* an fd that came in with the request at incoming_fd_offset in
+         * incoming_buffer, which hasn't been handled yet */
+        int                incoming_fd;
+        size_t             incoming_fd_offset;
+
+        /* mapped from the memfd of a progress channel request */
+        const ply_boot_protocol_progress_record_t *progress_record;
+
         uid_t              uid;
         pid_t              pid;
 
         int                reference_count;
 
+        /* while a batch is being handled, replies are collected here for
+         * one batched reply, instead of being written as they happen */
+        ply_buffer_t      *batched_replies;
+        uint32_t           batched_request_id;
+        uint32_t           number_of_batched_replies;
+
         uint32_t           credentials_read : 1;
         uint32_t           disconnected : 1;
+        uint32_t           is_dropped : 1;
 } ply_boot_connection_t;
 
 struct _ply_boot_server
@@ -80,8 +116,12 @@ struct _ply_boot_server
         ply_boot_server_reactivate_handler_t          reactivate_handler;
         ply_boot_server_quit_handler_t                quit_handler;
         ply_boot_server_has_active_vt_handler_t       has_active_vt_handler;
+        ply_boot_server_progress_channel_handler_t    progress_channel_handler;
         void                                         *user_data;
 
+        FILE                                         *recording;
+        double                                        recording_start_time;
+
         uint32_t                                      is_listening : 1;
 };
 
@@ -106,6 +146,7 @@ ply_boot_server_new (ply_boot_server_update_handler_t              update_handle
                      ply_boot_server_reactivate_handler_t          reactivate_handler,
                      ply_boot_server_quit_handler_t                quit_handler,
                      ply_boot_server_has_active_vt_handler_t       has_active_vt_handler,
+                     ply_boot_server_progress_channel_handler_t    progress_channel_handler,
                      void                                         *user_data)
 {
         ply_boot_server_t *server;
@@ -135,6 +176,7 @@ ply_boot_server_new (ply_boot_server_update_handler_t              update_handle
         server->reactivate_handler = reactivate_handler;
         server->quit_handler = quit_handler;
         server->has_active_vt_handler = has_active_vt_handler;
+        server->progress_channel_handler = progress_channel_handler;
         server->user_data = user_data;
 
         return server;
@@ -155,6 +197,7 @@ ply_boot_server_free (ply_boot_server_t *server)
         }
         ply_list_free (server->connections);
         ply_list_free (server->cached_passwords);
+        ply_boot_server_stop_recording (server);
         free (server);
 }
 
@@ -168,6 +211,10 @@ ply_boot_connection_new (ply_boot_server_t *server,
         connection->fd = fd;
         connection->server = server;
         connection->watch = NULL;
+        connection->outgoing_buffer = ply_buffer_new ();
+        connection->incoming_buffer = ply_buffer_new ();
+        connection->passed_fd = -1;
+        connection->incoming_fd = -1;
         connection->reference_count = 1;
 
         return connection;
@@ -180,6 +227,12 @@ ply_boot_connection_free (ply_boot_connection_t *connection)
                 return;
 
         close (connection->fd);
+        if (connection->passed_fd >= 0)
+                close (connection->passed_fd);
+        if (connection->incoming_fd >= 0)
+                close (connection->incoming_fd);
+        ply_buffer_free (connection->outgoing_buffer);
+        ply_buffer_free (connection->incoming_buffer);
         free (connection);
 }
 
@@ -203,6 +256,127 @@ ply_boot_connection_drop_reference (ply_boot_connection_t *connection)
                 ply_boot_connection_free (connection);
 }
 
+/* Cuts the client off.  The watches are left for the event loop to
+ * clean up when it notices the hang up, since this can get called while
+ * it's partway through running them.
+ */
+static void
+ply_boot_connection_drop (ply_boot_connection_t *connection)
+{
+        if (connection->is_dropped)
+                return;
+
+        connection->is_dropped = true;
+        ply_buffer_clear (connection->outgoing_buffer);
+        shutdown (connection->fd, SHUT_RDWR);
+}
+
+static bool
+ply_boot_connection_flush_outgoing_buffer (ply_boot_connection_t *connection)
+{
+        while (ply_buffer_get_size (connection->outgoing_buffer) > 0) {
+                ssize_t bytes_written;
+
+                bytes_written = send (connection->fd,
+                                      ply_buffer_get_bytes (connection->outgoing_buffer),
+                                      ply_buffer_get_size (connection->outgoing_buffer),
+                                      MSG_DONTWAIT | MSG_NOSIGNAL);
+
+                if (bytes_written < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        if (errno == EAGAIN || errno == EWOULDBLOCK)
+                                break;
+
+                        return false;
+                }
+
+                ply_buffer_remove_bytes (connection->outgoing_buffer, bytes_written);
+        }
+
+        return true;
+}
+
+static void
+ply_boot_connection_on_room_to_write (ply_boot_connection_t *connection)
+{
+        if (!ply_boot_connection_flush_outgoing_buffer (connection)) {
+                ply_trace ("could not finish writing to client: %m");
+                ply_buffer_clear (connection->outgoing_buffer);
+        }
+
+        if (ply_buffer_get_size (connection->outgoing_buffer) > 0)
+                return;
+
+        ply_event_loop_stop_watching_fd (connection->server->loop,
+                                         connection->outgoing_watch);
+        connection->outgoing_watch = NULL;
+}
+
+/* Works like ply_write, except whatever the client can't take right
+ * away is kept and sent once it can
+ */
+static bool
+ply_boot_connection_write (ply_boot_connection_t *connection,
+                           const void            *bytes,
+                           size_t                 number_of_bytes)
+{
+        if (connection->disconnected || connection->is_dropped) {
+                errno = EPIPE;
+                return false;
+        }
+
+        /* like an empty answer to a password prompt, or an empty batch */
+        if (number_of_bytes == 0)
+                return true;
+
+        ply_buffer_append_bytes (connection->outgoing_buffer, bytes, number_of_bytes);
+
+        /* if it's already waiting on the client, keep things in order */
+        if (connection->outgoing_watch == NULL &&
+            !ply_boot_connection_flush_outgoing_buffer (connection)) {
+                ply_buffer_clear (connection->outgoing_buffer);
+                return false;
+        }
+
+        if (ply_buffer_get_size (connection->outgoing_buffer) == 0)
+                return true;
+
+        if (ply_buffer_get_size (connection->outgoing_buffer) > PLY_BOOT_CONNECTION_MAX_OUTGOING_SIZE) {
+                ply_trace ("client pid %ld isn't reading its replies, dropping it",
+                           (long) connection->pid);
+                ply_boot_connection_drop (connection);
+                errno = EPIPE;
+                return false;
+        }
+
+        if (connection->outgoing_watch == NULL && connection->server->loop != NULL)
+                connection->outgoing_watch =
+                        ply_event_loop_watch_fd (connection->server->loop, connection->fd,
+                                                 PLY_EVENT_LOOP_FD_STATUS_CAN_TAKE_DATA,
+                                                 (ply_event_handler_t)
+                                                 ply_boot_connection_on_room_to_write,
+                                                 NULL,
+                                                 connection);
+
+        return true;
+}
+
+static bool
+ply_boot_connection_write_uint32 (ply_boot_connection_t *connection,
+                                  uint32_t               value)
+{
+        uint8_t buffer[4];
+
+        buffer[0] = (value >> 0) & 0xFF;
+        buffer[1] = (value >> 8) & 0xFF;
+        buffer[2] = (value >> 16) & 0xFF;
+        buffer[3] = (value >> 24) & 0xFF;
+
+        return ply_boot_connection_write (connection, buffer, sizeof(buffer));
+}
+
 bool
 ply_boot_server_listen (ply_boot_server_t *server)
 {
@@ -224,49 +398,143 @@ ply_boot_server_stop_listening (ply_boot_server_t *server)
         assert (server != NULL);
 }
 
+/* How much to read at once, which is more than most clients send in a
+ * whole connection */
+#define INCOMING_READ_SIZE 4096
+
+/* Reads whatever the client has sent so far with one call, picking up an
+ * fd if the client passed one along.  Returns false when the client is
+ * gone.
+ */
 static bool
-ply_boot_connection_read_request (ply_boot_connection_t *connection,
-                                  char                 **command,
-                                  char                 **argument)
+ply_boot_connection_read_incoming_bytes (ply_boot_connection_t *connection)
 {
-        uint8_t header[2];
+        /* credentials come along too, if the socket passes them */
+        union
+        {
+                struct cmsghdr header;
+                char           buffer[CMSG_SPACE (sizeof(int)) +
+                                      CMSG_SPACE (sizeof(struct ucred))];
+        } control;
+        struct cmsghdr *control_message;
+        struct msghdr message = { 0 };
+        struct iovec vector;
+        ssize_t bytes_read;
+        size_t size;
+
+        vector.iov_base = ply_buffer_get_writable_region (connection->incoming_buffer,
+                                                          INCOMING_READ_SIZE, &size);
+        vector.iov_len = size;
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+
+        do {
+                bytes_read = recvmsg (connection->fd, &message, MSG_CMSG_CLOEXEC);
+        } while (bytes_read < 0 && errno == EINTR);
+
+        if (bytes_read <= 0)
+                return false;
 
-        assert (connection != NULL);
-        assert (connection->fd >= 0);
+        ply_buffer_commit (connection->incoming_buffer, bytes_read);
+
+        for (control_message = CMSG_FIRSTHDR (&message);
+             control_message != NULL;
+             control_message = CMSG_NXTHDR (&message, control_message)) {
+                if (control_message->cmsg_level != SOL_SOCKET ||
+                    control_message->cmsg_type != SCM_RIGHTS ||
+                    control_message->cmsg_len != CMSG_LEN (sizeof(int)))
+                        continue;
+
+                /* The kernel doesn't read past the bytes an fd came with, so
+                 * it goes with the request the last byte read belongs to */
+                if (connection->incoming_fd >= 0)
+                        close (connection->incoming_fd);
+                memcpy (&connection->incoming_fd, CMSG_DATA (control_message), sizeof(int));
+                connection->incoming_fd_offset = ply_buffer_get_size (connection->incoming_buffer) - 1;
+        }
 
-        connection->credentials_read = false;
+        return true;
+}
 
-        if (!ply_read (connection->fd, header, sizeof(header)))
-                return false;
+/* Takes the next whole request off the incoming bytes.  Returns false if
+ * there isn't one yet, or if the client sent something that can't be a
+ * request, in which case it gets dropped.
+ */
+static bool
+ply_boot_connection_parse_request (ply_boot_connection_t *connection,
+                                   char                 **command,
+                                   char                 **argument,
+                                   size_t                *argument_size)
+{
+        const uint8_t *bytes;
+        size_t size, header_size, request_size;
+        uint32_t parsed_argument_size;
 
-        *command = calloc (2, sizeof(char));
-        *command[0] = header[0];
+        bytes = (const uint8_t *) ply_buffer_get_bytes (connection->incoming_buffer);
+        size = ply_buffer_get_size (connection->incoming_buffer);
 
-        *argument = NULL;
-        if (header[1] == '\002') {
-                uint8_t argument_size;
+        if (size < 2)
+                return false;
 
-                if (!ply_read (connection->fd, &argument_size, sizeof(uint8_t))) {
-                        free (*command);
+        header_size = 2;
+        parsed_argument_size = 0;
+        if (bytes[1] == '\002') {
+                if (size < 3)
+                        return false;
+
+                parsed_argument_size = bytes[2];
+                header_size = 3;
+        } else if (bytes[1] == '\003') {
+                if (size < 6)
                         return false;
-                }
 
-                *argument = calloc (argument_size, sizeof(char));
+                parsed_argument_size = (bytes[2] << 0) |
+                                       (bytes[3] << 8) |
+                                       (bytes[4] << 16) |
+                                       ((uint32_t) bytes[5] << 24);
+                header_size = 6;
 
-                if (!ply_read (connection->fd, *argument, argument_size)) {
-                        free (*argument);
-                        free (*command);
+                if (parsed_argument_size > PLY_BOOT_PROTOCOL_MAX_BATCH_SIZE) {
+                        ply_trace ("client sent a %u byte batch, dropping it", parsed_argument_size);
+                        ply_buffer_clear (connection->incoming_buffer);
+                        ply_boot_connection_drop (connection);
                         return false;
                 }
         }
 
-        if (!ply_get_credentials_from_fd (connection->fd, &connection->pid, &connection->uid, NULL)) {
-                ply_trace ("couldn't read credentials from connection: %m");
-                free (*argument);
-                free (*command);
+        request_size = header_size + parsed_argument_size;
+        if (size < request_size)
                 return false;
+
+        *command = calloc (2, sizeof(char));
+        *command[0] = bytes[0];
+
+        *argument = NULL;
+        *argument_size = 0;
+        if (bytes[1] == '\002') {
+                *argument = calloc (parsed_argument_size, sizeof(char));
+                *argument_size = parsed_argument_size;
+                memcpy (*argument, bytes + header_size, parsed_argument_size);
+        } else if (bytes[1] == '\003') {
+                *argument = calloc (parsed_argument_size + 1, sizeof(char));
+                *argument_size = parsed_argument_size;
+                memcpy (*argument, bytes + header_size, parsed_argument_size);
+        }
+
+        ply_buffer_remove_bytes (connection->incoming_buffer, request_size);
+
+        if (connection->incoming_fd >= 0) {
+                if (connection->incoming_fd_offset < request_size) {
+                        if (connection->passed_fd >= 0)
+                                close (connection->passed_fd);
+                        connection->passed_fd = connection->incoming_fd;
+                        connection->incoming_fd = -1;
+                } else {
+                        connection->incoming_fd_offset -= request_size;
+                }
         }
-        connection->credentials_read = true;
 
         return true;
 }
@@ -292,20 +560,20 @@ ply_boot_connection_send_answer (ply_boot_connection_t *connection,
          * punt to client
          */
         if (answer == NULL) {
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER)))
+                if (!ply_boot_connection_write (connection,
+                                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
+                                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER)))
                         ply_trace ("could not finish writing no answer reply: %m");
         } else {
                 size = strlen (answer);
 
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER)) ||
-                    !ply_write_uint32 (connection->fd,
-                                       size) ||
-                    !ply_write (connection->fd,
-                                answer, size))
+                if (!ply_boot_connection_write (connection,
+                                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER,
+                                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER)) ||
+                    !ply_boot_connection_write_uint32 (connection,
+                                                       size) ||
+                    !ply_boot_connection_write (connection,
+                                                answer, size))
                         ply_trace ("could not finish writing answer: %m");
         }
 }
@@ -332,9 +600,9 @@ ply_boot_connection_on_deactivated (ply_boot_connection_t *connection)
         ply_trace ("deactivated");
 
         if (!connection->disconnected) {
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+                if (!ply_boot_connection_write (connection,
+                                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
                         ply_trace ("could not finish writing deactivate reply: %m");
         }
 
@@ -346,9 +614,9 @@ ply_boot_connection_on_quit_complete (ply_boot_connection_t *connection)
 {
         ply_trace ("quit complete");
         if (!connection->disconnected) {
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+                if (!ply_boot_connection_write (connection,
+                                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
                         ply_trace ("could not finish writing quit reply: %m");
         }
 
@@ -400,44 +668,134 @@ print_connection_process_identity (ply_boot_connection_t *connection)
         free (command_line);
 }
 
-static void
-ply_boot_connection_on_request (ply_boot_connection_t *connection)
+static bool
+ply_boot_connection_send_reply (ply_boot_connection_t *connection,
+                                const char            *reply)
 {
-        ply_boot_server_t *server;
-        char *command, *argument;
+        uint8_t entry[5];
 
-        assert (connection != NULL);
-        assert (connection->fd >= 0);
+        if (connection->batched_replies == NULL)
+                return ply_boot_connection_write (connection, reply, strlen (reply));
 
-        server = connection->server;
-        assert (server != NULL);
+        entry[0] = (connection->batched_request_id >> 0) & 0xFF;
+        entry[1] = (connection->batched_request_id >> 8) & 0xFF;
+        entry[2] = (connection->batched_request_id >> 16) & 0xFF;
+        entry[3] = (connection->batched_request_id >> 24) & 0xFF;
+        entry[4] = reply[0];
 
-        if (!ply_boot_connection_read_request (connection,
-                                               &command, &argument)) {
-                ply_trace ("could not read connection request");
+        ply_buffer_append_bytes (connection->batched_replies, entry, sizeof(entry));
+        connection->number_of_batched_replies++;
+
+        return true;
+}
+
+/* Only requests that get an ACK or NAK right away can go in a batch,
+ * the rest reply later on their own
+ */
+static bool
+ply_boot_request_can_be_batched (const char *command)
+{
+        return strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PASSWORD) != 0 &&
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_CACHED_PASSWORD) != 0 &&
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUESTION) != 0 &&
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_KEYSTROKE) != 0 &&
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_DEACTIVATE) != 0 &&
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUIT) != 0 &&
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH) != 0 &&
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_CHANNEL) != 0 &&
+               strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_STATISTICS) != 0;
+}
+
+static void
+ply_boot_connection_close_progress_channel (ply_boot_connection_t *connection)
+{
+        ply_boot_server_t *server = connection->server;
+
+        if (connection->progress_record == NULL)
                 return;
+
+        if (server->progress_channel_handler != NULL)
+                server->progress_channel_handler (server->user_data,
+                                                  connection->progress_record,
+                                                  false, server);
+
+        munmap ((void *) connection->progress_record,
+                sizeof(ply_boot_protocol_progress_record_t));
+        connection->progress_record = NULL;
+}
+
+static bool
+ply_boot_connection_open_progress_channel (ply_boot_connection_t *connection)
+{
+        ply_boot_server_t *server = connection->server;
+        struct stat file_info;
+        void *record;
+        int fd, seals;
+
+        fd = connection->passed_fd;
+        connection->passed_fd = -1;
+
+        if (fd < 0) {
+                ply_trace ("progress channel request came without a memfd");
+                return false;
         }
 
-        if (ply_is_tracing ())
-                print_connection_process_identity (connection);
+        /* if the client could shrink it, reading it would crash us */
+        seals = fcntl (fd, F_GET_SEALS);
+        if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+                ply_trace ("progress channel memfd isn't sealed against shrinking");
+                close (fd);
+                return false;
+        }
 
-        if (!ply_boot_connection_is_from_root (connection)) {
-                ply_error ("request came from non-root user");
+        if (fstat (fd, &file_info) < 0 ||
+            file_info.st_size < (off_t) sizeof(ply_boot_protocol_progress_record_t)) {
+                ply_trace ("progress channel memfd is too small");
+                close (fd);
+                return false;
+        }
 
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
-                        ply_trace ("could not finish writing is-not-root nak: %m");
+        record = mmap (NULL, sizeof(ply_boot_protocol_progress_record_t),
+                       PROT_READ, MAP_SHARED, fd, 0);
+        close (fd);
 
-                free (argument);
-                free (command);
-                return;
+        if (record == MAP_FAILED) {
+                ply_trace ("could not map progress channel: %m");
+                return false;
         }
 
+        ply_boot_connection_close_progress_channel (connection);
+        connection->progress_record = record;
+
+        if (server->progress_channel_handler != NULL)
+                server->progress_channel_handler (server->user_data,
+                                                  connection->progress_record,
+                                                  true, server);
+
+        return true;
+}
+
+/* Takes ownership of command and argument */
+static void
+ply_boot_connection_handle_request (ply_boot_connection_t *connection,
+                                    char                  *command,
+                                    char                  *argument)
+{
+        ply_boot_server_t *server = connection->server;
+        char statistic_name[64];
+
+        snprintf (statistic_name, sizeof(statistic_name),
+                  "boot-server.requests.%s", command);
+        ply_statistics_add_to_count (statistic_name, 1);
+
+        if (server->recording != NULL)
+                ply_boot_server_record_event (server, PLY_BOOT_SERVER_EVENT_REQUEST,
+                                              command, argument,
+                                              argument != NULL ? strlen (argument) : 0);
+
         if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE) == 0) {
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)) &&
+                if (!ply_boot_connection_send_reply (connection,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK) &&
                     errno != EPIPE)
                         ply_trace ("could not finish writing update reply: %m");
 
@@ -448,9 +806,8 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 free (command);
                 return;
         } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_CHANGE_MODE) == 0) {
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+                if (!ply_boot_connection_send_reply (connection,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK))
                         ply_trace ("could not finish writing update reply: %m");
 
                 ply_trace ("got change mode notification");
@@ -470,9 +827,8 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 }
 
                 ply_trace ("got system-update notification %li%%", value);
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+                if (!ply_boot_connection_send_reply (connection,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK))
                         ply_trace ("could not finish writing update reply: %m");
 
                 if (server->system_update_handler != NULL)
@@ -608,22 +964,22 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 if (buffer_size == 0) {
                         ply_trace ("Responding with 'no answer' reply since there are currently "
                                    "no cached answers");
-                        if (!ply_write (connection->fd,
-                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
-                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER)))
+                        if (!ply_boot_connection_write (connection,
+                                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
+                                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER)))
                                 ply_trace ("could not finish writing no answer reply: %m");
                 } else {
                         size = buffer_size;
 
                         ply_trace ("writing %d cached answers",
                                    ply_list_get_length (server->cached_passwords));
-                        if (!ply_write (connection->fd,
-                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS,
-                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS)) ||
-                            !ply_write_uint32 (connection->fd,
-                                               size) ||
-                            !ply_write (connection->fd,
-                                        ply_buffer_get_bytes (buffer), size))
+                        if (!ply_boot_connection_write (connection,
+                                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS,
+                                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS)) ||
+                            !ply_boot_connection_write_uint32 (connection,
+                                                               size) ||
+                            !ply_boot_connection_write (connection,
+                                                        ply_buffer_get_bytes (buffer), size))
                                 ply_trace ("could not finish writing cached answer reply: %m");
                 }
 
@@ -716,9 +1072,33 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                         answer = server->has_active_vt_handler (server->user_data, server);
 
                 if (!answer) {
-                        if (!ply_write (connection->fd,
-                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
+                        if (!ply_boot_connection_send_reply (connection,
+                                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK))
+                                ply_trace ("could not finish writing nak: %m");
+
+                        free (argument);
+                        free (command);
+                        return;
+                }
+        } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH) == 0) {
+                ply_trace ("client can send batched requests");
+        } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_STATISTICS) == 0) {
+                char *statistics;
+
+                ply_trace ("got statistics request");
+                statistics = ply_statistics_format ();
+                ply_boot_connection_send_answer (connection, statistics);
+                free (statistics);
+
+                free (argument);
+                free (command);
+                return;
+        } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PROGRESS_CHANNEL) == 0) {
+                ply_trace ("got progress channel request");
+                if (server->progress_channel_handler == NULL ||
+                    !ply_boot_connection_open_progress_channel (connection)) {
+                        if (!ply_boot_connection_send_reply (connection,
+                                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK))
                                 ply_trace ("could not finish writing nak: %m");
 
                         free (argument);
@@ -728,9 +1108,8 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
         } else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING) != 0) {
                 ply_error ("received unknown command '%s' from client", command);
 
-                if (!ply_write (connection->fd,
-                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
+                if (!ply_boot_connection_send_reply (connection,
+                                                     PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK))
                         ply_trace ("could not finish writing ping reply: %m");
 
                 free (argument);
@@ -738,14 +1117,161 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
                 return;
         }
 
-        if (!ply_write (connection->fd,
-                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+        if (!ply_boot_connection_send_reply (connection,
+                                             PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK))
                 ply_trace ("could not finish writing ack: %m");
         free (argument);
         free (command);
 }
 
+static void
+ply_boot_connection_handle_batch (ply_boot_connection_t *connection,
+                                  const uint8_t         *batch,
+                                  size_t                 batch_size)
+{
+        size_t offset = 0;
+
+        connection->batched_replies = ply_buffer_new ();
+        connection->number_of_batched_replies = 0;
+
+        /* each request is a little endian uint32 id, the command byte,
+         * then an argument size byte and the argument */
+        while (offset + 6 <= batch_size) {
+                char *command, *argument = NULL;
+                uint8_t argument_size;
+
+                connection->batched_request_id = (batch[offset + 0] << 0) |
+                                                 (batch[offset + 1] << 8) |
+                                                 (batch[offset + 2] << 16) |
+                                                 ((uint32_t) batch[offset + 3] << 24);
+                command = calloc (2, sizeof(char));
+                command[0] = batch[offset + 4];
+                argument_size = batch[offset + 5];
+                offset += 6;
+
+                if (offset + argument_size > batch_size) {
+                        ply_trace ("batched request %u is cut off", connection->batched_request_id);
+                        free (command);
+                        break;
+                }
+
+                if (argument_size > 0) {
+                        argument = calloc (argument_size + 1, sizeof(char));
+                        memcpy (argument, batch + offset, argument_size);
+                        offset += argument_size;
+                }
+
+                if (!ply_boot_request_can_be_batched (command)) {
+                        ply_error ("received '%s' from client in a batch", command);
+                        ply_boot_connection_send_reply (connection, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK);
+                        free (argument);
+                        free (command);
+                        continue;
+                }
+
+                ply_boot_connection_handle_request (connection, command, argument);
+        }
+
+        ply_trace ("answering %u batched requests", connection->number_of_batched_replies);
+
+        if (!ply_boot_connection_write (connection,
+                                        PLY_BOOT_PROTOCOL_RESPONSE_TYPE_BATCH,
+                                        strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_BATCH)) ||
+            !ply_boot_connection_write_uint32 (connection,
+                                               connection->number_of_batched_replies) ||
+            !ply_boot_connection_write (connection,
+                                        ply_buffer_get_bytes (connection->batched_replies),
+                                        ply_buffer_get_size (connection->batched_replies)))
+                ply_trace ("could not finish writing batched reply: %m");
+
+        ply_buffer_free (connection->batched_replies);
+        connection->batched_replies = NULL;
+}
+
+static void
+ply_boot_connection_handle_incoming_request (ply_boot_connection_t *connection,
+                                             char                  *command,
+                                             char                  *argument,
+                                             size_t                 argument_size)
+{
+        ply_probe (boot_server_request, command, argument, argument_size);
+
+        if (ply_is_tracing ())
+                print_connection_process_identity (connection);
+
+        if (!ply_boot_connection_is_from_root (connection)) {
+                ply_error ("request came from non-root user");
+
+                if (!ply_boot_connection_write (connection,
+                                                PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
+                                                strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
+                        ply_trace ("could not finish writing is-not-root nak: %m");
+
+                free (argument);
+                free (command);
+                return;
+        }
+
+        if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_BATCH) == 0 && argument != NULL) {
+                ply_boot_connection_handle_batch (connection, (uint8_t *) argument, argument_size);
+                free (argument);
+                free (command);
+        } else {
+                ply_boot_connection_handle_request (connection, command, argument);
+        }
+}
+
+/* Handles every whole request that has come in, however many the client
+ * managed to send since the last time.  Part of a request is left for
+ * when the rest of it turns up, rather than waiting around for it.
+ */
+static void
+ply_boot_connection_on_request (ply_boot_connection_t *connection)
+{
+        char *command, *argument;
+        size_t argument_size;
+
+        assert (connection != NULL);
+        assert (connection->fd >= 0);
+        assert (connection->server != NULL);
+
+        if (!ply_boot_connection_read_incoming_bytes (connection)) {
+                ply_trace ("could not read connection request");
+                return;
+        }
+
+        /* The peer can't change, so its credentials only need to be
+         * asked for once */
+        if (!connection->credentials_read) {
+                if (!ply_get_credentials_from_fd (connection->fd, &connection->pid, &connection->uid, NULL)) {
+                        ply_trace ("couldn't read credentials from connection: %m");
+                        ply_buffer_clear (connection->incoming_buffer);
+                        return;
+                }
+                connection->credentials_read = true;
+        }
+
+        /* a client that doesn't read its replies can get dropped partway
+         * through */
+        ply_boot_connection_take_reference (connection);
+
+        while (!connection->is_dropped &&
+               ply_boot_connection_parse_request (connection,
+                                                  &command, &argument,
+                                                  &argument_size)) {
+                ply_boot_connection_handle_incoming_request (connection, command,
+                                                             argument, argument_size);
+
+                /* an fd that came with a request that doesn't take one */
+                if (connection->passed_fd >= 0) {
+                        close (connection->passed_fd);
+                        connection->passed_fd = -1;
+                }
+        }
+
+        ply_boot_connection_drop_reference (connection);
+}
+
 static void
 ply_boot_connection_on_hangup (ply_boot_connection_t *connection)
 {
@@ -757,6 +1283,12 @@ ply_boot_connection_on_hangup (ply_boot_connection_t *connection)
 
         connection->disconnected = true;
 
+        /* the event loop throws away the watches for a hung up fd */
+        connection->outgoing_watch = NULL;
+        ply_buffer_clear (connection->outgoing_buffer);
+
+        ply_boot_connection_close_progress_channel (connection);
+
         server = connection->server;
 
         node = ply_list_find_node (server->connections, connection);
@@ -830,4 +1362,89 @@ ply_boot_server_attach_to_event_loop (ply_boot_server_t *server,
                                        server);
 }
 
+bool
+ply_boot_server_start_recording (ply_boot_server_t *server,
+                                 const char        *filename)
+{
+        assert (server != NULL);
+        assert (filename != NULL);
+
+        ply_boot_server_stop_recording (server);
+
+        server->recording = fopen (filename, "we");
+
+        if (server->recording == NULL) {
+                ply_trace ("could not open %s to record to: %m", filename);
+                return false;
+        }
+
+        ply_trace ("recording boot to %s", filename);
+        server->recording_start_time = ply_get_timestamp ();
+
+        return true;
+}
+
+void
+ply_boot_server_stop_recording (ply_boot_server_t *server)
+{
+        assert (server != NULL);
+
+        if (server->recording == NULL)
+                return;
+
+        fclose (server->recording);
+        server->recording = NULL;
+}
+
+bool
+ply_boot_server_is_recording (ply_boot_server_t *server)
+{
+        return server->recording != NULL;
+}
+
+static void
+ply_boot_server_write_escaped (ply_boot_server_t *server,
+                               const char        *data,
+                               size_t             size)
+{
+        size_t i;
+
+        for (i = 0; i < size; i++) {
+                unsigned char byte = (unsigned char) data[i];
+
+                if (byte > ' ' && byte < 0x7f && byte != '\\')
+                        putc (byte, server->recording);
+                else
+                        fprintf (server->recording, "\\x%02x", byte);
+        }
+}
+
+void
+ply_boot_server_record_event (ply_boot_server_t *server,
+                              char               kind,
+                              const char        *name,
+                              const char        *data,
+                              size_t             size)
+{
+        assert (server != NULL);
+        assert (name != NULL);
+
+        if (server->recording == NULL)
+                return;
+
+        fprintf (server->recording, "%.6f %c ",
+                 ply_get_timestamp () - server->recording_start_time, kind);
+        ply_boot_server_write_escaped (server, name, strlen (name));
+
+        if (data != NULL) {
+                fputs (" :", server->recording);
+                ply_boot_server_write_escaped (server, data, size);
+        }
+
+        putc ('\n', server->recording);
+
+        /* so the trace of a boot that hangs or crashes isn't lost */
+        fflush (server->recording);
+}
+
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
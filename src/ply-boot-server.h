@@ -32,6 +32,16 @@
 
 typedef struct _ply_boot_server ply_boot_server_t;
 
+/* A recording has one line per event, "SECONDS KIND NAME[ :DATA]", with
+ * SECONDS counted from when recording started.  KIND is one of the
+ * below.  Bytes of DATA outside of printable ASCII, and spaces and
+ * backslashes, are written as \xHH.  A request that came without an
+ * argument has no DATA, and one with an empty argument ends in " :".
+ */
+#define PLY_BOOT_SERVER_EVENT_REQUEST 'R'
+#define PLY_BOOT_SERVER_EVENT_KEYBOARD 'K'
+#define PLY_BOOT_SERVER_EVENT_DEVICE 'D'
+
 typedef void (*ply_boot_server_update_handler_t) (void              *user_data,
                                                   const char        *status,
                                                   ply_boot_server_t *server);
@@ -103,6 +113,15 @@ typedef void (*ply_boot_server_quit_handler_t) (void              *user_data,
 typedef bool (*ply_boot_server_has_active_vt_handler_t) (void              *user_data,
                                                          ply_boot_server_t *server);
 
+/* Called with is_open set when a client hands over a progress channel,
+ * and again with it unset just before the record goes away, when the
+ * client disconnects.
+ */
+typedef void (*ply_boot_server_progress_channel_handler_t) (void                                      *user_data,
+                                                            const ply_boot_protocol_progress_record_t *record,
+                                                            bool                                       is_open,
+                                                            ply_boot_server_t                         *server);
+
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_boot_server_t *ply_boot_server_new (ply_boot_server_update_handler_t              update_handler,
                                         ply_boot_server_change_mode_handler_t         change_mode_handler,
@@ -124,6 +143,7 @@ ply_boot_server_t *ply_boot_server_new (ply_boot_server_update_handler_t
                                         ply_boot_server_reactivate_handler_t          reactivate_handler,
                                         ply_boot_server_quit_handler_t                quit_handler,
                                         ply_boot_server_has_active_vt_handler_t       has_active_vt_handler,
+                                        ply_boot_server_progress_channel_handler_t    progress_channel_handler,
                                         void                                         *user_data);
 
 void ply_boot_server_free (ply_boot_server_t *server);
@@ -132,6 +152,20 @@ void ply_boot_server_stop_listening (ply_boot_server_t *server);
 void ply_boot_server_attach_to_event_loop (ply_boot_server_t *server,
                                            ply_event_loop_t  *loop);
 
+/* Logs every request that comes in from here on to filename, along with
+ * whatever gets passed to ply_boot_server_record_event, so a boot can be
+ * played back later.
+ */
+bool ply_boot_server_start_recording (ply_boot_server_t *server,
+                                      const char        *filename);
+void ply_boot_server_stop_recording (ply_boot_server_t *server);
+bool ply_boot_server_is_recording (ply_boot_server_t *server);
+void ply_boot_server_record_event (ply_boot_server_t *server,
+                                   char               kind,
+                                   const char        *name,
+                                   const char        *data,
+                                   size_t             size);
+
 #endif
 
 #endif /* PLY_BOOT_SERVER_H */
@@ -0,0 +1,525 @@
+/* plymouth-benchmark.c - times the drawing primitives splashes lean on
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-list.h"
+#include "ply-pixel-buffer.h"
+#include "ply-rectangle.h"
+#include "ply-region.h"
+#include "ply-renderer.h"
+#include "ply-utils.h"
+
+/* Prints one line per case, so results can be diffed between builds:
+ *
+ *   NAME ITERATIONS NS_PER_OP MPIX_PER_S
+ *
+ * Cases matching any of the arguments get run, or all of them when
+ * there are none.  PLY_BENCHMARK_TIME sets how many seconds each case
+ * runs for, and PLY_BENCHMARK_RENDERER picks the renderer plugin the
+ * flush cases go through ("offscreen" by default, or "drm" or
+ * "frame-buffer" to time copying out to real hardware).
+ */
+
+#define DEFAULT_TIME_PER_CASE 0.5
+#define NUMBER_OF_REGION_RECTANGLES 1000
+
+typedef struct _benchmark benchmark_t;
+
+typedef void (*benchmark_function_t) (benchmark_t *benchmark);
+
+struct _benchmark
+{
+        const char          *name;
+        benchmark_function_t prepare;
+        benchmark_function_t run;
+
+        unsigned long        width;
+        unsigned long        height;
+        int                  scale;
+        ply_pixel_buffer_rotation_t rotation;
+        double               opacity;
+
+        /* how many device pixels, and operations, one run amounts to */
+        unsigned long        pixels_per_run;
+        unsigned long        operations_per_run;
+
+        ply_pixel_buffer_t  *canvas;
+        ply_pixel_buffer_t  *image;
+        ply_rectangle_t      area;
+        ply_region_t        *region;
+        ply_rectangle_t     *rectangles;
+        ply_renderer_t      *renderer;
+        ply_renderer_head_t *head;
+};
+
+static uint32_t random_state = 0x12345678;
+
+static uint32_t
+get_random_number (void)
+{
+        /* xorshift, so every run draws the same pixels */
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+
+        return random_state;
+}
+
+static ply_pixel_buffer_t *
+create_image (unsigned long width,
+              unsigned long height)
+{
+        ply_pixel_buffer_t *image;
+        uint32_t *pixels;
+        unsigned long i;
+
+        image = ply_pixel_buffer_new (width, height);
+        pixels = ply_pixel_buffer_get_argb32_data (image);
+
+        /* mostly opaque like a typical theme image, with some translucent
+         * and transparent pixels around so blending has work to do
+         */
+        for (i = 0; i < width * height; i++) {
+                uint32_t pixel, alpha;
+
+                pixel = get_random_number ();
+                switch (pixel >> 30) {
+                case 0:
+                        alpha = 0x00;
+                        break;
+                case 1:
+                        alpha = 0x80;
+                        break;
+                default:
+                        alpha = 0xff;
+                        break;
+                }
+
+                pixels[i] = (alpha << 24) |
+                            ((((pixel >> 16) & 0xff) * alpha / 0xff) << 16) |
+                            ((((pixel >> 8) & 0xff) * alpha / 0xff) << 8) |
+                            ((pixel & 0xff) * alpha / 0xff);
+        }
+
+        return image;
+}
+
+static void
+prepare_canvas (benchmark_t *benchmark)
+{
+        if (benchmark->canvas != NULL)
+                return;
+
+        benchmark->canvas = ply_pixel_buffer_new_with_device_rotation (benchmark->width,
+                                                                       benchmark->height,
+                                                                       benchmark->rotation);
+        ply_pixel_buffer_set_device_scale (benchmark->canvas, benchmark->scale);
+
+        benchmark->area.x = 0;
+        benchmark->area.y = 0;
+        benchmark->area.width = benchmark->width / benchmark->scale;
+        benchmark->area.height = benchmark->height / benchmark->scale;
+        benchmark->pixels_per_run = benchmark->width * benchmark->height;
+}
+
+static void
+prepare_fill_with_argb32_data (benchmark_t *benchmark)
+{
+        prepare_canvas (benchmark);
+
+        if (benchmark->image == NULL)
+                benchmark->image = create_image (benchmark->area.width,
+                                                 benchmark->area.height);
+}
+
+static void
+run_fill_with_argb32_data (benchmark_t *benchmark)
+{
+        ply_pixel_buffer_fill_with_argb32_data_at_opacity (benchmark->canvas,
+                                                           &benchmark->area,
+                                                           ply_pixel_buffer_get_argb32_data (benchmark->image),
+                                                           benchmark->opacity);
+}
+
+static void
+prepare_fill_with_scaled_argb32_data (benchmark_t *benchmark)
+{
+        prepare_canvas (benchmark);
+
+        /* an image carrying device pixels, like a theme's @2x assets */
+        if (benchmark->image == NULL)
+                benchmark->image = create_image (benchmark->width,
+                                                 benchmark->height);
+}
+
+static void
+run_fill_with_scaled_argb32_data (benchmark_t *benchmark)
+{
+        ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (benchmark->canvas,
+                                                                               &benchmark->area,
+                                                                               NULL,
+                                                                               ply_pixel_buffer_get_argb32_data (benchmark->image),
+                                                                               benchmark->opacity,
+                                                                               benchmark->scale);
+}
+
+static void
+run_fill_with_gradient (benchmark_t *benchmark)
+{
+        ply_pixel_buffer_fill_with_gradient (benchmark->canvas,
+                                             &benchmark->area,
+                                             0x000000, 0x4060a0);
+}
+
+static void
+prepare_transform (benchmark_t *benchmark)
+{
+        if (benchmark->image == NULL)
+                benchmark->image = create_image (benchmark->width,
+                                                 benchmark->height);
+}
+
+static void
+prepare_resize_up (benchmark_t *benchmark)
+{
+        prepare_transform (benchmark);
+        benchmark->pixels_per_run = benchmark->width * benchmark->height * 4;
+}
+
+static void
+run_resize_up (benchmark_t *benchmark)
+{
+        ply_pixel_buffer_free (ply_pixel_buffer_resize (benchmark->image,
+                                                        benchmark->width * 2,
+                                                        benchmark->height * 2));
+}
+
+static void
+prepare_resize_down (benchmark_t *benchmark)
+{
+        prepare_transform (benchmark);
+        benchmark->pixels_per_run = benchmark->width * benchmark->height;
+}
+
+static void
+run_resize_down (benchmark_t *benchmark)
+{
+        ply_pixel_buffer_free (ply_pixel_buffer_resize (benchmark->image,
+                                                        benchmark->width / 2,
+                                                        benchmark->height / 2));
+}
+
+static void
+prepare_rotate (benchmark_t *benchmark)
+{
+        prepare_transform (benchmark);
+        benchmark->pixels_per_run = benchmark->width * benchmark->height;
+}
+
+static void
+run_rotate (benchmark_t *benchmark)
+{
+        ply_pixel_buffer_free (ply_pixel_buffer_rotate (benchmark->image,
+                                                        benchmark->width / 2,
+                                                        benchmark->height / 2,
+                                                        0.3));
+}
+
+static void
+prepare_tile (benchmark_t *benchmark)
+{
+        if (benchmark->image == NULL)
+                benchmark->image = create_image (64, 64);
+
+        benchmark->pixels_per_run = benchmark->width * benchmark->height;
+}
+
+static void
+run_tile (benchmark_t *benchmark)
+{
+        ply_pixel_buffer_free (ply_pixel_buffer_tile (benchmark->image,
+                                                      benchmark->width,
+                                                      benchmark->height));
+}
+
+static void
+prepare_region (benchmark_t *benchmark)
+{
+        int i;
+
+        if (benchmark->rectangles != NULL) {
+                ply_region_clear (benchmark->region);
+                return;
+        }
+
+        benchmark->region = ply_region_new ();
+        benchmark->rectangles = calloc (NUMBER_OF_REGION_RECTANGLES,
+                                        sizeof(ply_rectangle_t));
+
+        /* small overlapping damage, like many sprites moving at once */
+        for (i = 0; i < NUMBER_OF_REGION_RECTANGLES; i++) {
+                benchmark->rectangles[i].x = get_random_number () % benchmark->width;
+                benchmark->rectangles[i].y = get_random_number () % benchmark->height;
+                benchmark->rectangles[i].width = 8 + get_random_number () % 120;
+                benchmark->rectangles[i].height = 8 + get_random_number () % 120;
+        }
+
+        benchmark->pixels_per_run = 0;
+        benchmark->operations_per_run = NUMBER_OF_REGION_RECTANGLES;
+}
+
+static void
+run_region (benchmark_t *benchmark)
+{
+        int i;
+
+        for (i = 0; i < NUMBER_OF_REGION_RECTANGLES; i++) {
+                ply_region_add_rectangle (benchmark->region,
+                                          &benchmark->rectangles[i]);
+        }
+}
+
+static ply_renderer_type_t
+get_renderer_type (void)
+{
+        const char *name;
+
+        name = getenv ("PLY_BENCHMARK_RENDERER");
+
+        if (name == NULL || strcmp (name, "offscreen") == 0)
+                return PLY_RENDERER_TYPE_OFFSCREEN;
+        if (strcmp (name, "drm") == 0)
+                return PLY_RENDERER_TYPE_DRM;
+        if (strcmp (name, "frame-buffer") == 0)
+                return PLY_RENDERER_TYPE_FRAME_BUFFER;
+
+        return PLY_RENDERER_TYPE_NONE;
+}
+
+static bool
+prepare_renderer (benchmark_t *benchmark)
+{
+        ply_renderer_type_t type;
+        char *heads;
+        ply_list_node_t *node;
+
+        type = get_renderer_type ();
+        if (type == PLY_RENDERER_TYPE_NONE)
+                return false;
+
+        /* only the offscreen renderer takes its head size from here,
+         * the others flush at whatever size the hardware is
+         */
+        asprintf (&heads, "%lux%lu@%d", benchmark->width, benchmark->height,
+                  benchmark->scale);
+        setenv ("PLY_OFFSCREEN_HEADS", heads, true);
+        free (heads);
+
+        benchmark->renderer = ply_renderer_new (type, NULL, NULL);
+
+        if (!ply_renderer_open (benchmark->renderer)) {
+                ply_renderer_free (benchmark->renderer);
+                benchmark->renderer = NULL;
+                return false;
+        }
+
+        node = ply_list_get_first_node (ply_renderer_get_heads (benchmark->renderer));
+        if (node == NULL) {
+                ply_renderer_close (benchmark->renderer);
+                ply_renderer_free (benchmark->renderer);
+                benchmark->renderer = NULL;
+                return false;
+        }
+
+        benchmark->head = ply_list_node_get_data (node);
+        benchmark->canvas = ply_pixel_buffer_ref (ply_renderer_get_buffer_for_head (benchmark->renderer,
+                                                                                   benchmark->head));
+        return true;
+}
+
+static void
+prepare_flush (benchmark_t *benchmark)
+{
+        unsigned long width, height;
+
+        if (benchmark->canvas == NULL) {
+                if (!prepare_renderer (benchmark))
+                        return;
+
+                width = ply_pixel_buffer_get_width (benchmark->canvas);
+                height = ply_pixel_buffer_get_height (benchmark->canvas);
+
+                if (benchmark->area.width == 0) {
+                        benchmark->area.width = width;
+                        benchmark->area.height = height;
+                } else {
+                        benchmark->area.x = (width - benchmark->area.width) / 2;
+                        benchmark->area.y = (height - benchmark->area.height) / 2;
+                }
+
+                benchmark->pixels_per_run = benchmark->area.width * benchmark->area.height *
+                                            ply_pixel_buffer_get_device_scale (benchmark->canvas) *
+                                            ply_pixel_buffer_get_device_scale (benchmark->canvas);
+        }
+
+        /* damage the area without timing it, so only the flush counts */
+        ply_pixel_buffer_fill_with_hex_color (benchmark->canvas, &benchmark->area,
+                                              get_random_number () & 0xffffff);
+}
+
+static void
+run_flush (benchmark_t *benchmark)
+{
+        ply_renderer_flush_head (benchmark->renderer, benchmark->head);
+}
+
+static void
+free_benchmark (benchmark_t *benchmark)
+{
+        ply_pixel_buffer_free (benchmark->canvas);
+        ply_pixel_buffer_free (benchmark->image);
+
+        if (benchmark->region != NULL)
+                ply_region_free (benchmark->region);
+        free (benchmark->rectangles);
+
+        if (benchmark->renderer != NULL) {
+                ply_renderer_close (benchmark->renderer);
+                ply_renderer_free (benchmark->renderer);
+        }
+}
+
+static void
+run_benchmark (benchmark_t *benchmark,
+               double       time_per_case)
+{
+        unsigned long iterations = 0;
+        double start_time, total_time = 0.0;
+        double nanoseconds_per_operation, megapixels_per_second;
+
+        if (benchmark->scale == 0)
+                benchmark->scale = 1;
+        if (benchmark->operations_per_run == 0)
+                benchmark->operations_per_run = 1;
+
+        /* one untimed run to warm up caches and pools */
+        benchmark->prepare (benchmark);
+
+        if (benchmark->run == run_flush && benchmark->renderer == NULL) {
+                printf ("# %s skipped, could not open renderer\n", benchmark->name);
+                return;
+        }
+
+        benchmark->run (benchmark);
+
+        while (total_time < time_per_case) {
+                benchmark->prepare (benchmark);
+
+                start_time = ply_get_timestamp ();
+                benchmark->run (benchmark);
+                total_time += ply_get_timestamp () - start_time;
+
+                iterations++;
+        }
+
+        nanoseconds_per_operation = total_time * 1e9 / (iterations * benchmark->operations_per_run);
+        megapixels_per_second = (double) benchmark->pixels_per_run * iterations / total_time / 1e6;
+
+        printf ("%s %lu %.1f %.1f\n", benchmark->name, iterations,
+                nanoseconds_per_operation, megapixels_per_second);
+        fflush (stdout);
+}
+
+static bool
+should_run_benchmark (benchmark_t *benchmark,
+                      int          argc,
+                      char       **argv)
+{
+        int i;
+
+        if (argc < 2)
+                return true;
+
+        for (i = 1; i < argc; i++) {
+                if (strstr (benchmark->name, argv[i]) != NULL)
+                        return true;
+        }
+
+        return false;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        benchmark_t benchmarks[] =
+        {
+                { "fill-argb32-opaque-1080p",       prepare_fill_with_argb32_data,        run_fill_with_argb32_data,        1920, 1080, 1, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           1.0 },
+                { "fill-argb32-opaque-4k",          prepare_fill_with_argb32_data,        run_fill_with_argb32_data,        3840, 2160, 1, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           1.0 },
+                { "fill-argb32-half-1080p",         prepare_fill_with_argb32_data,        run_fill_with_argb32_data,        1920, 1080, 1, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           0.5 },
+                { "fill-argb32-half-4k",            prepare_fill_with_argb32_data,        run_fill_with_argb32_data,        3840, 2160, 1, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           0.5 },
+                { "fill-argb32-opaque-1080p-cw",    prepare_fill_with_argb32_data,        run_fill_with_argb32_data,        1920, 1080, 1, PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE,         1.0 },
+                { "fill-argb32-opaque-1080p-ud",    prepare_fill_with_argb32_data,        run_fill_with_argb32_data,        1920, 1080, 1, PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN,       1.0 },
+                { "fill-argb32-opaque-4k-scale2",   prepare_fill_with_argb32_data,        run_fill_with_argb32_data,        3840, 2160, 2, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           1.0 },
+                { "fill-argb32-half-4k-scale2",     prepare_fill_with_argb32_data,        run_fill_with_argb32_data,        3840, 2160, 2, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           0.5 },
+                { "fill-argb32-hidpi-4k-scale2",    prepare_fill_with_scaled_argb32_data, run_fill_with_scaled_argb32_data, 3840, 2160, 2, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           1.0 },
+                { "fill-gradient-1080p",            prepare_canvas,                       run_fill_with_gradient,           1920, 1080, 1, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           1.0 },
+                { "fill-gradient-4k",               prepare_canvas,                       run_fill_with_gradient,           3840, 2160, 1, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           1.0 },
+                { "fill-gradient-4k-scale2",        prepare_canvas,                       run_fill_with_gradient,           3840, 2160, 2, PLY_PIXEL_BUFFER_ROTATE_UPRIGHT,           1.0 },
+                { "resize-up-1080p-to-4k",          prepare_resize_up,                    run_resize_up,                    1920, 1080 },
+                { "resize-down-4k-to-1080p",        prepare_resize_down,                  run_resize_down,                  3840, 2160 },
+                { "rotate-256",                     prepare_rotate,                       run_rotate,                        256,  256 },
+                { "rotate-1080p",                   prepare_rotate,                       run_rotate,                       1920, 1080 },
+                { "tile-64-to-1080p",               prepare_tile,                         run_tile,                         1920, 1080 },
+                { "tile-64-to-4k",                  prepare_tile,                         run_tile,                         3840, 2160 },
+                { "region-add-rectangle-1080p",     prepare_region,                       run_region,                       1920, 1080 },
+                { "region-add-rectangle-4k",        prepare_region,                       run_region,                       3840, 2160 },
+                { "flush-full-1080p",               prepare_flush,                        run_flush,                        1920, 1080, 1 },
+                { "flush-full-4k",                  prepare_flush,                        run_flush,                        3840, 2160, 1 },
+                { "flush-full-4k-scale2",           prepare_flush,                        run_flush,                        3840, 2160, 2 },
+                { "flush-partial-256-1080p",        prepare_flush,                        run_flush,                        1920, 1080, 1, .area = { 0, 0, 256, 256 } },
+                { "flush-partial-256-4k",           prepare_flush,                        run_flush,                        3840, 2160, 1, .area = { 0, 0, 256, 256 } },
+        };
+        const char *value;
+        double time_per_case = DEFAULT_TIME_PER_CASE;
+        size_t i;
+
+        value = getenv ("PLY_BENCHMARK_TIME");
+        if (value != NULL && strtod (value, NULL) > 0.0)
+                time_per_case = strtod (value, NULL);
+
+        printf ("# name iterations ns_per_op mpix_per_s\n");
+
+        for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+                if (!should_run_benchmark (&benchmarks[i], argc, argv))
+                        continue;
+
+                run_benchmark (&benchmarks[i], time_per_case);
+                free_benchmark (&benchmarks[i]);
+        }
+
+        return 0;
+}
@@ -0,0 +1,137 @@
+/* plymouth-cache-images.c - saves decoded theme images for fast loading
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "ply-image.h"
+
+static bool
+has_suffix (const char *name,
+            const char *suffix)
+{
+        size_t name_length, suffix_length;
+
+        name_length = strlen (name);
+        suffix_length = strlen (suffix);
+
+        if (name_length <= suffix_length)
+                return false;
+
+        return strcmp (name + name_length - suffix_length, suffix) == 0;
+}
+
+static bool
+cache_image (const char *filename)
+{
+        ply_image_t *image;
+        bool ret = false;
+
+        image = ply_image_new (filename);
+
+        if (!ply_image_load (image))
+                fprintf (stderr, "could not load %s\n", filename);
+        else if (!ply_image_save_cache (image))
+                fprintf (stderr, "could not save decoded %s: %m\n", filename);
+        else
+                ret = true;
+
+        ply_image_free (image);
+
+        return ret;
+}
+
+static bool
+cache_images_in_directory (const char *directory)
+{
+        struct dirent **entries;
+        int number_of_entries, i;
+        bool ret = true;
+
+        number_of_entries = scandir (directory, &entries, NULL, alphasort);
+
+        if (number_of_entries < 0) {
+                fprintf (stderr, "could not read %s: %m\n", directory);
+                return false;
+        }
+
+        for (i = 0; i < number_of_entries; i++) {
+                struct stat file_info;
+                char *filename;
+
+                if (entries[i]->d_name[0] == '.') {
+                        free (entries[i]);
+                        continue;
+                }
+
+                asprintf (&filename, "%s/%s", directory, entries[i]->d_name);
+
+                if (stat (filename, &file_info) == 0) {
+                        if (S_ISDIR (file_info.st_mode)) {
+                                if (!cache_images_in_directory (filename))
+                                        ret = false;
+                        } else if (has_suffix (filename, ".png")) {
+                                if (!cache_image (filename))
+                                        ret = false;
+                        }
+                }
+
+                free (filename);
+                free (entries[i]);
+        }
+        free (entries);
+
+        return ret;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        bool ret = true;
+        int i;
+
+        if (argc < 2) {
+                fprintf (stderr, "usage: %s DIRECTORY|IMAGE...\n", argv[0]);
+                return 1;
+        }
+
+        for (i = 1; i < argc; i++) {
+                struct stat file_info;
+
+                if (stat (argv[i], &file_info) < 0) {
+                        fprintf (stderr, "could not find %s: %m\n", argv[i]);
+                        ret = false;
+                } else if (S_ISDIR (file_info.st_mode)) {
+                        if (!cache_images_in_directory (argv[i]))
+                                ret = false;
+                } else if (!cache_image (argv[i])) {
+                        ret = false;
+                }
+        }
+
+        return ret ? 0 : 1;
+}
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
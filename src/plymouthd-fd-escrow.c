@@ -1,4 +1,5 @@
 #include <signal.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 int
@@ -12,6 +13,13 @@ main(int argc, char **argv)
          */
         argv[0][0] = '@';
 
+        /* When the splash got handed over at boot, the display server only
+         * needs the frame until its own first one is up, so let the fds go
+         * after a while, rather than keeping the memory until shutdown.
+         */
+        if (argc > 1)
+                alarm (atoi (argv[1]));
+
         while (pause());
 
         return 0;
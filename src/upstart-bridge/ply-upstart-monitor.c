@@ -43,12 +43,28 @@ typedef struct
         DBusTimeout           *timeout;
 } ply_upstart_monitor_timeout_t;
 
+/* A method call that's waiting to be sent, or for its reply.  The job or
+ * instance it's about keeps it on its pending_calls list, so it can be
+ * dropped if that goes away first.
+ */
+typedef struct
+{
+        ply_upstart_monitor_t        *monitor;
+        DBusMessage                  *message;
+        DBusPendingCall              *pending_call;
+        DBusPendingCallNotifyFunction handler;
+        void                         *user_data;
+        ply_list_t                   *owner_calls;
+} ply_upstart_monitor_call_t;
+
 struct _ply_upstart_monitor
 {
         DBusConnection                             *connection;
         ply_event_loop_t                           *loop;
         ply_hashtable_t                            *jobs;
         ply_hashtable_t                            *all_instances;
+        ply_list_t                                 *queued_calls;
+        int                                         number_of_calls_in_flight;
         ply_upstart_monitor_state_changed_handler_t state_changed_handler;
         void                                       *state_changed_data;
         ply_upstart_monitor_failed_handler_t        failed_handler;
@@ -80,6 +96,12 @@ typedef struct
 #define UPSTART_INTERFACE_0_6_JOB       "com.ubuntu.Upstart0_6.Job"
 #define UPSTART_INTERFACE_0_6_INSTANCE  "com.ubuntu.Upstart0_6.Instance"
 
+/* Upstart answers one call at a time anyway, so sending more than this
+ * before replies come back only fills up the bus.  The rest wait their
+ * turn.
+ */
+#define MAX_CALLS_IN_FLIGHT             16
+
 /* Remove an entry from a hashtable, free the key, and return the data. */
 static void *
 hashtable_remove_and_free_key (ply_hashtable_t *hashtable,
@@ -96,6 +118,128 @@ hashtable_remove_and_free_key (ply_hashtable_t *hashtable,
         return reply_data;
 }
 
+static void send_queued_calls (ply_upstart_monitor_t *monitor);
+
+static void
+free_call (ply_upstart_monitor_call_t *call)
+{
+        if (call->owner_calls != NULL)
+                ply_list_remove_data (call->owner_calls, call);
+
+        if (call->message != NULL)
+                dbus_message_unref (call->message);
+
+        if (call->pending_call != NULL)
+                dbus_pending_call_unref (call->pending_call);
+
+        free (call);
+}
+
+static void
+on_call_finished (DBusPendingCall            *pending_call,
+                  ply_upstart_monitor_call_t *call)
+{
+        ply_upstart_monitor_t *monitor = call->monitor;
+
+        monitor->number_of_calls_in_flight--;
+
+        /* The handler may drop the job or instance the call was about, so
+         * the call stops being theirs first
+         */
+        if (call->owner_calls != NULL) {
+                ply_list_remove_data (call->owner_calls, call);
+                call->owner_calls = NULL;
+        }
+
+        call->handler (pending_call, call->user_data);
+        free_call (call);
+
+        send_queued_calls (monitor);
+}
+
+static void
+send_queued_calls (ply_upstart_monitor_t *monitor)
+{
+        ply_list_node_t *node;
+
+        while (monitor->number_of_calls_in_flight < MAX_CALLS_IN_FLIGHT &&
+               (node = ply_list_get_first_node (monitor->queued_calls)) != NULL) {
+                ply_upstart_monitor_call_t *call;
+
+                call = ply_list_node_get_data (node);
+                ply_list_remove_node (monitor->queued_calls, node);
+
+                if (!dbus_connection_send_with_reply (monitor->connection, call->message,
+                                                      &call->pending_call, -1) ||
+                    call->pending_call == NULL) {
+                        ply_trace ("could not send %s call to %s",
+                                   dbus_message_get_member (call->message),
+                                   dbus_message_get_path (call->message));
+                        free_call (call);
+                        continue;
+                }
+
+                dbus_message_unref (call->message);
+                call->message = NULL;
+
+                dbus_pending_call_set_notify (call->pending_call,
+                                              (DBusPendingCallNotifyFunction)
+                                              on_call_finished,
+                                              call, NULL);
+                monitor->number_of_calls_in_flight++;
+        }
+}
+
+/* Takes over message, and calls handler with the reply once it's in */
+static void
+queue_call (ply_upstart_monitor_t        *monitor,
+            ply_list_t                   *owner_calls,
+            DBusMessage                  *message,
+            DBusPendingCallNotifyFunction handler,
+            void                         *user_data)
+{
+        ply_upstart_monitor_call_t *call;
+
+        call = calloc (1, sizeof(ply_upstart_monitor_call_t));
+        call->monitor = monitor;
+        call->message = message;
+        call->handler = handler;
+        call->user_data = user_data;
+        call->owner_calls = owner_calls;
+
+        if (owner_calls != NULL)
+                ply_list_append_data (owner_calls, call);
+
+        ply_list_append_data (monitor->queued_calls, call);
+        send_queued_calls (monitor);
+}
+
+static void
+cancel_calls (ply_upstart_monitor_t *monitor,
+              ply_list_t            *calls)
+{
+        ply_list_node_t *node;
+
+        while ((node = ply_list_get_first_node (calls)) != NULL) {
+                ply_upstart_monitor_call_t *call;
+
+                call = ply_list_node_get_data (node);
+
+                if (call->pending_call != NULL) {
+                        dbus_pending_call_cancel (call->pending_call);
+                        monitor->number_of_calls_in_flight--;
+                } else {
+                        ply_list_remove_data (monitor->queued_calls, call);
+                }
+
+                free_call (call);
+        }
+
+        ply_list_free (calls);
+
+        send_queued_calls (monitor);
+}
+
 /* We assume, in general, that Upstart responds to D-Bus messages in a
  * single thread, and that it processes messages on a given connection in
  * the order in which they were sent.  Taken together, these assumptions
@@ -284,25 +428,13 @@ static void
 remove_instance_internal (ply_upstart_monitor_job_t *job, const char *path)
 {
         ply_upstart_monitor_instance_t *instance;
-        ply_list_node_t *node;
 
         instance = hashtable_remove_and_free_key (job->instances, path);
         if (instance == NULL)
                 return;
         hashtable_remove_and_free_key (job->monitor->all_instances, path);
 
-        node = ply_list_get_first_node (instance->pending_calls);
-        while (node != NULL) {
-                DBusPendingCall *call;
-                ply_list_node_t *next_node;
-
-                call = ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (instance->pending_calls, node);
-                dbus_pending_call_cancel (call);
-                dbus_pending_call_unref (call);
-                node = next_node;
-        }
-        ply_list_free (instance->pending_calls);
+        cancel_calls (job->monitor, instance->pending_calls);
 
         free (instance->properties.name);
         free (instance->properties.goal);
@@ -317,11 +449,16 @@ add_instance (ply_upstart_monitor_job_t *job,
         ply_upstart_monitor_instance_t *instance;
         DBusMessage *message;
         const char *interface = UPSTART_INTERFACE_0_6_INSTANCE;
-        DBusPendingCall *call;
 
-        ply_trace ("adding instance: %s", path);
+        /* Instances that show up in both GetAllInstances and an
+         * InstanceAdded signal only need their properties fetched once
+         */
+        if (ply_hashtable_lookup (job->instances, (void *) path) != NULL) {
+                ply_trace ("already watching instance: %s", path);
+                return;
+        }
 
-        remove_instance_internal (job, path);
+        ply_trace ("adding instance: %s", path);
 
         instance = calloc (1, sizeof(ply_upstart_monitor_instance_t));
         instance->job = job;
@@ -349,16 +486,10 @@ add_instance (ply_upstart_monitor_job_t *job,
         dbus_message_append_args (message,
                                   DBUS_TYPE_STRING, &interface,
                                   DBUS_TYPE_INVALID);
-        dbus_connection_send_with_reply (job->monitor->connection, message,
-                                         &call, -1);
-        dbus_message_unref (message);
-        if (call != NULL) {
-                dbus_pending_call_set_notify (call,
-                                              (DBusPendingCallNotifyFunction)
-                                              on_get_all_instance_properties_finished,
-                                              instance, NULL);
-                ply_list_append_data (instance->pending_calls, call);
-        }
+        queue_call (job->monitor, instance->pending_calls, message,
+                    (DBusPendingCallNotifyFunction)
+                    on_get_all_instance_properties_finished,
+                    instance);
 }
 
 static void
@@ -420,6 +551,7 @@ free_job_instance (void *key, void *data, void *user_data)
                 return;
 
         hashtable_remove_and_free_key (monitor->all_instances, path);
+        cancel_calls (monitor, instance->pending_calls);
         free (instance->properties.name);
         free (instance->properties.goal);
         free (instance->properties.state);
@@ -430,24 +562,12 @@ static void
 remove_job_internal (ply_upstart_monitor_t *monitor, const char *path)
 {
         ply_upstart_monitor_job_t *job;
-        ply_list_node_t *node;
 
         job = hashtable_remove_and_free_key (monitor->jobs, path);
         if (job == NULL)
                 return;
 
-        node = ply_list_get_first_node (job->pending_calls);
-        while (node != NULL) {
-                DBusPendingCall *call;
-                ply_list_node_t *next_node;
-
-                call = ply_list_node_get_data (node);
-                next_node = ply_list_get_next_node (job->pending_calls, node);
-                dbus_pending_call_cancel (call);
-                dbus_pending_call_unref (call);
-                node = next_node;
-        }
-        ply_list_free (job->pending_calls);
+        cancel_calls (monitor, job->pending_calls);
 
         free (job->properties.name);
         free (job->properties.description);
@@ -462,11 +582,14 @@ add_job (ply_upstart_monitor_t *monitor, const char *path)
         ply_upstart_monitor_job_t *job;
         DBusMessage *message;
         const char *interface = UPSTART_INTERFACE_0_6_JOB;
-        DBusPendingCall *call;
 
-        ply_trace ("adding job: %s", path);
+        /* Jobs added while GetAllJobs was in flight show up twice */
+        if (ply_hashtable_lookup (monitor->jobs, (void *) path) != NULL) {
+                ply_trace ("already watching job: %s", path);
+                return;
+        }
 
-        remove_job_internal (monitor, path);
+        ply_trace ("adding job: %s", path);
 
         job = calloc (1, sizeof(ply_upstart_monitor_job_t));
         job->monitor = monitor;
@@ -486,32 +609,20 @@ add_job (ply_upstart_monitor_t *monitor, const char *path)
         dbus_message_append_args (message,
                                   DBUS_TYPE_STRING, &interface,
                                   DBUS_TYPE_INVALID);
-        dbus_connection_send_with_reply (monitor->connection, message, &call, -1);
-        dbus_message_unref (message);
-        if (call != NULL) {
-                dbus_pending_call_set_notify (call,
-                                              (DBusPendingCallNotifyFunction)
-                                              on_get_all_job_properties_finished,
-                                              job,
-                                              NULL);
-                ply_list_append_data (job->pending_calls, call);
-        }
+        queue_call (monitor, job->pending_calls, message,
+                    (DBusPendingCallNotifyFunction)
+                    on_get_all_job_properties_finished,
+                    job);
 
         /* Ask Upstart for a list of all instances of this job. */
         ply_trace ("calling GetAllInstances on job %s", path);
         message = dbus_message_new_method_call (UPSTART_SERVICE, path,
                                                 UPSTART_INTERFACE_0_6_JOB,
                                                 "GetAllInstances");
-        dbus_connection_send_with_reply (monitor->connection, message, &call, -1);
-        dbus_message_unref (message);
-        if (call != NULL) {
-                dbus_pending_call_set_notify (call,
-                                              (DBusPendingCallNotifyFunction)
-                                              on_get_all_instances_finished,
-                                              job,
-                                              NULL);
-                ply_list_append_data (job->pending_calls, call);
-        }
+        queue_call (monitor, job->pending_calls, message,
+                    (DBusPendingCallNotifyFunction)
+                    on_get_all_instances_finished,
+                    job);
 }
 
 static void
@@ -789,7 +900,6 @@ ply_upstart_monitor_new (ply_event_loop_t *loop)
         DBusConnection *connection;
         ply_upstart_monitor_t *monitor;
         DBusMessage *message;
-        DBusPendingCall *call;
 
         dbus_error_init (&error);
 
@@ -811,6 +921,7 @@ ply_upstart_monitor_new (ply_event_loop_t *loop)
                                            ply_hashtable_string_compare);
         monitor->all_instances = ply_hashtable_new (ply_hashtable_string_hash,
                                                     ply_hashtable_string_compare);
+        monitor->queued_calls = ply_list_new ();
         monitor->state_changed_handler = NULL;
         monitor->state_changed_data = NULL;
         monitor->failed_handler = NULL;
@@ -827,14 +938,10 @@ ply_upstart_monitor_new (ply_event_loop_t *loop)
         message = dbus_message_new_method_call (UPSTART_SERVICE, UPSTART_PATH,
                                                 UPSTART_INTERFACE_0_6,
                                                 "GetAllJobs");
-        dbus_connection_send_with_reply (monitor->connection, message, &call, -1);
-        dbus_message_unref (message);
-        if (call != NULL) {
-                dbus_pending_call_set_notify (call,
-                                              (DBusPendingCallNotifyFunction)
-                                              on_get_all_jobs_finished,
-                                              monitor, NULL);
-        }
+        queue_call (monitor, NULL, message,
+                    (DBusPendingCallNotifyFunction)
+                    on_get_all_jobs_finished,
+                    monitor);
 
         if (loop != NULL)
                 ply_upstart_monitor_connect_to_event_loop (monitor, loop);
@@ -850,6 +957,7 @@ ply_upstart_monitor_free (ply_upstart_monitor_t *monitor)
 
         ply_hashtable_free (monitor->all_instances);
         ply_hashtable_free (monitor->jobs);
+        ply_list_free (monitor->queued_calls);
         dbus_connection_unref (monitor->connection);
         if (monitor->dispatch_fd >= 0)
                 close (monitor->dispatch_fd);
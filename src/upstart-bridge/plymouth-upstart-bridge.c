@@ -140,6 +140,13 @@ unset_fg_color (void)
         fputs (terminal_string, stdout);
 }
 
+static void
+flush_status (state_t          *state,
+              ply_event_loop_t *loop)
+{
+        fflush (stdout);
+}
+
 static void
 update_status (state_t                                   *state,
                ply_upstart_monitor_job_properties_t      *job,
@@ -190,6 +197,13 @@ update_status (state_t                                   *state,
                 else
                         puts ("   ...fail!");
         }
+
+        /* A burst of job changes comes in on one wakeup, so it gets
+         * written out in one go once the loop is done with them
+         */
+        ply_event_loop_watch_for_idle (state->loop,
+                                       (ply_event_loop_idle_handler_t)
+                                       flush_status, state);
 }
 
 static void
@@ -296,6 +310,8 @@ main (int    argc,
         int errret = 0;
         setupterm (NULL, STDOUT_FILENO, &errret);
 
+        setvbuf (stdout, NULL, _IOFBF, 0);
+
         is_connected = ply_boot_client_connect (state.client,
                                                 (ply_boot_client_disconnect_handler_t)
                                                 on_disconnect, &state);